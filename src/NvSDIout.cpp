@@ -59,6 +59,17 @@ CNvSDIout::CNvSDIout() : m_bInitialized(false)
         _sdi_tex[i] = 0;
     }
     _sdi_fbo = 0;
+    for (int i = 0; i < query_ring_size; i++)
+    {
+        _present_time_queries[i] = 0;
+        _present_duration_queries[i] = 0;
+    }
+    _query_first = 0;
+    _query_count = 0;
+    _queued_frames = 0;
+    _frames_sent = 0;
+    _frames_repeated = 0;
+    _frames_skipped = 0;
 }
 
 CNvSDIout::~CNvSDIout()
@@ -192,12 +203,30 @@ void CNvSDIout::init(int videoFormat) {
     glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
     assert(glGetError() == GL_NO_ERROR);
 
+    glGenQueries(query_ring_size, _present_time_queries);
+    glGenQueries(query_ring_size, _present_duration_queries);
+    _query_first = 0;
+    _query_count = 0;
+    _queued_frames = 0;
+    assert(glGetError() == GL_NO_ERROR);
+
     m_bInitialized = true;
 }
 
 void CNvSDIout::deinit() {
     m_bInitialized = false;
 
+    if (_present_time_queries[0] != 0)
+    {
+        glDeleteQueries(query_ring_size, _present_time_queries);
+        glDeleteQueries(query_ring_size, _present_duration_queries);
+        for (int i = 0; i < query_ring_size; i++)
+        {
+            _present_time_queries[i] = 0;
+            _present_duration_queries[i] = 0;
+        }
+    }
+
     glDeleteFramebuffersEXT(1, &_sdi_fbo);
     _sdi_fbo = 0;
 
@@ -282,18 +311,72 @@ bool CNvSDIout::destroyOutputDeviceNVCtrl()
 }
 
 
+void CNvSDIout::updateQueueState()
+{
+    // A frame is finished when its presentation duration is known, i.e. when
+    // the next frame replaced it on the output. Frames finish in order.
+    while (_query_count > 0)
+    {
+        GLuint available = 0;
+        glGetQueryObjectuiv(_present_duration_queries[_query_first], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+        GLuint duration = 0;
+        glGetQueryObjectuiv(_present_duration_queries[_query_first], GL_QUERY_RESULT, &duration);
+        if (duration > 1)
+            _frames_repeated += duration - 1;
+        _query_first = (_query_first + 1) % query_ring_size;
+        _query_count--;
+    }
+    // Of the unfinished frames, the ones that did not start to be displayed yet are queued.
+    _queued_frames = 0;
+    for (int i = 0; i < _query_count; i++)
+    {
+        GLuint available = 0;
+        glGetQueryObjectuiv(_present_time_queries[(_query_first + i) % query_ring_size],
+                GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            _queued_frames++;
+    }
+}
+
+bool CNvSDIout::canSendTextures()
+{
+    assert(m_bInitialized);
+    updateQueueState();
+    return (_queued_frames < m_outputOptions.fql && _query_count < query_ring_size);
+}
+
 void CNvSDIout::sendTextures()
 {
     assert(glGetError() == GL_NO_ERROR);
     assert(m_bInitialized);
-    glPresentFrameDualFillNV(1, 0, 0, 0, GL_FRAME_NV,
+    GLuint time_query = 0;
+    GLuint duration_query = 0;
+    if (_query_count < query_ring_size)
+    {
+        int slot = (_query_first + _query_count) % query_ring_size;
+        time_query = _present_time_queries[slot];
+        duration_query = _present_duration_queries[slot];
+        _query_count++;
+    }
+    glPresentFrameDualFillNV(1, 0, time_query, duration_query, GL_FRAME_NV,
             GL_TEXTURE_2D, _sdi_tex[0],
             GL_NONE, 0,
             GL_TEXTURE_2D, _sdi_tex[1],
             GL_NONE, 0);
+    _frames_sent++;
     assert(glGetError() == GL_NO_ERROR);
 }
 
+void CNvSDIout::getStats(int *queued, int64_t *sent, int64_t *repeated, int64_t *skipped)
+{
+    *queued = _queued_frames;
+    *sent = _frames_sent;
+    *repeated = _frames_repeated;
+    *skipped = _frames_skipped;
+}
+
 void CNvSDIout::startRenderingTo(int textureIndex)
 {
     assert(m_bInitialized);
@@ -30,6 +30,8 @@
 #ifndef NVSDIOUT_H
 #define NVSDIOUT_H
 
+#include <stdint.h>
+
 #include <GL/glew.h>
 
 #if defined __cplusplus
@@ -67,6 +69,18 @@ private:
     GLuint _sdi_fbo;                    // framebuffer object to render into the sRGB texture
     GLuint _sdi_tex[2];                 // output: SRGB8 or linear RGB16 texture
 
+    // Presentation queries of the frames that were sent to the device, to
+    // find out how many frames wait in its output queue without blocking.
+    static const int query_ring_size = 8;       // must be larger than the flip queue length
+    GLuint _present_time_queries[query_ring_size];
+    GLuint _present_duration_queries[query_ring_size];
+    int _query_first;                   // oldest frame that is not finished yet
+    int _query_count;                   // number of frames that are not finished yet
+    int _queued_frames;                 // frames that wait to be displayed
+    int64_t _frames_sent;
+    int64_t _frames_repeated;           // additional displays of frames, because no new frame was available
+    int64_t _frames_skipped;            // frames that were not sent because the queue was full
+
 
 public:
 
@@ -77,13 +91,21 @@ public:
 	void deinit();
 	void reinit(int videoFormat);
 
+	// Check whether sendTextures() can queue another frame without blocking.
+	bool canSendTextures();
 	void sendTextures();
+	// Count a frame that was not sent because canSendTextures() returned false.
+	void skipFrame() { _frames_skipped++; }
+	// Get the output queue state and statistics.
+	void getStats(int *queued, int64_t *sent, int64_t *repeated, int64_t *skipped);
 
 	inline bool isInitialized() {return m_bInitialized; }
 
 	void startRenderingTo(int textureIndex);
 	void stopRenderingTo();
 
+    GLuint framebuffer() { return _sdi_fbo; }
+
     int width() { return m_videoWidth; }
     int height() { return m_videoHeight; }
 
@@ -91,6 +113,7 @@ public:
 
 private:
 
+	void updateQueueState();
 	void setOutputOptions(Display *display, const OutputOptions &outputOptions);
 	bool initOutputDeviceNVCtrl();
 	bool destroyOutputDeviceNVCtrl();
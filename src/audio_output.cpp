@@ -19,47 +19,65 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+
 #include "config.h"
 
+#include <algorithm>
 #include <limits>
+#include <cstring>
 
 #include "audio_output.h"
-#include "lib_versions.h"
+#include "audio_sink_openal.h"
+#if HAVE_LIBASOUND
+# include "audio_sink_alsa.h"
+#endif
 
 #include "base/exc.h"
 #include "base/str.h"
 #include "base/msg.h"
-#include "base/tmr.h"
 #include "base/dbg.h"
 
 #include "base/gettext.h"
 #define _(string) gettext(string)
 
 
-/* This code is adapted from the alffmpeg.c example available here:
- * http://kcat.strangesoft.net/alffmpeg.c (as of 2010-09-12). */
-
 // These number should fit for most formats; see comments in the alffmpeg.c example.
-const size_t audio_output::_num_buffers = 3;
-const size_t audio_output::_buffer_size = 20160 * 2;
+static const size_t default_num_buffers = 3;
+static const size_t default_buffer_size = 20160 * 2;
+// Low latency defaults, e.g. for live device input. At 48 kHz, stereo, 16 bit,
+// this queues about 140 ms of audio instead of about 630 ms.
+static const size_t low_latency_num_buffers = 4;
+static const size_t low_latency_buffer_size = 6720;
+// Buffer sizes must be a multiple of this so that each buffer holds complete
+// sample frames for all supported formats (1-8 channels, 1-8 bytes per sample).
+static const size_t buffer_size_granularity = 6720;
 
-audio_output::audio_output() : controller(), _initialized(false)
+audio_output::audio_output() : controller(),
+    _num_buffers(default_num_buffers), _buffer_size(default_buffer_size),
+    _sink(NULL), _speed(1.0), _block_speed(1.0), _resample_phase(0.0), _frame_size(1),
+    _block_device_time(0), _block_playback_time(0), _start_time(0)
 {
-    const char *p = NULL;
-    if (alcIsExtensionPresent(NULL, "ALC_ENUMERATE_ALL_EXT"))
-    {
-        p = alcGetString(NULL, ALC_ALL_DEVICES_SPECIFIER);
-    }
-    else if (alcIsExtensionPresent(NULL, "ALC_ENUMERATION_EXT"))
+    // The OpenAL sink comes first, so that the default device and the
+    // indices of OpenAL devices do not depend on the other sinks.
+    std::vector<std::string> prefixes;
+    _sinks.push_back(new audio_sink_openal);
+    prefixes.push_back("");
+#if HAVE_LIBASOUND
+    _sinks.push_back(new audio_sink_alsa);
+    prefixes.push_back("ALSA: ");
+#endif
+    for (size_t s = 0; s < _sinks.size(); s++)
     {
-        p = alcGetString(NULL, ALC_DEVICE_SPECIFIER);
-    }
-    while (p && *p)
-    {
-        _devices.push_back(p);
-        p += _devices.back().length() + 1;
+        std::vector<std::string> names;
+        _sinks[s]->list_devices(names);
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            _devices.push_back(prefixes[s] + names[i]);
+            _device_sinks.push_back(s);
+            _device_ids.push_back(names[i]);
+        }
     }
-    msg::dbg("%d OpenAL devices available:", devices());
+    msg::dbg("%d audio devices available:", devices());
     for (size_t i = 0; i < _devices.size(); i++)
     {
         msg::dbg(4, _devices[i]);
@@ -69,6 +87,10 @@ audio_output::audio_output() : controller(), _initialized(false)
 audio_output::~audio_output()
 {
     deinit();
+    for (size_t s = 0; s < _sinks.size(); s++)
+    {
+        delete _sinks[s];
+    }
 }
 
 int audio_output::devices() const
@@ -82,87 +104,42 @@ const std::string &audio_output::device_name(int i) const
     return _devices[i];
 }
 
-void audio_output::init(int i)
+float audio_output::gain() const
+{
+    return (dispatch::parameters().audio_mute() ? 0.0f : dispatch::parameters().audio_volume());
+}
+
+void audio_output::init(int i, bool low_latency)
 {
-    if (!_initialized)
+    if (!_sink)
     {
-        if (i < 0)
+        int num_buffers = dispatch::parameters().audio_buffers();
+        int buffer_size = dispatch::parameters().audio_buffer_size();
+        _num_buffers = (num_buffers > 0 ? num_buffers
+                : low_latency ? low_latency_num_buffers : default_num_buffers);
+        _buffer_size = (buffer_size > 0 ? buffer_size
+                : low_latency ? low_latency_buffer_size : default_buffer_size);
+        _buffer_size = std::max(_buffer_size / buffer_size_granularity, static_cast<size_t>(1))
+            * buffer_size_granularity;
+        msg::dbg("Using %d audio buffers of %d bytes each.",
+                static_cast<int>(_num_buffers), static_cast<int>(_buffer_size));
+        if (i >= static_cast<int>(_devices.size()))
         {
-            if (!(_device = alcOpenDevice(NULL)))
-            {
-                throw exc(_("No OpenAL device available."));
-            }
+            throw exc(str::asprintf(_("Audio device '%s' is not available."), _("unknown")));
         }
-        else if (i >= static_cast<int>(_devices.size()))
-        {
-            throw exc(str::asprintf(_("OpenAL device '%s' is not available."), _("unknown")));
-        }
-        else
-        {
-            if (!(_device = alcOpenDevice(_devices[i].c_str())))
-            {
-                throw exc(str::asprintf(_("OpenAL device '%s' is not available."),
-                            _devices[i].c_str()));
-            }
-        }
-        if (!(_context = alcCreateContext(_device, NULL)))
-        {
-            alcCloseDevice(_device);
-            throw exc(_("No OpenAL context available."));
-        }
-        alcMakeContextCurrent(_context);
-        set_openal_versions();
-        _buffers.resize(_num_buffers);
-        alGenBuffers(_num_buffers, &(_buffers[0]));
-        if (alGetError() != AL_NO_ERROR)
-        {
-            alcMakeContextCurrent(NULL);
-            alcDestroyContext(_context);
-            alcCloseDevice(_device);
-            throw exc(_("Cannot create OpenAL buffers."));
-        }
-        alGenSources(1, &_source);
-        if (alGetError() != AL_NO_ERROR)
-        {
-            alDeleteBuffers(_num_buffers, &(_buffers[0]));
-            alcMakeContextCurrent(NULL);
-            alcDestroyContext(_context);
-            alcCloseDevice(_device);
-            throw exc(_("Cannot create OpenAL source."));
-        }
-        /* Comment from alffmpeg.c:
-         * "Set parameters so mono sources won't distance attenuate" */
-        alSourcei(_source, AL_SOURCE_RELATIVE, AL_TRUE);
-        alSourcei(_source, AL_ROLLOFF_FACTOR, 0);
-        if (alGetError() != AL_NO_ERROR)
-        {
-            alDeleteSources(1, &_source);
-            alDeleteBuffers(_num_buffers, &(_buffers[0]));
-            alcMakeContextCurrent(NULL);
-            alcDestroyContext(_context);
-            alcCloseDevice(_device);
-            throw exc(_("Cannot set OpenAL source parameters."));
-        }
-        _state = 0;
-        _initialized = true;
+        audio_sink *sink = (i < 0 ? _sinks[0] : _sinks[_device_sinks[i]]);
+        sink->init(i < 0 ? std::string() : _device_ids[i], _num_buffers, _buffer_size);
+        sink->set_gain(gain());
+        _sink = sink;
     }
 }
 
 void audio_output::deinit()
 {
-    if (_initialized)
+    if (_sink)
     {
-        do
-        {
-            alGetSourcei(_source, AL_SOURCE_STATE, &_state);
-        }
-        while (alGetError() == AL_NO_ERROR && _state == AL_PLAYING);
-        alDeleteSources(1, &_source);
-        alDeleteBuffers(_num_buffers, &(_buffers[0]));
-        alcMakeContextCurrent(NULL);
-        alcDestroyContext(_context);
-        alcCloseDevice(_device);
-        _initialized = false;
+        _sink->deinit();
+        _sink = NULL;
     }
 }
 
@@ -173,325 +150,175 @@ size_t audio_output::required_initial_data_size() const
 
 size_t audio_output::required_update_data_size() const
 {
-    return _buffer_size;
+    if (_block_speed == 1.0 && _resample_input.empty())
+    {
+        return _buffer_size;
+    }
+    // The next block interpolates between the input frames up to the one after
+    // its last position; some of them may be left from the previous block.
+    size_t frames = _buffer_size / _frame_size;
+    size_t needed = static_cast<size_t>(_resample_phase + frames * _block_speed) + 2;
+    size_t available = _resample_input.size() / _frame_size;
+    return (needed > available ? (needed - available) * _frame_size : 0);
 }
 
 int64_t audio_output::status(bool *need_data)
 {
-    if (_state == 0)
+    assert(_sink);
+    int64_t device_time = _sink->status(need_data);
+    if (device_time == std::numeric_limits<int64_t>::min() || _block_times.empty())
     {
-        if (need_data)
-        {
-            *need_data = true;
-        }
-        return std::numeric_limits<int64_t>::min();
+        return device_time;
     }
-    else
+    // Find the block that is playing, and interpolate its playback time.
+    int64_t t = device_time - _start_time;
+    while (_block_times.size() > 1 && _block_times.front().device_end <= t)
     {
-        ALint processed = 0;
-        alGetSourcei(_source, AL_BUFFERS_PROCESSED, &processed);
-        if (processed == 0)
-        {
-            alGetSourcei(_source, AL_SOURCE_STATE, &_state);
-            if (alGetError() != AL_NO_ERROR)
-            {
-                throw exc(_("Cannot check OpenAL source state."));
-            }
-            if (_state != AL_PLAYING)
-            {
-                alSourcePlay(_source);
-                if (alGetError() != AL_NO_ERROR)
-                {
-                    throw exc(_("Cannot restart OpenAL source playback."));
-                }
-            }
-            if (need_data)
-            {
-                *need_data = false;
-            }
-        }
-        else
-        {
-            if (need_data)
-            {
-                *need_data = true;
-            }
-        }
-        ALint offset;
-        alGetSourcei(_source, AL_SAMPLE_OFFSET, &offset);
-        /* The time inside the current buffer */
-        int64_t timestamp = static_cast<int64_t>(offset) * 1000000 / _buffer_rates[0];
-        /* Add the time for all past buffers */
-        timestamp += _past_time;
-        /* This timestamp unfortunately only grows in relatively large steps. This is
-         * too imprecise for syncing a video stream with. Therefore, we use an external
-         * time source between two timestamp steps. In case this external time runs
-         * faster than the audio time, we also need to make sure that we do not report
-         * timestamps that run backwards. */
-        if (timestamp != _last_timestamp)
-        {
-            _last_timestamp = timestamp;
-            _ext_timer_at_last_timestamp = timer::get(timer::monotonic);
-            _last_reported_timestamp = std::max(_last_reported_timestamp, timestamp);
-            return _last_reported_timestamp;
-        }
-        else
-        {
-            _last_reported_timestamp = _last_timestamp + (timer::get(timer::monotonic) - _ext_timer_at_last_timestamp);
-            return _last_reported_timestamp;
-        }
+        _block_times.pop_front();
     }
+    const block_time &b = _block_times.front();
+    int64_t playback_time;
+    if (t <= b.device_start)
+        playback_time = b.playback_start - (b.device_start - t);
+    else if (t >= b.device_end)
+        playback_time = b.playback_end + (t - b.device_end);
+    else
+        playback_time = b.playback_start + (t - b.device_start)
+            * (b.playback_end - b.playback_start) / (b.device_end - b.device_start);
+    return _start_time + playback_time;
 }
 
-ALenum audio_output::get_al_format(const audio_blob &blob)
+// Resample interleaved frames by linear interpolation. Output frame j is taken
+// from the position phase + j * speed in the input frames.
+template<typename T>
+static void resample(const void *in, void *out, int channels, size_t out_frames,
+        double phase, double speed)
 {
-    ALenum format = 0;
-    if (blob.sample_format == audio_blob::u8)
+    const T *src = static_cast<const T *>(in);
+    T *dst = static_cast<T *>(out);
+    for (size_t j = 0; j < out_frames; j++)
     {
-        if (blob.channels == 1)
-        {
-            format = AL_FORMAT_MONO8;
-        }
-        else if (blob.channels == 2)
+        double x = phase + j * speed;
+        size_t i = x;
+        double f = x - i;
+        const T *a = src + i * channels;
+        const T *b = a + channels;
+        for (int c = 0; c < channels; c++)
         {
-            format = AL_FORMAT_STEREO8;
-        }
-        else if (alIsExtensionPresent("AL_EXT_MCFORMATS"))
-        {
-            if (blob.channels == 4)
-            {
-                format = alGetEnumValue("AL_FORMAT_QUAD8");
-            }
-            else if (blob.channels == 6)
-            {
-                format = alGetEnumValue("AL_FORMAT_51CHN8");
-            }
-            else if (blob.channels == 7)
-            {
-                format = alGetEnumValue("AL_FORMAT_71CHN8");
-            }
-            else if (blob.channels == 8)
-            {
-                format = alGetEnumValue("AL_FORMAT_81CHN8");
-            }
+            dst[j * channels + c] = static_cast<T>(a[c] + f * (static_cast<double>(b[c]) - a[c]));
         }
     }
-    else if (blob.sample_format == audio_blob::s16)
-    {
-        if (blob.channels == 1)
-        {
-            format = AL_FORMAT_MONO16;
-        }
-        else if (blob.channels == 2)
-        {
-            format = AL_FORMAT_STEREO16;
-        }
-        else if (alIsExtensionPresent("AL_EXT_MCFORMATS"))
-        {
-            if (blob.channels == 4)
-            {
-                format = alGetEnumValue("AL_FORMAT_QUAD16");
-            }
-            else if (blob.channels == 6)
-            {
-                format = alGetEnumValue("AL_FORMAT_51CHN16");
-            }
-            else if (blob.channels == 7)
-            {
-                format = alGetEnumValue("AL_FORMAT_61CHN16");
-            }
-            else if (blob.channels == 8)
-            {
-                format = alGetEnumValue("AL_FORMAT_71CHN16");
-            }
-        }
-    }
-    else if (blob.sample_format == audio_blob::f32)
-    {
-        if (alIsExtensionPresent("AL_EXT_float32"))
-        {
-            if (blob.channels == 1)
-            {
-                format = alGetEnumValue("AL_FORMAT_MONO_FLOAT32");
-            }
-            else if (blob.channels == 2)
-            {
-                format = alGetEnumValue("AL_FORMAT_STEREO_FLOAT32");
-            }
-            else if (alIsExtensionPresent("AL_EXT_MCFORMATS"))
-            {
-                if (blob.channels == 4)
-                {
-                    format = alGetEnumValue("AL_FORMAT_QUAD32");
-                }
-                else if (blob.channels == 6)
-                {
-                    format = alGetEnumValue("AL_FORMAT_51CHN32");
-                }
-                else if (blob.channels == 7)
-                {
-                    format = alGetEnumValue("AL_FORMAT_61CHN32");
-                }
-                else if (blob.channels == 8)
-                {
-                    format = alGetEnumValue("AL_FORMAT_71CHN32");
-                }
-            }
-        }
-    }
-    else if (blob.sample_format == audio_blob::d64)
-    {
-        if (alIsExtensionPresent("AL_EXT_double"))
-        {
-            if (blob.channels == 1)
-            {
-                format = alGetEnumValue("AL_FORMAT_MONO_DOUBLE_EXT");
-            }
-            else if (blob.channels == 2)
-            {
-                format = alGetEnumValue("AL_FORMAT_STEREO_DOUBLE_EXT");
-            }
-        }
-    }
-    if (format == 0)
-    {
-        throw exc(str::asprintf(_("No OpenAL format available for "
-                        "audio data format %s."), blob.format_name().c_str()));
-    }
-    return format;
 }
 
-void audio_output::set_source_parameters()
+void audio_output::data(const audio_blob &blob)
 {
-    float gain = dispatch::parameters().audio_volume();
-    if (dispatch::parameters().audio_mute())
+    assert(_sink);
+    _frame_size = blob.channels * blob.sample_bits() / 8;
+    int64_t bytes_per_second = static_cast<int64_t>(blob.rate) * _frame_size;
+    if (_block_speed == 1.0 && _resample_input.empty())
     {
-        gain = 0.0f;
+        _sink->data(blob);
+        int64_t duration = blob.size * 1000000 / bytes_per_second;
+        add_block_time(duration, duration);
     }
-    alSourcef(_source, AL_GAIN, gain);
-    if (alGetError() != AL_NO_ERROR)
-    {
-        throw exc(_("Cannot set OpenAL audio volume."));
-    }
-}
-
-void audio_output::data(const audio_blob &blob)
-{
-    assert(blob.data);
-    ALenum format = get_al_format(blob);
-    msg::dbg(std::string("Buffering ") + str::from(blob.size) + " bytes of audio data.");
-    if (_state == 0)
+    else
     {
-        set_source_parameters();
-        // Initial buffering
-        assert(blob.size == _num_buffers * _buffer_size);
-        char *data = static_cast<char *>(blob.data);
-        for (size_t j = 0; j < _num_buffers; j++)
-        {
-            _buffer_channels.push_back(blob.channels);
-            _buffer_sample_bits.push_back(blob.sample_bits());
-            _buffer_rates.push_back(blob.rate);
-            alBufferData(_buffers[j], format, data, _buffer_size, blob.rate);
-            alSourceQueueBuffers(_source, 1, &(_buffers[j]));
-            data += _buffer_size;
-        }
-        if (alGetError() != AL_NO_ERROR)
+        // Append the new data to the input frames that are left, and make a block of the
+        // usual size from them. If the input falls short, e.g. at the end of the stream,
+        // the last frame is repeated.
+        size_t frames = _buffer_size / _frame_size;
+        size_t needed = static_cast<size_t>(_resample_phase + frames * _block_speed) + 2;
+        size_t old_size = _resample_input.size();
+        _resample_input.resize(std::max(old_size + blob.size, needed * _frame_size));
+        std::memcpy(&(_resample_input[old_size]), blob.data, blob.size);
+        for (size_t i = old_size + blob.size; i < _resample_input.size(); i += _frame_size)
         {
-            throw exc(_("Cannot buffer initial OpenAL data."));
+            std::memcpy(&(_resample_input[i]), &(_resample_input[i - _frame_size]), _frame_size);
         }
-    }
-    else if (blob.size > 0)
-    {
-        // Replace one buffer
-        assert(blob.size == _buffer_size);
-        ALuint buf = 0;
-        alSourceUnqueueBuffers(_source, 1, &buf);
-        assert(buf != 0);
-        alBufferData(buf, format, blob.data, _buffer_size, blob.rate);
-        alSourceQueueBuffers(_source, 1, &buf);
-        if (alGetError() != AL_NO_ERROR)
+        _resample_output.resize(_buffer_size);
+        if (blob.sample_format == audio_blob::u8)
+            resample<uint8_t>(&(_resample_input[0]), &(_resample_output[0]), blob.channels, frames, _resample_phase, _block_speed);
+        else if (blob.sample_format == audio_blob::s16)
+            resample<int16_t>(&(_resample_input[0]), &(_resample_output[0]), blob.channels, frames, _resample_phase, _block_speed);
+        else if (blob.sample_format == audio_blob::f32)
+            resample<float>(&(_resample_input[0]), &(_resample_output[0]), blob.channels, frames, _resample_phase, _block_speed);
+        else
+            resample<double>(&(_resample_input[0]), &(_resample_output[0]), blob.channels, frames, _resample_phase, _block_speed);
+        audio_blob out = blob;
+        out.data = &(_resample_output[0]);
+        out.size = _buffer_size;
+        _sink->data(out);
+        // Keep the input frames from the one before the next output position on.
+        double end = _resample_phase + frames * _block_speed;
+        size_t used = std::min(static_cast<size_t>(end), _resample_input.size() / _frame_size);
+        _resample_input.erase(_resample_input.begin(), _resample_input.begin() + used * _frame_size);
+        _resample_phase = end - used;
+        int64_t duration = _buffer_size * 1000000 / bytes_per_second;
+        add_block_time(duration, static_cast<int64_t>(duration * _block_speed));
+        if (_block_speed == 1.0 && _resample_phase == 0.0)
         {
-            throw exc(_("Cannot buffer OpenAL data."));
+            // Back to normal; the next blob is passed on as it is.
+            _resample_input.clear();
         }
-        // Update the time spent on all past buffers
-        int64_t current_buffer_samples = _buffer_size / _buffer_channels[0] * 8 / _buffer_sample_bits[0];
-        int64_t current_buffer_time = current_buffer_samples * 1000000 / _buffer_rates[0];
-        _past_time += current_buffer_time;
-        // Remove current buffer entries
-        _buffer_channels.erase(_buffer_channels.begin());
-        _buffer_sample_bits.erase(_buffer_sample_bits.begin());
-        _buffer_rates.erase(_buffer_rates.begin());
-        // Add entries for the new buffer
-        _buffer_channels.push_back(blob.channels);
-        _buffer_sample_bits.push_back(blob.sample_bits());
-        _buffer_rates.push_back(blob.rate);
     }
+    // The initial data is passed as one blob, and the speed takes effect afterwards.
+    _block_speed = _speed;
+}
+
+void audio_output::add_block_time(int64_t device_duration, int64_t playback_duration)
+{
+    block_time b;
+    b.device_start = _block_device_time;
+    b.device_end = _block_device_time + device_duration;
+    b.playback_start = _block_playback_time;
+    b.playback_end = _block_playback_time + playback_duration;
+    _block_times.push_back(b);
+    _block_device_time = b.device_end;
+    _block_playback_time = b.playback_end;
 }
 
 int64_t audio_output::start()
 {
-    msg::dbg("Starting audio output.");
-    assert(_state == 0);
-    alSourcePlay(_source);
-    alGetSourcei(_source, AL_SOURCE_STATE, &_state);
-    if (alGetError() != AL_NO_ERROR)
-    {
-        throw exc(_("Cannot start OpenAL source playback."));
-    }
-    _past_time = 0;
-    _last_timestamp = 0;
-    _ext_timer_at_last_timestamp = timer::get(timer::monotonic);
-    _last_reported_timestamp = _last_timestamp;
-    return _last_timestamp;
+    assert(_sink);
+    _start_time = _sink->start();
+    return _start_time;
 }
 
 void audio_output::pause()
 {
-    alSourcePause(_source);
-    if (alGetError() != AL_NO_ERROR)
-    {
-        throw exc(_("Cannot pause OpenAL source playback."));
-    }
+    assert(_sink);
+    _sink->pause();
 }
 
 void audio_output::unpause()
 {
-    alSourcePlay(_source);
-    if (alGetError() != AL_NO_ERROR)
-    {
-        throw exc(_("Cannot unpause OpenAL source playback."));
-    }
+    assert(_sink);
+    _sink->unpause();
 }
 
 void audio_output::stop()
 {
-    alSourceStop(_source);
-    if (alGetError() != AL_NO_ERROR)
-    {
-        throw exc(_("Cannot stop OpenAL source playback."));
-    }
-    // flush all buffers and reset the state
-    ALint processed_buffers;
-    alGetSourcei(_source, AL_BUFFERS_PROCESSED, &processed_buffers);
-    while (processed_buffers > 0)
-    {
-        ALuint buf = 0;
-        alSourceUnqueueBuffers(_source, 1, &buf);
-        if (alGetError() != AL_NO_ERROR)
-        {
-            throw exc(_("Cannot unqueue OpenAL source buffers."));
-        }
-        alGetSourcei(_source, AL_BUFFERS_PROCESSED, &processed_buffers);
-    }
-    _state = 0;
+    assert(_sink);
+    _sink->stop();
+    _resample_input.clear();
+    _resample_phase = 0.0;
+    _block_speed = 1.0;
+    _block_times.clear();
+    _block_device_time = 0;
+    _block_playback_time = 0;
+}
+
+void audio_output::set_speed(double speed)
+{
+    _speed = speed;
 }
 
 void audio_output::receive_notification(const notification& note)
 {
-    if (_initialized
+    if (_sink
             && (note.type == notification::audio_volume
                 || note.type == notification::audio_mute))
     {
-        set_source_parameters();
+        _sink->set_gain(gain());
     }
 }
@@ -24,66 +24,68 @@
 #define AUDIO_OUTPUT_H
 
 #include <vector>
+#include <deque>
 #include <string>
-
-#if !defined(__APPLE__) || defined(HAVE_AL_AL_H)
-#  include <AL/al.h>
-#  include <AL/alc.h>
-#  include <AL/alext.h>
-#else
-#  include <OpenAL/al.h>
-#  include <OpenAL/alc.h>
-#  include <OpenAL/alext.h>
-#endif
+#include <stdint.h>
 
 #include "dispatch.h"
 
+class audio_sink;
+
 
 class audio_output : public controller
 {
 private:
-    // Static configuration
-    static const size_t _num_buffers;   // Number of audio buffers
-    static const size_t _buffer_size;   // Size of each audio buffer
-
-    // OpenAL things
-    std::vector<std::string> _devices;  // List of known OpenAL devices
-    bool _initialized;                  // Was this initialized?
-    ALCdevice *_device;                 // Audio device        
-    ALCcontext *_context;               // Audio context associated with device
-    std::vector<ALuint> _buffers;       // Buffer handles
-    ALuint _source;                     // Audio source
-    ALint _state;                       // State of audio source
-
-    // Properties of the audio data in the current buffers
-    std::vector<int64_t> _buffer_channels;      // Number of channels
-    std::vector<int64_t> _buffer_sample_bits;   // Number of sample bits
-    std::vector<int64_t> _buffer_rates;         // Sample rate in Hz
-
-    // Time management
-    int64_t _past_time;                 // Time that represents all finished buffers
-    int64_t _last_timestamp;            // 
-    int64_t _ext_timer_at_last_timestamp;
-    int64_t _last_reported_timestamp;
-
-    // Get an OpenAL source format for the audio data in blob (or throw an exception)
-    ALenum get_al_format(const audio_blob &blob);
-
-    // Set source parameters
-    void set_source_parameters();
+    // Buffer configuration, set by init()
+    size_t _num_buffers;                // Number of audio buffers
+    size_t _buffer_size;                // Size of each audio buffer
+
+    // Audio sinks: one for each available audio system
+    std::vector<audio_sink *> _sinks;
+    audio_sink *_sink;                  // The sink of the initialized device, or NULL
+
+    // All known devices
+    std::vector<std::string> _devices;          // Device names for display
+    std::vector<int> _device_sinks;             // Sink of each device
+    std::vector<std::string> _device_ids;       // Name of each device in its sink
+
+    // Get the output gain from the volume and mute parameters
+    float gain() const;
+
+    // Resampling to change the playback speed; see set_speed()
+    double _speed;                      // Requested speed
+    double _block_speed;                // Speed of the next update block
+    std::vector<unsigned char> _resample_input;  // Input sample frames that are not used up yet
+    double _resample_phase;             // Position of the next output frame in the input frames
+    std::vector<unsigned char> _resample_output;
+    size_t _frame_size;                 // Bytes per sample frame of the current data
+    // The device time and the playback time of each queued block, relative to the
+    // start of playback, for mapping device time to playback time
+    struct block_time
+    {
+        int64_t device_start, device_end;
+        int64_t playback_start, playback_end;
+    };
+    std::deque<block_time> _block_times;
+    int64_t _block_device_time, _block_playback_time;
+    int64_t _start_time;                // Time returned by the sink when playback started
+    void add_block_time(int64_t device_duration, int64_t playback_duration);
 
 public:
     audio_output();
     ~audio_output();
     
-    /* How many OpenAL devices are available? */
+    /* How many audio devices are available? */
     int devices() const;
-    /* Return the name of OpenAL device i. */
+    /* Return the name of audio device i. */
     const std::string &device_name(int i) const;
 
     /* Initialize the audio device i for output. If i is < 0, the default device
-     * will be used. Throw an exception if this fails. */
-    void init(int i = -1);
+     * will be used. The number and size of the audio buffers are taken from the
+     * audio_buffers and audio_buffer_size parameters; if these are not set, small
+     * buffers are used for low_latency (e.g. for device input) and large buffers
+     * otherwise. Throw an exception if this fails. */
+    void init(int i = -1, bool low_latency = false);
     /* Deinitialize the audio device. */
     void deinit();
 
@@ -98,7 +100,10 @@ public:
      *   required_update_data_size() using the data() function. The time position
      *   in the audio stream is the time returned by status() minus the start time
      *   that the start() function returned. You can also just query the time
-     *   without asking if more data is needed by passing NULL as need_data. */
+     *   without asking if more data is needed by passing NULL as need_data.
+     *   When the speed is not 1, the time is the playback time of the data,
+     *   not the device time, and the required update size changes with the
+     *   speed. */
     size_t required_initial_data_size() const;
     size_t required_update_data_size() const;
     int64_t status(bool *need_data);
@@ -112,6 +117,12 @@ public:
     /* Stop audio playback, and flush all buffers. */
     void stop();
 
+    /* Play the data faster (speed > 1) or slower (speed < 1) than its sample rate
+     * says by resampling it, e.g. to follow the display refresh. The speed applies
+     * from the next update on; the initial data is not resampled.
+     * Meant for speeds close to 1: the pitch changes too. */
+    void set_speed(double speed);
+
     /* Receive a notification from the dispatch. */
     virtual void receive_notification(const notification& note);
 };
@@ -0,0 +1,60 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010, 2011, 2012, 2013, 2015
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_SINK_H
+#define AUDIO_SINK_H
+
+#include <vector>
+#include <string>
+
+#include "media_data.h"
+
+
+/* An audio sink is a backend of audio_output: it plays audio data on a device
+ * of one audio system. See audio_output for the meaning of the functions;
+ * data sizes are given by the number and size of buffers that init() receives. */
+
+class audio_sink
+{
+public:
+    audio_sink() {}
+    virtual ~audio_sink() {}
+
+    /* Append the names of the available devices to the list. */
+    virtual void list_devices(std::vector<std::string> &names) = 0;
+
+    /* Open the given device, or the default device if the name is empty,
+     * and prepare it for the given buffer configuration. Throw an exception
+     * if this fails. */
+    virtual void init(const std::string &device, size_t num_buffers, size_t buffer_size) = 0;
+    virtual void deinit() = 0;
+
+    virtual int64_t status(bool *need_data) = 0;
+    virtual void data(const audio_blob &blob) = 0;
+    virtual int64_t start() = 0;
+    virtual void pause() = 0;
+    virtual void unpause() = 0;
+    virtual void stop() = 0;
+
+    /* Set the output gain (0 = silence, 1 = unchanged). */
+    virtual void set_gain(float gain) = 0;
+};
+
+#endif
@@ -0,0 +1,373 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010, 2011, 2012, 2013, 2015
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#include "audio_sink_alsa.h"
+
+#include "base/exc.h"
+#include "base/str.h"
+#include "base/msg.h"
+#include "base/dbg.h"
+
+#include "base/gettext.h"
+#define _(string) gettext(string)
+
+
+audio_sink_alsa::audio_sink_alsa() : audio_sink(),
+    _pcm(NULL), _num_buffers(0), _buffer_size(0), _gain(1.0f),
+    _configured(false), _channels(0), _rate(0), _sample_format(audio_blob::u8), _frame_size(0),
+    _can_pause(false), _started(false), _past_time(0), _frames_written(0), _device_paused(false)
+{
+    void **hints;
+    if (snd_device_name_hint(-1, "pcm", &hints) == 0)
+    {
+        for (void **hint = hints; *hint; hint++)
+        {
+            char *name = snd_device_name_get_hint(*hint, "NAME");
+            char *ioid = snd_device_name_get_hint(*hint, "IOID");
+            if (name && std::strcmp(name, "null") != 0
+                    && (!ioid || std::strcmp(ioid, "Output") == 0))
+            {
+                _devices.push_back(name);
+            }
+            std::free(name);
+            std::free(ioid);
+        }
+        snd_device_name_free_hint(hints);
+    }
+    msg::dbg("%d ALSA devices available:", static_cast<int>(_devices.size()));
+    for (size_t i = 0; i < _devices.size(); i++)
+    {
+        msg::dbg(4, _devices[i]);
+    }
+}
+
+audio_sink_alsa::~audio_sink_alsa()
+{
+    deinit();
+}
+
+void audio_sink_alsa::list_devices(std::vector<std::string> &names)
+{
+    names.insert(names.end(), _devices.begin(), _devices.end());
+}
+
+void audio_sink_alsa::init(const std::string &device, size_t num_buffers, size_t buffer_size)
+{
+    if (!_pcm)
+    {
+        const std::string name = (device.empty() ? std::string("default") : device);
+        int err = snd_pcm_open(&_pcm, name.c_str(), SND_PCM_STREAM_PLAYBACK, 0);
+        if (err < 0)
+        {
+            _pcm = NULL;
+            throw exc(str::asprintf(_("ALSA device '%s' is not available: %s"),
+                        name.c_str(), snd_strerror(err)));
+        }
+        _num_buffers = num_buffers;
+        _buffer_size = buffer_size;
+        _tmpbuf.resize(_num_buffers * _buffer_size);
+        _configured = false;
+        _started = false;
+        _past_time = 0;
+        _frames_written = 0;
+    }
+}
+
+void audio_sink_alsa::deinit()
+{
+    if (_pcm)
+    {
+        if (_started)
+        {
+            snd_pcm_drain(_pcm);
+        }
+        snd_pcm_close(_pcm);
+        _pcm = NULL;
+    }
+}
+
+void audio_sink_alsa::configure(const audio_blob &blob)
+{
+    snd_pcm_format_t format;
+    switch (blob.sample_format)
+    {
+    case audio_blob::u8:
+        format = SND_PCM_FORMAT_U8;
+        break;
+    case audio_blob::s16:
+        format = SND_PCM_FORMAT_S16;
+        break;
+    case audio_blob::f32:
+        format = SND_PCM_FORMAT_FLOAT;
+        break;
+    case audio_blob::d64:
+    default:
+        format = SND_PCM_FORMAT_FLOAT64;
+        break;
+    }
+    if (_configured)
+    {
+        // Play the data that is queued in the old format first
+        if (_started)
+        {
+            snd_pcm_drain(_pcm);
+        }
+        _past_time += _frames_written * 1000000 / _rate;
+        _frames_written = 0;
+    }
+    size_t frame_size = blob.channels * blob.sample_bits() / 8;
+    unsigned int latency = _num_buffers * (_buffer_size / frame_size) * 1000000 / blob.rate;
+    int err = snd_pcm_set_params(_pcm, format, SND_PCM_ACCESS_RW_INTERLEAVED,
+            blob.channels, blob.rate, 1, latency);
+    if (err < 0)
+    {
+        throw exc(str::asprintf(_("No ALSA format available for audio data format %s: %s"),
+                    blob.format_name().c_str(), snd_strerror(err)));
+    }
+    if (_configured && _started)
+    {
+        // Draining stopped the PCM
+        err = snd_pcm_prepare(_pcm);
+        if (err < 0)
+        {
+            throw exc(str::asprintf(_("Cannot restart ALSA playback: %s"), snd_strerror(err)));
+        }
+    }
+    snd_pcm_hw_params_t *hw_params;
+    snd_pcm_hw_params_alloca(&hw_params);
+    _can_pause = (snd_pcm_hw_params_current(_pcm, hw_params) >= 0
+            && snd_pcm_hw_params_can_pause(hw_params));
+    _configured = true;
+    _channels = blob.channels;
+    _rate = blob.rate;
+    _sample_format = blob.sample_format;
+    _frame_size = frame_size;
+}
+
+void audio_sink_alsa::write(const void *data, size_t size)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    snd_pcm_uframes_t frames = size / _frame_size;
+    while (frames > 0)
+    {
+        snd_pcm_sframes_t r = snd_pcm_writei(_pcm, p, frames);
+        if (r < 0)
+        {
+            // Recover from underruns and suspends, then try again
+            int err = snd_pcm_recover(_pcm, r, 1);
+            if (err < 0)
+            {
+                throw exc(str::asprintf(_("Cannot buffer ALSA data: %s"), snd_strerror(err)));
+            }
+            continue;
+        }
+        p += r * _frame_size;
+        frames -= r;
+        _frames_written += r;
+    }
+}
+
+template<typename T>
+static void apply_gain(void *data, size_t n, float gain, float offset, float min, float max)
+{
+    T *d = static_cast<T *>(data);
+    for (size_t i = 0; i < n; i++)
+    {
+        float v = (static_cast<float>(d[i]) - offset) * gain + offset;
+        d[i] = static_cast<T>(std::min(std::max(v, min), max));
+    }
+}
+
+void audio_sink_alsa::data(const audio_blob &blob)
+{
+    assert(blob.data);
+    assert(blob.size <= _tmpbuf.size());
+    if (!_configured || blob.channels != _channels || blob.rate != _rate
+            || blob.sample_format != _sample_format)
+    {
+        configure(blob);
+    }
+    // FFmpeg and OpenAL order the channels of 5.1 and 7.1 audio as
+    // FL FR FC LFE BL BR (SL SR), ALSA as FL FR BL BR FC LFE (SL SR).
+    bool reorder = (blob.channels == 6 || blob.channels == 8);
+    if (!reorder && _gain >= 1.0f)
+    {
+        write(blob.data, blob.size);
+        return;
+    }
+    std::memcpy(&(_tmpbuf[0]), blob.data, blob.size);
+    if (reorder)
+    {
+        size_t sample_size = blob.sample_bits() / 8;
+        size_t frames = blob.size / _frame_size;
+        for (size_t f = 0; f < frames; f++)
+        {
+            unsigned char *frame = &(_tmpbuf[f * _frame_size]);
+            unsigned char tmp[2 * sizeof(double)];
+            std::memcpy(tmp, frame + 2 * sample_size, 2 * sample_size);
+            std::memcpy(frame + 2 * sample_size, frame + 4 * sample_size, 2 * sample_size);
+            std::memcpy(frame + 4 * sample_size, tmp, 2 * sample_size);
+        }
+    }
+    if (_gain < 1.0f)
+    {
+        switch (blob.sample_format)
+        {
+        case audio_blob::u8:
+            apply_gain<uint8_t>(&(_tmpbuf[0]), blob.size, _gain, 128.0f, 0.0f, 255.0f);
+            break;
+        case audio_blob::s16:
+            apply_gain<int16_t>(&(_tmpbuf[0]), blob.size / 2, _gain, 0.0f, -32768.0f, 32767.0f);
+            break;
+        case audio_blob::f32:
+            apply_gain<float>(&(_tmpbuf[0]), blob.size / 4, _gain, 0.0f, -1.0f, 1.0f);
+            break;
+        case audio_blob::d64:
+            apply_gain<double>(&(_tmpbuf[0]), blob.size / 8, _gain, 0.0f, -1.0f, 1.0f);
+            break;
+        }
+    }
+    write(&(_tmpbuf[0]), blob.size);
+}
+
+int64_t audio_sink_alsa::status(bool *need_data)
+{
+    if (!_started)
+    {
+        if (need_data)
+        {
+            *need_data = true;
+        }
+        return std::numeric_limits<int64_t>::min();
+    }
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(_pcm);
+    if (avail < 0)
+    {
+        int err = snd_pcm_recover(_pcm, avail, 1);
+        if (err < 0)
+        {
+            throw exc(str::asprintf(_("Cannot check ALSA playback state: %s"), snd_strerror(err)));
+        }
+        avail = std::numeric_limits<snd_pcm_sframes_t>::max();
+    }
+    if (need_data)
+    {
+        *need_data = (static_cast<size_t>(avail) >= _buffer_size / _frame_size);
+    }
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_delay(_pcm, &delay) < 0 || delay < 0)
+    {
+        delay = 0;
+    }
+    int64_t played_frames = std::max(_frames_written - static_cast<int64_t>(delay), static_cast<int64_t>(0));
+    return _past_time + played_frames * 1000000 / _rate;
+}
+
+int64_t audio_sink_alsa::start()
+{
+    msg::dbg("Starting audio output.");
+    assert(!_started);
+    // The PCM starts by itself when its buffer is full; otherwise start it now.
+    if (snd_pcm_state(_pcm) == SND_PCM_STATE_PREPARED)
+    {
+        int err = snd_pcm_start(_pcm);
+        if (err < 0)
+        {
+            throw exc(str::asprintf(_("Cannot start ALSA playback: %s"), snd_strerror(err)));
+        }
+    }
+    _started = true;
+    return 0;
+}
+
+void audio_sink_alsa::pause()
+{
+    if (_can_pause && snd_pcm_state(_pcm) == SND_PCM_STATE_RUNNING)
+    {
+        int err = snd_pcm_pause(_pcm, 1);
+        if (err < 0)
+        {
+            throw exc(str::asprintf(_("Cannot pause ALSA playback: %s"), snd_strerror(err)));
+        }
+        _device_paused = true;
+        return;
+    }
+    // Many devices and plugins (e.g. dmix) cannot pause. Drop the queued data
+    // instead, and count it as played, so that the time stays in sync with the
+    // data that follows. The PCM starts again by itself when the buffer is full.
+    msg::dbg("ALSA device cannot pause; dropping queued audio data.");
+    int err = snd_pcm_drop(_pcm);
+    if (err >= 0)
+    {
+        err = snd_pcm_prepare(_pcm);
+    }
+    if (err < 0)
+    {
+        throw exc(str::asprintf(_("Cannot pause ALSA playback: %s"), snd_strerror(err)));
+    }
+    if (_rate > 0)
+    {
+        _past_time += _frames_written * 1000000 / _rate;
+    }
+    _frames_written = 0;
+}
+
+void audio_sink_alsa::unpause()
+{
+    if (_device_paused)
+    {
+        int err = snd_pcm_pause(_pcm, 0);
+        if (err < 0)
+        {
+            throw exc(str::asprintf(_("Cannot unpause ALSA playback: %s"), snd_strerror(err)));
+        }
+        _device_paused = false;
+    }
+}
+
+void audio_sink_alsa::stop()
+{
+    // Drop all queued data and reset the state
+    int err = snd_pcm_drop(_pcm);
+    if (err >= 0)
+    {
+        err = snd_pcm_prepare(_pcm);
+    }
+    if (err < 0)
+    {
+        throw exc(str::asprintf(_("Cannot stop ALSA playback: %s"), snd_strerror(err)));
+    }
+    _started = false;
+    _past_time = 0;
+    _frames_written = 0;
+    _device_paused = false;
+}
+
+void audio_sink_alsa::set_gain(float gain)
+{
+    _gain = gain;
+}
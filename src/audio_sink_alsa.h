@@ -0,0 +1,81 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010, 2011, 2012, 2013, 2015
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_SINK_ALSA_H
+#define AUDIO_SINK_ALSA_H
+
+#include <vector>
+#include <string>
+
+#include <alsa/asoundlib.h>
+
+#include "audio_sink.h"
+
+
+/* This sink writes directly to an ALSA PCM device. The audio time is computed
+ * from the number of frames written and the current delay of the device, which
+ * gives an exact hardware clock instead of the buffer granularity of OpenAL. */
+
+class audio_sink_alsa : public audio_sink
+{
+private:
+    std::vector<std::string> _devices;  // List of known ALSA PCM devices
+    snd_pcm_t *_pcm;                    // PCM handle, or NULL
+    size_t _num_buffers;                // Number of audio buffers
+    size_t _buffer_size;                // Size of each audio buffer
+    float _gain;                        // Output gain
+    std::vector<unsigned char> _tmpbuf; // Buffer for gain and channel order adjustments
+
+    // Format of the PCM, set by the first data
+    bool _configured;
+    int _channels;
+    int _rate;
+    audio_blob::sample_format_t _sample_format;
+    size_t _frame_size;
+    bool _can_pause;                    // Does the PCM support pausing?
+
+    // Time management
+    bool _started;                      // Was playback started?
+    int64_t _past_time;                 // Time that represents all data before the last format change
+    int64_t _frames_written;            // Frames written since the last format change
+    bool _device_paused;                // Was the PCM paused with snd_pcm_pause()?
+
+    // Set the PCM format for the audio data in blob (or throw an exception)
+    void configure(const audio_blob &blob);
+    // Write frames to the PCM, recovering from underruns
+    void write(const void *data, size_t size);
+
+public:
+    audio_sink_alsa();
+    ~audio_sink_alsa();
+
+    virtual void list_devices(std::vector<std::string> &names);
+    virtual void init(const std::string &device, size_t num_buffers, size_t buffer_size);
+    virtual void deinit();
+    virtual int64_t status(bool *need_data);
+    virtual void data(const audio_blob &blob);
+    virtual int64_t start();
+    virtual void pause();
+    virtual void unpause();
+    virtual void stop();
+    virtual void set_gain(float gain);
+};
+
+#endif
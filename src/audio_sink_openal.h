@@ -0,0 +1,94 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010, 2011, 2012, 2013
+ * Martin Lambers <marlam@marlam.de>
+ * Gabriele Greco <gabrielegreco@gmail.com>
+ * Frédéric Devernay <Frederic.Devernay@inrialpes.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_SINK_OPENAL_H
+#define AUDIO_SINK_OPENAL_H
+
+#include <vector>
+#include <string>
+
+#if !defined(__APPLE__) || defined(HAVE_AL_AL_H)
+#  include <AL/al.h>
+#  include <AL/alc.h>
+#  include <AL/alext.h>
+#else
+#  include <OpenAL/al.h>
+#  include <OpenAL/alc.h>
+#  include <OpenAL/alext.h>
+#endif
+
+#include "audio_sink.h"
+
+
+class audio_sink_openal : public audio_sink
+{
+private:
+    // Buffer configuration, set by init()
+    size_t _num_buffers;                // Number of audio buffers
+    size_t _buffer_size;                // Size of each audio buffer
+    float _gain;                        // Source gain
+
+    // OpenAL things
+    std::vector<std::string> _devices;  // List of known OpenAL devices
+    bool _initialized;                  // Was this initialized?
+    ALCdevice *_device;                 // Audio device        
+    ALCcontext *_context;               // Audio context associated with device
+    std::vector<ALuint> _buffers;       // Buffer handles
+    ALuint _source;                     // Audio source
+    ALint _state;                       // State of audio source
+
+    // Properties of the audio data in the current buffers. These are rings of
+    // _num_buffers entries in queue order, starting with the oldest buffer.
+    std::vector<int64_t> _buffer_channels;      // Number of channels
+    std::vector<int64_t> _buffer_sample_bits;   // Number of sample bits
+    std::vector<int64_t> _buffer_rates;         // Sample rate in Hz
+    size_t _buffer_head;                        // Index of the oldest buffer
+
+    // Time management
+    int64_t _past_time;                 // Time that represents all finished buffers
+    int64_t _last_timestamp;            // 
+    int64_t _ext_timer_at_last_timestamp;
+    int64_t _last_reported_timestamp;
+
+    // Get an OpenAL source format for the audio data in blob (or throw an exception)
+    ALenum get_al_format(const audio_blob &blob);
+
+    // Set source parameters
+    void set_source_parameters();
+
+public:
+    audio_sink_openal();
+    ~audio_sink_openal();
+
+    virtual void list_devices(std::vector<std::string> &names);
+    virtual void init(const std::string &device, size_t num_buffers, size_t buffer_size);
+    virtual void deinit();
+    virtual int64_t status(bool *need_data);
+    virtual void data(const audio_blob &blob);
+    virtual int64_t start();
+    virtual void pause();
+    virtual void unpause();
+    virtual void stop();
+    virtual void set_gain(float gain);
+};
+
+#endif
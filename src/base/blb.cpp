@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+#include <stdexcept>
+
+#if (defined _WIN32 || defined __WIN32__) && !defined __CYGWIN__
+# include <malloc.h>
+#endif
+#include <pthread.h>
+
+#include "base/blb.h"
+
+
+/*
+ * The pool has four size classes per power of two, from 64 bytes up to
+ * max_class_size, so that rounding up wastes at most 25%. Only a few free
+ * buffers per class are kept, and only up to a total size, so that the pool
+ * does not hold on to memory that was needed once, e.g. during a resolution
+ * change.
+ */
+
+static const size_t min_class_size = 64;
+static const int steps_per_power = 4;
+static const int class_count = 18 * steps_per_power + 1;    // 64 B to 16 MiB
+static const int max_free_per_class = 8;
+static const size_t max_free_size = 64 << 20;
+
+static struct
+{
+    pthread_mutex_t mutex;
+    void* buffers[class_count][max_free_per_class];
+    int buffer_count[class_count];
+    size_t size;
+} free_buffers = { PTHREAD_MUTEX_INITIALIZER, { { 0 } }, { 0 }, 0 };
+
+static int size_class(size_t s, size_t* class_size)
+{
+    size_t base = min_class_size;
+    int c = 0;
+    for (;;) {
+        for (int i = 0; i < steps_per_power; i++, c++) {
+            size_t cs = base + i * (base / steps_per_power);
+            if (cs >= s) {
+                *class_size = cs;
+                return c;
+            }
+        }
+        base *= 2;
+    }
+}
+
+static void* alloc_aligned(size_t s)
+{
+    void* ptr;
+#if (defined _WIN32 || defined __WIN32__) && !defined __CYGWIN__
+    ptr = _aligned_malloc(s, blob_pool::alignment);
+#else
+    if (posix_memalign(&ptr, blob_pool::alignment, s) != 0)
+        ptr = NULL;
+#endif
+    if (!ptr)
+        throw std::runtime_error(std::strerror(ENOMEM));
+    return ptr;
+}
+
+static void free_aligned(void* ptr)
+{
+#if (defined _WIN32 || defined __WIN32__) && !defined __CYGWIN__
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+void* blob_pool::alloc(size_t s, size_t* capacity)
+{
+    if (s == 0) {
+        *capacity = 0;
+        return NULL;
+    }
+    if (s > max_class_size) {
+        *capacity = s;
+        return alloc_aligned(s);
+    }
+    size_t class_size;
+    int c = size_class(s, &class_size);
+    void* ptr = NULL;
+    pthread_mutex_lock(&free_buffers.mutex);
+    if (free_buffers.buffer_count[c] > 0) {
+        ptr = free_buffers.buffers[c][--free_buffers.buffer_count[c]];
+        free_buffers.size -= class_size;
+    }
+    pthread_mutex_unlock(&free_buffers.mutex);
+    if (!ptr)
+        ptr = alloc_aligned(class_size);
+    *capacity = class_size;
+    return ptr;
+}
+
+void blob_pool::free(void* ptr, size_t capacity) throw ()
+{
+    if (!ptr)
+        return;
+    if (capacity <= max_class_size) {
+        size_t class_size;
+        int c = size_class(capacity, &class_size);
+        assert(class_size == capacity);
+        bool kept = false;
+        pthread_mutex_lock(&free_buffers.mutex);
+        if (free_buffers.buffer_count[c] < max_free_per_class
+                && free_buffers.size + class_size <= max_free_size) {
+            free_buffers.buffers[c][free_buffers.buffer_count[c]++] = ptr;
+            free_buffers.size += class_size;
+            kept = true;
+        }
+        pthread_mutex_unlock(&free_buffers.mutex);
+        if (kept)
+            return;
+    }
+    free_aligned(ptr);
+}
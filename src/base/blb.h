@@ -23,6 +23,12 @@
  * store any kind of data. Such memory blocks are a pain to manage with
  * new/delete or new[]/delete[] or malloc()/free() because of the necessary
  * type casting. This class provides easy access pointers and a destructor.
+ *
+ * The memory is aligned to blob_pool::alignment bytes, so that SIMD code can
+ * work on it directly. Blobs up to blob_pool::max_class_size bytes get their
+ * memory from a pool, and keep it when they shrink, so that buffers that are
+ * reallocated for every frame or packet do not need the system allocator
+ * once playback runs.
  */
 
 #ifndef BLB_H
@@ -36,69 +42,71 @@
 #include "base/chk.h"
 
 
+class blob_pool
+{
+public:
+    static const size_t alignment = 64;
+    static const size_t max_class_size = 16 << 20;
+
+    // Allocate at least s bytes. The size that is actually usable is stored in
+    // capacity; it must be passed back to free(). Throws std::runtime_error.
+    static void* alloc(size_t s, size_t* capacity);
+    // Release memory. Medium sized buffers are kept for reuse.
+    static void free(void* ptr, size_t capacity) throw ();
+};
+
 class blob
 {
 private:
 
     size_t _size;
+    size_t _capacity;
     void* _ptr;
 
-    static void* alloc(size_t s)
+    // Replace the memory with a new block of at least s bytes, and keep as much
+    // of the contents as fits.
+    void reallocate(size_t s)
     {
-        if (s == 0)
-        {
-            return NULL;
-        }
-        void* ptr = std::malloc(s);
-        if (!ptr) {
-            throw std::runtime_error(std::strerror(ENOMEM));
+        size_t capacity;
+        void* ptr = blob_pool::alloc(s, &capacity);
+        if (_size > 0 && s > 0) {
+            std::memcpy(ptr, _ptr, (_size < s ? _size : s));
         }
-        return ptr;
-    }
-
-    static void* realloc(void* p, size_t s)
-    {
-        if (s == 0)
-        {
-            std::free(p);
-            return NULL;
-        }
-        void* ptr = std::realloc(p, s);
-        if (!ptr) {
-            throw std::runtime_error(std::strerror(ENOMEM));
-        }
-        return ptr;
+        blob_pool::free(_ptr, _capacity);
+        _ptr = ptr;
+        _capacity = capacity;
     }
 
 public:
 
     blob() throw () :
-        _size(0), _ptr(NULL)
+        _size(0), _capacity(0), _ptr(NULL)
     {
     }
 
     blob(size_t s) :
-        _size(s), _ptr(alloc(_size))
+        _size(s), _capacity(0), _ptr(blob_pool::alloc(_size, &_capacity))
     {
     }
 
     blob(size_t s, size_t n) :
-        _size(checked_mul(s, n)), _ptr(alloc(_size))
+        _size(checked_mul(s, n)), _capacity(0), _ptr(blob_pool::alloc(_size, &_capacity))
     {
     }
 
     blob(size_t s, size_t n0, size_t n1) :
-        _size(checked_mul(checked_mul(s, n0), n1)), _ptr(alloc(_size))
+        _size(checked_mul(checked_mul(s, n0), n1)), _capacity(0), _ptr(blob_pool::alloc(_size, &_capacity))
     {
     }
 
     blob(size_t s, size_t n0, size_t n1, size_t n2) :
-        _size(checked_mul(checked_mul(s, n0), checked_mul(n1, n2))), _ptr(alloc(_size))
+        _size(checked_mul(checked_mul(s, n0), checked_mul(n1, n2))), _capacity(0),
+        _ptr(blob_pool::alloc(_size, &_capacity))
     {
     }
 
     blob(const blob& b) :
-        _size(b._size), _ptr(alloc(_size))
+        _size(b._size), _capacity(0), _ptr(blob_pool::alloc(_size, &_capacity))
     {
         if (_size > 0) {
             std::memcpy(_ptr, b._ptr, _size);
@@ -107,15 +115,17 @@ public:
 
     const blob& operator=(const blob& b)
     {
+        if (&b == this) {
+            return *this;
+        }
         if (b.size() == 0) {
-            std::free(_ptr);
-            _size = 0;
-            _ptr = NULL;
+            free();
         } else {
-            void *ptr = alloc(b.size());
-            std::memcpy(ptr, b.ptr(), b.size());
-            std::free(_ptr);
-            _ptr = ptr;
+            if (b.size() > _capacity || (_capacity > blob_pool::max_class_size && b.size() < _capacity)) {
+                _size = 0;
+                reallocate(b.size());
+            }
+            std::memcpy(_ptr, b.ptr(), b.size());
             _size = b.size();
         }
         return *this;
@@ -123,38 +133,49 @@ public:
 
     ~blob() throw ()
     {
-        std::free(_ptr);
+        blob_pool::free(_ptr, _capacity);
     }
 
     void free()
     {
-        std::free(_ptr);
+        blob_pool::free(_ptr, _capacity);
         _ptr = NULL;
         _size = 0;
+        _capacity = 0;
     }
 
     void resize(size_t s)
     {
+        if (s == 0) {
+            free();
+        } else if (s > _capacity) {
+            // Blobs that are too large for the pool grow geometrically, so that
+            // growing them in small steps does not copy them every time.
+            size_t c = s;
+            if (s > blob_pool::max_class_size && s - _capacity < _capacity / 2) {
+                c = _capacity + _capacity / 2;
+            }
+            reallocate(c);
+        } else if (s < _size && _capacity > blob_pool::max_class_size) {
+            // Give unused memory of large blobs back.
+            reallocate(s);
+        }
         _size = s;
-        _ptr = realloc(_ptr, _size);
     }
 
     void resize(size_t s, size_t n)
     {
-        _size = checked_mul(s, n);
-        _ptr = realloc(_ptr, _size);
+        resize(checked_mul(s, n));
     }
 
     void resize(size_t s, size_t n0, size_t n1)
     {
-        _size = checked_mul(checked_mul(s, n0), n1);
-        _ptr = realloc(_ptr, _size);
+        resize(checked_mul(checked_mul(s, n0), n1));
     }
 
     void resize(size_t s, size_t n0, size_t n1, size_t n2)
     {
-        _size = checked_mul(checked_mul(s, n0), checked_mul(n1, n2));
-        _ptr = realloc(_ptr, _size);
+        resize(checked_mul(checked_mul(s, n0), checked_mul(n1, n2)));
     }
 
     size_t size() const throw ()
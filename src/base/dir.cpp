@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#define __STDC_CONSTANT_MACROS
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+#include "base/dir.h"
+#include "base/msg.h"
+#include "base/str.h"
+
+
+static bool make_dir(const std::string &dir)
+{
+#if (defined _WIN32 || defined __WIN32__) && !defined __CYGWIN__
+    return (mkdir(dir.c_str()) == 0 || errno == EEXIST);
+#else
+    return (mkdir(dir.c_str(), 0777) == 0 || errno == EEXIST);
+#endif
+}
+
+namespace dir
+{
+    std::string cache()
+    {
+#if (defined _WIN32 || defined __WIN32__) && !defined __CYGWIN__
+        const char *base = std::getenv("LOCALAPPDATA");
+        return (base && base[0] ? std::string(base) + "\\bino" : std::string());
+#else
+        const char *xdg_cache_home = std::getenv("XDG_CACHE_HOME");
+        const char *home = std::getenv("HOME");
+        if (xdg_cache_home && xdg_cache_home[0])
+            return std::string(xdg_cache_home) + "/bino";
+        else if (home && home[0])
+            return std::string(home) + "/.cache/bino";
+        else
+            return std::string();
+#endif
+    }
+
+    bool make_cache()
+    {
+        std::string dir = cache();
+        if (dir.empty())
+            return false;
+        size_t slash = dir.find_last_of("/\\");
+        if (slash != std::string::npos)
+            make_dir(dir.substr(0, slash));
+        if (!make_dir(dir))
+        {
+            msg::dbg(dir + ": " + std::strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    std::string cache_file(const std::string &prefix, const std::string &id)
+    {
+        std::string dir = cache();
+        if (dir.empty())
+            return std::string();
+        // 64 bit FNV-1a hash of the identity
+        uint64_t hash = UINT64_C(14695981039346656037);
+        for (size_t i = 0; i < id.length(); i++)
+        {
+            hash ^= static_cast<unsigned char>(id[i]);
+            hash *= UINT64_C(1099511628211);
+        }
+        return dir + "/" + prefix + "-" + str::asprintf("%016llx", static_cast<unsigned long long>(hash));
+    }
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file dir.h
+ *
+ * Directories for files that bino creates.
+ */
+
+#ifndef DIR_H
+#define DIR_H
+
+#include <string>
+
+namespace dir
+{
+    /* Return the directory for cache files, or an empty string if there is none.
+     * This is $XDG_CACHE_HOME/bino or $HOME/.cache/bino, or %LOCALAPPDATA%\bino
+     * on Windows. */
+    std::string cache();
+
+    /* Create the cache directory if it does not exist yet. Returns false on failure. */
+    bool make_cache();
+
+    /* Return the name of a cache file for the given identity, or an empty string
+     * if there is no cache directory. The file name consists of the prefix and
+     * a hash of the identity. */
+    std::string cache_file(const std::string &prefix, const std::string &id);
+}
+
+#endif
@@ -74,6 +74,15 @@ namespace msg
     void msg_txt(level_t level, const std::string &s);
     void msg_txt(level_t level, const char *format, ...) MSG_AFP(2, 3);
 
+    /* Debug messages that take a std::string build it even if it is not
+     * printed. On hot paths, use the printf-style variants, which return
+     * before formatting anything, or test dbg_enabled() first. */
+#ifdef NDEBUG
+    inline bool dbg_enabled() { return false; }
+#else
+    inline bool dbg_enabled() { return level() == DBG; }
+#endif
+
 #ifdef NDEBUG
     inline void dbg(int, const std::string &) { }
     inline void dbg(int, const char *, ...) { }
@@ -18,10 +18,12 @@
 
 #include "config.h"
 
+#include <deque>
 #include <cerrno>
 #include <cstring>
 #include <pthread.h>
 #include <sched.h>
+#include <time.h>
 
 #include "base/pth.h"
 
@@ -109,6 +111,22 @@ void condition::wait(mutex& m)
                 + "pthread_cond_wait(): " + std::strerror(e), e);
 }
 
+bool condition::wait(mutex& m, int64_t timeout)
+{
+    struct timespec abstime;
+    clock_gettime(CLOCK_REALTIME, &abstime);
+    int64_t nsec = abstime.tv_nsec + (timeout % 1000000) * 1000;
+    abstime.tv_sec += timeout / 1000000 + nsec / 1000000000;
+    abstime.tv_nsec = nsec % 1000000000;
+    int e = pthread_cond_timedwait(&_cond, &m._mutex, &abstime);
+    if (e == ETIMEDOUT)
+        return false;
+    if (e != 0)
+        throw exc(std::string(_("System function failed: "))
+                + "pthread_cond_timedwait(): " + std::strerror(e), e);
+    return true;
+}
+
 void condition::wake_one()
 {
     int e = pthread_cond_signal(&_cond);
@@ -169,10 +187,10 @@ void* thread::__run(void* p)
     catch (...) {
         // We must assume this means thread cancellation. In this
         // case, we *must* rethrow the exception.
-        t->__running = false;
+        atomic::store_release(&t->__running, false);
         throw;
     }
-    t->__running = false;
+    atomic::store_release(&t->__running, false);
     return NULL;
 }
 
@@ -249,6 +267,279 @@ void thread::cancel()
 }
 
 
+/* The task pool */
+
+class task_pool
+{
+private:
+    static const int idle = 0;
+    static const int queued = 1;
+    static const int running = 2;
+    // The maximum number of pool threads. Beyond that, tasks wait in their queues.
+    static const size_t max_workers = 256;
+
+    // Queues of tasks, one for each priority
+    struct task_queues
+    {
+        std::deque<task*> q[2];
+    };
+
+    class worker : public thread
+    {
+    private:
+        task_pool* _pool;
+        const size_t _index;
+    public:
+        worker(task_pool* pool, size_t index) : _pool(pool), _index(index)
+        {
+        }
+        void run()
+        {
+            _pool->work(_index);
+        }
+    };
+
+    mutex _mutex;                       // protects everything below and the state of all tasks
+    condition _work_cond;               // signals new tasks to idle workers
+    condition _done_cond;               // signals finished tasks to waiting threads
+    std::vector<worker*> _workers;
+    std::vector<task_queues> _local;    // the queues of each worker
+    task_queues _global;                // the queues for tasks started outside of the pool
+    size_t _idle_workers;               // waiting workers that no start() has woken yet
+    size_t _wakeups;                    // wakeups from start() that no worker has received yet
+
+    static int queue_index(int priority)
+    {
+        return (priority == task::priority_min ? 1 : 0);
+    }
+    task* take(size_t index);
+    void execute(task* t);
+    void work(size_t index);
+
+public:
+    task_pool() : _idle_workers(0), _wakeups(0)
+    {
+    }
+
+    void start(task* t, int priority);
+    bool remove(task* t);
+    void wait(task* t);
+    void discard(task* t);
+};
+
+// The index of the pool thread that runs the calling thread, or -1.
+static __thread int current_worker = -1;
+
+static task_pool* global_task_pool = NULL;
+static pthread_once_t global_task_pool_once = PTHREAD_ONCE_INIT;
+
+static void create_global_task_pool()
+{
+    // The pool is never destroyed: its threads may still run when static
+    // objects are destroyed at exit.
+    global_task_pool = new task_pool;
+}
+
+static task_pool* get_global_task_pool()
+{
+    pthread_once(&global_task_pool_once, create_global_task_pool);
+    return global_task_pool;
+}
+
+task* task_pool::take(size_t index)
+{
+    // Call this with the mutex locked.
+    for (int p = 0; p < 2; p++) {
+        // First the own queue, newest task first, because its data is most likely in the cache
+        std::deque<task*>& own = _local[index].q[p];
+        if (!own.empty()) {
+            task* t = own.back();
+            own.pop_back();
+            return t;
+        }
+        // Then tasks started outside of the pool, oldest first
+        if (!_global.q[p].empty()) {
+            task* t = _global.q[p].front();
+            _global.q[p].pop_front();
+            return t;
+        }
+        // Then steal the oldest task of another worker
+        for (size_t i = 1; i < _local.size(); i++) {
+            std::deque<task*>& other = _local[(index + i) % _local.size()].q[p];
+            if (!other.empty()) {
+                task* t = other.front();
+                other.pop_front();
+                return t;
+            }
+        }
+    }
+    return NULL;
+}
+
+void task_pool::execute(task* t)
+{
+    try {
+        t->run();
+    }
+    catch (exc& e) {
+        t->__exception = e;
+    }
+    catch (std::exception& e) {
+        t->__exception = e;
+    }
+    _mutex.lock();
+    atomic::store_release(&t->__state, idle);
+    _done_cond.wake_all();
+    _mutex.unlock();
+}
+
+void task_pool::work(size_t index)
+{
+    current_worker = index;
+    _mutex.lock();
+    for (;;) {
+        task* t = take(index);
+        if (!t) {
+            _idle_workers++;
+            _work_cond.wait(_mutex);
+            // start() already took the woken worker off the idle count, so
+            // that a second task does not count on the same worker.
+            if (_wakeups > 0)
+                _wakeups--;
+            else
+                _idle_workers--;
+            continue;
+        }
+        atomic::store_release(&t->__state, running);
+        _mutex.unlock();
+        execute(t);
+        _mutex.lock();
+    }
+}
+
+void task_pool::start(task* t, int priority)
+{
+    _mutex.lock();
+    if (t->__state != idle) {
+        _mutex.unlock();
+        return;
+    }
+    atomic::store_release(&t->__state, queued);
+    t->__priority = priority;
+    task_queues& queues = (current_worker >= 0 ? _local[current_worker] : _global);
+    queues.q[queue_index(priority)].push_back(t);
+    if (_idle_workers > 0) {
+        _idle_workers--;
+        _wakeups++;
+        _work_cond.wake_one();
+    } else if (_workers.size() < max_workers) {
+        worker* w = new worker(this, _local.size());
+        _local.push_back(task_queues());
+        try {
+            w->start();
+            _workers.push_back(w);
+        }
+        catch (...) {
+            // Without a new thread, the task waits for a busy one.
+            _local.pop_back();
+            delete w;
+        }
+    }
+    _mutex.unlock();
+}
+
+bool task_pool::remove(task* t)
+{
+    // Call this with the mutex locked.
+    std::deque<task*>& global = _global.q[queue_index(t->__priority)];
+    for (std::deque<task*>::iterator it = global.begin(); it != global.end(); it++) {
+        if (*it == t) {
+            global.erase(it);
+            return true;
+        }
+    }
+    for (size_t i = 0; i < _local.size(); i++) {
+        std::deque<task*>& local = _local[i].q[queue_index(t->__priority)];
+        for (std::deque<task*>::iterator it = local.begin(); it != local.end(); it++) {
+            if (*it == t) {
+                local.erase(it);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void task_pool::discard(task* t)
+{
+    _mutex.lock();
+    if (t->__state == queued && remove(t)) {
+        atomic::store_release(&t->__state, idle);
+    }
+    while (t->__state != idle)
+        _done_cond.wait(_mutex);
+    _mutex.unlock();
+}
+
+void task_pool::wait(task* t)
+{
+    _mutex.lock();
+    if (t->__state == queued && remove(t)) {
+        // Nobody took the task yet, so run it here.
+        atomic::store_release(&t->__state, running);
+        _mutex.unlock();
+        execute(t);
+        return;
+    }
+    while (t->__state != idle)
+        _done_cond.wait(_mutex);
+    _mutex.unlock();
+}
+
+const int task::priority_default;
+const int task::priority_min;
+
+task::task() :
+    __state(0),
+    __priority(priority_default),
+    __exception()
+{
+}
+
+task::task(const task&) :
+    __state(0),
+    __priority(priority_default),
+    __exception()
+{
+    // The task state cannot be copied; a new state is created instead.
+}
+
+task::~task()
+{
+    // A queued task must not be executed anymore, and a running task must not
+    // be destroyed under its feet.
+    if (running())
+        get_global_task_pool()->discard(this);
+}
+
+void task::start(int priority)
+{
+    get_global_task_pool()->start(this, priority);
+}
+
+void task::wait()
+{
+    get_global_task_pool()->wait(this);
+}
+
+void task::finish()
+{
+    wait();
+    if (!exception().empty())
+        throw exception();
+}
+
+
 thread_group::thread_group(unsigned char size) : __max_size(size)
 {
     __active_threads.reserve(__max_size);
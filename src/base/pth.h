@@ -20,7 +20,9 @@
 #define PTH_H
 
 #include <vector>
+#include <cstring>
 #include <pthread.h>
+#include <stdint.h>
 
 #include "base/exc.h"
 
@@ -72,9 +74,122 @@ namespace atomic
     template<typename T> T inc_and_fetch(T* ptr) { return add_and_fetch(ptr, static_cast<T>(1)); }
     template<typename T> T fetch_and_dec(T* ptr) { return fetch_and_sub(ptr, static_cast<T>(1)); }
     template<typename T> T dec_and_fetch(T* ptr) { return sub_and_fetch(ptr, static_cast<T>(1)); }
+
+    /* The functions above are full barriers. The following loads and stores only
+     * order memory accesses as far as necessary, using the GCC __atomic builtins; see
+     * http://gcc.gnu.org/onlinedocs/gcc-4.7.0/gcc/_005f_005fatomic-Builtins.html
+     * A store with release semantics makes all previous writes of the storing thread
+     * visible to a thread that reads the stored value with acquire semantics.
+     * Relaxed loads and stores are atomic, but do not order other memory accesses. */
+    template<typename T> T load_relaxed(const T* ptr) { return __atomic_load_n(ptr, __ATOMIC_RELAXED); }
+    template<typename T> T load_acquire(const T* ptr) { return __atomic_load_n(ptr, __ATOMIC_ACQUIRE); }
+    template<typename T> void store_relaxed(T* ptr, T value) { __atomic_store_n(ptr, value, __ATOMIC_RELAXED); }
+    template<typename T> void store_release(T* ptr, T value) { __atomic_store_n(ptr, value, __ATOMIC_RELEASE); }
+
+    /* Fences, for orderings that cannot be attached to a single load or store. */
+    inline void fence_acquire() { __atomic_thread_fence(__ATOMIC_ACQUIRE); }
+    inline void fence_release() { __atomic_thread_fence(__ATOMIC_RELEASE); }
 }
 
 
+/*
+ * Single producer, single consumer queue
+ *
+ * A lock-free ring buffer with a fixed capacity, for handing data from exactly one
+ * producer thread to exactly one consumer thread. Neither side ever blocks; push()
+ * fails if the queue is full, and pop() fails if it is empty.
+ */
+
+template<typename T>
+class spsc_queue
+{
+private:
+    std::vector<T> _ring;       // one slot is always kept free
+    size_t _head;               // next slot to pop; written only by the consumer
+    size_t _tail;               // next slot to push; written only by the producer
+
+public:
+    spsc_queue(size_t capacity) : _ring(capacity + 1), _head(0), _tail(0)
+    {
+    }
+
+    // Producer: add an element. Return false if the queue is full.
+    bool push(const T& x)
+    {
+        size_t tail = atomic::load_relaxed(&_tail);
+        size_t next = (tail + 1) % _ring.size();
+        if (next == atomic::load_acquire(&_head))
+            return false;
+        _ring[tail] = x;
+        atomic::store_release(&_tail, next);
+        return true;
+    }
+
+    // Consumer: remove the oldest element. Return false if the queue is empty.
+    bool pop(T* x)
+    {
+        size_t head = atomic::load_relaxed(&_head);
+        if (head == atomic::load_acquire(&_tail))
+            return false;
+        *x = _ring[head];
+        atomic::store_release(&_head, (head + 1) % _ring.size());
+        return true;
+    }
+
+    // Either side: whether the queue is empty. The answer may be outdated immediately.
+    bool empty() const
+    {
+        return atomic::load_acquire(&_head) == atomic::load_acquire(&_tail);
+    }
+};
+
+
+/*
+ * Sequence lock
+ *
+ * Protects a value that one thread writes and other threads read often, e.g. a
+ * snapshot of timing information. Readers never block the writer: they retry if a
+ * write happened while they copied the value. T must be a plain data type that
+ * can be copied with memcpy(), since readers may copy it while it is written.
+ * Only one thread may write at a time.
+ */
+
+template<typename T>
+class seqlock
+{
+private:
+    unsigned int _seq;          // odd while a write is in progress
+    T _value;
+
+public:
+    seqlock(const T& value = T()) : _seq(0), _value(value)
+    {
+    }
+
+    void write(const T& value)
+    {
+        unsigned int seq = atomic::load_relaxed(&_seq);
+        atomic::store_relaxed(&_seq, seq + 1);
+        atomic::fence_release();
+        std::memcpy(&_value, &value, sizeof(T));
+        atomic::store_release(&_seq, seq + 2);
+    }
+
+    T read() const
+    {
+        T value;
+        unsigned int seq0, seq1;
+        do {
+            seq0 = atomic::load_acquire(&_seq);
+            std::memcpy(&value, &_value, sizeof(T));
+            atomic::fence_acquire();
+            seq1 = atomic::load_relaxed(&_seq);
+        } while ((seq0 & 1) || seq0 != seq1);
+        return value;
+    }
+};
+
+
 /*
  * Mutex
  */
@@ -120,6 +235,9 @@ public:
 
     // Wait for the condition. The calling thread must have the mutex locked.
     void wait(mutex& m);
+    // Wait for the condition, but at most the given number of microseconds.
+    // Return false if the timeout expired.
+    bool wait(mutex& m, int64_t timeout);
     // Wake one thread that waits on the condition.
     void wake_one();
     // Wake all threads that wait on the condition.
@@ -164,7 +282,7 @@ public:
     // Returns whether this thread is currently running.
     bool running()
     {
-        return __running;
+        return atomic::load_acquire(&__running);
     }
 
     // Wait for the thread to finish. If the thread is not running, this function
@@ -191,6 +309,79 @@ public:
 };
 
 
+/*
+ * Task
+ *
+ * A task is used like a thread, but its run() function is executed by one of the
+ * threads of a shared pool instead of a thread of its own. Use tasks for work that
+ * is started often and runs for a limited time, e.g. decoding one video frame, and
+ * threads for work that runs until it is told to stop.
+ *
+ * The pool starts a new thread whenever a task is started while all its threads
+ * are busy, so a task that blocks does not keep other tasks from running. Idle
+ * threads are kept for the next tasks. Each pool thread has its own queue: tasks
+ * started from within a task go to the queue of that thread, and idle threads
+ * take tasks from the queues of busy threads. Tasks with priority_default are
+ * always taken before tasks with priority_min.
+ *
+ * Implement the run() function in a subclass.
+ */
+
+class task
+{
+private:
+    int __state;        // idle, queued, or running; protected by the pool mutex
+    int __priority;
+    exc __exception;
+
+    friend class task_pool;
+
+public:
+    // Priorities: use the default priority for work with a deadline, e.g. decoding
+    // the next frame, and the minimum priority for background work, e.g. prefetching.
+    static const int priority_default = thread::priority_default;
+    static const int priority_min = thread::priority_min;
+
+    // Constructor / Destructor
+    task();
+    task(const task& t);
+    virtual ~task();
+
+    // Implement this in a subclass; it will be executed by a pool thread via start()
+    virtual void run() = 0;
+
+    // Queue the task for execution. If the task is already queued or running,
+    // this function does nothing.
+    void start(int priority = task::priority_default);
+
+    // Returns whether this task is currently queued or running.
+    bool running()
+    {
+        return atomic::load_acquire(&__state) != 0;
+    }
+
+    // Wait for the task to finish. If the task is still queued, it is executed by
+    // the calling thread, so that waiting for tasks from within a task cannot
+    // deadlock. If the task is not queued or running, this function returns immediately.
+    void wait();
+
+    // Wait for the task to finish, like wait(), and rethrow an exception that the
+    // run() function might have thrown during its execution.
+    void finish();
+
+    // Get an exception that the run() function might have thrown.
+    const exc& exception() const
+    {
+        return __exception;
+    }
+    // Modify the stored exception
+    exc& exception()
+    {
+        return __exception;
+    }
+};
+
+
 /*
  * Thread group.
  *
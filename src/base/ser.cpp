@@ -168,6 +168,43 @@ void serializable::load(const std::string& s)
     this->load(iss2);
 }
 
+void serializable::save(s11n::writer& w) const
+{
+    // Default implementation: use the binary stream save
+    std::ostringstream oss;
+    this->save(oss);
+    const std::string& s = oss.str();
+    w.write(s.data(), s.length());
+}
+
+// A stream buffer that reads from the memory of a reader without copying it.
+class reader_streambuf : public std::streambuf
+{
+public:
+    reader_streambuf(const void* ptr, size_t size)
+    {
+        char* p = const_cast<char*>(static_cast<const char*>(ptr));
+        setg(p, p, p + size);
+    }
+
+    size_t consumed() const
+    {
+        return gptr() - eback();
+    }
+};
+
+void serializable::load(s11n::reader& r)
+{
+    // Default implementation: use the binary stream load on the remaining data
+    reader_streambuf buf(r.ptr(), r.available());
+    std::istream is(&buf);
+    this->load(is);
+    if (!is.good())
+        r.fail();
+    else
+        r.skip(buf.consumed());
+}
+
 // Return value NULL means the character can be written as is.
 static const char* enc_char(char x)
 {
@@ -647,3 +684,37 @@ void s11n::load(const std::string& s, std::string& x)
         x.append(1, dec_char(sc, i));
     }
 }
+
+
+/*
+ * Save a value to a buffer / load a value from a buffer
+ */
+
+void s11n::save(writer& w, const serializable& x)
+{
+    x.save(w);
+}
+
+void s11n::load(reader& r, serializable& x)
+{
+    x.load(r);
+}
+
+void s11n::save(writer& w, const std::string& x)
+{
+    size_t s = x.length();
+    w.write(&s, sizeof(s));
+    w.write(x.data(), s);
+}
+
+void s11n::load(reader& r, std::string& x)
+{
+    size_t s;
+    r.read(&s, sizeof(s));
+    if (s > r.available()) {
+        r.fail();
+        s = 0;
+    }
+    x.assign(static_cast<const char*>(r.ptr()), s);
+    r.skip(s);
+}
@@ -26,13 +26,28 @@
  * classes that implement the s11n interface.
  * Additionally, STL containers of serializable types can also be serialized,
  * e.g. std::vector<std::string>.
+ *
+ * Binary serialization works with streams or with contiguous buffers
+ * (s11n::writer and s11n::reader). Both produce the same data, but buffers are
+ * much faster: most values are copied with a single memcpy(), and vectors of
+ * fundamental types are copied in one go. Use them for data that is
+ * serialized often, e.g. for every frame.
  */
 
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <vector>
+#include <cstring>
+
+#include "base/blb.h"
+
 
+namespace s11n
+{
+    class writer;
+    class reader;
+}
 
 class serializable
 {
@@ -45,6 +60,11 @@ public:
     virtual void save(std::ostream& os) const = 0;
     virtual void load(std::istream& is) = 0;
 
+    // Save binary to a buffer / load binary from a buffer. The default implementation falls back on the above
+    // stream functions. Classes that are serialized often should implement these, too.
+    virtual void save(s11n::writer& w) const;
+    virtual void load(s11n::reader& r);
+
     // Save in human-readable and editable text format. Can be used for machine- and application version independent
     // saving of data. The default implementation falls back on the above binary functions and stores the binary data in
     // strings.
@@ -54,6 +74,116 @@ public:
 
 namespace s11n
 {
+    // A buffer to save binary data to. It keeps its memory when it is cleared,
+    // so that reusing it does not allocate memory.
+    class writer
+    {
+    private:
+        blob _buf;
+        size_t _size;
+
+        void grow(size_t n)
+        {
+            size_t s = 2 * _buf.size();
+            _buf.resize(s < _size + n ? _size + n : s);
+        }
+
+    public:
+        writer() : _buf(), _size(0)
+        {
+        }
+
+        void clear()
+        {
+            _size = 0;
+        }
+
+        void write(const void* x, size_t n)
+        {
+            if (_size + n > _buf.size())
+                grow(n);
+            std::memcpy(_buf.ptr(_size), x, n);
+            _size += n;
+        }
+
+        const void* ptr() const
+        {
+            return _buf.ptr();
+        }
+
+        size_t size() const
+        {
+            return _size;
+        }
+
+        std::string str() const
+        {
+            return std::string(_buf.ptr<char>(), _size);
+        }
+    };
+
+    // A buffer to load binary data from. The data is not copied; it must stay
+    // valid while the reader is used. Reading beyond the end fails: the reader
+    // is then no longer good(), and the missing data reads as zero bytes.
+    class reader
+    {
+    private:
+        const char* _ptr;
+        const char* _end;
+        bool _good;
+
+    public:
+        reader(const void* ptr, size_t size) :
+            _ptr(static_cast<const char*>(ptr)), _end(_ptr + size), _good(true)
+        {
+        }
+
+        reader(const std::string& s) :
+            _ptr(s.data()), _end(_ptr + s.length()), _good(true)
+        {
+        }
+
+        void read(void* x, size_t n)
+        {
+            if (n > available()) {
+                std::memset(x, 0, n);
+                fail();
+            } else {
+                std::memcpy(x, _ptr, n);
+                _ptr += n;
+            }
+        }
+
+        const void* ptr() const
+        {
+            return _ptr;
+        }
+
+        size_t available() const
+        {
+            return _end - _ptr;
+        }
+
+        void skip(size_t n)
+        {
+            if (n > available())
+                fail();
+            else
+                _ptr += n;
+        }
+
+        void fail()
+        {
+            _ptr = _end;
+            _good = false;
+        }
+
+        bool good() const
+        {
+            return _good;
+        }
+    };
+
     // Functions needed for human-readable save/load:
     // - When saving a group of values contained in a serializable class, use startgroup()/endgroup()
     // - When loading back, get the next name/value pair and interpret it
@@ -241,6 +371,136 @@ namespace s11n
         load(s, x);
         return x;
     }
+
+    /*
+     * Save a value to a buffer / load a value from a buffer
+     */
+
+    // Fundamental arithmetic data types, and vectors of them
+
+#define S11N_BUFFER_FUNCTIONS(T) \
+    inline void save(writer& w, T x) \
+    { \
+        w.write(&x, sizeof(x)); \
+    } \
+    inline void load(reader& r, T& x) \
+    { \
+        r.read(&x, sizeof(x)); \
+    }
+
+#define S11N_BUFFER_VECTOR_FUNCTIONS(T) \
+    inline void save(writer& w, const std::vector<T>& x) \
+    { \
+        size_t s = x.size(); \
+        w.write(&s, sizeof(s)); \
+        if (s > 0) \
+            w.write(&(x[0]), s * sizeof(T)); \
+    } \
+    inline void load(reader& r, std::vector<T>& x) \
+    { \
+        size_t s; \
+        r.read(&s, sizeof(s)); \
+        if (s > r.available() / sizeof(T)) { \
+            r.fail(); \
+            s = 0; \
+        } \
+        x.resize(s); \
+        if (s > 0) \
+            r.read(&(x[0]), s * sizeof(T)); \
+    }
+
+    S11N_BUFFER_FUNCTIONS(bool)
+    S11N_BUFFER_FUNCTIONS(char)
+    S11N_BUFFER_VECTOR_FUNCTIONS(char)
+    S11N_BUFFER_FUNCTIONS(signed char)
+    S11N_BUFFER_VECTOR_FUNCTIONS(signed char)
+    S11N_BUFFER_FUNCTIONS(unsigned char)
+    S11N_BUFFER_VECTOR_FUNCTIONS(unsigned char)
+    S11N_BUFFER_FUNCTIONS(short)
+    S11N_BUFFER_VECTOR_FUNCTIONS(short)
+    S11N_BUFFER_FUNCTIONS(unsigned short)
+    S11N_BUFFER_VECTOR_FUNCTIONS(unsigned short)
+    S11N_BUFFER_FUNCTIONS(int)
+    S11N_BUFFER_VECTOR_FUNCTIONS(int)
+    S11N_BUFFER_FUNCTIONS(unsigned int)
+    S11N_BUFFER_VECTOR_FUNCTIONS(unsigned int)
+    S11N_BUFFER_FUNCTIONS(long)
+    S11N_BUFFER_VECTOR_FUNCTIONS(long)
+    S11N_BUFFER_FUNCTIONS(unsigned long)
+    S11N_BUFFER_VECTOR_FUNCTIONS(unsigned long)
+    S11N_BUFFER_FUNCTIONS(long long)
+    S11N_BUFFER_VECTOR_FUNCTIONS(long long)
+    S11N_BUFFER_FUNCTIONS(unsigned long long)
+    S11N_BUFFER_VECTOR_FUNCTIONS(unsigned long long)
+    S11N_BUFFER_FUNCTIONS(float)
+    S11N_BUFFER_VECTOR_FUNCTIONS(float)
+    S11N_BUFFER_FUNCTIONS(double)
+    S11N_BUFFER_VECTOR_FUNCTIONS(double)
+    S11N_BUFFER_FUNCTIONS(long double)
+    S11N_BUFFER_VECTOR_FUNCTIONS(long double)
+
+#undef S11N_BUFFER_FUNCTIONS
+#undef S11N_BUFFER_VECTOR_FUNCTIONS
+
+    // Binary blobs
+
+    inline void save(writer& w, const void* x, const size_t n)
+    {
+        w.write(x, n);
+    }
+
+    inline void load(reader& r, void* x, const size_t n)
+    {
+        r.read(x, n);
+    }
+
+    // Serializable classes
+
+    void save(writer& w, const serializable& x);
+    void load(reader& r, serializable& x);
+
+    // Basic STL types
+
+    void save(writer& w, const std::string& x);
+    void load(reader& r, std::string& x);
+
+    // STL containers
+
+    template<typename T>
+    void save(writer& w, const std::vector<T>& x)
+    {
+        size_t s = x.size();
+        save(w, s);
+        for (size_t i = 0; i < s; i++) {
+            save(w, x[i]);
+        }
+    }
+
+    template<typename T>
+    void load(reader& r, std::vector<T>& x)
+    {
+        size_t s;
+        load(r, s);
+        if (s > r.available()) {
+            // every element needs at least one byte
+            r.fail();
+            s = 0;
+        }
+        x.resize(s);
+        for (size_t i = 0; i < s; i++) {
+            load(r, x[i]);
+        }
+    }
+
+    // Convenience wrapper: directly return a loaded value
+
+    template<typename T>
+    T load(reader& r)
+    {
+        T x;
+        load(r, x);
+        return x;
+    }
 };
 
 #endif
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <vector>
+#include <map>
+#include <fstream>
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+
+#include "base/exc.h"
+#include "base/str.h"
+#include "base/pth.h"
+#include "base/trc.h"
+
+#include "base/gettext.h"
+#define _(string) gettext(string)
+
+
+struct trace_event
+{
+    const char *name;
+    const char *track;
+    long long start;
+    long long end;
+};
+
+// The ring buffer size; must be a power of two.
+static const unsigned int trace_ring_size = 1 << 18;
+
+bool trace::_enabled = false;
+
+static std::string trace_file_name;
+static trace_event *trace_ring = NULL;
+static unsigned int trace_count = 0;    // number of reserved slots, modulo 2^32
+static bool trace_wrapped = false;
+static pthread_key_t trace_track_key;
+
+void trace::start(const std::string &file_name)
+{
+    if (!trace_ring)
+    {
+        int e = pthread_key_create(&trace_track_key, NULL);
+        if (e != 0)
+        {
+            throw exc(std::strerror(e), e);
+        }
+        trace_ring = new trace_event[trace_ring_size];
+    }
+    trace_file_name = file_name;
+    trace_count = 0;
+    trace_wrapped = false;
+    _enabled = true;
+}
+
+void trace::set_thread_track(const char *track)
+{
+    if (_enabled)
+        pthread_setspecific(trace_track_key, track);
+}
+
+void trace::add(const char *name, long long start, long long end)
+{
+    if (!_enabled)
+        return;
+    unsigned int n = atomic::fetch_and_add(&trace_count, 1u);
+    if (n == trace_ring_size - 1)
+        trace_wrapped = true;
+    trace_event &event = trace_ring[n & (trace_ring_size - 1)];
+    event.name = name;
+    event.track = static_cast<const char *>(pthread_getspecific(trace_track_key));
+    event.start = start;
+    event.end = end;
+}
+
+static std::string json_escape(const char *s)
+{
+    std::string r;
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            r += '\\';
+        r += *s;
+    }
+    return r;
+}
+
+void trace::finish()
+{
+    if (!_enabled)
+        return;
+    _enabled = false;
+    unsigned int count = (trace_wrapped ? trace_ring_size : (trace_count & (trace_ring_size - 1)));
+    unsigned int first = (trace_wrapped ? trace_count : 0);
+
+    std::ofstream f(trace_file_name.c_str());
+    std::map<std::string, int> tids;
+    long long t0 = -1;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const trace_event &event = trace_ring[(first + i) & (trace_ring_size - 1)];
+        if (t0 < 0 || event.start < t0)
+            t0 = event.start;
+    }
+    f << "{\"traceEvents\":[\n";
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const trace_event &event = trace_ring[(first + i) & (trace_ring_size - 1)];
+        std::string track = (event.track ? event.track : "unnamed");
+        std::map<std::string, int>::iterator it = tids.find(track);
+        if (it == tids.end())
+        {
+            it = tids.insert(std::pair<std::string, int>(track, tids.size() + 1)).first;
+            f << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << it->second
+              << ",\"args\":{\"name\":\"" << json_escape(track.c_str()) << "\"}},\n";
+        }
+        f << "{\"name\":\"" << json_escape(event.name) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << it->second
+          << ",\"ts\":" << event.start - t0 << ",\"dur\":" << event.end - event.start << "},\n";
+    }
+    f << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"" PACKAGE_NAME "\"}}\n";
+    f << "],\"displayTimeUnit\":\"ms\"}\n";
+    f.flush();
+    if (!f.good())
+    {
+        throw exc(str::asprintf(_("%s: %s"), trace_file_name.c_str(), std::strerror(errno)), errno);
+    }
+}
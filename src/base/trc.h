@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file trc.h
+ *
+ * Tracing of timed events, for export to the Chrome trace format
+ * (readable by chrome://tracing and Perfetto).
+ *
+ * Events are recorded with trace_scope objects. While tracing is disabled,
+ * this costs one flag test per scope. While it is enabled, each event takes
+ * two timer reads and one slot in a fixed-size ring buffer, so that the
+ * newest events are kept when the buffer overflows. Slots are reserved with
+ * an atomic increment; there is no lock on the recording path. Since many
+ * worker threads are short-lived, events are grouped by the track name that
+ * a thread sets for itself instead of by the system thread id.
+ */
+
+#ifndef TRC_H
+#define TRC_H
+
+#include <string>
+
+#include "base/tmr.h"
+
+
+class trace
+{
+private:
+    static bool _enabled;
+
+public:
+    /* Start recording. The events are written to the given file by finish(). */
+    static void start(const std::string &file_name);
+    /* Stop recording and write the file. Throws an exception on failure.
+     * All threads that record events must have stopped. */
+    static void finish();
+
+    static bool enabled()
+    {
+        return _enabled;
+    }
+
+    /* Set the track name of the calling thread. The string must remain valid;
+     * use a literal. */
+    static void set_thread_track(const char *track);
+
+    /* Record an event with the given (literal) name and start and end times
+     * from timer::get(timer::monotonic). */
+    static void add(const char *name, long long start, long long end);
+};
+
+class trace_scope
+{
+private:
+    const char *_name;
+    long long _start;
+
+public:
+    trace_scope(const char *name) :
+        _name(name), _start(trace::enabled() ? timer::get(timer::monotonic) : -1)
+    {
+    }
+
+    ~trace_scope()
+    {
+        if (_start >= 0)
+            trace::add(_name, _start, timer::get(timer::monotonic));
+    }
+};
+
+#endif
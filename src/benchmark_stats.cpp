@@ -0,0 +1,254 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <cerrno>
+#include <cstring>
+
+#include "base/exc.h"
+#include "base/msg.h"
+#include "base/str.h"
+#include "base/pth.h"
+#include "base/tmr.h"
+
+#include "base/gettext.h"
+#define _(string) gettext(string)
+
+#include "benchmark_stats.h"
+
+
+static const char *stage_names[benchmark_stats::stage_count] =
+{
+    "demux", "decode", "conversion", "upload", "color", "render", "swap", "frame",
+    "gpu_color", "gpu_subtitle", "gpu_render", "gpu_sdi"
+};
+
+bool benchmark_stats::_enabled = false;
+
+static mutex stats_mutex;
+static std::string stats_result_file;
+static std::vector<int64_t> stats_times[benchmark_stats::stage_count];
+static int64_t stats_dropped_frames;
+static int64_t stats_late_frames;
+static int64_t stats_open_start = -1;
+static int64_t stats_open_time = -1;             // time to open the input
+static int64_t stats_first_frame_time = -1;      // time from opening to the first frame
+
+typedef benchmark_stats::summary stage_summary;
+
+stage_summary benchmark_stats::summarize(std::vector<int64_t>& times)
+{
+    stage_summary s;
+    s.count = times.size();
+    s.mean = s.p50 = s.p95 = s.p99 = s.max = 0;
+    if (s.count > 0)
+    {
+        std::sort(times.begin(), times.end());
+        int64_t sum = 0;
+        for (size_t i = 0; i < s.count; i++)
+            sum += times[i];
+        s.mean = sum / static_cast<int64_t>(s.count);
+        // Nearest-rank percentiles
+        s.p50 = times[(s.count * 50 + 99) / 100 - 1];
+        s.p95 = times[(s.count * 95 + 99) / 100 - 1];
+        s.p99 = times[(s.count * 99 + 99) / 100 - 1];
+        s.max = times[s.count - 1];
+    }
+    return s;
+}
+
+static void write_result_file(const std::string& file_name, const stage_summary summaries[],
+        int64_t dropped_frames, int64_t late_frames, int64_t open_time, int64_t first_frame_time)
+{
+    bool json = (file_name.length() >= 5 && file_name.substr(file_name.length() - 5) == ".json");
+    std::ofstream f(file_name.c_str());
+    if (json)
+    {
+        f << "{\n  \"dropped_frames\": " << dropped_frames << ",\n"
+          << "  \"late_frames\": " << late_frames << ",\n"
+          << "  \"open_time\": " << open_time << ",\n"
+          << "  \"first_frame_time\": " << first_frame_time << ",\n"
+          << "  \"stages\": {\n";
+        for (int i = 0; i < benchmark_stats::stage_count; i++)
+        {
+            const stage_summary& s = summaries[i];
+            f << "    \"" << stage_names[i] << "\": { \"count\": " << s.count
+              << ", \"mean\": " << s.mean << ", \"p50\": " << s.p50 << ", \"p95\": " << s.p95
+              << ", \"p99\": " << s.p99 << ", \"max\": " << s.max << " }"
+              << (i < benchmark_stats::stage_count - 1 ? ",\n" : "\n");
+        }
+        f << "  }\n}\n";
+    }
+    else
+    {
+        f << "stage,count,mean,p50,p95,p99,max\n";
+        for (int i = 0; i < benchmark_stats::stage_count; i++)
+        {
+            const stage_summary& s = summaries[i];
+            f << stage_names[i] << ',' << s.count << ',' << s.mean << ',' << s.p50 << ','
+              << s.p95 << ',' << s.p99 << ',' << s.max << '\n';
+        }
+        f << "dropped," << dropped_frames << ",,,,,\n";
+        f << "late," << late_frames << ",,,,,\n";
+        f << "open," << open_time << ",,,,,\n";
+        f << "first_frame," << first_frame_time << ",,,,,\n";
+    }
+    f.flush();
+    if (!f.good())
+    {
+        throw exc(str::asprintf(_("%s: %s"), file_name.c_str(), std::strerror(errno)), errno);
+    }
+}
+
+void benchmark_stats::set_result_file(const std::string& file_name)
+{
+    stats_mutex.lock();
+    stats_result_file = file_name;
+    stats_mutex.unlock();
+}
+
+bool benchmark_stats::has_result_file()
+{
+    stats_mutex.lock();
+    bool r = !stats_result_file.empty();
+    stats_mutex.unlock();
+    return r;
+}
+
+void benchmark_stats::start()
+{
+    stats_mutex.lock();
+    for (int i = 0; i < stage_count; i++)
+        stats_times[i].clear();
+    stats_dropped_frames = 0;
+    stats_late_frames = 0;
+    _enabled = true;
+    stats_mutex.unlock();
+}
+
+void benchmark_stats::stop()
+{
+    stage_summary summaries[stage_count];
+    stats_mutex.lock();
+    bool was_enabled = _enabled;
+    _enabled = false;
+    for (int i = 0; i < stage_count; i++)
+        summaries[i] = summarize(stats_times[i]);
+    int64_t dropped_frames = stats_dropped_frames;
+    int64_t late_frames = stats_late_frames;
+    int64_t open_time = stats_open_time;
+    int64_t first_frame_time = stats_first_frame_time;
+    std::string result_file = stats_result_file;
+    stats_mutex.unlock();
+    if (!was_enabled || summaries[frame].count == 0)
+        return;
+
+    msg::inf(_("Benchmark: %s frames displayed, %s dropped, %s late."),
+            str::from(summaries[frame].count).c_str(),
+            str::from(dropped_frames).c_str(), str::from(late_frames).c_str());
+    if (first_frame_time >= 0)
+    {
+        msg::inf(_("Benchmark: first frame after %.2f ms, of which %.2f ms for opening the input."),
+                first_frame_time / 1e3f, open_time / 1e3f);
+    }
+    msg::inf(4, "%-12s %8s %8s %8s %8s %8s %8s", _("stage"), _("count"),
+            _("mean"), _("p50"), _("p95"), _("p99"), _("max"));
+    for (int i = 0; i < stage_count; i++)
+    {
+        const stage_summary& s = summaries[i];
+        if (s.count == 0)
+            continue;
+        msg::inf(4, "%-12s %8s %8.2f %8.2f %8.2f %8.2f %8.2f", stage_names[i],
+                str::from(s.count).c_str(), s.mean / 1e3f,
+                s.p50 / 1e3f, s.p95 / 1e3f, s.p99 / 1e3f, s.max / 1e3f);
+    }
+    msg::inf(4, "%s", _("(all times in milliseconds)"));
+    if (!result_file.empty())
+    {
+        try
+        {
+            write_result_file(result_file, summaries, dropped_frames, late_frames,
+                    open_time, first_frame_time);
+        }
+        catch (std::exception& e)
+        {
+            msg::err("%s", e.what());
+        }
+    }
+}
+
+void benchmark_stats::add(stage_t stage, int64_t time)
+{
+    if (_enabled)
+    {
+        stats_mutex.lock();
+        stats_times[stage].push_back(time);
+        stats_mutex.unlock();
+    }
+}
+
+void benchmark_stats::add_dropped_frame()
+{
+    if (_enabled)
+    {
+        stats_mutex.lock();
+        stats_dropped_frames++;
+        stats_mutex.unlock();
+    }
+}
+
+void benchmark_stats::add_late_frame()
+{
+    if (_enabled)
+    {
+        stats_mutex.lock();
+        stats_late_frames++;
+        stats_mutex.unlock();
+    }
+}
+
+void benchmark_stats::open_started()
+{
+    stats_mutex.lock();
+    stats_open_start = timer::get(timer::monotonic);
+    stats_open_time = -1;
+    stats_first_frame_time = -1;
+    stats_mutex.unlock();
+}
+
+void benchmark_stats::open_finished()
+{
+    stats_mutex.lock();
+    if (stats_open_start >= 0)
+        stats_open_time = timer::get(timer::monotonic) - stats_open_start;
+    stats_mutex.unlock();
+}
+
+void benchmark_stats::first_frame_displayed()
+{
+    stats_mutex.lock();
+    if (stats_open_start >= 0 && stats_first_frame_time < 0)
+        stats_first_frame_time = timer::get(timer::monotonic) - stats_open_start;
+    stats_mutex.unlock();
+}
@@ -0,0 +1,109 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BENCHMARK_STATS_H
+#define BENCHMARK_STATS_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/*
+ * Per-frame timing statistics for benchmarking.
+ *
+ * The pipeline stages report the time they spent on each frame from
+ * whatever thread they run in. When the player stops, a summary with
+ * percentiles is printed, and optionally written to a result file.
+ * Recording only happens while the statistics are enabled, so the cost
+ * in normal playback is a single flag test per call.
+ *
+ * The times of the OpenGL stages are CPU times for submitting the work;
+ * the swap time includes waiting for the GPU. If the GL supports timer
+ * queries, the gpu_* stages report the GPU times of the passes; they are
+ * read back a few frames later, so that measuring them never stalls.
+ */
+
+class benchmark_stats
+{
+public:
+    enum stage_t
+    {
+        demux,          // reading one packet
+        decode,         // decoding one video frame
+        conversion,     // software pixel format conversion of one frame
+        upload,         // uploading one frame to the GL
+        color,          // the color conversion pass
+        render,         // the render pass
+        swap,           // buffer swap
+        frame,          // time between two displayed frames
+        gpu_color,      // GPU time of the color pass
+        gpu_subtitle,   // GPU time of the subtitle texture update
+        gpu_render,     // GPU time of the render pass
+        gpu_sdi,        // GPU time of the SDI output passes
+        stage_count
+    };
+
+    /* Summary of a series of times. */
+    struct summary
+    {
+        size_t count;
+        int64_t mean, p50, p95, p99, max;
+    };
+
+private:
+    static bool _enabled;
+
+public:
+    /* Summarize the given times; they are sorted in the process. */
+    static summary summarize(std::vector<int64_t>& times);
+
+    /* Set a file to write the results to. Its format is JSON if the name
+     * ends with ".json", and CSV otherwise. An empty name disables this. */
+    static void set_result_file(const std::string& file_name);
+    /* Whether a result file was set. Statistics are then also recorded
+     * outside of benchmark mode. */
+    static bool has_result_file();
+
+    /* Reset all statistics and start recording. */
+    static void start();
+    /* Stop recording, and print and write the results if anything was
+     * recorded. */
+    static void stop();
+
+    static bool enabled()
+    {
+        return _enabled;
+    }
+
+    /* Record the time of a stage in microseconds. */
+    static void add(stage_t stage, int64_t time);
+    /* Record that a frame was dropped, or displayed too late. */
+    static void add_dropped_frame();
+    static void add_late_frame();
+
+    /* Record the start and end of opening an input, and the display of the
+     * first frame after that. This gives the time to the first frame, which
+     * is reported independently of start() and stop(). */
+    static void open_started();
+    static void open_finished();
+    static void first_frame_displayed();
+};
+
+#endif
@@ -46,8 +46,10 @@
 
 
 command_file::command_file(const std::string& filename) :
-    _filename(filename), _fd(-1)
+    _filename(filename), _fd(-1), _fifo_write_fd(-1)
 {
+    // This controller only sends commands.
+    unsubscribe_all();
 }
 
 command_file::~command_file()
@@ -66,15 +68,25 @@ void command_file::init()
         struct stat statbuf;
         if (fstat(_fd, &statbuf) == 0 && S_ISFIFO(statbuf.st_mode))
             _is_fifo = true;
+        // Without a writer, a FIFO is always readable (EOF), and we would be
+        // woken up all the time. Keep a writer of our own.
+        if (_is_fifo)
+            _fifo_write_fd = ::open(_filename.c_str(), O_WRONLY | O_NONBLOCK);
         _linebuf.clear();
         _wait_until_stop = false;
         _wait_until = -1;
+        watch_fd(_fd);
     }
 }
 
 void command_file::deinit()
 {
     if (_fd >= 0) {
+        unwatch_fd();
+        if (_fifo_write_fd >= 0) {
+            ::close(_fifo_write_fd);
+            _fifo_write_fd = -1;
+        }
         if (::close(_fd) != 0) {
             msg::wrn(_("%s: %s"), _filename.c_str(), ::strerror(errno));
         }
@@ -97,13 +109,17 @@ void command_file::process_events()
     if (!is_active())
         return;
 
-    if (_wait_until_stop && dispatch::playing())
+    if (_wait_until_stop && dispatch::playing()) {
+        process_events_again();
         return;
+    }
 
     if (_wait_until >= 0) {
         int64_t now = timer::get(timer::monotonic);
-        if (now < _wait_until)
+        if (now < _wait_until) {
+            process_events_again();
             return;
+        }
     }
 
     _wait_until_stop = false;
@@ -135,7 +151,7 @@ void command_file::process_events()
         }
     }
     std::string cmd;
-    if (_linebuf.size() > 0) {
+    while (_linebuf.size() > 0) {
         size_t eol_pos = _linebuf.find_first_of('\n');
         if (eol_pos != std::string::npos) {
             // We have a complete command line. Execute the command,
@@ -148,10 +164,26 @@ void command_file::process_events()
             // We have a last line without EOL. Process it.
             cmd = _linebuf;
             _linebuf.clear();
+        } else {
+            break;
         }
+        cmd = str::sanitize(str::trim(cmd));
+        // Commands scheduled with 'at' are not executed now, so we pass all
+        // of them that are available to the schedule at once.
+        if (cmd.substr(0, 3) != "at ")
+            break;
+        command c;
+        if (!dispatch::parse_command(cmd, &c))
+            msg::err(_("%s: invalid command '%s'"), _filename.c_str(), cmd.c_str());
+        else
+            send_cmd(c);
+        cmd.clear();
     }
+    // We execute at most one command per call. If more are buffered, we need
+    // to be called again even if there is no new input.
+    if (_linebuf.find_first_of('\n') != std::string::npos)
+        process_events_again();
     if (cmd.length() > 0) {
-        cmd = str::sanitize(str::trim(cmd));
         if (cmd.substr(0, 4) == "wait") {
             // This command is specific to this particular controller!
             std::vector<std::string> tokens = str::tokens(cmd, " \t\r");
@@ -159,11 +191,13 @@ void command_file::process_events()
                 float seconds;
                 if (tokens[1] == "stop") {
                     _wait_until_stop = true;
+                    process_events_again();
                     return;
                 } else if (str::to(tokens[1], &seconds)) {
                     _wait_until = timer::get(timer::monotonic);
                     if (seconds > 0.0f)
                         _wait_until += seconds * 1e6f;
+                    process_events_again();
                     return;
                 }
             }
@@ -32,6 +32,7 @@ private:
     const std::string _filename;
     int _fd;
     bool _is_fifo;
+    int _fifo_write_fd;     // keeps a FIFO from signalling EOF when its writer goes away
     std::string _linebuf;
     bool _wait_until_stop;
     int64_t _wait_until;
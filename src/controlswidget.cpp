@@ -28,17 +28,24 @@
 
 #include <QGridLayout>
 #include <QIcon>
+#include <QImage>
 #include <QLabel>
+#include <QMouseEvent>
+#include <QPixmap>
 #include <QSettings>
 #include <QSlider>
+#include <QStyle>
 #include <QPushButton>
+#include <QTimer>
 
 #include "controlswidget.h"
 #include "gui_common.h"
 #include "media_input.h"
+#include "thumbnailer.h"
 
 controls_widget::controls_widget(QSettings *settings, QWidget *parent)
-    : QWidget(parent), _input_duration(0), _lock(false), _settings(settings)
+    : QWidget(parent), _input_duration(0), _lock(false), _settings(settings),
+    _scrubbing(false), _scrub_pending(false), _thumbnailer(NULL)
 {
     QGridLayout *row0_layout = new QGridLayout;
     _seek_slider = new QSlider(Qt::Horizontal);
@@ -47,6 +54,18 @@ controls_widget::controls_widget(QSettings *settings, QWidget *parent)
     _seek_slider->setRange(0, 2000);
     _seek_slider->setTracking(false);
     connect(_seek_slider, SIGNAL(valueChanged(int)), this, SLOT(seek_slider_changed()));
+    // While dragging, show previews at a rate that the decoder can follow.
+    connect(_seek_slider, SIGNAL(sliderMoved(int)), this, SLOT(seek_slider_moved()));
+    connect(_seek_slider, SIGNAL(sliderReleased()), this, SLOT(seek_slider_released()));
+    _scrub_timer = new QTimer(this);
+    _scrub_timer->setSingleShot(true);
+    _scrub_timer->setInterval(40);
+    connect(_scrub_timer, SIGNAL(timeout()), this, SLOT(scrub_timer_timeout()));
+    // Hovering over the slider shows a thumbnail of the position.
+    _seek_slider->setMouseTracking(true);
+    _seek_slider->installEventFilter(this);
+    _thumbnail_label = new QLabel(this, Qt::ToolTip);
+    _thumbnail_label->setFrameShape(QFrame::Box);
     row0_layout->addWidget(_seek_slider, 0, 0);
     _pos_label = new QLabel("0:00");
     _pos_label->setToolTip(_("<p>Elapsed / total time.</p>"));
@@ -166,6 +185,11 @@ controls_widget::controls_widget(QSettings *settings, QWidget *parent)
     update_audio_widgets();
 }
 
+controls_widget::~controls_widget()
+{
+    delete _thumbnailer;
+}
+
 void controls_widget::update_audio_widgets()
 {
     _lock = true;
@@ -262,6 +286,46 @@ void controls_widget::seek_slider_changed()
     }
 }
 
+void controls_widget::seek_slider_moved()
+{
+    if (_scrub_timer->isActive())
+    {
+        _scrub_pending = true;
+    }
+    else
+    {
+        _scrubbing = true;
+        send_cmd(command::scrub, static_cast<float>(_seek_slider->sliderPosition()) / 2000.0f);
+        _scrub_timer->start();
+    }
+}
+
+void controls_widget::scrub_timer_timeout()
+{
+    if (_scrub_pending && _seek_slider->isSliderDown())
+    {
+        _scrub_pending = false;
+        send_cmd(command::scrub, static_cast<float>(_seek_slider->sliderPosition()) / 2000.0f);
+        _scrub_timer->start();
+    }
+}
+
+void controls_widget::seek_slider_released()
+{
+    if (_scrubbing)
+    {
+        // The player holds the preview until it gets a seek, so send one even if
+        // the slider ends up at its old value.
+        _scrub_timer->stop();
+        _scrub_pending = false;
+        _scrubbing = false;
+        _lock = true;
+        _seek_slider->setValue(_seek_slider->sliderPosition());
+        _lock = false;
+        send_cmd(command::set_pos, static_cast<float>(_seek_slider->value()) / 2000.0f);
+    }
+}
+
 void controls_widget::audio_mute_clicked()
 {
     if (!_lock)
@@ -296,6 +360,7 @@ void controls_widget::update()
     }
     else
     {
+        _thumbnail_label->hide();
         _play_button->setEnabled(false);
         _pause_button->setEnabled(false);
         _stop_button->setEnabled(false);
@@ -314,6 +379,61 @@ void controls_widget::update()
         _pos_label->setText("0:00");
         _pos_label->setMinimumSize(QSize(0, 0));
     }
+    update_thumbnailer();
+}
+
+void controls_widget::update_thumbnailer()
+{
+    delete _thumbnailer;
+    _thumbnailer = NULL;
+    const media_input *input = dispatch::media_input();
+    if (input && !input->is_device() && input->duration() > 0 && input->video_streams() > 0)
+    {
+        int stream;
+        const std::string &url = input->video_stream_url(input->selected_video_stream(), &stream);
+        if (thumbnailer::supported(url))
+        {
+            const video_frame &t = input->video_frame_template();
+            _thumbnailer = new thumbnailer(url, stream, t.stereo_layout, t.stereo_layout_swap,
+                    input->initial_skip(), input->duration(), dispatch::parameters());
+            _thumbnailer->start(thread::priority_min);
+        }
+    }
+}
+
+void controls_widget::show_thumbnail(int x)
+{
+    thumbnail t;
+    float pos = QStyle::sliderValueFromPosition(_seek_slider->minimum(), _seek_slider->maximum(),
+            x, _seek_slider->width()) / 2000.0f;
+    if (!_thumbnailer || !_thumbnailer->get(pos, &t))
+    {
+        _thumbnail_label->hide();
+        return;
+    }
+    QImage image(&(t.data[0]), t.width, t.height, t.width * 4, QImage::Format_RGB32);
+    _thumbnail_label->setPixmap(QPixmap::fromImage(image));
+    _thumbnail_label->adjustSize();
+    _thumbnail_label->move(_seek_slider->mapToGlobal(QPoint(x - _thumbnail_label->width() / 2,
+                    -_thumbnail_label->height() - 2)));
+    _thumbnail_label->show();
+}
+
+bool controls_widget::eventFilter(QObject *obj, QEvent *event)
+{
+    if (obj == _seek_slider)
+    {
+        // While dragging, the video itself shows the position; see seek_slider_moved().
+        if (event->type() == QEvent::MouseMove && !_seek_slider->isSliderDown())
+        {
+            show_thumbnail(static_cast<QMouseEvent *>(event)->pos().x());
+        }
+        else if (event->type() == QEvent::Leave || event->type() == QEvent::MouseButtonPress)
+        {
+            _thumbnail_label->hide();
+        }
+    }
+    return QWidget::eventFilter(obj, event);
 }
 
 void controls_widget::receive_notification(const notification &note)
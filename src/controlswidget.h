@@ -36,6 +36,8 @@ class QSettings;
 class QPushButton;
 class QSlider;
 class QLabel;
+class QTimer;
+class thumbnailer;
 
 class controls_widget : public QWidget, public controller
 {
@@ -58,14 +60,24 @@ private:
     QPushButton *_ff_button;
     QPushButton *_fff_button;
     QSlider *_seek_slider;
+    QTimer *_scrub_timer;               // limits the rate of scrub commands while dragging
+    bool _scrubbing;                    // were scrub commands sent for the current drag?
+    bool _scrub_pending;                // is a slider position waiting for the timer?
+    thumbnailer *_thumbnailer;          // makes the thumbnails shown when hovering over the slider
+    QLabel *_thumbnail_label;
     QLabel *_pos_label;
     QPushButton *_audio_mute_button;
     QSlider *_audio_volume_slider;
 
 private:
     void update_audio_widgets();
+    void update_thumbnailer();
+    void show_thumbnail(int x);
     QIcon get_icon(const QString & name);
 
+protected:
+    bool eventFilter(QObject *obj, QEvent *event);
+
 private slots:
     void play_clicked();
     void pause_clicked();
@@ -80,11 +92,15 @@ private slots:
     void ff_clicked();
     void fff_clicked();
     void seek_slider_changed();
+    void seek_slider_moved();
+    void seek_slider_released();
+    void scrub_timer_timeout();
     void audio_mute_clicked();
     void audio_volume_slider_changed();
 
 public:
     controls_widget(QSettings *settings, QWidget *parent);
+    ~controls_widget();
 
     void update();
     virtual void receive_notification(const notification &note);
@@ -23,10 +23,22 @@
 #include "config.h"
 
 #include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
 #include <sstream>
 #include <cstdio>
 #include <cctype>
+#include <cstring>
+#include <cerrno>
 #include <unistd.h>
+#include <fcntl.h>
+#if (defined _WIN32 || defined __WIN32__) && !defined __CYGWIN__
+# define HAVE_POLL 0
+#else
+# define HAVE_POLL 1
+# include <poll.h>
+#endif
 
 #include "base/exc.h"
 #include "base/dbg.h"
@@ -41,8 +53,10 @@
 #include "gui.h"
 #include "audio_output.h"
 #include "video_output_qt.h"
+#include "video_output_file.h"
 #include "media_input.h"
 #include "player.h"
+#include "benchmark_stats.h"
 #if HAVE_LIBEQUALIZER
 # include "player_equalizer.h"
 #endif
@@ -58,22 +72,382 @@ open_input_data::open_input_data() :
 {
 }
 
-void open_input_data::save(std::ostream &os) const
+template<typename OS>
+void open_input_data::save_binary(OS &os) const
 {
     s11n::save(os, dev_request);
     s11n::save(os, urls);
     s11n::save(os, params);
 }
 
-void open_input_data::load(std::istream &is)
+template<typename IS>
+void open_input_data::load_binary(IS &is)
 {
     s11n::load(is, dev_request);
     s11n::load(is, urls);
     s11n::load(is, params);
 }
 
+void open_input_data::save(std::ostream &os) const
+{
+    save_binary(os);
+}
+
+void open_input_data::load(std::istream &is)
+{
+    load_binary(is);
+}
+
+void open_input_data::save(s11n::writer &w) const
+{
+    save_binary(w);
+}
+
+void open_input_data::load(s11n::reader &r)
+{
+    load_binary(r);
+}
+
+
+// Open a media input and select its streams and stereo layout as requested.
+// The parameters are used instead of dispatch::parameters(), see media_input::open().
+static void open_media_input(class media_input* input, const open_input_data& input_data,
+        const class parameters& params)
+{
+    input->open(input_data.urls, input_data.dev_request, params);
+    if (input->video_streams() == 0) {
+        throw exc(_("No video streams found."));
+    }
+    if (input_data.params.stereo_layout_is_set() || input_data.params.stereo_layout_swap_is_set()) {
+        if (!input->stereo_layout_is_supported(input_data.params.stereo_layout(), input_data.params.stereo_layout_swap())) {
+            throw exc(_("Cannot set requested stereo layout: incompatible media."));
+        }
+        input->set_stereo_layout(input_data.params.stereo_layout(), input_data.params.stereo_layout_swap());
+    } else {
+        input->set_stereo_layout(input->video_frame_template().stereo_layout,
+                input->video_frame_template().stereo_layout_swap);
+    }
+    if (input->video_streams() < input_data.params.video_stream() + 1) {
+        throw exc(str::asprintf(_("Video stream %d not found."), input_data.params.video_stream() + 1));
+    }
+    input->select_video_stream(input_data.params.video_stream());
+    if (input->audio_streams() > 0 && input->audio_streams() < input_data.params.audio_stream() + 1) {
+        throw exc(str::asprintf(_("Audio stream %d not found."), input_data.params.audio_stream() + 1));
+    }
+    if (input->audio_streams() > 0) {
+        input->select_audio_stream(input_data.params.audio_stream());
+    }
+    if (input->subtitle_streams() > 0 && input->subtitle_streams() < input_data.params.subtitle_stream() + 1) {
+        throw exc(str::asprintf(_("Subtitle stream %d not found."), input_data.params.subtitle_stream() + 1));
+    }
+    if (input->subtitle_streams() > 0 && input_data.params.subtitle_stream() >= 0) {
+        input->select_subtitle_stream(input_data.params.subtitle_stream());
+    }
+    if (params.clip_cache() > 0) {
+        input->build_clip_cache(static_cast<size_t>(params.clip_cache()) << 20);
+    }
+}
+
+
+// Whether the parameters that media_input::open() and open_media_input() use
+// are the same, so that inputs opened with them are interchangeable.
+static bool same_open_parameters(const class parameters& a, const class parameters& b)
+{
+    return (a.hwaccel() == b.hwaccel()
+            && a.lowres_decoding() == b.lowres_decoding()
+            && a.read_cache() == b.read_cache()
+            && a.probe_size() == b.probe_size()
+            && a.analyze_duration() == b.analyze_duration()
+            && a.demuxer_buffer() == b.demuxer_buffer()
+            && a.memory_limit() == b.memory_limit()
+            && a.decode_ahead() == b.decode_ahead()
+            && a.live_capture() == b.live_capture()
+            && a.clip_cache() == b.clip_cache());
+}
+
+
+/* Opens the next input of the playlist in the background and decodes its
+ * first video frame, so that playback can switch to it without a gap.
+ * The task runs in a pool thread, so it opens the input with a copy of the
+ * parameters that is made when the preloader is created. */
+
+class media_input_preloader : public task
+{
+private:
+    const open_input_data _input_data;
+    const class parameters _params;
+    const bool _is_playlist_entry;
+    class media_input* _media_input;
+
+public:
+    media_input_preloader(const open_input_data& input_data, const class parameters& params,
+            bool is_playlist_entry) :
+        _input_data(input_data), _params(params), _is_playlist_entry(is_playlist_entry),
+        _media_input(NULL)
+    {
+    }
+
+    ~media_input_preloader()
+    {
+        delete _media_input;
+    }
+
+    const open_input_data& input_data() const
+    {
+        return _input_data;
+    }
+
+    // The parameters that the input is opened with
+    const class parameters& params() const
+    {
+        return _params;
+    }
+
+    // Whether this is the next playlist entry, or a second instance of the
+    // current input for loop mode
+    bool is_playlist_entry() const
+    {
+        return _is_playlist_entry;
+    }
+
+    // Take ownership of the opened media input
+    class media_input* release()
+    {
+        class media_input* input = _media_input;
+        _media_input = NULL;
+        return input;
+    }
+
+    void run()
+    {
+        class media_input* input = new class media_input;
+        try {
+            open_media_input(input, _input_data, _params);
+            // Start decoding the first frame; the player picks it up after the switch.
+            input->start_video_frame_read();
+        }
+        catch (...) {
+            delete input;
+            throw;
+        }
+        _media_input = input;
+    }
+};
+
+
+/* Runs the player steps when Bino is driven by the Qt event loop, so that GUI
+ * activity such as repaints and dialogs cannot delay frame scheduling, and
+ * vice versa. Each step runs with the player mutex locked; the sleep between
+ * steps does not. When the player idles, e.g. while it shows a still image,
+ * the thread waits until a command arrives instead of polling. */
+
+static __thread bool current_thread_is_player = false;
+
+class player_thread : public thread
+{
+private:
+    class player* _player;
+    mutex& _mutex;
+    condition _wakeup;
+    bool _stop_request;         // protected by the mutex
+    bool _wakeup_request;       // protected by the mutex
+    bool _more_steps;
+    bool _idle;
+
+public:
+    player_thread(class player* player, mutex& m) :
+        _player(player), _mutex(m), _stop_request(false), _wakeup_request(false),
+        _more_steps(true), _idle(false)
+    {
+    }
+
+    // Call this with the mutex locked.
+    void stop_request()
+    {
+        _stop_request = true;
+        _wakeup.wake_one();
+    }
+
+    // Run the next step now if the player idles. Call this with the mutex locked.
+    void wakeup()
+    {
+        _wakeup_request = true;
+        _wakeup.wake_one();
+    }
+
+    // Whether the player idles until the next command
+    bool idle() const
+    {
+        return atomic::load_relaxed(&_idle);
+    }
+
+    // Whether the player wants more steps; false means the player finished.
+    bool more_steps() const
+    {
+        return _more_steps;
+    }
+
+    void run()
+    {
+        current_thread_is_player = true;
+        for (;;) {
+            int64_t sleep_time = 0;
+            _mutex.lock();
+            try {
+                _wakeup_request = false;
+                if (!_stop_request)
+                    _more_steps = _player->run_step(&sleep_time);
+            }
+            catch (...) {
+                _mutex.unlock();
+                throw;
+            }
+            bool stop = (_stop_request || !_more_steps);
+            if (!stop && sleep_time >= player::idle_sleep_time) {
+                // Commands that arrived during the step are handled by the next one.
+                if (!_wakeup_request) {
+                    atomic::store_relaxed(&_idle, true);
+                    if (sleep_time == std::numeric_limits<int64_t>::max())
+                        _wakeup.wait(_mutex);
+                    else
+                        _wakeup.wait(_mutex, sleep_time);
+                    atomic::store_relaxed(&_idle, false);
+                }
+                sleep_time = 0;
+                stop = _stop_request;
+            }
+            _mutex.unlock();
+            if (stop)
+                break;
+            if (sleep_time > 0)
+                usleep(sleep_time);
+        }
+    }
+};
 
-controller::controller() throw ()
+#if HAVE_POLL
+/* The fd watcher thread waits for input on the file descriptors that
+ * controllers watch, so that the main loop does not need to poll them. When a
+ * descriptor becomes readable, its controller is marked, and the descriptor is
+ * not watched again until the controller processed its events. */
+class fd_watcher : public thread
+{
+private:
+    mutex _mutex;
+    std::vector<controller*> _controllers;      // protected by the mutex
+    bool _stop_request;                         // protected by the mutex
+    int _wakeup_pipe[2];
+
+public:
+    fd_watcher() : _stop_request(false)
+    {
+        if (::pipe(_wakeup_pipe) != 0) {
+            throw exc(str::asprintf(_("Cannot create pipe: %s"), std::strerror(errno)), errno);
+        }
+        fcntl(_wakeup_pipe[0], F_SETFL, fcntl(_wakeup_pipe[0], F_GETFL) | O_NONBLOCK);
+        fcntl(_wakeup_pipe[1], F_SETFL, fcntl(_wakeup_pipe[1], F_GETFL) | O_NONBLOCK);
+    }
+
+    ~fd_watcher()
+    {
+        ::close(_wakeup_pipe[0]);
+        ::close(_wakeup_pipe[1]);
+    }
+
+    // Make the thread rebuild its list of descriptors.
+    void wakeup()
+    {
+        char c = 0;
+        ssize_t r = ::write(_wakeup_pipe[1], &c, 1);
+        (void)r;        // if the pipe is full, a wakeup is pending anyway
+    }
+
+    void add(controller* c)
+    {
+        _mutex.lock();
+        _controllers.push_back(c);
+        _mutex.unlock();
+        wakeup();
+    }
+
+    void remove(controller* c)
+    {
+        _mutex.lock();
+        for (size_t i = 0; i < _controllers.size(); i++) {
+            if (_controllers[i] == c) {
+                _controllers.erase(_controllers.begin() + i);
+                break;
+            }
+        }
+        _mutex.unlock();
+        wakeup();
+    }
+
+    void stop_request()
+    {
+        _mutex.lock();
+        _stop_request = true;
+        _mutex.unlock();
+        wakeup();
+    }
+
+    void run()
+    {
+        std::vector<struct pollfd> fds;
+        std::vector<controller*> fd_controllers;
+        for (;;) {
+            fds.resize(1);
+            fds[0].fd = _wakeup_pipe[0];
+            fds[0].events = POLLIN;
+            fd_controllers.clear();
+            _mutex.lock();
+            if (_stop_request) {
+                _mutex.unlock();
+                break;
+            }
+            for (size_t i = 0; i < _controllers.size(); i++) {
+                controller* c = _controllers[i];
+                if (!atomic::load_acquire(&c->_watched_fd_ready)) {
+                    struct pollfd p;
+                    p.fd = c->_watched_fd;
+                    p.events = POLLIN;
+                    p.revents = 0;
+                    fds.push_back(p);
+                    fd_controllers.push_back(c);
+                }
+            }
+            _mutex.unlock();
+            fds[0].revents = 0;
+            if (::poll(&(fds[0]), fds.size(), -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw exc(str::asprintf(_("Cannot wait for input: %s"), std::strerror(errno)), errno);
+            }
+            if (fds[0].revents) {
+                char buf[64];
+                while (::read(_wakeup_pipe[0], buf, sizeof(buf)) > 0);
+            }
+            _mutex.lock();
+            for (size_t i = 0; i < fd_controllers.size(); i++) {
+                if (!fds[i + 1].revents)
+                    continue;
+                // The controller may have been removed in the meantime.
+                for (size_t j = 0; j < _controllers.size(); j++) {
+                    if (_controllers[j] == fd_controllers[i]) {
+                        atomic::store_release(&(fd_controllers[i]->_watched_fd_ready), true);
+                        break;
+                    }
+                }
+            }
+            _mutex.unlock();
+        }
+    }
+};
+#endif
+
+
+controller::controller() throw () :
+    _filtered(false), _watched_fd(-1), _watched_fd_ready(false), _process_events_again(false)
 {
     assert(global_dispatch);
     global_dispatch->register_controller(this);
@@ -82,15 +456,68 @@ controller::controller() throw ()
 controller::~controller()
 {
     assert(global_dispatch);
+    unwatch_fd();
     global_dispatch->deregister_controller(this);
 }
 
+void controller::watch_fd(int fd)
+{
+#if HAVE_POLL
+    assert(global_dispatch);
+    unwatch_fd();
+    _watched_fd = fd;
+    atomic::store_release(&_watched_fd_ready, false);
+    _process_events_again = true;
+    global_dispatch->watch_fd(this);
+#else
+    (void)fd;
+#endif
+}
+
+void controller::unwatch_fd()
+{
+    if (_watched_fd >= 0) {
+        global_dispatch->unwatch_fd(this);
+        _watched_fd = -1;
+    }
+}
+
+void controller::handle_events()
+{
+    if (_watched_fd < 0) {
+        process_events();
+    } else {
+        bool ready = atomic::load_acquire(&_watched_fd_ready);
+        if (ready || _process_events_again) {
+            _process_events_again = false;
+            process_events();
+            if (ready && _watched_fd >= 0) {
+                atomic::store_release(&_watched_fd_ready, false);
+                global_dispatch->rewatch_fd(this);
+            }
+        }
+    }
+}
+
 void controller::send_cmd(const command &cmd)
 {
     assert(global_dispatch);
     global_dispatch->receive_cmd(cmd);
 }
 
+void controller::unsubscribe_all()
+{
+    _filtered = true;
+    _subscriptions.clear();
+}
+
+void controller::subscribe(enum notification::type t)
+{
+    if (static_cast<size_t>(t) >= _subscriptions.size())
+        _subscriptions.resize(t + 1, false);
+    _subscriptions[t] = true;
+}
+
 void controller::receive_notification(const notification& /* note */)
 {
     /* default: ignore the notification */
@@ -111,13 +538,21 @@ bool controller::allow_early_quit()
 dispatch::dispatch(int* argc, char** argv,
         bool equalizer, bool equalizer_3d, bool equalizer_slave_node,
         bool gui, bool have_display, msg::level_t log_level,
-        bool benchmark, int swap_interval) throw () :
+        bool benchmark, int swap_interval, int swap_group, int swap_barrier,
+        const std::string& output_file) throw () :
     _argc(argc), _argv(argv),
     _eq(equalizer), _eq_3d(equalizer_3d), _eq_slave_node(equalizer_slave_node),
-    _gui_mode(gui), _have_display(have_display),
+    _gui_mode(gui), _have_display(have_display), _output_file(output_file),
     _gui(NULL), _audio_output(NULL), _video_output(NULL), _media_input(NULL), _player(NULL),
     _controllers_version(0),
-    _playing(false), _pausing(false), _position(0.0f)
+    _preloader(NULL),
+    _player_thread(NULL), _player_lock_depth(0), _player_notifications_pending(false),
+    _schedule_head(std::numeric_limits<int64_t>::max()),
+    _schedule_due_time(0), _schedule_due(0),
+    _fd_watcher(NULL),
+    _parameter_snapshot(NULL), _parameter_snapshot_version(0),
+    _playing(false), _pausing(false), _position(0.0f),
+    _notified_position(0.0f), _position_notification_time(0)
 {
     assert(!global_dispatch);
     global_dispatch = this;
@@ -125,11 +560,27 @@ dispatch::dispatch(int* argc, char** argv,
     msg::set_level(log_level);
     _parameters.set_benchmark(benchmark);
     _parameters.set_swap_interval(swap_interval);
+    _parameters.set_swap_group(swap_group);
+    _parameters.set_swap_barrier(swap_barrier);
+    publish_parameters();
 }
 
 dispatch::~dispatch()
 {
     deinit();
+#if HAVE_POLL
+    if (_fd_watcher) {
+        _fd_watcher->stop_request();
+        try {
+            _fd_watcher->finish();
+        }
+        catch (std::exception& e) {
+            msg::err("%s", e.what());
+        }
+        delete _fd_watcher;
+    }
+#endif
+    _parameter_snapshot->unref();
     global_dispatch = NULL;
 }
 
@@ -158,11 +609,44 @@ void dispatch::deregister_controller(controller* c)
     _controllers_mutex.unlock();
 }
 
+void dispatch::watch_fd(controller* c)
+{
+#if HAVE_POLL
+    if (!_fd_watcher) {
+        _fd_watcher = new fd_watcher;
+        _fd_watcher->start();
+    }
+    _fd_watcher->add(c);
+#else
+    (void)c;
+#endif
+}
+
+void dispatch::unwatch_fd(controller* c)
+{
+#if HAVE_POLL
+    if (_fd_watcher)
+        _fd_watcher->remove(c);
+#else
+    (void)c;
+#endif
+}
+
+void dispatch::rewatch_fd(controller* /* c */)
+{
+#if HAVE_POLL
+    if (_fd_watcher)
+        _fd_watcher->wakeup();
+#endif
+}
+
 void dispatch::init(const open_input_data& input_data)
 {
     if (_eq) {
         if (!_eq_slave_node && !_parameters.benchmark())
             _audio_output = new class audio_output;
+    } else if (!_output_file.empty()) {
+        _video_output = new video_output_file(_output_file);
     } else if (!_have_display) {
         throw exc(_("Cannot connect to X server."));
     } else if (_gui_mode) {
@@ -192,6 +676,9 @@ void dispatch::init(const open_input_data& input_data)
 
 void dispatch::deinit()
 {
+    lock_player();
+    stop_player_thread();
+    unlock_player();
     force_stop();
     delete _player;
     _player = NULL;
@@ -208,7 +695,12 @@ void dispatch::deinit()
 void dispatch::step()
 {
     assert(global_dispatch);
-    if (global_dispatch->_playing) {
+    if (global_dispatch->_player_thread
+            || atomic::load_acquire(&global_dispatch->_player_notifications_pending)) {
+        global_dispatch->check_player_thread();
+        if (!idle())
+            usleep(1000);
+    } else if (global_dispatch->_playing) {
         if (!global_dispatch->_player->run_step())
             global_dispatch->stop_player();
     } else {
@@ -216,6 +708,12 @@ void dispatch::step()
     }
 }
 
+bool dispatch::idle()
+{
+    assert(global_dispatch);
+    return (global_dispatch->_player_thread && global_dispatch->_player_thread->idle());
+}
+
 bool dispatch::early_quit_is_allowed() const
 {
     for (size_t i = 0; i < _controllers.size(); i++)
@@ -236,8 +734,8 @@ void dispatch::visit_all_controllers(int action, const notification& note) const
     for (size_t i = 0; i < _controllers.size(); i++) {
         controller *c = _controllers[i];
         if (action == 0) {
-            c->process_events();
-        } else {
+            c->handle_events();
+        } else if (c->subscribed(note.type)) {
             c->receive_notification(note);
         }
         visited_controllers.push_back(c);
@@ -262,8 +760,8 @@ void dispatch::visit_all_controllers(int action, const notification& note) const
             }
             if (!visited) {
                 if (action == 0) {
-                    c->process_events();
-                } else {
+                    c->handle_events();
+                } else if (c->subscribed(note.type)) {
                     c->receive_notification(note);
                 }
                 visited_controllers.push_back(c);
@@ -277,15 +775,144 @@ void dispatch::visit_all_controllers(int action, const notification& note) const
 
 void dispatch::notify_all(const notification& note)
 {
+    if (current_thread_is_player) {
+        // Controllers are only called from the GUI thread; see check_player_thread().
+        // Notifications carry no data, so repeated ones within one tick are dropped.
+        for (size_t i = 0; i < _player_notifications.size(); i++)
+            if (_player_notifications[i].type == note.type)
+                return;
+        _player_notifications.push_back(note);
+        atomic::store_release(&_player_notifications_pending, true);
+        return;
+    }
     visit_all_controllers(1, note);
 }
 
 void dispatch::process_all_events()
 {
     assert(global_dispatch);
+    if (current_thread_is_player)
+        return;
+    if (atomic::load_acquire(&global_dispatch->_schedule_due))
+        global_dispatch->run_scheduled_commands();
     global_dispatch->visit_all_controllers(0, notification::noop);
 }
 
+static bool scheduled_before(const std::pair<int64_t, command>& a, const std::pair<int64_t, command>& b)
+{
+    return a.first < b.first;
+}
+
+void dispatch::clear_schedule()
+{
+    _schedule.clear();
+    _schedule_head = std::numeric_limits<int64_t>::max();
+    atomic::store_relaxed(&_schedule_due, 0);
+}
+
+bool dispatch::scheduled_commands_due(int64_t t)
+{
+    // This is called by the player, with the player lock held if it runs in
+    // its own thread. The common case costs a single comparison.
+    if (t < _schedule_head)
+        return false;
+    _schedule_due_time = t;
+    atomic::store_release(&_schedule_due, 1);
+    return true;
+}
+
+void dispatch::run_scheduled_commands()
+{
+    std::vector<command> cmds;
+    lock_player();
+    size_t n = 0;
+    while (n < _schedule.size() && _schedule[n].first <= _schedule_due_time) {
+        cmds.push_back(_schedule[n].second);
+        n++;
+    }
+    _schedule.erase(_schedule.begin(), _schedule.begin() + n);
+    _schedule_head = (_schedule.empty() ? std::numeric_limits<int64_t>::max() : _schedule[0].first);
+    atomic::store_relaxed(&_schedule_due, 0);
+    unlock_player();
+    for (size_t i = 0; i < cmds.size(); i++)
+        receive_cmd(cmds[i]);
+}
+
+bool dispatch::in_player_thread()
+{
+    return current_thread_is_player;
+}
+
+void dispatch::lock_player()
+{
+    if (_player_lock_depth++ == 0)
+        _player_mutex.lock();
+}
+
+void dispatch::unlock_player()
+{
+    assert(_player_lock_depth > 0);
+    if (--_player_lock_depth == 0)
+        _player_mutex.unlock();
+}
+
+void dispatch::start_player_thread()
+{
+    // Equalizer and the file output drive the player steps themselves.
+    if (_eq || !_output_file.empty())
+        return;
+    _player_thread = new class player_thread(_player, _player_mutex);
+    _player_thread->start();
+}
+
+void dispatch::stop_player_thread()
+{
+    // Call this with the player locked.
+    if (_player_thread) {
+        _player_thread->stop_request();
+        // The thread needs the mutex to see the request.
+        _player_mutex.unlock();
+        _player_thread->wait();
+        _player_mutex.lock();
+        delete _player_thread;
+        _player_thread = NULL;
+    }
+}
+
+void dispatch::check_player_thread()
+{
+    lock_player();
+    try {
+        // Deliver the notifications of the player thread.
+        std::vector<notification> notes;
+        notes.swap(_player_notifications);
+        atomic::store_release(&_player_notifications_pending, false);
+        for (size_t i = 0; i < notes.size(); i++)
+            notify_all(notes[i]);
+        // Clean up if the player finished or failed.
+        if (_player_thread && !_player_thread->running()) {
+            class player_thread* t = _player_thread;
+            _player_thread = NULL;
+            bool more_steps = t->more_steps();
+            try {
+                t->finish();
+            }
+            catch (...) {
+                delete t;
+                throw;
+            }
+            delete t;
+            if (!more_steps)
+                stop_player();
+        }
+    }
+    catch (...) {
+        unlock_player();
+        throw;
+    }
+    unlock_player();
+}
+
 class audio_output* dispatch::get_audio_output()
 {
     return _audio_output;
@@ -318,9 +945,32 @@ void dispatch::set_pausing(bool p)
     notify_all(notification::pause);
 }
 
+void dispatch::set_streams(int video_stream, int audio_stream)
+{
+    if (video_stream != _parameters.video_stream()) {
+        _parameters.set_video_stream(video_stream);
+        notify_all(notification::video_stream);
+    }
+    if (audio_stream != _parameters.audio_stream()) {
+        _parameters.set_audio_stream(audio_stream);
+        notify_all(notification::audio_stream);
+    }
+}
+
 void dispatch::set_position(float pos)
 {
+    // The position changes with every audio blob or video frame, but controllers
+    // only display it. Limit the notifications to a few per second, except for
+    // jumps such as seeks, which are shown immediately. dispatch::position()
+    // always returns the exact position.
+    const int64_t position_notification_interval = 50000;
+    int64_t now = timer::get(timer::monotonic);
     _position = pos;
+    if (now - _position_notification_time < position_notification_interval
+            && std::abs(pos - _notified_position) < 0.01f)
+        return;
+    _notified_position = pos;
+    _position_notification_time = now;
     notify_all(notification::pos);
 }
 
@@ -330,6 +980,53 @@ const class parameters& dispatch::parameters()
     return global_dispatch->_parameters;
 }
 
+parameters_ref dispatch::parameters_snapshot()
+{
+    parameters_ref r;
+    r.update();
+    return r;
+}
+
+void dispatch::publish_parameters()
+{
+    // Readers only take the mutex when the version changed, so this is
+    // cheap for them even though we publish after every command.
+    _parameter_snapshot_mutex.lock();
+    const class parameter_snapshot* old_snapshot = _parameter_snapshot;
+    unsigned int version = _parameter_snapshot_version + 1;
+    _parameter_snapshot = new class parameter_snapshot(_parameters, version);
+    atomic::store_release(&_parameter_snapshot_version, version);
+    _parameter_snapshot_mutex.unlock();
+    if (old_snapshot)
+        old_snapshot->unref();
+}
+
+const parameters_ref& parameters_ref::operator=(const parameters_ref& r)
+{
+    if (r._snapshot)
+        r._snapshot->ref();
+    if (_snapshot)
+        _snapshot->unref();
+    _snapshot = r._snapshot;
+    return *this;
+}
+
+bool parameters_ref::update()
+{
+    assert(global_dispatch);
+    if (_snapshot && _snapshot->version()
+            == atomic::load_acquire(&global_dispatch->_parameter_snapshot_version))
+        return false;
+    global_dispatch->_parameter_snapshot_mutex.lock();
+    const parameter_snapshot* snapshot = global_dispatch->_parameter_snapshot;
+    snapshot->ref();
+    global_dispatch->_parameter_snapshot_mutex.unlock();
+    if (_snapshot)
+        _snapshot->unref();
+    _snapshot = snapshot;
+    return true;
+}
+
 const class media_input* dispatch::media_input()
 {
     assert(global_dispatch);
@@ -381,6 +1078,8 @@ void dispatch::stop_player()
 
 void dispatch::force_stop(bool reopen_media_input)
 {
+    stop_player_thread();
+    stop_preloader();
     if (_player) {
         _player->close();
         if (!_eq)
@@ -391,7 +1090,7 @@ void dispatch::force_stop(bool reopen_media_input)
         // close, reopen, and reinitialize media input
         _media_input->close();
         if (reopen_media_input) {
-            _media_input->open(_input_data.urls, _input_data.dev_request);
+            _media_input->open(_input_data.urls, _input_data.dev_request, _parameters);
             _media_input->set_stereo_layout(_parameters.stereo_layout(), _parameters.stereo_layout_swap());
             _media_input->select_video_stream(_parameters.video_stream());
             if (_media_input->audio_streams() > 0)
@@ -413,7 +1112,194 @@ void dispatch::force_stop(bool reopen_media_input)
     _pausing = false;
 }
 
+void dispatch::apply_input_data()
+{
+    // Set the per-video parameters from the input data and the opened media input
+    _parameters.unset_video_parameters();
+    _parameters.set_stereo_layout(_media_input->video_frame_template().stereo_layout);
+    _parameters.set_stereo_layout_swap(_media_input->video_frame_template().stereo_layout_swap);
+    notify_all(notification::stereo_layout);
+    notify_all(notification::stereo_layout_swap);
+    _parameters.set_video_stream(_input_data.params.video_stream());
+    notify_all(notification::video_stream);
+    if (_media_input->audio_streams() > 0) {
+        _parameters.set_audio_stream(_input_data.params.audio_stream());
+    }
+    notify_all(notification::audio_stream);
+    if (_media_input->selected_subtitle_stream() >= 0) {
+        _parameters.set_subtitle_stream(_input_data.params.subtitle_stream());
+        if (_video_output)
+            _video_output->start_subtitle_renderer();
+    }
+    notify_all(notification::subtitle_stream);
+    // Initialize remaining parameters
+    if (_input_data.params.crop_aspect_ratio_is_set())
+        _parameters.set_crop_aspect_ratio(_input_data.params.crop_aspect_ratio());
+    notify_all(notification::crop_aspect_ratio);
+    if (_input_data.params.source_aspect_ratio_is_set())
+        _parameters.set_source_aspect_ratio(_input_data.params.source_aspect_ratio());
+    notify_all(notification::source_aspect_ratio);
+    if (_input_data.params.parallax_is_set())
+        _parameters.set_parallax(_input_data.params.parallax());
+    notify_all(notification::parallax);
+    if (_input_data.params.ghostbust_is_set())
+        _parameters.set_ghostbust(_input_data.params.ghostbust());
+    notify_all(notification::ghostbust);
+    if (_input_data.params.subtitle_parallax_is_set())
+        _parameters.set_subtitle_parallax(_input_data.params.subtitle_parallax());
+    notify_all(notification::subtitle_parallax);
+    if (_input_data.params.vertical_pixel_shift_left_is_set())
+        _parameters.set_vertical_pixel_shift_left(_input_data.params.vertical_pixel_shift_left());
+    notify_all(notification::vertical_pixel_shift_left);
+    if (_input_data.params.vertical_pixel_shift_right_is_set())
+        _parameters.set_vertical_pixel_shift_right(_input_data.params.vertical_pixel_shift_right());
+    notify_all(notification::vertical_pixel_shift_right);
+    if (!_parameters.stereo_mode_is_set()) {
+        if (_media_input->video_frame_template().stereo_layout == parameters::layout_mono)
+            _parameters.set_stereo_mode(parameters::mode_mono_left);
+        else if (_video_output && _video_output->supports_stereo())
+            _parameters.set_stereo_mode(parameters::mode_stereo);
+        else
+            _parameters.set_stereo_mode(parameters::mode_red_cyan_dubois);
+        _parameters.set_stereo_mode_swap(false);
+    }
+    publish_parameters();
+    notify_all(notification::stereo_mode);
+    notify_all(notification::stereo_mode_swap);
+}
+
+open_input_data dispatch::loop_input_data() const
+{
+    // The current input with the current per-video settings, which may differ
+    // from the ones it was opened with
+    open_input_data input_data = _input_data;
+    class parameters unset_params;
+    input_data.params = unset_params;
+    input_data.params.set_video_stream(_parameters.video_stream());
+    input_data.params.set_audio_stream(_parameters.audio_stream());
+    input_data.params.set_subtitle_stream(_parameters.subtitle_stream());
+    input_data.params.set_stereo_layout(_parameters.stereo_layout());
+    input_data.params.set_stereo_layout_swap(_parameters.stereo_layout_swap());
+    input_data.params.set_crop_aspect_ratio(_parameters.crop_aspect_ratio());
+    input_data.params.set_source_aspect_ratio(_parameters.source_aspect_ratio());
+    input_data.params.set_parallax(_parameters.parallax());
+    input_data.params.set_ghostbust(_parameters.ghostbust());
+    input_data.params.set_subtitle_parallax(_parameters.subtitle_parallax());
+    input_data.params.set_vertical_pixel_shift_left(_parameters.vertical_pixel_shift_left());
+    input_data.params.set_vertical_pixel_shift_right(_parameters.vertical_pixel_shift_right());
+    return input_data;
+}
+
+void dispatch::start_preloader()
+{
+    if (_eq || _preloader || !_media_input)
+        return;
+    if (_parameters.loop_mode() == parameters::loop_current) {
+        // Open a second instance of the current input, so that looping
+        // does not need to seek back and restart all decoders. This is not
+        // necessary if the input is played from the clip cache.
+        if (_media_input->is_device() || _media_input->has_clip_cache())
+            return;
+        _preloader = new media_input_preloader(loop_input_data(), _parameters, false);
+    } else if (!_playlist.empty()) {
+        _preloader = new media_input_preloader(_playlist.front(), _parameters, true);
+        _playlist.erase(_playlist.begin());
+    } else {
+        return;
+    }
+    _preloader->start(task::priority_min);
+}
+
+void dispatch::stop_preloader()
+{
+    if (_preloader) {
+        _preloader->wait();
+        // Put a playlist entry back so that it is opened again when playback restarts
+        if (_preloader->is_playlist_entry())
+            _playlist.insert(_playlist.begin(), _preloader->input_data());
+        delete _preloader;
+        _preloader = NULL;
+    }
+}
+
+bool dispatch::switch_to_next_input()
+{
+    if (_parameters.loop_mode() == parameters::loop_current && _media_input->has_clip_cache()) {
+        // Play the cached input again; this involves no decoding at all
+        _media_input->seek(std::numeric_limits<int64_t>::min());
+        return true;
+    }
+    class media_input* next_input = NULL;
+    open_input_data next_input_data;
+    while (!next_input) {
+        if (!_preloader)
+            start_preloader();
+        if (!_preloader)
+            return false;
+        bool is_playlist_entry = _preloader->is_playlist_entry();
+        bool same_params = same_open_parameters(_preloader->params(), _parameters);
+        // This waits only if the next input is not ready yet
+        try {
+            _preloader->finish();
+            next_input = _preloader->release();
+            next_input_data = _preloader->input_data();
+        }
+        catch (std::exception& e) {
+            msg::err(_("Skipping playlist entry: %s"), e.what());
+        }
+        delete _preloader;
+        _preloader = NULL;
+        if (!is_playlist_entry) {
+            // A second instance of the current input for loop mode. If it failed,
+            // or if the settings changed in the meantime, let the player seek instead.
+            // This includes the settings it was opened with, since the preloader
+            // uses a copy of them.
+            std::ostringstream a, b;
+            s11n::save(a, next_input_data.params);
+            s11n::save(b, loop_input_data().params);
+            if (!next_input || a.str() != b.str() || !same_params) {
+                delete next_input;
+                start_preloader();
+                return false;
+            }
+        }
+    }
+    if (_parameters.loop_mode() == parameters::loop_playlist)
+        _playlist.push_back(_input_data);
+    bool audio_initialized = (_media_input->audio_streams() > 0);
+    _media_input->close();
+    delete _media_input;
+    _media_input = next_input;
+    _input_data = next_input_data;
+    apply_input_data();
+    if (_audio_output && !audio_initialized && _media_input->audio_streams() > 0) {
+        _audio_output->deinit();
+        _audio_output->init(_parameters.audio_device(), _media_input->is_device());
+    }
+    notify_all(notification::open);
+    start_preloader();
+    return true;
+}
+
 void dispatch::receive_cmd(const command& cmd)
+{
+    lock_player();
+    try {
+        execute_cmd(cmd);
+    }
+    catch (...) {
+        publish_parameters();
+        unlock_player();
+        throw;
+    }
+    publish_parameters();
+    // The command may require a player step, e.g. to show a still image again.
+    if (_player_thread)
+        _player_thread->wakeup();
+    unlock_player();
+}
+
+void dispatch::execute_cmd(const command& cmd)
 {
     std::istringstream p(cmd.param);
 
@@ -430,13 +1316,14 @@ void dispatch::receive_cmd(const command& cmd)
         force_stop(false);
         notify_all(notification::play);
         s11n::load(p, _input_data);
+        _playlist.clear();
+        clear_schedule();
         // Create media input
         try {
             _media_input = new class media_input;
-            _media_input->open(_input_data.urls, _input_data.dev_request);
-            if (_media_input->video_streams() == 0) {
-                throw exc(_("No video streams found."));
-            }
+            benchmark_stats::open_started();
+            open_media_input(_media_input, _input_data, _parameters);
+            benchmark_stats::open_finished();
         }
         catch (exc& e) {
             delete _media_input;
@@ -448,83 +1335,22 @@ void dispatch::receive_cmd(const command& cmd)
             _media_input = NULL;
             throw e;
         }
-        _parameters.unset_video_parameters();
-        // Initialize media input and associated parameters
-        if (_input_data.params.stereo_layout_is_set() || _input_data.params.stereo_layout_swap_is_set()) {
-            if (!_media_input->stereo_layout_is_supported(_input_data.params.stereo_layout(), _input_data.params.stereo_layout_swap())) {
-                throw exc(_("Cannot set requested stereo layout: incompatible media."));
-            }
-            _media_input->set_stereo_layout(_input_data.params.stereo_layout(),
-                    _input_data.params.stereo_layout_swap());
-            _parameters.set_stereo_layout(_input_data.params.stereo_layout());
-            _parameters.set_stereo_layout_swap(_input_data.params.stereo_layout_swap());
-        } else {
-            _media_input->set_stereo_layout(_media_input->video_frame_template().stereo_layout,
-                    _media_input->video_frame_template().stereo_layout_swap);
-            _parameters.set_stereo_layout(_media_input->video_frame_template().stereo_layout);
-            _parameters.set_stereo_layout_swap(_media_input->video_frame_template().stereo_layout_swap);
-        }
-        notify_all(notification::stereo_layout);
-        notify_all(notification::stereo_layout_swap);
-        if (_media_input->video_streams() < _input_data.params.video_stream() + 1) {
-            throw exc(str::asprintf(_("Video stream %d not found."), _input_data.params.video_stream() + 1));
-        }
-        _media_input->select_video_stream(_input_data.params.video_stream());
-        _parameters.set_video_stream(_input_data.params.video_stream());
-        notify_all(notification::video_stream);
-        if (_media_input->audio_streams() > 0 && _media_input->audio_streams() < _input_data.params.audio_stream() + 1) {
-            throw exc(str::asprintf(_("Audio stream %d not found."), _input_data.params.audio_stream() + 1));
-        }
-        if (_media_input->audio_streams() > 0) {
-            _media_input->select_audio_stream(_input_data.params.audio_stream());
-            _parameters.set_audio_stream(_input_data.params.audio_stream());
-        }
-        notify_all(notification::audio_stream);
-        if (_media_input->subtitle_streams() > 0 && _media_input->subtitle_streams() < _input_data.params.subtitle_stream() + 1) {
-            throw exc(str::asprintf(_("Subtitle stream %d not found."), _input_data.params.subtitle_stream() + 1));
-        }
-        if (_media_input->subtitle_streams() > 0 && _input_data.params.subtitle_stream() >= 0) {
-            _media_input->select_subtitle_stream(_input_data.params.subtitle_stream());
-            _parameters.set_subtitle_stream(_input_data.params.subtitle_stream());
-        }
-        notify_all(notification::subtitle_stream);
-        // Initialize remaining parameters
-        if (_input_data.params.crop_aspect_ratio_is_set())
-            _parameters.set_crop_aspect_ratio(_input_data.params.crop_aspect_ratio());
-        notify_all(notification::crop_aspect_ratio);
-        if (_input_data.params.source_aspect_ratio_is_set())
-            _parameters.set_source_aspect_ratio(_input_data.params.source_aspect_ratio());
-        notify_all(notification::source_aspect_ratio);
-        if (_input_data.params.parallax_is_set())
-            _parameters.set_parallax(_input_data.params.parallax());
-        notify_all(notification::parallax);
-        if (_input_data.params.ghostbust_is_set())
-            _parameters.set_ghostbust(_input_data.params.ghostbust());
-        notify_all(notification::ghostbust);
-        if (_input_data.params.subtitle_parallax_is_set())
-            _parameters.set_subtitle_parallax(_input_data.params.subtitle_parallax());
-        notify_all(notification::subtitle_parallax);
-        if (_input_data.params.vertical_pixel_shift_left_is_set())
-            _parameters.set_vertical_pixel_shift_left(_input_data.params.vertical_pixel_shift_left());
-        notify_all(notification::vertical_pixel_shift_left);
-        if (_input_data.params.vertical_pixel_shift_right_is_set())
-            _parameters.set_vertical_pixel_shift_right(_input_data.params.vertical_pixel_shift_right());
-        notify_all(notification::vertical_pixel_shift_right);
-        if (!_parameters.stereo_mode_is_set()) {
-            if (_media_input->video_frame_template().stereo_layout == parameters::layout_mono)
-                _parameters.set_stereo_mode(parameters::mode_mono_left);
-            else if (_video_output && _video_output->supports_stereo())
-                _parameters.set_stereo_mode(parameters::mode_stereo);
-            else
-                _parameters.set_stereo_mode(parameters::mode_red_cyan_dubois);
-            _parameters.set_stereo_mode_swap(false);
-        }
-        notify_all(notification::stereo_mode);
-        notify_all(notification::stereo_mode_swap);
+        apply_input_data();
         notify_all(notification::open);
         break;
+    case command::queue:
+        {
+            open_input_data input_data;
+            s11n::load(p, input_data);
+            _playlist.push_back(input_data);
+            if (playing())
+                start_preloader();
+        }
+        break;
     case command::close:
         force_stop(false);
+        _playlist.clear();
+        clear_schedule();
         notify_all(notification::play);
         notify_all(notification::open);
         break;
@@ -537,7 +1363,7 @@ void dispatch::receive_cmd(const command& cmd)
             // Initialize audio output
             if (_media_input->audio_streams() > 0 && _audio_output) {
                 _audio_output->deinit();
-                _audio_output->init(_parameters.audio_device());
+                _audio_output->init(_parameters.audio_device(), _media_input->is_device());
             }
             // Initialize video output
             if (_video_output) {
@@ -569,6 +1395,8 @@ void dispatch::receive_cmd(const command& cmd)
             }
             _player->open();
             _playing = true;
+            start_preloader();
+            start_player_thread();
             notify_all(notification::play);
         }
         break;
@@ -591,6 +1419,10 @@ void dispatch::receive_cmd(const command& cmd)
             _player->set_pos(s11n::load<float>(p));
         /* notify when request is fulfilled */
         break;
+    case command::scrub:
+        if (_player)
+            _player->scrub(s11n::load<float>(p));
+        break;
     // Per-Session parameters
     case command::set_audio_device:
         _parameters.set_audio_device(s11n::load<int>(p));
@@ -600,6 +1432,14 @@ void dispatch::receive_cmd(const command& cmd)
         _parameters.set_quality(s11n::load<int>(p));
         notify_all(notification::quality);
         break;
+    case command::set_adaptive_quality:
+        _parameters.set_adaptive_quality(s11n::load<bool>(p));
+        notify_all(notification::adaptive_quality);
+        break;
+    case command::set_deinterlacing:
+        _parameters.set_deinterlacing(static_cast<parameters::deinterlacing_t>(s11n::load<int>(p)));
+        notify_all(notification::deinterlacing);
+        break;
     case command::set_stereo_mode:
         _parameters.set_stereo_mode(static_cast<parameters::stereo_mode_t>(s11n::load<int>(p)));
         notify_all(notification::stereo_mode);
@@ -646,6 +1486,10 @@ void dispatch::receive_cmd(const command& cmd)
         _parameters.set_fullscreen_3d_ready_sync(s11n::load<bool>(p));
         notify_all(notification::fullscreen_3d_ready_sync);
         break;
+    case command::set_fullscreen_per_screen:
+        _parameters.set_fullscreen_per_screen(s11n::load<bool>(p));
+        notify_all(notification::fullscreen_per_screen);
+        break;
     case command::adjust_contrast:
         _parameters.set_contrast(clamp(_parameters.contrast() + s11n::load<float>(p), -1.0f, +1.0f));
         notify_all(notification::contrast);
@@ -688,6 +1532,11 @@ void dispatch::receive_cmd(const command& cmd)
         break;
     case command::set_loop_mode:
         _parameters.set_loop_mode(static_cast<parameters::loop_mode_t>(s11n::load<int>(p)));
+        if (playing()) {
+            // The next input depends on the loop mode
+            stop_preloader();
+            start_preloader();
+        }
         notify_all(notification::loop_mode);
         break;
     case command::set_audio_delay:
@@ -718,6 +1567,66 @@ void dispatch::receive_cmd(const command& cmd)
         _parameters.set_subtitle_shadow(s11n::load<int>(p));
         notify_all(notification::subtitle_shadow);
         break;
+    case command::set_hwaccel:
+        _parameters.set_hwaccel(s11n::load<std::string>(p));
+        notify_all(notification::hwaccel);
+        break;
+    case command::set_lowres_decoding:
+        _parameters.set_lowres_decoding(s11n::load<bool>(p));
+        notify_all(notification::lowres_decoding);
+        break;
+    case command::set_display_sync:
+        _parameters.set_display_sync(s11n::load<bool>(p));
+        notify_all(notification::display_sync);
+        break;
+    case command::set_demuxer_buffer:
+        _parameters.set_demuxer_buffer(s11n::load<float>(p));
+        notify_all(notification::demuxer_buffer);
+        break;
+    case command::set_read_cache:
+        _parameters.set_read_cache(s11n::load<int>(p));
+        notify_all(notification::read_cache);
+        break;
+    case command::set_probe_size:
+        _parameters.set_probe_size(s11n::load<int>(p));
+        notify_all(notification::probe_size);
+        break;
+    case command::set_analyze_duration:
+        _parameters.set_analyze_duration(s11n::load<float>(p));
+        notify_all(notification::analyze_duration);
+        break;
+    case command::set_clip_cache:
+        _parameters.set_clip_cache(s11n::load<int>(p));
+        notify_all(notification::clip_cache);
+        break;
+    case command::set_memory_limit:
+        _parameters.set_memory_limit(s11n::load<int>(p));
+        notify_all(notification::memory_limit);
+        break;
+    case command::set_adaptive_bitrate:
+        _parameters.set_adaptive_bitrate(s11n::load<bool>(p));
+        notify_all(notification::adaptive_bitrate);
+        break;
+    case command::set_live_capture:
+        _parameters.set_live_capture(s11n::load<bool>(p));
+        notify_all(notification::live_capture);
+        break;
+    case command::set_decode_ahead:
+        _parameters.set_decode_ahead(s11n::load<int>(p));
+        notify_all(notification::decode_ahead);
+        break;
+    case command::set_image_duration:
+        _parameters.set_image_duration(s11n::load<float>(p));
+        notify_all(notification::image_duration);
+        break;
+    case command::set_audio_buffers:
+        _parameters.set_audio_buffers(s11n::load<int>(p));
+        notify_all(notification::audio_buffers);
+        break;
+    case command::set_audio_buffer_size:
+        _parameters.set_audio_buffer_size(s11n::load<int>(p));
+        notify_all(notification::audio_buffer_size);
+        break;
 #if HAVE_LIBXNVCTRL
     case command::set_sdi_output_format:
         _parameters.set_sdi_output_format(s11n::load<int>(p));
@@ -778,6 +1687,8 @@ void dispatch::receive_cmd(const command& cmd)
                 s = -1;
             s = _player->set_subtitle_stream(s);
             _parameters.set_subtitle_stream(s);
+            if (s >= 0 && _video_output)
+                _video_output->start_subtitle_renderer();
             notify_all(notification::subtitle_stream);
         }
         break;
@@ -786,6 +1697,8 @@ void dispatch::receive_cmd(const command& cmd)
             int s = s11n::load<int>(p);
             s = _player->set_subtitle_stream(s);
             _parameters.set_subtitle_stream(s);
+            if (s >= 0 && _video_output)
+                _video_output->start_subtitle_renderer();
             notify_all(notification::subtitle_stream);
         }
         break;
@@ -886,31 +1799,46 @@ void dispatch::receive_cmd(const command& cmd)
         _parameters.set_audio_mute(!_parameters.audio_mute());
         notify_all(notification::audio_mute);
         break;
+    case command::toggle_stats_overlay:
+        _parameters.set_stats_overlay(!_parameters.stats_overlay());
+        notify_all(notification::stats_overlay);
+        break;
     case command::update_display_pos:
         notify_all(notification::display_pos);
         break;
+    // Scripting
+    case command::schedule:
+        {
+            std::pair<int64_t, command> entry;
+            s11n::load(p, entry.first);
+            entry.second.type = static_cast<enum command::type>(s11n::load<int>(p));
+            s11n::load(p, entry.second.param);
+            // Commands with the same time are executed in the order they arrived.
+            _schedule.insert(std::upper_bound(_schedule.begin(), _schedule.end(), entry, scheduled_before), entry);
+            _schedule_head = _schedule[0].first;
+        }
+        break;
     }
 }
 
 std::string dispatch::save_state() const
 {
-    std::ostringstream oss;
-    s11n::save(oss, _input_data);
-    s11n::save(oss, _parameters);
-    s11n::save(oss, _playing);
-    s11n::save(oss, _pausing);
-    s11n::save(oss, _position);
-    return oss.str();
+    s11n::writer w;
+    s11n::save(w, _input_data);
+    s11n::save(w, _parameters);
+    s11n::save(w, _playing);
+    s11n::save(w, _pausing);
+    return w.str();
 }
 
 void dispatch::load_state(const std::string& s)
 {
-    std::istringstream iss(s);
-    s11n::load(iss, _input_data);
-    s11n::load(iss, _parameters);
-    s11n::load(iss, _playing);
-    s11n::load(iss, _pausing);
-    s11n::load(iss, _position);
+    s11n::reader r(s);
+    s11n::load(r, _input_data);
+    s11n::load(r, _parameters);
+    s11n::load(r, _playing);
+    s11n::load(r, _pausing);
+    publish_parameters();
 }
 
 static bool parse_bool(const std::string& s, bool* x)
@@ -1042,6 +1970,7 @@ bool dispatch::parse_command(const std::string& s, command* c)
     parameters::stereo_layout_t p_stereo_layout;
     parameters::stereo_mode_t p_stereo_mode;
     open_input_data p_oid;
+    double p_time;
 
     /* Please keep this in the same order as commands are declared in dispatch.h */
 
@@ -1055,6 +1984,11 @@ bool dispatch::parse_command(const std::string& s, command* c)
         std::ostringstream v;
         s11n::save(v, p_oid);
         *c = command(command::open, v.str());
+    } else if (tokens.size() > 1 && tokens[0] == "queue"
+            && parse_open_input_data(tokens, &p_oid)) {
+        std::ostringstream v;
+        s11n::save(v, p_oid);
+        *c = command(command::queue, v.str());
     } else if (tokens.size() == 1 && tokens[0] == "close") {
         *c = command(command::close);
     } else if (tokens.size() == 1 && tokens[0] == "toggle-play") {
@@ -1086,12 +2020,22 @@ bool dispatch::parse_command(const std::string& s, command* c)
     } else if (tokens.size() == 2 && tokens[0] == "set-pos"
             && str::to(tokens[1], &p.f) && p.f >= 0.0f && p.f <= 1.0f) {
         *c = command(command::set_pos, p.f);
+    } else if (tokens.size() == 2 && tokens[0] == "scrub"
+            && str::to(tokens[1], &p.f) && p.f >= 0.0f && p.f <= 1.0f) {
+        *c = command(command::scrub, p.f);
     } else if (tokens.size() == 2 && tokens[0] == "set-audio-device"
             && str::to(tokens[1], &p.i)) {
         *c = command(command::set_audio_device, p.i);
     } else if (tokens.size() == 2 && tokens[0] == "set-quality"
             && str::to(tokens[1], &p.i)) {
         *c = command(command::set_quality, p.i);
+    } else if (tokens.size() == 2 && tokens[0] == "set-adaptive-quality"
+            && parse_bool(tokens[1], &p.b)) {
+        *c = command(command::set_adaptive_quality, p.b);
+    } else if (tokens.size() == 2 && tokens[0] == "set-deinterlacing"
+            && (tokens[1] == "off" || tokens[1] == "bob" || tokens[1] == "adaptive")) {
+        *c = command(command::set_deinterlacing,
+                static_cast<int>(parameters::deinterlacing_from_string(tokens[1])));
     } else if (tokens.size() == 2 && tokens[0] == "set-stereo-mode"
             && parameters::parse_stereo_mode(tokens[1], &p_stereo_mode)) {
         *c = command(command::set_stereo_mode, static_cast<int>(p_stereo_mode));
@@ -1130,6 +2074,9 @@ bool dispatch::parse_command(const std::string& s, command* c)
     } else if (tokens.size() == 2 && tokens[0] == "set-fullscreen-3dr-sync"
             && parse_bool(tokens[1], &p.b)) {
         *c = command(command::set_fullscreen_3d_ready_sync, p.b);
+    } else if (tokens.size() == 2 && tokens[0] == "set-fullscreen-per-screen"
+            && parse_bool(tokens[1], &p.b)) {
+        *c = command(command::set_fullscreen_per_screen, p.b);
     } else if (tokens.size() == 2 && tokens[0] == "set-contrast"
             && str::to(tokens[1], &p.f)) {
         *c = command(command::set_contrast, p.f);
@@ -1161,9 +2108,10 @@ bool dispatch::parse_command(const std::string& s, command* c)
             && str::to(tokens[1], &p.f)) {
         *c = command(command::adjust_zoom, p.f);
     } else if (tokens.size() == 2 && tokens[0] == "set-loop-mode"
-            && (tokens[1] == "off" || tokens[1] == "current")) {
-        parameters::loop_mode_t l = (tokens[1] == "off"
-                ? parameters::no_loop : parameters::loop_current);
+            && (tokens[1] == "off" || tokens[1] == "current" || tokens[1] == "playlist")) {
+        parameters::loop_mode_t l = (tokens[1] == "off" ? parameters::no_loop
+                : tokens[1] == "current" ? parameters::loop_current
+                : parameters::loop_playlist);
         *c = command(command::set_loop_mode, static_cast<int>(l));
     } else if (tokens.size() == 2 && tokens[0] == "set-audio-delay"
             && str::to(tokens[1], &p.i)) {
@@ -1186,6 +2134,52 @@ bool dispatch::parse_command(const std::string& s, command* c)
     } else if (tokens.size() == 2 && tokens[0] == "set-subtitle-shadow"
             && str::to(tokens[1], &p.i)) {
         *c = command(command::set_subtitle_shadow, p.i);
+    } else if ((tokens.size() == 1 || tokens.size() == 2) && tokens[0] == "set-hwaccel") {
+        std::ostringstream v;
+        s11n::save(v, tokens.size() > 1 ? tokens[1] : std::string(""));
+        *c = command(command::set_hwaccel, v.str());
+    } else if (tokens.size() == 2 && tokens[0] == "set-lowres-decoding"
+            && parse_bool(tokens[1], &p.b)) {
+        *c = command(command::set_lowres_decoding, p.b);
+    } else if (tokens.size() == 2 && tokens[0] == "set-display-sync"
+            && parse_bool(tokens[1], &p.b)) {
+        *c = command(command::set_display_sync, p.b);
+    } else if (tokens.size() == 2 && tokens[0] == "set-demuxer-buffer"
+            && str::to(tokens[1], &p.f)) {
+        *c = command(command::set_demuxer_buffer, p.f);
+    } else if (tokens.size() == 2 && tokens[0] == "set-read-cache"
+            && str::to(tokens[1], &p.i)) {
+        *c = command(command::set_read_cache, p.i);
+    } else if (tokens.size() == 2 && tokens[0] == "set-probe-size"
+            && str::to(tokens[1], &p.i)) {
+        *c = command(command::set_probe_size, p.i);
+    } else if (tokens.size() == 2 && tokens[0] == "set-analyze-duration"
+            && str::to(tokens[1], &p.f)) {
+        *c = command(command::set_analyze_duration, p.f);
+    } else if (tokens.size() == 2 && tokens[0] == "set-clip-cache"
+            && str::to(tokens[1], &p.i)) {
+        *c = command(command::set_clip_cache, p.i);
+    } else if (tokens.size() == 2 && tokens[0] == "set-memory-limit"
+            && str::to(tokens[1], &p.i)) {
+        *c = command(command::set_memory_limit, p.i);
+    } else if (tokens.size() == 2 && tokens[0] == "set-adaptive-bitrate"
+            && parse_bool(tokens[1], &p.b)) {
+        *c = command(command::set_adaptive_bitrate, p.b);
+    } else if (tokens.size() == 2 && tokens[0] == "set-live-capture"
+            && parse_bool(tokens[1], &p.b)) {
+        *c = command(command::set_live_capture, p.b);
+    } else if (tokens.size() == 2 && tokens[0] == "set-decode-ahead"
+            && str::to(tokens[1], &p.i)) {
+        *c = command(command::set_decode_ahead, p.i);
+    } else if (tokens.size() == 2 && tokens[0] == "set-image-duration"
+            && str::to(tokens[1], &p.f)) {
+        *c = command(command::set_image_duration, p.f);
+    } else if (tokens.size() == 2 && tokens[0] == "set-audio-buffers"
+            && str::to(tokens[1], &p.i)) {
+        *c = command(command::set_audio_buffers, p.i);
+    } else if (tokens.size() == 2 && tokens[0] == "set-audio-buffer-size"
+            && str::to(tokens[1], &p.i)) {
+        *c = command(command::set_audio_buffer_size, p.i);
     } else if (tokens.size() == 2 && tokens[0] == "set-video-stream"
             && str::to(tokens[1], &p.i) && p.i >= 0) {
         *c = command(command::set_video_stream, p.i);
@@ -1249,6 +2243,26 @@ bool dispatch::parse_command(const std::string& s, command* c)
         *c = command(command::adjust_audio_volume, p.f);
     } else if (tokens.size() == 1 && tokens[0] == "toggle-audio-mute") {
         *c = command(command::toggle_audio_mute);
+    } else if (tokens.size() == 1 && tokens[0] == "toggle-stats-overlay") {
+        *c = command(command::toggle_stats_overlay);
+    } else if (tokens.size() > 2 && tokens[0] == "at"
+            && str::to(tokens[1], &p_time) && p_time >= 0.0) {
+        // The remaining tokens form the command to schedule.
+        std::string s;
+        for (size_t i = 2; i < tokens.size(); i++) {
+            if (i > 2)
+                s += ' ';
+            s += tokens[i];
+        }
+        command scheduled_cmd;
+        ok = parse_command(s, &scheduled_cmd);
+        if (ok) {
+            std::ostringstream v;
+            s11n::save(v, static_cast<int64_t>(p_time * 1e6));
+            s11n::save(v, static_cast<int>(scheduled_cmd.type));
+            s11n::save(v, scheduled_cmd.param);
+            *c = command(command::schedule, v.str());
+        }
     } else {
         ok = false;
     }
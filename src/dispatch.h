@@ -56,6 +56,12 @@ public:
     // Serialization
     void save(std::ostream &os) const;
     void load(std::istream &is);
+    void save(s11n::writer &w) const;
+    void load(s11n::reader &r);
+
+private:
+    template<typename OS> void save_binary(OS &os) const;
+    template<typename IS> void load_binary(IS &is);
 };
 
 
@@ -83,15 +89,19 @@ public:
         quit,                           // no parameters
         // Play state
         open,                           // open_input_data
+        queue,                          // open_input_data (appended to the playlist)
         close,                          // no parameters
         toggle_play,                    // no parameters
         toggle_pause,                   // no parameters
         step,                           // no parameters
         seek,                           // float (relative adjustment)
         set_pos,                        // float (absolute position)
+        scrub,                          // float (absolute position to preview)
         // Per-Session parameters
         set_audio_device,               // int
         set_quality,                    // int
+        set_adaptive_quality,           // bool
+        set_deinterlacing,              // parameters::deinterlacing_t
         set_stereo_mode,                // parameters::stereo_mode
         set_stereo_mode_swap,           // bool
         toggle_stereo_mode_swap,        // no parameters
@@ -103,6 +113,7 @@ public:
         set_fullscreen_flop_right,      // bool
         set_fullscreen_inhibit_screensaver,     // bool
         set_fullscreen_3d_ready_sync,   // bool
+        set_fullscreen_per_screen,      // bool
         set_contrast,                   // float (absolute value)
         adjust_contrast,                // float (relative adjustment)
         set_brightness,                 // float (absolute value)
@@ -121,6 +132,21 @@ public:
         set_subtitle_scale,             // float
         set_subtitle_color,             // uint64_t
         set_subtitle_shadow,            // int
+        set_hwaccel,                    // string (hardware decoding method)
+        set_lowres_decoding,            // bool
+        set_display_sync,               // bool
+        set_demuxer_buffer,             // float (seconds)
+        set_read_cache,                 // int (MiB)
+        set_probe_size,                 // int (KiB)
+        set_analyze_duration,           // float (seconds)
+        set_clip_cache,                 // int (MiB)
+        set_memory_limit,               // int (MiB)
+        set_adaptive_bitrate,           // bool
+        set_live_capture,               // bool
+        set_decode_ahead,               // int (frames)
+        set_image_duration,             // float (seconds)
+        set_audio_buffers,              // int
+        set_audio_buffer_size,          // int (bytes)
 #if HAVE_LIBXNVCTRL
         set_sdi_output_format,          // int
         set_sdi_output_left_stereo_mode,  // parameters::stereo_mode_t
@@ -151,7 +177,10 @@ public:
         set_audio_volume,               // float (absolute value)
         adjust_audio_volume,            // float (relative adjustment)
         toggle_audio_mute,              // no parameters
+        toggle_stats_overlay,           // no parameters
         update_display_pos,             // no parameters
+        // Scripting
+        schedule,                       // int64_t (presentation time), int (command type), string (command parameter)
     };
     
     type type;
@@ -223,6 +252,8 @@ public:
         // Per-Session parameters
         audio_device,
         quality,
+        adaptive_quality,
+        deinterlacing,
         stereo_mode,
         stereo_mode_swap,
         crosstalk,
@@ -233,6 +264,7 @@ public:
         fullscreen_flop_right,
         fullscreen_inhibit_screensaver,
         fullscreen_3d_ready_sync,
+        fullscreen_per_screen,
         contrast,
         brightness,
         hue,
@@ -246,6 +278,21 @@ public:
         subtitle_scale,
         subtitle_color,
         subtitle_shadow,
+        hwaccel,
+        lowres_decoding,
+        display_sync,
+        demuxer_buffer,
+        read_cache,
+        probe_size,
+        analyze_duration,
+        clip_cache,
+        memory_limit,
+        adaptive_bitrate,
+        live_capture,
+        decode_ahead,
+        image_duration,
+        audio_buffers,
+        audio_buffer_size,
 #if HAVE_LIBXNVCTRL
         sdi_output_format,
         sdi_output_left_stereo_mode,
@@ -269,6 +316,7 @@ public:
         center,
         audio_volume,
         audio_mute,
+        stats_overlay,
         display_pos,
     };
 
@@ -284,6 +332,36 @@ public:
 
 class controller
 {
+private:
+    bool _filtered;                     // whether only subscribed notifications are received
+    std::vector<bool> _subscriptions;   // indexed by notification type
+    int _watched_fd;                    // file descriptor that signals events, or -1
+    bool _watched_fd_ready;             // accessed atomically; set by the fd watcher
+    bool _process_events_again;
+
+protected:
+    /* A controller receives all notifications by default. After a call to
+     * unsubscribe_all(), it receives only the notification types that it then
+     * subscribes to. This keeps frequent notifications such as notification::pos
+     * away from controllers that do not use them. */
+    void unsubscribe_all();
+    void subscribe(enum notification::type t);
+
+    /* A controller's process_events() function is called on every step of
+     * the main loop by default. A controller that only reacts to input on a
+     * file descriptor can watch it instead: process_events() is then only
+     * called when there is input, so that an idle controller costs nothing.
+     * If process_events() returns with work left over (buffered input, a
+     * timeout), it calls process_events_again() to be called on the next step
+     * regardless of input. The file descriptor must be unwatched before it is
+     * closed. */
+    void watch_fd(int fd);
+    void unwatch_fd();
+    void process_events_again()
+    {
+        _process_events_again = true;
+    }
+
 public:
     controller() throw ();
     virtual ~controller();
@@ -311,6 +389,99 @@ public:
      * This is intended to be used for controllers that might send another
      * 'open' command in the future. */
     virtual bool allow_early_quit();
+
+    /* Whether the controller receives the given notification type. */
+    bool subscribed(enum notification::type t) const
+    {
+        return (!_filtered || (static_cast<size_t>(t) < _subscriptions.size() && _subscriptions[t]));
+    }
+
+    /* Call process_events() if there is something to do. */
+    void handle_events();
+
+    friend class fd_watcher;
+};
+
+// Parameter snapshots.
+// The dispatch publishes an immutable copy of its parameters whenever they
+// might have changed. Threads other than the main and player threads
+// (rendering, subtitle rendering) hold a reference to a snapshot instead of
+// using dispatch::parameters(), which the main thread may change at any time.
+
+class parameter_snapshot
+{
+private:
+    const class parameters _parameters;
+    const unsigned int _version;
+    mutable int _refs;
+
+    parameter_snapshot(const class parameters& p, unsigned int version) :
+        _parameters(p), _version(version), _refs(1)
+    {
+    }
+
+public:
+    const class parameters& parameters() const
+    {
+        return _parameters;
+    }
+    unsigned int version() const
+    {
+        return _version;
+    }
+    void ref() const
+    {
+        atomic::inc_and_fetch(&_refs);
+    }
+    void unref() const
+    {
+        if (atomic::dec_and_fetch(&_refs) == 0)
+            delete this;
+    }
+
+    friend class dispatch;
+};
+
+// A reference to a parameter snapshot. It is empty until update() is called
+// for the first time. Copying it only copies a pointer.
+
+class parameters_ref
+{
+private:
+    const parameter_snapshot* _snapshot;
+
+public:
+    parameters_ref() : _snapshot(NULL)
+    {
+    }
+    parameters_ref(const parameters_ref& r) : _snapshot(r._snapshot)
+    {
+        if (_snapshot)
+            _snapshot->ref();
+    }
+    ~parameters_ref()
+    {
+        if (_snapshot)
+            _snapshot->unref();
+    }
+    const parameters_ref& operator=(const parameters_ref& r);
+
+    /* Switch to the latest snapshot. Return true if the parameters changed.
+     * This is cheap if they did not. */
+    bool update();
+
+    bool is_empty() const
+    {
+        return !_snapshot;
+    }
+    unsigned int version() const
+    {
+        return _snapshot ? _snapshot->version() : 0;
+    }
+    const class parameters& get() const
+    {
+        return _snapshot->parameters();
+    }
 };
 
 // The dispatch (singleton).
@@ -325,6 +496,7 @@ private:
     const bool _eq_slave_node;
     const bool _gui_mode;
     const bool _have_display;
+    const std::string _output_file;
     // Objects
     class gui* _gui;
     class audio_output* _audio_output;
@@ -334,16 +506,52 @@ private:
     std::vector<controller*> _controllers;
     unsigned int _controllers_version;
     mutex _controllers_mutex;
-    // Parameters
+    // Playlist: inputs to play after the current one, and the background
+    // opener for the next one
+    std::vector<open_input_data> _playlist;
+    class media_input_preloader* _preloader;
+    // Player thread, used when Bino is driven by the Qt event loop. The mutex
+    // serializes its steps with the command handling in the GUI thread, and
+    // notifications from the player thread wait for the GUI thread.
+    class player_thread* _player_thread;
+    mutex _player_mutex;
+    int _player_lock_depth;
+    std::vector<notification> _player_notifications;
+    bool _player_notifications_pending; // whether the above is non-empty; read without the mutex
+    // Commands scheduled for presentation times of the current input, sorted by
+    // time. The player only compares the time of the first one with each frame.
+    std::vector<std::pair<int64_t, command> > _schedule;
+    int64_t _schedule_head;             // time of the first scheduled command
+    int64_t _schedule_due_time;         // presentation time of the frame that waits for them
+    int _schedule_due;                  // set by the player when a frame waits for them
+    // Thread that waits for input on the file descriptors watched by controllers
+    class fd_watcher* _fd_watcher;
+    // Parameters, and the snapshot of them that was published last
     open_input_data _input_data;
     class parameters _parameters;
+    const parameter_snapshot* _parameter_snapshot;
+    unsigned int _parameter_snapshot_version;
+    mutex _parameter_snapshot_mutex;
     // State
     bool _playing;
     bool _pausing;
     float _position;
+    float _notified_position;           // position at the last notification::pos
+    int64_t _position_notification_time;
 
     void stop_player();
     void force_stop(bool reopen_media_input = true);
+    void apply_input_data();
+    open_input_data loop_input_data() const;
+    void start_preloader();
+    void stop_preloader();
+    void start_player_thread();
+    void stop_player_thread();
+    void check_player_thread();
+    void execute_cmd(const command& cmd);
+    void publish_parameters();
+    void clear_schedule();
+    void run_scheduled_commands();
 
     bool early_quit_is_allowed() const;
     void visit_all_controllers(int action, const notification& note) const;
@@ -353,21 +561,33 @@ public:
     dispatch(int* argc, char** argv,
             bool equalizer, bool equalizer_3d, bool equalizer_slave_node,
             bool gui, bool have_display, msg::level_t log_level,
-            bool benchmark, int swap_interval) throw ();
+            bool benchmark, int swap_interval, int swap_group, int swap_barrier,
+            const std::string& output_file) throw ();
     virtual ~dispatch();
 
     void register_controller(controller* c);
     void deregister_controller(controller* c);
+    /* See controller::watch_fd(). */
+    void watch_fd(controller* c);
+    void unwatch_fd(controller* c);
+    void rewatch_fd(controller* c);
 
     void init(const open_input_data& input_data);
     void deinit();
 
     static void step();
+    /* Whether the player idles until the next command, e.g. while it shows a
+     * still image. Event loops may then call step() less often. */
+    static bool idle();
 
     /* Process events for all controllers */
     static void process_all_events();
 
-    /* Access parameters and state (read-only) */
+    /* Access parameters and state (read-only).
+     * The parameters are changed by receive_cmd() with the player locked, so
+     * parameters() may only be used in the main thread and in the player
+     * thread. Other threads use parameters_snapshot(), or get the parameters
+     * they need from the thread that starts them, like media_input::open(). */
     static const class parameters& parameters();
     static const class audio_output* audio_output();    // NULL if not available
     static const class video_output* video_output();    // NULL if not available
@@ -375,10 +595,20 @@ public:
     static bool playing();
     static bool pausing();
     static float position();
+    /* A snapshot of the parameters, for use outside of the main and player threads. */
+    static parameters_ref parameters_snapshot();
 
     /* Receive a command from a controller. */
     void receive_cmd(const command& cmd);
 
+    /* Whether the calling thread is the player thread. */
+    static bool in_player_thread();
+    /* Keep the player thread from running its next step. This is needed by
+     * code in the GUI thread that changes the outputs outside of receive_cmd().
+     * Calls can be nested. */
+    void lock_player();
+    void unlock_player();
+
     /* Interface for the player. TODO: remove this! */
     class audio_output* get_audio_output(); // NULL if not available
     class video_output* get_video_output(); // NULL if not available
@@ -386,8 +616,23 @@ public:
     void set_playing(bool p);
     void set_pausing(bool p);
     void set_position(float pos);
-
-    /* Interface for Equalizer. */
+    /* The player switched streams on its own, e.g. between the variants of
+     * an adaptive network stream. */
+    void set_streams(int video_stream, int audio_stream);
+    /* Replace the media input with the next input from the playlist, which
+     * was opened in the background. The audio and video outputs are kept.
+     * Return false if there is no next input. */
+    bool switch_to_next_input();
+    /* Check if commands are scheduled for the video frame with the given
+     * presentation time (relative to the start of the input), which is about to
+     * be displayed. If so, the player must not display it until the commands
+     * were executed by the next process_all_events() call. */
+    bool scheduled_commands_due(int64_t t);
+
+    friend class parameters_ref;
+
+    /* Interface for Equalizer. The state does not include the position,
+     * which changes with every frame and is distributed separately. */
     class open_input_data* get_input_data();
     std::string save_state() const;
     void load_state(const std::string& s);
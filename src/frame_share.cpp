@@ -0,0 +1,208 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <cerrno>
+#include <cstring>
+
+#if HAVE_SHM_OPEN
+# include <sys/types.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#include "base/exc.h"
+#include "base/str.h"
+#include "base/msg.h"
+#include "base/pth.h"
+
+#include "base/gettext.h"
+#define _(string) gettext(string)
+
+#include "frame_share.h"
+
+
+static std::string share_name;
+static bool share_views = false;
+
+void frame_share::set_name(const std::string& name)
+{
+    share_name = name;
+}
+
+void frame_share::set_views(bool views)
+{
+    share_views = views;
+}
+
+bool frame_share::enabled()
+{
+    return !share_name.empty();
+}
+
+bool frame_share::per_view()
+{
+    return share_views;
+}
+
+frame_share::frame_share() :
+    _fd(-1), _map(NULL), _map_size(0), _header(NULL),
+    _width(0), _height(0), _views(0), _slot(0)
+{
+}
+
+frame_share::~frame_share()
+{
+    close();
+}
+
+#if HAVE_SHM_OPEN
+
+// Round up to a multiple of the page size, so that consumers can map single slots.
+static uint64_t page_align(uint64_t size)
+{
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+}
+
+void frame_share::open(int width, int height, int views)
+{
+    if (_header && width == _width && height == _height && views == _views)
+    {
+        return;
+    }
+    close();
+    uint64_t stride = static_cast<uint64_t>(width) * 4;
+    uint64_t slot_offset = page_align(sizeof(frame_share_header));
+    uint64_t data_offset = page_align(sizeof(frame_share_slot));
+    uint64_t slot_size = data_offset + page_align(stride * height * views);
+    _map_size = slot_offset + _slot_count * slot_size;
+    // Recreate the object, so that consumers of an object with a different
+    // geometry never see it change under their feet.
+    shm_unlink(share_name.c_str());
+    _fd = shm_open(share_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (_fd < 0 || ftruncate(_fd, _map_size) < 0
+            || (_map = mmap(NULL, _map_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0)) == MAP_FAILED)
+    {
+        int e = errno;
+        _map = NULL;
+        close();
+        throw exc(str::asprintf(_("Cannot create shared memory %s: %s"),
+                    share_name.c_str(), std::strerror(e)), e);
+    }
+    // The object is zero-filled, so all slots start out unwritten.
+    _header = static_cast<frame_share_header *>(_map);
+    std::memcpy(_header->magic, "BINOSHM", 8);
+    _header->version = 1;
+    _header->slots = _slot_count;
+    _header->width = width;
+    _header->height = height;
+    _header->stride = stride;
+    _header->views = views;
+    _header->slot_offset = slot_offset;
+    _header->slot_size = slot_size;
+    _header->data_offset = data_offset;
+    _width = width;
+    _height = height;
+    _views = views;
+    _slot = 0;
+    msg::inf(_("Sharing %dx%d frames (%s) in shared memory %s."), width, height,
+            views == 2 ? _("left and right view") : _("output"), share_name.c_str());
+}
+
+void frame_share::close()
+{
+    if (_header)
+    {
+        atomic::store_release(&_header->closed, static_cast<uint32_t>(1));
+        munmap(_map, _map_size);
+        shm_unlink(share_name.c_str());
+        _map = NULL;
+        _header = NULL;
+    }
+    if (_fd >= 0)
+    {
+        ::close(_fd);
+        _fd = -1;
+    }
+    _width = 0;
+    _height = 0;
+    _views = 0;
+}
+
+static frame_share_slot* get_slot(frame_share_header* header, int slot)
+{
+    return reinterpret_cast<frame_share_slot *>(reinterpret_cast<char *>(header)
+            + header->slot_offset + slot * header->slot_size);
+}
+
+void frame_share::begin_write()
+{
+    frame_share_slot *s = get_slot(_header, _slot);
+    atomic::store_relaxed(&s->sequence, s->sequence + 1);
+    // The image data must not be written before the sequence number says so.
+    atomic::fence_release();
+}
+
+void* frame_share::data(int view)
+{
+    return reinterpret_cast<char *>(get_slot(_header, _slot)) + _header->data_offset
+        + static_cast<size_t>(view) * _header->stride * _header->height;
+}
+
+void frame_share::end_write(int64_t frameno, int64_t presentation_time)
+{
+    frame_share_slot *s = get_slot(_header, _slot);
+    s->frameno = frameno;
+    s->presentation_time = presentation_time;
+    atomic::store_release(&s->sequence, s->sequence + 1);
+    atomic::store_release(&_header->latest, static_cast<uint32_t>(_slot));
+    atomic::store_release(&_header->frames, _header->frames + 1);
+    _slot = (_slot + 1) % _slot_count;
+}
+
+#else
+
+void frame_share::open(int, int, int)
+{
+    throw exc(_("Sharing frames is not supported on this platform."));
+}
+
+void frame_share::close()
+{
+}
+
+void frame_share::begin_write()
+{
+}
+
+void* frame_share::data(int)
+{
+    return NULL;
+}
+
+void frame_share::end_write(int64_t, int64_t)
+{
+}
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_SHARE_H
+#define FRAME_SHARE_H
+
+#include <string>
+#include <stdint.h>
+
+/*
+ * Publishing of output frames to other applications through a ring of
+ * frames in POSIX shared memory.
+ *
+ * The shared memory object starts with a frame_share_header. It is followed
+ * by frame_share_header::slots slots, each of which starts at a multiple of
+ * the page size given by frame_share_header::slot_offset and
+ * frame_share_header::slot_size. A slot starts with a frame_share_slot and
+ * holds the image data at frame_share_header::data_offset relative to its
+ * start: one image per view, each with frame_share_header::height rows of
+ * frame_share_header::stride bytes in BGRA8 format, bottom row first as in
+ * OpenGL.
+ *
+ * The sequence number of a slot is odd while it is written and even when
+ * its frame is ready. A consumer reads frame_share_header::latest, copies
+ * or uses the slot, and checks that its sequence number did not change in
+ * the meantime. The sequence numbers, frames, latest, and closed are written
+ * atomically with release semantics. When the frame geometry changes, the object is recreated
+ * under the same name; frame_share_header::closed tells consumers of the old
+ * one to open it again.
+ */
+
+struct frame_share_header
+{
+    char magic[8];                      // "BINOSHM"
+    uint32_t version;                   // 1
+    uint32_t slots;                     // number of slots in the ring
+    uint32_t width;                     // image width in pixels
+    uint32_t height;                    // image height in pixels
+    uint32_t stride;                    // bytes per image row
+    uint32_t views;                     // 1 for the composited output, 2 for left and right view
+    uint64_t slot_offset;               // offset of the first slot from the start of the object
+    uint64_t slot_size;                 // size of each slot
+    uint64_t data_offset;               // offset of the image data from the start of a slot
+    uint64_t frames;                    // number of frames published so far
+    uint32_t latest;                    // slot of the newest frame; valid if frames > 0
+    uint32_t closed;                    // set when Bino stops publishing to this object
+};
+
+struct frame_share_slot
+{
+    uint64_t sequence;                  // odd while the slot is written
+    int64_t frameno;                    // frame number, counted from the start of the output
+    int64_t presentation_time;          // presentation time of the video frame, in microseconds
+};
+
+class frame_share
+{
+private:
+    static const int _slot_count = 3;
+    int _fd;
+    void *_map;
+    size_t _map_size;
+    frame_share_header *_header;
+    int _width, _height, _views;
+    int _slot;                          // the slot that is written next
+
+public:
+    /* Configure the shared memory name (e.g. "/bino") and whether the two
+     * views are published separately instead of the composited output.
+     * An empty name disables publishing. */
+    static void set_name(const std::string& name);
+    static void set_views(bool views);
+    static bool enabled();
+    static bool per_view();
+
+    frame_share();
+    ~frame_share();
+
+    /* Create the shared memory object for images of the given geometry, or
+     * recreate it if the geometry changed. Throw an exception if this fails. */
+    void open(int width, int height, int views);
+    void close();
+
+    bool is_open() const
+    {
+        return _header;
+    }
+    int width() const
+    {
+        return _width;
+    }
+    int height() const
+    {
+        return _height;
+    }
+    int views() const
+    {
+        return _views;
+    }
+
+    /* Mark the next slot as being written, fill the images of its views,
+     * and publish it with end_write(). */
+    void begin_write();
+    void* data(int view);
+    void end_write(int64_t frameno, int64_t presentation_time);
+};
+
+#endif
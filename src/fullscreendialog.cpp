@@ -95,6 +95,10 @@ fullscreen_dialog::fullscreen_dialog(QWidget* parent) : QWidget(parent)
     _3d_ready_sync_box = new QCheckBox(_("use DLP(R) 3-D Ready Sync"));
     _3d_ready_sync_box->setToolTip(_("<p>Use DLP&reg; 3-D Ready Sync for supported output modes.</p>"));
 
+    _per_screen_box = new QCheckBox(_("use a separate output for each screen"));
+    _per_screen_box->setToolTip(_("<p>Render each screen with its own OpenGL context instead of one window "
+                "that spans all screens. This is often faster with multiple screens.</p>"));
+
     _inhibit_screensaver_box = new QCheckBox(_("inhibit the screensaver"));
     _inhibit_screensaver_box->setToolTip(_("<p>Inhibit the screensaver during fullscreen playback.</p>"));
 
@@ -113,7 +117,8 @@ fullscreen_dialog::fullscreen_dialog(QWidget* parent) : QWidget(parent)
     layout0->addWidget(_flip_right_box, 7, 0, 1, 3);
     layout0->addWidget(_flop_right_box, 8, 0, 1, 3);
     layout0->addWidget(_3d_ready_sync_box, 9, 0, 1, 3);
-    layout0->addWidget(_inhibit_screensaver_box, 10, 0, 1, 3);
+    layout0->addWidget(_per_screen_box, 10, 0, 1, 3);
+    layout0->addWidget(_inhibit_screensaver_box, 11, 0, 1, 3);
     QGridLayout *layout1 = new QGridLayout();
     QGridLayout *layout = new QGridLayout();
     layout->addLayout(layout0, 0, 0);
@@ -165,6 +170,9 @@ fullscreen_dialog::fullscreen_dialog(QWidget* parent) : QWidget(parent)
     _flip_right_box->setChecked(dispatch::parameters().fullscreen_flip_right());
     _flop_right_box->setChecked(dispatch::parameters().fullscreen_flop_right());
     _3d_ready_sync_box->setChecked(dispatch::parameters().fullscreen_3d_ready_sync());
+    _per_screen_box->setChecked(dispatch::parameters().fullscreen_per_screen());
+    if (screen_count < 2)
+        _per_screen_box->setEnabled(false);
 #ifndef Q_OS_WIN
     _inhibit_screensaver_box->setChecked(dispatch::parameters().fullscreen_inhibit_screensaver());
 #else
@@ -203,6 +211,8 @@ void fullscreen_dialog::apply()
     send_cmd(command::set_fullscreen_flop_right, _flop_right_box->isChecked());
     // 3d ready sync
     send_cmd(command::set_fullscreen_3d_ready_sync, _3d_ready_sync_box->isChecked());
+    // per screen rendering
+    send_cmd(command::set_fullscreen_per_screen, _per_screen_box->isChecked());
     // inhibit_screensaver
     send_cmd(command::set_fullscreen_inhibit_screensaver, _inhibit_screensaver_box->isChecked());
 }
@@ -53,6 +53,7 @@ private:
     QCheckBox* _flip_right_box;
     QCheckBox* _flop_right_box;
     QCheckBox* _3d_ready_sync_box;
+    QCheckBox* _per_screen_box;
     QCheckBox* _inhibit_screensaver_box;
 
 public:
@@ -60,6 +60,7 @@ static std::vector<std::string> opengl_v;
 static std::vector<std::string> glew_v;
 static std::vector<std::string> equalizer_v;
 static std::vector<std::string> lirc_v;
+static std::vector<std::string> alsa_v;
 static std::vector<std::string> qt_v;
 
 static void ffmpeg_versions()
@@ -197,6 +198,18 @@ static void lirc_versions()
     }
 }
 
+static void alsa_versions()
+{
+    if (alsa_v.size() == 0)
+    {
+#if HAVE_LIBASOUND
+        alsa_v.push_back(ALSA_PKGCONFIG_VERSION);
+#else
+        alsa_v.push_back(_("not used"));
+#endif
+    }
+}
+
 static void qt_versions()
 {
     if (qt_v.size() == 0)
@@ -214,6 +227,7 @@ std::vector<std::string> lib_versions(bool html)
     glew_versions();
     equalizer_versions();
     lirc_versions();
+    alsa_versions();
     qt_versions();
 
     std::vector<std::string> v;
@@ -262,6 +276,12 @@ std::vector<std::string> lib_versions(bool html)
             v.push_back(std::string("<br>") + lirc_v[i]);
         }
         v.push_back("</li>");
+        v.push_back("<li><a href=\"http://www.alsa-project.org/\">ALSA</a>");
+        for (size_t i = 0; i < alsa_v.size(); i++)
+        {
+            v.push_back(std::string("<br>") + alsa_v[i]);
+        }
+        v.push_back("</li>");
         v.push_back("<li><a href=\"http://qt.nokia.com/\">Qt</a>");
         for (size_t i = 0; i < qt_v.size(); i++)
         {
@@ -307,6 +327,11 @@ std::vector<std::string> lib_versions(bool html)
         {
             v.push_back(std::string("    ") + lirc_v[i]);
         }
+        v.push_back("ALSA:");
+        for (size_t i = 0; i < alsa_v.size(); i++)
+        {
+            v.push_back(std::string("    ") + alsa_v[i]);
+        }
         v.push_back("Qt:");
         for (size_t i = 0; i < qt_v.size(); i++)
         {
@@ -45,6 +45,8 @@ lircclient::lircclient(
     _conf_files(conf_files),
     _initialized(false)
 {
+    // This controller only sends commands.
+    unsubscribe_all();
 }
 
 lircclient::~lircclient()
@@ -93,6 +95,7 @@ void lircclient::init()
             }
         }
         _initialized = true;
+        watch_fd(_socket);
     }
 }
 
@@ -100,6 +103,7 @@ void lircclient::deinit()
 {
     if (_initialized)
     {
+        unwatch_fd();
         lirc_freeconfig(_config);
         lirc_deinit();
         _initialized = false;
@@ -125,6 +129,9 @@ void lircclient::process_events()
             /* No event currently available */
             return;
         }
+        /* The LIRC client library may have buffered more codes than this one,
+         * and the socket does not signal those. */
+        process_events_again();
         while ((e = lirc_code2char(_config, code, &cmd)) == 0 && cmd)
         {
             command c;
@@ -0,0 +1,262 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "base/msg.h"
+#include "base/str.h"
+#include "base/tmr.h"
+#include "base/pth.h"
+
+#include "base/gettext.h"
+#define _(string) gettext(string)
+
+#include "dispatch.h"
+#include "media_input.h"
+#include "video_output.h"
+#include "subtitle_renderer.h"
+#include "live_stats.h"
+
+extern dispatch* global_dispatch;
+
+/* Windows portability. */
+#ifndef O_NONBLOCK
+# define O_NONBLOCK 0
+#endif
+#ifndef EWOULDBLOCK
+# define EWOULDBLOCK EAGAIN
+#endif
+
+
+static mutex stats_file_mutex;
+static std::string stats_file_name;
+static int stats_fd = -1;
+
+void live_stats::set_file(const std::string& file_name)
+{
+    stats_file_mutex.lock();
+    if (stats_fd >= 0) {
+        ::close(stats_fd);
+        stats_fd = -1;
+    }
+    stats_file_name = file_name;
+    stats_file_mutex.unlock();
+}
+
+// Write a line to the stats file. A FIFO is opened without blocking: if no
+// reader has it open, or if the reader does not keep up, the line is dropped
+// and we try again with the next one.
+static void write_line(const std::string& line)
+{
+    stats_file_mutex.lock();
+    if (stats_fd < 0 && !stats_file_name.empty()) {
+        struct stat statbuf;
+        bool is_fifo = (::stat(stats_file_name.c_str(), &statbuf) == 0 && S_ISFIFO(statbuf.st_mode));
+        stats_fd = ::open(stats_file_name.c_str(),
+                is_fifo ? O_WRONLY | O_NONBLOCK : O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (stats_fd < 0 && !(is_fifo && errno == ENXIO)) {
+            msg::err(_("%s: %s"), stats_file_name.c_str(), ::strerror(errno));
+            stats_file_name.clear();
+        }
+    }
+    if (stats_fd >= 0) {
+        ssize_t r = ::write(stats_fd, line.c_str(), line.length());
+        if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            // If the reader of a FIFO went away, reopen it for the next line.
+            int errno_bak = errno;
+            ::close(stats_fd);
+            stats_fd = -1;
+            if (errno_bak != EPIPE) {
+                msg::err(_("%s: %s"), stats_file_name.c_str(), ::strerror(errno_bak));
+                stats_file_name.clear();
+            }
+        }
+    }
+    stats_file_mutex.unlock();
+}
+
+// Convert text to the text field of an ASS event.
+static std::string ass_text(const std::string& text)
+{
+    return str::replace(str::replace(text, "\r\n", "\\N"), "\n", "\\N");
+}
+
+live_stats::live_stats()
+{
+    reset();
+}
+
+void live_stats::reset()
+{
+    _mark_time = -1;
+    _mark_frames = 0;
+    _overlay_text.clear();
+    position = 0;
+    fps = 0.0f;
+    dropped_frames = 0;
+    av_drift = 0;
+    video_skip_level = 0;
+    conversion_time = 0.0f;
+    upload_time = 0.0f;
+    for (int i = 0; i < 4; i++)
+        gpu_time[i] = 0.0f;
+    _have_gpu_time = false;
+    video_packets = 0;
+    audio_packets = 0;
+    subtitle_packets = 0;
+    queued_bytes = 0;
+    video_memory = 0;
+    audio_memory = 0;
+    subtitle_memory = 0;
+    gl_memory = 0;
+}
+
+void live_stats::frame_displayed(int64_t pos, int64_t delay, int skip_level)
+{
+    position = pos;
+    av_drift = delay;
+    video_skip_level = skip_level;
+    int64_t now = timer::get(timer::monotonic);
+    if (_mark_time < 0) {
+        // Only set the marks; the first interval starts now.
+        update(now);
+        return;
+    }
+    _mark_frames++;
+    if (now - _mark_time >= 1000000)
+        update(now);
+}
+
+void live_stats::update(int64_t now)
+{
+    int64_t upload_frames = 0, upload_time_sum = 0;
+    int64_t gpu_frames[4] = { 0, 0, 0, 0 }, gpu_time_sum[4] = { 0, 0, 0, 0 };
+    if (global_dispatch->get_video_output()) {
+        global_dispatch->get_video_output()->get_upload_stats(&upload_frames, &upload_time_sum);
+        for (int i = 0; i < 4; i++)
+            global_dispatch->get_video_output()->get_gpu_stats(
+                    static_cast<benchmark_stats::stage_t>(benchmark_stats::gpu_color + i),
+                    &gpu_frames[i], &gpu_time_sum[i]);
+    }
+    int64_t conversion_frames = 0, conversion_time_sum = 0;
+    global_dispatch->get_media_input()->get_conversion_stats(&conversion_frames, &conversion_time_sum);
+    bool first = (_mark_time < 0);
+    if (!first) {
+        fps = _mark_frames / ((now - _mark_time) / 1e6f);
+        upload_time = (upload_frames > _mark_upload_frames
+                ? (upload_time_sum - _mark_upload_time) / 1e3f / (upload_frames - _mark_upload_frames)
+                : 0.0f);
+        conversion_time = (conversion_frames > _mark_conversion_frames
+                ? (conversion_time_sum - _mark_conversion_time) / 1e3f / (conversion_frames - _mark_conversion_frames)
+                : 0.0f);
+        for (int i = 0; i < 4; i++) {
+            gpu_time[i] = (gpu_frames[i] > _mark_gpu_frames[i]
+                    ? (gpu_time_sum[i] - _mark_gpu_time[i]) / 1e3f / (gpu_frames[i] - _mark_gpu_frames[i])
+                    : 0.0f);
+            if (gpu_frames[i] > 0)
+                _have_gpu_time = true;
+        }
+        global_dispatch->get_media_input()->get_queue_stats(
+                &video_packets, &audio_packets, &subtitle_packets, &queued_bytes);
+        size_t packet_memory;
+        global_dispatch->get_media_input()->get_memory_stats(
+                &packet_memory, &video_memory, &audio_memory, &subtitle_memory);
+        gl_memory = 0;
+        if (global_dispatch->get_video_output())
+            global_dispatch->get_video_output()->get_memory_stats(&gl_memory);
+    }
+    _mark_time = now;
+    _mark_frames = 0;
+    _mark_upload_frames = upload_frames;
+    _mark_upload_time = upload_time_sum;
+    _mark_conversion_frames = conversion_frames;
+    _mark_conversion_time = conversion_time_sum;
+    for (int i = 0; i < 4; i++) {
+        _mark_gpu_frames[i] = gpu_frames[i];
+        _mark_gpu_time[i] = gpu_time_sum[i];
+    }
+    if (first)
+        return;
+
+    _overlay_text = str::asprintf(_("FPS: %.2f, dropped frames: %s, skip level: %d"),
+            fps, str::from(dropped_frames).c_str(), video_skip_level)
+        + '\n' + str::asprintf(_("A/V drift: %.1f ms"), av_drift / 1e3f)
+        + '\n' + str::asprintf(_("Conversion: %.2f ms/frame, upload: %.2f ms/frame"),
+                conversion_time, upload_time)
+        + (_have_gpu_time ? '\n' + str::asprintf(_("GPU: color %.2f, subtitle %.2f, render %.2f, SDI %.2f ms"),
+                    gpu_time[0], gpu_time[1], gpu_time[2], gpu_time[3]) : std::string())
+        + '\n' + str::asprintf(_("Queued packets: %lu video, %lu audio, %lu subtitle (%.1f MiB)"),
+                static_cast<unsigned long>(video_packets),
+                static_cast<unsigned long>(audio_packets),
+                static_cast<unsigned long>(subtitle_packets),
+                queued_bytes / 1048576.0f)
+        + '\n' + str::asprintf(_("Memory: %.1f MiB video, %.1f MiB audio, %.1f MiB subtitle, %.1f MiB GL"),
+                video_memory / 1048576.0f, audio_memory / 1048576.0f,
+                subtitle_memory / 1048576.0f, gl_memory / 1048576.0f);
+
+    write_line(str::asprintf("time=%.3f pos=%.3f fps=%.2f dropped=%s drift_ms=%.1f skip_level=%d "
+                "conversion_ms=%.2f upload_ms=%.2f gpu_color_ms=%.2f gpu_subtitle_ms=%.2f "
+                "gpu_render_ms=%.2f gpu_sdi_ms=%.2f video_packets=%lu audio_packets=%lu "
+                "subtitle_packets=%lu queued_bytes=%lu video_bytes=%lu audio_bytes=%lu "
+                "subtitle_bytes=%lu gl_bytes=%lu\n",
+                timer::get(timer::realtime) / 1e6, position / 1e6,
+                fps, str::from(dropped_frames).c_str(), av_drift / 1e3f, video_skip_level,
+                conversion_time, upload_time, gpu_time[0], gpu_time[1], gpu_time[2], gpu_time[3],
+                static_cast<unsigned long>(video_packets),
+                static_cast<unsigned long>(audio_packets),
+                static_cast<unsigned long>(subtitle_packets),
+                static_cast<unsigned long>(queued_bytes),
+                static_cast<unsigned long>(video_memory),
+                static_cast<unsigned long>(audio_memory),
+                static_cast<unsigned long>(subtitle_memory),
+                static_cast<unsigned long>(gl_memory)));
+}
+
+subtitle_box live_stats::overlay(const subtitle_box& subtitle) const
+{
+    if (_overlay_text.empty())
+        return subtitle;
+
+    const std::string event_timing = "0:00:00.00,9:59:59.99,";
+    subtitle_box box = subtitle;
+    if (!subtitle.is_valid()) {
+        // A text subtitle with the override tags for position and size.
+        box = subtitle_box();
+        box.format = subtitle_box::text;
+        box.str = "{\\an7\\fs10}" + _overlay_text;
+    } else if (subtitle.format == subtitle_box::text) {
+        // Convert to ASS with the style that text subtitles use, and add a second event.
+        box.format = subtitle_box::ass;
+        box.style = subtitle_renderer::text_style();
+        box.str = "Dialogue: 0," + event_timing + ass_text(subtitle.str) + '\n'
+            + "Dialogue: 1," + event_timing + "{\\an7\\fs10}" + ass_text(_overlay_text);
+    } else if (subtitle.format == subtitle_box::ass) {
+        // Add an event in the standard ASS event format.
+        box.str += "\nDialogue: 1," + event_timing + "Default,,0,0,0,,{\\an7}" + ass_text(_overlay_text);
+    }
+    return box;
+}
@@ -0,0 +1,100 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIVE_STATS_H
+#define LIVE_STATS_H
+
+#include <string>
+#include <stdint.h>
+
+#include "media_data.h"
+
+/*
+ * Live playback statistics for operators.
+ *
+ * The player reports every displayed and dropped video frame. Once per
+ * second, the values are refreshed from the media input (packet queues,
+ * conversion times, memory use) and the video output (upload and GPU times,
+ * GL memory). They can be shown
+ * as an on-screen overlay (see the stats_overlay parameter), and they are
+ * written as one line of key=value pairs to the stats file, if one is set.
+ */
+
+class live_stats
+{
+private:
+    int64_t _mark_time;                 // Start of the current measurement interval, or -1
+    int _mark_frames;                   // Frames displayed in the current interval
+    int64_t _mark_upload_frames;        // Upload and conversion counters at the start of the interval
+    int64_t _mark_upload_time;
+    int64_t _mark_conversion_frames;
+    int64_t _mark_conversion_time;
+    int64_t _mark_gpu_frames[4];        // GPU time counters at the start of the interval
+    int64_t _mark_gpu_time[4];
+    bool _have_gpu_time;                // whether the video output measures GPU times
+    std::string _overlay_text;          // Human readable version of the values
+
+    void update(int64_t now);
+
+public:
+    /* Values of the last complete measurement interval */
+    int64_t position;                   // Presentation time of the last displayed frame, microseconds
+    float fps;                          // Displayed video frames per second
+    int64_t dropped_frames;             // Video frames dropped since playback started
+    int64_t av_drift;                   // Delay of the last displayed frame w.r.t. the master clock, microseconds
+    int video_skip_level;               // Current decoder skip level
+    float conversion_time;              // Software pixel format conversion, ms per frame
+    float upload_time;                  // Texture upload, ms per frame
+    float gpu_time[4];                  // GPU time of the color, subtitle, render, and SDI passes, ms per pass
+    size_t video_packets;               // Queued packets per stream type
+    size_t audio_packets;
+    size_t subtitle_packets;
+    size_t queued_bytes;                // Total size of queued packets
+    size_t video_memory;                // Memory of decoded video frames and conversion buffers
+    size_t audio_memory;                // Memory of buffered audio data
+    size_t subtitle_memory;             // Memory of decoded subtitles
+    size_t gl_memory;                   // Estimated GL memory of textures and buffers
+
+    live_stats();
+
+    /* Set a file to write the values to once per second. This may be a FIFO;
+     * lines are dropped while no reader has it open. */
+    static void set_file(const std::string& file_name);
+
+    /* Start a new measurement, e.g. at the start of playback. */
+    void reset();
+
+    /* Report a dropped frame. */
+    void frame_dropped()
+    {
+        dropped_frames++;
+    }
+
+    /* Report a displayed frame with its presentation time, its delay, and the
+     * current decoder skip level. */
+    void frame_displayed(int64_t pos, int64_t delay, int skip_level);
+
+    /* Return a subtitle box that shows the values in the top left corner,
+     * on top of the given subtitle. Bitmap subtitles cannot be combined
+     * with text; while they are shown, the overlay is hidden. */
+    subtitle_box overlay(const subtitle_box& subtitle) const;
+};
+
+#endif
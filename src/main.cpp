@@ -28,8 +28,10 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cerrno>
+#include <csignal>
 #include <limits>
 #include <locale.h>
+#include <sstream>
 
 #if (defined _WIN32 || defined __WIN32__) && !defined __CYGWIN__
 # include <windows.h>
@@ -52,12 +54,19 @@
 #include "base/msg.h"
 #include "base/str.h"
 #include "base/opt.h"
+#include "base/trc.h"
 
 #include "base/gettext.h"
 #define _(string) gettext(string)
 
 #include "dispatch.h"
 #include "audio_output.h"
+#include "video_output_file.h"
+#include "benchmark_stats.h"
+#include "micro_benchmark.h"
+#include "net_sync.h"
+#include "frame_share.h"
+#include "live_stats.h"
 #if HAVE_LIBEQUALIZER
 # include "player_equalizer.h"
 #endif
@@ -276,6 +285,14 @@ int main(int argc, char *argv[])
     std::vector<std::string> input_modes;
     opt::val<int> quality("quality", '\0', opt::optional, 0, 4, 4);
     options.push_back(&quality);
+    opt::flag adaptive_quality("adaptive-quality", '\0', opt::optional);
+    options.push_back(&adaptive_quality);
+    std::vector<std::string> deinterlacing_methods;
+    deinterlacing_methods.push_back("off");
+    deinterlacing_methods.push_back("bob");
+    deinterlacing_methods.push_back("adaptive");
+    opt::val<std::string> deinterlacing("deinterlacing", '\0', opt::optional, deinterlacing_methods, "");
+    options.push_back(&deinterlacing);
     input_modes.push_back("mono");
     input_modes.push_back("separate-left-right");
     input_modes.push_back("separate-right-left");
@@ -317,6 +334,8 @@ int main(int argc, char *argv[])
     options.push_back(&fullscreen_flop_right);
     opt::flag fullscreen_3d_ready_sync("fullscreen-3dr-sync", '\0', opt::optional);
     options.push_back(&fullscreen_3d_ready_sync);
+    opt::flag fullscreen_per_screen("fullscreen-per-screen", '\0', opt::optional);
+    options.push_back(&fullscreen_per_screen);
     opt::val<float> zoom("zoom", 'z', opt::optional, 0.0f, 1.0f);
     options.push_back(&zoom);
     opt::tuple<float> crop_aspect_ratio("crop", 'C', opt::optional, 0.0f, 100.0f, std::vector<float>(), 2, ":");
@@ -335,6 +354,36 @@ int main(int argc, char *argv[])
     options.push_back(&subtitle_color);
     opt::val<int> subtitle_shadow("subtitle-shadow", '\0', opt::optional, -1, 1);
     options.push_back(&subtitle_shadow);
+    opt::val<std::string> hwaccel("hwaccel", '\0', opt::optional);
+    options.push_back(&hwaccel);
+    opt::flag lowres_decoding("lowres-decoding", '\0', opt::optional);
+    options.push_back(&lowres_decoding);
+    opt::flag display_sync("display-sync", '\0', opt::optional);
+    options.push_back(&display_sync);
+    opt::val<float> demuxer_buffer("demuxer-buffer", '\0', opt::optional, 0.0f, 3600.0f);
+    options.push_back(&demuxer_buffer);
+    opt::val<int> read_cache("read-cache", '\0', opt::optional, 0, 65536);
+    options.push_back(&read_cache);
+    opt::val<int> probe_size("probe-size", '\0', opt::optional, 0, 65536);
+    options.push_back(&probe_size);
+    opt::val<float> analyze_duration("analyze-duration", '\0', opt::optional, 0.0f, 60.0f);
+    options.push_back(&analyze_duration);
+    opt::val<int> clip_cache("clip-cache", '\0', opt::optional, 0, 65536);
+    options.push_back(&clip_cache);
+    opt::val<int> memory_limit("memory-limit", '\0', opt::optional, 0, 65536);
+    options.push_back(&memory_limit);
+    opt::flag adaptive_bitrate("adaptive-bitrate", '\0', opt::optional);
+    options.push_back(&adaptive_bitrate);
+    opt::flag live_capture("live-capture", '\0', opt::optional);
+    options.push_back(&live_capture);
+    opt::val<int> decode_ahead("decode-ahead", '\0', opt::optional, 0, 64);
+    options.push_back(&decode_ahead);
+    opt::val<float> image_duration("image-duration", '\0', opt::optional, 0.0f, 86400.0f);
+    options.push_back(&image_duration);
+    opt::val<int> audio_buffers("audio-buffers", '\0', opt::optional, 2, 64);
+    options.push_back(&audio_buffers);
+    opt::val<int> audio_buffer_size("audio-buffer-size", '\0', opt::optional, 1, 16777216);
+    options.push_back(&audio_buffer_size);
     opt::val<float> subtitle_parallax("subtitle-parallax", '\0', opt::optional, -1.0f, +1.0f);
     options.push_back(&subtitle_parallax);
     opt::val<float> vertical_pixel_shift_left("vertical-pixel-shift-left", '\0', opt::optional, -99999.9f, +99999.9f, 0.0f);
@@ -349,10 +398,39 @@ int main(int argc, char *argv[])
     options.push_back(&ghostbust);
     opt::flag benchmark("benchmark", 'b', opt::optional);
     options.push_back(&benchmark);
+    opt::val<std::string> benchmark_file("benchmark-file", '\0', opt::optional);
+    options.push_back(&benchmark_file);
+    opt::info micro_benchmarks("micro-benchmark", '\0', opt::optional);
+    options.push_back(&micro_benchmarks);
+    opt::tuple<int> micro_benchmark_size("micro-benchmark-size", '\0', opt::optional,
+            2, 16384, std::vector<int>(2, 0), 2, "x");
+    options.push_back(&micro_benchmark_size);
+    opt::val<std::string> trace_file("trace-file", '\0', opt::optional);
+    options.push_back(&trace_file);
+    opt::flag stats_overlay("stats-overlay", '\0', opt::optional);
+    options.push_back(&stats_overlay);
+    opt::val<std::string> stats_file("stats-file", '\0', opt::optional);
+    options.push_back(&stats_file);
+    opt::val<std::string> output_file("output-file", '\0', opt::optional);
+    options.push_back(&output_file);
     opt::val<int> swap_interval("swap-interval", '\0', opt::optional, 0, 999);
     options.push_back(&swap_interval);
+    opt::val<int> swap_group("swap-group", '\0', opt::optional, 1, 999);
+    options.push_back(&swap_group);
+    opt::val<int> swap_barrier("swap-barrier", '\0', opt::optional, 1, 999);
+    options.push_back(&swap_barrier);
+    opt::val<std::string> sync_master("sync-master", '\0', opt::optional);
+    options.push_back(&sync_master);
+    opt::val<std::string> sync_follow("sync-follow", '\0', opt::optional);
+    options.push_back(&sync_follow);
+    opt::val<std::string> share_frames("share-frames", '\0', opt::optional);
+    options.push_back(&share_frames);
+    opt::flag share_views("share-views", '\0', opt::optional);
+    options.push_back(&share_views);
     opt::flag loop("loop", 'l', opt::optional);
     options.push_back(&loop);
+    opt::flag playlist("playlist", '\0', opt::optional);
+    options.push_back(&playlist);
 #if HAVE_LIBXNVCTRL
     opt::val<int> sdi_output_format("sdi-output-format", '\0', opt::optional,
             NV_CTRL_GVIO_VIDEO_FORMAT_487I_59_94_SMPTE259_NTSC,
@@ -452,10 +530,13 @@ int main(int argc, char *argv[])
                 + "  --device-frame-size=WxH  " + _("Request frame size WxH from input device") + '\n'
                 + "  --device-frame-rate=N/D  " + _("Request frame rate N/D from input device") + '\n'
                 + "  --device-format=FORMAT   " + _("Request device format 'default' or 'mjpeg'") + '\n'
+                + "  --live-capture           " + _("Show the newest device frames with minimal latency") + '\n'
                 + "  --read-commands=FILE     " + _("Read commands from a file") + '\n'
                 + "  --lirc-config=FILE       " + _("Use the given LIRC configuration file") + '\n'
                 + "                           " + _("This option can be used more than once") + '\n'
                 + "  --quality=Q              " + _("Output quality (0=fastest to 4=best/default)") + '\n'
+                + "  --adaptive-quality       " + _("Lower the output quality when the GPU cannot keep up") + '\n'
+                + "  --deinterlacing=METHOD   " + _("Deinterlacing: off, bob, adaptive (default)") + '\n'
                 + "  -v|--video=STREAM        " + _("Select video stream (1-n, depending on input)") + '\n'
                 + "  -a|--audio=STREAM        " + _("Select audio stream (1-n, depending on input)") + '\n'
                 + "  -s|--subtitle=STREAM     " + _("Select subtitle stream (0-n, dep. on input)") + '\n'
@@ -514,6 +595,7 @@ int main(int argc, char *argv[])
                 + "  --fullscreen-flip-right  " + _("Flip right view vertically when fullscreen") + '\n'
                 + "  --fullscreen-flop-right  " + _("Flop right view horizontally when fullscreen") + '\n'
                 + "  --fullscreen-3dr-sync    " + _("Use DLP 3-D Ready Sync when fullscreen") + '\n'
+                + "  --fullscreen-per-screen  " + _("Render each fullscreen screen separately") + '\n'
                 + "  -z|--zoom=Z              " + _("Set zoom for wide videos (0=off to 1=full)") + '\n'
                 + "  -C|--crop=W:H            " + _("Crop video to given aspect ratio (0:0=off)") + '\n'
                 + "  -c|--center              " + _("Center window on screen") + '\n'
@@ -529,9 +611,50 @@ int main(int argc, char *argv[])
                 + "                           " + _("Comma-separated values for R,G,B") + '\n'
                 + "  --ghostbust=VAL          " + _("Amount of ghostbusting to apply (0 to 1)") + '\n'
                 + "  -b|--benchmark           " + _("Benchmark mode (no audio, show fps)") + '\n'
+                + "  --benchmark-file=FILE    " + _("Write frame timing statistics to FILE") + '\n'
+                + "                           " + _("JSON if FILE ends with .json, CSV otherwise") + '\n'
+                + "  --micro-benchmark        " + _("Benchmark the media hot paths with synthetic data") + '\n'
+                + "                           " + _("and exit; results go to the benchmark file") + '\n'
+                + "  --micro-benchmark-size=WxH" + '\n'
+                + "                           " + _("Frame size for the micro benchmarks (default") + '\n'
+                + "                           " + _("1920x1080); -i sets their input layout") + '\n'
+                + "  --trace-file=FILE        " + _("Write a trace of timed events to FILE") + '\n'
+                + "                           " + _("in Chrome trace format") + '\n'
+                + "  --stats-overlay          " + _("Show live playback statistics on screen") + '\n'
+                + "  --stats-file=FILE        " + _("Write live playback statistics to FILE") + '\n'
+                + "                           " + _("once per second; FILE may be a FIFO") + '\n'
                 + "  --swap-interval=D        " + _("Frame rate divisor for display refresh rate") + '\n'
                 + "                           " + _("Default is 0 for benchmark mode, 1 otherwise") + '\n'
+                + "  --swap-group=N           " + _("Join NV swap group N to synchronize buffer swaps") + '\n'
+                + "  --swap-barrier=B         " + _("Bind the swap group to NV swap barrier B") + '\n'
+                + "                           " + _("to synchronize with other systems") + '\n'
+                + "  --sync-master=ADDR:PORT  " + _("Send the playback clock to other instances") + '\n'
+                + "                           " + _("at a unicast, broadcast, or multicast address") + '\n'
+                + "  --sync-follow=PORT       " + _("Follow the playback clock of a master instance") + '\n'
+                + "                           " + _("Use ADDR:PORT to join a multicast group") + '\n'
+                + "  --share-frames=NAME      " + _("Publish the output frames in shared memory NAME") + '\n'
+                + "  --share-views            " + _("Publish the left and right view instead") + '\n'
+                + "  --output-file=FILE       " + _("Write the output video to FILE instead of a window") + '\n'
+                + "                           " + _("Format and codec are guessed from the file name") + '\n'
                 + "  -l|--loop                " + _("Loop the input media") + '\n'
+                + "  --playlist               " + _("Play the input files one after another") + '\n'
+                + "                           " + _("without gaps, instead of combining them") + '\n'
+                + "  --hwaccel=TYPE           " + _("Use hardware accelerated video decoding") + '\n'
+                + "                           " + _("TYPE is auto or a method such as vaapi or vdpau") + '\n'
+                + "  --lowres-decoding        " + _("Decode at reduced resolution if the screen is smaller") + '\n'
+                + "  --display-sync           " + _("Lock video to the display refresh rate and") + '\n'
+                + "                           " + _("resample audio to follow") + '\n'
+                + "  --demuxer-buffer=S       " + _("Read S seconds of input ahead") + '\n'
+                + "  --read-cache=M           " + _("Use a read cache of M MiB, 0 to disable") + '\n'
+                + "  --probe-size=K           " + _("Read at most K KiB to detect the streams") + '\n'
+                + "  --analyze-duration=S     " + _("Analyze at most S seconds to detect the streams") + '\n'
+                + "  --clip-cache=M           " + _("Keep inputs that fit into M MiB in decoded form") + '\n'
+                + "  --memory-limit=M         " + _("Use at most M MiB for queued and decoded data per input") + '\n'
+                + "  --adaptive-bitrate       " + _("Switch HLS/DASH variants by bandwidth") + '\n'
+                + "  --decode-ahead=N         " + _("Decode N video frames ahead, 0 to disable") + '\n'
+                + "  --image-duration=S       " + _("Show still images of a playlist for S seconds") + '\n'
+                + "  --audio-buffers=N        " + _("Use N audio output buffers") + '\n'
+                + "  --audio-buffer-size=B    " + _("Use audio output buffers of B bytes") + '\n'
                 + "  --sdi-output-format=F    " + _("Set SDI output format") + '\n'
                 + '\n'
                 + _("Interactive control:") + '\n'
@@ -553,6 +676,7 @@ int main(int argc, char *argv[])
                 + "  <, >                     " + _("Adjust zoom for wide videos") + '\n'
                 + "  /, *                     " + _("Adjust audio volume") + '\n'
                 + "  m                        " + _("Toggle audio mute") + '\n'
+                + "  i                        " + _("Toggle statistics overlay") + '\n'
                 + "  .                        " + _("Step a single video frame forward") + '\n'
                 + "  " + lengthen(_("left, right"), 25)        + _("Seek 10 seconds backward / forward") + '\n'
                 + "  " + lengthen(_("down, up"), 25)           + _("Seek 1 minute backward / forward") + '\n'
@@ -598,6 +722,10 @@ int main(int argc, char *argv[])
         dispatch_equalizer_3d = true;
         dispatch_gui = false;
     }
+    if (output_file.is_set()) {
+        // Render as fast as possible, without audio, window or GUI.
+        dispatch_gui = false;
+    }
     msg::level_t dispatch_log_level = msg::level();
     if (log_level.value() == "")
         dispatch_log_level = msg::INF;
@@ -611,7 +739,7 @@ int main(int argc, char *argv[])
         dispatch_log_level = msg::ERR;
     else if (log_level.value() == "quiet")
         dispatch_log_level = msg::REQ;
-    bool dispatch_benchmark = benchmark.value();
+    bool dispatch_benchmark = benchmark.value() || output_file.is_set();
     int dispatch_swap_interval = dispatch_benchmark ? 0 : 1;
     if (swap_interval.is_set())
         dispatch_swap_interval = swap_interval.value();
@@ -620,7 +748,10 @@ int main(int argc, char *argv[])
     dispatch global_dispatch(&argc, argv,
             dispatch_equalizer, dispatch_equalizer_3d, false,
             dispatch_gui, have_display, dispatch_log_level,
-            dispatch_benchmark, dispatch_swap_interval);
+            dispatch_benchmark, dispatch_swap_interval,
+            swap_group.is_set() ? swap_group.value() : 0,
+            swap_barrier.is_set() ? swap_barrier.value() : 0,
+            output_file.value());
 
     /* List audio devices and exit, if requested */
     if (list_audio_devices.value())
@@ -641,13 +772,66 @@ int main(int argc, char *argv[])
         return 0;
     }
 
+    /* Run the micro benchmarks and exit, if requested */
+    if (micro_benchmarks.value())
+    {
+        try
+        {
+            micro_benchmark::config conf;
+            if (micro_benchmark_size.is_set())
+            {
+                conf.width = micro_benchmark_size.value()[0];
+                conf.height = micro_benchmark_size.value()[1];
+            }
+            if (input_mode.is_set())
+            {
+                bool swap;
+                parameters::stereo_layout_from_string(input_mode.value(), conf.stereo_layout, swap);
+            }
+            micro_benchmark::run(benchmark_file.value(), conf);
+        }
+        catch (std::exception &e)
+        {
+            msg::err("%s", e.what());
+            return 1;
+        }
+        return 0;
+    }
+
     /* Set session parameters */
-    if (dispatch_benchmark)
+    if (benchmark_file.is_set())
+        benchmark_stats::set_result_file(benchmark_file.value());
+    if (stats_file.is_set()) {
+#ifdef SIGPIPE
+        // A reader of a stats FIFO may go away at any time.
+        std::signal(SIGPIPE, SIG_IGN);
+#endif
+        live_stats::set_file(stats_file.value());
+    }
+    if (sync_master.is_set() && sync_follow.is_set()) {
+        msg::err(_("Cannot be synchronization master and follower at the same time."));
+        return 1;
+    }
+    if (sync_master.is_set())
+        net_sync::set_master(sync_master.value());
+    if (sync_follow.is_set())
+        net_sync::set_follower(sync_follow.value());
+    if (share_frames.is_set() && !share_frames.value().empty()) {
+        // POSIX shared memory names start with a slash.
+        frame_share::set_name(share_frames.value()[0] == '/' ? share_frames.value() : '/' + share_frames.value());
+        frame_share::set_views(share_views.value());
+    }
+    if (benchmark.value())
         msg::inf(_("Benchmark mode: audio and time synchronization disabled."));
     if (audio_device.is_set())
         controller::send_cmd(command::set_audio_device, audio_device.value() - 1);
     if (quality.is_set())
         controller::send_cmd(command::set_quality, quality.value());
+    if (adaptive_quality.is_set())
+        controller::send_cmd(command::set_adaptive_quality, adaptive_quality.value());
+    if (deinterlacing.is_set())
+        controller::send_cmd(command::set_deinterlacing,
+                static_cast<int>(parameters::deinterlacing_from_string(deinterlacing.value())));
     if (video_output_mode.is_set()) {
         parameters::stereo_mode_t stereo_mode;
         if (video_output_mode.value() == "equalizer") {
@@ -686,10 +870,13 @@ int main(int argc, char *argv[])
         controller::send_cmd(command::set_fullscreen_flop_right, fullscreen_flop_right.value());
     if (fullscreen_3d_ready_sync.is_set())
         controller::send_cmd(command::set_fullscreen_3d_ready_sync, fullscreen_3d_ready_sync.value());
+    if (fullscreen_per_screen.is_set())
+        controller::send_cmd(command::set_fullscreen_per_screen, fullscreen_per_screen.value());
     if (zoom.is_set())
         controller::send_cmd(command::set_zoom, zoom.value());
     if (loop.is_set())
-        controller::send_cmd(command::set_loop_mode, loop.value() ? parameters::loop_current : parameters::no_loop);
+        controller::send_cmd(command::set_loop_mode, !loop.value() ? parameters::no_loop
+                : playlist.value() ? parameters::loop_playlist : parameters::loop_current);
     if (audio_delay.is_set())
         controller::send_cmd(command::set_audio_delay, static_cast<int64_t>(audio_delay.value() * 1000));
     if (subtitle_encoding.is_set()) {
@@ -710,6 +897,39 @@ int main(int argc, char *argv[])
         controller::send_cmd(command::set_subtitle_color, static_cast<uint64_t>(subtitle_color.value()));
     if (subtitle_shadow.is_set())
         controller::send_cmd(command::set_subtitle_shadow, subtitle_shadow.value());
+    if (hwaccel.is_set()) {
+        std::ostringstream v;
+        s11n::save(v, hwaccel.value());
+        controller::send_cmd(command::set_hwaccel, v.str());
+    }
+    if (lowres_decoding.is_set())
+        controller::send_cmd(command::set_lowres_decoding, lowres_decoding.value());
+    if (display_sync.is_set())
+        controller::send_cmd(command::set_display_sync, display_sync.value());
+    if (demuxer_buffer.is_set())
+        controller::send_cmd(command::set_demuxer_buffer, demuxer_buffer.value());
+    if (read_cache.is_set())
+        controller::send_cmd(command::set_read_cache, read_cache.value());
+    if (probe_size.is_set())
+        controller::send_cmd(command::set_probe_size, probe_size.value());
+    if (analyze_duration.is_set())
+        controller::send_cmd(command::set_analyze_duration, analyze_duration.value());
+    if (clip_cache.is_set())
+        controller::send_cmd(command::set_clip_cache, clip_cache.value());
+    if (memory_limit.is_set())
+        controller::send_cmd(command::set_memory_limit, memory_limit.value());
+    if (adaptive_bitrate.is_set())
+        controller::send_cmd(command::set_adaptive_bitrate, adaptive_bitrate.value());
+    if (live_capture.is_set())
+        controller::send_cmd(command::set_live_capture, live_capture.value());
+    if (decode_ahead.is_set())
+        controller::send_cmd(command::set_decode_ahead, decode_ahead.value());
+    if (image_duration.is_set())
+        controller::send_cmd(command::set_image_duration, image_duration.value());
+    if (audio_buffers.is_set())
+        controller::send_cmd(command::set_audio_buffers, audio_buffers.value());
+    if (audio_buffer_size.is_set())
+        controller::send_cmd(command::set_audio_buffer_size, audio_buffer_size.value());
 #if HAVE_LIBXNVCTRL
     if (sdi_output_format.is_set())
         controller::send_cmd(command::set_sdi_output_format, sdi_output_format.value());
@@ -724,6 +944,8 @@ int main(int argc, char *argv[])
         controller::send_cmd(command::set_audio_volume, audio_volume.value());
     if (audio_mute.is_set() && audio_mute.value())
         controller::send_cmd(command::toggle_audio_mute);
+    if (stats_overlay.is_set() && stats_overlay.value())
+        controller::send_cmd(command::toggle_stats_overlay);
 
     /* Gather initial player data: input URLs and per-video parameters */
     open_input_data input_data;
@@ -744,6 +966,8 @@ int main(int argc, char *argv[])
     if (device_format.value() == "mjpeg")
         input_data.dev_request.request_mjpeg = true;
     input_data.urls = arguments;
+    if (playlist.value() && input_data.urls.size() > 1)
+        input_data.urls.resize(1);
     if (video.is_set() > 0)
         input_data.params.set_video_stream(video.value() - 1);
     if (audio.is_set() > 0)
@@ -779,6 +1003,10 @@ int main(int argc, char *argv[])
     int retval = 0;
     std::vector<command_file*> command_files;
     try {
+        if (trace_file.is_set()) {
+            trace::start(trace_file.value());
+            trace::set_thread_track("main");
+        }
         for (size_t i = 0; i < read_commands.values().size(); i++) {
             command_files.push_back(new command_file(read_commands.values()[i]));
             command_files[i]->init();
@@ -797,12 +1025,24 @@ int main(int argc, char *argv[])
         }
 #endif
         global_dispatch.init(input_data);
+        if (playlist.value()) {
+            // Queue the remaining files; each one is opened while the previous one plays
+            for (size_t i = 1; i < arguments.size(); i++) {
+                open_input_data queued_input_data = input_data;
+                queued_input_data.urls = std::vector<std::string>(1, arguments[i]);
+                std::ostringstream v;
+                s11n::save(v, queued_input_data);
+                controller::send_cmd(command::queue, v.str());
+            }
+        }
         if (dispatch_equalizer) {
 #if HAVE_LIBEQUALIZER
             player_equalizer::mainloop();
 #else
             msg::err(_("This version of Bino was compiled without support for Equalizer."));
 #endif
+        } else if (output_file.is_set()) {
+            video_output_file::mainloop();
         } else {
             QApplication::exec();
         }
@@ -815,6 +1055,13 @@ int main(int argc, char *argv[])
         msg::err("%s", e.what());
         retval = 1;
     }
+    try {
+        trace::finish();
+    }
+    catch (std::exception& e) {
+        msg::err("%s", e.what());
+        retval = 1;
+    }
 
     for (size_t i = 0; i < command_files.size(); i++)
         delete command_files[i];
@@ -122,6 +122,10 @@ main_window::main_window(QSettings *settings) :
             send_cmd(command::set_audio_delay, session_params.audio_delay());
         if (!dispatch::parameters().quality_is_set() && !session_params.quality_is_default())
             send_cmd(command::set_quality, session_params.quality());
+        if (!dispatch::parameters().adaptive_quality_is_set() && !session_params.adaptive_quality_is_default())
+            send_cmd(command::set_adaptive_quality, session_params.adaptive_quality());
+        if (!dispatch::parameters().deinterlacing_is_set() && !session_params.deinterlacing_is_default())
+            send_cmd(command::set_deinterlacing, static_cast<int>(session_params.deinterlacing()));
         if (!dispatch::parameters().contrast_is_set() && !session_params.contrast_is_default())
             send_cmd(command::set_contrast, session_params.contrast());
         if (!dispatch::parameters().brightness_is_set() && !session_params.brightness_is_default())
@@ -158,6 +162,39 @@ main_window::main_window(QSettings *settings) :
             send_cmd(command::set_subtitle_scale, session_params.subtitle_scale());
         if (!dispatch::parameters().subtitle_color_is_set() && !session_params.subtitle_color_is_default())
             send_cmd(command::set_subtitle_color, session_params.subtitle_color());
+        if (!dispatch::parameters().hwaccel_is_set() && !session_params.hwaccel_is_default()) {
+            std::ostringstream v;
+            s11n::save(v, session_params.hwaccel());
+            send_cmd(command::set_hwaccel, v.str());
+        }
+        if (!dispatch::parameters().lowres_decoding_is_set() && !session_params.lowres_decoding_is_default())
+            send_cmd(command::set_lowres_decoding, session_params.lowres_decoding());
+        if (!dispatch::parameters().display_sync_is_set() && !session_params.display_sync_is_default())
+            send_cmd(command::set_display_sync, session_params.display_sync());
+        if (!dispatch::parameters().demuxer_buffer_is_set() && !session_params.demuxer_buffer_is_default())
+            send_cmd(command::set_demuxer_buffer, session_params.demuxer_buffer());
+        if (!dispatch::parameters().read_cache_is_set() && !session_params.read_cache_is_default())
+            send_cmd(command::set_read_cache, session_params.read_cache());
+        if (!dispatch::parameters().probe_size_is_set() && !session_params.probe_size_is_default())
+            send_cmd(command::set_probe_size, session_params.probe_size());
+        if (!dispatch::parameters().analyze_duration_is_set() && !session_params.analyze_duration_is_default())
+            send_cmd(command::set_analyze_duration, session_params.analyze_duration());
+        if (!dispatch::parameters().clip_cache_is_set() && !session_params.clip_cache_is_default())
+            send_cmd(command::set_clip_cache, session_params.clip_cache());
+        if (!dispatch::parameters().memory_limit_is_set() && !session_params.memory_limit_is_default())
+            send_cmd(command::set_memory_limit, session_params.memory_limit());
+        if (!dispatch::parameters().adaptive_bitrate_is_set() && !session_params.adaptive_bitrate_is_default())
+            send_cmd(command::set_adaptive_bitrate, session_params.adaptive_bitrate());
+        if (!dispatch::parameters().live_capture_is_set() && !session_params.live_capture_is_default())
+            send_cmd(command::set_live_capture, session_params.live_capture());
+        if (!dispatch::parameters().decode_ahead_is_set() && !session_params.decode_ahead_is_default())
+            send_cmd(command::set_decode_ahead, session_params.decode_ahead());
+        if (!dispatch::parameters().image_duration_is_set() && !session_params.image_duration_is_default())
+            send_cmd(command::set_image_duration, session_params.image_duration());
+        if (!dispatch::parameters().audio_buffers_is_set() && !session_params.audio_buffers_is_default())
+            send_cmd(command::set_audio_buffers, session_params.audio_buffers());
+        if (!dispatch::parameters().audio_buffer_size_is_set() && !session_params.audio_buffer_size_is_default())
+            send_cmd(command::set_audio_buffer_size, session_params.audio_buffer_size());
         if (!dispatch::parameters().fullscreen_screens_is_set() && !session_params.fullscreen_screens_is_default())
             send_cmd(command::set_fullscreen_screens, session_params.fullscreen_screens());
         if (!dispatch::parameters().fullscreen_flip_left_is_set() && !session_params.fullscreen_flip_left_is_default())
@@ -172,6 +209,8 @@ main_window::main_window(QSettings *settings) :
             send_cmd(command::set_fullscreen_inhibit_screensaver, session_params.fullscreen_inhibit_screensaver());
         if (!dispatch::parameters().fullscreen_3d_ready_sync_is_set() && !session_params.fullscreen_3d_ready_sync_is_default())
             send_cmd(command::set_fullscreen_3d_ready_sync, session_params.fullscreen_3d_ready_sync());
+        if (!dispatch::parameters().fullscreen_per_screen_is_set() && !session_params.fullscreen_per_screen_is_default())
+            send_cmd(command::set_fullscreen_per_screen, session_params.fullscreen_per_screen());
         if (!dispatch::parameters().zoom_is_set() && !session_params.zoom_is_default())
             send_cmd(command::set_zoom, session_params.zoom());
 #if HAVE_LIBXNVCTRL
@@ -589,6 +628,8 @@ void main_window::playloop_step()
     try {
         dispatch::step();
         dispatch::process_all_events();
+        // GUI events are handled immediately anyway; only polling can wait.
+        _timer->setInterval(dispatch::idle() ? 100 : 0);
     }
     catch (std::exception& e) {
         send_cmd(command::close);
@@ -25,6 +25,7 @@
 #include "config.h"
 
 #include <limits>
+#include <algorithm>
 #include <cstring>
 #include <cmath>
 
@@ -41,6 +42,13 @@
 # include <NVCtrl/NVCtrl.h>
 #endif // HAVE_LIBXNVCTRL
 
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+# include <immintrin.h>
+# define HAVE_X86_STREAM_COPY 1
+#else
+# define HAVE_X86_STREAM_COPY 0
+#endif
+
 
 device_request::device_request() :
     device(no_device),
@@ -52,7 +60,8 @@ device_request::device_request() :
 {
 }
 
-void device_request::save(std::ostream &os) const
+template<typename OS>
+void device_request::save_binary(OS &os) const
 {
     s11n::save(os, static_cast<int>(device));
     s11n::save(os, width);
@@ -62,7 +71,8 @@ void device_request::save(std::ostream &os) const
     s11n::save(os, request_mjpeg);
 }
 
-void device_request::load(std::istream &is)
+template<typename IS>
+void device_request::load_binary(IS &is)
 {
     int x;
     s11n::load(is, x);
@@ -74,6 +84,26 @@ void device_request::load(std::istream &is)
     s11n::load(is, request_mjpeg);
 }
 
+void device_request::save(std::ostream &os) const
+{
+    save_binary(os);
+}
+
+void device_request::load(std::istream &is)
+{
+    load_binary(is);
+}
+
+void device_request::save(s11n::writer &w) const
+{
+    save_binary(w);
+}
+
+void device_request::load(s11n::reader &r)
+{
+    load_binary(r);
+}
+
 
 parameters::parameters()
 {
@@ -81,9 +111,13 @@ parameters::parameters()
     unset_log_level();
     unset_benchmark();
     unset_swap_interval();
+    unset_swap_group();
+    unset_swap_barrier();
     // Per-Session parameters
     unset_audio_device();
     unset_quality();
+    unset_adaptive_quality();
+    unset_deinterlacing();
     unset_stereo_mode();
     unset_stereo_mode_swap();
     unset_crosstalk_r();
@@ -96,6 +130,7 @@ parameters::parameters()
     unset_fullscreen_flop_right();
     unset_fullscreen_inhibit_screensaver();
     unset_fullscreen_3d_ready_sync();
+    unset_fullscreen_per_screen();
     unset_contrast();
     unset_brightness();
     unset_hue();
@@ -109,6 +144,21 @@ parameters::parameters()
     unset_subtitle_scale();
     unset_subtitle_color();
     unset_subtitle_shadow();
+    unset_hwaccel();
+    unset_lowres_decoding();
+    unset_display_sync();
+    unset_demuxer_buffer();
+    unset_read_cache();
+    unset_probe_size();
+    unset_analyze_duration();
+    unset_clip_cache();
+    unset_memory_limit();
+    unset_adaptive_bitrate();
+    unset_live_capture();
+    unset_decode_ahead();
+    unset_image_duration();
+    unset_audio_buffers();
+    unset_audio_buffer_size();
 #if HAVE_LIBXNVCTRL
     unset_sdi_output_format();
     unset_sdi_output_left_stereo_mode();
@@ -132,15 +182,20 @@ parameters::parameters()
     unset_center();
     unset_audio_volume();
     unset_audio_mute();
+    unset_stats_overlay();
 }
 
 // Invariant parameters
 const msg::level_t parameters::_log_level_default = msg::INF;
 const bool parameters::_benchmark_default = false;
 const int parameters::_swap_interval_default = 1;
+const int parameters::_swap_group_default = 0;
+const int parameters::_swap_barrier_default = 0;
 // Per-Session parameter defaults
 const int parameters::_audio_device_default = -1;
 const int parameters::_quality_default = 4;
+const bool parameters::_adaptive_quality_default = false;
+const parameters::deinterlacing_t parameters::_deinterlacing_default = deinterlace_adaptive;
 const parameters::stereo_mode_t parameters::_stereo_mode_default = mode_mono_left;
 const bool parameters::_stereo_mode_swap_default = false;
 const float parameters::_crosstalk_r_default = 0.0f;
@@ -153,6 +208,7 @@ const bool parameters::_fullscreen_flip_right_default = false;
 const bool parameters::_fullscreen_flop_right_default = false;
 const bool parameters::_fullscreen_inhibit_screensaver_default = true;
 const bool parameters::_fullscreen_3d_ready_sync_default = false;
+const bool parameters::_fullscreen_per_screen_default = false;
 const float parameters::_contrast_default = 0.0f;
 const float parameters::_brightness_default = 0.0f;
 const float parameters::_hue_default = 0.0f;
@@ -166,6 +222,21 @@ const int parameters::_subtitle_size_default = -1;
 const float parameters::_subtitle_scale_default = -1.0f;
 const uint64_t parameters::_subtitle_color_default = std::numeric_limits<uint64_t>::max();
 const int parameters::_subtitle_shadow_default = -1;
+const std::string parameters::_hwaccel_default = "";
+const bool parameters::_lowres_decoding_default = false;
+const bool parameters::_display_sync_default = false;
+const float parameters::_demuxer_buffer_default = -1.0f;
+const int parameters::_read_cache_default = -1;
+const int parameters::_probe_size_default = -1;
+const float parameters::_analyze_duration_default = -1.0f;
+const int parameters::_clip_cache_default = 0;
+const int parameters::_memory_limit_default = 0;
+const bool parameters::_adaptive_bitrate_default = false;
+const bool parameters::_live_capture_default = false;
+const int parameters::_decode_ahead_default = -1;
+const float parameters::_image_duration_default = 0.0f;
+const int parameters::_audio_buffers_default = -1;
+const int parameters::_audio_buffer_size_default = -1;
 #if HAVE_LIBXNVCTRL
 const int parameters::_sdi_output_format_default = NV_CTRL_GVIO_VIDEO_FORMAT_1080P_25_00_SMPTE274;
 const parameters::stereo_mode_t parameters::_sdi_output_left_stereo_mode_default = mode_mono_left;
@@ -189,6 +260,7 @@ const bool parameters::_fullscreen_default = false;
 const bool parameters::_center_default = false;
 const float parameters::_audio_volume_default = 1.0f;
 const bool parameters::_audio_mute_default = false;
+const bool parameters::_stats_overlay_default = false;
 
 std::string parameters::stereo_layout_to_string(stereo_layout_t stereo_layout, bool stereo_layout_swap)
 {
@@ -472,6 +544,8 @@ std::string parameters::loop_mode_to_string(loop_mode_t loop_mode)
 {
     if (loop_mode == loop_current) {
         return "loop-current";
+    } else if (loop_mode == loop_playlist) {
+        return "loop-playlist";
     } else {
         return "no-loop";
     }
@@ -481,12 +555,37 @@ parameters::loop_mode_t parameters::loop_mode_from_string(const std::string &s)
 {
     if (s == "loop-current") {
         return loop_current;
+    } else if (s == "loop-playlist") {
+        return loop_playlist;
     } else {
         return no_loop;
     }
 }
 
-void parameters::save(std::ostream &os) const
+std::string parameters::deinterlacing_to_string(deinterlacing_t deinterlacing)
+{
+    if (deinterlacing == deinterlace_off) {
+        return "off";
+    } else if (deinterlacing == deinterlace_bob) {
+        return "bob";
+    } else {
+        return "adaptive";
+    }
+}
+
+parameters::deinterlacing_t parameters::deinterlacing_from_string(const std::string &s)
+{
+    if (s == "off") {
+        return deinterlace_off;
+    } else if (s == "bob") {
+        return deinterlace_bob;
+    } else {
+        return deinterlace_adaptive;
+    }
+}
+
+template<typename OS>
+void parameters::save_binary(OS &os) const
 {
     // Invariant parameters
     s11n::save(os, static_cast<int>(_log_level));
@@ -495,11 +594,19 @@ void parameters::save(std::ostream &os) const
     s11n::save(os, _benchmark_set);
     s11n::save(os, _swap_interval);
     s11n::save(os, _swap_interval_set);
+    s11n::save(os, _swap_group);
+    s11n::save(os, _swap_group_set);
+    s11n::save(os, _swap_barrier);
+    s11n::save(os, _swap_barrier_set);
     // Per-Session parameters
     s11n::save(os, _audio_device);
     s11n::save(os, _audio_device_set);
     s11n::save(os, _quality);
     s11n::save(os, _quality_set);
+    s11n::save(os, _adaptive_quality);
+    s11n::save(os, _adaptive_quality_set);
+    s11n::save(os, static_cast<int>(_deinterlacing));
+    s11n::save(os, _deinterlacing_set);
     s11n::save(os, static_cast<int>(_stereo_mode));
     s11n::save(os, _stereo_mode_set);
     s11n::save(os, _stereo_mode_swap);
@@ -524,6 +631,8 @@ void parameters::save(std::ostream &os) const
     s11n::save(os, _fullscreen_inhibit_screensaver_set);
     s11n::save(os, _fullscreen_3d_ready_sync);
     s11n::save(os, _fullscreen_3d_ready_sync_set);
+    s11n::save(os, _fullscreen_per_screen);
+    s11n::save(os, _fullscreen_per_screen_set);
     s11n::save(os, _contrast);
     s11n::save(os, _contrast_set);
     s11n::save(os, _brightness);
@@ -550,6 +659,36 @@ void parameters::save(std::ostream &os) const
     s11n::save(os, _subtitle_color_set);
     s11n::save(os, _subtitle_shadow);
     s11n::save(os, _subtitle_shadow_set);
+    s11n::save(os, _hwaccel);
+    s11n::save(os, _hwaccel_set);
+    s11n::save(os, _lowres_decoding);
+    s11n::save(os, _lowres_decoding_set);
+    s11n::save(os, _display_sync);
+    s11n::save(os, _display_sync_set);
+    s11n::save(os, _demuxer_buffer);
+    s11n::save(os, _demuxer_buffer_set);
+    s11n::save(os, _read_cache);
+    s11n::save(os, _read_cache_set);
+    s11n::save(os, _probe_size);
+    s11n::save(os, _probe_size_set);
+    s11n::save(os, _analyze_duration);
+    s11n::save(os, _analyze_duration_set);
+    s11n::save(os, _clip_cache);
+    s11n::save(os, _clip_cache_set);
+    s11n::save(os, _memory_limit);
+    s11n::save(os, _memory_limit_set);
+    s11n::save(os, _adaptive_bitrate);
+    s11n::save(os, _adaptive_bitrate_set);
+    s11n::save(os, _live_capture);
+    s11n::save(os, _live_capture_set);
+    s11n::save(os, _decode_ahead);
+    s11n::save(os, _decode_ahead_set);
+    s11n::save(os, _image_duration);
+    s11n::save(os, _image_duration_set);
+    s11n::save(os, _audio_buffers);
+    s11n::save(os, _audio_buffers_set);
+    s11n::save(os, _audio_buffer_size);
+    s11n::save(os, _audio_buffer_size_set);
 #if HAVE_LIBXNVCTRL
     s11n::save(os, _sdi_output_format);
     s11n::save(os, _sdi_output_format_set);
@@ -592,9 +731,12 @@ void parameters::save(std::ostream &os) const
     s11n::save(os, _audio_volume_set);
     s11n::save(os, _audio_mute);
     s11n::save(os, _audio_mute_set);
+    s11n::save(os, _stats_overlay);
+    s11n::save(os, _stats_overlay_set);
 }
 
-void parameters::load(std::istream &is)
+template<typename IS>
+void parameters::load_binary(IS &is)
 {
     int x;
     // Invariant parameters
@@ -604,11 +746,19 @@ void parameters::load(std::istream &is)
     s11n::load(is, _benchmark_set);
     s11n::load(is, _swap_interval);
     s11n::load(is, _swap_interval_set);
+    s11n::load(is, _swap_group);
+    s11n::load(is, _swap_group_set);
+    s11n::load(is, _swap_barrier);
+    s11n::load(is, _swap_barrier_set);
     // Per-Session parameters
     s11n::load(is, _audio_device);
     s11n::load(is, _audio_device_set);
     s11n::load(is, _quality);
     s11n::load(is, _quality_set);
+    s11n::load(is, _adaptive_quality);
+    s11n::load(is, _adaptive_quality_set);
+    s11n::load(is, x); _deinterlacing = static_cast<deinterlacing_t>(x);
+    s11n::load(is, _deinterlacing_set);
     s11n::load(is, x); _stereo_mode = static_cast<stereo_mode_t>(x);
     s11n::load(is, _stereo_mode_set);
     s11n::load(is, _stereo_mode_swap);
@@ -633,6 +783,8 @@ void parameters::load(std::istream &is)
     s11n::load(is, _fullscreen_inhibit_screensaver_set);
     s11n::load(is, _fullscreen_3d_ready_sync);
     s11n::load(is, _fullscreen_3d_ready_sync_set);
+    s11n::load(is, _fullscreen_per_screen);
+    s11n::load(is, _fullscreen_per_screen_set);
     s11n::load(is, _contrast);
     s11n::load(is, _contrast_set);
     s11n::load(is, _brightness);
@@ -659,6 +811,36 @@ void parameters::load(std::istream &is)
     s11n::load(is, _subtitle_color_set);
     s11n::load(is, _subtitle_shadow);
     s11n::load(is, _subtitle_shadow_set);
+    s11n::load(is, _hwaccel);
+    s11n::load(is, _hwaccel_set);
+    s11n::load(is, _lowres_decoding);
+    s11n::load(is, _lowres_decoding_set);
+    s11n::load(is, _display_sync);
+    s11n::load(is, _display_sync_set);
+    s11n::load(is, _demuxer_buffer);
+    s11n::load(is, _demuxer_buffer_set);
+    s11n::load(is, _read_cache);
+    s11n::load(is, _read_cache_set);
+    s11n::load(is, _probe_size);
+    s11n::load(is, _probe_size_set);
+    s11n::load(is, _analyze_duration);
+    s11n::load(is, _analyze_duration_set);
+    s11n::load(is, _clip_cache);
+    s11n::load(is, _clip_cache_set);
+    s11n::load(is, _memory_limit);
+    s11n::load(is, _memory_limit_set);
+    s11n::load(is, _adaptive_bitrate);
+    s11n::load(is, _adaptive_bitrate_set);
+    s11n::load(is, _live_capture);
+    s11n::load(is, _live_capture_set);
+    s11n::load(is, _decode_ahead);
+    s11n::load(is, _decode_ahead_set);
+    s11n::load(is, _image_duration);
+    s11n::load(is, _image_duration_set);
+    s11n::load(is, _audio_buffers);
+    s11n::load(is, _audio_buffers_set);
+    s11n::load(is, _audio_buffer_size);
+    s11n::load(is, _audio_buffer_size_set);
 #if HAVE_LIBXNVCTRL
     s11n::load(is, _sdi_output_format);
     s11n::load(is, _sdi_output_format_set);
@@ -701,6 +883,28 @@ void parameters::load(std::istream &is)
     s11n::load(is, _audio_volume_set);
     s11n::load(is, _audio_mute);
     s11n::load(is, _audio_mute_set);
+    s11n::load(is, _stats_overlay);
+    s11n::load(is, _stats_overlay_set);
+}
+
+void parameters::save(std::ostream &os) const
+{
+    save_binary(os);
+}
+
+void parameters::load(std::istream &is)
+{
+    load_binary(is);
+}
+
+void parameters::save(s11n::writer &w) const
+{
+    save_binary(w);
+}
+
+void parameters::load(s11n::reader &r)
+{
+    load_binary(r);
 }
 
 std::string parameters::save_session_parameters() const
@@ -710,6 +914,10 @@ std::string parameters::save_session_parameters() const
         s11n::save(oss, "audio_device", audio_device());
     if (!quality_is_default())
         s11n::save(oss, "quality", quality());
+    if (!adaptive_quality_is_default())
+        s11n::save(oss, "adaptive_quality", _adaptive_quality);
+    if (!deinterlacing_is_default())
+        s11n::save(oss, "deinterlacing", deinterlacing_to_string(deinterlacing()));
     if (!stereo_mode_is_default() || !stereo_mode_swap_is_default())
         s11n::save(oss, "stereo_mode", stereo_mode_to_string(stereo_mode(), stereo_mode_swap()));
     if (!crosstalk_r_is_default())
@@ -758,6 +966,36 @@ std::string parameters::save_session_parameters() const
         s11n::save(oss, "subtitle_color", _subtitle_color);
     if (!subtitle_shadow_is_default())
         s11n::save(oss, "subtitle_shadow", _subtitle_shadow);
+    if (!hwaccel_is_default())
+        s11n::save(oss, "hwaccel", _hwaccel);
+    if (!lowres_decoding_is_default())
+        s11n::save(oss, "lowres_decoding", _lowres_decoding);
+    if (!display_sync_is_default())
+        s11n::save(oss, "display_sync", _display_sync);
+    if (!demuxer_buffer_is_default())
+        s11n::save(oss, "demuxer_buffer", _demuxer_buffer);
+    if (!read_cache_is_default())
+        s11n::save(oss, "read_cache", _read_cache);
+    if (!probe_size_is_default())
+        s11n::save(oss, "probe_size", _probe_size);
+    if (!analyze_duration_is_default())
+        s11n::save(oss, "analyze_duration", _analyze_duration);
+    if (!clip_cache_is_default())
+        s11n::save(oss, "clip_cache", _clip_cache);
+    if (!memory_limit_is_default())
+        s11n::save(oss, "memory_limit", _memory_limit);
+    if (!adaptive_bitrate_is_default())
+        s11n::save(oss, "adaptive_bitrate", _adaptive_bitrate);
+    if (!live_capture_is_default())
+        s11n::save(oss, "live_capture", _live_capture);
+    if (!decode_ahead_is_default())
+        s11n::save(oss, "decode_ahead", _decode_ahead);
+    if (!image_duration_is_default())
+        s11n::save(oss, "image_duration", _image_duration);
+    if (!audio_buffers_is_default())
+        s11n::save(oss, "audio_buffers", _audio_buffers);
+    if (!audio_buffer_size_is_default())
+        s11n::save(oss, "audio_buffer_size", _audio_buffer_size);
 #if HAVE_LIBXNVCTRL
     if (!sdi_output_format_is_default())
         s11n::save(oss, "sdi_output_format", sdi_output_format());
@@ -781,6 +1019,14 @@ void parameters::load_session_parameters(const std::string &s)
         } else if (name == "quality") {
             s11n::load(value, _quality);
             _quality_set = true;
+        } else if (name == "adaptive_quality") {
+            s11n::load(value, _adaptive_quality);
+            _adaptive_quality_set = true;
+        } else if (name == "deinterlacing") {
+            std::string s;
+            s11n::load(value, s);
+            _deinterlacing = deinterlacing_from_string(s);
+            _deinterlacing_set = true;
         } else if (name == "stereo_mode") {
             std::string s;
             s11n::load(value, s);
@@ -858,6 +1104,51 @@ void parameters::load_session_parameters(const std::string &s)
         } else if (name == "subtitle_shadow") {
             s11n::load(value, _subtitle_shadow);
             _subtitle_shadow_set = true;
+        } else if (name == "hwaccel") {
+            s11n::load(value, _hwaccel);
+            _hwaccel_set = true;
+        } else if (name == "lowres_decoding") {
+            s11n::load(value, _lowres_decoding);
+            _lowres_decoding_set = true;
+        } else if (name == "display_sync") {
+            s11n::load(value, _display_sync);
+            _display_sync_set = true;
+        } else if (name == "demuxer_buffer") {
+            s11n::load(value, _demuxer_buffer);
+            _demuxer_buffer_set = true;
+        } else if (name == "read_cache") {
+            s11n::load(value, _read_cache);
+            _read_cache_set = true;
+        } else if (name == "probe_size") {
+            s11n::load(value, _probe_size);
+            _probe_size_set = true;
+        } else if (name == "analyze_duration") {
+            s11n::load(value, _analyze_duration);
+            _analyze_duration_set = true;
+        } else if (name == "clip_cache") {
+            s11n::load(value, _clip_cache);
+            _clip_cache_set = true;
+        } else if (name == "memory_limit") {
+            s11n::load(value, _memory_limit);
+            _memory_limit_set = true;
+        } else if (name == "adaptive_bitrate") {
+            s11n::load(value, _adaptive_bitrate);
+            _adaptive_bitrate_set = true;
+        } else if (name == "live_capture") {
+            s11n::load(value, _live_capture);
+            _live_capture_set = true;
+        } else if (name == "decode_ahead") {
+            s11n::load(value, _decode_ahead);
+            _decode_ahead_set = true;
+        } else if (name == "image_duration") {
+            s11n::load(value, _image_duration);
+            _image_duration_set = true;
+        } else if (name == "audio_buffers") {
+            s11n::load(value, _audio_buffers);
+            _audio_buffers_set = true;
+        } else if (name == "audio_buffer_size") {
+            s11n::load(value, _audio_buffer_size);
+            _audio_buffer_size_set = true;
 #if HAVE_LIBXNVCTRL
         } else if (name == "sdi_output_format") {
             s11n::load(value, _sdi_output_format);
@@ -983,6 +1274,8 @@ video_frame::video_frame() :
     chroma_location(center),
     stereo_layout(parameters::layout_mono),
     stereo_layout_swap(false),
+    field_order(progressive),
+    surface_type(no_surface),
     presentation_time(std::numeric_limits<int64_t>::min())
 {
     for (int i = 0; i < 2; i++)
@@ -992,6 +1285,8 @@ video_frame::video_frame() :
             data[i][p] = NULL;
             line_size[i][p] = 0;
         }
+        surface_device[i] = NULL;
+        surface[i] = 0;
     }
 }
 
@@ -1044,6 +1339,9 @@ std::string video_frame::format_name() const
     case yuv420p:
         name += "yuv420p";
         break;
+    case yuv420sp:
+        name += "yuv420sp";
+        break;
     }
     switch (color_space)
     {
@@ -1073,9 +1371,21 @@ std::string video_frame::format_name() const
         case u10_mpeg:
             name += "-mpeg10";
             break;
+        case u12_full:
+            name += "-jpeg12";
+            break;
+        case u12_mpeg:
+            name += "-mpeg12";
+            break;
+        case u16_full:
+            name += "-jpeg16";
+            break;
+        case u16_mpeg:
+            name += "-mpeg16";
+            break;
         }
     }
-    if (layout == yuv422p || layout == yuv420p)
+    if (layout == yuv422p || layout == yuv420p || layout == yuv420sp)
     {
         switch (chroma_location)
         {
@@ -1104,112 +1414,272 @@ static int next_multiple_of_4(int x)
     return (x / 4 + (x % 4 == 0 ? 0 : 1)) * 4;
 }
 
-void video_frame::copy_plane(int view, int plane, void *buf) const
+// Get the size of one view of the given plane: the bytes per row that belong
+// to the view, the bytes per row in a copy of it (multiple of 4), and the number of rows.
+static void get_view_plane_size(const video_frame &frame, int plane,
+        size_t *row_width, size_t *row_size, size_t *lines)
 {
-    char *dst = reinterpret_cast<char *>(buf);
-    const char *src = NULL;
-    size_t src_offset = 0;
-    size_t src_row_size = 0;
-    size_t dst_row_width = 0;
-    size_t dst_row_size = 0;
-    size_t lines = 0;
-    size_t type_size = (value_range == u8_full || value_range == u8_mpeg) ? 1 : 2;
+    size_t type_size = (frame.value_range == video_frame::u8_full || frame.value_range == video_frame::u8_mpeg) ? 1 : 2;
+    size_t w = 0;
 
-    switch (layout)
+    switch (frame.layout)
     {
-    case bgra32:
-        dst_row_width = width * 4;
-        dst_row_size = dst_row_width * type_size;
-        lines = height;
+    case video_frame::bgra32:
+        w = frame.width * 4;
+        *lines = frame.height;
         break;
 
-    case yuv444p:
-        dst_row_width = width;
-        dst_row_size = next_multiple_of_4(dst_row_width * type_size);
-        lines = height;
+    case video_frame::yuv444p:
+        w = frame.width;
+        *lines = frame.height;
         break;
 
-    case yuv422p:
-        if (plane == 0)
-        {
-            dst_row_width = width;
-            dst_row_size = next_multiple_of_4(dst_row_width * type_size);
-            lines = height;
-        }
-        else
-        {
-            dst_row_width = width / 2;
-            dst_row_size = next_multiple_of_4(dst_row_width * type_size);
-            lines = height;
-        }
+    case video_frame::yuv422p:
+        w = (plane == 0 ? frame.width : frame.width / 2);
+        *lines = frame.height;
         break;
 
-    case yuv420p:
-        if (plane == 0)
-        {
-            dst_row_width = width;
-            dst_row_size = next_multiple_of_4(dst_row_width * type_size);
-            lines = height;
-        }
-        else
-        {
-            dst_row_width = width / 2;
-            dst_row_size = next_multiple_of_4(dst_row_width * type_size);
-            lines = height / 2;
-        }
+    case video_frame::yuv420p:
+        w = (plane == 0 ? frame.width : frame.width / 2);
+        *lines = (plane == 0 ? frame.height : frame.height / 2);
+        break;
+
+    case video_frame::yuv420sp:
+        w = (plane == 0 ? frame.width : frame.width / 2 * 2);
+        *lines = (plane == 0 ? frame.height : frame.height / 2);
         break;
     }
+    *row_width = w * type_size;
+    *row_size = next_multiple_of_4(*row_width);
+}
+
+void video_frame::plane_location(int view, int plane, int *data_view, size_t *offset, size_t *row_size) const
+{
+    size_t row_width, dst_row_size, lines;
+    get_view_plane_size(*this, plane, &row_width, &dst_row_size, &lines);
 
     if (stereo_layout_swap)
     {
         view = (view == 0 ? 1 : 0);
     }
+    *data_view = 0;
+    *row_size = line_size[0][plane];
+    *offset = 0;
     switch (stereo_layout)
     {
     case parameters::layout_mono:
-        src = static_cast<const char *>(data[0][plane]);
-        src_row_size = line_size[0][plane];
-        src_offset = 0;
         break;
     case parameters::layout_separate:
     case parameters::layout_alternating:
-        src = static_cast<const char *>(data[view][plane]);
-        src_row_size = line_size[view][plane];
-        src_offset = 0;
+        *data_view = view;
+        *row_size = line_size[view][plane];
         break;
     case parameters::layout_top_bottom:
     case parameters::layout_top_bottom_half:
-        src = static_cast<const char *>(data[0][plane]);
-        src_row_size = line_size[0][plane];
-        src_offset = view * lines * src_row_size;
+        *offset = view * lines * line_size[0][plane];
         break;
     case parameters::layout_left_right:
     case parameters::layout_left_right_half:
-        src = static_cast<const char *>(data[0][plane]);
-        src_row_size = line_size[0][plane];
-        src_offset = view * dst_row_width;
+        *offset = view * row_width;
         break;
     case parameters::layout_even_odd_rows:
-        src = static_cast<const char *>(data[0][plane]);
-        src_row_size = 2 * line_size[0][plane];
-        src_offset = view * line_size[0][plane];
+        *row_size = 2 * line_size[0][plane];
+        *offset = view * line_size[0][plane];
         break;
     }
+}
 
-    assert(src);
-    if (src_row_size == dst_row_size)
+/* Copying rows of data. When the destination is memory that the CPU never reads
+ * back (typically a mapped pixel buffer object, which is write-combined), we use
+ * non-temporal stores: they do not pollute the cache and fill the write-combining
+ * buffers with whole lines. The best available variant is chosen at runtime.
+ * On other architectures, the C library memcpy() is the best we can do. */
+
+typedef void (*copy_rows_func)(char *dst, size_t dst_stride, const char *src, size_t src_stride,
+        size_t row_width, size_t lines);
+
+static void copy_rows_memcpy(char *dst, size_t dst_stride, const char *src, size_t src_stride,
+        size_t row_width, size_t lines)
+{
+    for (size_t y = 0; y < lines; y++)
     {
-        std::memcpy(dst, src + src_offset, lines * src_row_size);
+        std::memcpy(dst, src, row_width);
+        dst += dst_stride;
+        src += src_stride;
     }
-    else
+}
+
+#if HAVE_X86_STREAM_COPY
+__attribute__((target("sse2")))
+static void copy_rows_sse2(char *dst, size_t dst_stride, const char *src, size_t src_stride,
+        size_t row_width, size_t lines)
+{
+    for (size_t y = 0; y < lines; y++)
     {
-        size_t dst_offset = 0;
-        for (size_t y = 0; y < lines; y++)
+        char *d = dst;
+        const char *s = src;
+        size_t n = row_width;
+        size_t head = std::min(n, (16 - reinterpret_cast<uintptr_t>(d) % 16) % 16);
+        std::memcpy(d, s, head);
+        d += head;
+        s += head;
+        n -= head;
+        for (; n >= 64; n -= 64, d += 64, s += 64)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 16));
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 32));
+            __m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 48));
+            _mm_stream_si128(reinterpret_cast<__m128i *>(d), a);
+            _mm_stream_si128(reinterpret_cast<__m128i *>(d + 16), b);
+            _mm_stream_si128(reinterpret_cast<__m128i *>(d + 32), c);
+            _mm_stream_si128(reinterpret_cast<__m128i *>(d + 48), e);
+        }
+        for (; n >= 16; n -= 16, d += 16, s += 16)
         {
-            std::memcpy(dst + dst_offset, src + src_offset, dst_row_width * type_size);
-            dst_offset += dst_row_size;
-            src_offset += src_row_size;
+            _mm_stream_si128(reinterpret_cast<__m128i *>(d),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(s)));
         }
+        std::memcpy(d, s, n);
+        dst += dst_stride;
+        src += src_stride;
+    }
+    _mm_sfence();
+}
+
+__attribute__((target("avx")))
+static void copy_rows_avx(char *dst, size_t dst_stride, const char *src, size_t src_stride,
+        size_t row_width, size_t lines)
+{
+    for (size_t y = 0; y < lines; y++)
+    {
+        char *d = dst;
+        const char *s = src;
+        size_t n = row_width;
+        size_t head = std::min(n, (32 - reinterpret_cast<uintptr_t>(d) % 32) % 32);
+        std::memcpy(d, s, head);
+        d += head;
+        s += head;
+        n -= head;
+        for (; n >= 128; n -= 128, d += 128, s += 128)
+        {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + 32));
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + 64));
+            __m256i e = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + 96));
+            _mm256_stream_si256(reinterpret_cast<__m256i *>(d), a);
+            _mm256_stream_si256(reinterpret_cast<__m256i *>(d + 32), b);
+            _mm256_stream_si256(reinterpret_cast<__m256i *>(d + 64), c);
+            _mm256_stream_si256(reinterpret_cast<__m256i *>(d + 96), e);
+        }
+        for (; n >= 32; n -= 32, d += 32, s += 32)
+        {
+            _mm256_stream_si256(reinterpret_cast<__m256i *>(d),
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s)));
+        }
+        std::memcpy(d, s, n);
+        dst += dst_stride;
+        src += src_stride;
+    }
+    _mm_sfence();
+    _mm256_zeroupper();
+}
+#endif
+
+static copy_rows_func get_streaming_copy_rows()
+{
+    static copy_rows_func func = NULL;
+    if (!func)
+    {
+        copy_rows_func f = copy_rows_memcpy;
+#if HAVE_X86_STREAM_COPY
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx"))
+            f = copy_rows_avx;
+        else if (__builtin_cpu_supports("sse2"))
+            f = copy_rows_sse2;
+#endif
+        func = f;
+    }
+    return func;
+}
+
+// Below this size, the setup cost of the streaming variants is not worth it.
+static const size_t streaming_copy_min_size = 4096;
+
+static void copy_rows(char *dst, size_t dst_stride, const char *src, size_t src_stride,
+        size_t row_width, size_t lines, bool streaming)
+{
+    if (row_width == dst_stride && row_width == src_stride)
+    {
+        // Contiguous in both source and destination: one single copy.
+        row_width *= lines;
+        lines = 1;
+    }
+    if (streaming && row_width * lines >= streaming_copy_min_size)
+    {
+        get_streaming_copy_rows()(dst, dst_stride, src, src_stride, row_width, lines);
+    }
+    else if (lines == 1)
+    {
+        std::memcpy(dst, src, row_width);
+    }
+    else
+    {
+        copy_rows_memcpy(dst, dst_stride, src, src_stride, row_width, lines);
+    }
+}
+
+void video_frame::copy_data(void *dst, const void *src, size_t size, bool streaming)
+{
+    copy_rows(static_cast<char *>(dst), size, static_cast<const char *>(src), size, size, 1, streaming);
+}
+
+void video_frame::copy_rect(void *dst, size_t dst_row_size, const void *src, size_t src_row_size,
+        size_t row_width, size_t lines, bool streaming)
+{
+    copy_rows(static_cast<char *>(dst), dst_row_size, static_cast<const char *>(src), src_row_size,
+            row_width, lines, streaming);
+}
+
+void video_frame::copy_plane(int view, int plane, void *buf, bool streaming) const
+{
+    char *dst = reinterpret_cast<char *>(buf);
+    size_t dst_row_width, dst_row_size, lines;
+    int data_view;
+    size_t src_offset, src_row_size;
+
+    assert(surface_type == no_surface);
+    get_view_plane_size(*this, plane, &dst_row_width, &dst_row_size, &lines);
+    plane_location(view, plane, &data_view, &src_offset, &src_row_size);
+    const char *src = static_cast<const char *>(data[data_view][plane]);
+
+    assert(src);
+    if (src_row_size == dst_row_size)
+    {
+        // Copy the padding bytes, too, so that the whole plane is a single block.
+        dst_row_width = dst_row_size;
+    }
+    copy_rows(dst, dst_row_size, src + src_offset, src_row_size, dst_row_width, lines, streaming);
+}
+
+void video_frame::set_view_data(int dst_view, const video_frame &src, int src_view)
+{
+    for (int p = 0; p < 3; p++)
+    {
+        data[dst_view][p] = src.data[src_view][p];
+        line_size[dst_view][p] = src.line_size[src_view][p];
+    }
+    surface[dst_view] = src.surface[src_view];
+    if (src.surface_type != no_surface)
+    {
+        // Hardware surfaces determine their own data format.
+        surface_type = src.surface_type;
+        surface_device[0] = src.surface_device[0];
+        surface_device[1] = src.surface_device[1];
+        layout = src.layout;
+        color_space = src.color_space;
+        value_range = src.value_range;
     }
 }
 
@@ -1276,6 +1746,67 @@ int audio_blob::sample_bits() const
     return bits;
 }
 
+// Interleave planar audio data. The channel count is a template parameter for
+// common layouts so that the compiler can unroll and vectorize the inner loop;
+// CHANNELS == 0 handles any other channel count.
+template<typename T, int CHANNELS>
+static void interleave_samples(void *out, const uint8_t *const *planes, int channels, int samples)
+{
+    const int n = (CHANNELS > 0 ? CHANNELS : channels);
+    T *dst = static_cast<T *>(out);
+    for (int c = 0; c < n; c++)
+    {
+        const T *src = reinterpret_cast<const T *>(planes[c]);
+        T *d = dst + c;
+        for (int s = 0; s < samples; s++)
+        {
+            d[s * n] = src[s];
+        }
+    }
+}
+
+template<typename T>
+static void interleave_samples(void *out, const uint8_t *const *planes, int channels, int samples)
+{
+    switch (channels)
+    {
+    case 2:
+        interleave_samples<T, 2>(out, planes, channels, samples);
+        break;
+    case 6:
+        interleave_samples<T, 6>(out, planes, channels, samples);
+        break;
+    case 8:
+        interleave_samples<T, 8>(out, planes, channels, samples);
+        break;
+    default:
+        interleave_samples<T, 0>(out, planes, channels, samples);
+        break;
+    }
+}
+
+void audio_blob::interleave(void *out, const uint8_t *const *planes, int channels, int samples, int sample_size)
+{
+    switch (sample_size)
+    {
+    case 1:
+        interleave_samples<uint8_t>(out, planes, channels, samples);
+        break;
+    case 2:
+        interleave_samples<uint16_t>(out, planes, channels, samples);
+        break;
+    case 4:
+        interleave_samples<uint32_t>(out, planes, channels, samples);
+        break;
+    case 8:
+        interleave_samples<uint64_t>(out, planes, channels, samples);
+        break;
+    default:
+        assert(false);
+        break;
+    }
+}
+
 subtitle_box::subtitle_box() :
     language(),
     format(text),
@@ -1297,7 +1828,8 @@ std::string subtitle_box::format_name() const
     return (language.empty() ? _("unknown") : language);
 }
 
-void subtitle_box::image_t::save(std::ostream &os) const
+template<typename OS>
+void subtitle_box::image_t::save_binary(OS &os) const
 {
     s11n::save(os, w);
     s11n::save(os, h);
@@ -1306,17 +1838,18 @@ void subtitle_box::image_t::save(std::ostream &os) const
     s11n::save(os, palette.size());
     if (palette.size() > 0)
     {
-        s11n::save(os, static_cast<const void *>(&(palette[0])), palette.size() * sizeof(uint8_t));
+        s11n::save(os, palette.ptr(), palette.size());
     }
     s11n::save(os, data.size());
     if (data.size() > 0)
     {
-        s11n::save(os, static_cast<const void *>(&(data[0])), data.size() * sizeof(uint8_t));
+        s11n::save(os, data.ptr(), data.size());
     }
     s11n::save(os, linesize);
 }
 
-void subtitle_box::image_t::load(std::istream &is)
+template<typename IS>
+void subtitle_box::image_t::load_binary(IS &is)
 {
     size_t s;
     s11n::load(is, w);
@@ -1327,18 +1860,39 @@ void subtitle_box::image_t::load(std::istream &is)
     palette.resize(s);
     if (palette.size() > 0)
     {
-        s11n::load(is, static_cast<void *>(&(palette[0])), palette.size() * sizeof(uint8_t));
+        s11n::load(is, palette.ptr(), palette.size());
     }
     s11n::load(is, s);
     data.resize(s);
     if (data.size() > 0)
     {
-        s11n::load(is, static_cast<void *>(&(data[0])), data.size() * sizeof(uint8_t));
+        s11n::load(is, data.ptr(), data.size());
     }
     s11n::load(is, linesize);
 }
 
-void subtitle_box::save(std::ostream &os) const
+void subtitle_box::image_t::save(std::ostream &os) const
+{
+    save_binary(os);
+}
+
+void subtitle_box::image_t::load(std::istream &is)
+{
+    load_binary(is);
+}
+
+void subtitle_box::image_t::save(s11n::writer &w) const
+{
+    save_binary(w);
+}
+
+void subtitle_box::image_t::load(s11n::reader &r)
+{
+    load_binary(r);
+}
+
+template<typename OS>
+void subtitle_box::save_binary(OS &os) const
 {
     s11n::save(os, language);
     s11n::save(os, static_cast<int>(format));
@@ -1349,7 +1903,8 @@ void subtitle_box::save(std::ostream &os) const
     s11n::save(os, presentation_stop_time);
 }
 
-void subtitle_box::load(std::istream &is)
+template<typename IS>
+void subtitle_box::load_binary(IS &is)
 {
     s11n::load(is, language);
     int x;
@@ -1361,3 +1916,23 @@ void subtitle_box::load(std::istream &is)
     s11n::load(is, presentation_start_time);
     s11n::load(is, presentation_stop_time);
 }
+
+void subtitle_box::save(std::ostream &os) const
+{
+    save_binary(os);
+}
+
+void subtitle_box::load(std::istream &is)
+{
+    load_binary(is);
+}
+
+void subtitle_box::save(s11n::writer &w) const
+{
+    save_binary(w);
+}
+
+void subtitle_box::load(s11n::reader &r)
+{
+    load_binary(r);
+}
@@ -28,6 +28,7 @@
 #include <string>
 #include <stdint.h>
 
+#include "base/blb.h"
 #include "base/ser.h"
 #include "base/msg.h"
 
@@ -62,6 +63,12 @@ public:
     // Serialization
     void save(std::ostream &os) const;
     void load(std::istream &is);
+    void save(s11n::writer &w) const;
+    void load(s11n::reader &r);
+
+private:
+    template<typename OS> void save_binary(OS &os) const;
+    template<typename IS> void load_binary(IS &is);
 };
 
 class parameters : public serializable
@@ -123,12 +130,23 @@ public:
     typedef enum {
         no_loop,                        // Do not loop.
         loop_current,                   // Loop the current media input.
+        loop_playlist,                  // Loop the playlist of queued media inputs.
     } loop_mode_t;
 
     // Convert the loop mode to and from a string representation
     static std::string loop_mode_to_string(loop_mode_t loop_mode);
     static loop_mode_t loop_mode_from_string(const std::string &s);
 
+    typedef enum {
+        deinterlace_off,                // Show interlaced frames as they are.
+        deinterlace_bob,                // Interpolate the missing field lines.
+        deinterlace_adaptive,           // Keep the missing field lines where there is no motion.
+    } deinterlacing_t;
+
+    // Convert the deinterlacing method to and from a string representation
+    static std::string deinterlacing_to_string(deinterlacing_t deinterlacing);
+    static deinterlacing_t deinterlacing_from_string(const std::string &s);
+
 #define PARAMETER(TYPE, NAME) \
     private: \
     TYPE _ ## NAME; \
@@ -161,9 +179,13 @@ public:
     PARAMETER(msg::level_t, log_level)        // Global log level
     PARAMETER(bool, benchmark)                // Benchmark mode
     PARAMETER(int, swap_interval)             // Swap interval
+    PARAMETER(int, swap_group)                // NV swap group to join, 0 = none
+    PARAMETER(int, swap_barrier)              // NV swap barrier to bind the swap group to, 0 = none
     // Per-Session parameters
     PARAMETER(int, audio_device)              // Audio output device index, -1 = default
     PARAMETER(int, quality)                   // Rendering quality, 0=fastest .. 4=best
+    PARAMETER(bool, adaptive_quality)         // Lower the quality automatically when the GPU cannot keep up
+    PARAMETER(deinterlacing_t, deinterlacing) // Deinterlacing method for interlaced video
     PARAMETER(stereo_mode_t, stereo_mode)     // Stereo mode
     PARAMETER(bool, stereo_mode_swap)         // Swap left and right view
     PARAMETER(float, crosstalk_r)             // Crosstalk level for red, 0 .. 1
@@ -176,6 +198,7 @@ public:
     PARAMETER(bool, fullscreen_flop_right)    // Flop right view horizontally in fullscreen mode
     PARAMETER(bool, fullscreen_inhibit_screensaver)     // Inhibit screensaver when in fullscreen mode
     PARAMETER(bool, fullscreen_3d_ready_sync) // Use DLP 3-D Ready Sync in fullscreen mode
+    PARAMETER(bool, fullscreen_per_screen)    // Use one GL context per screen in fullscreen mode
     PARAMETER(float, contrast)                // Contrast adjustment, -1 .. +1
     PARAMETER(float, brightness)              // Brightness adjustment, -1 .. +1
     PARAMETER(float, hue)                     // Hue adjustment, -1 .. +1
@@ -189,6 +212,21 @@ public:
     PARAMETER(float, subtitle_scale)          // Scale factor
     PARAMETER(uint64_t, subtitle_color)       // Subtitle color in uint32_t bgra32 format, > UINT32_MAX means keep default
     PARAMETER(int, subtitle_shadow)           // Subtitle shadow, -1 = default, 0 = force off, 1 = force on
+    PARAMETER(std::string, hwaccel)           // Hardware video decoding method, empty means off, "auto" means any
+    PARAMETER(bool, lowres_decoding)          // Decode at reduced resolution if the display is smaller than the video
+    PARAMETER(bool, display_sync)             // Lock video to the display refresh and resample audio to follow
+    PARAMETER(float, demuxer_buffer)          // Seconds of packets to read ahead, < 0 means default for the input type
+    PARAMETER(int, read_cache)                // Size of the read cache in MiB, 0 = off, < 0 means default for the input type
+    PARAMETER(int, probe_size)                // Bytes to read for detecting streams, in KiB, < 0 means default for the input type
+    PARAMETER(float, analyze_duration)        // Seconds of input to analyze for detecting streams, < 0 means default for the input type
+    PARAMETER(int, clip_cache)                // Memory for caching short inputs in decoded form, in MiB, 0 disables it
+    PARAMETER(int, memory_limit)              // Memory for queued packets and decoded data per input, in MiB, 0 for no limit
+    PARAMETER(bool, adaptive_bitrate)         // Switch between the variants of adaptive network streams by bandwidth
+    PARAMETER(bool, live_capture)             // Present the newest device frame with minimal latency instead of smooth playback
+    PARAMETER(int, decode_ahead)              // Number of video frames to decode ahead, 0 = off, < 0 means default for the input type
+    PARAMETER(float, image_duration)          // Seconds to show still images of a playlist, 0 = until playback continues
+    PARAMETER(int, audio_buffers)             // Number of audio output buffers, < 0 means default for the input type
+    PARAMETER(int, audio_buffer_size)         // Size of each audio output buffer in bytes, < 0 means default for the input type
 #if HAVE_LIBXNVCTRL
     PARAMETER(int, sdi_output_format)         // SDI output format
     PARAMETER(stereo_mode_t, sdi_output_left_stereo_mode)  // SDI output left stereo mode
@@ -212,6 +250,7 @@ public:
     PARAMETER(bool, center)                   // Should the video be centered?
     PARAMETER(float, audio_volume)            // Audio volume, 0 .. 1
     PARAMETER(bool, audio_mute)               // Audio mute: -1 = unknown, 0 = off, 1 = on
+    PARAMETER(bool, stats_overlay)            // Show live playback statistics on screen
 
 public:
     // Constructor
@@ -220,6 +259,8 @@ public:
     // Serialization
     void save(std::ostream &os) const;
     void load(std::istream &is);
+    void save(s11n::writer &w) const;
+    void load(s11n::reader &r);
 
     // Serialize per-session parameters
     std::string save_session_parameters() const;
@@ -229,6 +270,11 @@ public:
     void unset_video_parameters();
     std::string save_video_parameters() const;
     void load_video_parameters(const std::string &s);
+
+private:
+    // Binary serialization, for streams and buffers
+    template<typename OS> void save_binary(OS &os) const;
+    template<typename IS> void load_binary(IS &is);
 };
 
 class video_frame
@@ -241,6 +287,7 @@ public:
         yuv444p,        // Three planes, Y/U/V, all with the same size
         yuv422p,        // Three planes, U and V with half width: one U/V pair for 2x1 Y values
         yuv420p,        // Three planes, U and V with half width and half height: one U/V pair for 2x2 Y values
+        yuv420sp,       // Two planes, Y and interleaved UVUV... with half width and half height (NV12, P010)
     } layout_t;
 
     // Color space
@@ -258,6 +305,10 @@ public:
         u8_mpeg,        // 16-235 for Y, 16-240 for U and V
         u10_full,       // 0-1023 for all components (stored in 16 bits)
         u10_mpeg,       // 64-940 for Y, 64-960 for U and V (stored in 16 bits)
+        u12_full,       // 0-4095 for all components (stored in 16 bits)
+        u12_mpeg,       // 256-3760 for Y, 256-3840 for U and V (stored in 16 bits)
+        u16_full,       // 0-65535 for all components
+        u16_mpeg,       // 4096-60160 for Y, 4096-61440 for U and V
     } value_range_t;
 
     // Location of chroma samples (only relevant for chroma subsampling layouts)
@@ -268,6 +319,21 @@ public:
         topleft         // U/V at the corresponding top left Y location
     } chroma_location_t;
 
+    // Field order (only relevant for interlaced video)
+    typedef enum
+    {
+        progressive,    // The frame is not interlaced
+        top_first,      // Interlaced, the field of the even rows (counted from 0) comes first
+        bottom_first,   // Interlaced, the field of the odd rows comes first
+    } field_order_t;
+
+    // Hardware surface type (only relevant for hardware decoded video)
+    typedef enum
+    {
+        no_surface,     // The data is in system memory (see data and line_size)
+        vdpau_surface,  // The data is in VDPAU output surfaces (bgra32 layout)
+    } surface_type_t;
+
     int raw_width;                      // Width of the data in pixels
     int raw_height;                     // Height of the data in pixels
     float raw_aspect_ratio;             // Aspect ratio of the data
@@ -280,10 +346,17 @@ public:
     chroma_location_t chroma_location;  // Chroma sample location
     parameters::stereo_layout_t stereo_layout; // Stereo layout
     bool stereo_layout_swap;            // Whether the stereo layout needs to swap left and right view
+    field_order_t field_order;          // Field order
     // The data. Note that a frame does not own the data stored in these pointers,
     // so it does not free them on destruction.
     void *data[2][3];                   // Data pointer for 1-3 planes in 1-2 views. NULL if unused.
     size_t line_size[2][3];             // Line size for 1-3 planes in 1-2 views. 0 if unused.
+    // Hardware surfaces. If the surface type is not no_surface, then the data and
+    // line_size fields are unused, and the video output must access the surfaces
+    // directly. Like the data, the surfaces are not owned by the frame.
+    surface_type_t surface_type;        // Type of the surfaces
+    void *surface_device[2];            // Type-specific handles of the device that owns the surfaces
+    uintptr_t surface[2];               // Surface handle for 1-2 views. 0 if unused.
 
     int64_t presentation_time;          // Presentation timestamp
 
@@ -293,6 +366,12 @@ public:
     // Set width/height/ar from raw width/height/ar according to stereo layout
     void set_view_dimensions();
 
+    // Number of data planes used by the layout
+    int planes() const
+    {
+        return (layout == bgra32 ? 1 : layout == yuv420sp ? 2 : 3);
+    }
+
     // Does this frame contain valid data?
     bool is_valid() const
     {
@@ -300,8 +379,25 @@ public:
     }
 
     // Copy the data of the given view (0=left, 1=right) and the given plane (see layout)
-    // to the given destination.
-    void copy_plane(int view, int plane, void *dst) const;
+    // to the given destination. Set streaming if the CPU will not read the destination
+    // back, e.g. if it is a mapped pixel buffer object; this bypasses the cache.
+    void copy_plane(int view, int plane, void *dst, bool streaming = false) const;
+
+    // Copy a block of data, see copy_plane() for the meaning of streaming.
+    static void copy_data(void *dst, const void *src, size_t size, bool streaming = false);
+
+    // Copy a rectangle of lines of row_width bytes each, see copy_plane() for the meaning of streaming.
+    static void copy_rect(void *dst, size_t dst_row_size, const void *src, size_t src_row_size,
+            size_t row_width, size_t lines, bool streaming = false);
+
+    // Get the location of the given view (0=left, 1=right) and plane in the data:
+    // the view index of the data pointer to use, the offset of the first byte of
+    // the view in it, and the number of bytes from one row of the view to the next.
+    void plane_location(int view, int plane, int *data_view, size_t *offset, size_t *row_size) const;
+
+    // Use view src_view of the given frame (data or surface) as view dst_view of
+    // this frame.
+    void set_view_data(int dst_view, const video_frame &src, int src_view);
 
     // Return a string describing the format (layout, color space, value range, chroma location)
     std::string format_info() const;    // Human readable information
@@ -348,6 +444,10 @@ public:
 
     // Return the number of bits the sample format
     int sample_bits() const;
+
+    // Interleave planar audio data: copy the given number of samples of the
+    // given size (in bytes) from one plane per channel into out.
+    static void interleave(void *out, const uint8_t *const *planes, int channels, int samples, int sample_size);
 };
 
 class subtitle_box : public serializable
@@ -367,12 +467,18 @@ public:
     public:
         int w, h;                       // Dimensions
         int x, y;                       // Position w.r.t. the video frame
-        std::vector<uint8_t> palette;   // Palette, with R,G,B,A components for each palette entry.
-        std::vector<uint8_t> data;      // Bitmap using the palette
+        blob palette;                   // Palette, with R,G,B,A components for each palette entry.
+        blob data;                      // Bitmap using the palette
         size_t linesize;                // Size of one bitmap line (may differ from width)
 
         void save(std::ostream &os) const;
         void load(std::istream &is);
+        void save(s11n::writer &w) const;
+        void load(s11n::reader &r);
+
+    private:
+        template<typename OS> void save_binary(OS &os) const;
+        template<typename IS> void load_binary(IS &is);
     };
 
     // Description of the content
@@ -429,6 +535,12 @@ public:
     // Serialization
     void save(std::ostream &os) const;
     void load(std::istream &is);
+    void save(s11n::writer &w) const;
+    void load(s11n::reader &r);
+
+private:
+    template<typename OS> void save_binary(OS &os) const;
+    template<typename IS> void load_binary(IS &is);
 };
 
 #endif
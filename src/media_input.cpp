@@ -23,11 +23,15 @@
 #include "config.h"
 
 #include <limits>
+#include <algorithm>
+#include <cstring>
 
 #include "base/dbg.h"
 #include "base/exc.h"
 #include "base/msg.h"
+#include "base/pth.h"
 #include "base/str.h"
+#include "base/tmr.h"
 
 #include "base/gettext.h"
 #define _(string) gettext(string)
@@ -35,11 +39,38 @@
 #include "media_input.h"
 
 
+// Opens a media object in a separate task, so that multiple files
+// are probed in parallel instead of adding up their latencies.
+class media_object_opener : public task
+{
+private:
+    media_object &_media_object;
+    const std::string &_url;
+    const device_request &_dev_request;
+    const parameters &_params;
+    const cpu_share _cpus;
+
+public:
+    media_object_opener(media_object &obj, const std::string &url,
+            const device_request &dev_request, const parameters &params, const cpu_share &cpus) :
+        _media_object(obj), _url(url), _dev_request(dev_request), _params(params), _cpus(cpus)
+    {
+    }
+
+    void run()
+    {
+        _media_object.open(_url, _dev_request, _params, _cpus);
+    }
+};
+
 media_input::media_input() :
+    _is_device(false), _is_live(false),
     _active_video_stream(-1), _active_audio_stream(-1), _active_subtitle_stream(-1),
     _have_active_video_read(false), _have_active_audio_read(false), _have_active_subtitle_read(false),
     _last_audio_data_size(0), _initial_skip(0), _duration(-1),
-    _finished_first_frame_read(false)
+    _finished_first_frame_read(false),
+    _clip_cached(false), _clip_cache_video_index(0),
+    _clip_cache_audio_start(0), _clip_cache_audio_offset(0)
 {
 }
 
@@ -109,16 +140,46 @@ static std::string basename(const std::string &url)
     }
 }
 
-void media_input::open(const std::vector<std::string> &urls, const device_request &dev_request)
+void media_input::open(const std::vector<std::string> &urls, const device_request &dev_request,
+        const parameters &params)
 {
     assert(urls.size() > 0);
 
-    // Open media objects
+    // Open media objects. With multiple files, the first two usually contain the
+    // two views, which are decoded in parallel. Divide the processors among them
+    // so that their decoders do not compete; further files share with the others.
     _is_device = dev_request.is_device();
+    _is_live = (_is_device && params.live_capture());
     _media_objects.resize(urls.size());
-    for (size_t i = 0; i < urls.size(); i++)
+    std::vector<cpu_share> cpu_shares = media_object::cpu_shares(std::min(urls.size(), static_cast<size_t>(2)));
+    if (urls.size() == 1)
     {
-        _media_objects[i].open(urls[i], dev_request);
+        _media_objects[0].open(urls[0], dev_request, params, cpu_shares[0]);
+    }
+    else
+    {
+        std::vector<media_object_opener *> openers;
+        for (size_t i = 0; i < urls.size(); i++)
+        {
+            openers.push_back(new media_object_opener(_media_objects[i], urls[i],
+                        dev_request, params, cpu_shares[i % cpu_shares.size()]));
+            openers.back()->start();
+        }
+        // Wait for all of them before reporting the first error.
+        exc e;
+        for (size_t i = 0; i < openers.size(); i++)
+        {
+            openers[i]->wait();
+            if (e.empty())
+            {
+                e = openers[i]->exception();
+            }
+            delete openers[i];
+        }
+        if (!e.empty())
+        {
+            throw e;
+        }
     }
 
     // Construct id for this input
@@ -273,6 +334,11 @@ void media_input::open(const std::vector<std::string> &urls, const device_reques
 
     // Set active subtitle stream
     _active_subtitle_stream = -1;       // no subtitles by default
+    if (subtitle_streams() > 0)
+    {
+        // This puts the subtitle streams in standby, so that they can be enabled seamlessly.
+        select_subtitle_stream(-1);
+    }
 
     // Print summary
     msg::inf(_("Input:"));
@@ -327,6 +393,14 @@ const std::string &media_input::url(size_t i) const
     return _media_objects[i].url();
 }
 
+const std::string &media_input::video_stream_url(int video_stream, int *object_video_stream) const
+{
+    int o, s;
+    get_video_stream(video_stream, o, s);
+    *object_video_stream = s;
+    return _media_objects[o].url();
+}
+
 const std::string &media_input::id() const
 {
     return _id;
@@ -395,6 +469,93 @@ int64_t media_input::video_frame_duration() const
     return static_cast<int64_t>(video_frame_rate_denominator()) * 1000000 / video_frame_rate_numerator();
 }
 
+const std::string &media_input::video_hwaccel() const
+{
+    assert(_active_video_stream >= 0);
+    int o, s;
+    get_video_stream(_active_video_stream, o, s);
+    return _media_objects[o].video_hwaccel(s);
+}
+
+void media_input::get_conversion_stats(int64_t *frames, int64_t *time)
+{
+    *frames = 0;
+    *time = 0;
+    for (size_t i = 0; i < _media_objects.size(); i++)
+    {
+        int64_t f, t;
+        _media_objects[i].get_conversion_stats(&f, &t);
+        *frames += f;
+        *time += t;
+    }
+}
+
+void media_input::get_queue_stats(size_t *video_packets, size_t *audio_packets, size_t *subtitle_packets,
+        size_t *bytes)
+{
+    *video_packets = 0;
+    *audio_packets = 0;
+    *subtitle_packets = 0;
+    *bytes = 0;
+    for (size_t i = 0; i < _media_objects.size(); i++)
+    {
+        size_t v, a, s, b;
+        _media_objects[i].get_queue_stats(&v, &a, &s, &b);
+        *video_packets += v;
+        *audio_packets += a;
+        *subtitle_packets += s;
+        *bytes += b;
+    }
+}
+
+void media_input::get_memory_stats(size_t *packets, size_t *video, size_t *audio, size_t *subtitles)
+{
+    *packets = 0;
+    *video = _clip_cache_video_data.size();
+    *audio = _clip_cache_audio_data.size();
+    *subtitles = 0;
+    for (size_t i = 0; i < _media_objects.size(); i++)
+    {
+        size_t p, v, a, s;
+        _media_objects[i].get_memory_stats(&p, &v, &a, &s);
+        *packets += p;
+        *video += v;
+        *audio += a;
+        *subtitles += s;
+    }
+}
+
+void media_input::get_read_stats(int64_t *bytes, int64_t *time)
+{
+    *bytes = 0;
+    *time = 0;
+    for (size_t i = 0; i < _media_objects.size(); i++)
+    {
+        int64_t b, t;
+        _media_objects[i].get_read_stats(&b, &t);
+        *bytes += b;
+        *time += t;
+    }
+}
+
+bool media_input::is_adaptive() const
+{
+    return (_media_objects.size() == 1 && _media_objects[0].is_adaptive());
+}
+
+int64_t media_input::video_stream_bitrate(int video_stream) const
+{
+    int o, s;
+    get_video_stream(video_stream, o, s);
+    return _media_objects[o].video_stream_bitrate(s);
+}
+
+int media_input::variant_audio_stream(int video_stream, int audio_stream) const
+{
+    assert(is_adaptive());
+    return _media_objects[0].variant_audio_stream(video_stream, audio_stream);
+}
+
 const audio_blob &media_input::audio_blob_template() const
 {
     assert(_active_audio_stream >= 0);
@@ -444,6 +605,7 @@ void media_input::set_stereo_layout(parameters::stereo_layout_t layout, bool swa
     {
         (void)finish_subtitle_box_read();
     }
+    drop_clip_cache();
     int o, s;
     get_video_stream(_active_video_stream, o, s);
     const video_frame &t = _media_objects[o].video_frame_template(s);
@@ -480,6 +642,7 @@ void media_input::select_video_stream(int video_stream)
     {
         (void)finish_subtitle_box_read();
     }
+    drop_clip_cache();
     assert(video_stream >= 0);
     assert(video_stream < video_streams());
     if (_video_frame.stereo_layout == parameters::layout_separate)
@@ -517,9 +680,14 @@ void media_input::select_video_stream(int video_stream)
     _video_frame.set_view_dimensions();
 }
 
-void media_input::select_audio_stream(int audio_stream)
+bool media_input::select_audio_stream(int audio_stream)
 {
-    if (_have_active_video_read)
+    assert(audio_stream >= 0);
+    assert(audio_stream < audio_streams());
+    // The clip cache must be dropped, and dropping it seeks all media objects.
+    // Otherwise, only the audio read is affected by the switch.
+    bool clip_cached = _clip_cached;
+    if (_have_active_video_read && clip_cached)
     {
         (void)finish_video_frame_read();
     }
@@ -527,12 +695,17 @@ void media_input::select_audio_stream(int audio_stream)
     {
         (void)finish_audio_blob_read();
     }
-    if (_have_active_subtitle_read)
+    if (_have_active_subtitle_read && clip_cached)
     {
         (void)finish_subtitle_box_read();
     }
-    assert(audio_stream >= 0);
-    assert(audio_stream < audio_streams());
+    drop_clip_cache();
+    int old_o = -1, old_s = -1;
+    if (_active_audio_stream >= 0)
+    {
+        get_audio_stream(_active_audio_stream, old_o, old_s);
+    }
+    audio_blob old_audio_blob = _audio_blob;
     _active_audio_stream = audio_stream;
     int o, s;
     get_audio_stream(_active_audio_stream, o, s);
@@ -545,15 +718,26 @@ void media_input::select_audio_stream(int audio_stream)
     }
     // Re-set audio blob template
     _audio_blob = _media_objects[o].audio_blob_template(s);
+    // A standby stream continues where the previous stream stopped, but only
+    // if its media object is being read, and the audio output can play the
+    // new stream without reinitialization.
+    return (!clip_cached && (o == old_o || media_object_is_read(o))
+            && _audio_blob.channels == old_audio_blob.channels
+            && _audio_blob.rate == old_audio_blob.rate
+            && _audio_blob.sample_format == old_audio_blob.sample_format);
 }
 
-void media_input::select_subtitle_stream(int subtitle_stream)
+bool media_input::select_subtitle_stream(int subtitle_stream)
 {
-    if (_have_active_video_read)
+    assert(subtitle_stream >= -1);
+    assert(subtitle_stream < subtitle_streams());
+    // The clip cache is only used without subtitles; see build_clip_cache().
+    bool clip_cached = (_clip_cached && subtitle_stream >= 0);
+    if (_have_active_video_read && clip_cached)
     {
         (void)finish_video_frame_read();
     }
-    if (_have_active_audio_read)
+    if (_have_active_audio_read && clip_cached)
     {
         (void)finish_audio_blob_read();
     }
@@ -561,8 +745,10 @@ void media_input::select_subtitle_stream(int subtitle_stream)
     {
         (void)finish_subtitle_box_read();
     }
-    assert(subtitle_stream >= -1);
-    assert(subtitle_stream < subtitle_streams());
+    if (clip_cached)
+    {
+        drop_clip_cache();
+    }
     _active_subtitle_stream = subtitle_stream;
     int o = -1, s = -1;
     if (_active_subtitle_stream >= 0)
@@ -581,6 +767,24 @@ void media_input::select_subtitle_stream(int subtitle_stream)
         _subtitle_box = _media_objects[o].subtitle_box_template(s);
     else
         _subtitle_box = subtitle_box();
+    // Disabling subtitles needs no resynchronization. Otherwise, the standby
+    // packets are only there if the media object is read for other streams.
+    return (!clip_cached && (o < 0 || media_object_is_read(o)));
+}
+
+bool media_input::media_object_is_read(int o) const
+{
+    int vo = -1, vs = -1;
+    if (_active_video_stream >= 0)
+    {
+        get_video_stream(_active_video_stream, vo, vs);
+    }
+    int ao = -1, as = -1;
+    if (_active_audio_stream >= 0)
+    {
+        get_audio_stream(_active_audio_stream, ao, as);
+    }
+    return (o == vo || o == ao);
 }
 
 void media_input::start_video_frame_read()
@@ -590,6 +794,11 @@ void media_input::start_video_frame_read()
     {
         return;
     }
+    if (_clip_cached)
+    {
+        _have_active_video_read = true;
+        return;
+    }
     if (_video_frame.stereo_layout == parameters::layout_separate)
     {
         int o0, s0, o1, s1;
@@ -616,18 +825,27 @@ video_frame media_input::finish_video_frame_read()
         start_video_frame_read();
     }
     video_frame frame;
-    if (_video_frame.stereo_layout == parameters::layout_separate)
+    if (_clip_cached)
+    {
+        if (_clip_cache_video_index < _clip_cache_video_frames.size())
+        {
+            frame = _clip_cache_video_frames[_clip_cache_video_index++];
+        }
+    }
+    else if (_video_frame.stereo_layout == parameters::layout_separate)
     {
         int o0, s0, o1, s1;
         get_video_stream(0, o0, s0);
         get_video_stream(1, o1, s1);
         video_frame f0 = _media_objects[o0].finish_video_frame_read(s0);
         video_frame f1 = _media_objects[o1].finish_video_frame_read(s1);
-        if (!_finished_first_frame_read && is_device())
+        if ((!_finished_first_frame_read || _is_live) && is_device())
         {
-            /* Try to keep both device streams in sync. This should only be
-             * relevant at the beginning of playback, i.e. the first frame read,
-             * when one device starts grabbing frames before the other does. */
+            /* Try to keep both device streams in sync. This is mostly relevant
+             * at the beginning of playback, i.e. the first frame read, when one
+             * device starts grabbing frames before the other does. In live
+             * capture mode, the devices drop frames independently, so they are
+             * realigned with every frame. */
             while (f0.is_valid() && f1.is_valid()
                     && f1.presentation_time > f0.presentation_time + video_frame_duration() / 2)
             {
@@ -646,13 +864,8 @@ video_frame media_input::finish_video_frame_read()
         if (f0.is_valid() && f1.is_valid())
         {
             frame = _video_frame;
-            for (int p = 0; p < 3; p++)
-            {
-                frame.data[0][p] = f0.data[0][p];
-                frame.data[1][p] = f1.data[0][p];
-                frame.line_size[0][p] = f0.line_size[0][p];
-                frame.line_size[1][p] = f1.line_size[0][p];
-            }
+            frame.set_view_data(0, f0, 0);
+            frame.set_view_data(1, f1, 0);
             frame.presentation_time = f0.presentation_time;
         }
     }
@@ -664,14 +877,8 @@ video_frame media_input::finish_video_frame_read()
         if (f.is_valid())
         {
             frame = _video_frame;
-            for (int v = 0; v < 2; v++)
-            {
-                for (int p = 0; p < 3; p++)
-                {
-                    frame.data[v][p] = f.data[v][p];
-                    frame.line_size[v][p] = f.line_size[v][p];
-                }
-            }
+            frame.set_view_data(0, f, 0);
+            frame.set_view_data(1, f, 1);
             frame.presentation_time = f.presentation_time;
         }
     }
@@ -680,6 +887,25 @@ video_frame media_input::finish_video_frame_read()
     return frame;
 }
 
+void media_input::set_video_skip_level(int level)
+{
+    assert(_active_video_stream >= 0);
+    if (_video_frame.stereo_layout == parameters::layout_separate)
+    {
+        int o0, s0, o1, s1;
+        get_video_stream(0, o0, s0);
+        get_video_stream(1, o1, s1);
+        _media_objects[o0].set_video_skip_level(s0, level);
+        _media_objects[o1].set_video_skip_level(s1, level);
+    }
+    else
+    {
+        int o, s;
+        get_video_stream(_active_video_stream, o, s);
+        _media_objects[o].set_video_skip_level(s, level);
+    }
+}
+
 void media_input::start_audio_blob_read(size_t size)
 {
     assert(_active_audio_stream >= 0);
@@ -687,9 +913,12 @@ void media_input::start_audio_blob_read(size_t size)
     {
         return;
     }
-    int o, s;
-    get_audio_stream(_active_audio_stream, o, s);
-    _media_objects[o].start_audio_blob_read(s, size);
+    if (!_clip_cached)
+    {
+        int o, s;
+        get_audio_stream(_active_audio_stream, o, s);
+        _media_objects[o].start_audio_blob_read(s, size);
+    }
     _last_audio_data_size = size;
     _have_active_audio_read = true;
 }
@@ -704,6 +933,24 @@ audio_blob media_input::finish_audio_blob_read()
         start_audio_blob_read(_last_audio_data_size);
     }
     _have_active_audio_read = false;
+    if (_clip_cached)
+    {
+        // Serve the requested amount of data; like the decoder, do not return
+        // an incomplete blob at the end.
+        audio_blob blob;
+        size_t size = _last_audio_data_size;
+        if (_clip_cache_audio_offset + size <= _clip_cache_audio_data.size())
+        {
+            size_t sample_size = _audio_blob.channels * _audio_blob.sample_bits() / 8;
+            blob = _audio_blob;
+            blob.data = _clip_cache_audio_data.ptr(_clip_cache_audio_offset);
+            blob.size = size;
+            blob.presentation_time = _clip_cache_audio_start
+                + static_cast<int64_t>(_clip_cache_audio_offset / sample_size) * 1000000 / _audio_blob.rate;
+            _clip_cache_audio_offset += size;
+        }
+        return blob;
+    }
     return _media_objects[o].finish_audio_blob_read(s);
 }
 
@@ -733,10 +980,217 @@ subtitle_box media_input::finish_subtitle_box_read()
     return _media_objects[o].finish_subtitle_box_read(s);
 }
 
+// Number of rows of the given plane in the raw video frame data
+static int plane_rows(const video_frame &frame, int plane)
+{
+    if (plane > 0 && (frame.layout == video_frame::yuv420p || frame.layout == video_frame::yuv420sp))
+    {
+        return (frame.raw_height + 1) / 2;
+    }
+    return frame.raw_height;
+}
+
+bool media_input::build_clip_cache(size_t max_size)
+{
+    assert(_active_video_stream >= 0);
+    if (_clip_cached)
+    {
+        return true;
+    }
+    if (_is_device || _duration <= 0 || _active_subtitle_stream >= 0)
+    {
+        return false;
+    }
+
+    // Estimate the size first, to avoid decoding inputs that are obviously too long.
+    const video_frame &t = _video_frame;
+    double bytes_per_pixel = (t.layout == video_frame::bgra32 ? 4.0
+            : t.layout == video_frame::yuv444p ? 3.0
+            : t.layout == video_frame::yuv422p ? 2.0 : 1.5);
+    if (t.value_range != video_frame::u8_full && t.value_range != video_frame::u8_mpeg)
+    {
+        bytes_per_pixel *= 2.0;
+    }
+    if (t.stereo_layout == parameters::layout_separate || t.stereo_layout == parameters::layout_alternating)
+    {
+        bytes_per_pixel *= 2.0;
+    }
+    double estimated_size = bytes_per_pixel * t.raw_width * t.raw_height
+        * (static_cast<double>(_duration) / video_frame_duration());
+    if (_active_audio_stream >= 0)
+    {
+        estimated_size += static_cast<double>(_audio_blob.rate) * _audio_blob.channels
+            * _audio_blob.sample_bits() / 8 * (_duration / 1e6);
+    }
+    if (estimated_size > max_size)
+    {
+        msg::dbg("Input %s is too large for the clip cache (about %g MiB).", _id.c_str(), estimated_size / (1024 * 1024));
+        return false;
+    }
+
+    // Decode all video frames and copy their data. The offsets of the planes
+    // are stored in place of the data pointers until the data is complete,
+    // because growing the blob may move it.
+    int64_t start_time = timer::get(timer::monotonic);
+    const size_t no_plane = std::numeric_limits<size_t>::max();
+    std::vector<size_t> offsets;
+    size_t video_size = 0;
+    bool fits = true;
+    _clip_cache_video_data.resize(std::min(static_cast<size_t>(estimated_size), max_size));
+    for (;;)
+    {
+        start_video_frame_read();
+        video_frame frame = finish_video_frame_read();
+        if (!frame.is_valid())
+        {
+            break;
+        }
+        if (frame.surface_type != video_frame::no_surface)
+        {
+            msg::dbg("Input %s uses hardware surfaces; not using the clip cache.", _id.c_str());
+            fits = false;
+            break;
+        }
+        for (int v = 0; v < 2; v++)
+        {
+            for (int p = 0; p < 3; p++)
+            {
+                if (!frame.data[v][p])
+                {
+                    offsets.push_back(no_plane);
+                    continue;
+                }
+                if (v == 1 && frame.data[1][p] == frame.data[0][p])
+                {
+                    // Both views share this plane
+                    offsets.push_back(offsets[offsets.size() - 3]);
+                    continue;
+                }
+                size_t size = frame.line_size[v][p] * plane_rows(frame, p);
+                if (video_size + size > max_size)
+                {
+                    fits = false;
+                    break;
+                }
+                if (video_size + size > _clip_cache_video_data.size())
+                {
+                    _clip_cache_video_data.resize(std::min(std::max(2 * _clip_cache_video_data.size(),
+                                    video_size + size), max_size));
+                }
+                video_frame::copy_data(_clip_cache_video_data.ptr(video_size), frame.data[v][p], size);
+                offsets.push_back(video_size);
+                video_size += size;
+            }
+            if (!fits)
+            {
+                break;
+            }
+        }
+        if (!fits)
+        {
+            break;
+        }
+        _clip_cache_video_frames.push_back(frame);
+    }
+
+    // Decode all audio data into one contiguous block.
+    size_t audio_size = 0;
+    if (fits && _active_audio_stream >= 0)
+    {
+        size_t sample_size = _audio_blob.channels * _audio_blob.sample_bits() / 8;
+        size_t chunk_size = 65536 / sample_size * sample_size;
+        for (;;)
+        {
+            start_audio_blob_read(chunk_size);
+            audio_blob blob = finish_audio_blob_read();
+            if (!blob.is_valid())
+            {
+                break;
+            }
+            if (video_size + audio_size + blob.size > max_size)
+            {
+                fits = false;
+                break;
+            }
+            if (audio_size == 0)
+            {
+                _clip_cache_audio_start = blob.presentation_time;
+            }
+            _clip_cache_audio_data.resize(audio_size + blob.size);
+            std::memcpy(_clip_cache_audio_data.ptr(audio_size), blob.data, blob.size);
+            audio_size += blob.size;
+        }
+    }
+
+    if (!fits || _clip_cache_video_frames.empty())
+    {
+        msg::dbg("Input %s does not fit into the clip cache.", _id.c_str());
+        _clip_cache_video_data.free();
+        _clip_cache_video_frames.clear();
+        _clip_cache_audio_data.free();
+        seek(std::numeric_limits<int64_t>::min());
+        return false;
+    }
+    _clip_cache_video_data.resize(video_size);
+    for (size_t i = 0; i < _clip_cache_video_frames.size(); i++)
+    {
+        for (int v = 0; v < 2; v++)
+        {
+            for (int p = 0; p < 3; p++)
+            {
+                size_t offset = offsets[6 * i + 3 * v + p];
+                _clip_cache_video_frames[i].data[v][p] =
+                    (offset == no_plane ? NULL : _clip_cache_video_data.ptr(offset));
+            }
+        }
+    }
+    _clip_cache_video_index = 0;
+    _clip_cache_audio_offset = 0;
+    _clip_cached = true;
+    msg::inf(_("Input %s: cached %d decoded video frames and %g seconds of audio in %g MiB (%g seconds)."),
+            _id.c_str(), static_cast<int>(_clip_cache_video_frames.size()),
+            _active_audio_stream >= 0 ? audio_size / (_audio_blob.channels * _audio_blob.sample_bits() / 8)
+            / static_cast<double>(_audio_blob.rate) : 0.0,
+            (video_size + audio_size) / (1024.0 * 1024.0),
+            (timer::get(timer::monotonic) - start_time) / 1e6);
+    return true;
+}
+
+void media_input::drop_clip_cache()
+{
+    if (!_clip_cached)
+    {
+        return;
+    }
+    int64_t pos = tell();
+    _clip_cached = false;
+    _clip_cache_video_data.free();
+    _clip_cache_video_frames.clear();
+    _clip_cache_audio_data.free();
+    msg::dbg("Input %s: dropping the clip cache.", _id.c_str());
+    // The decoders are at the end of the input
+    for (size_t i = 0; i < _media_objects.size(); i++)
+    {
+        _media_objects[i].seek(pos);
+    }
+}
+
 int64_t media_input::tell()
 {
     int64_t pos = std::numeric_limits<int64_t>::min();
     int o, s;
+    if (_clip_cached)
+    {
+        if (_clip_cache_video_index < _clip_cache_video_frames.size())
+        {
+            pos = _clip_cache_video_frames[_clip_cache_video_index].presentation_time;
+        }
+        else
+        {
+            pos = _clip_cache_video_frames.back().presentation_time;
+        }
+        return pos;
+    }
     if (_active_audio_stream >= 0)
     {
         get_audio_stream(_active_audio_stream, o, s);
@@ -750,7 +1204,7 @@ int64_t media_input::tell()
     return pos;
 }
 
-void media_input::seek(int64_t pos)
+void media_input::seek(int64_t pos, bool keyframe_only)
 {
     if (_have_active_video_read)
     {
@@ -764,12 +1218,42 @@ void media_input::seek(int64_t pos)
     {
         (void)finish_subtitle_box_read();
     }
+    if (_clip_cached)
+    {
+        // Continue with the last frame at or before the position, and the
+        // corresponding audio sample.
+        _clip_cache_video_index = 0;
+        while (_clip_cache_video_index + 1 < _clip_cache_video_frames.size()
+                && _clip_cache_video_frames[_clip_cache_video_index + 1].presentation_time <= pos)
+        {
+            _clip_cache_video_index++;
+        }
+        _clip_cache_audio_offset = 0;
+        if (_active_audio_stream >= 0 && pos > _clip_cache_audio_start)
+        {
+            size_t sample_size = _audio_blob.channels * _audio_blob.sample_bits() / 8;
+            size_t samples = static_cast<double>(pos - _clip_cache_audio_start) / 1e6 * _audio_blob.rate;
+            _clip_cache_audio_offset = std::min(samples * sample_size, _clip_cache_audio_data.size());
+        }
+        return;
+    }
     for (size_t i = 0; i < _media_objects.size(); i++)
     {
-        _media_objects[i].seek(pos);
+        _media_objects[i].seek(pos, keyframe_only);
     }
 }
 
+int64_t media_input::keyframe_position(int64_t pos) const
+{
+    if (_clip_cached || _active_video_stream < 0)
+    {
+        return std::numeric_limits<int64_t>::min();
+    }
+    int o, s;
+    get_video_stream(_active_video_stream, o, s);
+    return _media_objects[o].keyframe_position(s, pos);
+}
+
 void media_input::close()
 {
     try
@@ -795,6 +1279,7 @@ void media_input::close()
     {
     }
     _is_device = false;
+    _is_live = false;
     _id = "";
     _media_objects.clear();
     _tag_names.clear();
@@ -810,4 +1295,8 @@ void media_input::close()
     _video_frame = video_frame();
     _audio_blob = audio_blob();
     _subtitle_box = subtitle_box();
+    _clip_cached = false;
+    _clip_cache_video_data.free();
+    _clip_cache_video_frames.clear();
+    _clip_cache_audio_data.free();
 }
@@ -24,6 +24,8 @@
 
 #include <vector>
 
+#include "base/blb.h"
+
 #include "media_data.h"
 #include "media_object.h"
 
@@ -32,6 +34,7 @@ class media_input
 {
 private:
     bool _is_device;                            // Whether this is a device (e.g. a camera)
+    bool _is_live;                              // Whether this is a device in live capture mode
     std::string _id;                            // ID of this input: URL0[/URL1[/URL2[...]]]
     std::vector<media_object> _media_objects;   // The media objects that are combined into one input
     std::vector<std::string> _tag_names;        // Meta data: tag names
@@ -59,9 +62,23 @@ private:
     audio_blob _audio_blob;                     // Audio blob template for currently active audio stream.
     subtitle_box _subtitle_box;                 // Subtitle box template for currently active subtitle stream.
 
+    // Cache of the completely decoded input, see build_clip_cache().
+    bool _clip_cached;                          // Whether all reads are served from the cache.
+    blob _clip_cache_video_data;                // Data of all cached video frames.
+    std::vector<video_frame> _clip_cache_video_frames; // The cached video frames, pointing into the data.
+    size_t _clip_cache_video_index;             // Index of the next video frame to read.
+    blob _clip_cache_audio_data;                // All cached audio data.
+    int64_t _clip_cache_audio_start;            // Presentation time of the first cached audio sample.
+    size_t _clip_cache_audio_offset;            // Offset of the next audio data to read.
+
+    // Drop the cache and let the decoders continue at the current position.
+    void drop_clip_cache();
+
     // Find the media object and its stream index for a given video or audio stream number.
     void get_video_stream(int stream, int &media_object, int &media_object_video_stream) const;
     void get_audio_stream(int stream, int &media_object, int &media_object_audio_stream) const;
+    // Whether packets are read from a media object for the active video or audio stream
+    bool media_object_is_read(int media_object) const;
     void get_subtitle_stream(int stream, int &media_object, int &media_object_subtitle_stream) const;
 
 public:
@@ -72,9 +89,11 @@ public:
     ~media_input();
 
     /* Open this input by combining the media objects at the given URLS.
-     * A device can only have a single URL. */
+     * A device can only have a single URL. The parameters are used as in
+     * media_object::open(), so this can run in any thread. */
 
-    void open(const std::vector<std::string> &urls, const device_request &dev_request = device_request());
+    void open(const std::vector<std::string> &urls, const device_request &dev_request,
+            const parameters &params);
 
     /* Get information */
 
@@ -82,12 +101,21 @@ public:
     size_t urls() const;
     // Get the URL with the given index
     const std::string &url(size_t i) const;
+    // Get the URL of the media object that provides the given video stream, and
+    // the number of the stream in that object. Background decoders such as the
+    // thumbnailer open their own media object with these.
+    const std::string &video_stream_url(int video_stream, int *object_video_stream) const;
 
     // Identifier.
     const std::string &id() const;
 
     // Metadata
     bool is_device() const;
+    // Whether this is a device in live capture mode, see parameters::live_capture()
+    bool is_live() const
+    {
+        return _is_live;
+    }
     size_t tags() const;
     const std::string &tag_name(size_t i) const;
     const std::string &tag_value(size_t i) const;
@@ -149,6 +177,30 @@ public:
     int video_frame_rate_numerator() const;
     int video_frame_rate_denominator() const;
     int64_t video_frame_duration() const;       // derived from frame rate
+    // Hardware decoding method of the active video stream, or an empty string
+    // if it is decoded in software.
+    const std::string &video_hwaccel() const;
+    // Number of video frames whose pixel format was converted in software since the
+    // input was opened, and the time spent on that in microseconds, summed over all media objects.
+    void get_conversion_stats(int64_t *frames, int64_t *time);
+    // Number of queued video, audio and subtitle packets and their total size in bytes,
+    // summed over all media objects.
+    void get_queue_stats(size_t *video_packets, size_t *audio_packets, size_t *subtitle_packets,
+            size_t *bytes);
+    // Memory used for queued packets, decoded video, audio and subtitles in bytes,
+    // summed over all media objects. The clip cache counts as video and audio.
+    void get_memory_stats(size_t *packets, size_t *video, size_t *audio, size_t *subtitles);
+    // Bytes read from all media objects and the time spent reading them in microseconds.
+    void get_read_stats(int64_t *bytes, int64_t *time);
+
+    // Adaptive network streams, see media_object::is_adaptive(). Only single
+    // inputs are adaptive; the video streams are then the variants.
+    bool is_adaptive() const;
+    // The bandwidth of the variant of a video stream in bits per second, or 0 if unknown.
+    int64_t video_stream_bitrate(int video_stream) const;
+    // The audio stream of the variant of the given video stream that replaces
+    // the given audio stream; see media_object::variant_audio_stream().
+    int variant_audio_stream(int video_stream, int audio_stream) const;
 
     // Information about the active audio stream, in the form of an audio blob
     // that contains all properties but no actual data.
@@ -162,6 +214,18 @@ public:
      * Access media data
      */
 
+    /* Decode the complete input with the active streams into memory, and serve
+     * all reads from there afterwards, without any decoding work. This is meant
+     * for short clips, e.g. loops. It fails and returns false if the input is a
+     * device, has an active subtitle stream or hardware decoded video, or if its
+     * decoded data does not fit into max_size bytes. Selecting streams or
+     * changing the stereo layout drops the cache. */
+    bool build_clip_cache(size_t max_size);
+    bool has_clip_cache() const
+    {
+        return _clip_cached;
+    }
+
     /* Set the active media streams.
      * For subtitle streams, -1 selects no subtitle stream. */
     int selected_video_stream() const
@@ -173,12 +237,14 @@ public:
     {
         return _active_audio_stream;
     }
-    void select_audio_stream(int audio_stream);
+    /* Return whether the new stream continues at the current position. Otherwise,
+     * the caller must seek to resynchronize it. */
+    bool select_audio_stream(int audio_stream);
     int selected_subtitle_stream() const
     {
         return _active_subtitle_stream;
     }
-    void select_subtitle_stream(int subtitle_stream);
+    bool select_subtitle_stream(int subtitle_stream);
 
     /* Check whether a stereo layout is supported by this input. */
     bool stereo_layout_is_supported(parameters::stereo_layout_t layout, bool swap) const;
@@ -191,6 +257,10 @@ public:
     /* Wait for the video frame reading to finish, and return the frame.
      * An invalid frame means that EOF was reached. */
     video_frame finish_video_frame_read();
+    /* Let the decoders of the active video stream(s) trade quality for speed.
+     * See media_object::set_video_skip_level(). */
+    static const int max_video_skip_level = media_object::max_video_skip_level;
+    void set_video_skip_level(int level);
 
     /* Start to read the given amount of audio data from the active stream asynchronously
      * (in a separate thread). */
@@ -215,8 +285,13 @@ public:
      * The real position after seeking is only revealed after reading the next video frame
      * or audio blob. This position may differ from the requested position for various
      * reasons (seeking is only possible to keyframes, seeking is not supported by the
-     * stream, ...) */
-    void seek(int64_t pos);
+     * stream, ...)
+     * See media_object::seek() for keyframe_only. */
+    void seek(int64_t pos, bool keyframe_only = false);
+
+    /* Return the position of the last known key frame of the active video stream
+     * at or before the given position; see media_object::keyframe_position(). */
+    int64_t keyframe_position(int64_t pos) const;
 
     /*
      * Cleanup
@@ -31,60 +31,261 @@ extern "C"
 #include <libavdevice/avdevice.h>
 #include <libavcodec/avcodec.h>
 #include <libswscale/swscale.h>
+#include <libavutil/pixdesc.h>
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(58, 18, 100)
+# define HAVE_AV_HWACCEL 1
+# include <libavutil/hwcontext.h>
+#else
+# define HAVE_AV_HWACCEL 0
+#endif
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(58, 18, 100)
+# define HAVE_AV_PACKET_MAKE_REFCOUNTED 1
+#else
+# define HAVE_AV_PACKET_MAKE_REFCOUNTED 0
+#endif
+#if HAVE_AV_HWACCEL && HAVE_LIBVDPAU
+# define HAVE_AV_VDPAU_INTEROP 1
+# include <vdpau/vdpau.h>
+# include <libavutil/hwcontext_vdpau.h>
+#else
+# define HAVE_AV_VDPAU_INTEROP 0
+#endif
 }
 
 #include <deque>
+#include <utility>
+#include <algorithm>
 #include <limits>
+#include <fstream>
 #include <cerrno>
+#include <cstdlib>
 #include <cstring>
 #include <cctype>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #if HAVE_SYSCONF
 #  include <unistd.h>
 #else
 #  include <windows.h>
 #endif
+#if HAVE_PTHREAD_SETAFFINITY_NP
+#  include <pthread.h>
+#  include <sched.h>
+#endif
 
 #include "base/dbg.h"
 #include "base/blb.h"
+#include "base/dir.h"
 #include "base/exc.h"
 #include "base/msg.h"
 #include "base/str.h"
 #include "base/pth.h"
+#include "base/ser.h"
+#include "base/tmr.h"
+#include "base/trc.h"
 
 #include "base/gettext.h"
 #define _(string) gettext(string)
 
+#include "dispatch.h"
+#include "video_output.h"
 #include "media_object.h"
+#include "benchmark_stats.h"
 
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(54, 25, 0)
 #define AV_CODEC_ID_TEXT CODEC_ID_TEXT
 #endif
 
+// A packet queue.
+// This is a ring buffer of the packets of one stream. It only grows, so that
+// queueing packets does not allocate memory once it has reached its working size.
+// It is not thread safe by itself: the read thread protects all queues.
+class packet_queue
+{
+private:
+    std::vector<AVPacket> _ring;
+    size_t _head;
+    size_t _size;
+    size_t _bytes;
+    int64_t _duration;
+
+public:
+    packet_queue() : _ring(), _head(0), _size(0), _bytes(0), _duration(0)
+    {
+    }
+
+    size_t size() const
+    {
+        return _size;
+    }
+    // Total size of the packet data
+    size_t bytes() const
+    {
+        return _bytes;
+    }
+    // Total duration of the packets, in the time base of the stream
+    int64_t duration() const
+    {
+        return _duration;
+    }
+    bool empty() const
+    {
+        return _size == 0;
+    }
+    // The oldest packet. The queue must not be empty.
+    const AVPacket &front() const
+    {
+        assert(_size > 0);
+        return _ring[_head];
+    }
+    void push(const AVPacket &packet);
+    void pop(AVPacket *packet);
+    // Free all queued packets.
+    void clear();
+};
+
+// A ring buffer of decoded audio data.
+// Like the packet queue, it only grows, so that decoding audio does not allocate
+// memory and does not move the buffered data once it has reached its working size.
+class audio_ring
+{
+private:
+    std::vector<unsigned char> _ring;
+    size_t _head;
+    size_t _size;
+
+public:
+    audio_ring() : _ring(), _head(0), _size(0)
+    {
+    }
+
+    size_t size() const
+    {
+        return _size;
+    }
+    // The size of the allocated memory. It only grows, until the ring is destroyed.
+    size_t capacity() const
+    {
+        return _ring.size();
+    }
+    // Append n bytes of data.
+    void write(const void *data, size_t n);
+    // Remove up to n bytes of data from the front and copy them to buffer.
+    // Return the number of bytes that were copied.
+    size_t read(void *buffer, size_t n);
+    void clear()
+    {
+        _head = 0;
+        _size = 0;
+    }
+};
+
+// The read cache.
+// This is an I/O context for libavformat that puts a memory cache in front of
+// the real input. A thread prefetches data ahead of the read position into a
+// ring buffer. Data that was already read stays in the ring until it is
+// overwritten, so that seeks within the cached range do not touch the input.
+class read_cache : public thread
+{
+private:
+    const std::string _url;
+    AVIOContext *_source;               // the real input
+    AVIOContext *_avio;                 // the context used by libavformat
+    int64_t _source_size;
+    std::vector<unsigned char> _ring;
+    int64_t _start;                     // input position of the oldest byte in the ring
+    int64_t _end;                       // input position after the newest byte in the ring
+    int64_t _pos;                       // read position
+    int64_t _seek_target;               // requested input position, or -1
+    int _seek_result;
+    int _error;
+    bool _eof;
+    bool _stop;
+    mutex _mutex;                       // protects the ring and the fields above
+    condition _cond;                    // signals changes of the fields above
+
+    static int interrupt(void *opaque);
+    static int read_packet(void *opaque, uint8_t *buf, int buf_size);
+    static int64_t seek(void *opaque, int64_t offset, int whence);
+
+public:
+    read_cache(const std::string &url, size_t size);
+    ~read_cache();
+    // Open the input and start prefetching. Throw an exception if this fails.
+    void open();
+    // Stop prefetching and close the input.
+    void close();
+    AVIOContext *context()
+    {
+        return _avio;
+    }
+    void run();
+};
+
 // The read thread.
 // This thread reads packets from the AVFormatContext and stores them in the
-// appropriate packet queues.
+// appropriate packet queues. It sleeps while all queues of active streams are
+// filled, and the decode threads sleep while their queue is empty.
+// Every queue gets a minimum number of packets. Beyond that, the thread reads
+// ahead until the video and audio queues hold a given duration or all queues
+// together reach a given size. These budgets depend on the type of input.
 class read_thread : public thread
 {
 private:
     const std::string _url;
     const bool _is_device;
+    const bool _live;           // live capture mode for devices, see parameters::live_capture()
     struct ffmpeg_stuff *_ffmpeg;
+    int64_t _budget_duration;   // microseconds
+    size_t _budget_bytes;
+    size_t _memory_limit;       // bytes for packets and decoded data, 0 for no limit
     bool _eof;
+    bool _failed;
+    bool _stop;
+    bool _reading;      // whether av_read_frame() runs
+    int _stream_locks;  // number of threads waiting in lock_streams()
+    int64_t _read_bytes;        // bytes of all packets read so far
+    int64_t _read_time;         // microseconds spent in av_read_frame() for them
+    mutex _mutex;       // protects the packet queues, the standby flags, and the flags above
+    condition _cond;    // signals changes of the packet queues and the flags
+
+    // The memory used by all packet queues and the decoded data, in bytes.
+    size_t memory_use();
+    bool need_another_packet();
+    void queue_packet(AVPacket &packet);
+    // The position in microseconds before which the packets of standby streams are
+    // not needed anymore, or the minimum int64_t value if it is unknown.
+    int64_t standby_position();
+    void trim_standby_queue(packet_queue &queue, const AVStream *stream);
 
 public:
-    read_thread(const std::string &url, bool is_device, struct ffmpeg_stuff *ffmpeg);
+    read_thread(const std::string &url, bool is_device, struct ffmpeg_stuff *ffmpeg,
+            const parameters &params);
     void run();
     void reset();
-    bool eof() const
-    {
-        return _eof;
-    }
+    // Stop reading, wait for the thread to finish, and rethrow its exception, if any.
+    void stop();
+    // Get the next packet from the given queue, waiting for it to be read if necessary.
+    // Return false if there are no more packets because the end of the input was reached.
+    bool get_packet(packet_queue &queue, AVPacket *packet);
+    // Get the next packet from the given queue only if it was already read.
+    bool get_queued_packet(packet_queue &queue, AVPacket *packet);
+    // Get the number of queued packets per stream type, and their total size in bytes.
+    void get_queue_stats(size_t *video_packets, size_t *audio_packets, size_t *subtitle_packets,
+            size_t *bytes);
+    // Get the number of bytes read so far, and the time spent reading them.
+    void get_read_stats(int64_t *bytes, int64_t *time);
+    // Change the discard and standby flags of the streams between these two calls.
+    // The reader keeps running, but does not read packets meanwhile, and the
+    // packet queues are locked.
+    void lock_streams();
+    void unlock_streams();
 };
 
 // The video decode thread.
-// This thread reads packets from its packet queue and decodes them to video frames.
-class video_decode_thread : public thread
+// This task reads packets from its packet queue and decodes them to video frames.
+class video_decode_thread : public task
 {
 private:
     std::string _url;
@@ -92,8 +293,12 @@ private:
     int _video_stream;
     video_frame _frame;
     int _raw_frames;
+    int _skip_level;
 
     int64_t handle_timestamp(int64_t timestamp);
+    // Convert the pixel format of a frame in software
+    void convert(const AVFrame *src, enum AVPixelFormat src_fmt, int width, int height,
+            AVFrame *dst, enum AVPixelFormat dst_fmt);
 
 public:
     video_decode_thread(const std::string &url, struct ffmpeg_stuff *ffmpeg, int video_stream);
@@ -101,6 +306,11 @@ public:
     {
         _raw_frames = raw_frames;
     }
+    // See media_object::set_video_skip_level(). Only change this while the thread is stopped.
+    void set_skip_level(int skip_level)
+    {
+        _skip_level = skip_level;
+    }
     void run();
     const video_frame &frame()
     {
@@ -108,9 +318,128 @@ public:
     }
 };
 
+// A slice of a software pixel format conversion.
+// Each slice converts a horizontal stripe of a video frame with its own scaler
+// context, so that the slices of one frame can be converted in parallel.
+class video_sws_slice : public task
+{
+public:
+    std::vector<int> cpus;      // the processors of the video stream
+    struct SwsContext *ctx;
+    const uint8_t *src[4];
+    int src_linesize[4];
+    uint8_t *dst[4];
+    int dst_linesize[4];
+    int height;
+
+    video_sws_slice();
+    ~video_sws_slice();
+    // Convert the slice in the calling thread
+    void convert();
+    void run();
+};
+
+// A pool of buffers for decoded video frames.
+// The buffers are reference counted. A buffer returns to the pool when its last
+// reference is released, so that decoding ahead does not allocate memory once
+// the pool has reached its working size.
+// It is not thread safe by itself: the video lookahead thread protects it.
+class video_frame_pool
+{
+private:
+    std::vector<blob *> _buffers;
+    std::vector<int> _refs;
+    size_t _bytes;
+
+public:
+    video_frame_pool() : _buffers(), _refs(), _bytes(0)
+    {
+    }
+    ~video_frame_pool();
+    // Get an unused buffer of the given size, with one reference.
+    int acquire(size_t size);
+    void ref(int buffer)
+    {
+        _refs[buffer]++;
+    }
+    void unref(int buffer)
+    {
+        _refs[buffer]--;
+    }
+    void *ptr(int buffer)
+    {
+        return _buffers[buffer]->ptr();
+    }
+    // The total size of all buffers.
+    size_t bytes() const
+    {
+        return _bytes;
+    }
+};
+
+// The video lookahead thread.
+// This thread runs the decoder of one video stream ahead of the player, and
+// keeps up to a given number of decoded frames in a queue, so that a decoding
+// spike does not delay the display of the next frame. The frame data is copied
+// to buffers from a frame pool, because the decoder overwrites its own buffers.
+// For alternating stereo, the queue holds pairs of raw frames, so the next pair
+// is decoded while the current one is displayed. Frames in hardware surfaces
+// cannot be copied; the thread stops decoding ahead when it gets such a frame,
+// and the player then reads frames directly from the video decode thread again.
+class video_lookahead_thread : public thread
+{
+private:
+    const std::string _url;
+    struct ffmpeg_stuff *_ffmpeg;
+    const int _video_stream;
+    const size_t _depth;        // maximum number of queued frames
+    int _raw_frames;            // raw frames per frame, see media_object::start_video_frame_read()
+    int _skip_level;            // see media_object::set_video_skip_level()
+    video_frame_pool _pool;
+    std::deque<std::pair<video_frame, int> > _queue;    // the frames and their pool buffers
+    int _current_buffer;        // the buffer of the frame that the player uses, or -1
+    bool _eof;
+    bool _failed;
+    bool _surfaces;
+    bool _stop;
+    mutex _mutex;               // protects the pool, the queue, and the flags above
+    condition _cond;            // signals changes of the queue and the flags
+
+    void release_current();
+
+public:
+    video_lookahead_thread(const std::string &url, struct ffmpeg_stuff *ffmpeg, int video_stream, size_t depth);
+    // Whether the player should get its frames from this thread.
+    bool enabled();
+    // Whether frames are queued.
+    bool have_frames();
+    // The number of raw frames per frame. Only change this while the thread is stopped.
+    int raw_frames() const
+    {
+        return _raw_frames;
+    }
+    void set_raw_frames(int raw_frames)
+    {
+        _raw_frames = raw_frames;
+    }
+    // The skip level for the frames that are decoded from now on. Can be changed at any time.
+    void set_skip_level(int skip_level);
+    void run();
+    // Stop decoding ahead, wait for the thread to finish, and rethrow its exception, if any.
+    void stop();
+    // Throw away all queued frames. Only call this while the thread is stopped.
+    void clear();
+    // Throw away the queued frames that end before the given position. Return true if
+    // a frame at or after the position remains. Only call this while the thread is stopped.
+    bool skip_to(int64_t pos);
+    // Get the next frame, waiting for it to be decoded if necessary. The frame data
+    // stays valid until the next call. Return an invalid frame at the end of the stream.
+    video_frame get_frame();
+};
+
 // The audio decode thread.
-// This thread reads packets from its packet queue and decodes them to audio blobs.
-class audio_decode_thread : public thread
+// This task reads packets from its packet queue and decodes them to audio blobs.
+class audio_decode_thread : public task
 {
 private:
     std::string _url;
@@ -119,6 +448,8 @@ private:
     audio_blob _blob;
 
     int64_t handle_timestamp(int64_t timestamp);
+    // Append decoded data to the audio buffer of the stream
+    void buffer(const void *data, size_t n);
 
 public:
     audio_decode_thread(const std::string &url, struct ffmpeg_stuff *ffmpeg, int audio_stream);
@@ -130,8 +461,8 @@ public:
 };
 
 // The subtitle decode thread.
-// This thread reads packets from its packet queue and decodes them to subtitle boxes.
-class subtitle_decode_thread : public thread
+// This task reads packets from its packet queue and decodes them to subtitle boxes.
+class subtitle_decode_thread : public task
 {
 private:
     std::string _url;
@@ -160,6 +491,7 @@ static const size_t audio_tmpbuf_size = (max_audio_frame_size * 3) / 2;
 struct ffmpeg_stuff
 {
     AVFormatContext *format_ctx;
+    read_cache *cache;
 
     bool have_active_audio_stream;
     int64_t pos;
@@ -169,65 +501,279 @@ struct ffmpeg_stuff
     std::vector<int> video_streams;
     std::vector<AVCodecContext *> video_codec_ctxs;
     std::vector<video_frame> video_frame_templates;
-    std::vector<struct SwsContext *> video_sws_ctxs;
     std::vector<AVCodec *> video_codecs;
-    std::vector<std::deque<AVPacket> > video_packet_queues;
-    std::vector<mutex> video_packet_queue_mutexes;
+    std::vector<packet_queue> video_packet_queues;
     std::vector<AVPacket> video_packets;
     std::vector<video_decode_thread> video_decode_threads;
+    std::vector<video_lookahead_thread *> video_lookahead_threads;
+    std::vector<bool> video_lookahead_reads;                    // whether the current frame read uses the lookahead thread
+    std::vector<int> video_skip_levels;                         // see media_object::set_video_skip_level()
     std::vector<AVFrame *> video_frames;
     std::vector<AVFrame *> video_buffered_frames;
-    std::vector<uint8_t *> video_buffers;
+    std::vector<uint8_t *> video_buffers;                       // allocated while the stream is active
+    std::vector<size_t> video_buffer_sizes;                     // size of video_buffers and video_sws_buffers
+    std::vector<std::vector<video_sws_slice *> > video_sws_slices;   // slices for software pixel format conversion
     std::vector<AVFrame *> video_sws_frames;
-    std::vector<uint8_t *> video_sws_buffers;
+    std::vector<uint8_t *> video_sws_buffers;                   // allocated while the stream is active
+    mutex video_conversion_mutex;                               // protects the conversion statistics
+    int64_t video_conversion_frames;                            // number of converted frames
+    int64_t video_conversion_time;                              // conversion time in microseconds
     std::vector<int64_t> video_last_timestamps;
+    std::vector<std::vector<int64_t> > video_keyframes;         // known key frame timestamps, sorted, in stream time base
+    mutable mutex video_keyframes_mutex;                        // protects video_keyframes while the reader runs
+    bool video_keyframes_only;                                  // decode only key frames; see media_object::seek()
+    std::string video_keyframes_file;                           // file that caches the key frame index, if any
+    size_t video_keyframes_loaded;                              // number of key frames loaded from that file
+    std::vector<int64_t> video_seek_targets;                    // drop frames before this position after a seek
+    std::vector<enum AVPixelFormat> video_pix_fmts;
+    std::vector<std::string> video_hwaccel_names;
+    std::vector<std::vector<int> > video_cpus;                  // processors for decoding; empty means all
+#if HAVE_AV_HWACCEL
+    std::vector<AVBufferRef *> video_hw_device_ctxs;
+    std::vector<enum AVPixelFormat> video_hw_pix_fmts;
+    std::vector<AVFrame *> video_hw_frames;
+    std::vector<AVFrame *> video_hw_sws_frames;
+    std::vector<uint8_t *> video_hw_sws_buffers;
+#endif
+#if HAVE_AV_VDPAU_INTEROP
+    std::vector<struct vdpau_output *> video_vdpau_outputs;
+    std::vector<bool> video_vdpau_output_failed;
+#endif
 
     std::vector<int> audio_streams;
     std::vector<AVCodecContext *> audio_codec_ctxs;
     std::vector<audio_blob> audio_blob_templates;
     std::vector<AVCodec *> audio_codecs;
-    std::vector<std::deque<AVPacket> > audio_packet_queues;
-    std::vector<mutex> audio_packet_queue_mutexes;
+    std::vector<bool> audio_codecs_open;                        // codecs are opened when the stream is activated
+    std::vector<packet_queue> audio_packet_queues;
     std::vector<audio_decode_thread> audio_decode_threads;
-    std::vector<unsigned char *> audio_tmpbufs;
+    std::vector<unsigned char *> audio_tmpbufs;                 // allocated while the stream is active
     std::vector<blob> audio_blobs;
-    std::vector<std::vector<unsigned char> > audio_buffers;
+    std::vector<audio_ring> audio_buffers;
     std::vector<int64_t> audio_last_timestamps;
+    std::vector<bool> audio_standby;                            // inactive, but packets around the position are queued
+    std::vector<int64_t> audio_seek_targets;                    // drop data before this position after a seek
 
     std::vector<int> subtitle_streams;
     std::vector<AVCodecContext *> subtitle_codec_ctxs;
     std::vector<subtitle_box> subtitle_box_templates;
     std::vector<AVCodec *> subtitle_codecs;
-    std::vector<std::deque<AVPacket> > subtitle_packet_queues;
-    std::vector<mutex> subtitle_packet_queue_mutexes;
+    std::vector<bool> subtitle_codecs_open;                     // codecs are opened when the stream is activated
+    std::vector<packet_queue> subtitle_packet_queues;
     std::vector<subtitle_decode_thread> subtitle_decode_threads;
     std::vector<std::deque<subtitle_box> > subtitle_box_buffers;
     std::vector<int64_t> subtitle_last_timestamps;
+    std::vector<bool> subtitle_standby;                         // like audio_standby
+
+    mutex memory_mutex;                                         // protects the memory statistics
+    size_t video_memory;                                        // decoded video frame buffers, in bytes
+    size_t audio_memory;                                        // decoded audio buffers, in bytes
+    size_t subtitle_memory;                                     // decoded subtitle boxes, in bytes
 };
 
-// Use one decoding thread per processor for video decoding.
-static int video_decoding_threads()
+// Update one of the memory statistics of the ffmpeg stuff.
+static void account_memory(struct ffmpeg_stuff *ffmpeg, size_t *counter, size_t added, size_t removed)
+{
+    ffmpeg->memory_mutex.lock();
+    *counter = *counter + added - removed;
+    ffmpeg->memory_mutex.unlock();
+}
+
+// The memory used by a decoded subtitle box, in bytes.
+static size_t subtitle_box_bytes(const subtitle_box &box)
+{
+    size_t bytes = sizeof(box) + box.language.length() + box.style.length() + box.str.length();
+    for (size_t i = 0; i < box.images.size(); i++)
+    {
+        bytes += sizeof(box.images[i]) + box.images[i].palette.size() + box.images[i].data.size();
+    }
+    return bytes;
+}
+
+// Throw away the decoded subtitle boxes of a stream.
+static void clear_subtitle_box_buffer(struct ffmpeg_stuff *ffmpeg, int subtitle_stream)
+{
+    std::deque<subtitle_box> &buffer = ffmpeg->subtitle_box_buffers[subtitle_stream];
+    size_t bytes = 0;
+    for (size_t i = 0; i < buffer.size(); i++)
+    {
+        bytes += subtitle_box_bytes(buffer[i]);
+    }
+    buffer.clear();
+    account_memory(ffmpeg, &(ffmpeg->subtitle_memory), 0, bytes);
+}
+
+// Get the processor topology: the logical processors of each physical core, ordered
+// by package and core, restricted to the processors that this process may use.
+static const std::vector<std::vector<int> > &cpu_cores()
 {
-    static long n = -1;
-    if (n < 0)
+    static std::vector<std::vector<int> > cores;
+    if (cores.empty())
     {
+#if HAVE_PTHREAD_SETAFFINITY_NP
+        cpu_set_t allowed;
+        if (pthread_getaffinity_np(pthread_self(), sizeof(allowed), &allowed) == 0)
+        {
+            // ((package, core), logical processor)
+            std::vector<std::pair<std::pair<int, int>, int> > cpus;
+            for (int i = 0; i < CPU_SETSIZE; i++)
+            {
+                if (CPU_ISSET(i, &allowed))
+                {
+                    // Without topology information, every logical processor is a core.
+                    std::string dir = std::string("/sys/devices/system/cpu/cpu") + str::from(i) + "/topology/";
+                    int package = 0;
+                    int core = i;
+                    std::ifstream package_file((dir + "physical_package_id").c_str());
+                    package_file >> package;
+                    std::ifstream core_file((dir + "core_id").c_str());
+                    core_file >> core;
+                    cpus.push_back(std::make_pair(std::make_pair(package, core), i));
+                }
+            }
+            std::sort(cpus.begin(), cpus.end());
+            for (size_t i = 0; i < cpus.size(); i++)
+            {
+                if (i == 0 || cpus[i].first != cpus[i - 1].first)
+                {
+                    cores.push_back(std::vector<int>());
+                }
+                cores.back().push_back(cpus[i].second);
+            }
+        }
+#endif
+        if (cores.empty())
+        {
+            long n;
 #ifdef HAVE_SYSCONF
-        n = sysconf(_SC_NPROCESSORS_ONLN);
+            n = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+            SYSTEM_INFO si;
+            GetSystemInfo(&si);
+            n = si.dwNumberOfProcessors;
+#endif
+            for (long i = 0; i < std::max(n, 1L); i++)
+            {
+                cores.push_back(std::vector<int>(1, i));
+            }
+        }
+    }
+    return cores;
+}
+
+// Restrict the calling thread to the given logical processors. Threads that it
+// creates inherit this. An empty set allows all processors of the process.
+static void set_thread_cpus(const std::vector<int> &cpus)
+{
+#if HAVE_PTHREAD_SETAFFINITY_NP
+    const std::vector<std::vector<int> > &cores = cpu_cores();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (cpus.empty())
+    {
+        for (size_t i = 0; i < cores.size(); i++)
+        {
+            for (size_t j = 0; j < cores[i].size(); j++)
+            {
+                CPU_SET(cores[i][j], &set);
+            }
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < cpus.size(); i++)
+        {
+            CPU_SET(cpus[i], &set);
+        }
+    }
+    int e = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (e != 0)
+    {
+        msg::dbg(std::string("Cannot set processor affinity: ") + std::strerror(e));
+    }
 #else
-        SYSTEM_INFO si;
-        GetSystemInfo(&si);
-        n = si.dwNumberOfProcessors;
+    (void)cpus;
 #endif
-        if (n < 1)
+}
+
+// Restrict the calling thread to the given processors until the end of the scope.
+// Tasks need this because the threads of the task pool run all kinds of tasks.
+// An empty set leaves the calling thread alone.
+class thread_cpus_scope
+{
+private:
+    const bool _active;
+
+public:
+    thread_cpus_scope(const std::vector<int> &cpus) : _active(!cpus.empty())
+    {
+        if (_active)
         {
-            n = 1;
+            set_thread_cpus(cpus);
         }
-        else if (n > 16)
+    }
+    ~thread_cpus_scope()
+    {
+        if (_active)
         {
-            n = 16;
+            set_thread_cpus(std::vector<int>());
         }
     }
-    return n;
+};
+
+// Divide the given processors into n parts and return part i. Neighboring
+// processors, e.g. the logical processors of one core, stay together.
+static cpu_share split_cpu_share(const cpu_share &share, int n, int i)
+{
+    cpu_share part;
+    if (n <= 1)
+    {
+        part = share;
+    }
+    else if (static_cast<int>(share.cpus.size()) >= n)
+    {
+        part.cpus.assign(share.cpus.begin() + i * share.cpus.size() / n,
+                share.cpus.begin() + (i + 1) * share.cpus.size() / n);
+        part.threads = part.cpus.size();
+    }
+    else
+    {
+        part.cpus = share.cpus;
+        part.threads = std::max(share.threads / n, 1);
+    }
+    return part;
+}
+
+std::vector<cpu_share> media_object::cpu_shares(int n)
+{
+    // Use one decoding thread per logical processor, but at most 16.
+    const int max_threads = 16;
+    const std::vector<std::vector<int> > &cores = cpu_cores();
+    const int ncores = cores.size();
+    std::vector<cpu_share> shares(n);
+    for (int i = 0; i < n; i++)
+    {
+        if (n > 1 && ncores >= n)
+        {
+            for (int c = i * ncores / n; c < (i + 1) * ncores / n; c++)
+            {
+                shares[i].cpus.insert(shares[i].cpus.end(), cores[c].begin(), cores[c].end());
+            }
+            shares[i].threads = shares[i].cpus.size();
+        }
+        else
+        {
+            // All shares use all processors.
+            int cpus = 0;
+            for (int c = 0; c < ncores; c++)
+            {
+                cpus += cores[c].size();
+            }
+            shares[i].threads = std::max(cpus / n, 1);
+        }
+        shares[i].threads = std::min(shares[i].threads, max_threads);
+    }
+    return shares;
 }
 
 // Return FFmpeg error as std::string.
@@ -238,6 +784,13 @@ static std::string my_av_strerror(int err)
     return std::string(b.ptr<const char>());
 }
 
+// Return whether the URL refers to something that is read over the network.
+static bool is_network_url(const std::string &url)
+{
+    size_t colon = url.find("://");
+    return (colon != std::string::npos && url.substr(0, colon) != "file");
+}
+
 // Convert FFmpeg log messages to our log messages.
 static void my_av_log(void *ptr, int level, const char *fmt, va_list vl)
 {
@@ -309,6 +862,13 @@ static int64_t timestamp_helper(int64_t &last_timestamp, int64_t timestamp)
     return timestamp;
 }
 
+// Get the nominal duration of one frame of a video stream, or 0 if unknown
+static int64_t video_frame_duration(AVStream *stream)
+{
+    return (stream->avg_frame_rate.num > 0 && stream->avg_frame_rate.den > 0
+            ? static_cast<int64_t>(1000000) * stream->avg_frame_rate.den / stream->avg_frame_rate.num : 0);
+}
+
 // Get a stream duration
 static int64_t stream_duration(AVStream *stream, AVFormatContext *format)
 {
@@ -340,80 +900,481 @@ static std::string get_extension(const std::string& url)
     return extension;
 }
 
-
-media_object::media_object(bool always_convert_to_bgra32) :
-    _always_convert_to_bgra32(always_convert_to_bgra32), _ffmpeg(NULL)
+// Check if frames in the given pixel format can be passed to the video output
+// as they are, so that the color conversion happens on the GPU. If so, get the
+// data layout and the number of bits per sample. P010 stores its 10 bit samples
+// in the high bits of 16 bit values, so the video output treats it as 16 bit data.
+static bool native_pix_fmt(enum AVPixelFormat fmt, video_frame::layout_t *layout, int *bits)
 {
-    avdevice_register_all();
-    av_register_all();
-    avformat_network_init();
-    switch (msg::level())
+    switch (fmt)
     {
-    case msg::DBG:
-        av_log_set_level(AV_LOG_DEBUG);
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_NV12:
+        *bits = 8;
         break;
-    case msg::INF:
-        av_log_set_level(AV_LOG_INFO);
+    case AV_PIX_FMT_YUV444P10:
+    case AV_PIX_FMT_YUV422P10:
+    case AV_PIX_FMT_YUV420P10:
+        *bits = 10;
         break;
-    case msg::WRN:
-        av_log_set_level(AV_LOG_WARNING);
+    case AV_PIX_FMT_YUV444P12:
+    case AV_PIX_FMT_YUV422P12:
+    case AV_PIX_FMT_YUV420P12:
+        *bits = 12;
         break;
-    case msg::ERR:
-        av_log_set_level(AV_LOG_ERROR);
+    case AV_PIX_FMT_YUV444P16:
+    case AV_PIX_FMT_YUV422P16:
+    case AV_PIX_FMT_YUV420P16:
+#ifdef AV_PIX_FMT_P010
+    case AV_PIX_FMT_P010:
+#endif
+#ifdef AV_PIX_FMT_P016
+    case AV_PIX_FMT_P016:
+#endif
+        *bits = 16;
         break;
-    case msg::REQ:
     default:
-        av_log_set_level(AV_LOG_FATAL);
+        return false;
+    }
+    switch (fmt)
+    {
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_YUV444P10:
+    case AV_PIX_FMT_YUV444P12:
+    case AV_PIX_FMT_YUV444P16:
+        *layout = video_frame::yuv444p;
+        break;
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUV422P10:
+    case AV_PIX_FMT_YUV422P12:
+    case AV_PIX_FMT_YUV422P16:
+        *layout = video_frame::yuv422p;
+        break;
+    case AV_PIX_FMT_NV12:
+#ifdef AV_PIX_FMT_P010
+    case AV_PIX_FMT_P010:
+#endif
+#ifdef AV_PIX_FMT_P016
+    case AV_PIX_FMT_P016:
+#endif
+        *layout = video_frame::yuv420sp;
+        break;
+    default:
+        *layout = video_frame::yuv420p;
         break;
     }
-    av_log_set_callback(my_av_log);
+    return true;
 }
 
-media_object::~media_object()
+static video_frame::value_range_t native_value_range(int bits, bool full_range)
 {
-    if (_ffmpeg)
+    switch (bits)
     {
-        close();
+    case 8:
+        return (full_range ? video_frame::u8_full : video_frame::u8_mpeg);
+    case 10:
+        return (full_range ? video_frame::u10_full : video_frame::u10_mpeg);
+    case 12:
+        return (full_range ? video_frame::u12_full : video_frame::u12_mpeg);
+    default:
+        return (full_range ? video_frame::u16_full : video_frame::u16_mpeg);
     }
 }
 
-void media_object::set_video_frame_template(int index, int width_before_avcodec_open, int height_before_avcodec_open)
+// Return the largest lowres level (each level halves width and height) at which
+// every view of the given frame is still at least as large as the screen.
+// The output stereo mode is not final when a stream is opened, so this assumes
+// that a single view may cover the whole screen.
+// For thumbnails, the view only needs to be at least as wide as the thumbnail.
+static int lowres_level(const video_frame &frame, int max_lowres, int thumbnail_width)
 {
-    AVStream *video_stream = _ffmpeg->format_ctx->streams[_ffmpeg->video_streams[index]];
-    AVCodecContext *video_codec_ctx = _ffmpeg->video_codec_ctxs[index];
-    video_frame &video_frame_template = _ffmpeg->video_frame_templates[index];
-
-    // Dimensions and aspect ratio
-    video_frame_template.raw_width = video_codec_ctx->width;
-    video_frame_template.raw_height = video_codec_ctx->height;
-    // XXX Use width/height values from before avcodec_open() if they
-    // differ and seem safe to use. See also media_object::open().
-    if (width_before_avcodec_open >= 1
-            && height_before_avcodec_open >= 1
-            && width_before_avcodec_open <= video_codec_ctx->width
-            && height_before_avcodec_open <= video_codec_ctx->height
-            && (width_before_avcodec_open != video_codec_ctx->width
-                || height_before_avcodec_open != video_codec_ctx->height))
+    int min_width = thumbnail_width;
+    int min_height = 0;
+    if (thumbnail_width <= 0)
     {
-        msg::dbg("%s video stream %d: using frame size %dx%d instead of %dx%d.",
-                _url.c_str(), index + 1,
-                width_before_avcodec_open, height_before_avcodec_open,
-                video_codec_ctx->width, video_codec_ctx->height);
-        video_frame_template.raw_width = width_before_avcodec_open;
-        video_frame_template.raw_height = height_before_avcodec_open;
+        const video_output *vo = dispatch::video_output();
+        if (!vo || vo->screen_width() < 1 || vo->screen_height() < 1)
+        {
+            return 0;
+        }
+        min_width = vo->screen_width();
+        min_height = vo->screen_height();
     }
-    int ar_num = 1;
-    int ar_den = 1;
-    int ar_snum = video_stream->sample_aspect_ratio.num;
-    int ar_sden = video_stream->sample_aspect_ratio.den;
-    int ar_cnum = video_codec_ctx->sample_aspect_ratio.num;
-    int ar_cden = video_codec_ctx->sample_aspect_ratio.den;
-    if (ar_cnum > 0 && ar_cden > 0)
+    int lowres = 0;
+    while (lowres < max_lowres
+            && (frame.width >> (lowres + 1)) >= min_width
+            && (frame.height >> (lowres + 1)) >= min_height)
     {
-        ar_num = ar_cnum;
-        ar_den = ar_cden;
+        lowres++;
     }
-    else if (ar_snum > 0 && ar_sden > 0)
+    return lowres;
+}
+
+// Key frame index cache.
+// The key frame index of local files is cached on disk so that seeking is fast
+// and exact right away when the file is opened again. The cache file name is
+// a hash of the file name, size, and modification time, so that a changed file
+// does not reuse an old index.
+
+static const char *keyframes_file_magic = "bino-keyframe-index-1";
+
+static std::string keyframes_cache_file(const std::string &url)
+{
+    struct stat statbuf;
+    if (is_network_url(url) || stat(url.c_str(), &statbuf) != 0 || !S_ISREG(statbuf.st_mode))
+    {
+        return std::string();
+    }
+    std::string id = url + '\0' + str::from(statbuf.st_size) + '\0' + str::from(statbuf.st_mtime);
+    return dir::cache_file("keyframes", id);
+}
+
+static void load_keyframes(const std::string &filename, std::vector<std::vector<int64_t> > &keyframes)
+{
+    std::ifstream ifs(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!ifs.good())
+    {
+        return;
+    }
+    try
+    {
+        std::string magic;
+        std::vector<std::vector<int64_t> > k;
+        s11n::load(ifs, magic);
+        if (magic == keyframes_file_magic)
+        {
+            s11n::load(ifs, k);
+            if (ifs.good() && k.size() == keyframes.size())
+            {
+                keyframes.swap(k);
+            }
+        }
+    }
+    catch (...)
+    {
+        // Ignore broken cache files; the index will be rebuilt.
+    }
+}
+
+static void save_keyframes(const std::string &filename, const std::vector<std::vector<int64_t> > &keyframes)
+{
+    if (!dir::make_cache())
+    {
+        return;
+    }
+    std::ofstream ofs(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    s11n::save(ofs, std::string(keyframes_file_magic));
+    s11n::save(ofs, keyframes);
+    if (!ofs.good())
+    {
+        msg::dbg(filename + ": " + std::strerror(errno));
+    }
+}
+
+#if HAVE_AV_HWACCEL
+// Let the decoder choose the hardware pixel format that we negotiated in
+// init_hwaccel(). The codec context's opaque field stores that format.
+// If the decoder does not offer it (e.g. because the hardware cannot handle
+// the current profile), fall back to the first software format.
+static enum AVPixelFormat hwaccel_get_format(AVCodecContext *ctx, const enum AVPixelFormat *fmts)
+{
+    enum AVPixelFormat hw_pix_fmt = static_cast<enum AVPixelFormat>(reinterpret_cast<intptr_t>(ctx->opaque));
+    for (const enum AVPixelFormat *p = fmts; *p != AV_PIX_FMT_NONE; p++)
+    {
+        if (*p == hw_pix_fmt)
+        {
+            return *p;
+        }
+    }
+    for (const enum AVPixelFormat *p = fmts; *p != AV_PIX_FMT_NONE; p++)
+    {
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(*p);
+        if (desc && !(desc->flags & AV_PIX_FMT_FLAG_HWACCEL))
+        {
+            msg::wrn(_("Hardware decoding is not available for this video; falling back to software decoding."));
+            return *p;
+        }
+    }
+    return AV_PIX_FMT_NONE;
+}
+
+// Hardware devices are shared by all media objects, so that the views of all
+// video streams live on the same device. This is necessary to display them
+// without copying them through system memory (see video_frame::surface_type).
+// The devices are kept until the program exits.
+static mutex hw_device_ctxs_mutex;
+static std::vector<AVBufferRef *> hw_device_ctxs;
+
+// Return a new reference to the device of the given type, or NULL if there is
+// no such device.
+static AVBufferRef *get_hw_device_ctx(enum AVHWDeviceType type)
+{
+    AVBufferRef *device_ctx = NULL;
+    hw_device_ctxs_mutex.lock();
+    for (size_t i = 0; i < hw_device_ctxs.size() && !device_ctx; i++)
+    {
+        if (reinterpret_cast<AVHWDeviceContext *>(hw_device_ctxs[i]->data)->type == type)
+        {
+            device_ctx = av_buffer_ref(hw_device_ctxs[i]);
+        }
+    }
+    if (!device_ctx)
+    {
+        AVBufferRef *new_device_ctx = NULL;
+        int e = av_hwdevice_ctx_create(&new_device_ctx, type, NULL, NULL, 0);
+        if (e < 0)
+        {
+            msg::dbg("Cannot create %s hardware device: %s",
+                    av_hwdevice_get_type_name(type), my_av_strerror(e).c_str());
+        }
+        else
+        {
+            hw_device_ctxs.push_back(new_device_ctx);
+            device_ctx = av_buffer_ref(new_device_ctx);
+        }
+    }
+    hw_device_ctxs_mutex.unlock();
+    return device_ctx;
+}
+
+// Try to set up hardware accelerated decoding for the given codec context.
+// The name is either "auto" (use the first device type that works) or the
+// name of an FFmpeg hardware device type (vaapi, vdpau, cuda, videotoolbox, ...).
+// Return the device context on success, or NULL if software decoding must be used.
+static AVBufferRef *init_hwaccel(AVCodecContext *ctx, const AVCodec *codec, const std::string &name,
+        enum AVPixelFormat *hw_pix_fmt)
+{
+    enum AVHWDeviceType requested_type = AV_HWDEVICE_TYPE_NONE;
+    if (name != "auto")
+    {
+        requested_type = av_hwdevice_find_type_by_name(name.c_str());
+        if (requested_type == AV_HWDEVICE_TYPE_NONE)
+        {
+            msg::wrn(_("Unknown hardware decoding method %s."), name.c_str());
+            return NULL;
+        }
+    }
+    for (int i = 0; ; i++)
+    {
+        const AVCodecHWConfig *config = avcodec_get_hw_config(codec, i);
+        if (!config)
+        {
+            break;
+        }
+        if (!(config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX)
+                || (requested_type != AV_HWDEVICE_TYPE_NONE && config->device_type != requested_type))
+        {
+            continue;
+        }
+        AVBufferRef *device_ctx = get_hw_device_ctx(config->device_type);
+        if (!device_ctx)
+        {
+            continue;
+        }
+        ctx->hw_device_ctx = av_buffer_ref(device_ctx);
+        ctx->get_format = hwaccel_get_format;
+        ctx->opaque = reinterpret_cast<void *>(static_cast<intptr_t>(config->pix_fmt));
+        *hw_pix_fmt = config->pix_fmt;
+        return device_ctx;
+    }
+    if (requested_type != AV_HWDEVICE_TYPE_NONE)
+    {
+        msg::wrn(_("Hardware decoding method %s is not available for codec %s."), name.c_str(), codec->name);
+    }
+    return NULL;
+}
+#endif
+
+#if HAVE_AV_VDPAU_INTEROP
+// The VDPAU video mixer renders a decoded video surface into a BGRA output
+// surface. The video output maps such output surfaces directly to OpenGL
+// textures, so hardware decoded frames never leave the GPU. There is one
+// output surface per raw frame, because alternating stereo layouts need two.
+struct vdpau_output
+{
+    AVVDPAUDeviceContext *dev;
+    VdpVideoMixerDestroy *video_mixer_destroy;
+    VdpVideoMixerRender *video_mixer_render;
+    VdpOutputSurfaceDestroy *output_surface_destroy;
+    VdpVideoMixer mixer;
+    VdpOutputSurface surfaces[2];
+    uint32_t width, height;
+};
+
+static bool vdpau_get_proc(AVVDPAUDeviceContext *dev, VdpFuncId id, void *func)
+{
+    return (dev->get_proc_address(dev->device, id, static_cast<void **>(func)) == VDP_STATUS_OK);
+}
+
+static void vdpau_output_destroy(struct vdpau_output *out)
+{
+    if (out)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            if (out->surfaces[i] != VDP_INVALID_HANDLE)
+            {
+                out->output_surface_destroy(out->surfaces[i]);
+            }
+        }
+        if (out->mixer != VDP_INVALID_HANDLE)
+        {
+            out->video_mixer_destroy(out->mixer);
+        }
+        delete out;
+    }
+}
+
+// Create the mixer and output surfaces for video surfaces that look like the given
+// one. Return NULL if this fails; the caller must then use the normal path.
+static struct vdpau_output *vdpau_output_create(AVBufferRef *hw_device_ctx,
+        VdpVideoSurface video_surface, uint32_t width, uint32_t height,
+        video_frame::color_space_t color_space)
+{
+    AVVDPAUDeviceContext *dev = static_cast<AVVDPAUDeviceContext *>(
+            reinterpret_cast<AVHWDeviceContext *>(hw_device_ctx->data)->hwctx);
+    VdpVideoSurfaceGetParameters *video_surface_get_parameters;
+    VdpVideoMixerCreate *video_mixer_create;
+    VdpVideoMixerSetAttributeValues *video_mixer_set_attribute_values;
+    VdpGenerateCSCMatrix *generate_csc_matrix;
+    VdpOutputSurfaceCreate *output_surface_create;
+    struct vdpau_output *out = new struct vdpau_output;
+    out->dev = dev;
+    out->mixer = VDP_INVALID_HANDLE;
+    out->surfaces[0] = VDP_INVALID_HANDLE;
+    out->surfaces[1] = VDP_INVALID_HANDLE;
+    out->width = width;
+    out->height = height;
+    if (!vdpau_get_proc(dev, VDP_FUNC_ID_VIDEO_SURFACE_GET_PARAMETERS, &video_surface_get_parameters)
+            || !vdpau_get_proc(dev, VDP_FUNC_ID_VIDEO_MIXER_CREATE, &video_mixer_create)
+            || !vdpau_get_proc(dev, VDP_FUNC_ID_VIDEO_MIXER_DESTROY, &out->video_mixer_destroy)
+            || !vdpau_get_proc(dev, VDP_FUNC_ID_VIDEO_MIXER_SET_ATTRIBUTE_VALUES, &video_mixer_set_attribute_values)
+            || !vdpau_get_proc(dev, VDP_FUNC_ID_VIDEO_MIXER_RENDER, &out->video_mixer_render)
+            || !vdpau_get_proc(dev, VDP_FUNC_ID_GENERATE_CSC_MATRIX, &generate_csc_matrix)
+            || !vdpau_get_proc(dev, VDP_FUNC_ID_OUTPUT_SURFACE_CREATE, &output_surface_create)
+            || !vdpau_get_proc(dev, VDP_FUNC_ID_OUTPUT_SURFACE_DESTROY, &out->output_surface_destroy))
+    {
+        msg::dbg("Cannot get VDPAU functions.");
+        delete out;
+        return NULL;
+    }
+    VdpChromaType chroma_type;
+    uint32_t surface_width, surface_height;
+    if (video_surface_get_parameters(video_surface, &chroma_type, &surface_width, &surface_height) != VDP_STATUS_OK)
+    {
+        msg::dbg("Cannot get VDPAU video surface parameters.");
+        delete out;
+        return NULL;
+    }
+    VdpVideoMixerParameter mixer_params[] = {
+        VDP_VIDEO_MIXER_PARAMETER_VIDEO_SURFACE_WIDTH,
+        VDP_VIDEO_MIXER_PARAMETER_VIDEO_SURFACE_HEIGHT,
+        VDP_VIDEO_MIXER_PARAMETER_CHROMA_TYPE
+    };
+    const void *mixer_param_values[] = { &surface_width, &surface_height, &chroma_type };
+    VdpProcamp procamp = { VDP_PROCAMP_VERSION, 0.0f, 1.0f, 1.0f, 0.0f };
+    VdpCSCMatrix csc_matrix;
+    VdpVideoMixerAttribute mixer_attribs[] = { VDP_VIDEO_MIXER_ATTRIBUTE_CSC_MATRIX };
+    const void *mixer_attrib_values[] = { &csc_matrix };
+    if (video_mixer_create(dev->device, 0, NULL, 3, mixer_params, mixer_param_values, &out->mixer) != VDP_STATUS_OK
+            || generate_csc_matrix(&procamp, color_space == video_frame::yuv709
+                ? VDP_COLOR_STANDARD_ITUR_BT_709 : VDP_COLOR_STANDARD_ITUR_BT_601, &csc_matrix) != VDP_STATUS_OK
+            || video_mixer_set_attribute_values(out->mixer, 1, mixer_attribs, mixer_attrib_values) != VDP_STATUS_OK
+            || output_surface_create(dev->device, VDP_RGBA_FORMAT_B8G8R8A8, width, height, &out->surfaces[0]) != VDP_STATUS_OK
+            || output_surface_create(dev->device, VDP_RGBA_FORMAT_B8G8R8A8, width, height, &out->surfaces[1]) != VDP_STATUS_OK)
+    {
+        msg::dbg("Cannot create VDPAU video mixer or output surfaces.");
+        vdpau_output_destroy(out);
+        return NULL;
+    }
+    return out;
+}
+
+static bool vdpau_output_render(struct vdpau_output *out, VdpVideoSurface video_surface, int index)
+{
+    VdpRect rect = { 0, 0, out->width, out->height };
+    return (out->video_mixer_render(out->mixer, VDP_INVALID_HANDLE, NULL,
+                VDP_VIDEO_MIXER_PICTURE_STRUCTURE_FRAME, 0, NULL, video_surface, 0, NULL,
+                &rect, out->surfaces[index], NULL, NULL, 0, NULL) == VDP_STATUS_OK);
+}
+#endif
+
+
+media_object::media_object(bool always_convert_to_bgra32, int thumbnail_width) :
+    _always_convert_to_bgra32(always_convert_to_bgra32), _thumbnail_width(thumbnail_width), _ffmpeg(NULL)
+{
+    avdevice_register_all();
+    av_register_all();
+    avformat_network_init();
+    switch (msg::level())
+    {
+    case msg::DBG:
+        av_log_set_level(AV_LOG_DEBUG);
+        break;
+    case msg::INF:
+        av_log_set_level(AV_LOG_INFO);
+        break;
+    case msg::WRN:
+        av_log_set_level(AV_LOG_WARNING);
+        break;
+    case msg::ERR:
+        av_log_set_level(AV_LOG_ERROR);
+        break;
+    case msg::REQ:
+    default:
+        av_log_set_level(AV_LOG_FATAL);
+        break;
+    }
+    av_log_set_callback(my_av_log);
+}
+
+media_object::~media_object()
+{
+    if (_ffmpeg)
+    {
+        close();
+    }
+}
+
+void media_object::set_video_frame_template(int index, int width_before_avcodec_open, int height_before_avcodec_open)
+{
+    AVStream *video_stream = _ffmpeg->format_ctx->streams[_ffmpeg->video_streams[index]];
+    AVCodecContext *video_codec_ctx = _ffmpeg->video_codec_ctxs[index];
+    video_frame &video_frame_template = _ffmpeg->video_frame_templates[index];
+
+    // Dimensions and aspect ratio
+    video_frame_template.raw_width = video_codec_ctx->width;
+    video_frame_template.raw_height = video_codec_ctx->height;
+    // XXX Use width/height values from before avcodec_open() if they
+    // differ and seem safe to use. See also media_object::open().
+    if (width_before_avcodec_open >= 1
+            && height_before_avcodec_open >= 1
+            && width_before_avcodec_open <= video_codec_ctx->width
+            && height_before_avcodec_open <= video_codec_ctx->height
+            && (width_before_avcodec_open != video_codec_ctx->width
+                || height_before_avcodec_open != video_codec_ctx->height))
+    {
+        msg::dbg("%s video stream %d: using frame size %dx%d instead of %dx%d.",
+                _url.c_str(), index + 1,
+                width_before_avcodec_open, height_before_avcodec_open,
+                video_codec_ctx->width, video_codec_ctx->height);
+        video_frame_template.raw_width = width_before_avcodec_open;
+        video_frame_template.raw_height = height_before_avcodec_open;
+    }
+    int ar_num = 1;
+    int ar_den = 1;
+    int ar_snum = video_stream->sample_aspect_ratio.num;
+    int ar_sden = video_stream->sample_aspect_ratio.den;
+    int ar_cnum = video_codec_ctx->sample_aspect_ratio.num;
+    int ar_cden = video_codec_ctx->sample_aspect_ratio.den;
+    if (ar_cnum > 0 && ar_cden > 0)
+    {
+        ar_num = ar_cnum;
+        ar_den = ar_cden;
+    }
+    else if (ar_snum > 0 && ar_sden > 0)
     {
         ar_num = ar_snum;
         ar_den = ar_sden;
@@ -426,51 +1387,19 @@ void media_object::set_video_frame_template(int index, int width_before_avcodec_
     video_frame_template.color_space = video_frame::srgb;
     video_frame_template.value_range = video_frame::u8_full;
     video_frame_template.chroma_location = video_frame::center;
+    video_frame::layout_t native_layout;
+    int native_bits;
     if (!_always_convert_to_bgra32
-            && (video_codec_ctx->pix_fmt == AV_PIX_FMT_YUV444P
-                || video_codec_ctx->pix_fmt == AV_PIX_FMT_YUV444P10
-                || video_codec_ctx->pix_fmt == AV_PIX_FMT_YUV422P
-                || video_codec_ctx->pix_fmt == AV_PIX_FMT_YUV422P10
-                || video_codec_ctx->pix_fmt == AV_PIX_FMT_YUV420P
-                || video_codec_ctx->pix_fmt == AV_PIX_FMT_YUV420P10))
+            && native_pix_fmt(video_codec_ctx->pix_fmt, &native_layout, &native_bits))
     {
-        if (video_codec_ctx->pix_fmt == AV_PIX_FMT_YUV444P
-                || video_codec_ctx->pix_fmt == AV_PIX_FMT_YUV444P10)
-        {
-            video_frame_template.layout = video_frame::yuv444p;
-        }
-        else if (video_codec_ctx->pix_fmt == AV_PIX_FMT_YUV422P
-                || video_codec_ctx->pix_fmt == AV_PIX_FMT_YUV422P10)
-        {
-            video_frame_template.layout = video_frame::yuv422p;
-        }
-        else
-        {
-            video_frame_template.layout = video_frame::yuv420p;
-        }
+        video_frame_template.layout = native_layout;
         video_frame_template.color_space = video_frame::yuv601;
         if (video_codec_ctx->colorspace == AVCOL_SPC_BT709)
         {
             video_frame_template.color_space = video_frame::yuv709;
         }
-        if (video_codec_ctx->pix_fmt == AV_PIX_FMT_YUV444P10
-                || video_codec_ctx->pix_fmt == AV_PIX_FMT_YUV422P10
-                || video_codec_ctx->pix_fmt == AV_PIX_FMT_YUV420P10)
-        {
-            video_frame_template.value_range = video_frame::u10_mpeg;
-            if (video_codec_ctx->color_range == AVCOL_RANGE_JPEG)
-            {
-                video_frame_template.value_range = video_frame::u10_full;
-            }
-        }
-        else
-        {
-            video_frame_template.value_range = video_frame::u8_mpeg;
-            if (video_codec_ctx->color_range == AVCOL_RANGE_JPEG)
-            {
-                video_frame_template.value_range = video_frame::u8_full;
-            }
-        }
+        video_frame_template.value_range = native_value_range(native_bits,
+                video_codec_ctx->color_range == AVCOL_RANGE_JPEG);
         video_frame_template.chroma_location = video_frame::center;
         if (video_codec_ctx->chroma_sample_location == AVCHROMA_LOC_LEFT)
         {
@@ -502,6 +1431,17 @@ void media_object::set_video_frame_template(int index, int width_before_avcodec_
         video_frame_template.value_range = video_frame::u8_full;
         video_frame_template.chroma_location = video_frame::center;
     }
+    // Field order, in display order. Decoders also mark the individual frames;
+    // see video_decode_thread::run().
+    video_frame_template.field_order = video_frame::progressive;
+    if (video_codec_ctx->field_order == AV_FIELD_TT || video_codec_ctx->field_order == AV_FIELD_BT)
+    {
+        video_frame_template.field_order = video_frame::top_first;
+    }
+    else if (video_codec_ctx->field_order == AV_FIELD_BB || video_codec_ctx->field_order == AV_FIELD_TB)
+    {
+        video_frame_template.field_order = video_frame::bottom_first;
+    }
     // Stereo layout
     video_frame_template.stereo_layout = parameters::layout_mono;
     video_frame_template.stereo_layout_swap = false;
@@ -774,7 +1714,40 @@ void media_object::set_subtitle_box_template(int index)
     }
 }
 
-void media_object::open(const std::string &url, const device_request &dev_request)
+void media_object::set_probe_limits(const parameters &params)
+{
+    AVFormatContext *format_ctx = _ffmpeg->format_ctx;
+    int probe_size = params.probe_size();
+    float analyze_duration = params.analyze_duration();
+    if (analyze_duration < 0.0f)
+    {
+        std::string format_name = (format_ctx->iformat ? format_ctx->iformat->name : "");
+        if (_is_device)
+        {
+            // For a camera device, do not read ahead multiple packets, to avoid a startup delay.
+            analyze_duration = 0.0f;
+        }
+        else if (!is_network_url(_url)
+                && (format_name == "matroska,webm" || format_name == "mov,mp4,m4a,3gp,3g2,mj2"))
+        {
+            // These containers describe all streams in their headers, so only the first
+            // frames need to be decoded to find the remaining codec parameters.
+            analyze_duration = 0.5f;
+        }
+    }
+    if (analyze_duration >= 0.0f)
+    {
+        format_ctx->max_analyze_duration = static_cast<int64_t>(analyze_duration * AV_TIME_BASE);
+        msg::dbg("%s: analyzing at most %g seconds of input.", _url.c_str(), analyze_duration);
+    }
+    if (probe_size > 0)
+    {
+        format_ctx->probesize = static_cast<int64_t>(probe_size) << 10;
+    }
+}
+
+void media_object::open(const std::string &url, const device_request &dev_request,
+        const parameters &params, const cpu_share &cpus)
 {
     assert(!_ffmpeg);
 
@@ -782,9 +1755,17 @@ void media_object::open(const std::string &url, const device_request &dev_reques
     _is_device = dev_request.is_device();
     _ffmpeg = new struct ffmpeg_stuff;
     _ffmpeg->format_ctx = NULL;
+    _ffmpeg->cache = NULL;
+    _ffmpeg->video_keyframes_loaded = 0;
+    _ffmpeg->video_keyframes_only = false;
     _ffmpeg->have_active_audio_stream = false;
     _ffmpeg->pos = 0;
-    _ffmpeg->reader = new read_thread(_url, _is_device, _ffmpeg);
+    _ffmpeg->video_conversion_frames = 0;
+    _ffmpeg->video_conversion_time = 0;
+    _ffmpeg->video_memory = 0;
+    _ffmpeg->audio_memory = 0;
+    _ffmpeg->subtitle_memory = 0;
+    _ffmpeg->reader = new read_thread(_url, _is_device, _ffmpeg, params);
     int e;
 
     /* Set format and parameters for device input */
@@ -847,8 +1828,38 @@ void media_object::open(const std::string &url, const device_request &dev_reques
         av_dict_set(&iparams, "input_format", "mjpeg", 0);
     }
 
+    /* Set up the read cache */
+    int cache_size = params.read_cache();
+    if (cache_size < 0)
+    {
+        cache_size = (!_is_device && is_network_url(_url) ? 32 : 0);
+    }
+    if (!_is_device && cache_size > 0)
+    {
+        msg::dbg(_url + ": using a read cache of " + str::from(cache_size) + " MiB.");
+        _ffmpeg->cache = new read_cache(_url, static_cast<size_t>(cache_size) << 20);
+        _ffmpeg->cache->open();
+    }
+
     /* Open the input */
     _ffmpeg->format_ctx = NULL;
+    if (_ffmpeg->cache)
+    {
+        _ffmpeg->format_ctx = avformat_alloc_context();
+        if (!_ffmpeg->format_ctx)
+        {
+            av_dict_free(&iparams);
+            throw exc(HERE + ": " + std::strerror(ENOMEM));
+        }
+        _ffmpeg->format_ctx->pb = _ffmpeg->cache->context();
+        _ffmpeg->format_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+    int probe_size = params.probe_size();
+    if (probe_size > 0)
+    {
+        // This also limits the data used for detecting the format.
+        av_dict_set(&iparams, "probesize", str::from(static_cast<int64_t>(probe_size) << 10).c_str(), 0);
+    }
     if ((e = avformat_open_input(&_ffmpeg->format_ctx, _url.c_str(), iformat, &iparams)) != 0)
     {
         av_dict_free(&iparams);
@@ -856,11 +1867,7 @@ void media_object::open(const std::string &url, const device_request &dev_reques
                     _url.c_str(), my_av_strerror(e).c_str()));
     }
     av_dict_free(&iparams);
-    if (_is_device)
-    {
-        // For a camera device, do not read ahead multiple packets, to avoid a startup delay.
-        _ffmpeg->format_ctx->max_analyze_duration = 0;
-    }
+    set_probe_limits(params);
     if ((e = avformat_find_stream_info(_ffmpeg->format_ctx, NULL)) < 0)
     {
         throw exc(str::asprintf(_("%s: Cannot read stream info: %s"),
@@ -879,6 +1886,31 @@ void media_object::open(const std::string &url, const device_request &dev_reques
     _ffmpeg->have_active_audio_stream = false;
     _ffmpeg->pos = std::numeric_limits<int64_t>::min();
 
+    // Divide our share of the processors among the video streams that may be decoded
+    // in parallel: two for the separate streams stereo layout, otherwise one.
+    // Attached pictures such as cover art are never decoded in parallel.
+    int parallel_video_streams = 0;
+    for (unsigned int i = 0; i < _ffmpeg->format_ctx->nb_streams; i++)
+    {
+        if (_ffmpeg->format_ctx->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO
+#ifdef AV_DISPOSITION_ATTACHED_PIC
+                && !(_ffmpeg->format_ctx->streams[i]->disposition & AV_DISPOSITION_ATTACHED_PIC)
+#endif
+           )
+        {
+            parallel_video_streams++;
+        }
+    }
+    parallel_video_streams = std::min(std::max(parallel_video_streams, 1), 2);
+    cpu_share share = (cpus.threads > 0 ? cpus : cpu_shares(1)[0]);
+    std::vector<cpu_share> video_stream_shares;
+    for (int i = 0; i < parallel_video_streams; i++)
+    {
+        video_stream_shares.push_back(share.cpus.empty()
+                ? cpu_shares(parallel_video_streams)[i]
+                : split_cpu_share(share, parallel_video_streams, i));
+    }
+
     for (unsigned int i = 0; i < _ffmpeg->format_ctx->nb_streams
             && i < static_cast<unsigned int>(std::numeric_limits<int>::max()); i++)
     {
@@ -893,11 +1925,46 @@ void media_object::open(const std::string &url, const device_request &dev_reques
         // them later in set_video_frame_template().
         int width_before_avcodec_open = codec_ctx->width;
         int height_before_avcodec_open = codec_ctx->height;
+#if HAVE_AV_HWACCEL
+        AVBufferRef *hw_device_ctx = NULL;
+        enum AVPixelFormat hw_pix_fmt = AV_PIX_FMT_NONE;
+#endif
+        const cpu_share &video_stream_share = video_stream_shares[
+            _ffmpeg->video_streams.size() % video_stream_shares.size()];
         if (codec_ctx->codec_type == AVMEDIA_TYPE_VIDEO)
         {
             // Activate multithreaded decoding. This must be done before opening the codec; see
             // http://lists.gnu.org/archive/html/bino-list/2011-08/msg00019.html
-            codec_ctx->thread_count = video_decoding_threads();
+            codec_ctx->thread_count = video_stream_share.threads;
+            // FFmpeg creates its decoding threads when the codec is opened, and these
+            // inherit the processors of this thread. This pins them to our share.
+            set_thread_cpus(video_stream_share.cpus);
+#if HAVE_AV_HWACCEL
+            // Activate hardware accelerated decoding if requested. This must also be done
+            // before opening the codec. If it fails, we silently use software decoding.
+            // MJPEG from camera devices is always decoded on the GPU if possible, since
+            // two cameras at full HD would otherwise keep the processors of small
+            // machines busy with nothing else.
+            std::string hwaccel = params.hwaccel();
+            if (hwaccel.empty() && _is_device && codec_ctx->codec_id == AV_CODEC_ID_MJPEG)
+            {
+                hwaccel = "auto";
+            }
+            // Thumbnails leave the hardware decoders to playback.
+            if (codec && !hwaccel.empty() && _thumbnail_width <= 0)
+            {
+                hw_device_ctx = init_hwaccel(codec_ctx, codec, hwaccel, &hw_pix_fmt);
+            }
+#endif
+            // Blu-ray 3D uses H.264 MVC, whose dependent view FFmpeg cannot decode.
+            // Say so instead of silently showing the base view as 2D video.
+            if (codec_ctx->codec_id == AV_CODEC_ID_H264
+                    && (codec_ctx->profile == FF_PROFILE_H264_MULTIVIEW_HIGH
+                        || codec_ctx->profile == FF_PROFILE_H264_STEREO_HIGH))
+            {
+                msg::wrn(_("%s stream %d: Cannot decode the second view of MVC stereo video."),
+                        _url.c_str(), i + 1);
+            }
 #if 0 /* This seems to be obsolete now. */
             // Set CODEC_FLAG_EMU_EDGE in the same situations in which ffplay sets it.
             // I don't know what exactly this does, but it is necessary to fix the problem
@@ -911,7 +1978,17 @@ void media_object::open(const std::string &url, const device_request &dev_reques
 #endif
         }
         // Find and open the codec. AV_CODEC_ID_TEXT is a special case: it has no decoder since it is unencoded raw data.
-        if (codec_ctx->codec_id != AV_CODEC_ID_TEXT && (!codec || (e = avcodec_open2(codec_ctx, codec, NULL)) < 0))
+        // Audio and subtitle codecs are only opened when their stream is activated: files often
+        // carry many of these streams, and most of them are never used.
+        bool open_later = (codec_ctx->codec_type == AVMEDIA_TYPE_AUDIO
+                || codec_ctx->codec_type == AVMEDIA_TYPE_SUBTITLE);
+        bool codec_failed = (codec_ctx->codec_id != AV_CODEC_ID_TEXT
+                && (!codec || (!open_later && (e = avcodec_open2(codec_ctx, codec, NULL)) < 0)));
+        if (codec_ctx->codec_type == AVMEDIA_TYPE_VIDEO)
+        {
+            set_thread_cpus(std::vector<int>());
+        }
+        if (codec_failed)
         {
             msg::wrn(_("%s stream %d: Cannot open %s: %s"), _url.c_str(), i,
                     codec_ctx->codec_type == AVMEDIA_TYPE_VIDEO ? _("video codec")
@@ -919,6 +1996,9 @@ void media_object::open(const std::string &url, const device_request &dev_reques
                     : codec_ctx->codec_type == AVMEDIA_TYPE_SUBTITLE ? _("subtitle codec")
                     : _("data"),
                     codec ? my_av_strerror(e).c_str() : _("codec not supported"));
+#if HAVE_AV_HWACCEL
+            av_buffer_unref(&hw_device_ctx);
+#endif
         }
         else if (codec_ctx->codec_type == AVMEDIA_TYPE_VIDEO)
         {
@@ -932,9 +2012,54 @@ void media_object::open(const std::string &url, const device_request &dev_reques
                             _url.c_str(), j + 1));
             }
             _ffmpeg->video_codecs.push_back(codec);
+            _ffmpeg->video_cpus.push_back(video_stream_share.cpus);
             // Determine frame template.
             _ffmpeg->video_frame_templates.push_back(video_frame());
             set_video_frame_template(j, width_before_avcodec_open, height_before_avcodec_open);
+            // If requested, let the decoder skip the resolution that the screen cannot show anyway.
+            int lowres = (codec->max_lowres > 0
+                    && (_thumbnail_width > 0 || params.lowres_decoding())
+#if HAVE_AV_HWACCEL
+                    && !hw_device_ctx
+#endif
+                    ? lowres_level(_ffmpeg->video_frame_templates[j], codec->max_lowres, _thumbnail_width) : 0);
+            if (lowres > 0)
+            {
+                avcodec_close(codec_ctx);
+                codec_ctx->lowres = lowres;
+                set_thread_cpus(video_stream_share.cpus);
+                e = avcodec_open2(codec_ctx, codec, NULL);
+                if (e < 0)
+                {
+                    msg::wrn(_("%s video stream %d: Cannot decode at reduced resolution: %s"),
+                            _url.c_str(), j + 1, my_av_strerror(e).c_str());
+                    lowres = 0;
+                    codec_ctx->lowres = 0;
+                    e = avcodec_open2(codec_ctx, codec, NULL);
+                }
+                set_thread_cpus(std::vector<int>());
+                if (e < 0)
+                {
+                    throw exc(str::asprintf(_("%s video stream %d: Cannot open %s: %s"),
+                                _url.c_str(), j + 1, _("video codec"), my_av_strerror(e).c_str()));
+                }
+                if (lowres > 0)
+                {
+                    msg::inf(_("%s video stream %d: Decoding at 1/%d resolution."),
+                            _url.c_str(), j + 1, 1 << lowres);
+                    set_video_frame_template(j,
+                            (width_before_avcodec_open + (1 << lowres) - 1) >> lowres,
+                            (height_before_avcodec_open + (1 << lowres) - 1) >> lowres);
+                }
+            }
+            // A software pixel format conversion, if necessary, is split into slices of at
+            // least 64 lines that are converted in parallel on the processors of this stream.
+            _ffmpeg->video_sws_slices.push_back(std::vector<video_sws_slice *>());
+            for (int k = 0; k < std::max(1, std::min(video_stream_share.threads, codec_ctx->height / 64)); k++)
+            {
+                _ffmpeg->video_sws_slices[j].push_back(new video_sws_slice);
+                _ffmpeg->video_sws_slices[j].back()->cpus = video_stream_share.cpus;
+            }
             // Allocate things required for decoding
             _ffmpeg->video_packets.push_back(AVPacket());
             av_init_packet(&(_ffmpeg->video_packets[j]));
@@ -946,40 +2071,33 @@ void media_object::open(const std::string &url, const device_request &dev_reques
             _ffmpeg->video_frames.push_back(av_frame_alloc());
             _ffmpeg->video_buffered_frames.push_back(av_frame_alloc());
 #endif
-            enum AVPixelFormat frame_fmt = (_ffmpeg->video_frame_templates[j].layout == video_frame::bgra32
-                    ? AV_PIX_FMT_BGRA : _ffmpeg->video_codec_ctxs[j]->pix_fmt);
-            int frame_bufsize = (avpicture_get_size(frame_fmt,
-                        _ffmpeg->video_codec_ctxs[j]->width, _ffmpeg->video_codec_ctxs[j]->height));
-            _ffmpeg->video_buffers.push_back(static_cast<uint8_t *>(av_malloc(frame_bufsize)));
-            avpicture_fill(reinterpret_cast<AVPicture *>(_ffmpeg->video_buffered_frames[j]), _ffmpeg->video_buffers[j],
-                    frame_fmt, _ffmpeg->video_codec_ctxs[j]->width, _ffmpeg->video_codec_ctxs[j]->height);
-            if (!_ffmpeg->video_frames[j] || !_ffmpeg->video_buffered_frames[j] || !_ffmpeg->video_buffers[j])
+            if (!_ffmpeg->video_frames[j] || !_ffmpeg->video_buffered_frames[j])
             {
                 throw exc(HERE + ": " + strerror(ENOMEM));
             }
+            // The frame buffers are allocated when the stream is activated; see open_video_buffers().
+            _ffmpeg->video_buffers.push_back(NULL);
+            _ffmpeg->video_buffer_sizes.push_back(0);
+            enum AVPixelFormat frame_fmt = (_ffmpeg->video_frame_templates[j].layout == video_frame::bgra32
+                    ? AV_PIX_FMT_BGRA : _ffmpeg->video_codec_ctxs[j]->pix_fmt);
+            int frame_bufsize = (avpicture_get_size(frame_fmt,
+                        _ffmpeg->video_codec_ctxs[j]->width, _ffmpeg->video_codec_ctxs[j]->height));
             if (_ffmpeg->video_frame_templates[j].layout == video_frame::bgra32)
             {
                 // Initialize things needed for software pixel format conversion
-                int sws_bufsize = avpicture_get_size(AV_PIX_FMT_BGRA,
-                        _ffmpeg->video_codec_ctxs[j]->width, _ffmpeg->video_codec_ctxs[j]->height);
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(55, 28, 1)
                 _ffmpeg->video_sws_frames.push_back(avcodec_alloc_frame());
 #else
                 _ffmpeg->video_sws_frames.push_back(av_frame_alloc());
 #endif
-                _ffmpeg->video_sws_buffers.push_back(static_cast<uint8_t *>(av_malloc(sws_bufsize)));
-                if (!_ffmpeg->video_sws_frames[j] || !_ffmpeg->video_sws_buffers[j])
+                _ffmpeg->video_sws_buffers.push_back(NULL);
+                if (!_ffmpeg->video_sws_frames[j])
                 {
                     throw exc(HERE + ": " + strerror(ENOMEM));
                 }
-                avpicture_fill(reinterpret_cast<AVPicture *>(_ffmpeg->video_sws_frames[j]), _ffmpeg->video_sws_buffers[j],
-                        AV_PIX_FMT_BGRA, _ffmpeg->video_codec_ctxs[j]->width, _ffmpeg->video_codec_ctxs[j]->height);
-                // Call sws_getCachedContext(NULL, ...) instead of sws_getContext(...) just to avoid a deprecation warning.
-                _ffmpeg->video_sws_ctxs.push_back(sws_getCachedContext(NULL,
-                            _ffmpeg->video_codec_ctxs[j]->width, _ffmpeg->video_codec_ctxs[j]->height, _ffmpeg->video_codec_ctxs[j]->pix_fmt,
-                            _ffmpeg->video_codec_ctxs[j]->width, _ffmpeg->video_codec_ctxs[j]->height, AV_PIX_FMT_BGRA,
-                            SWS_POINT, NULL, NULL, NULL));
-                if (!_ffmpeg->video_sws_ctxs[j])
+                // The scaler contexts of the slices are created on first use.
+                if (!sws_isSupportedInput(_ffmpeg->video_codec_ctxs[j]->pix_fmt)
+                        || !sws_isSupportedOutput(AV_PIX_FMT_BGRA))
                 {
                     throw exc(str::asprintf(_("%s video stream %d: Cannot initialize conversion context."),
                                 _url.c_str(), j + 1));
@@ -989,9 +2107,52 @@ void media_object::open(const std::string &url, const device_request &dev_reques
             {
                 _ffmpeg->video_sws_frames.push_back(NULL);
                 _ffmpeg->video_sws_buffers.push_back(NULL);
-                _ffmpeg->video_sws_ctxs.push_back(NULL);
             }
             _ffmpeg->video_last_timestamps.push_back(std::numeric_limits<int64_t>::min());
+            // Remember the software pixel format; with hardware decoding, the codec
+            // context will later report the hardware pixel format instead.
+            _ffmpeg->video_pix_fmts.push_back(_ffmpeg->video_codec_ctxs[j]->pix_fmt);
+#if HAVE_AV_HWACCEL
+            _ffmpeg->video_hw_device_ctxs.push_back(hw_device_ctx);
+            _ffmpeg->video_hw_pix_fmts.push_back(hw_pix_fmt);
+            _ffmpeg->video_hw_frames.push_back(NULL);
+            _ffmpeg->video_hw_sws_frames.push_back(NULL);
+            _ffmpeg->video_hw_sws_buffers.push_back(NULL);
+            if (hw_device_ctx)
+            {
+                // Frames downloaded from the hardware surface usually have a different
+                // pixel format (e.g. NV12) than what we use for the frame template, so
+                // we may need to convert them.
+                _ffmpeg->video_hw_frames[j] = av_frame_alloc();
+                if (!_ffmpeg->video_hw_frames[j])
+                {
+                    throw exc(HERE + ": " + strerror(ENOMEM));
+                }
+                if (_ffmpeg->video_frame_templates[j].layout != video_frame::bgra32)
+                {
+                    _ffmpeg->video_hw_sws_frames[j] = av_frame_alloc();
+                    _ffmpeg->video_hw_sws_buffers[j] = static_cast<uint8_t *>(av_malloc(frame_bufsize));
+                    if (!_ffmpeg->video_hw_sws_frames[j] || !_ffmpeg->video_hw_sws_buffers[j])
+                    {
+                        throw exc(HERE + ": " + strerror(ENOMEM));
+                    }
+                    avpicture_fill(reinterpret_cast<AVPicture *>(_ffmpeg->video_hw_sws_frames[j]), _ffmpeg->video_hw_sws_buffers[j],
+                            frame_fmt, _ffmpeg->video_codec_ctxs[j]->width, _ffmpeg->video_codec_ctxs[j]->height);
+                }
+                _ffmpeg->video_hwaccel_names.push_back(av_hwdevice_get_type_name(
+                            reinterpret_cast<AVHWDeviceContext *>(hw_device_ctx->data)->type));
+            }
+            else
+            {
+                _ffmpeg->video_hwaccel_names.push_back(std::string());
+            }
+#else
+            _ffmpeg->video_hwaccel_names.push_back(std::string());
+#endif
+#if HAVE_AV_VDPAU_INTEROP
+            _ffmpeg->video_vdpau_outputs.push_back(NULL);
+            _ffmpeg->video_vdpau_output_failed.push_back(false);
+#endif
         }
         else if (codec_ctx->codec_type == AVMEDIA_TYPE_AUDIO)
         {
@@ -1000,18 +2161,14 @@ void media_object::open(const std::string &url, const device_request &dev_reques
             msg::dbg(_url + " stream " + str::from(i) + " is audio stream " + str::from(j) + ".");
             _ffmpeg->audio_codec_ctxs.push_back(codec_ctx);
             _ffmpeg->audio_codecs.push_back(codec);
+            _ffmpeg->audio_codecs_open.push_back(false);
             _ffmpeg->audio_blob_templates.push_back(audio_blob());
             set_audio_blob_template(j);
             _ffmpeg->audio_decode_threads.push_back(audio_decode_thread(_url, _ffmpeg, j));
-            // Manage audio_tmpbufs with av_malloc/av_free, to guarantee correct alignment.
-            // Not doing this results in hard to debug crashes on some systems.
-            _ffmpeg->audio_tmpbufs.push_back(static_cast<unsigned char*>(av_malloc(audio_tmpbuf_size)));
-            if (!_ffmpeg->audio_tmpbufs[j])
-            {
-                throw exc(HERE + ": " + strerror(ENOMEM));
-            }
+            // The temporary buffer is allocated when the stream is activated; see open_audio_codec().
+            _ffmpeg->audio_tmpbufs.push_back(NULL);
             _ffmpeg->audio_blobs.push_back(blob());
-            _ffmpeg->audio_buffers.push_back(std::vector<unsigned char>());
+            _ffmpeg->audio_buffers.push_back(audio_ring());
             _ffmpeg->audio_last_timestamps.push_back(std::numeric_limits<int64_t>::min());
         }
         else if (codec_ctx->codec_type == AVMEDIA_TYPE_SUBTITLE)
@@ -1023,6 +2180,7 @@ void media_object::open(const std::string &url, const device_request &dev_reques
             // AV_CODEC_ID_TEXT does not have any decoder; it is just UTF-8 text in the packet data.
             _ffmpeg->subtitle_codecs.push_back(
                     _ffmpeg->subtitle_codec_ctxs[j]->codec_id == AV_CODEC_ID_TEXT ? NULL : codec);
+            _ffmpeg->subtitle_codecs_open.push_back(false);
             _ffmpeg->subtitle_box_templates.push_back(subtitle_box());
             set_subtitle_box_template(j);
             _ffmpeg->subtitle_decode_threads.push_back(subtitle_decode_thread(_url, _ffmpeg, j));
@@ -1035,11 +2193,43 @@ void media_object::open(const std::string &url, const device_request &dev_reques
         }
     }
     _ffmpeg->video_packet_queues.resize(video_streams());
+    _ffmpeg->video_keyframes.resize(video_streams());
+    if (!_is_device)
+    {
+        _ffmpeg->video_keyframes_file = keyframes_cache_file(_url);
+    }
+    if (!_ffmpeg->video_keyframes_file.empty())
+    {
+        load_keyframes(_ffmpeg->video_keyframes_file, _ffmpeg->video_keyframes);
+        for (size_t i = 0; i < _ffmpeg->video_keyframes.size(); i++)
+        {
+            _ffmpeg->video_keyframes_loaded += _ffmpeg->video_keyframes[i].size();
+        }
+        msg::dbg(_url + ": " + str::from(_ffmpeg->video_keyframes_loaded)
+                + " key frames loaded from " + _ffmpeg->video_keyframes_file);
+    }
+    _ffmpeg->video_seek_targets.resize(video_streams(), std::numeric_limits<int64_t>::min());
+    // Devices are not decoded ahead, to avoid latency.
+    int decode_ahead = params.decode_ahead();
+    if (decode_ahead < 0)
+    {
+        decode_ahead = (_is_device ? 0 : 3);
+    }
+    if (_thumbnail_width > 0)
+    {
+        decode_ahead = 0;
+    }
+    for (int i = 0; i < video_streams(); i++)
+    {
+        _ffmpeg->video_lookahead_threads.push_back(new video_lookahead_thread(_url, _ffmpeg, i, decode_ahead));
+    }
+    _ffmpeg->video_lookahead_reads.resize(video_streams(), false);
+    _ffmpeg->video_skip_levels.resize(video_streams(), 0);
+    _ffmpeg->audio_seek_targets.resize(audio_streams(), std::numeric_limits<int64_t>::min());
     _ffmpeg->audio_packet_queues.resize(audio_streams());
+    _ffmpeg->audio_standby.resize(audio_streams(), false);
     _ffmpeg->subtitle_packet_queues.resize(subtitle_streams());
-    _ffmpeg->video_packet_queue_mutexes.resize(video_streams());
-    _ffmpeg->audio_packet_queue_mutexes.resize(audio_streams());
-    _ffmpeg->subtitle_packet_queue_mutexes.resize(subtitle_streams());
+    _ffmpeg->subtitle_standby.resize(subtitle_streams(), false);
 
     msg::inf(_url + ":");
     for (int i = 0; i < video_streams(); i++)
@@ -1050,6 +2240,20 @@ void media_object::open(const std::string &url, const device_request &dev_reques
                 video_duration(i) / 1e6f);
         msg::inf(8, _("Using up to %d threads for decoding."),
                 _ffmpeg->video_codec_ctxs.at(i)->thread_count);
+        if (!_ffmpeg->video_cpus.at(i).empty())
+        {
+            std::string cpu_list;
+            for (size_t j = 0; j < _ffmpeg->video_cpus[i].size(); j++)
+            {
+                cpu_list += (j > 0 ? "," : "") + str::from(_ffmpeg->video_cpus[i][j]);
+            }
+            msg::inf(8, _("Using processors %s for decoding."), cpu_list.c_str());
+        }
+        if (!_ffmpeg->video_hwaccel_names.at(i).empty())
+        {
+            msg::inf(8, _("Using %s for hardware accelerated decoding."),
+                    _ffmpeg->video_hwaccel_names.at(i).c_str());
+        }
     }
     for (int i = 0; i < audio_streams(); i++)
     {
@@ -1121,91 +2325,227 @@ int media_object::subtitle_streams() const
     return _ffmpeg->subtitle_streams.size();
 }
 
+/* Only the streams that are active use decoding resources. The codecs of audio
+ * and subtitle streams are opened when the stream is activated and closed when
+ * it is deactivated; video codecs stay open since the frame templates depend on
+ * them, but their frame buffers are only kept while the stream is active. */
+
+void media_object::open_video_buffers(int index)
+{
+    if (_ffmpeg->video_buffers[index])
+    {
+        return;
+    }
+    AVCodecContext *codec_ctx = _ffmpeg->video_codec_ctxs[index];
+    bool bgra32 = (_ffmpeg->video_frame_templates[index].layout == video_frame::bgra32);
+    enum AVPixelFormat frame_fmt = (bgra32 ? AV_PIX_FMT_BGRA : _ffmpeg->video_pix_fmts[index]);
+    size_t size = avpicture_get_size(frame_fmt, codec_ctx->width, codec_ctx->height);
+    _ffmpeg->video_buffers[index] = static_cast<uint8_t *>(av_malloc(size));
+    if (!_ffmpeg->video_buffers[index])
+    {
+        throw exc(HERE + ": " + strerror(ENOMEM));
+    }
+    _ffmpeg->video_buffer_sizes[index] = size;
+    account_memory(_ffmpeg, &(_ffmpeg->video_memory), size, 0);
+    if (bgra32)
+    {
+        size_t sws_size = avpicture_get_size(AV_PIX_FMT_BGRA, codec_ctx->width, codec_ctx->height);
+        _ffmpeg->video_sws_buffers[index] = static_cast<uint8_t *>(av_malloc(sws_size));
+        if (!_ffmpeg->video_sws_buffers[index])
+        {
+            close_video_buffers(index);
+            throw exc(HERE + ": " + strerror(ENOMEM));
+        }
+        _ffmpeg->video_buffer_sizes[index] += sws_size;
+        account_memory(_ffmpeg, &(_ffmpeg->video_memory), sws_size, 0);
+        avpicture_fill(reinterpret_cast<AVPicture *>(_ffmpeg->video_sws_frames[index]), _ffmpeg->video_sws_buffers[index],
+                AV_PIX_FMT_BGRA, codec_ctx->width, codec_ctx->height);
+    }
+}
+
+void media_object::close_video_buffers(int index)
+{
+    av_free(_ffmpeg->video_buffers[index]);
+    _ffmpeg->video_buffers[index] = NULL;
+    av_free(_ffmpeg->video_sws_buffers[index]);
+    _ffmpeg->video_sws_buffers[index] = NULL;
+    account_memory(_ffmpeg, &(_ffmpeg->video_memory), 0, _ffmpeg->video_buffer_sizes[index]);
+    _ffmpeg->video_buffer_sizes[index] = 0;
+}
+
+void media_object::open_audio_codec(int index)
+{
+    if (_ffmpeg->audio_codecs_open[index])
+    {
+        return;
+    }
+    AVCodecContext *codec_ctx = _ffmpeg->audio_codec_ctxs[index];
+    int e = avcodec_open2(codec_ctx, _ffmpeg->audio_codecs[index], NULL);
+    if (e < 0)
+    {
+        throw exc(str::asprintf(_("%s audio stream %d: Cannot open %s: %s"),
+                    _url.c_str(), index + 1, _("audio codec"), my_av_strerror(e).c_str()));
+    }
+    _ffmpeg->audio_codecs_open[index] = true;
+    // Manage audio_tmpbufs with av_malloc/av_free, to guarantee correct alignment.
+    // Not doing this results in hard to debug crashes on some systems.
+    _ffmpeg->audio_tmpbufs[index] = static_cast<unsigned char*>(av_malloc(audio_tmpbuf_size));
+    if (!_ffmpeg->audio_tmpbufs[index])
+    {
+        close_audio_codec(index);
+        throw exc(HERE + ": " + strerror(ENOMEM));
+    }
+    account_memory(_ffmpeg, &(_ffmpeg->audio_memory), audio_tmpbuf_size, 0);
+    // The decoder may report more accurate parameters than the stream header.
+    try
+    {
+        set_audio_blob_template(index);
+    }
+    catch (...)
+    {
+        close_audio_codec(index);
+        throw;
+    }
+}
+
+void media_object::close_audio_codec(int index)
+{
+    if (_ffmpeg->audio_codecs_open[index])
+    {
+        avcodec_close(_ffmpeg->audio_codec_ctxs[index]);
+        _ffmpeg->audio_codecs_open[index] = false;
+    }
+    if (_ffmpeg->audio_tmpbufs[index])
+    {
+        av_free(_ffmpeg->audio_tmpbufs[index]);
+        _ffmpeg->audio_tmpbufs[index] = NULL;
+        account_memory(_ffmpeg, &(_ffmpeg->audio_memory), 0, audio_tmpbuf_size);
+    }
+}
+
+void media_object::open_subtitle_codec(int index)
+{
+    // AV_CODEC_ID_TEXT has no decoder; there is nothing to open.
+    if (_ffmpeg->subtitle_codecs_open[index] || !_ffmpeg->subtitle_codecs[index])
+    {
+        return;
+    }
+    int e = avcodec_open2(_ffmpeg->subtitle_codec_ctxs[index], _ffmpeg->subtitle_codecs[index], NULL);
+    if (e < 0)
+    {
+        throw exc(str::asprintf(_("%s subtitle stream %d: Cannot open %s: %s"),
+                    _url.c_str(), index + 1, _("subtitle codec"), my_av_strerror(e).c_str()));
+    }
+    _ffmpeg->subtitle_codecs_open[index] = true;
+}
+
+void media_object::close_subtitle_codec(int index)
+{
+    if (_ffmpeg->subtitle_codecs_open[index])
+    {
+        avcodec_close(_ffmpeg->subtitle_codec_ctxs[index]);
+        _ffmpeg->subtitle_codecs_open[index] = false;
+    }
+}
+
 void media_object::video_stream_set_active(int index, bool active)
 {
     assert(index >= 0);
     assert(index < video_streams());
-    // Stop decoder threads
-    for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
+    AVStream *stream = _ffmpeg->format_ctx->streams[_ffmpeg->video_streams.at(index)];
+    if ((stream->discard == AVDISCARD_DEFAULT) == active)
     {
-        _ffmpeg->video_decode_threads[i].finish();
+        return;
     }
-    for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
+    // Only the threads of this stream need to stop; the other streams continue.
+    if (!active)
     {
-        _ffmpeg->audio_decode_threads[i].finish();
+        _ffmpeg->video_lookahead_threads[index]->stop();
+        _ffmpeg->video_decode_threads[index].finish();
+        // Frames decoded ahead would be outdated when the stream becomes active again.
+        _ffmpeg->video_lookahead_threads[index]->clear();
+        close_video_buffers(index);
     }
-    for (size_t i = 0; i < _ffmpeg->subtitle_streams.size(); i++)
+    else
     {
-        _ffmpeg->subtitle_decode_threads[i].finish();
+        open_video_buffers(index);
     }
-    // Stop reading packets
-    _ffmpeg->reader->finish();
-    // Set status
-    _ffmpeg->format_ctx->streams[_ffmpeg->video_streams.at(index)]->discard =
-        (active ? AVDISCARD_DEFAULT : AVDISCARD_ALL);
-    // Restart reader
-    _ffmpeg->reader->start();
+    _ffmpeg->reader->lock_streams();
+    stream->discard = (active ? AVDISCARD_DEFAULT : AVDISCARD_ALL);
+    _ffmpeg->reader->unlock_streams();
 }
 
+/* Inactive audio and subtitle streams are kept in standby: their packets are
+ * read together with those of the active streams, and only the packets around
+ * the current position are kept. Activating such a stream is then seamless:
+ * its decoder starts with packets that follow the position of the previously
+ * active stream, without a seek and without interrupting the other streams. */
+
 void media_object::audio_stream_set_active(int index, bool active)
 {
     assert(index >= 0);
     assert(index < audio_streams());
-    // Stop decoder threads
-    for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
+    AVStream *stream = _ffmpeg->format_ctx->streams[_ffmpeg->audio_streams.at(index)];
+    bool is_active = (stream->discard == AVDISCARD_DEFAULT && !_ffmpeg->audio_standby[index]);
+    if (is_active == active && stream->discard == AVDISCARD_DEFAULT)
     {
-        _ffmpeg->video_decode_threads[i].finish();
+        return;
     }
-    for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
+    if (is_active)
     {
-        _ffmpeg->audio_decode_threads[i].finish();
+        _ffmpeg->audio_decode_threads[index].finish();
+        close_audio_codec(index);
     }
-    for (size_t i = 0; i < _ffmpeg->subtitle_streams.size(); i++)
+    else if (active)
     {
-        _ffmpeg->subtitle_decode_threads[i].finish();
+        // Forget the state from the last time this stream was active.
+        open_audio_codec(index);
+        _ffmpeg->audio_buffers[index].clear();
+        _ffmpeg->audio_last_timestamps[index] = std::numeric_limits<int64_t>::min();
+        _ffmpeg->audio_seek_targets[index] = std::numeric_limits<int64_t>::min();
     }
-    // Stop reading packets
-    _ffmpeg->reader->finish();
-    // Set status
-    _ffmpeg->format_ctx->streams[_ffmpeg->audio_streams.at(index)]->discard =
-        (active ? AVDISCARD_DEFAULT : AVDISCARD_ALL);
+    _ffmpeg->reader->lock_streams();
+    stream->discard = AVDISCARD_DEFAULT;
+    _ffmpeg->audio_standby[index] = !active;
+    _ffmpeg->reader->unlock_streams();
     _ffmpeg->have_active_audio_stream = false;
     for (int i = 0; i < audio_streams(); i++)
     {
-        if (_ffmpeg->format_ctx->streams[_ffmpeg->audio_streams.at(index)]->discard == AVDISCARD_DEFAULT)
+        if (_ffmpeg->format_ctx->streams[_ffmpeg->audio_streams.at(i)]->discard == AVDISCARD_DEFAULT
+                && !_ffmpeg->audio_standby[i])
         {
             _ffmpeg->have_active_audio_stream = true;
             break;
         }
     }
-    // Restart reader
-    _ffmpeg->reader->start();
 }
 
 void media_object::subtitle_stream_set_active(int index, bool active)
 {
     assert(index >= 0);
     assert(index < subtitle_streams());
-    // Stop decoder threads
-    for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
+    AVStream *stream = _ffmpeg->format_ctx->streams[_ffmpeg->subtitle_streams.at(index)];
+    bool is_active = (stream->discard == AVDISCARD_DEFAULT && !_ffmpeg->subtitle_standby[index]);
+    if (is_active == active && stream->discard == AVDISCARD_DEFAULT)
     {
-        _ffmpeg->video_decode_threads[i].finish();
+        return;
     }
-    for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
+    if (is_active)
     {
-        _ffmpeg->audio_decode_threads[i].finish();
+        _ffmpeg->subtitle_decode_threads[index].finish();
+        close_subtitle_codec(index);
     }
-    for (size_t i = 0; i < _ffmpeg->subtitle_streams.size(); i++)
+    else if (active)
     {
-        _ffmpeg->subtitle_decode_threads[i].finish();
+        // Forget the state from the last time this stream was active.
+        open_subtitle_codec(index);
+        clear_subtitle_box_buffer(_ffmpeg, index);
+        _ffmpeg->subtitle_last_timestamps[index] = std::numeric_limits<int64_t>::min();
     }
-    // Stop reading packets
-    _ffmpeg->reader->finish();
-    // Set status
-    _ffmpeg->format_ctx->streams[_ffmpeg->subtitle_streams.at(index)]->discard =
-        (active ? AVDISCARD_DEFAULT : AVDISCARD_ALL);
-    // Restart reader
-    _ffmpeg->reader->start();
+    _ffmpeg->reader->lock_streams();
+    stream->discard = AVDISCARD_DEFAULT;
+    _ffmpeg->subtitle_standby[index] = !active;
+    _ffmpeg->reader->unlock_streams();
 }
 
 const video_frame &media_object::video_frame_template(int video_stream) const
@@ -1244,6 +2584,163 @@ int64_t media_object::video_duration(int index) const
             _ffmpeg->format_ctx);
 }
 
+// The first program that contains the given stream, or NULL.
+static const AVProgram *stream_program(const AVFormatContext *format_ctx, int stream_index)
+{
+    for (unsigned int i = 0; i < format_ctx->nb_programs; i++)
+    {
+        for (unsigned int j = 0; j < format_ctx->programs[i]->nb_stream_indexes; j++)
+        {
+            if (format_ctx->programs[i]->stream_index[j] == static_cast<unsigned int>(stream_index))
+            {
+                return format_ctx->programs[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+static bool program_contains(const AVProgram *program, int stream_index)
+{
+    for (unsigned int j = 0; j < program->nb_stream_indexes; j++)
+    {
+        if (program->stream_index[j] == static_cast<unsigned int>(stream_index))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool media_object::is_adaptive() const
+{
+    std::string format_name = (_ffmpeg->format_ctx->iformat ? _ffmpeg->format_ctx->iformat->name : "");
+    return ((format_name.find("hls") != std::string::npos || format_name.find("dash") != std::string::npos)
+            && _ffmpeg->format_ctx->nb_programs > 1 && video_streams() > 1);
+}
+
+int64_t media_object::video_stream_bitrate(int index) const
+{
+    assert(index >= 0);
+    assert(index < video_streams());
+    const AVStream *stream = _ffmpeg->format_ctx->streams[_ffmpeg->video_streams[index]];
+    const AVProgram *program = stream_program(_ffmpeg->format_ctx, _ffmpeg->video_streams[index]);
+    AVDictionaryEntry *tag = av_dict_get(stream->metadata, "variant_bitrate", NULL, 0);
+    if (!tag && program)
+    {
+        tag = av_dict_get(program->metadata, "variant_bitrate", NULL, 0);
+    }
+    int64_t bitrate = 0;
+    if (!tag || !str::to(tag->value, &bitrate) || bitrate <= 0)
+    {
+        bitrate = stream->codec->bit_rate;
+    }
+    return bitrate;
+}
+
+int media_object::variant_audio_stream(int video_stream, int audio_stream) const
+{
+    assert(video_stream >= 0);
+    assert(video_stream < video_streams());
+    assert(audio_stream >= 0);
+    assert(audio_stream < audio_streams());
+    const AVProgram *program = stream_program(_ffmpeg->format_ctx, _ffmpeg->video_streams[video_stream]);
+    if (!program || program_contains(program, _ffmpeg->audio_streams[audio_stream]))
+    {
+        return audio_stream;
+    }
+    // Use the audio stream at the same position within the new variant.
+    const AVProgram *old_program = stream_program(_ffmpeg->format_ctx, _ffmpeg->audio_streams[audio_stream]);
+    int rank = 0;
+    for (int i = 0; old_program && i < audio_stream; i++)
+    {
+        if (program_contains(old_program, _ffmpeg->audio_streams[i]))
+        {
+            rank++;
+        }
+    }
+    int first = -1;
+    for (int i = 0; i < audio_streams(); i++)
+    {
+        if (program_contains(program, _ffmpeg->audio_streams[i]))
+        {
+            if (rank-- == 0)
+            {
+                return i;
+            }
+            if (first < 0)
+            {
+                first = i;
+            }
+        }
+    }
+    return (first >= 0 ? first : audio_stream);
+}
+
+const std::string &media_object::video_hwaccel(int index) const
+{
+    assert(index >= 0);
+    assert(index < video_streams());
+    return _ffmpeg->video_hwaccel_names.at(index);
+}
+
+void media_object::get_conversion_stats(int64_t *frames, int64_t *time)
+{
+    _ffmpeg->video_conversion_mutex.lock();
+    *frames = _ffmpeg->video_conversion_frames;
+    *time = _ffmpeg->video_conversion_time;
+    _ffmpeg->video_conversion_mutex.unlock();
+}
+
+void media_object::get_queue_stats(size_t *video_packets, size_t *audio_packets, size_t *subtitle_packets,
+        size_t *bytes)
+{
+    if (_ffmpeg && _ffmpeg->reader)
+    {
+        _ffmpeg->reader->get_queue_stats(video_packets, audio_packets, subtitle_packets, bytes);
+    }
+    else
+    {
+        *video_packets = 0;
+        *audio_packets = 0;
+        *subtitle_packets = 0;
+        *bytes = 0;
+    }
+}
+
+void media_object::get_read_stats(int64_t *bytes, int64_t *time)
+{
+    if (_ffmpeg && _ffmpeg->reader)
+    {
+        _ffmpeg->reader->get_read_stats(bytes, time);
+    }
+    else
+    {
+        *bytes = 0;
+        *time = 0;
+    }
+}
+
+void media_object::get_memory_stats(size_t *packets, size_t *video, size_t *audio, size_t *subtitles)
+{
+    size_t video_packets, audio_packets, subtitle_packets;
+    get_queue_stats(&video_packets, &audio_packets, &subtitle_packets, packets);
+    if (_ffmpeg)
+    {
+        _ffmpeg->memory_mutex.lock();
+        *video = _ffmpeg->video_memory;
+        *audio = _ffmpeg->audio_memory;
+        *subtitles = _ffmpeg->subtitle_memory;
+        _ffmpeg->memory_mutex.unlock();
+    }
+    else
+    {
+        *video = 0;
+        *audio = 0;
+        *subtitles = 0;
+    }
+}
+
 const audio_blob &media_object::audio_blob_template(int audio_stream) const
 {
     assert(audio_stream >= 0);
@@ -1269,317 +2766,1536 @@ const subtitle_box &media_object::subtitle_box_template(int subtitle_stream) con
 
 int64_t media_object::subtitle_duration(int index) const
 {
-    assert(index >= 0);
-    assert(index < subtitle_streams());
-    return stream_duration(
-            _ffmpeg->format_ctx->streams[_ffmpeg->subtitle_streams.at(index)],
-            _ffmpeg->format_ctx);
+    assert(index >= 0);
+    assert(index < subtitle_streams());
+    return stream_duration(
+            _ffmpeg->format_ctx->streams[_ffmpeg->subtitle_streams.at(index)],
+            _ffmpeg->format_ctx);
+}
+
+// Make sure that a packet owns its data, so that it stays valid after the next
+// av_read_frame(). Reference counted packets, which is what av_read_frame()
+// returns for almost all inputs, are kept as they are: their data is never copied,
+// and queueing them only moves the AVPacket structure itself.
+static int own_packet(AVPacket *packet)
+{
+    if (packet->buf)
+    {
+        return 0;
+    }
+#if HAVE_AV_PACKET_MAKE_REFCOUNTED
+    return av_packet_make_refcounted(packet);
+#else
+    return av_dup_packet(packet);
+#endif
+}
+
+void packet_queue::push(const AVPacket &packet)
+{
+    if (_size == _ring.size())
+    {
+        // Grow the ring and move it so that it starts at index 0 again.
+        std::vector<AVPacket> ring(std::max(static_cast<size_t>(8), 2 * _ring.size()));
+        for (size_t i = 0; i < _size; i++)
+        {
+            ring[i] = _ring[(_head + i) % _ring.size()];
+        }
+        _ring.swap(ring);
+        _head = 0;
+    }
+    _ring[(_head + _size) % _ring.size()] = packet;
+    _size++;
+    _bytes += packet.size;
+    _duration += (packet.duration > 0 ? packet.duration : 0);
+}
+
+void packet_queue::pop(AVPacket *packet)
+{
+    assert(_size > 0);
+    *packet = _ring[_head];
+    _head = (_head + 1) % _ring.size();
+    _size--;
+    _bytes -= packet->size;
+    _duration -= (packet->duration > 0 ? packet->duration : 0);
+}
+
+void packet_queue::clear()
+{
+    while (!empty())
+    {
+        AVPacket packet;
+        pop(&packet);
+        av_free_packet(&packet);
+    }
+}
+
+void audio_ring::write(const void *data, size_t n)
+{
+    if (_size + n > _ring.size())
+    {
+        // Grow the ring and move it so that it starts at index 0 again.
+        std::vector<unsigned char> ring(std::max(_size + n, 2 * _ring.size()));
+        size_t size = _size;
+        if (size > 0)
+        {
+            read(&(ring[0]), size);
+        }
+        _ring.swap(ring);
+        _head = 0;
+        _size = size;
+    }
+    if (n == 0)
+    {
+        return;
+    }
+    size_t tail = (_head + _size) % _ring.size();
+    size_t n0 = std::min(n, _ring.size() - tail);
+    std::memcpy(&(_ring[tail]), data, n0);
+    std::memcpy(&(_ring[0]), static_cast<const unsigned char *>(data) + n0, n - n0);
+    _size += n;
+}
+
+size_t audio_ring::read(void *buffer, size_t n)
+{
+    n = std::min(n, _size);
+    if (n == 0)
+    {
+        return 0;
+    }
+    size_t n0 = std::min(n, _ring.size() - _head);
+    std::memcpy(buffer, &(_ring[_head]), n0);
+    std::memcpy(static_cast<unsigned char *>(buffer) + n0, &(_ring[0]), n - n0);
+    _head = (_head + n) % _ring.size();
+    _size -= n;
+    return n;
+}
+
+read_cache::read_cache(const std::string &url, size_t size) :
+    _url(url), _source(NULL), _avio(NULL), _source_size(-1), _ring(size),
+    _start(0), _end(0), _pos(0), _seek_target(-1), _seek_result(0),
+    _error(0), _eof(false), _stop(false)
+{
+}
+
+read_cache::~read_cache()
+{
+    close();
+}
+
+int read_cache::interrupt(void *opaque)
+{
+    // Reading _stop without locking is fine here: we only need to see it eventually.
+    return static_cast<read_cache *>(opaque)->_stop ? 1 : 0;
+}
+
+void read_cache::open()
+{
+    AVIOInterruptCB interrupt_cb = { interrupt, this };
+    int e = avio_open2(&_source, _url.c_str(), AVIO_FLAG_READ, &interrupt_cb, NULL);
+    if (e < 0)
+    {
+        throw exc(str::asprintf(_("%s: %s"), _url.c_str(), my_av_strerror(e).c_str()));
+    }
+    const int avio_buffer_size = 32768;
+    unsigned char *avio_buffer = static_cast<unsigned char *>(av_malloc(avio_buffer_size));
+    if (avio_buffer)
+    {
+        _avio = avio_alloc_context(avio_buffer, avio_buffer_size, 0, this, read_packet, NULL, seek);
+    }
+    if (!_avio)
+    {
+        av_free(avio_buffer);
+        avio_close(_source);
+        _source = NULL;
+        throw exc(HERE + ": " + std::strerror(ENOMEM));
+    }
+    _avio->seekable = _source->seekable;
+    _source_size = avio_size(_source);
+    start();
+}
+
+void read_cache::close()
+{
+    if (_source)
+    {
+        _mutex.lock();
+        _stop = true;
+        _cond.wake_all();
+        _mutex.unlock();
+        wait();
+        avio_close(_source);
+        _source = NULL;
+    }
+    if (_avio)
+    {
+        av_freep(&_avio->buffer);
+        av_freep(&_avio);
+    }
+}
+
+void read_cache::run()
+{
+    trace::set_thread_track("read cache");
+    // We prefetch until only a quarter of the ring is left for data
+    // behind the read position.
+    const int64_t size = _ring.size();
+    const int64_t ahead_limit = size - size / 4;
+    _mutex.lock();
+    while (!_stop)
+    {
+        if (_seek_target >= 0)
+        {
+            int64_t target = _seek_target;
+            _mutex.unlock();
+            int64_t r = avio_seek(_source, target, SEEK_SET);
+            _mutex.lock();
+            _seek_result = (r < 0 ? r : 0);
+            if (r >= 0)
+            {
+                _start = target;
+                _end = target;
+                _pos = target;
+                _eof = false;
+                _error = 0;
+            }
+            _seek_target = -1;
+            _cond.wake_all();
+            continue;
+        }
+        if (_eof || _error != 0 || _end - _pos >= ahead_limit)
+        {
+            _cond.wait(_mutex);
+            continue;
+        }
+        // Read the next chunk into the ring. The read position cannot get into
+        // the chunk while we are reading (only seeks can move it backwards, and
+        // they cannot go below _start), so we can unlock meanwhile.
+        int64_t at = _end;
+        int64_t n = std::min(static_cast<int64_t>(65536), ahead_limit - (_end - _pos));
+        n = std::min(n, size - at % size);
+        _start = std::max(_start, at + n - size);
+        _mutex.unlock();
+        int r = avio_read(_source, &(_ring[at % size]), n);
+        _mutex.lock();
+        if (_seek_target >= 0 || _end != at)
+        {
+            // A seek was requested meanwhile; the data is not needed.
+            continue;
+        }
+        if (r > 0)
+        {
+            _end += r;
+        }
+        else if (r == 0 || r == AVERROR_EOF)
+        {
+            _eof = true;
+        }
+        else if (!_stop)
+        {
+            msg::wrn(_("%s: %s"), _url.c_str(), my_av_strerror(r).c_str());
+            _error = r;
+        }
+        _cond.wake_all();
+    }
+    _mutex.unlock();
+}
+
+int read_cache::read_packet(void *opaque, uint8_t *buf, int buf_size)
+{
+    read_cache *cache = static_cast<read_cache *>(opaque);
+    const int64_t size = cache->_ring.size();
+    int r;
+    cache->_mutex.lock();
+    while (cache->_pos >= cache->_end && !cache->_eof && cache->_error == 0 && !cache->_stop)
+    {
+        cache->_cond.wait(cache->_mutex);
+    }
+    if (cache->_pos < cache->_end)
+    {
+        r = std::min(static_cast<int64_t>(buf_size), cache->_end - cache->_pos);
+        int64_t ring_pos = cache->_pos % size;
+        int64_t n = std::min(static_cast<int64_t>(r), size - ring_pos);
+        std::memcpy(buf, &(cache->_ring[ring_pos]), n);
+        std::memcpy(buf + n, &(cache->_ring[0]), r - n);
+        cache->_pos += r;
+        cache->_cond.wake_all();
+    }
+    else
+    {
+        r = (cache->_error != 0 ? cache->_error : AVERROR_EOF);
+    }
+    cache->_mutex.unlock();
+    return r;
+}
+
+int64_t read_cache::seek(void *opaque, int64_t offset, int whence)
+{
+    read_cache *cache = static_cast<read_cache *>(opaque);
+    whence &= ~AVSEEK_FORCE;
+    if (whence == AVSEEK_SIZE)
+    {
+        return cache->_source_size;
+    }
+    cache->_mutex.lock();
+    int64_t pos = offset;
+    if (whence == SEEK_CUR)
+    {
+        pos += cache->_pos;
+    }
+    else if (whence == SEEK_END)
+    {
+        if (cache->_source_size < 0)
+        {
+            cache->_mutex.unlock();
+            return cache->_source_size;
+        }
+        pos += cache->_source_size;
+    }
+    if (pos < 0)
+    {
+        cache->_mutex.unlock();
+        return AVERROR(EINVAL);
+    }
+    if (pos < cache->_start || pos > cache->_end)
+    {
+        // Not in the cache: let the prefetch thread seek in the input.
+        cache->_seek_target = pos;
+        cache->_cond.wake_all();
+        while (cache->_seek_target >= 0 && !cache->_stop)
+        {
+            cache->_cond.wait(cache->_mutex);
+        }
+        if (cache->_seek_target >= 0 || cache->_seek_result < 0)
+        {
+            int e = (cache->_seek_target >= 0 ? AVERROR_EXIT : cache->_seek_result);
+            cache->_mutex.unlock();
+            return e;
+        }
+    }
+    cache->_pos = pos;
+    cache->_cond.wake_all();
+    cache->_mutex.unlock();
+    return pos;
+}
+
+read_thread::read_thread(const std::string &url, bool is_device, struct ffmpeg_stuff *ffmpeg,
+        const parameters &params) :
+    _url(url), _is_device(is_device), _live(is_device && params.live_capture()),
+    _ffmpeg(ffmpeg), _eof(false), _failed(false), _stop(false), _reading(false), _stream_locks(0),
+    _read_bytes(0), _read_time(0)
+{
+    // Devices should not be read ahead to avoid latency. Network inputs
+    // are read further ahead than local files to absorb network stalls.
+    if (_is_device)
+    {
+        _budget_duration = 0;
+        _budget_bytes = 0;
+    }
+    else if (is_network_url(url))
+    {
+        _budget_duration = 10000000;
+        _budget_bytes = 128 << 20;
+    }
+    else
+    {
+        _budget_duration = 1000000;
+        _budget_bytes = 32 << 20;
+    }
+    float demuxer_buffer = params.demuxer_buffer();
+    if (demuxer_buffer >= 0.0f)
+    {
+        _budget_duration = demuxer_buffer * 1e6f;
+        if (_budget_bytes == 0)
+        {
+            _budget_bytes = 32 << 20;
+        }
+    }
+    _memory_limit = static_cast<size_t>(params.memory_limit()) << 20;
+    msg::dbg(_url + ": read ahead budget is " + str::from(_budget_duration / 1000)
+            + " ms or " + str::from(_budget_bytes >> 20) + " MiB.");
+}
+
+size_t read_thread::memory_use()
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < _ffmpeg->video_packet_queues.size(); i++)
+    {
+        bytes += _ffmpeg->video_packet_queues[i].bytes();
+    }
+    for (size_t i = 0; i < _ffmpeg->audio_packet_queues.size(); i++)
+    {
+        bytes += _ffmpeg->audio_packet_queues[i].bytes();
+    }
+    for (size_t i = 0; i < _ffmpeg->subtitle_packet_queues.size(); i++)
+    {
+        bytes += _ffmpeg->subtitle_packet_queues[i].bytes();
+    }
+    _ffmpeg->memory_mutex.lock();
+    bytes += _ffmpeg->video_memory + _ffmpeg->audio_memory + _ffmpeg->subtitle_memory;
+    _ffmpeg->memory_mutex.unlock();
+    return bytes;
+}
+
+bool read_thread::need_another_packet()
+{
+    // In live capture mode, always read: a device delivers packets at its own pace, and
+    // packets that are not read pile up in its buffers and add latency. The queues
+    // are bounded in queue_packet() instead.
+    if (_live)
+    {
+        return true;
+    }
+    // We need another packet if the number of queued packets for an active stream is below a threshold.
+    // For files, we often want to read ahead to avoid i/o waits. For devices, we do not want to read
+    // ahead to avoid latency.
+    const size_t video_stream_low_threshold = (_is_device ? 1 : 2);         // Often, 1 packet results in one video frame
+    const size_t audio_stream_low_threshold = (_is_device ? 1 : 5);         // Often, 3-4 packets are needed for one buffer fill
+    const size_t subtitle_stream_low_threshold = (_is_device ? 1 : 1);      // Just a guess
+    // Beyond the memory limit, only empty queues of active video and audio streams
+    // cause reads, so that their decoders never starve. Subtitle packets that are
+    // missing then are read together with the packets of the other streams.
+    const bool over_limit = (_memory_limit > 0 && memory_use() >= _memory_limit);
+    for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
+    {
+        if (_ffmpeg->format_ctx->streams[_ffmpeg->video_streams[i]]->discard == AVDISCARD_DEFAULT
+                && _ffmpeg->video_packet_queues[i].size() < (over_limit ? 1 : video_stream_low_threshold))
+        {
+            return true;
+        }
+    }
+    // Streams in standby do not cause reads; their packets are only kept while
+    // the active streams are read.
+    for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
+    {
+        if (_ffmpeg->format_ctx->streams[_ffmpeg->audio_streams[i]]->discard == AVDISCARD_DEFAULT
+                && !_ffmpeg->audio_standby[i]
+                && _ffmpeg->audio_packet_queues[i].size() < (over_limit ? 1 : audio_stream_low_threshold))
+        {
+            return true;
+        }
+    }
+    for (size_t i = 0; i < _ffmpeg->subtitle_streams.size(); i++)
+    {
+        if (!over_limit
+                && _ffmpeg->format_ctx->streams[_ffmpeg->subtitle_streams[i]]->discard == AVDISCARD_DEFAULT
+                && !_ffmpeg->subtitle_standby[i]
+                && _ffmpeg->subtitle_packet_queues[i].size() < subtitle_stream_low_threshold)
+        {
+            return true;
+        }
+    }
+    // Devices do not read ahead within the budgets. Their packets usually
+    // reference the memory mapped capture buffers of the driver, and every
+    // queued packet keeps one of these buffers from the driver. When the driver
+    // runs low on buffers, the demuxer falls back to copying each packet.
+    if (_is_device)
+    {
+        return false;
+    }
+    // Read ahead within the budgets.
+    size_t bytes = 0;
+    for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
+    {
+        bytes += _ffmpeg->video_packet_queues[i].bytes();
+    }
+    for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
+    {
+        if (!_ffmpeg->audio_standby[i])
+        {
+            bytes += _ffmpeg->audio_packet_queues[i].bytes();
+        }
+    }
+    for (size_t i = 0; i < _ffmpeg->subtitle_streams.size(); i++)
+    {
+        if (!_ffmpeg->subtitle_standby[i])
+        {
+            bytes += _ffmpeg->subtitle_packet_queues[i].bytes();
+        }
+    }
+    if (over_limit || bytes >= _budget_bytes)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
+    {
+        AVStream *stream = _ffmpeg->format_ctx->streams[_ffmpeg->video_streams[i]];
+        if (stream->discard == AVDISCARD_DEFAULT
+                && _ffmpeg->video_packet_queues[i].duration() * 1000000
+                * stream->time_base.num / stream->time_base.den < _budget_duration)
+        {
+            return true;
+        }
+    }
+    for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
+    {
+        AVStream *stream = _ffmpeg->format_ctx->streams[_ffmpeg->audio_streams[i]];
+        if (stream->discard == AVDISCARD_DEFAULT
+                && !_ffmpeg->audio_standby[i]
+                && _ffmpeg->audio_packet_queues[i].duration() * 1000000
+                * stream->time_base.num / stream->time_base.den < _budget_duration)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void read_thread::queue_packet(AVPacket &packet)
+{
+    // In live capture mode, streams that are read slowly or not at all must not
+    // make the queues grow without bounds.
+    const size_t live_queue_limit = 16;
+
+    // Put the packet in the right queue.
+    bool packet_queued = false;
+    for (size_t i = 0; i < _ffmpeg->video_streams.size() && !packet_queued; i++)
+    {
+        if (packet.stream_index == _ffmpeg->video_streams[i])
+        {
+            // We do not check for missing timestamps here, as we do with audio
+            // packets, for the following reasons:
+            // 1. The video decoder might fill in a timestamp for us
+            // 2. We cannot drop video packets anyway, because of their
+            //    interdependencies. We would mess up decoding.
+            // Reference counted packets, such as those that point into the
+            // capture buffers of a device, are not copied here.
+            if (own_packet(&packet) < 0)
+            {
+                throw exc(str::asprintf(_("%s: Cannot duplicate packet."), _url.c_str()));
+            }
+            // Remember the positions of key frames for later seeks.
+            int64_t ts = (packet.pts != static_cast<int64_t>(AV_NOPTS_VALUE) ? packet.pts : packet.dts);
+            if ((packet.flags & AV_PKT_FLAG_KEY) && ts != static_cast<int64_t>(AV_NOPTS_VALUE))
+            {
+                std::vector<int64_t> &keyframes = _ffmpeg->video_keyframes[i];
+                _ffmpeg->video_keyframes_mutex.lock();
+                std::vector<int64_t>::iterator it = std::lower_bound(keyframes.begin(), keyframes.end(), ts);
+                if (it == keyframes.end() || *it != ts)
+                {
+                    keyframes.insert(it, ts);
+                }
+                _ffmpeg->video_keyframes_mutex.unlock();
+            }
+            _ffmpeg->video_packet_queues[i].push(packet);
+            packet_queued = true;
+            if (_live)
+            {
+                // Drop stale packets if the codec allows it, so that the next
+                // decoded frame is always the newest one.
+                const AVCodecDescriptor *desc = avcodec_descriptor_get(
+                        _ffmpeg->format_ctx->streams[_ffmpeg->video_streams[i]]->codec->codec_id);
+                bool intra_only = (desc && (desc->props & AV_CODEC_PROP_INTRA_ONLY));
+                while (intra_only && _ffmpeg->video_packet_queues[i].size() > 1)
+                {
+                    AVPacket stale_packet;
+                    _ffmpeg->video_packet_queues[i].pop(&stale_packet);
+                    av_free_packet(&stale_packet);
+                    msg::dbg("%s: video stream %lu: dropping stale packet", _url.c_str(), static_cast<unsigned long>(i));
+                }
+            }
+            msg::dbg("%s: %lu packets queued in video stream %lu.", _url.c_str(),
+                    static_cast<unsigned long>(_ffmpeg->video_packet_queues[i].size()),
+                    static_cast<unsigned long>(i));
+        }
+    }
+    for (size_t i = 0; i < _ffmpeg->audio_streams.size() && !packet_queued; i++)
+    {
+        if (packet.stream_index == _ffmpeg->audio_streams[i])
+        {
+            if (_ffmpeg->audio_packet_queues[i].empty()
+                    && _ffmpeg->audio_last_timestamps[i] == std::numeric_limits<int64_t>::min()
+                    && packet.dts == static_cast<int64_t>(AV_NOPTS_VALUE))
+            {
+                // We have no packet in the queue and no last timestamp, probably
+                // because we just seeked. We *need* a packet with a timestamp.
+                msg::dbg("%s: audio stream %lu: dropping packet because it has no timestamp",
+                        _url.c_str(), static_cast<unsigned long>(i));
+            }
+            else
+            {
+                if (own_packet(&packet) < 0)
+                {
+                    throw exc(str::asprintf(_("%s: Cannot duplicate packet."), _url.c_str()));
+                }
+                _ffmpeg->audio_packet_queues[i].push(packet);
+                packet_queued = true;
+                if (_ffmpeg->audio_standby[i])
+                {
+                    trim_standby_queue(_ffmpeg->audio_packet_queues[i],
+                            _ffmpeg->format_ctx->streams[_ffmpeg->audio_streams[i]]);
+                }
+                while (_live && _ffmpeg->audio_packet_queues[i].size() > live_queue_limit)
+                {
+                    AVPacket stale_packet;
+                    _ffmpeg->audio_packet_queues[i].pop(&stale_packet);
+                    av_free_packet(&stale_packet);
+                }
+                msg::dbg("%s: %lu packets queued in audio stream %lu.", _url.c_str(),
+                        static_cast<unsigned long>(_ffmpeg->audio_packet_queues[i].size()),
+                        static_cast<unsigned long>(i));
+            }
+        }
+    }
+    for (size_t i = 0; i < _ffmpeg->subtitle_streams.size() && !packet_queued; i++)
+    {
+        if (packet.stream_index == _ffmpeg->subtitle_streams[i])
+        {
+            if (_ffmpeg->subtitle_packet_queues[i].empty()
+                    && _ffmpeg->subtitle_last_timestamps[i] == std::numeric_limits<int64_t>::min()
+                    && packet.dts == static_cast<int64_t>(AV_NOPTS_VALUE))
+            {
+                // We have no packet in the queue and no last timestamp, probably
+                // because we just seeked. We want a packet with a timestamp.
+                msg::dbg("%s: subtitle stream %lu: dropping packet because it has no timestamp",
+                        _url.c_str(), static_cast<unsigned long>(i));
+            }
+            else
+            {
+                if (own_packet(&packet) < 0)
+                {
+                    throw exc(str::asprintf(_("%s: Cannot duplicate packet."), _url.c_str()));
+                }
+                _ffmpeg->subtitle_packet_queues[i].push(packet);
+                packet_queued = true;
+                if (_ffmpeg->subtitle_standby[i])
+                {
+                    trim_standby_queue(_ffmpeg->subtitle_packet_queues[i],
+                            _ffmpeg->format_ctx->streams[_ffmpeg->subtitle_streams[i]]);
+                }
+                while (_live && _ffmpeg->subtitle_packet_queues[i].size() > live_queue_limit)
+                {
+                    AVPacket stale_packet;
+                    _ffmpeg->subtitle_packet_queues[i].pop(&stale_packet);
+                    av_free_packet(&stale_packet);
+                }
+                msg::dbg("%s: %lu packets queued in subtitle stream %lu.", _url.c_str(),
+                        static_cast<unsigned long>(_ffmpeg->subtitle_packet_queues[i].size()),
+                        static_cast<unsigned long>(i));
+            }
+        }
+    }
+    if (!packet_queued)
+    {
+        av_free_packet(&packet);
+    }
+}
+
+int64_t read_thread::standby_position()
+{
+    // The next packet that the decoder of the active audio stream will get, or
+    // else that of the active video stream. Playback is at or before this point.
+    const packet_queue *queue = NULL;
+    const AVStream *stream = NULL;
+    for (size_t i = 0; i < _ffmpeg->audio_streams.size() && !queue; i++)
+    {
+        if (_ffmpeg->format_ctx->streams[_ffmpeg->audio_streams[i]]->discard == AVDISCARD_DEFAULT
+                && !_ffmpeg->audio_standby[i] && !_ffmpeg->audio_packet_queues[i].empty())
+        {
+            queue = &(_ffmpeg->audio_packet_queues[i]);
+            stream = _ffmpeg->format_ctx->streams[_ffmpeg->audio_streams[i]];
+        }
+    }
+    for (size_t i = 0; i < _ffmpeg->video_streams.size() && !queue; i++)
+    {
+        if (_ffmpeg->format_ctx->streams[_ffmpeg->video_streams[i]]->discard == AVDISCARD_DEFAULT
+                && !_ffmpeg->video_packet_queues[i].empty())
+        {
+            queue = &(_ffmpeg->video_packet_queues[i]);
+            stream = _ffmpeg->format_ctx->streams[_ffmpeg->video_streams[i]];
+        }
+    }
+    if (!queue || queue->front().dts == static_cast<int64_t>(AV_NOPTS_VALUE))
+    {
+        return std::numeric_limits<int64_t>::min();
+    }
+    return queue->front().dts * 1000000 * stream->time_base.num / stream->time_base.den;
+}
+
+void read_thread::trim_standby_queue(packet_queue &queue, const AVStream *stream)
+{
+    int64_t pos = standby_position();
+    if (pos == std::numeric_limits<int64_t>::min())
+    {
+        return;
+    }
+    // Drop the packets that end before the position. Packets without timestamp
+    // are dropped, too: decoding must not start with them after a switch.
+    while (queue.size() > 1)
+    {
+        const AVPacket &packet = queue.front();
+        if (packet.dts != static_cast<int64_t>(AV_NOPTS_VALUE)
+                && (packet.dts + (packet.duration > 0 ? packet.duration : 0)) * 1000000
+                * stream->time_base.num / stream->time_base.den >= pos)
+        {
+            break;
+        }
+        AVPacket old_packet;
+        queue.pop(&old_packet);
+        av_free_packet(&old_packet);
+    }
+}
+
+void read_thread::run()
+{
+    trace::set_thread_track("demux");
+    _mutex.lock();
+    try
+    {
+        while (!_stop && !_eof)
+        {
+            if (_stream_locks > 0)
+            {
+                // Let lock_streams() go first.
+                _cond.wait(_mutex);
+                continue;
+            }
+            if (!need_another_packet())
+            {
+                // Sleep until a decode thread takes a packet from its queue.
+                msg::dbg("%s: No need to read more packets.", _url.c_str());
+                _cond.wait(_mutex);
+                continue;
+            }
+            // Read a packet. The queues are unlocked meanwhile so that the
+            // decode threads can continue.
+            _reading = true;
+            _mutex.unlock();
+            msg::dbg("%s: Reading a packet.", _url.c_str());
+            AVPacket packet;
+            int64_t read_start = timer::get(timer::monotonic);
+            int e;
+            {
+                trace_scope read_trace("read packet");
+                e = av_read_frame(_ffmpeg->format_ctx, &packet);
+            }
+            int64_t read_time = timer::get(timer::monotonic) - read_start;
+            if (e >= 0)
+                benchmark_stats::add(benchmark_stats::demux, read_time);
+            _mutex.lock();
+            _reading = false;
+            if (e >= 0)
+            {
+                _read_bytes += packet.size;
+                _read_time += read_time;
+            }
+            if (e < 0)
+            {
+                if (e == AVERROR_EOF)
+                {
+                    msg::dbg(_url + ": EOF.");
+                    _eof = true;
+                }
+                else
+                {
+                    throw exc(str::asprintf(_("%s: %s"), _url.c_str(), my_av_strerror(e).c_str()));
+                }
+            }
+            else
+            {
+                queue_packet(packet);
+            }
+            _cond.wake_all();
+        }
+    }
+    catch (...)
+    {
+        _failed = true;
+        _reading = false;
+        _cond.wake_all();
+        _mutex.unlock();
+        throw;
+    }
+    _mutex.unlock();
+}
+
+void read_thread::lock_streams()
+{
+    // The demuxer reads the discard flags in av_read_frame(), so wait for a read to finish.
+    _mutex.lock();
+    _stream_locks++;
+    while (_reading)
+    {
+        _cond.wait(_mutex);
+    }
+}
+
+void read_thread::unlock_streams()
+{
+    _stream_locks--;
+    _cond.wake_all();
+    _mutex.unlock();
+}
+
+void read_thread::reset()
+{
+    exception() = exc();
+    _eof = false;
+    _failed = false;
+}
+
+void read_thread::stop()
+{
+    _mutex.lock();
+    _stop = true;
+    _cond.wake_all();
+    _mutex.unlock();
+    wait();
+    _stop = false;
+    if (!exception().empty())
+    {
+        throw exception();
+    }
+}
+
+bool read_thread::get_packet(packet_queue &queue, AVPacket *packet)
+{
+    _mutex.lock();
+    while (queue.empty() && !_eof && !_failed)
+    {
+        msg::dbg("%s: need to wait for packets...", _url.c_str());
+        start();        // does nothing if the reader is already running
+        _cond.wait(_mutex);
+    }
+    if (queue.empty())
+    {
+        bool failed = _failed;
+        _mutex.unlock();
+        if (failed)
+        {
+            finish();
+        }
+        return false;
+    }
+    queue.pop(packet);
+    _cond.wake_all();   // let the reader refill the queue
+    _mutex.unlock();
+    return true;
+}
+
+bool read_thread::get_queued_packet(packet_queue &queue, AVPacket *packet)
+{
+    _mutex.lock();
+    if (queue.empty())
+    {
+        _mutex.unlock();
+        return false;
+    }
+    queue.pop(packet);
+    _cond.wake_all();   // let the reader refill the queue
+    _mutex.unlock();
+    return true;
+}
+
+void read_thread::get_read_stats(int64_t *bytes, int64_t *time)
+{
+    _mutex.lock();
+    *bytes = _read_bytes;
+    *time = _read_time;
+    _mutex.unlock();
+}
+
+void read_thread::get_queue_stats(size_t *video_packets, size_t *audio_packets, size_t *subtitle_packets,
+        size_t *bytes)
+{
+    *video_packets = 0;
+    *audio_packets = 0;
+    *subtitle_packets = 0;
+    *bytes = 0;
+    _mutex.lock();
+    for (size_t i = 0; i < _ffmpeg->video_packet_queues.size(); i++)
+    {
+        *video_packets += _ffmpeg->video_packet_queues[i].size();
+        *bytes += _ffmpeg->video_packet_queues[i].bytes();
+    }
+    for (size_t i = 0; i < _ffmpeg->audio_packet_queues.size(); i++)
+    {
+        *audio_packets += _ffmpeg->audio_packet_queues[i].size();
+        *bytes += _ffmpeg->audio_packet_queues[i].bytes();
+    }
+    for (size_t i = 0; i < _ffmpeg->subtitle_packet_queues.size(); i++)
+    {
+        *subtitle_packets += _ffmpeg->subtitle_packet_queues[i].size();
+        *bytes += _ffmpeg->subtitle_packet_queues[i].bytes();
+    }
+    _mutex.unlock();
+}
+
+video_sws_slice::video_sws_slice() : ctx(NULL), height(0)
+{
+}
+
+video_sws_slice::~video_sws_slice()
+{
+    sws_freeContext(ctx);
+}
+
+void video_sws_slice::convert()
+{
+    trace_scope slice_trace("convert slice");
+    sws_scale(ctx, src, src_linesize, 0, height, dst, dst_linesize);
+}
+
+void video_sws_slice::run()
+{
+    trace::set_thread_track("video conversion");
+    thread_cpus_scope cpus_scope(cpus);
+    convert();
+}
+
+// Get the start of row y in the planes of an image with the given pixel format.
+// Only the planes that hold image components are moved; e.g. a palette stays in place.
+template<typename T>
+static void image_rows(const AVPixFmtDescriptor *desc, int y, T *const data[], const int linesize[], T *rows[])
+{
+    for (int p = 0; p < 4; p++)
+    {
+        rows[p] = data[p];
+    }
+    for (int c = 0; c < desc->nb_components; c++)
+    {
+        int p = desc->comp[c].plane;
+        bool chroma = ((c == 1 || c == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB));
+        rows[p] = data[p] + (chroma ? (y >> desc->log2_chroma_h) : y) * linesize[p];
+    }
+}
+
+// Convert an image with sws_scale, split into one horizontal slice for each entry in
+// slices. All slices but the first are converted by their own tasks while this
+// thread converts the first one. The slice boundaries are aligned to the vertical
+// chroma subsampling of both pixel formats, and since the image is not scaled, the
+// result is the same as converting it in one piece.
+// Return false if a scaler context cannot be initialized.
+static bool sliced_sws_scale(std::vector<video_sws_slice *> &slices, int width, int height,
+        enum AVPixelFormat src_fmt, const uint8_t *const src[], const int src_linesize[],
+        enum AVPixelFormat dst_fmt, uint8_t *const dst[], const int dst_linesize[])
+{
+    const AVPixFmtDescriptor *src_desc = av_pix_fmt_desc_get(src_fmt);
+    const AVPixFmtDescriptor *dst_desc = av_pix_fmt_desc_get(dst_fmt);
+    if (!src_desc || !dst_desc)
+    {
+        return false;
+    }
+    int align = 1 << std::max(src_desc->log2_chroma_h, dst_desc->log2_chroma_h);
+    int n = std::max(1, std::min(static_cast<int>(slices.size()), height / align));
+    int slice_height = height / n / align * align;
+    for (int i = 0; i < n; i++)
+    {
+        video_sws_slice *slice = slices[i];
+        int y = i * slice_height;
+        slice->height = (i == n - 1 ? height - y : slice_height);
+        slice->ctx = sws_getCachedContext(slice->ctx,
+                width, slice->height, src_fmt, width, slice->height, dst_fmt,
+                SWS_POINT, NULL, NULL, NULL);
+        if (!slice->ctx)
+        {
+            return false;
+        }
+        image_rows(src_desc, y, src, src_linesize, slice->src);
+        image_rows(dst_desc, y, dst, dst_linesize, slice->dst);
+        for (int p = 0; p < 4; p++)
+        {
+            slice->src_linesize[p] = src_linesize[p];
+            slice->dst_linesize[p] = dst_linesize[p];
+        }
+    }
+    for (int i = 1; i < n; i++)
+    {
+        slices[i]->start();
+    }
+    slices[0]->convert();
+    for (int i = 1; i < n; i++)
+    {
+        slices[i]->finish();
+    }
+    return true;
+}
+
+video_decode_thread::video_decode_thread(const std::string &url, struct ffmpeg_stuff *ffmpeg, int video_stream) :
+    _url(url), _ffmpeg(ffmpeg), _video_stream(video_stream), _frame(), _raw_frames(1), _skip_level(0)
+{
+}
+
+int64_t video_decode_thread::handle_timestamp(int64_t timestamp)
+{
+    // The position is updated when the player gets the frame; see finish_video_frame_read().
+    return timestamp_helper(_ffmpeg->video_last_timestamps[_video_stream], timestamp);
+}
+
+void video_decode_thread::convert(const AVFrame *src, enum AVPixelFormat src_fmt, int width, int height,
+        AVFrame *dst, enum AVPixelFormat dst_fmt)
+{
+    trace_scope convert_trace("convert video frame");
+    int64_t start = timer::get(timer::monotonic);
+    if (!sliced_sws_scale(_ffmpeg->video_sws_slices[_video_stream], width, height,
+                src_fmt, src->data, src->linesize, dst_fmt, dst->data, dst->linesize))
+    {
+        throw exc(str::asprintf(_("%s video stream %d: Cannot initialize conversion context."),
+                    _url.c_str(), _video_stream + 1));
+    }
+    int64_t elapsed = timer::get(timer::monotonic) - start;
+    benchmark_stats::add(benchmark_stats::conversion, elapsed);
+    _ffmpeg->video_conversion_mutex.lock();
+    _ffmpeg->video_conversion_frames++;
+    _ffmpeg->video_conversion_time += elapsed;
+    _ffmpeg->video_conversion_mutex.unlock();
+}
+
+void video_decode_thread::run()
+{
+    trace::set_thread_track("video decode");
+    trace_scope decode_trace("decode video frame");
+    thread_cpus_scope cpus_scope(_ffmpeg->video_cpus[_video_stream]);
+    // Let the decoder cut corners if the player cannot keep up; see media_object::set_video_skip_level().
+    // Skipping whole frames would break the frame pairs of alternating stereo.
+    AVCodecContext *codec_ctx = _ffmpeg->video_codec_ctxs[_video_stream];
+    codec_ctx->skip_loop_filter = (_skip_level >= 2 ? AVDISCARD_ALL
+            : _skip_level >= 1 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT);
+    codec_ctx->skip_frame = (_ffmpeg->video_keyframes_only && _raw_frames == 1 ? AVDISCARD_NONKEY
+            : _skip_level >= 3 && _raw_frames == 1 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT);
+    _frame = _ffmpeg->video_frame_templates[_video_stream];
+    int64_t decode_time = 0;
+    for (int raw_frame = 0; raw_frame < _raw_frames; raw_frame++)
+    {
+        int frame_finished = 0;
+read_frame:
+        do
+        {
+            AVPacket packet;
+            if (!_ffmpeg->reader->get_packet(_ffmpeg->video_packet_queues[_video_stream], &packet))
+            {
+                if (raw_frame == 1)
+                {
+                    _frame.surface[1] = _frame.surface[0];
+                    _frame.data[1][0] = _frame.data[0][0];
+                    _frame.data[1][1] = _frame.data[0][1];
+                    _frame.data[1][2] = _frame.data[0][2];
+                    _frame.line_size[1][0] = _frame.line_size[0][0];
+                    _frame.line_size[1][1] = _frame.line_size[0][1];
+                    _frame.line_size[1][2] = _frame.line_size[0][2];
+                }
+                else
+                {
+                    _frame = video_frame();
+                }
+                return;
+            }
+            av_free_packet(&(_ffmpeg->video_packets[_video_stream]));
+            _ffmpeg->video_packets[_video_stream] = packet;
+            int64_t decode_start = timer::get(timer::monotonic);
+            avcodec_decode_video2(_ffmpeg->video_codec_ctxs[_video_stream],
+                    _ffmpeg->video_frames[_video_stream], &frame_finished,
+                    &(_ffmpeg->video_packets[_video_stream]));
+            decode_time += timer::get(timer::monotonic) - decode_start;
+        }
+        while (!frame_finished);
+        if (_ffmpeg->video_frames[_video_stream]->width != _ffmpeg->video_frame_templates[_video_stream].raw_width
+                || _ffmpeg->video_frames[_video_stream]->height != _ffmpeg->video_frame_templates[_video_stream].raw_height)
+        {
+            msg::wrn(_("%s video stream %d: Dropping %dx%d frame"), _url.c_str(), _video_stream + 1, 
+                    _ffmpeg->video_frames[_video_stream]->width, _ffmpeg->video_frames[_video_stream]->height);
+            goto read_frame;
+        }
+        if (_raw_frames == 1 && _ffmpeg->video_seek_targets[_video_stream] != std::numeric_limits<int64_t>::min()
+                && _ffmpeg->video_packets[_video_stream].dts != static_cast<int64_t>(AV_NOPTS_VALUE))
+        {
+            // After a seek, drop the frames before the seek target. We do not need to
+            // convert them. The alternating layout is left alone since its frames come in pairs.
+            AVStream *stream = _ffmpeg->format_ctx->streams[_ffmpeg->video_streams[_video_stream]];
+            int64_t ts = _ffmpeg->video_packets[_video_stream].dts * 1000000
+                * stream->time_base.num / stream->time_base.den;
+            if (ts + video_frame_duration(stream) <= _ffmpeg->video_seek_targets[_video_stream])
+            {
+                msg::dbg("%s: video stream %d: dropping frame at %g before seek target",
+                        _url.c_str(), _video_stream, ts / 1e6f);
+                _ffmpeg->video_last_timestamps[_video_stream] = ts;
+                goto read_frame;
+            }
+            _ffmpeg->video_seek_targets[_video_stream] = std::numeric_limits<int64_t>::min();
+        }
+        const AVFrame *decoded_frame = _ffmpeg->video_frames[_video_stream];
+        if (decoded_frame->interlaced_frame)
+        {
+            // The frame flags override the field order of the stream, which is
+            // kept for decoders that do not mark interlaced frames.
+            _frame.field_order = (decoded_frame->top_field_first
+                    ? video_frame::top_first : video_frame::bottom_first);
+        }
+        bool have_surface = false;
+        // The pixel format of the frame data that we pass on
+        enum AVPixelFormat src_fmt = _ffmpeg->video_pix_fmts[_video_stream];
+#if HAVE_AV_VDPAU_INTEROP
+        if (decoded_frame->format == AV_PIX_FMT_VDPAU
+                && !_ffmpeg->video_vdpau_output_failed[_video_stream]
+                && dispatch::video_output()
+                && dispatch::video_output()->supports_surface(video_frame::vdpau_surface))
+        {
+            // Zero-copy path: let the VDPAU video mixer convert the frame to BGRA
+            // on the GPU, and pass the resulting output surface to the video output.
+            VdpVideoSurface video_surface = static_cast<VdpVideoSurface>(
+                    reinterpret_cast<uintptr_t>(decoded_frame->data[3]));
+            struct vdpau_output *out = _ffmpeg->video_vdpau_outputs[_video_stream];
+            if (!out)
+            {
+                out = vdpau_output_create(_ffmpeg->video_hw_device_ctxs[_video_stream], video_surface,
+                        _frame.raw_width, _frame.raw_height, _frame.color_space);
+                _ffmpeg->video_vdpau_outputs[_video_stream] = out;
+            }
+            if (out && vdpau_output_render(out, video_surface, raw_frame))
+            {
+                _frame.surface_type = video_frame::vdpau_surface;
+                _frame.surface_device[0] = reinterpret_cast<void *>(static_cast<uintptr_t>(out->dev->device));
+                _frame.surface_device[1] = reinterpret_cast<void *>(out->dev->get_proc_address);
+                _frame.surface[raw_frame] = out->surfaces[raw_frame];
+                _frame.layout = video_frame::bgra32;
+                _frame.color_space = video_frame::srgb;
+                _frame.value_range = video_frame::u8_full;
+                have_surface = true;
+            }
+            else
+            {
+                msg::wrn(_("%s video stream %d: Cannot display hardware decoded frames directly; "
+                            "falling back to copying them."), _url.c_str(), _video_stream + 1);
+                _ffmpeg->video_vdpau_output_failed[_video_stream] = true;
+            }
+        }
+#endif
+#if HAVE_AV_HWACCEL
+        if (!have_surface && _ffmpeg->video_hw_device_ctxs[_video_stream]
+                && decoded_frame->format == _ffmpeg->video_hw_pix_fmts[_video_stream])
+        {
+            // Download the frame from the hardware surface. If the hardware can
+            // deliver our pixel format directly, request it to avoid a conversion.
+            AVFrame *hw_frame = _ffmpeg->video_hw_frames[_video_stream];
+            av_frame_unref(hw_frame);
+            enum AVPixelFormat *transfer_fmts = NULL;
+            if (av_hwframe_transfer_get_formats(decoded_frame->hw_frames_ctx,
+                        AV_HWFRAME_TRANSFER_DIRECTION_FROM, &transfer_fmts, 0) >= 0)
+            {
+                for (enum AVPixelFormat *p = transfer_fmts; *p != AV_PIX_FMT_NONE; p++)
+                {
+                    if (*p == _ffmpeg->video_pix_fmts[_video_stream])
+                    {
+                        hw_frame->format = *p;
+                        break;
+                    }
+                }
+                av_free(transfer_fmts);
+            }
+            int e = av_hwframe_transfer_data(hw_frame, decoded_frame, 0);
+            if (e < 0)
+            {
+                throw exc(str::asprintf(_("%s video stream %d: Cannot transfer hardware decoded frame: %s"),
+                            _url.c_str(), _video_stream + 1, my_av_strerror(e).c_str()));
+            }
+            decoded_frame = hw_frame;
+            video_frame::layout_t native_layout;
+            int native_bits;
+            if (_frame.layout != video_frame::bgra32
+                    && decoded_frame->format != _ffmpeg->video_pix_fmts[_video_stream]
+                    && native_pix_fmt(static_cast<enum AVPixelFormat>(decoded_frame->format), &native_layout, &native_bits)
+                    && avpicture_get_size(static_cast<enum AVPixelFormat>(decoded_frame->format),
+                        decoded_frame->width, decoded_frame->height)
+                    == avpicture_get_size(_ffmpeg->video_pix_fmts[_video_stream],
+                        decoded_frame->width, decoded_frame->height))
+            {
+                // The video output can handle the downloaded format (typically NV12
+                // or P010) itself; there is no need to convert it on the CPU.
+                bool full_range = (_frame.value_range == video_frame::u8_full
+                        || _frame.value_range == video_frame::u10_full
+                        || _frame.value_range == video_frame::u12_full
+                        || _frame.value_range == video_frame::u16_full);
+                _frame.layout = native_layout;
+                _frame.value_range = native_value_range(native_bits, full_range);
+                src_fmt = static_cast<enum AVPixelFormat>(decoded_frame->format);
+            }
+            else if (_frame.layout != video_frame::bgra32
+                    && decoded_frame->format != _ffmpeg->video_pix_fmts[_video_stream])
+            {
+                convert(decoded_frame, static_cast<enum AVPixelFormat>(decoded_frame->format),
+                        decoded_frame->width, decoded_frame->height,
+                        _ffmpeg->video_hw_sws_frames[_video_stream], _ffmpeg->video_pix_fmts[_video_stream]);
+                decoded_frame = _ffmpeg->video_hw_sws_frames[_video_stream];
+            }
+            else
+            {
+                src_fmt = static_cast<enum AVPixelFormat>(decoded_frame->format);
+            }
+        }
+#endif
+        if (have_surface)
+        {
+            // The video output reads the surface directly.
+        }
+        else if (_frame.layout == video_frame::bgra32)
+        {
+            // With hardware decoding, the source pixel format depends on what the hardware delivers.
+            convert(decoded_frame, src_fmt,
+                    _ffmpeg->video_codec_ctxs[_video_stream]->width, _frame.raw_height,
+                    _ffmpeg->video_sws_frames[_video_stream], AV_PIX_FMT_BGRA);
+            _frame.data[raw_frame][0] = _ffmpeg->video_sws_frames[_video_stream]->data[0];
+            _frame.line_size[raw_frame][0] = _ffmpeg->video_sws_frames[_video_stream]->linesize[0];
+        }
+        else
+        {
+            const AVFrame *src_frame = decoded_frame;
+            if (_raw_frames == 2 && raw_frame == 0)
+            {
+                // We need to buffer the data because FFmpeg will clubber it when decoding the next frame.
+                // The buffer has the same size for all formats that we pass on unconverted.
+                avpicture_fill(reinterpret_cast<AVPicture *>(_ffmpeg->video_buffered_frames[_video_stream]),
+                        _ffmpeg->video_buffers[_video_stream], src_fmt,
+                        _ffmpeg->video_codec_ctxs[_video_stream]->width,
+                        _ffmpeg->video_codec_ctxs[_video_stream]->height);
+                av_picture_copy(reinterpret_cast<AVPicture *>(_ffmpeg->video_buffered_frames[_video_stream]),
+                        reinterpret_cast<const AVPicture *>(decoded_frame),
+                        src_fmt,
+                        _ffmpeg->video_codec_ctxs[_video_stream]->width,
+                        _ffmpeg->video_codec_ctxs[_video_stream]->height);
+                src_frame = _ffmpeg->video_buffered_frames[_video_stream];
+            }
+            _frame.data[raw_frame][0] = src_frame->data[0];
+            _frame.data[raw_frame][1] = src_frame->data[1];
+            _frame.data[raw_frame][2] = src_frame->data[2];
+            _frame.line_size[raw_frame][0] = src_frame->linesize[0];
+            _frame.line_size[raw_frame][1] = src_frame->linesize[1];
+            _frame.line_size[raw_frame][2] = src_frame->linesize[2];
+        }
+
+        if (_ffmpeg->video_packets[_video_stream].dts != static_cast<int64_t>(AV_NOPTS_VALUE))
+        {
+            _frame.presentation_time = handle_timestamp(_ffmpeg->video_packets[_video_stream].dts * 1000000
+                    * _ffmpeg->format_ctx->streams[_ffmpeg->video_streams[_video_stream]]->time_base.num
+                    / _ffmpeg->format_ctx->streams[_ffmpeg->video_streams[_video_stream]]->time_base.den);
+        }
+        else if (_ffmpeg->video_last_timestamps[_video_stream] != std::numeric_limits<int64_t>::min())
+        {
+            msg::dbg("%s: video stream %d: no timestamp available, using a questionable guess",
+                    _url.c_str(), _video_stream);
+            _frame.presentation_time = _ffmpeg->video_last_timestamps[_video_stream];
+        }
+        else
+        {
+            msg::dbg("%s: video stream %d: no timestamp available, using a bad guess",
+                    _url.c_str(), _video_stream);
+            _frame.presentation_time = _ffmpeg->pos;
+        }
+    }
+    benchmark_stats::add(benchmark_stats::decode, decode_time);
+}
+
+video_frame_pool::~video_frame_pool()
+{
+    for (size_t i = 0; i < _buffers.size(); i++)
+    {
+        delete _buffers[i];
+    }
+}
+
+int video_frame_pool::acquire(size_t size)
+{
+    size_t i = 0;
+    while (i < _buffers.size() && _refs[i] > 0)
+    {
+        i++;
+    }
+    if (i == _buffers.size())
+    {
+        _buffers.push_back(new blob);
+        _refs.push_back(0);
+    }
+    if (_buffers[i]->size() != size)
+    {
+        _bytes = _bytes - _buffers[i]->size() + size;
+        _buffers[i]->resize(size);
+    }
+    _refs[i] = 1;
+    return i;
+}
+
+video_lookahead_thread::video_lookahead_thread(const std::string &url, struct ffmpeg_stuff *ffmpeg,
+        int video_stream, size_t depth) :
+    _url(url), _ffmpeg(ffmpeg), _video_stream(video_stream), _depth(depth), _raw_frames(1), _skip_level(0),
+    _pool(), _queue(), _current_buffer(-1),
+    _eof(false), _failed(false), _surfaces(false), _stop(false)
+{
+}
+
+void video_lookahead_thread::release_current()
+{
+    if (_current_buffer >= 0)
+    {
+        _pool.unref(_current_buffer);
+        _current_buffer = -1;
+    }
+}
+
+void video_lookahead_thread::set_skip_level(int skip_level)
+{
+    _mutex.lock();
+    _skip_level = skip_level;
+    _mutex.unlock();
+}
+
+bool video_lookahead_thread::enabled()
+{
+    _mutex.lock();
+    bool r = (_depth > 0 && !_surfaces);
+    _mutex.unlock();
+    return r;
 }
 
-read_thread::read_thread(const std::string &url, bool is_device, struct ffmpeg_stuff *ffmpeg) :
-    _url(url), _is_device(is_device), _ffmpeg(ffmpeg), _eof(false)
+bool video_lookahead_thread::have_frames()
 {
+    _mutex.lock();
+    bool r = !_queue.empty();
+    _mutex.unlock();
+    return r;
 }
 
-void read_thread::run()
+void video_lookahead_thread::run()
 {
-    while (!_eof)
+    trace::set_thread_track("video decode");
+    video_decode_thread &decoder = _ffmpeg->video_decode_threads[_video_stream];
+    _mutex.lock();
+    try
     {
-        // We need another packet if the number of queued packets for an active stream is below a threshold.
-        // For files, we often want to read ahead to avoid i/o waits. For devices, we do not want to read
-        // ahead to avoid latency.
-        const size_t video_stream_low_threshold = (_is_device ? 1 : 2);         // Often, 1 packet results in one video frame
-        const size_t audio_stream_low_threshold = (_is_device ? 1 : 5);         // Often, 3-4 packets are needed for one buffer fill
-        const size_t subtitle_stream_low_threshold = (_is_device ? 1 : 1);      // Just a guess
-        bool need_another_packet = false;
-        for (size_t i = 0; !need_another_packet && i < _ffmpeg->video_streams.size(); i++)
+        while (!_stop && !_eof && !_surfaces)
         {
-            if (_ffmpeg->format_ctx->streams[_ffmpeg->video_streams[i]]->discard == AVDISCARD_DEFAULT)
+            // The depth is given in frames, but the queue holds frame pairs for alternating stereo.
+            if (_queue.size() >= (_raw_frames == 1 ? _depth : (_depth + 1) / 2))
             {
-                _ffmpeg->video_packet_queue_mutexes[i].lock();
-                need_another_packet = _ffmpeg->video_packet_queues[i].size() < video_stream_low_threshold;
-                _ffmpeg->video_packet_queue_mutexes[i].unlock();
+                // Sleep until the player takes a frame from the queue.
+                _cond.wait(_mutex);
+                continue;
             }
-        }
-        for (size_t i = 0; !need_another_packet && i < _ffmpeg->audio_streams.size(); i++)
-        {
-            if (_ffmpeg->format_ctx->streams[_ffmpeg->audio_streams[i]]->discard == AVDISCARD_DEFAULT)
+            // Decode a frame in this thread. The queue is unlocked meanwhile
+            // so that the player can take the frames that are already there.
+            int skip_level = _skip_level;
+            _mutex.unlock();
+            try
             {
-                _ffmpeg->audio_packet_queue_mutexes[i].lock();
-                    need_another_packet = _ffmpeg->audio_packet_queues[i].size() < audio_stream_low_threshold;
-                    _ffmpeg->audio_packet_queue_mutexes[i].unlock();
+                decoder.set_raw_frames(_raw_frames);
+                decoder.set_skip_level(skip_level);
+                decoder.run();
             }
-        }
-        for (size_t i = 0; !need_another_packet && i < _ffmpeg->subtitle_streams.size(); i++)
-        {
-            if (_ffmpeg->format_ctx->streams[_ffmpeg->subtitle_streams[i]]->discard == AVDISCARD_DEFAULT)
+            catch (...)
             {
-                _ffmpeg->subtitle_packet_queue_mutexes[i].lock();
-                need_another_packet = _ffmpeg->subtitle_packet_queues[i].size() < subtitle_stream_low_threshold;
-                _ffmpeg->subtitle_packet_queue_mutexes[i].unlock();
+                _mutex.lock();
+                throw;
             }
-        }
-        if (!need_another_packet)
-        {
-            msg::dbg(_url + ": No need to read more packets.");
-            break;
-        }
-        // Read a packet.
-        msg::dbg(_url + ": Reading a packet.");
-        AVPacket packet;
-        int e = av_read_frame(_ffmpeg->format_ctx, &packet);
-        if (e < 0)
-        {
-            if (e == AVERROR_EOF)
+            video_frame frame = decoder.frame();
+            _mutex.lock();
+            if (!frame.is_valid())
             {
-                msg::dbg(_url + ": EOF.");
+                msg::dbg(_url + ": video stream " + str::from(_video_stream) + ": lookahead reached EOF.");
                 _eof = true;
-                return;
-            }
-            else
-            {
-                throw exc(str::asprintf(_("%s: %s"), _url.c_str(), my_av_strerror(e).c_str()));
             }
-        }
-        // Put the packet in the right queue.
-        bool packet_queued = false;
-        for (size_t i = 0; i < _ffmpeg->video_streams.size() && !packet_queued; i++)
-        {
-            if (packet.stream_index == _ffmpeg->video_streams[i])
+            else if (frame.surface_type != video_frame::no_surface)
             {
-                // We do not check for missing timestamps here, as we do with audio
-                // packets, for the following reasons:
-                // 1. The video decoder might fill in a timestamp for us
-                // 2. We cannot drop video packets anyway, because of their
-                //    interdependencies. We would mess up decoding.
-                if (av_dup_packet(&packet) < 0)
-                {
-                    throw exc(str::asprintf(_("%s: Cannot duplicate packet."), _url.c_str()));
-                }
-                _ffmpeg->video_packet_queue_mutexes[i].lock();
-                _ffmpeg->video_packet_queues[i].push_back(packet);
-                _ffmpeg->video_packet_queue_mutexes[i].unlock();
-                packet_queued = true;
-                msg::dbg(_url + ": "
-                        + str::from(_ffmpeg->video_packet_queues[i].size())
-                        + " packets queued in video stream " + str::from(i) + ".");
+                // We cannot keep more than one hardware surface; see the class description.
+                msg::dbg(_url + ": video stream " + str::from(_video_stream)
+                        + ": frames are in hardware surfaces; not decoding ahead.");
+                _surfaces = true;
+                _queue.push_back(std::make_pair(frame, -1));
             }
-        }
-        for (size_t i = 0; i < _ffmpeg->audio_streams.size() && !packet_queued; i++)
-        {
-            if (packet.stream_index == _ffmpeg->audio_streams[i])
+            else
             {
-                _ffmpeg->audio_packet_queue_mutexes[i].lock();
-                if (_ffmpeg->audio_packet_queues[i].empty()
-                        && _ffmpeg->audio_last_timestamps[i] == std::numeric_limits<int64_t>::min()
-                        && packet.dts == static_cast<int64_t>(AV_NOPTS_VALUE))
-                {
-                    // We have no packet in the queue and no last timestamp, probably
-                    // because we just seeked. We *need* a packet with a timestamp.
-                    msg::dbg(_url + ": audio stream " + str::from(i)
-                            + ": dropping packet because it has no timestamp");
-                }
-                else
+                // Both raw frames of a pair go into one buffer. At the end of the
+                // stream, the decoder may use the same data for both.
+                int planes = frame.planes();
+                bool same_data = (_raw_frames == 2 && frame.data[1][0] == frame.data[0][0]);
+                int copies = (_raw_frames == 2 && !same_data ? 2 : 1);
+                size_t sizes[2][3];
+                size_t size = 0;
+                for (int r = 0; r < copies; r++)
                 {
-                    if (av_dup_packet(&packet) < 0)
+                    for (int p = 0; p < planes; p++)
                     {
-                        _ffmpeg->audio_packet_queue_mutexes[i].unlock();
-                        throw exc(str::asprintf(_("%s: Cannot duplicate packet."), _url.c_str()));
+                        size_t lines = ((frame.layout == video_frame::yuv420p
+                                    || frame.layout == video_frame::yuv420sp) && p > 0
+                                ? (frame.raw_height + 1) / 2 : frame.raw_height);
+                        sizes[r][p] = frame.line_size[r][p] * lines;
+                        size += sizes[r][p];
                     }
-                    _ffmpeg->audio_packet_queues[i].push_back(packet);
-                    packet_queued = true;
-                    msg::dbg(_url + ": "
-                            + str::from(_ffmpeg->audio_packet_queues[i].size())
-                            + " packets queued in audio stream " + str::from(i) + ".");
-                }
-                _ffmpeg->audio_packet_queue_mutexes[i].unlock();
-            }
-        }
-        for (size_t i = 0; i < _ffmpeg->subtitle_streams.size() && !packet_queued; i++)
-        {
-            if (packet.stream_index == _ffmpeg->subtitle_streams[i])
-            {
-                _ffmpeg->subtitle_packet_queue_mutexes[i].lock();
-                if (_ffmpeg->subtitle_packet_queues[i].empty()
-                        && _ffmpeg->subtitle_last_timestamps[i] == std::numeric_limits<int64_t>::min()
-                        && packet.dts == static_cast<int64_t>(AV_NOPTS_VALUE))
-                {
-                    // We have no packet in the queue and no last timestamp, probably
-                    // because we just seeked. We want a packet with a timestamp.
-                    msg::dbg(_url + ": subtitle stream " + str::from(i)
-                            + ": dropping packet because it has no timestamp");
                 }
-                else
+                size_t pool_bytes = _pool.bytes();
+                int buffer = _pool.acquire(size);
+                account_memory(_ffmpeg, &(_ffmpeg->video_memory), _pool.bytes(), pool_bytes);
+                char *ptr = static_cast<char *>(_pool.ptr(buffer));
+                // The buffer belongs to this thread until it is queued.
+                _mutex.unlock();
+                for (int r = 0; r < copies; r++)
                 {
-                    if (av_dup_packet(&packet) < 0)
+                    for (int p = 0; p < planes; p++)
                     {
-                        _ffmpeg->subtitle_packet_queue_mutexes[i].unlock();
-                        throw exc(str::asprintf(_("%s: Cannot duplicate packet."), _url.c_str()));
+                        video_frame::copy_data(ptr, frame.data[r][p], sizes[r][p]);
+                        frame.data[r][p] = ptr;
+                        ptr += sizes[r][p];
                     }
-                    _ffmpeg->subtitle_packet_queues[i].push_back(packet);
-                    packet_queued = true;
-                    msg::dbg(_url + ": "
-                            + str::from(_ffmpeg->subtitle_packet_queues[i].size())
-                            + " packets queued in subtitle stream " + str::from(i) + ".");
                 }
-                _ffmpeg->subtitle_packet_queue_mutexes[i].unlock();
+                if (same_data)
+                {
+                    frame.set_view_data(1, frame, 0);
+                }
+                _mutex.lock();
+                _queue.push_back(std::make_pair(frame, buffer));
+                msg::dbg("%s: %lu frames decoded ahead in video stream %d.", _url.c_str(),
+                        static_cast<unsigned long>(_queue.size()), _video_stream);
             }
+            _cond.wake_all();
         }
-        if (!packet_queued)
-        {
-            av_free_packet(&packet);
-        }
     }
+    catch (...)
+    {
+        _failed = true;
+        _cond.wake_all();
+        _mutex.unlock();
+        throw;
+    }
+    _mutex.unlock();
 }
 
-void read_thread::reset()
+void video_lookahead_thread::stop()
 {
-    exception() = exc();
-    _eof = false;
+    _mutex.lock();
+    _stop = true;
+    _cond.wake_all();
+    _mutex.unlock();
+    wait();
+    _stop = false;
+    if (!exception().empty())
+    {
+        throw exception();
+    }
 }
 
-video_decode_thread::video_decode_thread(const std::string &url, struct ffmpeg_stuff *ffmpeg, int video_stream) :
-    _url(url), _ffmpeg(ffmpeg), _video_stream(video_stream), _frame(), _raw_frames(1)
+void video_lookahead_thread::clear()
 {
+    for (size_t i = 0; i < _queue.size(); i++)
+    {
+        if (_queue[i].second >= 0)
+        {
+            _pool.unref(_queue[i].second);
+        }
+    }
+    _queue.clear();
+    exception() = exc();
+    _eof = false;
+    _failed = false;
+    _surfaces = false;
 }
 
-int64_t video_decode_thread::handle_timestamp(int64_t timestamp)
+bool video_lookahead_thread::skip_to(int64_t pos)
 {
-    int64_t ts = timestamp_helper(_ffmpeg->video_last_timestamps[_video_stream], timestamp);
-    if (!_ffmpeg->have_active_audio_stream || _ffmpeg->pos == std::numeric_limits<int64_t>::min())
+    int64_t frame_duration = video_frame_duration(
+            _ffmpeg->format_ctx->streams[_ffmpeg->video_streams[_video_stream]]);
+    while (!_queue.empty() && _queue.front().first.presentation_time + frame_duration <= pos)
     {
-        _ffmpeg->pos = ts;
+        if (_queue.front().second >= 0)
+        {
+            _pool.unref(_queue.front().second);
+        }
+        _queue.pop_front();
     }
-    return ts;
+    return !_queue.empty();
 }
 
-void video_decode_thread::run()
+video_frame video_lookahead_thread::get_frame()
 {
-    _frame = _ffmpeg->video_frame_templates[_video_stream];
-    for (int raw_frame = 0; raw_frame < _raw_frames; raw_frame++)
+    _mutex.lock();
+    release_current();
+    while (_queue.empty() && !_eof && !_surfaces && !_failed)
     {
-        int frame_finished = 0;
-read_frame:
-        do
-        {
-            bool empty;
-            do
-            {
-                _ffmpeg->video_packet_queue_mutexes[_video_stream].lock();
-                empty = _ffmpeg->video_packet_queues[_video_stream].empty();
-                _ffmpeg->video_packet_queue_mutexes[_video_stream].unlock();
-                if (empty)
-                {
-                    if (_ffmpeg->reader->eof())
-                    {
-                        if (raw_frame == 1)
-                        {
-                            _frame.data[1][0] = _frame.data[0][0];
-                            _frame.data[1][1] = _frame.data[0][1];
-                            _frame.data[1][2] = _frame.data[0][2];
-                            _frame.line_size[1][0] = _frame.line_size[0][0];
-                            _frame.line_size[1][1] = _frame.line_size[0][1];
-                            _frame.line_size[1][2] = _frame.line_size[0][2];
-                        }
-                        else
-                        {
-                            _frame = video_frame();
-                        }
-                        return;
-                    }
-                    msg::dbg(_url + ": video stream " + str::from(_video_stream) + ": need to wait for packets...");
-                    _ffmpeg->reader->start();
-                    _ffmpeg->reader->finish();
-                }
-            }
-            while (empty);
-            av_free_packet(&(_ffmpeg->video_packets[_video_stream]));
-            _ffmpeg->video_packet_queue_mutexes[_video_stream].lock();
-            _ffmpeg->video_packets[_video_stream] = _ffmpeg->video_packet_queues[_video_stream].front();
-            _ffmpeg->video_packet_queues[_video_stream].pop_front();
-            _ffmpeg->video_packet_queue_mutexes[_video_stream].unlock();
-            _ffmpeg->reader->start();       // Refill the packet queue
-            avcodec_decode_video2(_ffmpeg->video_codec_ctxs[_video_stream],
-                    _ffmpeg->video_frames[_video_stream], &frame_finished,
-                    &(_ffmpeg->video_packets[_video_stream]));
-        }
-        while (!frame_finished);
-        if (_ffmpeg->video_frames[_video_stream]->width != _ffmpeg->video_frame_templates[_video_stream].raw_width
-                || _ffmpeg->video_frames[_video_stream]->height != _ffmpeg->video_frame_templates[_video_stream].raw_height)
-        {
-            msg::wrn(_("%s video stream %d: Dropping %dx%d frame"), _url.c_str(), _video_stream + 1, 
-                    _ffmpeg->video_frames[_video_stream]->width, _ffmpeg->video_frames[_video_stream]->height);
-            goto read_frame;
-        }
-        if (_frame.layout == video_frame::bgra32)
-        {
-            sws_scale(_ffmpeg->video_sws_ctxs[_video_stream],
-                    _ffmpeg->video_frames[_video_stream]->data,
-                    _ffmpeg->video_frames[_video_stream]->linesize,
-                    0, _frame.raw_height,
-                    _ffmpeg->video_sws_frames[_video_stream]->data,
-                    _ffmpeg->video_sws_frames[_video_stream]->linesize);
-            // TODO: Handle sws_scale errors. How?
-            _frame.data[raw_frame][0] = _ffmpeg->video_sws_frames[_video_stream]->data[0];
-            _frame.line_size[raw_frame][0] = _ffmpeg->video_sws_frames[_video_stream]->linesize[0];
-        }
-        else
+        msg::dbg("%s: video stream %d: need to wait for a frame...", _url.c_str(), _video_stream);
+        start();        // does nothing if the thread is already running
+        _cond.wait(_mutex);
+    }
+    if (_queue.empty())
+    {
+        bool failed = _failed;
+        _mutex.unlock();
+        if (failed)
         {
-            const AVFrame *src_frame = _ffmpeg->video_frames[_video_stream];
-            if (_raw_frames == 2 && raw_frame == 0)
-            {
-                // We need to buffer the data because FFmpeg will clubber it when decoding the next frame.
-                av_picture_copy(reinterpret_cast<AVPicture *>(_ffmpeg->video_buffered_frames[_video_stream]),
-                        reinterpret_cast<AVPicture *>(_ffmpeg->video_frames[_video_stream]),
-                        static_cast<enum AVPixelFormat>(_ffmpeg->video_codec_ctxs[_video_stream]->pix_fmt),
-                        _ffmpeg->video_codec_ctxs[_video_stream]->width,
-                        _ffmpeg->video_codec_ctxs[_video_stream]->height);
-                src_frame = _ffmpeg->video_buffered_frames[_video_stream];
-            }
-            _frame.data[raw_frame][0] = src_frame->data[0];
-            _frame.data[raw_frame][1] = src_frame->data[1];
-            _frame.data[raw_frame][2] = src_frame->data[2];
-            _frame.line_size[raw_frame][0] = src_frame->linesize[0];
-            _frame.line_size[raw_frame][1] = src_frame->linesize[1];
-            _frame.line_size[raw_frame][2] = src_frame->linesize[2];
+            finish();
         }
+        return video_frame();
+    }
+    video_frame frame = _queue.front().first;
+    _current_buffer = _queue.front().second;
+    _queue.pop_front();
+    if (!_eof && !_surfaces)
+    {
+        start();        // refill the queue
+    }
+    _cond.wake_all();
+    _mutex.unlock();
+    return frame;
+}
 
-        if (_ffmpeg->video_packets[_video_stream].dts != static_cast<int64_t>(AV_NOPTS_VALUE))
-        {
-            _frame.presentation_time = handle_timestamp(_ffmpeg->video_packets[_video_stream].dts * 1000000
-                    * _ffmpeg->format_ctx->streams[_ffmpeg->video_streams[_video_stream]]->time_base.num
-                    / _ffmpeg->format_ctx->streams[_ffmpeg->video_streams[_video_stream]]->time_base.den);
-        }
-        else if (_ffmpeg->video_last_timestamps[_video_stream] != std::numeric_limits<int64_t>::min())
-        {
-            msg::dbg(_url + ": video stream " + str::from(_video_stream)
-                    + ": no timestamp available, using a questionable guess");
-            _frame.presentation_time = _ffmpeg->video_last_timestamps[_video_stream];
-        }
-        else
+void media_object::start_video_frame_read(int video_stream, int raw_frames)
+{
+    assert(video_stream >= 0);
+    assert(video_stream < video_streams());
+    assert(raw_frames == 1 || raw_frames == 2);
+    video_lookahead_thread *lookahead = _ffmpeg->video_lookahead_threads[video_stream];
+    if (lookahead->raw_frames() != raw_frames)
+    {
+        // The stereo layout changed. Frames that were decoded ahead for the
+        // old layout cannot be used, so throw them away.
+        lookahead->stop();
+        if (lookahead->have_frames())
         {
-            msg::dbg(_url + ": video stream " + str::from(_video_stream)
-                    + ": no timestamp available, using a bad guess");
-            _frame.presentation_time = _ffmpeg->pos;
+            msg::dbg(_url + ": video stream " + str::from(video_stream) + ": discarding frames decoded ahead.");
         }
+        lookahead->clear();
+        lookahead->set_raw_frames(raw_frames);
+    }
+    _ffmpeg->video_lookahead_reads[video_stream] = (lookahead->enabled() || lookahead->have_frames());
+    if (_ffmpeg->video_lookahead_reads[video_stream])
+    {
+        lookahead->start();
+    }
+    else
+    {
+        _ffmpeg->video_decode_threads[video_stream].set_raw_frames(raw_frames);
+        _ffmpeg->video_decode_threads[video_stream].set_skip_level(_ffmpeg->video_skip_levels[video_stream]);
+        _ffmpeg->video_decode_threads[video_stream].start();
     }
 }
 
-void media_object::start_video_frame_read(int video_stream, int raw_frames)
+void media_object::set_video_skip_level(int video_stream, int level)
 {
     assert(video_stream >= 0);
     assert(video_stream < video_streams());
-    assert(raw_frames == 1 || raw_frames == 2);
-    _ffmpeg->video_decode_threads[video_stream].set_raw_frames(raw_frames);
-    _ffmpeg->video_decode_threads[video_stream].start();
+    assert(level >= 0 && level <= max_video_skip_level);
+    if (_ffmpeg->video_skip_levels[video_stream] != level)
+    {
+        msg::dbg(_url + ": video stream " + str::from(video_stream) + ": decoder skip level " + str::from(level));
+        _ffmpeg->video_skip_levels[video_stream] = level;
+        _ffmpeg->video_lookahead_threads[video_stream]->set_skip_level(level);
+    }
 }
 
 video_frame media_object::finish_video_frame_read(int video_stream)
 {
     assert(video_stream >= 0);
     assert(video_stream < video_streams());
-    _ffmpeg->video_decode_threads[video_stream].finish();
-    return _ffmpeg->video_decode_threads[video_stream].frame();
+    video_frame frame;
+    if (_ffmpeg->video_lookahead_reads[video_stream])
+    {
+        frame = _ffmpeg->video_lookahead_threads[video_stream]->get_frame();
+    }
+    else
+    {
+        _ffmpeg->video_decode_threads[video_stream].finish();
+        frame = _ffmpeg->video_decode_threads[video_stream].frame();
+    }
+    if (frame.is_valid() && (!_ffmpeg->have_active_audio_stream
+                || _ffmpeg->pos == std::numeric_limits<int64_t>::min()))
+    {
+        _ffmpeg->pos = frame.presentation_time;
+    }
+    return frame;
 }
 
 audio_decode_thread::audio_decode_thread(const std::string &url, struct ffmpeg_stuff *ffmpeg, int audio_stream) :
@@ -1587,6 +4303,17 @@ audio_decode_thread::audio_decode_thread(const std::string &url, struct ffmpeg_s
 {
 }
 
+void audio_decode_thread::buffer(const void *data, size_t n)
+{
+    audio_ring &ring = _ffmpeg->audio_buffers[_audio_stream];
+    size_t capacity = ring.capacity();
+    ring.write(data, n);
+    if (ring.capacity() != capacity)
+    {
+        account_memory(_ffmpeg, &(_ffmpeg->audio_memory), ring.capacity(), capacity);
+    }
+}
+
 int64_t audio_decode_thread::handle_timestamp(int64_t timestamp)
 {
     int64_t ts = timestamp_helper(_ffmpeg->audio_last_timestamps[_audio_stream], timestamp);
@@ -1596,6 +4323,8 @@ int64_t audio_decode_thread::handle_timestamp(int64_t timestamp)
 
 void audio_decode_thread::run()
 {
+    trace::set_thread_track("audio decode");
+    trace_scope decode_trace("decode audio");
     size_t size = _ffmpeg->audio_blobs[_audio_stream].size();
     void *buffer = _ffmpeg->audio_blobs[_audio_stream].ptr();
     int64_t timestamp = std::numeric_limits<int64_t>::min();
@@ -1605,11 +4334,7 @@ void audio_decode_thread::run()
         if (_ffmpeg->audio_buffers[_audio_stream].size() > 0)
         {
             // Use available decoded audio data
-            size_t remaining = std::min(size - i, _ffmpeg->audio_buffers[_audio_stream].size());
-            memcpy(buffer, &(_ffmpeg->audio_buffers[_audio_stream][0]), remaining);
-            _ffmpeg->audio_buffers[_audio_stream].erase(
-                    _ffmpeg->audio_buffers[_audio_stream].begin(),
-                    _ffmpeg->audio_buffers[_audio_stream].begin() + remaining);
+            size_t remaining = _ffmpeg->audio_buffers[_audio_stream].read(buffer, size - i);
             buffer = reinterpret_cast<unsigned char *>(buffer) + remaining;
             i += remaining;
         }
@@ -1617,31 +4342,30 @@ void audio_decode_thread::run()
         {
             // Read more audio data
             AVPacket packet, tmppacket;
-            bool empty;
-            do
+            if (!_ffmpeg->reader->get_packet(_ffmpeg->audio_packet_queues[_audio_stream], &packet))
+            {
+                _blob = audio_blob();
+                return;
+            }
+            // After a seek, drop the data before the seek target. The packet is still
+            // decoded to keep the decoder state intact.
+            bool drop = false;
+            if (_ffmpeg->audio_seek_targets[_audio_stream] != std::numeric_limits<int64_t>::min()
+                    && packet.dts != static_cast<int64_t>(AV_NOPTS_VALUE))
             {
-                _ffmpeg->audio_packet_queue_mutexes[_audio_stream].lock();
-                empty = _ffmpeg->audio_packet_queues[_audio_stream].empty();
-                _ffmpeg->audio_packet_queue_mutexes[_audio_stream].unlock();
-                if (empty)
+                AVStream *stream = _ffmpeg->format_ctx->streams[_ffmpeg->audio_streams[_audio_stream]];
+                int64_t packet_end = (packet.dts + (packet.duration > 0 ? packet.duration : 0)) * 1000000
+                    * stream->time_base.num / stream->time_base.den;
+                if (packet_end <= _ffmpeg->audio_seek_targets[_audio_stream])
                 {
-                    if (_ffmpeg->reader->eof())
-                    {
-                        _blob = audio_blob();
-                        return;
-                    }
-                    msg::dbg(_url + ": audio stream " + str::from(_audio_stream) + ": need to wait for packets...");
-                    _ffmpeg->reader->start();
-                    _ffmpeg->reader->finish();
+                    drop = true;
+                }
+                else
+                {
+                    _ffmpeg->audio_seek_targets[_audio_stream] = std::numeric_limits<int64_t>::min();
                 }
             }
-            while (empty);
-            _ffmpeg->audio_packet_queue_mutexes[_audio_stream].lock();
-            packet = _ffmpeg->audio_packet_queues[_audio_stream].front();
-            _ffmpeg->audio_packet_queues[_audio_stream].pop_front();
-            _ffmpeg->audio_packet_queue_mutexes[_audio_stream].unlock();
-            _ffmpeg->reader->start();   // Refill the packet queue
-            if (timestamp == std::numeric_limits<int64_t>::min() && packet.dts != static_cast<int64_t>(AV_NOPTS_VALUE))
+            if (!drop && timestamp == std::numeric_limits<int64_t>::min() && packet.dts != static_cast<int64_t>(AV_NOPTS_VALUE))
             {
                 timestamp = packet.dts * 1000000
                     * _ffmpeg->format_ctx->streams[_ffmpeg->audio_streams[_audio_stream]]->time_base.num
@@ -1663,7 +4387,7 @@ void audio_decode_thread::run()
                 }
                 tmppacket.data += len;
                 tmppacket.size -= len;
-                if (!got_frame)
+                if (!got_frame || drop)
                 {
                     continue;
                 }
@@ -1672,28 +4396,28 @@ void audio_decode_thread::run()
                         _ffmpeg->audio_codec_ctxs[_audio_stream]->channels,
                         audioframe.nb_samples,
                         _ffmpeg->audio_codec_ctxs[_audio_stream]->sample_fmt, 1);
-                if (av_sample_fmt_is_planar(_ffmpeg->audio_codec_ctxs[_audio_stream]->sample_fmt)
-                        && _ffmpeg->audio_codec_ctxs[_audio_stream]->channels > 1)
+                bool planar = (av_sample_fmt_is_planar(_ffmpeg->audio_codec_ctxs[_audio_stream]->sample_fmt)
+                        && _ffmpeg->audio_codec_ctxs[_audio_stream]->channels > 1);
+                bool s32 = (av_get_packed_sample_fmt(_ffmpeg->audio_codec_ctxs[_audio_stream]->sample_fmt)
+                        == AV_SAMPLE_FMT_S32);
+                if (!planar && !s32)
                 {
-                    int dummy;
-                    int sample_size = av_samples_get_buffer_size(&dummy, 1, 1,
-                            _ffmpeg->audio_codec_ctxs[_audio_stream]->sample_fmt, 1);
-                    uint8_t *out = reinterpret_cast<uint8_t *>(&(_ffmpeg->audio_tmpbufs[_audio_stream][0]));
-                    for (int s = 0; s < audioframe.nb_samples; s++)
-                    {
-                        for (int c = 0; c < _ffmpeg->audio_codec_ctxs[_audio_stream]->channels; c++)
-                        {
-                            std::memcpy(out, audioframe.extended_data[c] + s * sample_size, sample_size);
-                            out += sample_size;
-                        }
-                    }
+                    // The data can be used as is: put it directly in the decoded audio data buffer
+                    buffer(audioframe.extended_data[0], plane_size);
+                    continue;
+                }
+                if (planar)
+                {
+                    audio_blob::interleave(_ffmpeg->audio_tmpbufs[_audio_stream], audioframe.extended_data,
+                            _ffmpeg->audio_codec_ctxs[_audio_stream]->channels, audioframe.nb_samples,
+                            av_get_bytes_per_sample(_ffmpeg->audio_codec_ctxs[_audio_stream]->sample_fmt));
                 }
                 else
                 {
                     std::memcpy(&(_ffmpeg->audio_tmpbufs[_audio_stream][0]), audioframe.extended_data[0], plane_size);
                 }
                 // Put it in the decoded audio data buffer
-                if (_ffmpeg->audio_codec_ctxs[_audio_stream]->sample_fmt == AV_SAMPLE_FMT_S32)
+                if (s32)
                 {
                     // we need to convert this to AV_SAMPLE_FMT_FLT
                     assert(sizeof(int32_t) == sizeof(float));
@@ -1710,9 +4434,7 @@ void audio_decode_thread::run()
                         tmpbuf_flt[j] = sample_flt;
                     }
                 }
-                size_t old_size = _ffmpeg->audio_buffers[_audio_stream].size();
-                _ffmpeg->audio_buffers[_audio_stream].resize(old_size + tmpbuf_size);
-                memcpy(&(_ffmpeg->audio_buffers[_audio_stream][old_size]), _ffmpeg->audio_tmpbufs[_audio_stream], tmpbuf_size);
+                buffer(_ffmpeg->audio_tmpbufs[_audio_stream], tmpbuf_size);
             }
 
             av_free_packet(&packet);
@@ -1724,8 +4446,8 @@ void audio_decode_thread::run()
     }
     if (timestamp == std::numeric_limits<int64_t>::min())
     {
-        msg::dbg(_url + ": audio stream " + str::from(_audio_stream)
-                + ": no timestamp available, using a bad guess");
+        msg::dbg("%s: audio stream %d: no timestamp available, using a bad guess",
+                _url.c_str(), _audio_stream);
         timestamp = _ffmpeg->pos;
     }
 
@@ -1739,7 +4461,11 @@ void media_object::start_audio_blob_read(int audio_stream, size_t size)
 {
     assert(audio_stream >= 0);
     assert(audio_stream < audio_streams());
-    _ffmpeg->audio_blobs[audio_stream].resize(size);
+    if (_ffmpeg->audio_blobs[audio_stream].size() != size)
+    {
+        account_memory(_ffmpeg, &(_ffmpeg->audio_memory), size, _ffmpeg->audio_blobs[audio_stream].size());
+        _ffmpeg->audio_blobs[audio_stream].resize(size);
+    }
     _ffmpeg->audio_decode_threads[audio_stream].start();
 }
 
@@ -1765,35 +4491,16 @@ int64_t subtitle_decode_thread::handle_timestamp(int64_t timestamp)
 
 void subtitle_decode_thread::run()
 {
-    if (_ffmpeg->subtitle_box_buffers[_subtitle_stream].empty())
+    trace::set_thread_track("subtitle decode");
+    trace_scope decode_trace("decode subtitle");
+    // Wait for subtitle data only if no decoded subtitle is left, but decode all
+    // packets that were already read. Upcoming subtitles are then decoded ahead and
+    // ready when the player asks for them.
+    AVPacket packet, tmppacket;
+    while (_ffmpeg->subtitle_box_buffers[_subtitle_stream].empty()
+            ? _ffmpeg->reader->get_packet(_ffmpeg->subtitle_packet_queues[_subtitle_stream], &packet)
+            : _ffmpeg->reader->get_queued_packet(_ffmpeg->subtitle_packet_queues[_subtitle_stream], &packet))
     {
-        // Read more subtitle data
-        AVPacket packet, tmppacket;
-        bool empty;
-        do
-        {
-            _ffmpeg->subtitle_packet_queue_mutexes[_subtitle_stream].lock();
-            empty = _ffmpeg->subtitle_packet_queues[_subtitle_stream].empty();
-            _ffmpeg->subtitle_packet_queue_mutexes[_subtitle_stream].unlock();
-            if (empty)
-            {
-                if (_ffmpeg->reader->eof())
-                {
-                    _box = subtitle_box();
-                    return;
-                }
-                msg::dbg(_url + ": subtitle stream " + str::from(_subtitle_stream) + ": need to wait for packets...");
-                _ffmpeg->reader->start();
-                _ffmpeg->reader->finish();
-            }
-        }
-        while (empty);
-        _ffmpeg->subtitle_packet_queue_mutexes[_subtitle_stream].lock();
-        packet = _ffmpeg->subtitle_packet_queues[_subtitle_stream].front();
-        _ffmpeg->subtitle_packet_queues[_subtitle_stream].pop_front();
-        _ffmpeg->subtitle_packet_queue_mutexes[_subtitle_stream].unlock();
-        _ffmpeg->reader->start();   // Refill the packet queue
-
         // Decode subtitle data
         int64_t timestamp = packet.pts * 1000000
             * _ffmpeg->format_ctx->streams[_ffmpeg->subtitle_streams[_subtitle_stream]]->time_base.num
@@ -1818,6 +4525,7 @@ void subtitle_decode_thread::run()
             box.str = reinterpret_cast<const char *>(packet.data);
 
             _ffmpeg->subtitle_box_buffers[_subtitle_stream].push_back(box);
+            account_memory(_ffmpeg, &(_ffmpeg->subtitle_memory), subtitle_box_bytes(box), 0);
 
             tmppacket.size = 0;
         }
@@ -1854,12 +4562,12 @@ void subtitle_decode_thread::run()
                     box.images.back().x = rect->x;
                     box.images.back().y = rect->y;
                     box.images.back().palette.resize(4 * rect->nb_colors);
-                    std::memcpy(&(box.images.back().palette[0]), rect->pict.data[1],
+                    std::memcpy(box.images.back().palette.ptr(), rect->pict.data[1],
                             box.images.back().palette.size());
                     box.images.back().linesize = rect->pict.linesize[0];
                     box.images.back().data.resize(box.images.back().h * box.images.back().linesize);
-                    std::memcpy(&(box.images.back().data[0]), rect->pict.data[0],
-                            box.images.back().data.size() * sizeof(uint8_t));
+                    std::memcpy(box.images.back().data.ptr(), rect->pict.data[0],
+                            box.images.back().data.size());
                     break;
                 case SUBTITLE_TEXT:
                     box.format = subtitle_box::text;
@@ -1888,6 +4596,7 @@ void subtitle_decode_thread::run()
                 }
             }
             _ffmpeg->subtitle_box_buffers[_subtitle_stream].push_back(box);
+            account_memory(_ffmpeg, &(_ffmpeg->subtitle_memory), subtitle_box_bytes(box), 0);
             avsubtitle_free(&subtitle);
         }
 
@@ -1900,6 +4609,7 @@ void subtitle_decode_thread::run()
     }
     _box = _ffmpeg->subtitle_box_buffers[_subtitle_stream].front();
     _ffmpeg->subtitle_box_buffers[_subtitle_stream].pop_front();
+    account_memory(_ffmpeg, &(_ffmpeg->subtitle_memory), 0, subtitle_box_bytes(_box));
 }
 
 void media_object::start_subtitle_box_read(int subtitle_stream)
@@ -1922,13 +4632,30 @@ int64_t media_object::tell()
     return _ffmpeg->pos;
 }
 
-void media_object::seek(int64_t dest_pos)
+int64_t media_object::keyframe_position(int video_stream, int64_t pos) const
+{
+    AVStream *stream = _ffmpeg->format_ctx->streams[_ffmpeg->video_streams[video_stream]];
+    const std::vector<int64_t> &keyframes = _ffmpeg->video_keyframes[video_stream];
+    int64_t ts = pos * stream->time_base.den / 1000000 / stream->time_base.num;
+    int64_t keyframe_pos = std::numeric_limits<int64_t>::min();
+    _ffmpeg->video_keyframes_mutex.lock();
+    std::vector<int64_t>::const_iterator it = std::upper_bound(keyframes.begin(), keyframes.end(), ts);
+    if (it != keyframes.begin())
+    {
+        keyframe_pos = *(it - 1) * 1000000 * stream->time_base.num / stream->time_base.den;
+    }
+    _ffmpeg->video_keyframes_mutex.unlock();
+    return keyframe_pos;
+}
+
+void media_object::seek(int64_t dest_pos, bool keyframe_only)
 {
     msg::dbg(_url + ": Seeking from " + str::from(_ffmpeg->pos / 1e6f) + " to " + str::from(dest_pos / 1e6f) + ".");
 
     // Stop decoder threads
     for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
     {
+        _ffmpeg->video_lookahead_threads[i]->stop();
         _ffmpeg->video_decode_threads[i].finish();
     }
     for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
@@ -1939,40 +4666,95 @@ void media_object::seek(int64_t dest_pos)
     {
         _ffmpeg->subtitle_decode_threads[i].finish();
     }
+
+    // Find the active video stream and the last known key frame before the destination.
+    // The key frame index is built while reading; see read_thread::queue_packet().
+    int video_stream = -1;
+    for (size_t i = 0; i < _ffmpeg->video_streams.size() && video_stream < 0; i++)
+    {
+        if (_ffmpeg->format_ctx->streams[_ffmpeg->video_streams[i]]->discard == AVDISCARD_DEFAULT)
+        {
+            video_stream = i;
+        }
+    }
+    int64_t keyframe = std::numeric_limits<int64_t>::min();     // in stream time base
+    int64_t keyframe_pos = std::numeric_limits<int64_t>::min(); // in microseconds
+    if (video_stream >= 0 && dest_pos != std::numeric_limits<int64_t>::min())
+    {
+        AVStream *stream = _ffmpeg->format_ctx->streams[_ffmpeg->video_streams[video_stream]];
+        const std::vector<int64_t> &keyframes = _ffmpeg->video_keyframes[video_stream];
+        int64_t dest_ts = dest_pos * stream->time_base.den / 1000000 / stream->time_base.num;
+        _ffmpeg->video_keyframes_mutex.lock();
+        std::vector<int64_t>::const_iterator it = std::upper_bound(keyframes.begin(), keyframes.end(), dest_ts);
+        if (it != keyframes.begin())
+        {
+            keyframe = *(it - 1);
+            keyframe_pos = keyframe * 1000000 * stream->time_base.num / stream->time_base.den;
+        }
+        _ffmpeg->video_keyframes_mutex.unlock();
+    }
+    // The decoders pick this up when they are restarted.
+    _ffmpeg->video_keyframes_only = keyframe_only;
+
+    // If the destination is a bit ahead and there is no key frame in between,
+    // it is faster to simply decode forward: keep the reader, the queued packets,
+    // and the decoder states, and drop everything before the destination.
+    // A preview shows the key frame itself, so this does not apply to it.
+    // The video decoder drops single frames only, so frame pairs (alternating
+    // stereo) would fall behind the audio; this does not apply to them either.
+    const int64_t max_decode_forward = 3000000;
+    bool single_frames = true;
+    for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
+    {
+        if (_ffmpeg->video_lookahead_threads[i]->raw_frames() != 1)
+        {
+            single_frames = false;
+        }
+    }
+    if (!keyframe_only && single_frames && _ffmpeg->pos != std::numeric_limits<int64_t>::min()
+            && dest_pos >= _ffmpeg->pos && dest_pos - _ffmpeg->pos <= max_decode_forward
+            && (video_stream < 0 || keyframe_pos <= _ffmpeg->pos))
+    {
+        msg::dbg(_url + ": Decoding forward to " + str::from(dest_pos / 1e6f) + ".");
+        for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
+        {
+            // Frames that were decoded ahead may already reach the destination.
+            _ffmpeg->video_seek_targets[i] = (_ffmpeg->video_lookahead_threads[i]->skip_to(dest_pos)
+                    ? std::numeric_limits<int64_t>::min() : dest_pos);
+        }
+        for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
+        {
+            _ffmpeg->audio_seek_targets[i] = dest_pos;
+        }
+        return;
+    }
+
     // Stop reading packets
-    _ffmpeg->reader->finish();
+    _ffmpeg->reader->stop();
     // Throw away all queued packets and buffered data
     for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
     {
         avcodec_flush_buffers(_ffmpeg->format_ctx->streams[_ffmpeg->video_streams[i]]->codec);
-        for (size_t j = 0; j < _ffmpeg->video_packet_queues[i].size(); j++)
-        {
-            av_free_packet(&_ffmpeg->video_packet_queues[i][j]);
-        }
         _ffmpeg->video_packet_queues[i].clear();
+        _ffmpeg->video_lookahead_threads[i]->clear();
     }
     for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
     {
-        avcodec_flush_buffers(_ffmpeg->format_ctx->streams[_ffmpeg->audio_streams[i]]->codec);
-        _ffmpeg->audio_buffers[i].clear();
-        for (size_t j = 0; j < _ffmpeg->audio_packet_queues[i].size(); j++)
+        if (_ffmpeg->audio_codecs_open[i])
         {
-            av_free_packet(&_ffmpeg->audio_packet_queues[i][j]);
+            avcodec_flush_buffers(_ffmpeg->audio_codec_ctxs[i]);
         }
+        _ffmpeg->audio_buffers[i].clear();
         _ffmpeg->audio_packet_queues[i].clear();
     }
     for (size_t i = 0; i < _ffmpeg->subtitle_streams.size(); i++)
     {
-        if (_ffmpeg->format_ctx->streams[_ffmpeg->subtitle_streams[i]]->codec->codec_id != AV_CODEC_ID_TEXT)
-        {
-            // AV_CODEC_ID_TEXT has no decoder, so we cannot flush its buffers
-            avcodec_flush_buffers(_ffmpeg->format_ctx->streams[_ffmpeg->subtitle_streams[i]]->codec);
-        }
-        _ffmpeg->subtitle_box_buffers[i].clear();
-        for (size_t j = 0; j < _ffmpeg->subtitle_packet_queues[i].size(); j++)
+        if (_ffmpeg->subtitle_codecs_open[i])
         {
-            av_free_packet(&_ffmpeg->subtitle_packet_queues[i][j]);
+            // AV_CODEC_ID_TEXT has no decoder and is therefore never open
+            avcodec_flush_buffers(_ffmpeg->subtitle_codec_ctxs[i]);
         }
+        clear_subtitle_box_buffer(_ffmpeg, i);
         _ffmpeg->subtitle_packet_queues[i].clear();
     }
     // The next read request must update the position
@@ -1989,14 +4771,38 @@ void media_object::seek(int64_t dest_pos)
         _ffmpeg->subtitle_last_timestamps[i] = std::numeric_limits<int64_t>::min();
     }
     _ffmpeg->pos = std::numeric_limits<int64_t>::min();
-    // Seek
-    int e = av_seek_frame(_ffmpeg->format_ctx, -1,
-            dest_pos * AV_TIME_BASE / 1000000,
-            dest_pos < _ffmpeg->pos ?  AVSEEK_FLAG_BACKWARD : 0);
+    // Seek. If we know a key frame before the destination, seek to it directly.
+    // Otherwise, seek to a key frame before the destination if possible.
+    // In both cases, the frames up to the destination are dropped after decoding.
+    int e = -1;
+    if (keyframe != std::numeric_limits<int64_t>::min())
+    {
+        e = av_seek_frame(_ffmpeg->format_ctx, _ffmpeg->video_streams[video_stream],
+                keyframe, AVSEEK_FLAG_BACKWARD);
+    }
+    if (e < 0)
+    {
+        e = av_seek_frame(_ffmpeg->format_ctx, -1,
+                dest_pos * AV_TIME_BASE / 1000000, AVSEEK_FLAG_BACKWARD);
+    }
+    if (e < 0)
+    {
+        e = av_seek_frame(_ffmpeg->format_ctx, -1,
+                dest_pos * AV_TIME_BASE / 1000000, 0);
+    }
     if (e < 0)
     {
         msg::err(_("%s: Seeking failed."), _url.c_str());
     }
+    for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
+    {
+        // A preview shows the first decoded key frame instead of dropping it.
+        _ffmpeg->video_seek_targets[i] = (keyframe_only ? std::numeric_limits<int64_t>::min() : dest_pos);
+    }
+    for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
+    {
+        _ffmpeg->audio_seek_targets[i] = dest_pos;
+    }
     // Restart packet reading
     _ffmpeg->reader->reset();
     _ffmpeg->reader->start();
@@ -2009,6 +4815,17 @@ void media_object::close()
         try
         {
             // Stop decoder threads
+            for (size_t i = 0; i < _ffmpeg->video_lookahead_threads.size(); i++)
+            {
+                try
+                {
+                    _ffmpeg->video_lookahead_threads[i]->stop();
+                }
+                catch (...)
+                {
+                    // The thread has finished anyway. Make sure the others stop, too.
+                }
+            }
             for (size_t i = 0; i < _ffmpeg->video_decode_threads.size(); i++)
             {
                 _ffmpeg->video_decode_threads[i].finish();
@@ -2022,7 +4839,7 @@ void media_object::close()
                 _ffmpeg->subtitle_decode_threads[i].finish();
             }
             // Stop reading packets
-            _ffmpeg->reader->finish();
+            _ffmpeg->reader->stop();
         }
         catch (...)
         {
@@ -2056,10 +4873,37 @@ void media_object::close()
                     avcodec_close(_ffmpeg->video_codec_ctxs[i]);
                 }
             }
-            for (size_t i = 0; i < _ffmpeg->video_sws_ctxs.size(); i++)
+            for (size_t i = 0; i < _ffmpeg->video_sws_slices.size(); i++)
+            {
+                for (size_t k = 0; k < _ffmpeg->video_sws_slices[i].size(); k++)
+                {
+                    delete _ffmpeg->video_sws_slices[i][k];
+                }
+            }
+#if HAVE_AV_HWACCEL
+            for (size_t i = 0; i < _ffmpeg->video_hw_frames.size(); i++)
+            {
+                av_frame_free(&(_ffmpeg->video_hw_frames[i]));
+            }
+            for (size_t i = 0; i < _ffmpeg->video_hw_sws_frames.size(); i++)
+            {
+                av_free(_ffmpeg->video_hw_sws_frames[i]);
+            }
+            for (size_t i = 0; i < _ffmpeg->video_hw_sws_buffers.size(); i++)
             {
-                sws_freeContext(_ffmpeg->video_sws_ctxs[i]);
+                av_free(_ffmpeg->video_hw_sws_buffers[i]);
             }
+#if HAVE_AV_VDPAU_INTEROP
+            for (size_t i = 0; i < _ffmpeg->video_vdpau_outputs.size(); i++)
+            {
+                vdpau_output_destroy(_ffmpeg->video_vdpau_outputs[i]);
+            }
+#endif
+            for (size_t i = 0; i < _ffmpeg->video_hw_device_ctxs.size(); i++)
+            {
+                av_buffer_unref(&(_ffmpeg->video_hw_device_ctxs[i]));
+            }
+#endif
             for (size_t i = 0; i < _ffmpeg->video_packet_queues.size(); i++)
             {
                 if (_ffmpeg->video_packet_queues[i].size() > 0)
@@ -2067,10 +4911,7 @@ void media_object::close()
                     msg::dbg(_url + ": " + str::from(_ffmpeg->video_packet_queues[i].size())
                             + " unprocessed packets in video stream " + str::from(i));
                 }
-                for (size_t j = 0; j < _ffmpeg->video_packet_queues[i].size(); j++)
-                {
-                    av_free_packet(&_ffmpeg->video_packet_queues[i][j]);
-                }
+                _ffmpeg->video_packet_queues[i].clear();
             }
             for (size_t i = 0; i < _ffmpeg->video_packets.size(); i++)
             {
@@ -2078,7 +4919,7 @@ void media_object::close()
             }
             for (size_t i = 0; i < _ffmpeg->audio_codec_ctxs.size(); i++)
             {
-                if (i < _ffmpeg->audio_codecs.size() && _ffmpeg->audio_codecs[i])
+                if (i < _ffmpeg->audio_codecs_open.size() && _ffmpeg->audio_codecs_open[i])
                 {
                     avcodec_close(_ffmpeg->audio_codec_ctxs[i]);
                 }
@@ -2090,10 +4931,7 @@ void media_object::close()
                     msg::dbg(_url + ": " + str::from(_ffmpeg->audio_packet_queues[i].size())
                             + " unprocessed packets in audio stream " + str::from(i));
                 }
-                for (size_t j = 0; j < _ffmpeg->audio_packet_queues[i].size(); j++)
-                {
-                    av_free_packet(&_ffmpeg->audio_packet_queues[i][j]);
-                }
+                _ffmpeg->audio_packet_queues[i].clear();
             }
             for (size_t i = 0; i < _ffmpeg->audio_tmpbufs.size(); i++)
             {
@@ -2101,7 +4939,7 @@ void media_object::close()
             }
             for (size_t i = 0; i < _ffmpeg->subtitle_codec_ctxs.size(); i++)
             {
-                if (i < _ffmpeg->subtitle_codecs.size() && _ffmpeg->subtitle_codecs[i])
+                if (i < _ffmpeg->subtitle_codecs_open.size() && _ffmpeg->subtitle_codecs_open[i])
                 {
                     avcodec_close(_ffmpeg->subtitle_codec_ctxs[i]);
                 }
@@ -2113,13 +4951,28 @@ void media_object::close()
                     msg::dbg(_url + ": " + str::from(_ffmpeg->subtitle_packet_queues[i].size())
                             + " unprocessed packets in subtitle stream " + str::from(i));
                 }
-                for (size_t j = 0; j < _ffmpeg->subtitle_packet_queues[i].size(); j++)
+                _ffmpeg->subtitle_packet_queues[i].clear();
+            }
+            // The index of a thumbnail object is left to the object used for playback.
+            if (!_ffmpeg->video_keyframes_file.empty() && _thumbnail_width <= 0)
+            {
+                size_t n = 0;
+                for (size_t i = 0; i < _ffmpeg->video_keyframes.size(); i++)
+                {
+                    n += _ffmpeg->video_keyframes[i].size();
+                }
+                if (n > _ffmpeg->video_keyframes_loaded)
                 {
-                    av_free_packet(&_ffmpeg->subtitle_packet_queues[i][j]);
+                    save_keyframes(_ffmpeg->video_keyframes_file, _ffmpeg->video_keyframes);
                 }
             }
             avformat_close_input(&_ffmpeg->format_ctx);
         }
+        delete _ffmpeg->cache;
+        for (size_t i = 0; i < _ffmpeg->video_lookahead_threads.size(); i++)
+        {
+            delete _ffmpeg->video_lookahead_threads[i];
+        }
         delete _ffmpeg->reader;
         delete _ffmpeg;
         _ffmpeg = NULL;
@@ -28,10 +28,25 @@
 #include "media_data.h"
 
 
+/* A share of the processors of the system for video decoding. A media input
+ * divides the processors among its media objects so that decoders that run in
+ * parallel, e.g. for one file per view, do not compete for the same cores. */
+class cpu_share
+{
+public:
+    std::vector<int> cpus;      // Logical processors to use. Empty means no restriction.
+    int threads;                // Number of decoding threads. 0 means automatic.
+
+    cpu_share() : cpus(), threads(0)
+    {
+    }
+};
+
 class media_object
 {
 private:
     bool _always_convert_to_bgra32;             // Always convert video to BGRA32 format
+    int _thumbnail_width;                       // Decode video only for thumbnails of this width, if positive
     std::string _url;                           // The URL of the media object (may be a file)
     bool _is_device;                            // Whether the URL represents a device (e.g. a camera)
     struct ffmpeg_stuff *_ffmpeg;               // FFmpeg related data
@@ -44,6 +59,18 @@ private:
     void set_audio_blob_template(int audio_stream);
     void set_subtitle_box_template(int subtitle_stream);
 
+    // Allocate or release the decoding resources of a stream when it is
+    // activated or deactivated
+    void open_video_buffers(int video_stream);
+    void close_video_buffers(int video_stream);
+    void open_audio_codec(int audio_stream);
+    void close_audio_codec(int audio_stream);
+    void open_subtitle_codec(int subtitle_stream);
+    void close_subtitle_codec(int subtitle_stream);
+
+    // Set the limits for detecting the streams of the opened input
+    void set_probe_limits(const parameters &params);
+
     // The threaded implementation can access private members
     friend class read_thread;
     friend class video_decode_thread;
@@ -52,16 +79,26 @@ private:
 
 public:
 
-    /* Constructor, Destructor */
-    media_object(bool always_convert_to_bgra32 = false);
+    /* Constructor, Destructor.
+     * If thumbnail_width is positive, video is decoded only as far as thumbnails of that
+     * width need it: in software, at the lowest resolution that is still wide enough, and
+     * without decoding ahead. The key frame index cache is then used but not written. */
+    media_object(bool always_convert_to_bgra32 = false, int thumbnail_width = 0);
     ~media_object();
 
     /*
      * Initialization
      */
 
-    /* Open a media object. The URL may simply be a file name. */
-    void open(const std::string &url, const device_request &dev_request);
+    /* Divide the processor cores of the system into n shares of neighboring cores. */
+    static std::vector<cpu_share> cpu_shares(int n);
+
+    /* Open a media object. The URL may simply be a file name.
+     * The given parameters are used instead of dispatch::parameters(), so that
+     * this can run in any thread; they are only needed until this returns.
+     * The video decoders use the given share of the processors. */
+    void open(const std::string &url, const device_request &dev_request,
+            const parameters &params, const cpu_share &cpus = cpu_share());
 
     /* Get metadata */
     const std::string &url() const;
@@ -75,7 +112,10 @@ public:
     int audio_streams() const;
     int subtitle_streams() const;
 
-    /* Activate a media stream for usage. Inactive streams will not be accessible. */
+    /* Activate a media stream for usage. Inactive streams will not be accessible.
+     * This only affects the given stream; the others continue to be decoded.
+     * Inactive audio and subtitle streams are kept in standby, so that they
+     * can be activated at the current position without seeking. */
     void video_stream_set_active(int video_stream, bool active);
     void audio_stream_set_active(int audio_stream, bool active);
     void subtitle_stream_set_active(int subtitle_stream, bool active);
@@ -90,6 +130,35 @@ public:
     int video_frame_rate_denominator(int video_stream) const;
     // Video stream duration in microseconds.
     int64_t video_duration(int video_stream) const;
+    // Hardware decoding method used for this video stream (e.g. "vaapi"),
+    // or an empty string if the stream is decoded in software.
+    const std::string &video_hwaccel(int video_stream) const;
+    // Get the number of video frames whose pixel format was converted in software
+    // since the media object was opened, and the time spent on that in microseconds.
+    void get_conversion_stats(int64_t *frames, int64_t *time);
+    // Get the number of packets currently queued for video, audio and subtitle
+    // streams, and their total size in bytes.
+    void get_queue_stats(size_t *video_packets, size_t *audio_packets, size_t *subtitle_packets,
+            size_t *bytes);
+    // Get the memory used for queued packets, decoded video frames and conversion
+    // buffers, buffered audio data, and decoded subtitles, in bytes.
+    void get_memory_stats(size_t *packets, size_t *video, size_t *audio, size_t *subtitles);
+    // Get the number of bytes read from the input since it was opened, and the
+    // time spent reading them in microseconds. For network inputs, this measures
+    // the throughput of the connection while data is transferred.
+    void get_read_stats(int64_t *bytes, int64_t *time);
+
+    /* Get information about the variants of adaptive network streams (HLS,
+     * DASH). FFmpeg exposes each variant as a program with its own streams;
+     * only the streams of active variants are downloaded. */
+    // Whether the input is an adaptive stream with more than one variant.
+    bool is_adaptive() const;
+    // The bandwidth of the variant of a video stream in bits per second, or 0 if unknown.
+    int64_t video_stream_bitrate(int video_stream) const;
+    // The audio stream that plays along with the given video stream in place of
+    // the given audio stream: the audio stream itself if it belongs to the variant
+    // of the video stream, and otherwise the corresponding one of that variant.
+    int variant_audio_stream(int video_stream, int audio_stream) const;
 
     /* Get information about audio streams. */
     // Return an audio blob with all properties filled in (but without any data).
@@ -116,6 +185,12 @@ public:
     /* Wait for the video frame reading to finish, and return the frame.
      * An invalid frame means that EOF was reached. */
     video_frame finish_video_frame_read(int video_stream);
+    /* Let the decoder trade quality for speed when the player cannot keep up.
+     * Level 0 decodes everything, 1 skips the loop filter for non-reference frames,
+     * 2 skips it for all frames, and 3 also skips decoding of non-reference frames.
+     * The level applies to frames that are decoded after the call. */
+    static const int max_video_skip_level = 3;
+    void set_video_skip_level(int video_stream, int level);
 
     /* Start to read the given amount of audio data asynchronously (in a separate thread). */
     void start_audio_blob_read(int audio_stream, size_t size);
@@ -138,8 +213,16 @@ public:
      * The real position after seeking is only revealed after reading the next video frame,
      * audio blob, or subtitle box. This position may differ from the requested position
      * for various reasons (seeking is only possible to keyframes, seeking is not supported
-     * by the stream, ...) */
-    void seek(int64_t pos);
+     * by the stream, ...)
+     * If keyframe_only is set, the video frames before the position are not dropped, and
+     * only key frames are decoded until the next seek. This is for quick previews while
+     * the user drags the position slider. */
+    void seek(int64_t pos, bool keyframe_only = false);
+
+    /* Return the position in microseconds of the last known key frame of the given video
+     * stream at or before the given position, or the minimum possible value if none is
+     * known. The key frames are known from reading the input or from the index cache. */
+    int64_t keyframe_position(int video_stream, int64_t pos) const;
 
     /*
      * Cleanup
@@ -0,0 +1,613 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <cerrno>
+#include <cstring>
+
+#include <GL/glew.h>
+
+#include "base/blb.h"
+#include "base/exc.h"
+#include "base/msg.h"
+#include "base/ser.h"
+#include "base/str.h"
+#include "base/tmr.h"
+
+#include "base/gettext.h"
+#define _(string) gettext(string)
+
+#include "media_data.h"
+#include "dispatch.h"
+#include "subtitle_renderer.h"
+#include "video_output_file.h"
+#include "micro_benchmark.h"
+
+
+// Each benchmark collects at least min_samples samples during at least
+// min_time microseconds, but no more than max_samples samples.
+static const size_t min_samples = 20;
+static const size_t max_samples = 100000;
+static const int64_t min_time = 250000;
+
+// Measures the time per operation of batches of operations:
+//   sampler s(ops);
+//   while (s.next())
+//       for (int i = 0; i < ops; i++)
+//           operation();
+class sampler
+{
+private:
+    const int _ops;
+    std::vector<int64_t> _times;
+    int64_t _begin;
+    int64_t _last;
+
+public:
+    sampler(int ops) : _ops(ops), _times(), _begin(-1), _last(-1)
+    {
+    }
+
+    // Record the time per operation of the batch since the last call, if any,
+    // and return whether another batch should be run.
+    bool next()
+    {
+        int64_t t = timer::get(timer::monotonic);
+        if (_begin < 0)
+            _begin = t;
+        else
+            _times.push_back((t - _last) * 1000 / _ops);
+        bool more = (_times.size() < max_samples
+                && (_times.size() < min_samples || t - _begin < min_time));
+        _last = timer::get(timer::monotonic);
+        return more;
+    }
+
+    std::vector<int64_t>& times()
+    {
+        return _times;
+    }
+};
+
+void micro_benchmark::add(std::vector<result>& results, const std::string& name,
+        size_t bytes, std::vector<int64_t>& times)
+{
+    result r;
+    r.name = name;
+    r.bytes = bytes;
+    r.times = benchmark_stats::summarize(times);
+    r.gl_calls = -1.0;
+    r.gl_syncs = -1.0;
+    results.push_back(r);
+}
+
+// The pixel formats of the synthetic frames
+struct frame_format
+{
+    const char *name;
+    video_frame::layout_t layout;
+    video_frame::value_range_t value_range;
+};
+
+static const frame_format frame_formats[] =
+{
+    { "bgra32",    video_frame::bgra32,   video_frame::u8_full  },
+    { "yuv420p",   video_frame::yuv420p,  video_frame::u8_mpeg  },
+    { "yuv420p10", video_frame::yuv420p,  video_frame::u10_mpeg },
+    { "yuv420sp",  video_frame::yuv420sp, video_frame::u8_mpeg  },
+};
+
+// Make a synthetic frame of the given format, raw size, and stereo layout, with
+// its planes in src. Layouts that store the views in two frames use the same
+// data for both. Return the number of bytes in the planes of one frame.
+static size_t make_frame(video_frame& frame, const frame_format& format,
+        int width, int height, parameters::stereo_layout_t stereo_layout, blob src[3])
+{
+    frame = video_frame();
+    // Subsampled chroma planes need even sizes.
+    frame.raw_width = std::max(width & ~1, 2);
+    frame.raw_height = std::max(height & ~1, 2);
+    frame.raw_aspect_ratio = static_cast<float>(frame.raw_width) / frame.raw_height;
+    frame.layout = format.layout;
+    frame.value_range = format.value_range;
+    frame.stereo_layout = stereo_layout;
+    frame.set_view_dimensions();
+    bool two_frames = (stereo_layout == parameters::layout_separate
+            || stereo_layout == parameters::layout_alternating);
+    size_t type_size = (frame.value_range == video_frame::u8_full
+            || frame.value_range == video_frame::u8_mpeg ? 1 : 2);
+    size_t bytes = 0;
+    for (int p = 0; p < frame.planes(); p++)
+    {
+        size_t w = (frame.layout == video_frame::bgra32 ? 4 * frame.raw_width
+                : p == 0 || frame.layout == video_frame::yuv420sp ? frame.raw_width
+                : frame.raw_width / 2);
+        size_t h = (p == 0 ? frame.raw_height : frame.raw_height / 2);
+        frame.line_size[0][p] = w * type_size;
+        src[p].resize(frame.line_size[0][p], h);
+        for (size_t i = 0; i < src[p].size(); i++)
+            src[p].ptr<uint8_t>()[i] = i % 251;
+        frame.data[0][p] = src[p].ptr();
+        if (two_frames)
+        {
+            frame.line_size[1][p] = frame.line_size[0][p];
+            frame.data[1][p] = frame.data[0][p];
+        }
+        bytes += src[p].size();
+    }
+    return bytes;
+}
+
+void micro_benchmark::copy_plane(std::vector<result>& results, const config& conf)
+{
+    for (size_t f = 0; f < sizeof(frame_formats) / sizeof(frame_formats[0]); f++)
+    {
+        video_frame frame;
+        blob src[3], dst[3];
+        size_t bytes = make_frame(frame, frame_formats[f], conf.width, conf.height, conf.stereo_layout, src);
+        int views = (frame.stereo_layout == parameters::layout_mono ? 1 : 2);
+        for (int p = 0; p < frame.planes(); p++)
+            dst[p].resize(src[p].size());
+        if (views == 2 && frame.data[1][0])
+            bytes *= 2;
+
+        for (int streaming = 0; streaming <= 1; streaming++)
+        {
+            sampler s(1);
+            while (s.next())
+                for (int v = 0; v < views; v++)
+                    for (int p = 0; p < frame.planes(); p++)
+                        frame.copy_plane(v, p, dst[p].ptr(), streaming);
+            add(results, std::string("copy_plane/") + frame_formats[f].name
+                    + (streaming ? "/streaming" : ""), bytes, s.times());
+        }
+    }
+}
+
+// Counting of OpenGL calls. GLEW calls the functions beyond OpenGL 1.1 through
+// function pointers, and while a gl_call_counter exists, these point to
+// versions that count the calls. Functions that may wait for the GPU, such as
+// queries, are also counted separately. OpenGL 1.1 functions are called
+// directly, so they are not counted.
+
+#ifdef GLEW_MX
+# define GLEW_FUNCTION(name) (_glew_context->__glew##name)
+#else
+# define GLEW_FUNCTION(name) (__glew##name)
+#endif
+
+static int64_t gl_calls = 0;
+static int64_t gl_syncs = 0;
+
+#define COUNTED_GL_FUNCTION(ret, name, params, args, sync) \
+    static ret (GLAPIENTRY *real_gl##name) params = NULL; \
+    static ret GLAPIENTRY counted_gl##name params \
+    { \
+        gl_calls++; \
+        gl_syncs += sync; \
+        return real_gl##name args; \
+    }
+
+COUNTED_GL_FUNCTION(GLint, GetUniformLocation, (GLuint program, const GLchar* name), (program, name), 1)
+COUNTED_GL_FUNCTION(void, GetProgramiv, (GLuint program, GLenum pname, GLint* param), (program, pname, param), 1)
+COUNTED_GL_FUNCTION(void, GetQueryObjectiv, (GLuint id, GLenum pname, GLint* params), (id, pname, params), 1)
+COUNTED_GL_FUNCTION(void, GetQueryObjectui64v, (GLuint id, GLenum pname, GLuint64* params), (id, pname, params), 1)
+COUNTED_GL_FUNCTION(GLenum, ClientWaitSync, (GLsync sync, GLbitfield flags, GLuint64 timeout), (sync, flags, timeout), 1)
+COUNTED_GL_FUNCTION(void, UseProgram, (GLuint program), (program), 0)
+COUNTED_GL_FUNCTION(void, Uniform1i, (GLint location, GLint v0), (location, v0), 0)
+COUNTED_GL_FUNCTION(void, Uniform1f, (GLint location, GLfloat v0), (location, v0), 0)
+COUNTED_GL_FUNCTION(void, Uniform3f, (GLint location, GLfloat v0, GLfloat v1, GLfloat v2), (location, v0, v1, v2), 0)
+COUNTED_GL_FUNCTION(void, Uniform4fv, (GLint location, GLsizei count, const GLfloat* value), (location, count, value), 0)
+COUNTED_GL_FUNCTION(void, UniformMatrix4fv, (GLint location, GLsizei count, GLboolean transpose, const GLfloat* value),
+        (location, count, transpose, value), 0)
+COUNTED_GL_FUNCTION(void, ActiveTexture, (GLenum texture), (texture), 0)
+COUNTED_GL_FUNCTION(void, BindBuffer, (GLenum target, GLuint buffer), (target, buffer), 0)
+COUNTED_GL_FUNCTION(void, BufferData, (GLenum target, GLsizeiptr size, const void* data, GLenum usage),
+        (target, size, data, usage), 0)
+COUNTED_GL_FUNCTION(void*, MapBuffer, (GLenum target, GLenum access), (target, access), 0)
+COUNTED_GL_FUNCTION(GLboolean, UnmapBuffer, (GLenum target), (target), 0)
+COUNTED_GL_FUNCTION(void, BindFramebufferEXT, (GLenum target, GLuint framebuffer), (target, framebuffer), 0)
+COUNTED_GL_FUNCTION(void, BindVertexArray, (GLuint array), (array), 0)
+
+#define FOR_ALL_COUNTED_GL_FUNCTIONS(action) \
+    action(GetUniformLocation) action(GetProgramiv) action(GetQueryObjectiv) \
+    action(GetQueryObjectui64v) action(ClientWaitSync) action(UseProgram) \
+    action(Uniform1i) action(Uniform1f) action(Uniform3f) action(Uniform4fv) \
+    action(UniformMatrix4fv) action(ActiveTexture) action(BindBuffer) \
+    action(BufferData) action(MapBuffer) action(UnmapBuffer) \
+    action(BindFramebufferEXT) action(BindVertexArray)
+
+#define INSTALL_COUNTED_GL_FUNCTION(name) \
+    real_gl##name = GLEW_FUNCTION(name); \
+    if (real_gl##name) \
+        GLEW_FUNCTION(name) = counted_gl##name;
+
+#define REMOVE_COUNTED_GL_FUNCTION(name) \
+    if (real_gl##name) \
+        GLEW_FUNCTION(name) = real_gl##name;
+
+class gl_call_counter
+{
+private:
+#ifdef GLEW_MX
+    GLEWContext* _glew_context;
+#endif
+    int64_t _calls, _syncs;
+
+public:
+#ifdef GLEW_MX
+    gl_call_counter(GLEWContext* glew_context) : _glew_context(glew_context)
+#else
+    gl_call_counter()
+#endif
+    {
+        FOR_ALL_COUNTED_GL_FUNCTIONS(INSTALL_COUNTED_GL_FUNCTION)
+        reset();
+    }
+
+    ~gl_call_counter()
+    {
+        FOR_ALL_COUNTED_GL_FUNCTIONS(REMOVE_COUNTED_GL_FUNCTION)
+    }
+
+    // Start counting from zero.
+    void reset()
+    {
+        _calls = gl_calls;
+        _syncs = gl_syncs;
+    }
+
+    // The calls since the last reset, per operation.
+    double calls(size_t ops) const
+    {
+        return ops > 0 ? static_cast<double>(gl_calls - _calls) / ops : 0.0;
+    }
+    double syncs(size_t ops) const
+    {
+        return ops > 0 ? static_cast<double>(gl_syncs - _syncs) / ops : 0.0;
+    }
+};
+
+void micro_benchmark::gl_passes(std::vector<result>& results, const config& conf)
+{
+    // Render into an offscreen framebuffer, like the output to a file does.
+    // Each pass is finished with glFinish(), so that the times include the
+    // GPU work and not only the submission of the commands.
+    video_output_file out("");
+    try
+    {
+        out.init();
+    }
+    catch (std::exception& e)
+    {
+        msg::wrn(_("Skipping the OpenGL benchmarks: %s"), e.what());
+        return;
+    }
+#ifdef GLEW_MX
+    gl_call_counter counter(out.glewGetContext());
+#else
+    gl_call_counter counter;
+#endif
+    const parameters::stereo_mode_t modes[] =
+    {
+        parameters::mode_mono_left,
+        parameters::mode_red_cyan_dubois,
+        parameters::mode_even_odd_rows,
+        parameters::mode_checkerboard,
+    };
+    for (size_t f = 0; f < sizeof(frame_formats) / sizeof(frame_formats[0]); f++)
+    {
+        video_frame frame;
+        blob src[3];
+        size_t bytes = make_frame(frame, frame_formats[f], conf.width, conf.height, conf.stereo_layout, src);
+        // The output size is fixed by the first frame.
+        out.trigger_resize(frame.width, frame.height);
+
+        // The color pass uploads the frame and converts it to the internal format.
+        // The first run includes the shader compilation, so it does not count.
+        out.prepare_next_frame(frame, subtitle_box());
+        glFinish();
+        sampler sc(1);
+        counter.reset();
+        while (sc.next())
+        {
+            out.prepare_next_frame(frame, subtitle_box());
+            glFinish();
+        }
+        add(results, std::string("gl_color/") + frame_formats[f].name, bytes, sc.times());
+        results.back().gl_calls = counter.calls(sc.times().size());
+        results.back().gl_syncs = counter.syncs(sc.times().size());
+
+        // The render pass combines the views for the output. Both frames of
+        // the output are prepared, so that switching between them always
+        // shows a valid frame.
+        out.activate_next_frame();
+        out.prepare_next_frame(frame, subtitle_box());
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+        {
+            controller::send_cmd(command::set_stereo_mode, static_cast<int>(modes[m]));
+            out.activate_next_frame();
+            glFinish();
+            sampler sr(1);
+            counter.reset();
+            while (sr.next())
+            {
+                out.activate_next_frame();
+                glFinish();
+            }
+            add(results, std::string("gl_render/") + frame_formats[f].name + "/"
+                    + parameters::stereo_mode_to_string(modes[m], false), 0, sr.times());
+            results.back().gl_calls = counter.calls(sr.times().size());
+            results.back().gl_syncs = counter.syncs(sr.times().size());
+        }
+    }
+    controller::send_cmd(command::set_stereo_mode, static_cast<int>(parameters::mode_mono_left));
+    out.deinit();
+}
+
+void micro_benchmark::subtitle_blend(std::vector<result>& results)
+{
+    // Two lines of text, each with outline, shadow, and glyph images,
+    // in a subtitle bounding box at the bottom of a 1080p frame.
+    const int bb_w = 1920;
+    const int bb_h = 160;
+    const int img_w = 1600;
+    const int img_h = 56;
+    const unsigned int colors[3] = { 0x00000000u, 0x00000080u, 0xffffff00u };
+    ASS_Image images[6];
+    blob bitmap(img_w, img_h);
+    for (int y = 0; y < img_h; y++)
+    {
+        for (int x = 0; x < img_w; x++)
+        {
+            // Mostly transparent and opaque pixels, with antialiased edges.
+            int g = (x / 9 + y / 14) % 3;
+            bitmap.ptr<uint8_t>()[y * img_w + x] = (g == 0 ? 0 : g == 1 ? 255 : (x * 37 + y * 11) & 0xff);
+        }
+    }
+    size_t bytes = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        images[i].w = img_w;
+        images[i].h = img_h;
+        images[i].stride = img_w;
+        images[i].bitmap = bitmap.ptr<unsigned char>();
+        images[i].color = colors[i % 3];
+        images[i].dst_x = (bb_w - img_w) / 2 + (i % 3 == 1 ? 2 : 0);
+        images[i].dst_y = (i / 3) * (bb_h / 2) + (i % 3 == 1 ? 2 : 0);
+        images[i].next = (i < 5 ? &images[i + 1] : NULL);
+        bytes += img_w * img_h;
+    }
+    blob buf(bb_w * sizeof(uint32_t), bb_h);
+    std::memset(buf.ptr(), 0, buf.size());
+
+    subtitle_renderer renderer;
+    renderer._bb_x = 0;
+    renderer._bb_y = 0;
+    renderer._bb_w = bb_w;
+    renderer._bb_h = bb_h;
+    sampler s(1);
+    while (s.next())
+        for (const ASS_Image *img = images; img; img = img->next)
+            renderer.blend_ass_image(img, buf.ptr<uint32_t>());
+    add(results, "blend_ass_image", bytes, s.times());
+}
+
+void micro_benchmark::audio_interleave(std::vector<result>& results)
+{
+    const int samples = 4096;
+    const int ops = 16;
+    const int channel_counts[] = { 2, 6, 8, 3 };
+    const int sample_sizes[] = { 2, 4 };
+
+    for (size_t c = 0; c < sizeof(channel_counts) / sizeof(channel_counts[0]); c++)
+    {
+        int channels = channel_counts[c];
+        for (size_t z = 0; z < sizeof(sample_sizes) / sizeof(sample_sizes[0]); z++)
+        {
+            int sample_size = sample_sizes[z];
+            blob planes(samples * sample_size, channels);
+            blob out(samples * sample_size, channels);
+            for (size_t i = 0; i < planes.size(); i++)
+                planes.ptr<uint8_t>()[i] = i % 253;
+            std::vector<const uint8_t *> plane_ptrs(channels);
+            for (int i = 0; i < channels; i++)
+                plane_ptrs[i] = planes.ptr<uint8_t>(i * samples * sample_size);
+            sampler s(ops);
+            while (s.next())
+                for (int i = 0; i < ops; i++)
+                    audio_blob::interleave(out.ptr(), &(plane_ptrs[0]), channels, samples, sample_size);
+            add(results, str::asprintf("audio_interleave/%dch/%dbit", channels, sample_size * 8),
+                    planes.size(), s.times());
+        }
+    }
+}
+
+void micro_benchmark::serialization(std::vector<result>& results, const std::string& name,
+        const serializable& object, serializable& loaded, int ops)
+{
+    s11n::writer w;
+    object.save(w);
+    size_t bytes = w.size();
+
+    sampler ss(ops);
+    while (ss.next())
+    {
+        for (int i = 0; i < ops; i++)
+        {
+            w.clear();
+            object.save(w);
+        }
+    }
+    add(results, "s11n_save/" + name, bytes, ss.times());
+
+    sampler sl(ops);
+    while (sl.next())
+    {
+        for (int i = 0; i < ops; i++)
+        {
+            s11n::reader r(w.ptr(), w.size());
+            loaded.load(r);
+        }
+    }
+    add(results, "s11n_load/" + name, bytes, sl.times());
+}
+
+void micro_benchmark::serialization(std::vector<result>& results)
+{
+    subtitle_box loaded_box;
+
+    subtitle_box text_box;
+    text_box.language = "en";
+    text_box.format = subtitle_box::text;
+    text_box.str = "This is a typical subtitle,\nwith two lines of text.";
+    text_box.presentation_start_time = 1000000;
+    text_box.presentation_stop_time = 4000000;
+    serialization(results, "subtitle_box/text", text_box, loaded_box, 1000);
+
+    subtitle_box ass_box = text_box;
+    ass_box.format = subtitle_box::ass;
+    ass_box.style = subtitle_renderer::text_style();
+    ass_box.str = "0,Default,{\\i1}This is a typical subtitle,{\\i0}\\Nwith two lines of text.";
+    serialization(results, "subtitle_box/ass", ass_box, loaded_box, 1000);
+
+    subtitle_box image_box = text_box;
+    image_box.format = subtitle_box::image;
+    image_box.str.clear();
+    image_box.images.resize(1);
+    subtitle_box::image_t &img = image_box.images[0];
+    img.w = 720;
+    img.h = 64;
+    img.x = 0;
+    img.y = 416;
+    img.linesize = img.w;
+    img.palette.resize(4 * 4);
+    img.data.resize(img.linesize * img.h);
+    for (size_t i = 0; i < img.palette.size(); i++)
+        img.palette.ptr<uint8_t>()[i] = i * 17;
+    for (size_t i = 0; i < img.data.size(); i++)
+        img.data.ptr<uint8_t>()[i] = i % 4;
+    serialization(results, "subtitle_box/image", image_box, loaded_box, 100);
+
+    parameters params;
+    parameters loaded_params;
+    params.set_stereo_mode(parameters::mode_red_cyan_dubois);
+    params.set_contrast(0.1f);
+    params.set_parallax(-0.05f);
+    params.set_subtitle_font("DejaVu Sans");
+    params.set_zoom(0.5f);
+    serialization(results, "parameters", params, loaded_params, 1000);
+}
+
+void micro_benchmark::write_result_file(const std::string& file_name, const std::vector<result>& results)
+{
+    bool json = (file_name.length() >= 5 && file_name.substr(file_name.length() - 5) == ".json");
+    std::ofstream f(file_name.c_str());
+    if (json)
+    {
+        f << "{\n  \"unit\": \"ns\",\n  \"benchmarks\": {\n";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const benchmark_stats::summary& s = results[i].times;
+            f << "    \"" << results[i].name << "\": { \"bytes\": " << results[i].bytes
+              << ", \"count\": " << s.count
+              << ", \"mean\": " << s.mean << ", \"p50\": " << s.p50 << ", \"p95\": " << s.p95
+              << ", \"p99\": " << s.p99 << ", \"max\": " << s.max;
+            if (results[i].gl_calls >= 0.0)
+            {
+                f << ", \"gl_calls\": " << results[i].gl_calls
+                  << ", \"gl_syncs\": " << results[i].gl_syncs;
+            }
+            f << " }" << (i < results.size() - 1 ? ",\n" : "\n");
+        }
+        f << "  }\n}\n";
+    }
+    else
+    {
+        f << "benchmark,bytes,count,mean,p50,p95,p99,max,gl_calls,gl_syncs\n";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const benchmark_stats::summary& s = results[i].times;
+            f << results[i].name << ',' << results[i].bytes << ',' << s.count << ',' << s.mean << ','
+              << s.p50 << ',' << s.p95 << ',' << s.p99 << ',' << s.max << ',';
+            if (results[i].gl_calls >= 0.0)
+                f << results[i].gl_calls << ',' << results[i].gl_syncs;
+            else
+                f << ',';
+            f << '\n';
+        }
+    }
+    f.flush();
+    if (!f.good())
+    {
+        throw exc(str::asprintf(_("%s: %s"), file_name.c_str(), std::strerror(errno)), errno);
+    }
+}
+
+void micro_benchmark::run(const std::string& result_file, const config& conf)
+{
+    std::vector<result> results;
+    msg::inf(_("Running micro benchmarks with %dx%d %s frames."), conf.width, conf.height,
+            parameters::stereo_layout_to_string(conf.stereo_layout, false).c_str());
+    copy_plane(results, conf);
+    gl_passes(results, conf);
+    subtitle_blend(results);
+    audio_interleave(results);
+    serialization(results);
+
+    msg::inf(4, "%-36s %8s %10s %10s %10s %10s %10s %8s", _("benchmark"), _("count"),
+            _("mean"), _("p50"), _("p95"), _("p99"), _("max"), _("MiB/s"));
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const benchmark_stats::summary& s = results[i].times;
+        std::string throughput = "-";
+        if (results[i].bytes > 0 && s.mean > 0)
+            throughput = str::asprintf("%.0f", results[i].bytes * 1e9 / s.mean / (1024.0 * 1024.0));
+        msg::inf(4, "%-36s %8s %10.3f %10.3f %10.3f %10.3f %10.3f %8s", results[i].name.c_str(),
+                str::from(s.count).c_str(), s.mean / 1e3f,
+                s.p50 / 1e3f, s.p95 / 1e3f, s.p99 / 1e3f, s.max / 1e3f, throughput.c_str());
+    }
+    msg::inf(4, "%s", _("(all times in microseconds per operation)"));
+    bool gl_header = false;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        if (results[i].gl_calls < 0.0)
+            continue;
+        if (!gl_header)
+        {
+            msg::inf(4, "%-36s %10s %10s", _("benchmark"), _("GL calls"), _("GL syncs"));
+            gl_header = true;
+        }
+        msg::inf(4, "%-36s %10.1f %10.1f", results[i].name.c_str(),
+                results[i].gl_calls, results[i].gl_syncs);
+    }
+    if (gl_header)
+    {
+        msg::inf(4, "%s", _("(OpenGL calls per frame, without OpenGL 1.1 functions)"));
+    }
+    if (!result_file.empty())
+    {
+        write_result_file(result_file, results);
+    }
+}
@@ -0,0 +1,91 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MICRO_BENCHMARK_H
+#define MICRO_BENCHMARK_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "base/ser.h"
+
+#include "media_data.h"
+#include "benchmark_stats.h"
+
+/*
+ * Micro benchmarks of the CPU hot paths of the media pipeline.
+ *
+ * Each benchmark runs one hot path on synthetic data, without any input or
+ * window, so that the results only depend on the code and the machine. The
+ * time of one operation is measured in batches until enough samples are
+ * collected, and summarized like the per-frame statistics of benchmark mode.
+ *
+ * The color conversion and render passes run in an offscreen OpenGL context,
+ * like the output to a file. If no context is available, they are skipped.
+ * These passes also count the OpenGL calls per frame, except for the OpenGL
+ * 1.1 functions, which cannot be intercepted.
+ */
+
+class micro_benchmark
+{
+public:
+    // The synthetic video frames
+    struct config
+    {
+        int width, height;                              // raw frame size
+        parameters::stereo_layout_t stereo_layout;      // input layout
+
+        config() : width(1920), height(1080), stereo_layout(parameters::layout_mono)
+        {
+        }
+    };
+
+private:
+    struct result
+    {
+        std::string name;               // name of the benchmark
+        size_t bytes;                   // bytes processed per operation, 0 if not meaningful
+        benchmark_stats::summary times; // times per operation, in nanoseconds
+        double gl_calls;                // counted OpenGL calls per operation, -1 if not counted
+        double gl_syncs;                // counted OpenGL calls that may wait for the GPU, -1 if not counted
+    };
+
+    static void add(std::vector<result>& results, const std::string& name,
+            size_t bytes, std::vector<int64_t>& times);
+
+    static void copy_plane(std::vector<result>& results, const config& conf);
+    static void gl_passes(std::vector<result>& results, const config& conf);
+    static void subtitle_blend(std::vector<result>& results);
+    static void audio_interleave(std::vector<result>& results);
+    static void serialization(std::vector<result>& results, const std::string& name,
+            const serializable& object, serializable& loaded, int ops);
+    static void serialization(std::vector<result>& results);
+
+    static void write_result_file(const std::string& file_name, const std::vector<result>& results);
+
+public:
+    /* Run all micro benchmarks and print the results. If a file name is
+     * given, the results are also written to it. Its format is JSON if the
+     * name ends with ".json", and CSV otherwise. */
+    static void run(const std::string& result_file, const config& conf = config());
+};
+
+#endif
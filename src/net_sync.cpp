@@ -0,0 +1,307 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <vector>
+#include <cerrno>
+#include <cstring>
+
+#if !((defined _WIN32 || defined __WIN32__) && !defined __CYGWIN__)
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+# include <netdb.h>
+# include <fcntl.h>
+# include <unistd.h>
+# define HAVE_NET_SYNC 1
+#else
+# define HAVE_NET_SYNC 0
+#endif
+
+#include "base/exc.h"
+#include "base/str.h"
+#include "base/msg.h"
+#include "base/tmr.h"
+
+#include "base/gettext.h"
+#define _(string) gettext(string)
+
+#include "net_sync.h"
+
+
+static std::string master_address;
+static std::string follower_address;
+
+void net_sync::set_master(const std::string& address)
+{
+    master_address = address;
+}
+
+void net_sync::set_follower(const std::string& address)
+{
+    follower_address = address;
+}
+
+net_sync::net_sync() :
+    _fd(-1), _master(false), _session(0), _sequence(0), _have_sequence(false),
+    _last_send_time(0), _last_paused(false), _last_seek_epoch(0)
+{
+}
+
+net_sync::~net_sync()
+{
+    close();
+}
+
+#if HAVE_NET_SYNC
+
+// Resolve [HOST:]PORT into an IPv4 socket address. An empty host is the
+// wildcard address, which only makes sense for receiving.
+static struct sockaddr_in resolve(const std::string& address)
+{
+    std::string host;
+    std::string port = address;
+    size_t colon = address.find_last_of(':');
+    if (colon != std::string::npos)
+    {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+    }
+    int port_number;
+    if (!str::to(port, &port_number) || port_number < 1 || port_number > 65535)
+    {
+        throw exc(str::asprintf(_("Invalid synchronization address %s."), address.c_str()));
+    }
+    struct sockaddr_in sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port_number);
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (!host.empty())
+    {
+        struct addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        struct addrinfo *result;
+        int e = getaddrinfo(host.c_str(), NULL, &hints, &result);
+        if (e != 0)
+        {
+            throw exc(str::asprintf(_("Cannot resolve synchronization address %s: %s"),
+                        address.c_str(), gai_strerror(e)));
+        }
+        sa.sin_addr = reinterpret_cast<struct sockaddr_in *>(result->ai_addr)->sin_addr;
+        freeaddrinfo(result);
+    }
+    return sa;
+}
+
+static bool is_multicast(const struct sockaddr_in& sa)
+{
+    return IN_MULTICAST(ntohl(sa.sin_addr.s_addr));
+}
+
+void net_sync::open()
+{
+    if (_fd >= 0 || (master_address.empty() && follower_address.empty()))
+    {
+        return;
+    }
+    _master = !master_address.empty();
+    const std::string& address = (_master ? master_address : follower_address);
+    struct sockaddr_in sa = resolve(address);
+    _fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (_fd < 0)
+    {
+        throw exc(str::asprintf(_("Cannot create synchronization socket: %s"), std::strerror(errno)), errno);
+    }
+    int e = 0;
+    int one = 1;
+    int flags = fcntl(_fd, F_GETFL);
+    if (flags < 0 || fcntl(_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        e = errno;
+    }
+    else if (_master)
+    {
+        // Allow broadcast addresses, and let several followers on the same
+        // host receive multicast datagrams.
+        if (setsockopt(_fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one)) < 0
+                || ::connect(_fd, reinterpret_cast<struct sockaddr *>(&sa), sizeof(sa)) < 0)
+        {
+            e = errno;
+        }
+        else if (is_multicast(sa))
+        {
+            unsigned char loop = 1;
+            setsockopt(_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+        }
+    }
+    else
+    {
+        // A multicast group is joined, and the socket is bound to the wildcard
+        // address so that it receives the datagrams of the group.
+        struct sockaddr_in bind_sa = sa;
+        if (is_multicast(sa))
+        {
+            bind_sa.sin_addr.s_addr = htonl(INADDR_ANY);
+        }
+        setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (::bind(_fd, reinterpret_cast<struct sockaddr *>(&bind_sa), sizeof(bind_sa)) < 0)
+        {
+            e = errno;
+        }
+        else if (is_multicast(sa))
+        {
+            struct ip_mreq mreq;
+            mreq.imr_multiaddr = sa.sin_addr;
+            mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+            if (setsockopt(_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+            {
+                e = errno;
+            }
+        }
+    }
+    if (e != 0)
+    {
+        ::close(_fd);
+        _fd = -1;
+        throw exc(str::asprintf(_("Cannot use synchronization address %s: %s"),
+                    address.c_str(), std::strerror(e)), e);
+    }
+    _have_sequence = false;
+    _last_send_time = 0;
+    if (_master)
+    {
+        // A new session, so that followers do not take the restarted
+        // sequence for old datagrams.
+        _session = static_cast<uint32_t>(timer::get(timer::realtime) ^ (static_cast<int64_t>(getpid()) << 20));
+        _sequence = 0;
+    }
+    msg::inf(_master ? _("Sending playback synchronization to %s.")
+            : _("Receiving playback synchronization on %s."), address.c_str());
+}
+
+void net_sync::close()
+{
+    if (_fd >= 0)
+    {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+void net_sync::send(int64_t now, int64_t pos, bool paused, int seek_epoch)
+{
+    if (!is_master()
+            || (now - _last_send_time < send_interval
+                && paused == _last_paused && seek_epoch == _last_seek_epoch))
+    {
+        return;
+    }
+    _sequence++;
+    std::string line = str::asprintf("bino-sync 2 %u %u %d %d %s\n",
+            static_cast<unsigned int>(_session), static_cast<unsigned int>(_sequence),
+            seek_epoch, paused ? 1 : 0,
+            str::from(pos).c_str());
+    // Datagrams are dropped if the network is busy; the next one follows soon.
+    if (::send(_fd, line.c_str(), line.length(), 0) < 0
+            && errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED)
+    {
+        msg::dbg("Cannot send synchronization datagram: %s", std::strerror(errno));
+    }
+    _last_send_time = now;
+    _last_paused = paused;
+    _last_seek_epoch = seek_epoch;
+}
+
+bool net_sync::receive(state* s)
+{
+    if (!is_follower())
+    {
+        return false;
+    }
+    bool have_state = false;
+    char buf[256];
+    ssize_t len;
+    while ((len = ::recv(_fd, buf, sizeof(buf) - 1, 0)) > 0)
+    {
+        buf[len] = '\0';
+        std::vector<std::string> tokens = str::tokens(buf, " \n");
+        unsigned int session, sequence;
+        int seek_epoch, paused;
+        int64_t pos;
+        if (tokens.size() != 7 || tokens[0] != "bino-sync" || tokens[1] != "2"
+                || !str::to(tokens[2], &session) || !str::to(tokens[3], &sequence)
+                || !str::to(tokens[4], &seek_epoch) || !str::to(tokens[5], &paused)
+                || !str::to(tokens[6], &pos))
+        {
+            msg::dbg("Ignoring invalid synchronization datagram.");
+            continue;
+        }
+        // Ignore datagrams that were overtaken by newer ones of the same session.
+        // A new session means that the master was restarted.
+        if (_have_sequence && session == _session
+                && static_cast<int32_t>(static_cast<uint32_t>(sequence) - _sequence) <= 0)
+        {
+            continue;
+        }
+        if (_have_sequence && session != _session)
+        {
+            msg::dbg("New synchronization session of the master.");
+        }
+        _session = session;
+        _sequence = sequence;
+        _have_sequence = true;
+        s->pos = pos;
+        s->receive_time = timer::get(timer::monotonic);
+        s->paused = paused;
+        s->seek_epoch = seek_epoch;
+        have_state = true;
+    }
+    return have_state;
+}
+
+#else
+
+void net_sync::open()
+{
+    if (!master_address.empty() || !follower_address.empty())
+    {
+        throw exc(_("Playback synchronization is not supported on this platform."));
+    }
+}
+
+void net_sync::close()
+{
+}
+
+void net_sync::send(int64_t, int64_t, bool, int)
+{
+}
+
+bool net_sync::receive(state*)
+{
+    return false;
+}
+
+#endif
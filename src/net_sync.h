@@ -0,0 +1,103 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NET_SYNC_H
+#define NET_SYNC_H
+
+#include <string>
+#include <stdint.h>
+
+/*
+ * Network synchronization of independent Bino instances.
+ *
+ * One instance is the master: it sends its playback clock to a UDP address,
+ * which may be a unicast, broadcast, or multicast address. The other
+ * instances are followers: they receive these datagrams and adjust their own
+ * clock; see player::follow_sync().
+ *
+ * Each datagram is one line of text:
+ *   bino-sync 2 <session> <sequence> <seek epoch> <paused> <position>
+ * The session is a random number that the master picks whenever it starts
+ * sending; the sequence number counts the datagrams of a session. The
+ * position is the input position of the master's video clock in
+ * microseconds at the time the datagram was sent. The seek epoch changes
+ * whenever the master seeks, so that followers seek at once instead of
+ * waiting for the clock difference to show.
+ */
+
+class net_sync
+{
+public:
+    /* The state of the master as received by a follower. */
+    struct state
+    {
+        int64_t pos;                    // Position of the master's video clock, microseconds
+        int64_t receive_time;           // Monotonic time at which it was received
+        bool paused;                    // Is the master in pause mode?
+        int seek_epoch;                 // Incremented by the master on every seek
+    };
+
+    /* Interval between two datagrams of the master, in microseconds. */
+    static const int64_t send_interval = 50000;
+
+private:
+    int _fd;
+    bool _master;
+    uint32_t _session;                  // Session of the last sent or received datagram
+    uint32_t _sequence;                 // Last sent or received sequence number
+    bool _have_sequence;
+    int64_t _last_send_time;
+    bool _last_paused;
+    int _last_seek_epoch;
+
+public:
+    /* Configure the role of this instance. The master sends to ADDRESS:PORT;
+     * a follower receives on [ADDRESS:]PORT, where ADDRESS may be a multicast
+     * group to join. The roles take effect when a player is opened. */
+    static void set_master(const std::string& address);
+    static void set_follower(const std::string& address);
+
+    net_sync();
+    ~net_sync();
+
+    /* Create the socket for the configured role, if any. Throw an exception
+     * if this fails. */
+    void open();
+    void close();
+
+    bool is_master() const
+    {
+        return _fd >= 0 && _master;
+    }
+    bool is_follower() const
+    {
+        return _fd >= 0 && !_master;
+    }
+
+    /* Master: send the current state if the send interval is over, or at once
+     * if the pause state or seek epoch changed. */
+    void send(int64_t now, int64_t pos, bool paused, int seek_epoch);
+
+    /* Follower: read all pending datagrams and return the newest state.
+     * Returns false if no new state arrived. */
+    bool receive(state* s);
+};
+
+#endif
@@ -24,6 +24,9 @@
 
 #include <vector>
 #include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <algorithm>
 #include <unistd.h>
 
 #include "base/exc.h"
@@ -31,6 +34,7 @@
 #include "base/str.h"
 #include "base/msg.h"
 #include "base/tmr.h"
+#include "base/trc.h"
 
 #include "base/gettext.h"
 #define _(string) gettext(string)
@@ -39,6 +43,7 @@
 #include "video_output.h"
 #include "media_input.h"
 #include "player.h"
+#include "benchmark_stats.h"
 
 
 extern dispatch* global_dispatch;
@@ -62,6 +67,24 @@ float player::normalize_pos(int64_t pos) const
         return 0.0f;
 }
 
+int64_t player::denormalize_pos(float pos) const
+{
+    int64_t dest_pos_min = _start_pos + global_dispatch->get_media_input()->initial_skip();
+    int64_t dest_pos_max = dest_pos_min + global_dispatch->get_media_input()->duration() - 2000000;
+    if (dest_pos_max <= dest_pos_min)
+        return _current_pos;
+    else
+        return static_cast<double>(pos) * dest_pos_max + (1.0 - static_cast<double>(pos)) * dest_pos_min;
+}
+
+bool player::use_audio() const
+{
+    // In live capture mode, waiting for audio data would delay video frames.
+    return (global_dispatch->get_audio_output()
+            && global_dispatch->get_media_input()->selected_audio_stream() >= 0
+            && !global_dispatch->get_media_input()->is_live());
+}
+
 void player::reset_playstate()
 {
     _running = false;
@@ -70,13 +93,40 @@ void player::reset_playstate()
     _need_frame_soon = false;
     _drop_next_frame = false;
     _previous_frame_dropped = false;
+    _video_skip_level = 0;
+    _late_frames = 0;
+    _punctual_frames = 0;
+    _variant_mark_time = -1;
+    _variant_mark_read_bytes = 0;
+    _variant_mark_read_time = 0;
+    _variant_throughput = -1;
+    _variant_good_periods = 0;
+    _variant_request = -1;
+    _sync_seek_epoch = 0;
+    _sync_master_epoch = -1;
+    _sync_error = 0;
+    _sync_error_valid = false;
+    _sync_correction_time = -1;
+    _sync_resync_time = -1;
+    _display_sync_speed = 1.0;
+    _display_sync_cadence = 0;
+    _display_sync_period = 0;
+    _display_sync_phase = 0.0;
     _in_pause = false;
     _recently_seeked = false;
+    _scrubbing = false;
+    _scrub_keyframe = std::numeric_limits<int64_t>::min();
+    _still_image = false;
+    _still_end = std::numeric_limits<int64_t>::max();
     _quit_request = false;
     _pause_request = false;
     _step_request = false;
     _seek_request = 0;
     _set_pos_request = -1.0f;
+    _scrub_request = -1.0f;
+    _input_switched = false;
+    _audio_continues = false;
+    _audio_rebase = false;
     _video_frame = video_frame();
     _current_subtitle_box = subtitle_box();
     _next_subtitle_box = subtitle_box();
@@ -85,13 +135,287 @@ void player::reset_playstate()
 void player::open()
 {
     reset_playstate();
+    _sync.open();
 }
 
 void player::close()
 {
+    benchmark_stats::stop();
+    _sync.close();
     reset_playstate();
 }
 
+void player::update_video_skip_level(int64_t delay)
+{
+    // Degrade gracefully when decoding cannot keep up: first let the decoder
+    // cut corners, and only drop decoded frames when that is not enough.
+    // Go back to full quality only after a long run of punctual frames, so
+    // that the level does not oscillate.
+    const int64_t frame_duration = global_dispatch->get_media_input()->video_frame_duration();
+    int level = _video_skip_level;
+    if (delay > frame_duration / 2)
+    {
+        _punctual_frames = 0;
+        if (++_late_frames >= 3 && level < media_input::max_video_skip_level)
+            level++;
+    }
+    else if (delay < frame_duration / 4)
+    {
+        if (++_punctual_frames >= 500 && level > 0)
+            level--;
+    }
+    if (level != _video_skip_level)
+    {
+        if (level > _video_skip_level)
+            msg::inf(_("Video: decoding is too slow; reducing video decoding quality (level %d)."), level);
+        else
+            msg::inf(_("Video: increasing video decoding quality (level %d)."), level);
+        _video_skip_level = level;
+        _late_frames = 0;
+        _punctual_frames = 0;
+        global_dispatch->get_media_input()->set_video_skip_level(level);
+    }
+}
+
+void player::update_display_sync(int64_t delay)
+{
+    // If the frame rate is within half a percent of a whole fraction of the
+    // refresh rate, play slightly faster or slower so that every frame is shown
+    // for the same number of refreshes instead of repeating one now and then.
+    // With audio, the audio output resamples to the new speed and its clock
+    // follows; otherwise our own timer runs at that speed. On top of this, the
+    // speed is nudged by up to 0.2% so that frames become due in the middle
+    // between two refreshes, where timing jitter does not move them to another
+    // refresh.
+    const double max_deviation = 0.005;
+    const double max_correction = 0.002;
+    const int64_t frame_duration = global_dispatch->get_media_input()->video_frame_duration();
+    int64_t period = (global_dispatch->get_video_output()
+            ? global_dispatch->get_video_output()->presentation_period() : 0);
+    int cadence = 0;
+    double base_speed = 1.0;
+    if (dispatch::parameters().display_sync() && period > 0 && frame_duration > 0)
+    {
+        cadence = std::max(static_cast<int>(frame_duration / static_cast<double>(period) + 0.5), 1);
+        base_speed = frame_duration / static_cast<double>(cadence * period);
+        if (std::abs(base_speed - 1.0) > max_deviation)
+        {
+            cadence = 0;
+            base_speed = 1.0;
+        }
+    }
+    if (cadence != _display_sync_cadence
+            || (cadence > 0 && std::abs(period - _display_sync_period) > period / 100))
+    {
+        if (cadence > 0)
+            msg::inf(_("Display sync: playing at %.2f%% speed to show each frame for %d refreshes."),
+                    base_speed * 100.0, cadence);
+        else if (_display_sync_cadence > 0)
+            msg::inf(_("Display sync: playing at normal speed."));
+        _display_sync_cadence = cadence;
+        _display_sync_period = period;
+        _display_sync_phase = 0.0;
+    }
+    double speed = 1.0;
+    if (cadence > 0)
+    {
+        // Ignore frames that are late, e.g. after a hiccup of the decoder.
+        if (delay >= 0 && delay < period)
+            _display_sync_phase += ((delay - period / 2) - _display_sync_phase) / 32.0;
+        double correction = -_display_sync_phase / 8e6;
+        speed = base_speed + std::min(std::max(correction, -max_correction), max_correction);
+    }
+    if (!use_audio() && speed != _display_sync_speed)
+    {
+        // Keep the master clock continuous at the current time.
+        int64_t now = timer::get(timer::monotonic);
+        int64_t master_time = static_cast<int64_t>((now - _master_time_start) * _display_sync_speed) + _master_time_pos;
+        _master_time_start = now - static_cast<int64_t>((master_time - _master_time_pos) / speed);
+    }
+    _display_sync_speed = speed;
+    if (use_audio())
+        global_dispatch->get_audio_output()->set_speed(speed);
+}
+
+void player::update_video_variant()
+{
+    // Measure the read throughput over periods of two seconds. Only the time
+    // spent reading counts, so the throughput is that of the connection even
+    // while the reader is idle because enough data is buffered.
+    // Switch down as soon as the current variant needs more than the measured
+    // throughput, or when the decoder cannot keep up with it. Switch up one
+    // variant at a time, and only after three periods in which the throughput
+    // exceeds its bandwidth by a safety margin.
+    const int64_t period = 2000000;
+    media_input *input = global_dispatch->get_media_input();
+    int64_t now = timer::get(timer::monotonic);
+    int64_t read_bytes, read_time;
+    input->get_read_stats(&read_bytes, &read_time);
+    if (_variant_mark_time < 0 || read_bytes < _variant_mark_read_bytes)
+    {
+        _variant_mark_time = now;
+        _variant_mark_read_bytes = read_bytes;
+        _variant_mark_read_time = read_time;
+        return;
+    }
+    if (now - _variant_mark_time < period)
+        return;
+    if (read_time > _variant_mark_read_time)
+    {
+        int64_t throughput = (read_bytes - _variant_mark_read_bytes) * 8 * 1000000
+            / (read_time - _variant_mark_read_time);
+        _variant_throughput = (_variant_throughput < 0 ? throughput
+                : (3 * _variant_throughput + throughput) / 4);
+    }
+    _variant_mark_time = now;
+    _variant_mark_read_bytes = read_bytes;
+    _variant_mark_read_time = read_time;
+    if (_variant_throughput < 0)
+        return;
+
+    int current = input->selected_video_stream();
+    int64_t current_bitrate = input->video_stream_bitrate(current);
+    if (current_bitrate <= 0)
+        return;
+    // The best variant below the given bandwidth, and the next better variant
+    int below = -1, better = -1;
+    int64_t limit = (_video_skip_level >= 2 ? current_bitrate : _variant_throughput * 8 / 10);
+    for (int i = 0; i < input->video_streams(); i++)
+    {
+        int64_t bitrate = input->video_stream_bitrate(i);
+        if (bitrate <= 0)
+            continue;
+        if (bitrate < limit && (below < 0 || bitrate > input->video_stream_bitrate(below)))
+            below = i;
+        if (bitrate > current_bitrate && (better < 0 || bitrate < input->video_stream_bitrate(better)))
+            better = i;
+    }
+    int variant = current;
+    if (_video_skip_level >= 2 || current_bitrate > _variant_throughput)
+    {
+        _variant_good_periods = 0;
+        if (below >= 0)
+            variant = below;
+    }
+    else if (better >= 0 && _video_skip_level == 0
+            && input->video_stream_bitrate(better) < _variant_throughput * 7 / 10)
+    {
+        if (++_variant_good_periods >= 3)
+            variant = better;
+    }
+    else
+    {
+        _variant_good_periods = 0;
+    }
+    if (variant != current)
+    {
+        msg::inf(_("Video: switching to the variant with %g kbit/s (measured throughput: %g kbit/s)."),
+                input->video_stream_bitrate(variant) / 1e3, _variant_throughput / 1e3);
+        _variant_request = variant;
+        _variant_good_periods = 0;
+    }
+}
+
+void player::switch_video_variant()
+{
+    media_input *input = global_dispatch->get_media_input();
+    int video_stream = set_video_stream(_variant_request);
+    int audio_stream = input->selected_audio_stream();
+    if (audio_stream >= 0)
+    {
+        int s = input->variant_audio_stream(video_stream, audio_stream);
+        if (s != audio_stream)
+            audio_stream = set_audio_stream(s);
+    }
+    // The segments of the new variant start at the current position.
+    _seek_request = -1;
+    _variant_request = -1;
+    _variant_mark_time = -1;
+    global_dispatch->set_streams(video_stream, audio_stream);
+}
+
+int64_t player::video_clock(int64_t now) const
+{
+    if (_in_pause || _pause_request)
+    {
+        return _video_pos;
+    }
+    else
+    {
+        // The master time including the audio delay determines which video frame is shown.
+        int64_t master_time = (use_audio() ? _master_time_current
+                : static_cast<int64_t>((now - _master_time_start) * _display_sync_speed) + _master_time_pos);
+        return master_time + dispatch::parameters().audio_delay();
+    }
+}
+
+void player::send_sync()
+{
+    int64_t now = timer::get(timer::monotonic);
+    _sync.send(now, video_clock(now), _pause_request, _sync_seek_epoch);
+}
+
+void player::follow_sync()
+{
+    // Follow the clock of the master. Differences of less than an eighth of a frame
+    // are tolerated. Larger ones are removed by slewing our clock by at most 0.5%,
+    // which is not noticeable, or by stepping it if they exceed a frame, which drops
+    // or repeats frames. Seeks of the master and differences of more than a second
+    // are followed by seeking. With audio, the audio output drives the clock, so
+    // seeking is the only way to catch up.
+    const int64_t seek_threshold = 1000000;
+    const int64_t max_slew_divisor = 200;
+    const int64_t resync_interval = 2000000;
+    net_sync::state s;
+    if (!_sync.receive(&s))
+        return;
+    int64_t now = s.receive_time;
+    bool master_seeked = (s.seek_epoch != _sync_master_epoch);
+    _sync_master_epoch = s.seek_epoch;
+    if (s.paused != _pause_request && !_still_image)
+    {
+        _pause_request = s.paused;
+        _step_request = false;
+    }
+    int64_t frame_duration = global_dispatch->get_media_input()->video_frame_duration();
+    int64_t error = s.pos - video_clock(now);
+    bool can_slew = (!use_audio() && !_pause_request);
+    if (master_seeked || std::abs(error) > seek_threshold
+            || (!can_slew && std::abs(error) > frame_duration
+                && (_sync_resync_time < 0 || now - _sync_resync_time > resync_interval)))
+    {
+        if (std::abs(error) > frame_duration / 2)
+        {
+            msg::dbg("Sync: seeking by %g seconds to follow the master.", error / 1e6f);
+            _seek_request = s.pos - _current_pos;
+            if (_seek_request == 0)
+                _seek_request = -1;
+            _sync_resync_time = now;
+            _sync_error_valid = false;
+            _sync_correction_time = -1;
+        }
+        return;
+    }
+    if (!can_slew)
+        return;
+    // Smooth the differences to hide the jitter of the network.
+    _sync_error = (_sync_error_valid ? _sync_error + (error - _sync_error) / 8 : error);
+    _sync_error_valid = true;
+    int64_t correction = 0;
+    if (std::abs(_sync_error) > frame_duration)
+    {
+        correction = _sync_error;
+    }
+    else if (std::abs(_sync_error) > frame_duration / 8 && _sync_correction_time >= 0)
+    {
+        int64_t max_correction = (now - _sync_correction_time) / max_slew_divisor;
+        correction = std::max(std::min(_sync_error, max_correction), -max_correction);
+    }
+    _sync_correction_time = now;
+    _master_time_start -= correction;
+    _sync_error -= correction;
+}
+
 void player::set_current_subtitle_box()
 {
     _current_subtitle_box = subtitle_box();
@@ -102,6 +426,64 @@ void player::set_current_subtitle_box()
     }
 }
 
+// Duration of an audio blob in microseconds
+static int64_t audio_blob_duration(const audio_blob &blob)
+{
+    int64_t samples = blob.size / (blob.channels * blob.sample_bits() / 8);
+    return samples * 1000000 / blob.rate;
+}
+
+void player::end_of_input(bool *more_steps)
+{
+    // The master time at which the current input ends: when the audio data
+    // passed to the audio output is used up, or when the last video frame
+    // has been shown for its duration.
+    bool had_audio = use_audio();
+    audio_blob audio_template;
+    int64_t end_pos;
+    if (had_audio)
+    {
+        audio_template = global_dispatch->get_media_input()->audio_blob_template();
+        end_pos = _audio_pos + _audio_blob_duration;
+    }
+    else
+    {
+        end_pos = _video_pos + global_dispatch->get_media_input()->video_frame_duration();
+    }
+    int64_t continue_time = (had_audio ? end_pos - _master_time_pos
+            : static_cast<int64_t>((end_pos - _master_time_pos) / _display_sync_speed)) + _master_time_start;
+
+    if (global_dispatch->switch_to_next_input())
+    {
+        // Continue with the next input: the next playlist entry, or a second
+        // instance of the current input in loop mode. The outputs keep showing
+        // the last frame until the first frame of the new input, which is
+        // already decoded, replaces it. If the audio format stays the same,
+        // the new audio data is simply appended to the queued data.
+        msg::dbg("Switching to next input.");
+        const audio_blob &t = global_dispatch->get_media_input()->audio_blob_template();
+        bool audio_continues = (had_audio && !_pause_request
+                && global_dispatch->get_media_input()->selected_audio_stream() >= 0
+                && t.channels == audio_template.channels
+                && t.rate == audio_template.rate
+                && t.sample_format == audio_template.sample_format);
+        if (had_audio && !audio_continues)
+        {
+            global_dispatch->get_audio_output()->stop();
+        }
+        reset_playstate();
+        _input_switched = true;
+        _audio_continues = audio_continues;
+        _continue_time = continue_time;
+        *more_steps = true;
+    }
+    else if (dispatch::parameters().loop_mode() != parameters::no_loop)
+    {
+        _set_pos_request = -0.0f; // the sign bit signals that this is loop mode
+        *more_steps = true;
+    }
+}
+
 int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *prep_frame, bool *drop_frame, bool *display_frame)
 {
     *more_steps = false;
@@ -139,8 +521,19 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
             }
             while (_next_subtitle_box.presentation_stop_time < _video_pos);
         }
-        if (global_dispatch->get_audio_output()
-                && global_dispatch->get_media_input()->selected_audio_stream() >= 0)
+        if (use_audio()
+                && _audio_continues)
+        {
+            // The audio output still plays the end of the previous input.
+            // Map the master time so that this input starts when that is
+            // used up; the first audio blob refines this mapping.
+            global_dispatch->get_media_input()->start_audio_blob_read(global_dispatch->get_audio_output()->required_update_data_size());
+            _master_time_start = _continue_time;
+            _master_time_pos = _video_pos;
+            _current_pos = _video_pos;
+            _audio_rebase = true;
+        }
+        else if (use_audio())
         {
             global_dispatch->get_media_input()->start_audio_blob_read(global_dispatch->get_audio_output()->required_initial_data_size());
             audio_blob blob = global_dispatch->get_media_input()->finish_audio_blob_read();
@@ -150,6 +543,7 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
                 return 0;
             }
             _audio_pos = blob.presentation_time;
+            _audio_blob_duration = audio_blob_duration(blob);
             global_dispatch->get_audio_output()->data(blob);
             global_dispatch->get_media_input()->start_audio_blob_read(global_dispatch->get_audio_output()->required_update_data_size());
             _master_time_start = global_dispatch->get_audio_output()->start();
@@ -159,12 +553,36 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
         else
         {
             _master_time_start = timer::get(timer::monotonic);
+            if (_input_switched)
+            {
+                // Show the last frame of the previous input for its full duration
+                _master_time_start = std::max(_master_time_start, _continue_time);
+            }
             _master_time_pos = _video_pos;
             _current_pos = _video_pos;
         }
+        _master_time_current = _master_time_pos;
         _start_pos = _current_pos;
-        _fps_mark_time = timer::get(timer::monotonic);
-        _frames_shown = 0;
+        global_dispatch->get_media_input()->get_conversion_stats(&_fps_mark_conversion_frames, &_fps_mark_conversion_time);
+        if (!_input_switched)
+        {
+            _fps_mark_time = timer::get(timer::monotonic);
+            _fps_mark_upload_frames = 0;
+            _fps_mark_upload_time = 0;
+            if (global_dispatch->get_video_output())
+            {
+                global_dispatch->get_video_output()->get_upload_stats(&_fps_mark_upload_frames, &_fps_mark_upload_time);
+            }
+            _frames_shown = 0;
+            _last_frame_time = -1;
+            _live_stats.reset();
+            if (dispatch::parameters().benchmark() || benchmark_stats::has_result_file())
+            {
+                benchmark_stats::start();
+            }
+        }
+        _input_switched = false;
+        _audio_continues = false;
         _running = true;
         if (global_dispatch->get_media_input()->initial_skip() > 0)
         {
@@ -181,6 +599,54 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
             return 0;
         }
     }
+    if (_sync.is_follower())
+    {
+        follow_sync();
+    }
+    else if (_sync.is_master())
+    {
+        send_sync();
+    }
+    if (_variant_request >= 0)
+    {
+        switch_video_variant();
+    }
+    if (_scrub_request >= 0.0f && _seek_request == 0 && _set_pos_request < 0.0f)
+    {
+        // Preview for the position slider: show the last key frame before the position.
+        // Requests are coalesced since only the newest one is kept, and a new seek is
+        // only necessary when the preview moves to another key frame.
+        int64_t pos = denormalize_pos(_scrub_request);
+        _scrub_request = -1.0f;
+        if (!_scrubbing)
+        {
+            if (use_audio())
+            {
+                global_dispatch->get_audio_output()->stop();
+            }
+            _scrubbing = true;
+        }
+        int64_t keyframe = global_dispatch->get_media_input()->keyframe_position(pos);
+        if (keyframe == std::numeric_limits<int64_t>::min() || keyframe != _scrub_keyframe)
+        {
+            _scrub_keyframe = keyframe;
+            global_dispatch->get_media_input()->seek(pos, true);
+            _next_subtitle_box = subtitle_box();
+            _current_subtitle_box = subtitle_box();
+            global_dispatch->get_media_input()->start_video_frame_read();
+            video_frame frame = global_dispatch->get_media_input()->finish_video_frame_read();
+            if (frame.is_valid())
+            {
+                // Otherwise, keep showing the previous preview.
+                _video_frame = frame;
+                _video_pos = _video_frame.presentation_time;
+                _recently_seeked = true;
+                *prep_frame = true;
+            }
+        }
+        *more_steps = true;
+        return 0;
+    }
     if (_seek_request != 0 || _set_pos_request >= 0.0f)
     {
         if (_set_pos_request >= 0.0f)
@@ -192,17 +658,7 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
             }
             else
             {
-                int64_t dest_pos_min = _start_pos + global_dispatch->get_media_input()->initial_skip();
-                int64_t dest_pos_max = dest_pos_min + global_dispatch->get_media_input()->duration() - 2000000;
-                if (dest_pos_max <= dest_pos_min)
-                {
-                    *seek_to = _current_pos;
-                }
-                else
-                {
-                    *seek_to = static_cast<double>(_set_pos_request) * dest_pos_max
-                        + (1.0 - static_cast<double>(_set_pos_request)) * dest_pos_min;
-                }
+                *seek_to = denormalize_pos(_set_pos_request);
             }
         }
         else
@@ -223,6 +679,10 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
         *do_seek = true;
         _seek_request = 0;
         _set_pos_request = -1.0f;
+        _scrub_request = -1.0f;
+        _scrubbing = false;
+        _scrub_keyframe = std::numeric_limits<int64_t>::min();
+        _sync_seek_epoch++;
         global_dispatch->get_media_input()->seek(*seek_to);
         _next_subtitle_box = subtitle_box();
         _current_subtitle_box = subtitle_box();
@@ -249,8 +709,7 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
             }
             while (_next_subtitle_box.presentation_stop_time < _video_pos);
         }
-        if (global_dispatch->get_audio_output()
-                && global_dispatch->get_media_input()->selected_audio_stream() >= 0)
+        if (use_audio())
         {
             global_dispatch->get_audio_output()->stop();
             global_dispatch->get_media_input()->start_audio_blob_read(global_dispatch->get_audio_output()->required_initial_data_size());
@@ -261,6 +720,7 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
                 return 0;
             }
             _audio_pos = blob.presentation_time;
+            _audio_blob_duration = audio_blob_duration(blob);
             global_dispatch->get_audio_output()->data(blob);
             global_dispatch->get_media_input()->start_audio_blob_read(global_dispatch->get_audio_output()->required_update_data_size());
             _master_time_start = global_dispatch->get_audio_output()->start();
@@ -273,6 +733,7 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
             _master_time_pos = _video_pos;
             _current_pos = _video_pos;
         }
+        _master_time_current = _master_time_pos;
         global_dispatch->set_position(normalize_pos(_current_pos));
         set_current_subtitle_box();
         _recently_seeked = true;
@@ -290,12 +751,46 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
         *more_steps = true;
         return 0;
     }
+    else if (_scrubbing)
+    {
+        // Keep showing the preview until the next scrub or seek request.
+        *more_steps = true;
+        return 1000;
+    }
+    else if (_still_image)
+    {
+        // The video output keeps showing the image, and nothing needs to be decoded.
+        // Continue when requested, or when the image duration of a playlist is over.
+        int64_t now = timer::get(timer::monotonic);
+        if (!_pause_request || now >= _still_end)
+        {
+            // In loop mode, the image is shown again after seeking back to it.
+            _still_image = false;
+            _first_frame = true;
+            bool next_input = false;
+            end_of_input(&next_input);
+            if (next_input)
+            {
+                global_dispatch->set_pausing(false);
+                *more_steps = true;
+                return 0;
+            }
+            // Nothing follows; keep showing the image.
+            _still_image = true;
+            _pause_request = true;
+            _step_request = false;
+            _still_end = std::numeric_limits<int64_t>::max();
+        }
+        *more_steps = true;
+        return (_still_end == std::numeric_limits<int64_t>::max()
+                ? std::numeric_limits<int64_t>::max()
+                : std::max(_still_end - now, static_cast<int64_t>(0)));
+    }
     else if (_pause_request)
     {
         if (!_in_pause)
         {
-            if (global_dispatch->get_audio_output()
-                && global_dispatch->get_media_input()->selected_audio_stream() >= 0)
+            if (use_audio())
             {
                 global_dispatch->get_audio_output()->pause();
             }
@@ -311,7 +806,25 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
     }
     else if (_need_frame_now)
     {
-        _video_frame = global_dispatch->get_media_input()->finish_video_frame_read();
+        video_frame next_frame = global_dispatch->get_media_input()->finish_video_frame_read();
+        if (!next_frame.is_valid() && _first_frame && !use_audio())
+        {
+            // Still images such as MPO or JPS photos are decoded only once, and the
+            // player then idles until a command arrives; see the _still_image step.
+            msg::dbg("Single-frame video input: showing a still image.");
+            _still_image = true;
+            float image_duration = dispatch::parameters().image_duration();
+            _still_end = (image_duration > 0.0f
+                    ? timer::get(timer::monotonic) + static_cast<int64_t>(image_duration * 1e6f)
+                    : std::numeric_limits<int64_t>::max());
+            _pause_request = true;
+            _step_request = false;
+            global_dispatch->set_pausing(true);
+            _need_frame_now = false;
+            *more_steps = true;
+            return 0;
+        }
+        _video_frame = next_frame;
         if (!_video_frame.is_valid())
         {
             if (_first_frame)
@@ -322,11 +835,7 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
             else
             {
                 msg::dbg("End of video stream.");
-                if (dispatch::parameters().loop_mode() == parameters::loop_current)
-                {
-                    _set_pos_request = -0.0f; // the sign bit signals that this is loop mode
-                    *more_steps = true;
-                }
+                end_of_input(more_steps);
                 return 0;
             }
         }
@@ -346,10 +855,9 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
                 // Ignore this and let audio/video continue.
             }
         }
-        if (!global_dispatch->get_audio_output()
-                || global_dispatch->get_media_input()->selected_audio_stream() < 0)
+        if (!use_audio())
         {
-            _master_time_start += (_video_pos - _master_time_pos);
+            _master_time_start += static_cast<int64_t>((_video_pos - _master_time_pos) / _display_sync_speed);
             _master_time_pos = _video_pos;
             _current_pos = _video_pos;
             global_dispatch->set_position(normalize_pos(_current_pos));
@@ -379,8 +887,7 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
     {
         if (_in_pause)
         {
-            if (global_dispatch->get_audio_output()
-                && global_dispatch->get_media_input()->selected_audio_stream() >= 0)
+            if (use_audio())
             {
                 global_dispatch->get_audio_output()->unpause();
             }
@@ -392,8 +899,7 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
             global_dispatch->set_pausing(false);
         }
 
-        if (global_dispatch->get_audio_output()
-                && global_dispatch->get_media_input()->selected_audio_stream() >= 0)
+        if (use_audio())
         {
             // Check if audio needs more data, and get audio time
             bool need_audio_data;
@@ -405,14 +911,18 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
                 if (!blob.is_valid())
                 {
                     msg::dbg("End of audio stream.");
-                    if (dispatch::parameters().loop_mode() == parameters::loop_current)
-                    {
-                        _set_pos_request = -0.0f; // the sign bit signals that this is loop mode
-                        *more_steps = true;
-                    }
+                    end_of_input(more_steps);
                     return 0;
                 }
                 _audio_pos = blob.presentation_time;
+                _audio_blob_duration = audio_blob_duration(blob);
+                if (_audio_rebase)
+                {
+                    // First blob after switching inputs: it is played when the
+                    // previously queued data is used up, at _master_time_start.
+                    _master_time_pos = _audio_pos;
+                    _audio_rebase = false;
+                }
                 _master_time_start += (_audio_pos - _master_time_pos);
                 _master_time_pos = _audio_pos;
                 global_dispatch->get_audio_output()->data(blob);
@@ -424,8 +934,8 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
         else
         {
             // Use our own timer
-            _master_time_current = timer::get(timer::monotonic) - _master_time_start
-                + _master_time_pos;
+            _master_time_current = static_cast<int64_t>((timer::get(timer::monotonic) - _master_time_start)
+                    * _display_sync_speed) + _master_time_pos;
         }
 
         int64_t allowable_sleep = 0;
@@ -436,22 +946,68 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
                 || dispatch::parameters().benchmark()
                 || global_dispatch->get_media_input()->is_device())
         {
+            // Commands scheduled for this frame must take effect before it is shown.
+            if (global_dispatch->scheduled_commands_due(_video_pos
+                        - _start_pos - global_dispatch->get_media_input()->initial_skip()))
+            {
+                *more_steps = true;
+                return 0;
+            }
             // Output current video frame
             _drop_next_frame = false;
             int64_t delay = next_frame_presentation_time - _video_pos;
-            if (delay > global_dispatch->get_media_input()->video_frame_duration() * 75 / 100
-                    && !dispatch::parameters().benchmark()
+            int64_t frame_duration = global_dispatch->get_media_input()->video_frame_duration();
+            bool may_degrade = (!dispatch::parameters().benchmark()
                     && !global_dispatch->get_media_input()->is_device()
-                    && !_step_request)
+                    && !_step_request);
+            if (may_degrade)
+            {
+                update_video_skip_level(delay);
+                update_display_sync(delay);
+                if (dispatch::parameters().adaptive_bitrate()
+                        && global_dispatch->get_media_input()->is_adaptive()
+                        && _video_frame.stereo_layout != parameters::layout_separate)
+                    update_video_variant();
+                if (global_dispatch->get_video_output())
+                    global_dispatch->get_video_output()->adapt_quality(frame_duration, delay);
+            }
+            // Drop frames only as a last resort, or when we are far behind.
+            if (may_degrade && delay > frame_duration * 75 / 100
+                    && (_video_skip_level == media_input::max_video_skip_level
+                        || delay > 2 * frame_duration))
             {
                 msg::wrn(_("Video: delay %g seconds/%g frames; dropping next frame."),
                          float(delay) / 1e6f, 
                          float(delay) / float(global_dispatch->get_media_input()->video_frame_duration()));
                 _drop_next_frame = true;
+                benchmark_stats::add_dropped_frame();
+                _live_stats.frame_dropped();
             }
             if (!_previous_frame_dropped)
             {
                 *display_frame = true;
+                _live_stats.frame_displayed(_video_pos, delay, _video_skip_level);
+                if (benchmark_stats::enabled())
+                {
+                    // In benchmark mode, a frame is late if it took longer than
+                    // its duration; otherwise if it missed its presentation time.
+                    int64_t now = timer::get(timer::monotonic);
+                    if (_last_frame_time >= 0)
+                    {
+                        benchmark_stats::add(benchmark_stats::frame, now - _last_frame_time);
+                    }
+                    else
+                    {
+                        benchmark_stats::first_frame_displayed();
+                    }
+                    if (dispatch::parameters().benchmark()
+                            ? (_last_frame_time >= 0 && now - _last_frame_time > frame_duration)
+                            : (delay > frame_duration / 2))
+                    {
+                        benchmark_stats::add_late_frame();
+                    }
+                    _last_frame_time = now;
+                }
                 if (_step_request)
                     _pause_request = true;
                 if (dispatch::parameters().benchmark())
@@ -460,8 +1016,29 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
                     if (_frames_shown == 100)   //show fps each 100 frames
                     {
                         int64_t now = timer::get(timer::monotonic);
-                        msg::inf(_("FPS: %.2f"), static_cast<float>(_frames_shown) / ((now - _fps_mark_time) / 1e6f));
+                        const std::string& hwaccel = global_dispatch->get_media_input()->video_hwaccel();
+                        int64_t upload_frames = 0, upload_time = 0;
+                        if (global_dispatch->get_video_output())
+                        {
+                            global_dispatch->get_video_output()->get_upload_stats(&upload_frames, &upload_time);
+                        }
+                        int64_t conversion_frames = 0, conversion_time = 0;
+                        global_dispatch->get_media_input()->get_conversion_stats(&conversion_frames, &conversion_time);
+                        // The counters are totals; use the differences to the last mark.
+                        int64_t conversion_frames_diff = conversion_frames - _fps_mark_conversion_frames;
+                        int64_t upload_frames_diff = upload_frames - _fps_mark_upload_frames;
+                        msg::inf(_("FPS: %.2f (%s decoding), conversion: %.2f ms/frame, upload: %.2f ms/frame"),
+                                static_cast<float>(_frames_shown) / ((now - _fps_mark_time) / 1e6f),
+                                hwaccel.empty() ? _("software") : hwaccel.c_str(),
+                                conversion_frames_diff > 0
+                                ? (conversion_time - _fps_mark_conversion_time) / 1e3f / conversion_frames_diff : 0.0f,
+                                upload_frames_diff > 0
+                                ? (upload_time - _fps_mark_upload_time) / 1e3f / upload_frames_diff : 0.0f);
                         _fps_mark_time = now;
+                        _fps_mark_upload_frames = upload_frames;
+                        _fps_mark_upload_time = upload_time;
+                        _fps_mark_conversion_frames = conversion_frames;
+                        _fps_mark_conversion_time = conversion_time;
                         _frames_shown = 0;
                     }
                 }
@@ -488,8 +1065,9 @@ int64_t player::step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *pr
     }
 }
 
-bool player::run_step()
+bool player::run_step(int64_t *sleep_time)
 {
+    trace_scope step_trace("player step");
     bool more_steps;
     bool do_seek;
     int64_t seek_to;
@@ -506,11 +1084,34 @@ bool player::run_step()
     }
     if (prep_frame)
     {
-        if (_current_subtitle_box.is_valid() && global_dispatch->get_video_output())
+        subtitle_box subtitle = _current_subtitle_box;
+        if (dispatch::parameters().stats_overlay())
         {
-            _master_time_start += global_dispatch->get_video_output()->wait_for_subtitle_renderer();
+            subtitle = _live_stats.overlay(subtitle);
         }
-        global_dispatch->get_video_output()->prepare_next_frame(_video_frame, _current_subtitle_box);
+        if (subtitle.is_valid() && global_dispatch->get_video_output() && dispatch::in_player_thread())
+        {
+            // Waiting for the subtitle renderer involves the GUI, so the player
+            // thread shows no subtitles until the renderer is ready instead.
+            if (!global_dispatch->get_video_output()->subtitle_renderer_is_initialized())
+            {
+                subtitle = subtitle_box();
+            }
+        }
+        else if (subtitle.is_valid() && global_dispatch->get_video_output())
+        {
+            int64_t wait_time = global_dispatch->get_video_output()->wait_for_subtitle_renderer();
+            if (wait_time > 0)
+            {
+                msg::inf(_("Playback was blocked for %g seconds by subtitle renderer initialization."),
+                        wait_time / 1e6);
+                _master_time_start += wait_time;
+            }
+        }
+        // The next subtitle is announced until it becomes the current one.
+        global_dispatch->get_video_output()->set_upcoming_subtitle(
+                _next_subtitle_box == _current_subtitle_box ? subtitle_box() : _next_subtitle_box);
+        global_dispatch->get_video_output()->prepare_next_frame(_video_frame, subtitle);
     }
     else if (drop_frame)
     {
@@ -521,7 +1122,16 @@ bool player::run_step()
     }
 
     dispatch::process_all_events();
-    if (allowed_sleep > 0)
+    if (sleep_time)
+    {
+        *sleep_time = allowed_sleep;
+    }
+    else if (allowed_sleep >= idle_sleep_time)
+    {
+        // Nobody can wake us up early, so keep reacting to events.
+        usleep(1000);
+    }
+    else if (allowed_sleep > 0)
     {
         usleep(allowed_sleep);
     }
@@ -558,6 +1168,11 @@ void player::set_pos(float pos)
     _set_pos_request = pos;
 }
 
+void player::scrub(float pos)
+{
+    _scrub_request = pos;
+}
+
 int player::set_video_stream(int s)
 {
     assert(dispatch::media_input())
@@ -572,8 +1187,9 @@ int player::set_audio_stream(int s)
 {
     assert(dispatch::media_input())
     assert(s >= 0 && s < dispatch::media_input()->audio_streams());
-    global_dispatch->get_media_input()->select_audio_stream(s);
-    if (dispatch::playing())
+    // A seamless switch continues at the current position; see media_input::select_audio_stream().
+    bool seamless = global_dispatch->get_media_input()->select_audio_stream(s);
+    if (dispatch::playing() && !seamless)
         _seek_request = -1; // Get position right
     return s;
 }
@@ -582,8 +1198,8 @@ int player::set_subtitle_stream(int s)
 {
     assert(dispatch::media_input())
     assert(s >= -1 && s < dispatch::media_input()->subtitle_streams());
-    global_dispatch->get_media_input()->select_subtitle_stream(s);
-    if (dispatch::playing())
+    bool seamless = global_dispatch->get_media_input()->select_subtitle_stream(s);
+    if (dispatch::playing() && !seamless)
         _seek_request = -1; // Get position right
     return s;
 }
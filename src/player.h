@@ -30,6 +30,8 @@
 #include "base/ser.h"
 
 #include "dispatch.h"
+#include "live_stats.h"
+#include "net_sync.h"
 
 
 /*
@@ -44,6 +46,14 @@ private:
     // Benchmark mode
     int _frames_shown;                          // Frames shown since last reset
     int64_t _fps_mark_time;                     // Time when _frames_shown was reset to zero
+    int64_t _fps_mark_upload_frames;            // Upload and conversion counters at that time
+    int64_t _fps_mark_upload_time;
+    int64_t _fps_mark_conversion_frames;
+    int64_t _fps_mark_conversion_time;
+    int64_t _last_frame_time;                   // Time when the last frame was displayed, for benchmark_stats
+
+    // Live statistics for the overlay and the stats file
+    live_stats _live_stats;
 
     // The play state
     bool _running;                              // Are we running?
@@ -52,8 +62,21 @@ private:
     bool _need_frame_soon;                      // Do we need another video frame soon?
     bool _drop_next_frame;                      // Do we need to drop the next video frame (to catch up)?
     bool _previous_frame_dropped;               // Did we drop the previous video frame?
+    int _video_skip_level;                      // Current decoder skip level, see media_object::set_video_skip_level()
+    int _late_frames;                           // Late frames since the last skip level change
+    int _punctual_frames;                       // Consecutive punctual frames since the last skip level change
+    int64_t _variant_mark_time;                 // Start of the current variant measurement period, or -1
+    int64_t _variant_mark_read_bytes;           // Read counters of the media input at the start of the period
+    int64_t _variant_mark_read_time;
+    int64_t _variant_throughput;                // Smoothed read throughput in bits per second, or -1
+    int _variant_good_periods;                  // Consecutive periods with headroom for the next better variant
+    int _variant_request;                       // Video stream to switch to, or -1
     bool _in_pause;                             // Are we in pause mode?
     bool _recently_seeked;                      // We did not yet display a video frame after the last seek.
+    bool _scrubbing;                            // Are we showing key frame previews for the position slider?
+    int64_t _scrub_keyframe;                    // Key frame position of the current preview
+    bool _still_image;                          // Is the input a single frame that stays on display?
+    int64_t _still_end;                         // Monotonic time at which to continue after a still image
 
     // Requests made by controller commands
     bool _quit_request;                         // Request to quit
@@ -61,6 +84,7 @@ private:
     bool _step_request;                         // Request for single-frame stepping mode
     int64_t _seek_request;                      // Request to seek relative to the current position
     float _set_pos_request;                     // Request to seek to the absolute position (normalized 0..1)
+    float _scrub_request;                       // Request to preview the absolute position (normalized 0..1)
 
     /* Timing information. All times are in microseconds.
      * The master time is the audio time if audio output is available,
@@ -74,11 +98,54 @@ private:
     int64_t _master_time_start;                 // Master time offset
     int64_t _master_time_current;               // Current master time
     int64_t _master_time_pos;                   // Input position at master time start
+    int64_t _audio_blob_duration;               // Duration of the last audio blob passed to the output
+
+    // Network synchronization with other instances; see net_sync.h
+    net_sync _sync;
+    int _sync_seek_epoch;                       // Master: incremented on every seek
+    int _sync_master_epoch;                     // Follower: last seek epoch of the master, or -1
+    int64_t _sync_error;                        // Follower: smoothed clock difference to the master
+    bool _sync_error_valid;
+    int64_t _sync_correction_time;              // Follower: time of the last clock correction
+    int64_t _sync_resync_time;                  // Follower: time of the last seek to catch up, or -1
+
+    // Display-synchronous playback; see update_display_sync()
+    double _display_sync_speed;                 // Speed of the master clock
+    int _display_sync_cadence;                  // Refreshes per video frame, or 0 if not locked
+    int64_t _display_sync_period;               // Presentation period of the video output when locked
+    double _display_sync_phase;                 // Smoothed offset of the frame delay from half a period
+
+    // Switching to the next input without stopping the outputs
+    bool _input_switched;                       // Did we just switch to the next input?
+    bool _audio_continues;                      // Does the audio output keep playing across the switch?
+    bool _audio_rebase;                         // Does the master time need to be rebased on the next audio blob?
+    int64_t _continue_time;                     // Master time at which the new input starts
 
     /* Helper functions */
 
-    // Normalize an input position to [0,1]
+    // Adapt the decoder skip level to the delay of the current video frame
+    void update_video_skip_level(int64_t delay);
+
+    // Adapt the speed of the master clock so that each video frame is shown for
+    // a whole number of display refreshes
+    void update_display_sync(int64_t delay);
+
+    // Choose the variant of an adaptive network stream from the read throughput
+    // and the decoder skip level, and request a switch if necessary
+    void update_video_variant();
+    // Switch to the requested variant
+    void switch_video_variant();
+
+    // The input position that the video clock shows at the given monotonic time
+    int64_t video_clock(int64_t now) const;
+
+    // Send our clock to followers, or follow the clock of the master
+    void send_sync();
+    void follow_sync();
+
+    // Normalize an input position to [0,1], and map it back to a seek destination
     float normalize_pos(int64_t pos) const;
+    int64_t denormalize_pos(float pos) const;
 
     // Set the current subtitle from the next subtitle
     void set_current_subtitle_box();
@@ -86,6 +153,12 @@ private:
     // Reset the play state
     void reset_playstate();
 
+    // Whether audio is played and drives the master time
+    bool use_audio() const;
+
+    // Handle the end of the input: loop, switch to the next input, or stop
+    void end_of_input(bool *more_steps);
+
     // Stop playback
     void stop_playback();
 
@@ -108,12 +181,18 @@ public:
     /* Close the player and clean up. */
     virtual void close();
 
+    // Steps that allow a sleep of at least this many microseconds leave the player idle,
+    // e.g. while it shows a still image. The caller may then sleep until the next command
+    // arrives, if that is earlier.
+    static const int64_t idle_sleep_time = 10000;
+
     // Execute one step and indicate required actions. Returns the number of microseconds
     // that the caller may sleep before starting the next step.
     int64_t step(bool *more_steps, bool *do_seek, int64_t *seek_to, bool *prep_frame, bool *drop_frame, bool *display_frame);
 
     // Execute one step and immediately take required actions. Return true if more steps are required.
-    bool run_step();
+    // If sleep_time is not NULL, the caller does the sleeping that the step allows.
+    bool run_step(int64_t *sleep_time = NULL);
 
     /* Dispatch interface. TODO: remove this */
     void quit_request();
@@ -121,6 +200,7 @@ public:
     void set_step(bool s);
     void seek(int64_t offset);
     void set_pos(float pos);
+    void scrub(float pos);
 
     int set_video_stream(int s);
     int set_audio_stream(int s);
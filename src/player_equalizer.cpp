@@ -25,11 +25,13 @@
 #include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <unistd.h>     // for usleep()
 
 #include <eq/eq.h>
 
 #include "base/dbg.h"
+#include "base/exc.h"
 #include "base/msg.h"
 #include "base/ser.h"
 
@@ -73,16 +75,17 @@ class player_eq_node : public player
 {
 private:
     class media_input _media_input;
+    bool _read_failed;
 
 public:
-    player_eq_node() : player()
+    player_eq_node() : player(), _read_failed(false)
     {
     }
 
     bool init(const open_input_data& input)
     {
         try {
-            _media_input.open(input.urls, input.dev_request);
+            _media_input.open(input.urls, input.dev_request, dispatch::parameters());
             if (_media_input.video_streams() == 0)
                 throw exc(_("No video streams found."));
             if (input.params.stereo_layout_is_set() || input.params.stereo_layout_swap_is_set())
@@ -110,14 +113,32 @@ public:
         _media_input.start_video_frame_read();
     }
 
-    void finish_frame_read()
+    void finish_frame_read(int64_t presentation_time)
     {
-        // Only called on slave nodes
-        _video_frame = _media_input.finish_video_frame_read();
-        if (!_video_frame.is_valid())
+        // Only called on slave nodes.
+        // The master might have dropped frames, and this node might lag behind,
+        // so skip frames up to the one that the master displays. The decoder
+        // works ahead in the background, which absorbs jitter of this node.
+        for (;;)
         {
-            msg::err(_("Reading input frame failed."));
-            std::exit(1);
+            video_frame frame = _media_input.finish_video_frame_read();
+            if (!frame.is_valid())
+            {
+                // Keep displaying the previous frame instead of giving up.
+                if (!_read_failed)
+                {
+                    msg::wrn(_("Reading input frame failed."));
+                    _read_failed = true;
+                }
+                break;
+            }
+            _read_failed = false;
+            if (frame.presentation_time >= presentation_time)
+            {
+                _video_frame = frame;
+                break;
+            }
+            _media_input.start_video_frame_read();
         }
     }
 };
@@ -203,6 +224,23 @@ public:
         _canvas_video_area_h = canvas_video_area_h;
     }
 
+    // On flat screens, only upload the part of the video that this channel shows.
+    // The texture coordinates are axis-aligned in that case.
+    void set_visible_area(float video_x, float video_y, float video_w, float video_h,
+            const eq::Viewport &channel_area, const float tex_coords[4][2])
+    {
+        float x0 = std::min(std::max((channel_area.x - video_x) / video_w, 0.0f), 1.0f);
+        float x1 = std::min(std::max((channel_area.x + channel_area.w - video_x) / video_w, 0.0f), 1.0f);
+        float y0 = std::min(std::max((channel_area.y - video_y) / video_h, 0.0f), 1.0f);
+        float y1 = std::min(std::max((channel_area.y + channel_area.h - video_y) / video_h, 0.0f), 1.0f);
+        float tx0 = tex_coords[0][0] + x0 * (tex_coords[1][0] - tex_coords[0][0]);
+        float tx1 = tex_coords[0][0] + x1 * (tex_coords[1][0] - tex_coords[0][0]);
+        float ty0 = tex_coords[0][1] + y0 * (tex_coords[3][1] - tex_coords[0][1]);
+        float ty1 = tex_coords[0][1] + y1 * (tex_coords[3][1] - tex_coords[0][1]);
+        set_input_region(std::min(tx0, tx1), std::min(ty0, ty1),
+                std::fabs(tx1 - tx0), std::fabs(ty1 - ty0));
+    }
+
     void display_current_frame(bool mono_right_instead_of_left,
             float x, float y, float w, float h,
             const GLint viewport[4], const float tex_coords[4][2])
@@ -295,21 +333,115 @@ class eq_frame_data : public co::Object
 {
 public:
     std::string dispatch_state;
+    bool dispatch_state_changed;        // set on render nodes when a new state arrived; reset by the user
     subtitle_box subtitle;
+    float position;
     bool do_seek;
     int64_t seek_to;
     bool prep_frame;
+    int64_t prep_frame_time;            // presentation time of the frame to prepare
     bool drop_frame;
     bool display_frame;
     bool display_statistics;
     struct { float x, y, w, h, d; } canvas_video_area;
     float tex_coords[4][2];
 
+private:
+    /* Frame data is distributed to the render nodes with every frame. Each
+     * update starts with a fixed-size header that holds the per-frame values.
+     * The dispatch state and the subtitle follow only if they changed since
+     * the last update, which is rare during playback. */
+    static const uint32_t format_version = 2;
+    enum
+    {
+        flag_do_seek = 1,
+        flag_prep_frame = 2,
+        flag_drop_frame = 4,
+        flag_display_frame = 8,
+        flag_display_statistics = 16,
+        flag_dispatch_state = 32,
+        flag_subtitle = 64
+    };
+    struct header
+    {
+        uint32_t version;
+        uint32_t flags;
+        int64_t seek_to;
+        int64_t prep_frame_time;
+        float position;
+        float canvas_video_area[5];
+        float tex_coords[4][2];
+    };
+
+    // The dispatch state and subtitle that the last delta was based on
+    std::string _packed_dispatch_state;
+    subtitle_box _packed_subtitle;
+    // Reused for serializing the frame data
+    s11n::writer _buffer;
+
+    void save(co::DataOStream &os, bool with_dispatch_state, bool with_subtitle)
+    {
+        header h;
+        h.version = format_version;
+        h.flags = (do_seek ? flag_do_seek : 0)
+            | (prep_frame ? flag_prep_frame : 0)
+            | (drop_frame ? flag_drop_frame : 0)
+            | (display_frame ? flag_display_frame : 0)
+            | (display_statistics ? flag_display_statistics : 0)
+            | (with_dispatch_state ? flag_dispatch_state : 0)
+            | (with_subtitle ? flag_subtitle : 0);
+        h.seek_to = seek_to;
+        h.prep_frame_time = prep_frame_time;
+        h.position = position;
+        std::memcpy(h.canvas_video_area, &canvas_video_area, sizeof(h.canvas_video_area));
+        std::memcpy(h.tex_coords, tex_coords, sizeof(h.tex_coords));
+        _buffer.clear();
+        s11n::save(_buffer, &h, sizeof(h));
+        if (with_dispatch_state)
+            s11n::save(_buffer, dispatch_state);
+        if (with_subtitle)
+            s11n::save(_buffer, subtitle);
+        os << _buffer.str();
+    }
+
+    void load(co::DataIStream &is)
+    {
+        std::string s;
+        is >> s;
+        s11n::reader r(s);
+        header h;
+        s11n::load(r, &h, sizeof(h));
+        if (h.version != format_version)
+        {
+            throw exc(_("Equalizer nodes use incompatible Bino versions."));
+        }
+        do_seek = (h.flags & flag_do_seek);
+        prep_frame = (h.flags & flag_prep_frame);
+        drop_frame = (h.flags & flag_drop_frame);
+        display_frame = (h.flags & flag_display_frame);
+        display_statistics = (h.flags & flag_display_statistics);
+        seek_to = h.seek_to;
+        prep_frame_time = h.prep_frame_time;
+        position = h.position;
+        std::memcpy(&canvas_video_area, h.canvas_video_area, sizeof(h.canvas_video_area));
+        std::memcpy(tex_coords, h.tex_coords, sizeof(h.tex_coords));
+        if (h.flags & flag_dispatch_state)
+        {
+            s11n::load(r, dispatch_state);
+            dispatch_state_changed = true;
+        }
+        if (h.flags & flag_subtitle)
+            s11n::load(r, subtitle);
+    }
+
 public:
     eq_frame_data() :
+        dispatch_state_changed(false),
+        position(0.0f),
         do_seek(false),
         seek_to(0),
         prep_frame(false),
+        prep_frame_time(0),
         drop_frame(false),
         display_frame(false),
         display_statistics(false)
@@ -319,40 +451,35 @@ public:
 protected:
     virtual ChangeType getChangeType() const
     {
-        return co::Object::INSTANCE;
+        return co::Object::DELTA;
     }
 
+    // Full data for nodes that map this object
     virtual void getInstanceData(co::DataOStream &os)
     {
-        std::ostringstream oss;
-        s11n::save(oss, dispatch_state);
-        s11n::save(oss, subtitle);
-        s11n::save(oss, do_seek);
-        s11n::save(oss, seek_to);
-        s11n::save(oss, prep_frame);
-        s11n::save(oss, drop_frame);
-        s11n::save(oss, display_frame);
-        s11n::save(oss, display_statistics);
-        s11n::save(oss, &canvas_video_area, sizeof(canvas_video_area));
-        s11n::save(oss, tex_coords, sizeof(tex_coords));
-        os << oss.str();
+        save(os, true, true);
     }
 
     virtual void applyInstanceData(co::DataIStream &is)
     {
-        std::string s;
-        is >> s;
-        std::istringstream iss(s);
-        s11n::load(iss, dispatch_state);
-        s11n::load(iss, subtitle);
-        s11n::load(iss, do_seek);
-        s11n::load(iss, seek_to);
-        s11n::load(iss, prep_frame);
-        s11n::load(iss, drop_frame);
-        s11n::load(iss, display_frame);
-        s11n::load(iss, display_statistics);
-        s11n::load(iss, &canvas_video_area, sizeof(canvas_video_area));
-        s11n::load(iss, tex_coords, sizeof(tex_coords));
+        load(is);
+    }
+
+    // Changes relative to the previous version for nodes that are already mapped
+    virtual void pack(co::DataOStream &os)
+    {
+        bool with_dispatch_state = (dispatch_state != _packed_dispatch_state);
+        bool with_subtitle = (subtitle != _packed_subtitle);
+        save(os, with_dispatch_state, with_subtitle);
+        if (with_dispatch_state)
+            _packed_dispatch_state = dispatch_state;
+        if (with_subtitle)
+            _packed_subtitle = subtitle;
+    }
+
+    virtual void unpack(co::DataIStream &is)
+    {
+        load(is);
     }
 };
 
@@ -434,6 +561,9 @@ public:
         // Update the video state for all (it might have changed via handleEvent())
         _eq_frame_data.subtitle = global_player_equalizer->get_subtitle_box();
         _eq_frame_data.dispatch_state = global_dispatch->save_state();
+        _eq_frame_data.position = dispatch::position();
+        if (_eq_frame_data.prep_frame)
+            _eq_frame_data.prep_frame_time = global_player_equalizer->get_video_frame().presentation_time;
         // Find region of canvas to use, depending on the video aspect ratio and zoom level
         float aspect_ratio = dispatch::media_input()->video_frame_template().aspect_ratio;
         float crop_aspect_ratio = dispatch::parameters().crop_aspect_ratio();
@@ -753,7 +883,8 @@ protected:
         {
             _dispatch = new dispatch(NULL, NULL, true, init_data.flat_screen, true,
                     false, false, init_data.params.log_level(), init_data.params.benchmark(),
-                    init_data.params.swap_interval());
+                    init_data.params.swap_interval(), init_data.params.swap_group(),
+                    init_data.params.swap_barrier(), std::string());
             if (!_player.init(init_data.input))
             {
                 msg::err(_("Video player initialization failed."));
@@ -790,20 +921,21 @@ protected:
         }
         else
         {
-            _dispatch->load_state(frame_data.dispatch_state);
+            if (frame_data.dispatch_state_changed)
+            {
+                _dispatch->load_state(frame_data.dispatch_state);
+                frame_data.dispatch_state_changed = false;
+            }
+            _dispatch->set_position(frame_data.position);
             if (frame_data.do_seek)
             {
                 _player.seek(frame_data.seek_to);
             }
             if (frame_data.prep_frame)
             {
-                _player.finish_frame_read();
-            }
-            if (frame_data.drop_frame)
-            {
-                _player.finish_frame_read();
-                _player.start_frame_read();
+                _player.finish_frame_read(frame_data.prep_frame_time);
             }
+            // Frames that the master drops are skipped by finish_frame_read().
         }
         startFrame(frame_number);
     }
@@ -981,6 +1113,13 @@ protected:
         if (node->frame_data.prep_frame)
         {
             getWindow()->makeCurrent();
+            if (node->init_data.flat_screen)
+            {
+                _video_output.set_visible_area(
+                        node->frame_data.canvas_video_area.x, node->frame_data.canvas_video_area.y,
+                        node->frame_data.canvas_video_area.w, node->frame_data.canvas_video_area.h,
+                        getViewport(), node->frame_data.tex_coords);
+            }
             if (node->frame_data.subtitle.is_valid())
             {
                 _video_output.wait_for_subtitle_renderer();
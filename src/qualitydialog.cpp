@@ -29,6 +29,7 @@
 #include <QLabel>
 #include <QSlider>
 #include <QSpinBox>
+#include <QComboBox>
 #include <QGridLayout>
 
 #include "qualitydialog.h"
@@ -47,11 +48,20 @@ quality_dialog::quality_dialog(QWidget *parent) : QWidget(parent), _lock(false)
     _q_spinbox->setValue(dispatch::parameters().quality());
     _q_spinbox->setSingleStep(1);
     connect(_q_spinbox, SIGNAL(valueChanged(int)), this, SLOT(q_spinbox_changed(int)));
+    QLabel *deinterlacing_label = new QLabel(_("Deinterlacing:"));
+    _deinterlacing_combobox = new QComboBox();
+    _deinterlacing_combobox->addItem(_("Off"));
+    _deinterlacing_combobox->addItem(_("Bob"));
+    _deinterlacing_combobox->addItem(_("Motion adaptive"));
+    _deinterlacing_combobox->setCurrentIndex(dispatch::parameters().deinterlacing());
+    connect(_deinterlacing_combobox, SIGNAL(currentIndexChanged(int)), this, SLOT(deinterlacing_changed(int)));
 
     QGridLayout *layout = new QGridLayout;
     layout->addWidget(q_label, 0, 0);
     layout->addWidget(_q_slider, 0, 1);
     layout->addWidget(_q_spinbox, 0, 2);
+    layout->addWidget(deinterlacing_label, 1, 0);
+    layout->addWidget(_deinterlacing_combobox, 1, 1, 1, 2);
     setLayout(layout);
 }
 
@@ -67,6 +77,12 @@ void quality_dialog::q_spinbox_changed(int val)
         send_cmd(command::set_quality, val);
 }
 
+void quality_dialog::deinterlacing_changed(int index)
+{
+    if (!_lock)
+        send_cmd(command::set_deinterlacing, index);
+}
+
 void quality_dialog::receive_notification(const notification &note)
 {
     switch (note.type)
@@ -77,6 +93,11 @@ void quality_dialog::receive_notification(const notification &note)
         _q_spinbox->setValue(dispatch::parameters().quality());
         _lock = false;
         break;
+    case notification::deinterlacing:
+        _lock = true;
+        _deinterlacing_combobox->setCurrentIndex(dispatch::parameters().deinterlacing());
+        _lock = false;
+        break;
     default:
         /* not handled */
         break;
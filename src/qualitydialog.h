@@ -33,6 +33,7 @@
 
 class QSpinBox;
 class QSlider;
+class QComboBox;
 
 class quality_dialog : public QWidget, public controller
 {
@@ -42,10 +43,12 @@ private:
     bool _lock;
     QSpinBox *_q_spinbox;
     QSlider *_q_slider;
+    QComboBox *_deinterlacing_combobox;
 
 private slots:
     void q_slider_changed(int val);
     void q_spinbox_changed(int val);
+    void deinterlacing_changed(int index);
 
 public:
     quality_dialog(QWidget *parent = 0);
@@ -48,12 +48,21 @@ extern "C"
 #include "base/blb.h"
 #include "base/msg.h"
 #include "base/pth.h"
+#include "base/tmr.h"
+#include "base/trc.h"
 
 #include "base/gettext.h"
 #define _(string) gettext(string)
 
 #include "subtitle_renderer.h"
 
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+# include <immintrin.h>
+# define HAVE_X86_BLEND 1
+#else
+# define HAVE_X86_BLEND 0
+#endif
+
 
 subtitle_renderer_initializer::subtitle_renderer_initializer(subtitle_renderer &renderer) :
     _subtitle_renderer(renderer)
@@ -62,6 +71,8 @@ subtitle_renderer_initializer::subtitle_renderer_initializer(subtitle_renderer &
 
 void subtitle_renderer_initializer::run()
 {
+    trace::set_thread_track("subtitle renderer initialization");
+    trace_scope init_trace("initialize subtitle renderer");
     _subtitle_renderer.init();
 }
 
@@ -83,13 +94,14 @@ static mutex global_libass_mutex;
 
 subtitle_renderer::subtitle_renderer() :
     _initializer(*this),
+    _init_started(false),
     _initialized(false),
     _fontconfig_conffile(NULL),
     _ass_library(NULL),
     _ass_renderer(NULL),
-    _ass_track(NULL)
+    _ass_track(NULL),
+    _bb_x(0), _bb_y(0), _bb_w(0), _bb_h(0)
 {
-    _initializer.start();
 }
 
 subtitle_renderer::~subtitle_renderer()
@@ -165,6 +177,7 @@ const char *subtitle_renderer::get_fontconfig_conffile()
 # if ((defined _WIN32 || defined __WIN32__) && !defined __CYGWIN__)
             "<dir>WINDOWSFONTDIR</dir>\n"
             "<dir>~/.fonts</dir>\n"
+            "<cachedir>LOCAL_APPDATA_FONTCONFIG_CACHE</cachedir>\n"
             "<cachedir>WINDOWSTEMPDIR_FONTCONFIG_CACHE</cachedir>\n"
             "<cachedir>~/.fontconfig</cachedir>\n"
 # else /* __APPLE__ */
@@ -213,6 +226,7 @@ void subtitle_renderer::init()
 {
     if (!_initialized)
     {
+        int64_t init_start = timer::get(timer::monotonic);
         try
         {
             global_libass_mutex.lock();
@@ -238,6 +252,8 @@ void subtitle_renderer::init()
 
             _initialized = true;
             global_libass_mutex.unlock();
+            msg::dbg("Subtitle renderer initialization took %g seconds.",
+                    (timer::get(timer::monotonic) - init_start) / 1e6);
         }
         catch (...)
         {
@@ -251,8 +267,18 @@ void subtitle_renderer::init()
     }
 }
 
+void subtitle_renderer::start_init()
+{
+    if (!_init_started)
+    {
+        _init_started = true;
+        _initializer.start(task::priority_min);
+    }
+}
+
 bool subtitle_renderer::is_initialized()
 {
+    start_init();
     if (_initializer.running())
     {
         return false;
@@ -265,6 +291,16 @@ bool subtitle_renderer::is_initialized()
     }
 }
 
+bool subtitle_renderer::same_parameters(const parameters &p0, const parameters &p1)
+{
+    return (p0.subtitle_encoding() == p1.subtitle_encoding()
+            && p0.subtitle_font() == p1.subtitle_font()
+            && p0.subtitle_size() == p1.subtitle_size()
+            && !(p0.subtitle_scale() < p1.subtitle_scale() || p0.subtitle_scale() > p1.subtitle_scale())
+            && p0.subtitle_color() == p1.subtitle_color()
+            && p0.subtitle_shadow() == p1.subtitle_shadow());
+}
+
 bool subtitle_renderer::render_to_display_size(const subtitle_box &box) const
 {
     return (box.format != subtitle_box::image);
@@ -309,38 +345,189 @@ void subtitle_renderer::render(uint32_t *bgra32_buffer)
     }
 }
 
+/* Blending of ASS images.
+ * An ASS image is a coverage bitmap with a single color. Each pixel is blended
+ * into the BGRA32 buffer with alpha a = coverage * A / 255:
+ *   alpha = min(a + old_alpha, 255)
+ *   color = (a * C + (255 - a) * old_color) / 255
+ * All divisions by 255 are rounded down. The SIMD variants compute exactly the
+ * same results as the plain C variant, using (x + 1 + (x >> 8)) >> 8 == x / 255,
+ * which holds for all x that can occur here (0 <= x <= 255 * 255). */
+
+typedef void (*blend_ass_row_func)(uint32_t *dst, const unsigned char *src, int width,
+        unsigned int R, unsigned int G, unsigned int B, unsigned int A);
+
+static void blend_ass_row_c(uint32_t *dst, const unsigned char *src, int width,
+        unsigned int R, unsigned int G, unsigned int B, unsigned int A)
+{
+    for (int x = 0; x < width; x++)
+    {
+        unsigned int a = src[x] * A / 255u;
+        if (a == 0)
+        {
+            continue;
+        }
+        uint32_t oldval = dst[x];
+        // XXX: The BGRA layout used here may be wrong on big endian system
+        uint32_t newval = std::min(a + (oldval >> 24u), 255u) << 24u
+            | ((a * R + (255u - a) * ((oldval >> 16u) & 0xffu)) / 255u) << 16u
+            | ((a * G + (255u - a) * ((oldval >>  8u) & 0xffu)) / 255u) << 8u
+            | ((a * B + (255u - a) * ((oldval       ) & 0xffu)) / 255u);
+        dst[x] = newval;
+    }
+}
+
+#if HAVE_X86_BLEND
+__attribute__((target("sse2")))
+static inline __m128i div255_sse2(__m128i x)
+{
+    return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, _mm_set1_epi16(1)), _mm_srli_epi16(x, 8)), 8);
+}
+
+// Blend two pixels, with 16 bits per channel. The alpha value
+// of each pixel must be replicated to all four channels.
+__attribute__((target("sse2")))
+static inline __m128i blend_ass_pixels_sse2(__m128i old, __m128i a, __m128i color, __m128i alpha_mask)
+{
+    __m128i c = div255_sse2(_mm_add_epi16(_mm_mullo_epi16(a, color),
+                _mm_mullo_epi16(_mm_sub_epi16(_mm_set1_epi16(255), a), old)));
+    __m128i alpha = _mm_min_epi16(_mm_add_epi16(a, old), _mm_set1_epi16(255));
+    return _mm_or_si128(_mm_andnot_si128(alpha_mask, c), _mm_and_si128(alpha_mask, alpha));
+}
+
+__attribute__((target("sse2")))
+static void blend_ass_row_sse2(uint32_t *dst, const unsigned char *src, int width,
+        unsigned int R, unsigned int G, unsigned int B, unsigned int A)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i vA = _mm_set1_epi16(A);
+    const __m128i color = _mm_set_epi16(0, R, G, B, 0, R, G, B);
+    const __m128i alpha_mask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i cov = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + x));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(cov, zero)) == 0xffff)
+        {
+            continue;
+        }
+        __m128i a = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(cov, zero), vA));
+        __m128i a03 = _mm_unpacklo_epi16(a, a);
+        __m128i a47 = _mm_unpackhi_epi16(a, a);
+        __m128i *d = reinterpret_cast<__m128i *>(dst + x);
+        __m128i d03 = _mm_loadu_si128(d);
+        __m128i d47 = _mm_loadu_si128(d + 1);
+        __m128i r01 = blend_ass_pixels_sse2(_mm_unpacklo_epi8(d03, zero), _mm_unpacklo_epi32(a03, a03), color, alpha_mask);
+        __m128i r23 = blend_ass_pixels_sse2(_mm_unpackhi_epi8(d03, zero), _mm_unpackhi_epi32(a03, a03), color, alpha_mask);
+        __m128i r45 = blend_ass_pixels_sse2(_mm_unpacklo_epi8(d47, zero), _mm_unpacklo_epi32(a47, a47), color, alpha_mask);
+        __m128i r67 = blend_ass_pixels_sse2(_mm_unpackhi_epi8(d47, zero), _mm_unpackhi_epi32(a47, a47), color, alpha_mask);
+        _mm_storeu_si128(d, _mm_packus_epi16(r01, r23));
+        _mm_storeu_si128(d + 1, _mm_packus_epi16(r45, r67));
+    }
+    blend_ass_row_c(dst + x, src + x, width - x, R, G, B, A);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i div255_avx2(__m256i x)
+{
+    return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(x, _mm256_set1_epi16(1)), _mm256_srli_epi16(x, 8)), 8);
+}
+
+// Blend four pixels, with 16 bits per channel. The alpha value
+// of each pixel must be replicated to all four channels.
+__attribute__((target("avx2")))
+static inline __m256i blend_ass_pixels_avx2(__m256i old, __m256i a, __m256i color, __m256i alpha_mask)
+{
+    __m256i c = div255_avx2(_mm256_add_epi16(_mm256_mullo_epi16(a, color),
+                _mm256_mullo_epi16(_mm256_sub_epi16(_mm256_set1_epi16(255), a), old)));
+    __m256i alpha = _mm256_min_epi16(_mm256_add_epi16(a, old), _mm256_set1_epi16(255));
+    return _mm256_blendv_epi8(c, alpha, alpha_mask);
+}
+
+// Replicate each of the four 16 bit values in the lower half of x to four channels.
+__attribute__((target("avx2")))
+static inline __m256i replicate_alpha_avx2(__m128i x)
+{
+    __m256i y = _mm256_cvtepu16_epi64(x);
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(y, 0), 0);
+}
+
+__attribute__((target("avx2")))
+static void blend_ass_row_avx2(uint32_t *dst, const unsigned char *src, int width,
+        unsigned int R, unsigned int G, unsigned int B, unsigned int A)
+{
+    const __m128i vA = _mm_set1_epi16(A);
+    const __m256i color = _mm256_set_epi16(0, R, G, B, 0, R, G, B, 0, R, G, B, 0, R, G, B);
+    const __m256i alpha_mask = _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i cov = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + x));
+        if (_mm_testz_si128(cov, _mm_set_epi32(0, 0, -1, -1)))
+        {
+            continue;
+        }
+        __m128i a = div255_sse2(_mm_mullo_epi16(_mm_cvtepu8_epi16(cov), vA));
+        __m256i *d = reinterpret_cast<__m256i *>(dst + x);
+        __m256i d07 = _mm256_loadu_si256(d);
+        __m256i r03 = blend_ass_pixels_avx2(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(d07)),
+                replicate_alpha_avx2(a), color, alpha_mask);
+        __m256i r47 = blend_ass_pixels_avx2(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(d07, 1)),
+                replicate_alpha_avx2(_mm_srli_si128(a, 8)), color, alpha_mask);
+        // Packing works on 128 bit lanes, so the 64 bit blocks have to be put back in order.
+        _mm256_storeu_si256(d, _mm256_permute4x64_epi64(_mm256_packus_epi16(r03, r47), _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    blend_ass_row_c(dst + x, src + x, width - x, R, G, B, A);
+}
+#endif
+
+static blend_ass_row_func get_blend_ass_row()
+{
+    static blend_ass_row_func func = NULL;
+    if (!func)
+    {
+        blend_ass_row_func f = blend_ass_row_c;
+#if HAVE_X86_BLEND
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            f = blend_ass_row_avx2;
+        else if (__builtin_cpu_supports("sse2"))
+            f = blend_ass_row_sse2;
+#endif
+        func = f;
+    }
+    return func;
+}
+
 void subtitle_renderer::blend_ass_image(const ASS_Image *img, uint32_t *buf)
 {
     const unsigned int R = (img->color >> 24u) & 0xffu;
     const unsigned int G = (img->color >> 16u) & 0xffu;
     const unsigned int B = (img->color >>  8u) & 0xffu;
     const unsigned int A = 255u - (img->color & 0xffu);
+    if (A == 0)
+    {
+        return;
+    }
 
-    unsigned char *src = img->bitmap;
-    for (int src_y = 0; src_y < img->h; src_y++)
+    // The image lies inside the bounding box, with the possible exception
+    // of its right and bottom borders; see prerender_ass().
+    const int dst_x = img->dst_x - _bb_x;
+    const int dst_y = img->dst_y - _bb_y;
+    const int w = std::min(img->w, _bb_w - dst_x);
+    const int h = std::min(img->h, _bb_h - dst_y);
+    if (w <= 0)
     {
-        int dst_y = src_y + img->dst_y - _bb_y;
-        if (dst_y >= _bb_h)
-        {
-            break;
-        }
-        for (int src_x = 0; src_x < img->w; src_x++)
-        {
-            unsigned int a = src[src_x] * A / 255u;
-            int dst_x = src_x + img->dst_x - _bb_x;
-            if (dst_x >= _bb_w)
-            {
-                break;
-            }
-            uint32_t oldval = buf[dst_y * _bb_w + dst_x];
-            // XXX: The BGRA layout used here may be wrong on big endian system
-            uint32_t newval = std::min(a + (oldval >> 24u), 255u) << 24u
-                | ((a * R + (255u - a) * ((oldval >> 16u) & 0xffu)) / 255u) << 16u
-                | ((a * G + (255u - a) * ((oldval >>  8u) & 0xffu)) / 255u) << 8u
-                | ((a * B + (255u - a) * ((oldval       ) & 0xffu)) / 255u);
-            buf[dst_y * _bb_w + dst_x] = newval;
-        }
+        return;
+    }
+    blend_ass_row_func blend_row = get_blend_ass_row();
+    const unsigned char *src = img->bitmap;
+    uint32_t *dst = buf + dst_y * _bb_w + dst_x;
+    for (int y = 0; y < h; y++)
+    {
+        blend_row(dst, src, w, R, G, B, A);
         src += img->stride;
+        dst += _bb_w;
     }
 }
 
@@ -392,10 +579,22 @@ bool subtitle_renderer::prerender_ass(const subtitle_box &box, int64_t timestamp
     ass_set_frame_size(_ass_renderer, width, height);
     ass_set_aspect_ratio(_ass_renderer, 1.0, pixel_aspect_ratio);
 
+    // Animated subtitles are rendered once per frame, but their event data
+    // stays the same. Only refill the ASS track when it changes.
+    int change_detected = 0;
+    if (_ass_track && box.format == _ass_track_box.format && box == _ass_track_box
+            && same_parameters(params, _ass_track_params))
+    {
+        _ass_img = ass_render_frame(_ass_renderer, _ass_track, timestamp / 1000, &change_detected);
+        global_libass_mutex.unlock();
+        return (update_ass_bounding_box(width, height) || change_detected);
+    }
+
     // Put subtitle data into ASS track
     if (_ass_track)
     {
         ass_free_track(_ass_track);
+        _ass_track_box = subtitle_box();
     }
     _ass_track = ass_new_track(_ass_library);
     if (!_ass_track)
@@ -424,19 +623,7 @@ bool subtitle_renderer::prerender_ass(const subtitle_box &box, int64_t timestamp
     else
     {
         // Set a default ASS style for text subtitles
-        std::string style =
-            "[Script Info]\n"
-            "ScriptType: v4.00+\n"
-            "\n"
-            "[V4+ Styles]\n"
-            "Format: Name, Fontname, Fontsize, PrimaryColour, SecondaryColour, "
-            "OutlineColour, BackColour, Bold, Italic, Underline, BorderStyle, "
-            "Outline, Shadow, Alignment, MarginL, MarginR, MarginV, AlphaLevel, Encoding\n"
-            "Style: Default,Arial,16,&Hffffff,&Hffffff,&H0,&H0,0,0,0,1,1,0,2,10,10,10,0,0\n"
-            "\n"
-            "[Events]\n"
-            "Format: Layer, Start, End, Text\n"
-            "\n";
+        std::string style = text_style();
         ass_process_codec_private(_ass_track, const_cast<char *>(style.c_str()), style.length());
         // Convert text to ASS
         conv_str = str::replace(conv_str, "\r\n", "\\N");
@@ -445,15 +632,39 @@ bool subtitle_renderer::prerender_ass(const subtitle_box &box, int64_t timestamp
         ass_process_data(_ass_track, const_cast<char *>(str.c_str()), str.length());
     }
     set_ass_parameters(params);
+    _ass_track_box = box;
+    _ass_track_params = params;
 
     // Render subtitle
-    int change_detected = 0;
     _ass_img = ass_render_frame(_ass_renderer, _ass_track, timestamp / 1000, &change_detected);
 
     // Unlock
     global_libass_mutex.unlock();
 
-    // Determine bounding box
+    update_ass_bounding_box(width, height);
+    return true;
+}
+
+const char *subtitle_renderer::text_style()
+{
+    return
+        "[Script Info]\n"
+        "ScriptType: v4.00+\n"
+        "\n"
+        "[V4+ Styles]\n"
+        "Format: Name, Fontname, Fontsize, PrimaryColour, SecondaryColour, "
+        "OutlineColour, BackColour, Bold, Italic, Underline, BorderStyle, "
+        "Outline, Shadow, Alignment, MarginL, MarginR, MarginV, AlphaLevel, Encoding\n"
+        "Style: Default,Arial,16,&Hffffff,&Hffffff,&H0,&H0,0,0,0,1,1,0,2,10,10,10,0,0\n"
+        "\n"
+        "[Events]\n"
+        "Format: Layer, Start, End, Text\n"
+        "\n";
+}
+
+bool subtitle_renderer::update_ass_bounding_box(int width, int height)
+{
+    int old_bb_x = _bb_x, old_bb_y = _bb_y, old_bb_w = _bb_w, old_bb_h = _bb_h;
     int min_x = width;
     int max_x = -1;
     int min_y = height;
@@ -485,7 +696,7 @@ bool subtitle_renderer::prerender_ass(const subtitle_box &box, int64_t timestamp
         _bb_y = min_y;
         _bb_h = max_y - min_y + 1;
     }
-    return change_detected;
+    return (_bb_x != old_bb_x || _bb_y != old_bb_y || _bb_w != old_bb_w || _bb_h != old_bb_h);
 }
 
 void subtitle_renderer::render_ass(uint32_t *bgra32_buffer)
@@ -550,7 +761,7 @@ void subtitle_renderer::render_img(uint32_t *bgra32_buffer)
     for (size_t i = 0; i < _img_box->images.size(); i++)
     {
         const subtitle_box::image_t &img = _img_box->images[i];
-        const uint8_t *src = &(img.data[0]);
+        const uint8_t *src = img.data.ptr<uint8_t>();
         for (int src_y = 0; src_y < img.h; src_y++)
         {
             int dst_y = src_y + img.y - _bb_y;
@@ -566,7 +777,7 @@ void subtitle_renderer::render_img(uint32_t *bgra32_buffer)
                     break;
                 }
                 int palette_index = src[src_x];
-                uint32_t palette_entry = reinterpret_cast<const uint32_t *>(&(img.palette[0]))[palette_index];
+                uint32_t palette_entry = img.palette.ptr<uint32_t>()[palette_index];
                 unsigned int A = (palette_entry >> 24u);
                 unsigned int R = (palette_entry >> 16u) & 0xffu;
                 unsigned int G = (palette_entry >> 8u) & 0xffu;
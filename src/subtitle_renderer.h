@@ -38,7 +38,7 @@ extern "C"
 
 class subtitle_renderer;
 
-class subtitle_renderer_initializer : public thread
+class subtitle_renderer_initializer : public task
 {
 private:
     subtitle_renderer &_subtitle_renderer;
@@ -53,11 +53,13 @@ class subtitle_renderer
 private:
     // Initialization
     subtitle_renderer_initializer _initializer;
+    bool _init_started;
     bool _initialized;
     const char *_fontconfig_conffile;
     const char *get_fontconfig_conffile();
     void init();
     friend class subtitle_renderer_initializer;
+    friend class micro_benchmark;
 
     // Static ASS data
     ASS_Library *_ass_library;
@@ -66,6 +68,8 @@ private:
     // Dynamic data (changes with each subtitle)
     subtitle_box::format_t _fmt;
     ASS_Track *_ass_track;
+    subtitle_box _ass_track_box;        // the subtitle in _ass_track
+    parameters _ass_track_params;       // the parameters that _ass_track was set up with
     ASS_Image *_ass_img;
     const subtitle_box *_img_box;
     int _bb_x, _bb_y, _bb_w, _bb_h;
@@ -73,6 +77,7 @@ private:
     // ASS helper functions
     void blend_ass_image(const ASS_Image *img, uint32_t *buf);
     void set_ass_parameters(const parameters &params);
+    bool update_ass_bounding_box(int width, int height);
 
     // Rendering ASS and text subtitles
     bool prerender_ass(const subtitle_box &box, int64_t timestamp,
@@ -88,9 +93,13 @@ public:
     subtitle_renderer();
     ~subtitle_renderer();
 
-    // Check if the subtitle renderer is initialized. Since initialization may
-    // take a long time on systems where fontconfig needs to create its cache first,
-    // it is done in a separate thread in the background.
+    // Start initialization in a separate thread in the background, unless it was
+    // started before. Initialization may take a long time on systems where fontconfig
+    // needs to create its cache first, so it is only done once subtitles are needed.
+    void start_init();
+
+    // Check if the subtitle renderer is initialized. This starts initialization
+    // if that has not happened yet.
     // You must make sure that the renderer is initialized before calling any of
     // the functions below!
     // In the case of initialization failure, this function will throw the appropriate
@@ -110,6 +119,13 @@ public:
      *    image from the buffer.
      */
 
+    // Return true if subtitles look the same with both parameter sets.
+    static bool same_parameters(const parameters &p0, const parameters &p1);
+
+    // The ASS style header used for text subtitles. Its events have the
+    // format "Layer, Start, End, Text".
+    static const char *text_style();
+
     // Return true if the subtitle should be rendered in display resolution.
     // Return false if the subtitle should be rendered in video frame resolution.
     bool render_to_display_size(const subtitle_box &box) const;
@@ -0,0 +1,325 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <cerrno>
+#include <cstring>
+#include <cmath>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "base/exc.h"
+#include "base/str.h"
+#include "base/msg.h"
+#include "base/ser.h"
+#include "base/dir.h"
+
+#include "media_object.h"
+#include "thumbnailer.h"
+
+
+// Thumbnail cache.
+// Like the key frame index, the cache file name is a hash of the file name,
+// size, and modification time, and additionally of the settings that change
+// the thumbnails.
+
+static const char *thumbnails_file_magic = "bino-thumbnails-1";
+
+bool thumbnailer::supported(const std::string& url)
+{
+    struct stat statbuf;
+    return (stat(url.c_str(), &statbuf) == 0 && S_ISREG(statbuf.st_mode));
+}
+
+thumbnailer::thumbnailer(const std::string& url, int video_stream,
+        parameters::stereo_layout_t stereo_layout, bool stereo_layout_swap,
+        int64_t initial_skip, int64_t duration, const parameters& params) :
+    _url(url), _video_stream(video_stream),
+    _stereo_layout(stereo_layout), _stereo_layout_swap(stereo_layout_swap),
+    _initial_skip(initial_skip), _duration(duration), _params(params),
+    _stop_request(false), _width(0), _height(0)
+{
+    // One thumbnail per two seconds, but not more than a slider can show.
+    int64_t count = std::min(std::max(duration / 2000000, static_cast<int64_t>(1)), static_cast<int64_t>(200));
+    _images.resize(count);
+    struct stat statbuf;
+    if (stat(url.c_str(), &statbuf) == 0)
+    {
+        std::string id = url + '\0' + str::from(statbuf.st_size) + '\0' + str::from(statbuf.st_mtime)
+            + '\0' + str::from(video_stream)
+            + '\0' + parameters::stereo_layout_to_string(stereo_layout, stereo_layout_swap)
+            + '\0' + str::from(initial_skip) + '\0' + str::from(count) + '\0' + str::from(thumbnail_width);
+        _cache_file = dir::cache_file("thumbnails", id);
+    }
+}
+
+thumbnailer::~thumbnailer()
+{
+    stop();
+    wait();
+}
+
+void thumbnailer::stop()
+{
+    _mutex.lock();
+    _stop_request = true;
+    _mutex.unlock();
+}
+
+bool thumbnailer::get(float pos, thumbnail* t)
+{
+    bool found = false;
+    _mutex.lock();
+    int n = _images.size();
+    int i = std::min(std::max(static_cast<int>(pos * n), 0), n - 1);
+    // Search outward from the position for the nearest decoded thumbnail.
+    for (int d = 0; d < n && !found; d++)
+    {
+        int j = (i - d >= 0 && !_images[i - d].empty() ? i - d
+                : i + d < n && !_images[i + d].empty() ? i + d : -1);
+        if (j >= 0)
+        {
+            t->width = _width;
+            t->height = _height;
+            t->data = _images[j];
+            found = true;
+        }
+    }
+    _mutex.unlock();
+    return found;
+}
+
+bool thumbnailer::load_cache()
+{
+    std::ifstream ifs(_cache_file.c_str(), std::ios::in | std::ios::binary);
+    if (!ifs.good())
+    {
+        return false;
+    }
+    try
+    {
+        std::string magic;
+        int width, height;
+        std::vector<std::vector<unsigned char> > images(_images.size());
+        s11n::load(ifs, magic);
+        if (magic != thumbnails_file_magic)
+        {
+            return false;
+        }
+        s11n::load(ifs, width);
+        s11n::load(ifs, height);
+        if (width != thumbnail_width || height < 1 || height > 16 * thumbnail_width)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            bool present;
+            s11n::load(ifs, present);
+            if (present)
+            {
+                images[i].resize(width * height * 4);
+                s11n::load(ifs, &(images[i][0]), images[i].size());
+            }
+        }
+        if (!ifs.good())
+        {
+            return false;
+        }
+        _mutex.lock();
+        _width = width;
+        _height = height;
+        _images.swap(images);
+        _mutex.unlock();
+    }
+    catch (...)
+    {
+        // Ignore broken cache files; the thumbnails will be made again.
+        return false;
+    }
+    return true;
+}
+
+void thumbnailer::save_cache()
+{
+    if (!dir::make_cache())
+    {
+        return;
+    }
+    std::ofstream ofs(_cache_file.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    _mutex.lock();
+    s11n::save(ofs, std::string(thumbnails_file_magic));
+    s11n::save(ofs, _width);
+    s11n::save(ofs, _height);
+    for (size_t i = 0; i < _images.size(); i++)
+    {
+        s11n::save(ofs, !_images[i].empty());
+        if (!_images[i].empty())
+        {
+            s11n::save(ofs, &(_images[i][0]), _images[i].size());
+        }
+    }
+    _mutex.unlock();
+    if (!ofs.good())
+    {
+        msg::dbg(_cache_file + ": " + std::strerror(errno));
+    }
+}
+
+// Scale the left view of a BGRA32 frame down to the given size with a box filter.
+static void scale_view(const video_frame& frame, int width, int height, unsigned char* dst)
+{
+    int data_view;
+    size_t offset, row_size;
+    frame.plane_location(0, 0, &data_view, &offset, &row_size);
+    const unsigned char* src = static_cast<const unsigned char*>(frame.data[data_view][0]) + offset;
+    for (int y = 0; y < height; y++)
+    {
+        int y0 = y * frame.height / height;
+        int y1 = std::max((y + 1) * frame.height / height, y0 + 1);
+        for (int x = 0; x < width; x++)
+        {
+            int x0 = x * frame.width / width;
+            int x1 = std::max((x + 1) * frame.width / width, x0 + 1);
+            unsigned int sum[3] = { 0, 0, 0 };
+            for (int sy = y0; sy < y1; sy++)
+            {
+                const unsigned char* p = src + sy * row_size + x0 * 4;
+                for (int sx = x0; sx < x1; sx++, p += 4)
+                {
+                    sum[0] += p[0];
+                    sum[1] += p[1];
+                    sum[2] += p[2];
+                }
+            }
+            unsigned int pixels = (y1 - y0) * (x1 - x0);
+            unsigned char* q = dst + (y * width + x) * 4;
+            q[0] = sum[0] / pixels;
+            q[1] = sum[1] / pixels;
+            q[2] = sum[2] / pixels;
+            q[3] = 255;
+        }
+    }
+}
+
+void thumbnailer::run()
+{
+    if (!_cache_file.empty() && load_cache())
+    {
+        bool complete = true;
+        for (size_t i = 0; i < _images.size() && complete; i++)
+        {
+            complete = !_images[i].empty();
+        }
+        msg::dbg(_url + ": thumbnails loaded from " + _cache_file);
+        if (complete)
+        {
+            return;
+        }
+    }
+    int new_thumbnails = 0;
+    media_object object(true, thumbnail_width);
+    try
+    {
+        // A single decoding thread is enough for a few key frames per second.
+        cpu_share cpus;
+        cpus.threads = 1;
+        object.open(_url, device_request(), _params, cpus);
+        object.video_stream_set_active(_video_stream, true);
+        // The first frame tells the start of the input.
+        object.start_video_frame_read(_video_stream, 1);
+        video_frame frame = object.finish_video_frame_read(_video_stream);
+        if (!frame.is_valid())
+        {
+            object.close();
+            return;
+        }
+        int64_t start = frame.presentation_time;
+        int n = _images.size();
+        int step = 1;
+        while (step < n)
+        {
+            step *= 2;
+        }
+        for (; step >= 1; step /= 2)
+        {
+            for (int i = 0; i < n; i += step)
+            {
+                _mutex.lock();
+                bool stop = _stop_request;
+                bool have = !_images[i].empty();
+                _mutex.unlock();
+                if (stop)
+                {
+                    step = 0;
+                    break;
+                }
+                if (have)
+                {
+                    continue;
+                }
+                int64_t pos = start + _initial_skip
+                    + static_cast<int64_t>((i + 0.5) / n * static_cast<double>(_duration));
+                object.seek(pos, true);
+                object.start_video_frame_read(_video_stream, 1);
+                frame = object.finish_video_frame_read(_video_stream);
+                if (!frame.is_valid())
+                {
+                    continue;
+                }
+                // Views that are stored in separate frames are read as single views.
+                frame.stereo_layout = (_stereo_layout == parameters::layout_separate
+                        || _stereo_layout == parameters::layout_alternating
+                        ? parameters::layout_mono : _stereo_layout);
+                frame.stereo_layout_swap = _stereo_layout_swap;
+                frame.set_view_dimensions();
+                _mutex.lock();
+                if (_width == 0)
+                {
+                    _width = thumbnail_width;
+                    _height = std::max(static_cast<int>(std::floor(thumbnail_width / frame.aspect_ratio + 0.5f)), 1);
+                }
+                int width = _width;
+                int height = _height;
+                _mutex.unlock();
+                std::vector<unsigned char> image(width * height * 4);
+                scale_view(frame, width, height, &(image[0]));
+                _mutex.lock();
+                _images[i].swap(image);
+                _mutex.unlock();
+                new_thumbnails++;
+            }
+        }
+        object.close();
+    }
+    catch (std::exception& e)
+    {
+        msg::dbg(_url + ": cannot make thumbnails: " + e.what());
+    }
+    if (new_thumbnails > 0 && !_cache_file.empty())
+    {
+        save_cache();
+    }
+}
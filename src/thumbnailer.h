@@ -0,0 +1,103 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2026
+ * agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THUMBNAILER_H
+#define THUMBNAILER_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "base/pth.h"
+
+#include "media_data.h"
+
+/*
+ * Thumbnails for the position slider.
+ *
+ * A thumbnailer decodes the key frames at evenly spaced positions of an input
+ * with a media object of its own, in a thread with minimum priority, so that
+ * it never competes with playback for the decoders or delays its seeks. The
+ * positions are visited coarse to fine, so that a rough strip is available
+ * early. The thumbnails are cached on disk, next to the key frame index.
+ *
+ * Only local files are supported: for network streams, the additional reads
+ * would compete with playback for the bandwidth.
+ *
+ * The thread must not use dispatch::parameters(), which the main thread may
+ * change at any time. The media object is opened with a copy of the parameters
+ * that the creator of the thumbnailer passes to the constructor.
+ */
+
+class thumbnail
+{
+public:
+    int width;                          // 0 if there is no thumbnail
+    int height;
+    std::vector<unsigned char> data;    // BGRA32, top row first
+
+    thumbnail() : width(0), height(0)
+    {
+    }
+};
+
+class thumbnailer : public thread
+{
+public:
+    static const int thumbnail_width = 160;
+
+private:
+    const std::string _url;
+    const int _video_stream;            // stream number in the media object of the URL
+    const parameters::stereo_layout_t _stereo_layout;
+    const bool _stereo_layout_swap;
+    const int64_t _initial_skip;
+    const int64_t _duration;
+    const parameters _params;           // for opening the media object
+    std::string _cache_file;
+    mutex _mutex;                       // protects the following members
+    bool _stop_request;
+    int _width, _height;
+    std::vector<std::vector<unsigned char> > _images;   // empty if not decoded yet
+
+    bool load_cache();
+    void save_cache();
+
+public:
+    /* Whether thumbnails can be made for the given URL. */
+    static bool supported(const std::string& url);
+
+    thumbnailer(const std::string& url, int video_stream,
+            parameters::stereo_layout_t stereo_layout, bool stereo_layout_swap,
+            int64_t initial_skip, int64_t duration, const parameters& params);
+    /* The destructor stops the thread and waits for it. */
+    ~thumbnailer();
+
+    /* Let the thread stop after the current thumbnail. */
+    void stop();
+
+    /* Get the nearest available thumbnail for the normalized position in [0,1].
+     * Returns false if there is none yet. */
+    bool get(float pos, thumbnail* t);
+
+    void run();
+};
+
+#endif
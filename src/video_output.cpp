@@ -25,6 +25,11 @@
 #include "config.h"
 
 #include <limits>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
@@ -35,15 +40,21 @@
 #include "base/msg.h"
 #include "base/str.h"
 #include "base/tmr.h"
+#include "base/trc.h"
 #include "base/blb.h"
 #include "base/dbg.h"
+#include "base/dir.h"
+#include "base/ser.h"
 
 #include "base/gettext.h"
 #define _(string) gettext(string)
 
 #include "color_matrix.h"
 #include "video_output.h"
+#include "benchmark_stats.h"
+#include "video_output_color.vs.glsl.h"
 #include "video_output_color.fs.glsl.h"
+#include "video_output_render.vs.glsl.h"
 #include "video_output_render.fs.glsl.h"
 
 #if HAVE_LIBXNVCTRL
@@ -108,39 +119,58 @@
 /*
  * The subtitle updater:
  * Render subtitles in a separate thread.
+ * Rendered subtitles are kept in a small cache, so that animated subtitles
+ * do not need to be rendered again when the same state is shown again, e.g.
+ * when a frame is redisplayed, after seeking back, or in loop mode. Animated
+ * subtitles are identified by the libass clock, which has millisecond resolution.
  */
 
-class subtitle_updater : public thread
+class subtitle_updater : public task
 {
 private:
-    // The last rendered subtitle
-    subtitle_box _last_subtitle;
-    int64_t _last_timestamp;
-    parameters _last_params;
-    int _last_outwidth;
-    int _last_outheight;
-    float _last_pixel_ar;
+    // A rendered subtitle
+    struct cache_entry {
+        subtitle_box subtitle;
+        int64_t timestamp;
+        parameters_ref params;
+        int outwidth;
+        int outheight;
+        float pixel_ar;
+        blob buffer;
+        int bb_x, bb_y, bb_w, bb_h;
+    };
+    static const size_t cache_max_entries = 16;
+    static const size_t cache_max_size = 32 << 20;
+    // The cache. The first entry is the most recently used one.
+    std::list<cache_entry> _cache;
+    size_t _cache_size;
+    // The entry that corresponds to the current state of the renderer, or _cache.end()
+    std::list<cache_entry>::iterator _rendered;
     // The current subtitle to render
     subtitle_box _subtitle;
     int64_t _timestamp;
-    parameters _params;
+    parameters_ref _params;
     int _outwidth;
     int _outheight;
     float _pixel_ar;
-    // The renderer and rendering buffer
+    // Whether the subtitle is rendered ahead of time, before it is needed
+    bool _ahead;
+    // The renderer
     subtitle_renderer* _renderer;
-    blob _buffer;
-    int _bb_x, _bb_y, _bb_w, _bb_h;
     bool _buffer_changed;
 
+    bool matches(const cache_entry& e, int64_t timestamp) const;
+
 public:
     subtitle_updater(subtitle_renderer* sr);
 
     // Reset
     void reset();
-    // Set all necessary information to render the next subtitle.
+    // Set all necessary information to render the next subtitle. A subtitle that is
+    // rendered ahead of time only goes into the cache; get() does not report it.
     void set(const subtitle_box& subtitle, int64_t timestamp,
-            const parameters& params, int outwidth, int outheight, float pixel_ar);
+            const parameters_ref& params, int outwidth, int outheight, float pixel_ar,
+            bool ahead = false);
     // Start the subtitle rendering with thread::start(), which will execute the run() fuction.
     // The wait for it to finish using the thread::finish() function.
     virtual void run();
@@ -150,21 +180,22 @@ public:
 };
 
 subtitle_updater::subtitle_updater(subtitle_renderer* renderer) :
-    _renderer(renderer)
+    _ahead(false), _renderer(renderer), _buffer_changed(false)
 {
     reset();
 }
 
 void subtitle_updater::reset()
 {
-    _last_outwidth = -1;
-    _last_outheight = -1;
-    _last_timestamp = std::numeric_limits<int64_t>::min();
+    _cache.clear();
+    _cache_size = 0;
+    _rendered = _cache.end();
 }
 
 void subtitle_updater::set(
         const subtitle_box& subtitle, int64_t timestamp,
-        const parameters& params, int outwidth, int outheight, float pixel_ar)
+        const parameters_ref& params, int outwidth, int outheight, float pixel_ar,
+        bool ahead)
 {
     _subtitle = subtitle;
     _timestamp = timestamp;
@@ -172,43 +203,108 @@ void subtitle_updater::set(
     _outwidth = outwidth;
     _outheight = outheight;
     _pixel_ar = pixel_ar;
+    _ahead = ahead;
+}
+
+bool subtitle_updater::matches(const cache_entry& e, int64_t timestamp) const
+{
+    return (e.timestamp == timestamp
+            && e.outwidth == _outwidth
+            && e.outheight == _outheight
+            && !(e.pixel_ar < _pixel_ar || e.pixel_ar > _pixel_ar)
+            && e.subtitle.format == _subtitle.format
+            && e.subtitle == _subtitle
+            && (e.params.version() == _params.version()
+                || subtitle_renderer::same_parameters(e.params.get(), _params.get())));
 }
 
 void subtitle_updater::run()
 {
-    _buffer_changed = false;
-    if (_subtitle.is_valid()
-            && (_subtitle != _last_subtitle
-                || (!_subtitle.is_constant() && _timestamp != _last_timestamp)
-                || _outwidth != _last_outwidth
-                || _outheight != _last_outheight
-                || (_pixel_ar < _last_pixel_ar || _pixel_ar > _last_pixel_ar)
-                || _params.subtitle_encoding() != _last_params.subtitle_encoding()
-                || _params.subtitle_font() != _last_params.subtitle_font()
-                || _params.subtitle_size() != _last_params.subtitle_size()
-                || (_params.subtitle_scale() < _last_params.subtitle_scale()
-                    || _params.subtitle_scale() > _last_params.subtitle_scale())
-                || _params.subtitle_color() != _last_params.subtitle_color()
-                || _params.subtitle_shadow() != _last_params.subtitle_shadow())) {
-        // We have a new subtitle or a new video display size or new parameters,
-        // therefore we need to render it.
-        _buffer_changed = _renderer->prerender(
-                _subtitle, _timestamp, _params,
-                _outwidth, _outheight, _pixel_ar,
-                _bb_x, _bb_y, _bb_w, _bb_h);
-        _last_subtitle = _subtitle;
-        _last_timestamp = _timestamp;
-        _last_params = _params;
-        _last_outwidth = _outwidth;
-        _last_outheight = _outheight;
-        _last_pixel_ar = _pixel_ar;
-    }
-
-    if (_buffer_changed) {
-        size_t bufsize = _bb_w * _bb_h * sizeof(uint32_t);
-        if (_buffer.size() < bufsize)
-            _buffer.resize(bufsize);
-        _renderer->render(_buffer.ptr<uint32_t>());
+    trace::set_thread_track("subtitle rendering");
+    trace_scope update_trace(_ahead ? "render subtitle ahead" : "render subtitle");
+    if (!_ahead)
+        _buffer_changed = false;
+    if (!_subtitle.is_valid())
+        return;
+    int64_t timestamp = (_subtitle.is_constant() ? 0 : _timestamp / 1000);
+
+    // Look the subtitle up in the cache. The common case is that nothing
+    // changed since the last frame.
+    std::list<cache_entry>::iterator it = _cache.begin();
+    if (it != _cache.end() && matches(*it, timestamp))
+        return;
+    for (; it != _cache.end(); it++) {
+        if (matches(*it, timestamp)) {
+            if (!_ahead) {
+                _cache.splice(_cache.begin(), _cache, it);
+                _buffer_changed = true;
+            }
+            return;
+        }
+    }
+
+    // We have a new subtitle or a new video display size or new parameters,
+    // therefore we need to render it.
+    int bb_x, bb_y, bb_w, bb_h;
+    bool changed = _renderer->prerender(
+            _subtitle, _timestamp, _params.get(),
+            _outwidth, _outheight, _pixel_ar,
+            bb_x, bb_y, bb_w, bb_h);
+    bool same = (!changed && _rendered != _cache.end());
+    if (same && !_ahead) {
+        // The renderer reports the same result as the last time
+        // it rendered, so we can reuse that.
+        it = _rendered;
+    } else {
+        // Reuse the least recently used cache entry if the cache is full
+        if (_cache.size() >= cache_max_entries) {
+            it = --_cache.end();
+        } else {
+            it = _cache.insert(_cache.end(), cache_entry());
+        }
+        size_t bufsize = bb_w * bb_h * sizeof(uint32_t);
+        if (it->buffer.size() < bufsize) {
+            _cache_size += bufsize - it->buffer.size();
+            it->buffer.resize(bufsize);
+        }
+        it->bb_x = bb_x;
+        it->bb_y = bb_y;
+        it->bb_w = bb_w;
+        it->bb_h = bb_h;
+        if (same) {
+            // Ahead of time, the entry of the last rendering may still be needed
+            // for the current subtitle, so copy it instead of reusing it.
+            if (it != _rendered)
+                std::memcpy(it->buffer.ptr(), _rendered->buffer.ptr(), bufsize);
+        } else {
+            _renderer->render(it->buffer.ptr<uint32_t>());
+            _rendered = it;
+        }
+    }
+    it->subtitle = _subtitle;
+    it->timestamp = timestamp;
+    it->params = _params;
+    it->outwidth = _outwidth;
+    it->outheight = _outheight;
+    it->pixel_ar = _pixel_ar;
+    if (_ahead) {
+        // Keep the current subtitle at the front, where get() finds it.
+        std::list<cache_entry>::iterator second = _cache.begin();
+        if (second != it)
+            second++;
+        _cache.splice(second, _cache, it);
+    } else {
+        _cache.splice(_cache.begin(), _cache, it);
+        _buffer_changed = true;
+    }
+
+    // Limit the memory used by the cache, but always keep the current entry
+    while (_cache_size > cache_max_size && _cache.size() > 1) {
+        it = --_cache.end();
+        if (it == _rendered)
+            _rendered = _cache.end();
+        _cache_size -= it->buffer.size();
+        _cache.erase(it);
     }
 }
 
@@ -217,11 +313,20 @@ bool subtitle_updater::get(int *outwidth, int* outheight,
 {
     *outwidth = _outwidth;
     *outheight = _outheight;
-    *ptr = _buffer.ptr();
-    *bb_x = _bb_x;
-    *bb_y = _bb_y;
-    *bb_w = _bb_w;
-    *bb_h = _bb_h;
+    if (_cache.empty()) {
+        *ptr = NULL;
+        *bb_x = 0;
+        *bb_y = 0;
+        *bb_w = 0;
+        *bb_h = 0;
+    } else {
+        const cache_entry& e = _cache.front();
+        *ptr = const_cast<void*>(e.buffer.ptr());
+        *bb_x = e.bb_x;
+        *bb_y = e.bb_y;
+        *bb_w = e.bb_w;
+        *bb_h = e.bb_h;
+    }
     return _buffer_changed;
 }
 
@@ -241,6 +346,34 @@ static int next_multiple_of_4(int x)
     return (x / 4 + (x % 4 == 0 ? 0 : 1)) * 4;
 }
 
+// Create an input texture. If layers is not zero, this is an array texture
+// with the given number of layers. Its memory is added to bytes.
+static GLuint create_input_tex(int layers, GLint internal_format, int w, int h, GLenum format, GLenum type,
+        int bytes_per_texel, size_t *bytes)
+{
+    GLenum target = (layers > 0 ? GL_TEXTURE_2D_ARRAY_EXT : GL_TEXTURE_2D);
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(target, tex);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    if (layers > 0)
+        glTexImage3D(target, 0, internal_format, w, h, layers, 0, format, type, NULL);
+    else
+        glTexImage2D(target, 0, internal_format, w, h, 0, format, type, NULL);
+    *bytes += static_cast<size_t>(w) * h * std::max(layers, 1) * bytes_per_texel;
+    return tex;
+}
+
+// The memory of a texture of the color and render cache formats in bytes.
+// Drivers pad RGB textures to four components.
+static size_t tex_bytes(GLint internal_format, int w, int h)
+{
+    return static_cast<size_t>(w) * h * (internal_format == GL_RGB16 ? 8 : 4);
+}
+
 static void xglKillCrlf(char* str)
 {
     size_t l = std::strlen(str);
@@ -294,6 +427,52 @@ static void compute_viewport_and_tex_coords(int vp[4], float tc[4][2],
     vp[1] = (h - vp[3]) / 2;
 }
 
+// For hardware surfaces, the input textures contain the complete input frame,
+// so instead of extracting the views as video_frame::copy_plane() does, we
+// select them via texture coordinates. Returns the index of the surface that
+// contains the view.
+static int compute_surface_tex_coords(const video_frame &frame, int view, float tc[2][4][2])
+{
+    float x0 = 0.0f, y0 = 0.0f, x1 = 1.0f, y1 = 1.0f;
+    int surface = 0;
+    if (frame.stereo_layout_swap)
+        view = (view == 0 ? 1 : 0);
+    switch (frame.stereo_layout) {
+    case parameters::layout_mono:
+        break;
+    case parameters::layout_separate:
+    case parameters::layout_alternating:
+        surface = view;
+        break;
+    case parameters::layout_top_bottom:
+    case parameters::layout_top_bottom_half:
+        y0 = view * 0.5f;
+        y1 = y0 + 0.5f;
+        break;
+    case parameters::layout_left_right:
+    case parameters::layout_left_right_half:
+        x0 = view * 0.5f;
+        x1 = x0 + 0.5f;
+        break;
+    case parameters::layout_even_odd_rows:
+        // With nearest neighbor filtering, this hits the center of every second row.
+        y0 = (view - 0.5f) / frame.raw_height;
+        y1 = y0 + 1.0f;
+        break;
+    }
+    for (int i = 0; i < 2; i++) {
+        tc[i][0][0] = x0;
+        tc[i][0][1] = y0;
+        tc[i][1][0] = x1;
+        tc[i][1][1] = y0;
+        tc[i][2][0] = x1;
+        tc[i][2][1] = y1;
+        tc[i][3][0] = x0;
+        tc[i][3][1] = y1;
+    }
+    return surface;
+}
+
 
 /*
  * The video output
@@ -301,25 +480,122 @@ static void compute_viewport_and_tex_coords(int vp[4], float tc[4][2],
 
 video_output::video_output() : controller(), _initialized(false)
 {
-    _input_pbo = 0;
+    for (int i = 0; i < _input_pbo_count; i++) {
+        _input_pbo[i] = 0;
+        _input_pbo_fence[i] = 0;
+        _input_pbo_ptr[i] = NULL;
+    }
+    _input_pbo_size = 0;
+    _input_pbo_index = 0;
+    set_input_region(0.0f, 0.0f, 1.0f, 1.0f);
+    _input_region_is_set = false;
+    std::memset(_input_view_region, 0, sizeof(_input_view_region));
+    _input_prev_valid = false;
+    _subtitle_pbo = 0;
+    _subtitle_pbo_size = 0;
+    _input_tex_bytes = 0;
+    _upload_frames = 0;
+    _upload_time = 0;
+    _gpu_timer_supported = false;
+    for (int i = 0; i < _gpu_stage_count; i++) {
+        for (int j = 0; j < _gpu_timer_count; j++) {
+            _gpu_timer_query[i][j] = 0;
+            _gpu_timer_pending[i][j] = false;
+        }
+        _gpu_timer_index[i] = 0;
+        _gpu_frames[i] = 0;
+        _gpu_time[i] = 0;
+    }
+    _gpu_timer_active = -1;
+    _quality_limit = 4;
+    _quality_window_frames = 0;
+    _quality_window_late_frames = 0;
+    _quality_good_windows = 0;
+    for (int i = 0; i < _gpu_stage_count; i++) {
+        _quality_mark_gpu_frames[i] = 0;
+        _quality_mark_gpu_time[i] = 0;
+    }
+    _quality_params_version = 0;
+    _render_params_version = 0;
     _input_fbo = 0;
+    _input_supports_vdpau_surfaces = false;
+#if HAVE_LIBVDPAU
+    _input_vdpau_device = NULL;
+    _input_vdpau_mapped[0] = 0;
+    _input_vdpau_mapped[1] = 0;
+#endif
     _active_index = 1;
     for (int i = 0; i < 2; i++) {
-        _input_yuv_y_tex[i] = 0;
-        _input_yuv_u_tex[i] = 0;
-        _input_yuv_v_tex[i] = 0;
-        _input_bgra32_tex[i] = 0;
-        for (int j = 0; j < 2; j++)
+        for (int j = 0; j < 2; j++) {
+            _input_yuv_y_tex[i][j] = 0;
+            _input_yuv_u_tex[i][j] = 0;
+            _input_yuv_v_tex[i][j] = 0;
+            _input_bgra32_tex[i][j] = 0;
             _color_tex[i][j] = 0;
+        }
+        _color_tex_bytes[i] = 0;
+        _color_tex_format[i] = 0;
+        _render_fused[i] = false;
         _subtitle_tex[i] = 0;
+        _subtitle_tex_bytes[i] = 0;
         _subtitle_tex_current[i] = false;
+        for (int j = 0; j < 4; j++)
+            _subtitle_tex_bb[i][j] = 0;
         _color_prg[i] = 0;
+        _color_loc_input_layer[i] = -1;
+        _color_loc_deinterlace[i][0] = -1;
+        _color_loc_deinterlace[i][1] = -1;
+        for (int j = 0; j < 4; j++)
+            _color_loc_packed_view[i][j] = -1;
     }
     _color_fbo = 0;
     _render_prg = 0;
+    _render_last_fused = false;
+    _render_loc_parallax = -1;
+    _render_loc_vertical_shift_left = -1;
+    _render_loc_vertical_shift_right = -1;
+    _render_loc_subtitle_parallax = -1;
+    _render_loc_color_matrix = -1;
+    _render_loc_crosstalk = -1;
+    _render_loc_step_x = -1;
+    _render_loc_step_y = -1;
+    _render_loc_channel = -1;
+    _render_loc_input_layer = -1;
+    for (int j = 0; j < 4; j++)
+        _render_loc_packed_view[j] = -1;
+    _output_fbo = 0;
+    std::memset(_display_span, 0, sizeof(_display_span));
+    _quad_vbo = 0;
+    _quad_vao = 0;
     _render_dummy_tex = 0;
     _render_mask_tex = 0;
+    _transfer_lut_tex[0] = 0;
+    _transfer_lut_tex[1] = 0;
+    _render_cache_fbo = 0;
+    _render_cache_tex[0] = 0;
+    _render_cache_tex[1] = 0;
+    _render_cache_valid[0] = false;
+    _render_cache_valid[1] = false;
+    _render_cache_tex_width = -1;
+    _render_cache_tex_height = -1;
+    _render_cache_width = -1;
+    _render_cache_height = -1;
+    std::memset(_render_cache_viewport, 0, sizeof(_render_cache_viewport));
+    _render_cache_stereo_mode = parameters::mode_mono_left;
+    _render_cache_params_version = 0;
     _subtitle_updater = new subtitle_updater(&_subtitle_renderer);
+    _share_fbo = 0;
+    _share_rb = 0;
+    _share_rb_width = 0;
+    _share_rb_height = 0;
+    for (int i = 0; i < 2; i++) {
+        _share_pbo[i] = 0;
+        _share_pbo_size[i] = 0;
+        _share_pbo_fence[i] = 0;
+        _share_pbo_frameno[i] = -1;
+    }
+    _share_pbo_index = 0;
+    _last_shared_frameno = -1;
 #if HAVE_LIBXNVCTRL
     _nv_sdi_output = new CNvSDIout();
     _last_nv_sdi_displayed_frameno = 0;
@@ -328,6 +604,7 @@ video_output::video_output() : controller(), _initialized(false)
 
 video_output::~video_output()
 {
+    _subtitle_updater->wait();
     delete _subtitle_updater;
 #if HAVE_LIBXNVCTRL
     delete _nv_sdi_output;
@@ -518,6 +795,249 @@ void video_output::xglDeleteProgram(GLuint program) const
     }
 }
 
+// Vertex attribute locations and layout of the quad vertex buffer (see draw_quad())
+static const GLuint quad_attrib_position = 0;
+static const GLuint quad_attrib_texcoord0 = 1;
+static const GLuint quad_attrib_texcoord1 = 2;
+static const GLuint quad_attrib_texcoord2 = 3;
+static const int quad_vertex_floats = 8;
+
+static const char *program_binary_file_magic = "bino-program-binary-1";
+
+static std::string gl_string(GLenum name)
+{
+    const GLubyte *s = glGetString(name);
+    return (s ? reinterpret_cast<const char *>(s) : "");
+}
+
+/**
+ * \param name              Name of the program. Can be an arbitrary string.
+ * \param vshader_src       Source of the vertex shader, or an empty string.
+ * \param fshader_src       Source of the fragment shader, or an empty string.
+ * \returns                 The linked GL program object.
+ *
+ * Returns a linked GL program for the given shader sources. The programs are
+ * cached until deinit(), so that switching back and forth between settings
+ * does not recompile them. The caller must not delete the program.
+ * With GL_ARB_get_program_binary, the program binaries are additionally cached
+ * on disk, so that later runs with known settings skip the compilation.
+ */
+GLuint video_output::xglGetProgram(const std::string& name,
+        const std::string& vshader_src, const std::string& fshader_src)
+{
+    std::string key = vshader_src + '\0' + fshader_src;
+    std::map<std::string, GLuint>::const_iterator it = _program_cache.find(key);
+    if (it != _program_cache.end())
+        return it->second;
+
+    // The binary format is specific to the driver, so it is part of the identity
+    std::string cache_file;
+    if (GLEW_ARB_get_program_binary) {
+        cache_file = dir::cache_file("program", key + '\0' + gl_string(GL_VENDOR)
+                + '\0' + gl_string(GL_RENDERER) + '\0' + gl_string(GL_VERSION));
+    }
+    GLuint prg = 0;
+    if (!cache_file.empty())
+        prg = xglLoadProgramBinary(name, cache_file);
+    if (prg == 0) {
+        prg = xglCreateProgram(name, vshader_src, fshader_src);
+        // The vertex attributes of draw_quad(); unused names are ignored
+        glBindAttribLocation(prg, quad_attrib_position, "position");
+        glBindAttribLocation(prg, quad_attrib_texcoord0, "texcoord0");
+        glBindAttribLocation(prg, quad_attrib_texcoord1, "texcoord1");
+        glBindAttribLocation(prg, quad_attrib_texcoord2, "texcoord2");
+        if (!cache_file.empty())
+            glProgramParameteri(prg, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        xglLinkProgram(name, prg);
+        if (!cache_file.empty())
+            xglSaveProgramBinary(name, prg, cache_file);
+    }
+    _program_cache.insert(std::make_pair(key, prg));
+    return prg;
+}
+
+GLuint video_output::xglLoadProgramBinary(const std::string& name, const std::string& filename) const
+{
+    std::ifstream ifs(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!ifs.good())
+        return 0;
+    std::string magic;
+    int format;
+    std::string binary;
+    try {
+        s11n::load(ifs, magic);
+        if (magic != program_binary_file_magic)
+            return 0;
+        s11n::load(ifs, format);
+        s11n::load(ifs, binary);
+        if (!ifs.good())
+            return 0;
+    }
+    catch (...) {
+        // Ignore broken cache files; the program will be rebuilt.
+        return 0;
+    }
+    GLuint prg = glCreateProgram();
+    glProgramBinary(prg, format, binary.data(), binary.length());
+    GLint e;
+    glGetProgramiv(prg, GL_LINK_STATUS, &e);
+    if (e != GL_TRUE) {
+        // The driver may reject binaries even for the same version string
+        glDeleteProgram(prg);
+        // Clear the error state that glProgramBinary may have set
+        glGetError();
+        return 0;
+    }
+    msg::dbg("Loaded OpenGL program %s from %s.", name.c_str(), filename.c_str());
+    return prg;
+}
+
+void video_output::xglSaveProgramBinary(const std::string& name, GLuint prg, const std::string& filename) const
+{
+    GLint length = 0;
+    glGetProgramiv(prg, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0 || !dir::make_cache())
+        return;
+    std::string binary(length, '\0');
+    GLenum format;
+    glGetProgramBinary(prg, length, NULL, &format, &(binary[0]));
+    std::ofstream ofs(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    s11n::save(ofs, std::string(program_binary_file_magic));
+    s11n::save(ofs, static_cast<int>(format));
+    s11n::save(ofs, binary);
+    if (!ofs.good())
+        msg::dbg(filename + ": " + std::strerror(errno));
+    else
+        msg::dbg("Saved OpenGL program %s to %s.", name.c_str(), filename.c_str());
+}
+
+void video_output::xglClearProgramCache()
+{
+    for (std::map<std::string, GLuint>::const_iterator it = _program_cache.begin();
+            it != _program_cache.end(); it++) {
+        xglDeleteProgram(it->second);
+    }
+    _program_cache.clear();
+}
+
+GLuint video_output::tex_pool_get(GLint internal_format, int w, int h)
+{
+    for (size_t i = 0; i < _tex_pool.size(); i++) {
+        if (_tex_pool[i].internal_format == internal_format
+                && _tex_pool[i].width == w && _tex_pool[i].height == h) {
+            GLuint tex = _tex_pool[i].tex;
+            _tex_pool.erase(_tex_pool.begin() + i);
+            glBindTexture(GL_TEXTURE_2D, tex);
+            return tex;
+        }
+    }
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, w, h, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+    return tex;
+}
+
+void video_output::tex_pool_put(GLuint tex, GLint internal_format, int w, int h)
+{
+    if (_tex_pool.size() == _tex_pool_size) {
+        glDeleteTextures(1, &(_tex_pool[0].tex));
+        _tex_pool.erase(_tex_pool.begin());
+    }
+    pooled_tex t;
+    t.tex = tex;
+    t.internal_format = internal_format;
+    t.width = w;
+    t.height = h;
+    _tex_pool.push_back(t);
+}
+
+void video_output::tex_pool_clear()
+{
+    for (size_t i = 0; i < _tex_pool.size(); i++)
+        glDeleteTextures(1, &(_tex_pool[i].tex));
+    _tex_pool.clear();
+}
+
+void video_output::gpu_timer_init()
+{
+    _gpu_timer_supported = (GLEW_ARB_timer_query || GLEW_EXT_timer_query);
+    if (_gpu_timer_supported) {
+        for (int i = 0; i < _gpu_stage_count; i++) {
+            glGenQueries(_gpu_timer_count, _gpu_timer_query[i]);
+            for (int j = 0; j < _gpu_timer_count; j++)
+                _gpu_timer_pending[i][j] = false;
+            _gpu_timer_index[i] = 0;
+        }
+    }
+    _gpu_timer_active = -1;
+}
+
+void video_output::gpu_timer_deinit()
+{
+    if (_gpu_timer_supported) {
+        if (_gpu_timer_active >= 0)
+            glEndQuery(GL_TIME_ELAPSED);
+        for (int i = 0; i < _gpu_stage_count; i++) {
+            glDeleteQueries(_gpu_timer_count, _gpu_timer_query[i]);
+            for (int j = 0; j < _gpu_timer_count; j++) {
+                _gpu_timer_query[i][j] = 0;
+                _gpu_timer_pending[i][j] = false;
+            }
+        }
+        _gpu_timer_supported = false;
+    }
+    _gpu_timer_active = -1;
+}
+
+void video_output::gpu_timer_collect(int stage_index)
+{
+    for (int j = 0; j < _gpu_timer_count; j++) {
+        if (!_gpu_timer_pending[stage_index][j])
+            continue;
+        GLint available = 0;
+        glGetQueryObjectiv(_gpu_timer_query[stage_index][j], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+        GLuint64 ns = 0;
+        if (GLEW_ARB_timer_query)
+            glGetQueryObjectui64v(_gpu_timer_query[stage_index][j], GL_QUERY_RESULT, &ns);
+        else
+            glGetQueryObjectui64vEXT(_gpu_timer_query[stage_index][j], GL_QUERY_RESULT, &ns);
+        _gpu_timer_pending[stage_index][j] = false;
+        int64_t us = ns / 1000;
+        _gpu_frames[stage_index]++;
+        _gpu_time[stage_index] += us;
+        benchmark_stats::add(static_cast<benchmark_stats::stage_t>(benchmark_stats::gpu_color + stage_index), us);
+    }
+}
+
+void video_output::gpu_timer_begin(benchmark_stats::stage_t stage)
+{
+    if (!_gpu_timer_supported || _gpu_timer_active >= 0)
+        return;
+    int i = stage - benchmark_stats::gpu_color;
+    gpu_timer_collect(i);
+    int j = _gpu_timer_index[i];
+    // If the GPU has not even finished the oldest query of this stage, skip
+    // this measurement instead of waiting for it.
+    if (_gpu_timer_pending[i][j])
+        return;
+    glBeginQuery(GL_TIME_ELAPSED, _gpu_timer_query[i][j]);
+    _gpu_timer_active = stage;
+}
+
+void video_output::gpu_timer_end(benchmark_stats::stage_t stage)
+{
+    if (_gpu_timer_active != stage)
+        return;
+    int i = stage - benchmark_stats::gpu_color;
+    glEndQuery(GL_TIME_ELAPSED);
+    _gpu_timer_pending[i][_gpu_timer_index[i]] = true;
+    _gpu_timer_index[i] = (_gpu_timer_index[i] + 1) % _gpu_timer_count;
+    _gpu_timer_active = -1;
+}
+
 bool video_output::srgb8_textures_are_color_renderable()
 {
     bool retval = true;
@@ -547,38 +1067,62 @@ bool video_output::srgb8_textures_are_color_renderable()
     return retval;
 }
 
+/* The quad is drawn from a small vertex buffer that holds the position and
+ * the three texture coordinates of each vertex. With a vertex array object,
+ * the attribute setup is done once in init(). */
+void video_output::quad_setup_attribs() const
+{
+    const GLsizei stride = quad_vertex_floats * sizeof(float);
+    glEnableVertexAttribArray(quad_attrib_position);
+    glVertexAttribPointer(quad_attrib_position, 2, GL_FLOAT, GL_FALSE, stride,
+            reinterpret_cast<const GLvoid *>(0 * sizeof(float)));
+    glEnableVertexAttribArray(quad_attrib_texcoord0);
+    glVertexAttribPointer(quad_attrib_texcoord0, 2, GL_FLOAT, GL_FALSE, stride,
+            reinterpret_cast<const GLvoid *>(2 * sizeof(float)));
+    glEnableVertexAttribArray(quad_attrib_texcoord1);
+    glVertexAttribPointer(quad_attrib_texcoord1, 2, GL_FLOAT, GL_FALSE, stride,
+            reinterpret_cast<const GLvoid *>(4 * sizeof(float)));
+    glEnableVertexAttribArray(quad_attrib_texcoord2);
+    glVertexAttribPointer(quad_attrib_texcoord2, 2, GL_FLOAT, GL_FALSE, stride,
+            reinterpret_cast<const GLvoid *>(6 * sizeof(float)));
+}
+
 void video_output::draw_quad(float x, float y, float w, float h,
         const float tex_coords[2][4][2],
         const float more_tex_coords[4][2]) const
 {
     const float (*my_tex_coords)[4][2] = (tex_coords ? tex_coords : full_tex_coords);
-
-    glBegin(GL_QUADS);
-    glTexCoord2f(my_tex_coords[0][0][0], my_tex_coords[0][0][1]);
-    glMultiTexCoord2f(GL_TEXTURE1, my_tex_coords[1][0][0], my_tex_coords[1][0][1]);
-    if (more_tex_coords) {
-        glMultiTexCoord2f(GL_TEXTURE2, more_tex_coords[0][0], more_tex_coords[0][1]);
-    }
-    glVertex2f(x, y);
-    glTexCoord2f(my_tex_coords[0][1][0], my_tex_coords[0][1][1]);
-    glMultiTexCoord2f(GL_TEXTURE1, my_tex_coords[1][1][0], my_tex_coords[1][1][1]);
-    if (more_tex_coords) {
-        glMultiTexCoord2f(GL_TEXTURE2, more_tex_coords[1][0], more_tex_coords[1][1]);
-    }
-    glVertex2f(x + w, y);
-    glTexCoord2f(my_tex_coords[0][2][0], my_tex_coords[0][2][1]);
-    glMultiTexCoord2f(GL_TEXTURE1, my_tex_coords[1][2][0], my_tex_coords[1][2][1]);
-    if (more_tex_coords) {
-        glMultiTexCoord2f(GL_TEXTURE2, more_tex_coords[2][0], more_tex_coords[2][1]);
+    const float pos[4][2] = { { x, y }, { x + w, y }, { x + w, y + h }, { x, y + h } };
+
+    float vertices[4 * quad_vertex_floats];
+    for (int i = 0; i < 4; i++) {
+        float *v = vertices + i * quad_vertex_floats;
+        v[0] = pos[i][0];
+        v[1] = pos[i][1];
+        v[2] = my_tex_coords[0][i][0];
+        v[3] = my_tex_coords[0][i][1];
+        v[4] = my_tex_coords[1][i][0];
+        v[5] = my_tex_coords[1][i][1];
+        v[6] = (more_tex_coords ? more_tex_coords[i][0] : 0.0f);
+        v[7] = (more_tex_coords ? more_tex_coords[i][1] : 0.0f);
     }
-    glVertex2f(x + w, y + h);
-    glTexCoord2f(my_tex_coords[0][3][0], my_tex_coords[0][3][1]);
-    glMultiTexCoord2f(GL_TEXTURE1, my_tex_coords[1][3][0], my_tex_coords[1][3][1]);
-    if (more_tex_coords) {
-        glMultiTexCoord2f(GL_TEXTURE2, more_tex_coords[3][0], more_tex_coords[3][1]);
+    glBindBuffer(GL_ARRAY_BUFFER, _quad_vbo);
+    // Respecify the whole buffer so that the GL does not have to wait
+    // until a previous draw call using it is finished.
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STREAM_DRAW);
+    if (_quad_vao) {
+        glBindVertexArray(_quad_vao);
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        glBindVertexArray(0);
+    } else {
+        quad_setup_attribs();
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        glDisableVertexAttribArray(quad_attrib_position);
+        glDisableVertexAttribArray(quad_attrib_texcoord0);
+        glDisableVertexAttribArray(quad_attrib_texcoord1);
+        glDisableVertexAttribArray(quad_attrib_texcoord2);
     }
-    glVertex2f(x, y + h);
-    glEnd();
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void video_output::init()
@@ -591,10 +1135,28 @@ void video_output::init()
         _full_viewport[1] = -1;
         _full_viewport[2] = -1;
         _full_viewport[3] = -1;
+#if HAVE_LIBVDPAU
+        _input_supports_vdpau_surfaces = GLEW_NV_vdpau_interop;
+#endif
+        glGenBuffers(1, &_quad_vbo);
+        if (GLEW_ARB_vertex_array_object) {
+            glGenVertexArrays(1, &_quad_vao);
+            glBindVertexArray(_quad_vao);
+            glBindBuffer(GL_ARRAY_BUFFER, _quad_vbo);
+            quad_setup_attribs();
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+        gpu_timer_init();
         _initialized = true;
     }
 }
 
+void video_output::start_subtitle_renderer()
+{
+    _subtitle_renderer.start_init();
+}
+
 void video_output::deinit()
 {
     if (_initialized) {
@@ -610,7 +1172,35 @@ void video_output::deinit()
         subtitle_deinit(1);
         color_deinit(0);
         color_deinit(1);
+        glDeleteFramebuffersEXT(1, &_color_fbo);
+        _color_fbo = 0;
         render_deinit();
+        if (_render_dummy_tex != 0) {
+            glDeleteTextures(1, &_render_dummy_tex);
+            _render_dummy_tex = 0;
+        }
+        if (_render_mask_tex != 0) {
+            glDeleteTextures(1, &_render_mask_tex);
+            _render_mask_tex = 0;
+        }
+        render_cache_deinit();
+        share_deinit();
+        tex_pool_clear();
+        if (_transfer_lut_tex[0] != 0 || _transfer_lut_tex[1] != 0) {
+            glDeleteTextures(2, _transfer_lut_tex);
+            _transfer_lut_tex[0] = 0;
+            _transfer_lut_tex[1] = 0;
+        }
+        _reshape_last_params = parameters();
+        _reshape_last_frame = video_frame();
+        xglClearProgramCache();
+        if (_quad_vao != 0) {
+            glDeleteVertexArrays(1, &_quad_vao);
+            _quad_vao = 0;
+        }
+        glDeleteBuffers(1, &_quad_vbo);
+        _quad_vbo = 0;
+        gpu_timer_deinit();
         xglCheckError(HERE);
         _initialized = false;
     }
@@ -641,154 +1231,604 @@ void video_output::set_suitable_size(int width, int height, float ar, parameters
 void video_output::input_init(const video_frame &frame)
 {
     xglCheckError(HERE);
-    glGenBuffers(1, &_input_pbo);
+    glGenBuffers(1, &_subtitle_pbo);
     glGenFramebuffersEXT(1, &_input_fbo);
+    // With an array texture, both views are layers of the texture of view 0.
+    // Linear filtering does not change the texel center samples of the color
+    // conversion step, but it is needed when the render step reads these
+    // textures directly.
+    int layers = (input_tex_array(frame) ? 2 : 0);
+    bool packed = input_tex_packed(frame);
+    int textures = (frame.stereo_layout == parameters::layout_mono || layers > 0 || packed ? 1 : 2);
+    int tex_width = (packed ? frame.raw_width : frame.width);
+    int tex_height = (packed ? frame.raw_height : frame.height);
     if (frame.layout == video_frame::bgra32) {
-        for (int i = 0; i < (frame.stereo_layout == parameters::layout_mono ? 1 : 2); i++) {
-            glGenTextures(1, &(_input_bgra32_tex[i]));
-            glBindTexture(GL_TEXTURE_2D, _input_bgra32_tex[i]);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, frame.width, frame.height,
-                    0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+        for (int j = 0; j < 2; j++) {
+            for (int i = 0; i < textures; i++) {
+                _input_bgra32_tex[j][i] = create_input_tex(layers, GL_RGB8, tex_width, tex_height,
+                        GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 4, &_input_tex_bytes);
+            }
         }
     } else {
         _input_yuv_chroma_width_divisor = 1;
         _input_yuv_chroma_height_divisor = 1;
-        bool need_chroma_filtering = false;
         if (frame.layout == video_frame::yuv422p) {
             _input_yuv_chroma_width_divisor = 2;
-            need_chroma_filtering = true;
-        } else if (frame.layout == video_frame::yuv420p) {
+        } else if (frame.layout == video_frame::yuv420p || frame.layout == video_frame::yuv420sp) {
             _input_yuv_chroma_width_divisor = 2;
             _input_yuv_chroma_height_divisor = 2;
-            need_chroma_filtering = true;
         }
         bool type_u8 = (frame.value_range == video_frame::u8_full || frame.value_range == video_frame::u8_mpeg);
         GLint internal_format = type_u8 ? GL_LUMINANCE8 : GL_LUMINANCE16;
         GLint type = type_u8 ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT;
-        for (int i = 0; i < (frame.stereo_layout == parameters::layout_mono ? 1 : 2); i++) {
-            glGenTextures(1, &(_input_yuv_y_tex[i]));
-            glBindTexture(GL_TEXTURE_2D, _input_yuv_y_tex[i]);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-            glTexImage2D(GL_TEXTURE_2D, 0, internal_format,
-                    frame.width,
-                    frame.height,
-                    0, GL_LUMINANCE, type, NULL);
-            glGenTextures(1, &(_input_yuv_u_tex[i]));
-            glBindTexture(GL_TEXTURE_2D, _input_yuv_u_tex[i]);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, need_chroma_filtering ? GL_LINEAR : GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, need_chroma_filtering ? GL_LINEAR : GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-            glTexImage2D(GL_TEXTURE_2D, 0, internal_format,
-                    frame.width / _input_yuv_chroma_width_divisor,
-                    frame.height / _input_yuv_chroma_height_divisor,
-                    0, GL_LUMINANCE, type, NULL);
-            glGenTextures(1, &(_input_yuv_v_tex[i]));
-            glBindTexture(GL_TEXTURE_2D, _input_yuv_v_tex[i]);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, need_chroma_filtering ? GL_LINEAR : GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, need_chroma_filtering ? GL_LINEAR : GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-            glTexImage2D(GL_TEXTURE_2D, 0, internal_format,
-                    frame.width / _input_yuv_chroma_width_divisor,
-                    frame.height / _input_yuv_chroma_height_divisor,
-                    0, GL_LUMINANCE, type, NULL);
+        // For the semi-planar layout, the interleaved U/V plane goes into a
+        // two-component texture in place of the U texture; there is no V texture.
+        bool semi_planar = (frame.layout == video_frame::yuv420sp);
+        GLint chroma_internal_format = (!semi_planar ? internal_format
+                : type_u8 ? GL_LUMINANCE8_ALPHA8 : GL_LUMINANCE16_ALPHA16);
+        GLenum chroma_format = (semi_planar ? GL_LUMINANCE_ALPHA : GL_LUMINANCE);
+        int chroma_width = tex_width / _input_yuv_chroma_width_divisor;
+        int chroma_height = tex_height / _input_yuv_chroma_height_divisor;
+        int texel_size = (type_u8 ? 1 : 2);
+        for (int j = 0; j < 2; j++) {
+            for (int i = 0; i < textures; i++) {
+                _input_yuv_y_tex[j][i] = create_input_tex(layers, internal_format,
+                        tex_width, tex_height, GL_LUMINANCE, type, texel_size, &_input_tex_bytes);
+                _input_yuv_u_tex[j][i] = create_input_tex(layers, chroma_internal_format,
+                        chroma_width, chroma_height, chroma_format, type,
+                        (semi_planar ? 2 : 1) * texel_size, &_input_tex_bytes);
+                if (semi_planar)
+                    continue;
+                _input_yuv_v_tex[j][i] = create_input_tex(layers, internal_format,
+                        chroma_width, chroma_height, GL_LUMINANCE, type, texel_size, &_input_tex_bytes);
+            }
+        }
+    }
+    if (layers > 0)
+        msg::dbg("Using array textures for the input views.");
+    else if (packed)
+        msg::dbg("Using packed textures for the input views.");
+    // Create the PBO ring. With ARB_buffer_storage, the PBOs are mapped once and
+    // stay mapped; otherwise, they are mapped for each frame. In both cases,
+    // fences (if available) tell us when a PBO can be reused.
+    _input_pbo_size = 0;
+    if (frame.surface_type == video_frame::no_surface) {
+        for (int i = 0; i < (frame.stereo_layout == parameters::layout_mono || packed ? 1 : 2); i++) {
+            for (int plane = 0; plane < frame.planes(); plane++) {
+                int w, h, row_size;
+                input_plane_size(frame, plane, &w, &h, &row_size);
+                _input_pbo_size += row_size * h;
+            }
+        }
+        _input_pbo_size = std::max(_input_pbo_size, input_direct_upload_size(frame));
+        bool persistent = (GLEW_ARB_buffer_storage && GLEW_ARB_map_buffer_range && GLEW_ARB_sync);
+        glGenBuffers(_input_pbo_count, _input_pbo);
+        for (int i = 0; i < _input_pbo_count; i++) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _input_pbo[i]);
+            if (persistent) {
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                glBufferStorage(GL_PIXEL_UNPACK_BUFFER, _input_pbo_size, NULL, flags);
+                _input_pbo_ptr[i] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, _input_pbo_size, flags);
+                if (!_input_pbo_ptr[i])
+                    throw exc(_("Cannot create a PBO buffer."));
+            } else {
+                glBufferData(GL_PIXEL_UNPACK_BUFFER, _input_pbo_size, NULL, GL_STREAM_DRAW);
+            }
         }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        msg::dbg("Using %d %s PBOs of %d bytes each for texture uploads.", _input_pbo_count,
+                persistent ? "persistently mapped" : "round-robin", static_cast<int>(_input_pbo_size));
     }
+    _input_pbo_index = 0;
 }
 
-void video_output::input_deinit()
+int video_output::input_bytes_per_pixel(const video_frame &frame, int plane) const
 {
-    xglCheckError(HERE);
-    glDeleteBuffers(1, &_input_pbo);
-    _input_pbo = 0;
-    glDeleteFramebuffersEXT(1, &_input_fbo);
-    _input_fbo = 0;
+    if (frame.layout == video_frame::bgra32)
+        return 4;
+    bool type_u8 = (frame.value_range == video_frame::u8_full || frame.value_range == video_frame::u8_mpeg);
+    return (type_u8 ? 1 : 2) * (frame.layout == video_frame::yuv420sp && plane != 0 ? 2 : 1);
+}
+
+void video_output::input_plane_size(const video_frame &frame, int plane, int *w, int *h, int *row_size) const
+{
+    bool packed = input_tex_packed(frame);
+    *w = (packed ? frame.raw_width : frame.width);
+    *h = (packed ? frame.raw_height : frame.height);
+    if (frame.layout != video_frame::bgra32 && plane != 0) {
+        *w /= _input_yuv_chroma_width_divisor;
+        *h /= _input_yuv_chroma_height_divisor;
+    }
+    *row_size = next_multiple_of_4(*w * input_bytes_per_pixel(frame, plane));
+}
+
+void video_output::set_input_region(float x, float y, float w, float h)
+{
+    _input_region[0] = x;
+    _input_region[1] = y;
+    _input_region[2] = w;
+    _input_region[3] = h;
+    _input_region_is_set = true;
+}
+
+void video_output::input_update_region(const video_frame &frame)
+{
+    _input_region[0] = 0.0f;
+    _input_region[1] = 0.0f;
+    _input_region[2] = 1.0f;
+    _input_region[3] = 1.0f;
+    // A frame that stays on screen for a longer time, as in pause mode, must be
+    // complete, because the layout can change while it is displayed. While playing,
+    // a layout change affects at most the frames that are already prepared.
+    // The tex coords must have been computed for this kind of frame and these
+    // parameters; they are recomputed when the frame is displayed otherwise.
+    // NVIDIA SDI output uses its own layout.
+    const parameters &params = _params.get();
+    if (!dispatch::playing() || dispatch::pausing()
+            || frame.width != _reshape_last_frame.width
+            || frame.height != _reshape_last_frame.height
+            || frame.aspect_ratio < _reshape_last_frame.aspect_ratio
+            || frame.aspect_ratio > _reshape_last_frame.aspect_ratio
+            || params.stereo_mode() != _reshape_last_params.stereo_mode()
+            || params.crop_aspect_ratio() < _reshape_last_params.crop_aspect_ratio()
+            || params.crop_aspect_ratio() > _reshape_last_params.crop_aspect_ratio()
+            || params.source_aspect_ratio() < _reshape_last_params.source_aspect_ratio()
+            || params.source_aspect_ratio() > _reshape_last_params.source_aspect_ratio()
+            || params.zoom() < _reshape_last_params.zoom()
+            || params.zoom() > _reshape_last_params.zoom()
+#if HAVE_LIBXNVCTRL
+            || _nv_sdi_output->isInitialized()
+#endif // HAVE_LIBXNVCTRL
+       ) {
+        return;
+    }
+    float x0 = 1.0f, y0 = 1.0f, x1 = 0.0f, y1 = 0.0f;
     for (int i = 0; i < 2; i++) {
-        if (_input_yuv_y_tex[i] != 0) {
-            glDeleteTextures(1, &(_input_yuv_y_tex[i]));
-            _input_yuv_y_tex[i] = 0;
+        for (int j = 0; j < 4; j++) {
+            x0 = std::min(x0, _tex_coords[i][j][0]);
+            x1 = std::max(x1, _tex_coords[i][j][0]);
+            y0 = std::min(y0, _tex_coords[i][j][1]);
+            y1 = std::max(y1, _tex_coords[i][j][1]);
+        }
+    }
+    // The layout is always centered, so it does not matter that the color
+    // textures are vertically flipped relative to the input textures.
+    // Leave room for the parallax and vertical shift of the render step.
+    float mx = std::fabs(params.parallax()) * 0.05f;
+    float my = std::max(std::fabs(params.vertical_pixel_shift_left()),
+            std::fabs(params.vertical_pixel_shift_right())) / frame.height;
+    x0 = std::max(x0 - mx, 0.0f);
+    x1 = std::min(x1 + mx, 1.0f);
+    y0 = std::max(y0 - my, 0.0f);
+    y1 = std::min(y1 + my, 1.0f);
+    if (x1 > x0 && y1 > y0) {
+        _input_region[0] = x0;
+        _input_region[1] = y0;
+        _input_region[2] = x1 - x0;
+        _input_region[3] = y1 - y0;
+    }
+}
+
+bool video_output::input_region_is_full() const
+{
+    return (_input_region[0] <= 0.0f && _input_region[1] <= 0.0f
+            && _input_region[0] + _input_region[2] >= 1.0f
+            && _input_region[1] + _input_region[3] >= 1.0f);
+}
+
+void video_output::input_plane_region(const video_frame &frame, int plane,
+        int *x, int *y, int *w, int *h, int *row_size) const
+{
+    int plane_w, plane_h;
+    input_plane_size(frame, plane, &plane_w, &plane_h, row_size);
+    if (input_region_is_full()) {
+        *x = 0;
+        *y = 0;
+        *w = plane_w;
+        *h = plane_h;
+        return;
+    }
+    // Packed textures hold both views, so use the union of the regions of both views.
+    float rx = _input_region[0], ry = _input_region[1], rw = _input_region[2], rh = _input_region[3];
+    int tex_width = frame.width, tex_height = frame.height;
+    if (input_tex_packed(frame)) {
+        tex_width = frame.raw_width;
+        tex_height = frame.raw_height;
+        if (frame.stereo_layout == parameters::layout_left_right
+                || frame.stereo_layout == parameters::layout_left_right_half) {
+            rx /= 2.0f;
+            rw = 0.5f + rw / 2.0f;
+        } else {
+            ry /= 2.0f;
+            rh = 0.5f + rh / 2.0f;
+        }
+    }
+    // Determine the region in pixels of the texture, with a margin for texture
+    // filtering, and aligned so that it maps exactly to subsampled chroma planes.
+    int x0 = std::max(static_cast<int>(std::floor(rx * tex_width)) - 2, 0) / 4 * 4;
+    int y0 = std::max(static_cast<int>(std::floor(ry * tex_height)) - 2, 0) / 4 * 4;
+    int x1 = (static_cast<int>(std::ceil((rx + rw) * tex_width)) + 2 + 3) / 4 * 4;
+    int y1 = (static_cast<int>(std::ceil((ry + rh) * tex_height)) + 2 + 3) / 4 * 4;
+    int wd = 1, hd = 1;
+    if (frame.layout != video_frame::bgra32 && plane != 0) {
+        wd = _input_yuv_chroma_width_divisor;
+        hd = _input_yuv_chroma_height_divisor;
+    }
+    *x = std::min(x0 / wd, plane_w);
+    *y = std::min(y0 / hd, plane_h);
+    *w = std::max(std::min(x1 / wd, plane_w) - *x, 0);
+    *h = std::max(std::min(y1 / hd, plane_h) - *y, 0);
+    *row_size = next_multiple_of_4(*w * input_bytes_per_pixel(frame, plane));
+}
+
+int video_output::input_raw_plane_height(const video_frame &frame, int plane) const
+{
+    return (frame.layout == video_frame::bgra32 || plane == 0
+            ? frame.raw_height : frame.raw_height / _input_yuv_chroma_height_divisor);
+}
+
+size_t video_output::input_direct_upload_size(const video_frame &frame) const
+{
+    size_t size = 0;
+    int data_views = (frame.stereo_layout == parameters::layout_separate
+            || frame.stereo_layout == parameters::layout_alternating ? 2 : 1);
+    for (int i = 0; i < data_views; i++) {
+        for (int plane = 0; plane < frame.planes(); plane++) {
+            // The GL needs row sizes that are a multiple of GL_UNPACK_ALIGNMENT
+            if (frame.line_size[i][plane] % 4 != 0)
+                return 0;
+            size += frame.line_size[i][plane] * input_raw_plane_height(frame, plane);
         }
-        if (_input_yuv_u_tex[i] != 0) {
-            glDeleteTextures(1, &(_input_yuv_u_tex[i]));
-            _input_yuv_u_tex[i] = 0;
+    }
+    return size;
+}
+
+void video_output::input_deinit()
+{
+    xglCheckError(HERE);
+    for (int i = 0; i < _input_pbo_count; i++) {
+        if (_input_pbo_fence[i]) {
+            glDeleteSync(_input_pbo_fence[i]);
+            _input_pbo_fence[i] = 0;
         }
-        if (_input_yuv_v_tex[i] != 0) {
-            glDeleteTextures(1, &(_input_yuv_v_tex[i]));
-            _input_yuv_v_tex[i] = 0;
+        if (_input_pbo[i] != 0) {
+            // This also unmaps persistently mapped buffers.
+            glDeleteBuffers(1, &(_input_pbo[i]));
+            _input_pbo[i] = 0;
         }
-        if (_input_bgra32_tex[i] != 0) {
-            glDeleteTextures(1, &(_input_bgra32_tex[i]));
-            _input_bgra32_tex[i] = 0;
+        _input_pbo_ptr[i] = NULL;
+    }
+    _input_pbo_size = 0;
+    _input_tex_bytes = 0;
+    glDeleteBuffers(1, &_subtitle_pbo);
+    _subtitle_pbo = 0;
+    _subtitle_pbo_size = 0;
+    glDeleteFramebuffersEXT(1, &_input_fbo);
+    _input_fbo = 0;
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < 2; i++) {
+            if (_input_yuv_y_tex[j][i] != 0) {
+                glDeleteTextures(1, &(_input_yuv_y_tex[j][i]));
+                _input_yuv_y_tex[j][i] = 0;
+            }
+            if (_input_yuv_u_tex[j][i] != 0) {
+                glDeleteTextures(1, &(_input_yuv_u_tex[j][i]));
+                _input_yuv_u_tex[j][i] = 0;
+            }
+            if (_input_yuv_v_tex[j][i] != 0) {
+                glDeleteTextures(1, &(_input_yuv_v_tex[j][i]));
+                _input_yuv_v_tex[j][i] = 0;
+            }
+            if (_input_bgra32_tex[j][i] != 0) {
+                glDeleteTextures(1, &(_input_bgra32_tex[j][i]));
+                _input_bgra32_tex[j][i] = 0;
+            }
         }
     }
     _input_yuv_chroma_width_divisor = 0;
     _input_yuv_chroma_height_divisor = 0;
     _input_last_frame = video_frame();
+    input_surfaces_deinit();
     xglCheckError(HERE);
 }
 
-bool video_output::input_is_compatible(const video_frame &current_frame)
+bool video_output::supports_surface(video_frame::surface_type_t type) const
 {
-    return (_input_last_frame.width == current_frame.width
-            && _input_last_frame.height == current_frame.height
-            && _input_last_frame.layout == current_frame.layout
-            && _input_last_frame.color_space == current_frame.color_space
-            && _input_last_frame.value_range == current_frame.value_range
-            && _input_last_frame.chroma_location == current_frame.chroma_location
-            && _input_last_frame.stereo_layout == current_frame.stereo_layout);
+    return (type == video_frame::no_surface
+            || (type == video_frame::vdpau_surface && _input_supports_vdpau_surfaces));
 }
 
-void video_output::subtitle_init(int index)
+/* Hardware surfaces are used directly as input textures, without going through
+ * system memory. For VDPAU, the GL_NV_vdpau_interop extension registers each
+ * output surface once and then maps it for the duration of the color
+ * conversion step. The media object rotates through a small fixed set of
+ * output surfaces, so the registrations are cached until the next input_deinit(). */
+void video_output::input_map_surfaces(const video_frame &frame, GLuint tex[2])
 {
-    if (_subtitle_tex[index] == 0) {
-        glGenTextures(1, &_subtitle_tex[index]);
-        glBindTexture(GL_TEXTURE_2D, _subtitle_tex[index]);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        xglCheckError(HERE);
+#if HAVE_LIBVDPAU
+    assert(frame.surface_type == video_frame::vdpau_surface);
+    if (_input_vdpau_device != frame.surface_device[0]) {
+        input_surfaces_deinit();
+        glVDPAUInitNV(frame.surface_device[0], frame.surface_device[1]);
+        _input_vdpau_device = frame.surface_device[0];
+    }
+    int views = (frame.stereo_layout == parameters::layout_separate
+            || frame.stereo_layout == parameters::layout_alternating ? 2 : 1);
+    for (int i = 0; i < views; i++) {
+        size_t j = 0;
+        while (j < _input_vdpau_surfaces.size() && _input_vdpau_surfaces[j] != frame.surface[i])
+            j++;
+        if (j == _input_vdpau_surfaces.size()) {
+            GLuint t;
+            glGenTextures(1, &t);
+            GLvdpauSurfaceNV s = glVDPAURegisterOutputSurfaceNV(
+                    reinterpret_cast<void *>(frame.surface[i]), GL_TEXTURE_2D, 1, &t);
+            glVDPAUSurfaceAccessNV(s, GL_READ_ONLY);
+            glBindTexture(GL_TEXTURE_2D, t);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            _input_vdpau_surfaces.push_back(frame.surface[i]);
+            _input_vdpau_gl_surfaces.push_back(s);
+            _input_vdpau_tex.push_back(t);
+        }
+        _input_vdpau_mapped[i] = _input_vdpau_gl_surfaces[j];
+        tex[i] = _input_vdpau_tex[j];
     }
+    if (views == 1) {
+        tex[1] = tex[0];
+    } else if (_input_vdpau_mapped[1] == _input_vdpau_mapped[0]) {
+        // The same surface is used for both views (e.g. at the end of the video).
+        views = 1;
+    }
+    glVDPAUMapSurfacesNV(views, _input_vdpau_mapped);
+    assert(xglCheckError(HERE));
+#else
+    (void)frame;
+    (void)tex;
+    assert(false);
+#endif
 }
 
-void video_output::subtitle_deinit(int index)
+void video_output::input_unmap_surfaces(const video_frame &frame)
 {
-    if (_subtitle_tex[index] != 0) {
-        glDeleteTextures(1, _subtitle_tex + index);
-        _subtitle_tex[index] = 0;
-        _subtitle_tex_current[index] = false;
-        _subtitle[index] = subtitle_box();
+#if HAVE_LIBVDPAU
+    int views = (frame.stereo_layout == parameters::layout_separate
+            || frame.stereo_layout == parameters::layout_alternating ? 2 : 1);
+    if (views == 2 && _input_vdpau_mapped[1] == _input_vdpau_mapped[0])
+        views = 1;
+    glVDPAUUnmapSurfacesNV(views, _input_vdpau_mapped);
+    _input_vdpau_mapped[0] = 0;
+    _input_vdpau_mapped[1] = 0;
+#else
+    (void)frame;
+#endif
+}
+
+void video_output::input_surfaces_deinit()
+{
+#if HAVE_LIBVDPAU
+    if (_input_vdpau_device) {
+        for (size_t i = 0; i < _input_vdpau_gl_surfaces.size(); i++) {
+            glVDPAUUnregisterSurfaceNV(_input_vdpau_gl_surfaces[i]);
+            glDeleteTextures(1, &(_input_vdpau_tex[i]));
+        }
+        glVDPAUFiniNV();
+        _input_vdpau_device = NULL;
     }
-    _subtitle_updater->reset();
+    _input_vdpau_surfaces.clear();
+    _input_vdpau_gl_surfaces.clear();
+    _input_vdpau_tex.clear();
+#endif
 }
 
-void video_output::color_init(int index, const parameters& params, const video_frame &frame)
+/* Binds the input textures of the given view of frame [index]. The y (or bgra32)
+ * texture uses texture unit 0 and the u (or u/v) texture uses unit 1. The v
+ * texture uses unit 4, because units 2 and 3 are taken by the subtitle and mask
+ * textures when the render step reads the input textures directly. */
+bool video_output::input_tex_array(const video_frame &frame) const
 {
-    xglCheckError(HERE);
-    glGenFramebuffersEXT(1, &_color_fbo);
-    std::string quality_str;
-    std::string layout_str;
-    std::string color_space_str;
-    std::string value_range_str;
-    std::string storage_str;
-    std::string chroma_offset_x_str;
-    std::string chroma_offset_y_str;
-    quality_str = str::from(params.quality());
-    if (frame.layout == video_frame::bgra32) {
-        layout_str = "layout_bgra32";
-        color_space_str = "color_space_srgb";
-        value_range_str = "value_range_8bit_full";
-        storage_str = "storage_srgb";
-    } else {
-        layout_str = "layout_yuv_p";
+    return (frame.stereo_layout != parameters::layout_mono
+            && frame.surface_type == video_frame::no_surface
+            && !input_tex_packed(frame)
+            && GLEW_EXT_texture_array);
+}
+
+/* The side-by-side and top-bottom layouts are uploaded as they are, instead of
+ * extracting the views on the CPU or with strided uploads. This is not done
+ * for the even-odd-rows layout: there, the interpolation of subsampled chroma
+ * and the linear filtering of the render step would mix the interleaved rows
+ * of both views. For that layout, the rows of the views are picked out by the
+ * GL during the upload instead (see prepare_next_frame()). */
+bool video_output::input_tex_packed(const video_frame &frame) const
+{
+    // The views must split all planes at texel boundaries, including subsampled chroma planes.
+    int align_w = (frame.layout == video_frame::bgra32 || frame.layout == video_frame::yuv444p ? 2 : 4);
+    int align_h = (frame.layout == video_frame::yuv420p || frame.layout == video_frame::yuv420sp ? 4 : 2);
+    return (frame.surface_type == video_frame::no_surface
+            && (((frame.stereo_layout == parameters::layout_left_right
+                        || frame.stereo_layout == parameters::layout_left_right_half)
+                    && frame.raw_width % align_w == 0)
+                || ((frame.stereo_layout == parameters::layout_top_bottom
+                        || frame.stereo_layout == parameters::layout_top_bottom_half)
+                    && frame.raw_height % align_h == 0)));
+}
+
+void video_output::input_set_packed_view(const video_frame &frame, int view, const GLint loc[4]) const
+{
+    if (frame.stereo_layout_swap)
+        view = (view == 0 ? 1 : 0);
+    bool left_right = (frame.stereo_layout == parameters::layout_left_right
+            || frame.stereo_layout == parameters::layout_left_right_half);
+    for (int chroma = 0; chroma < 2; chroma++) {
+        float w = frame.raw_width;
+        float h = frame.raw_height;
+        if (chroma && frame.layout != video_frame::bgra32) {
+            w /= _input_yuv_chroma_width_divisor;
+            h /= _input_yuv_chroma_height_divisor;
+        }
+        float transform[4] = { 1.0f, 1.0f, 0.0f, 0.0f };
+        float bounds[4] = { 0.5f / w, 0.5f / h, 1.0f - 0.5f / w, 1.0f - 0.5f / h };
+        if (left_right) {
+            transform[0] = 0.5f;
+            transform[2] = view * 0.5f;
+            bounds[0] = transform[2] + 0.5f / w;
+            bounds[2] = transform[2] + 0.5f - 0.5f / w;
+        } else {
+            transform[1] = 0.5f;
+            transform[3] = view * 0.5f;
+            bounds[1] = transform[3] + 0.5f / h;
+            bounds[3] = transform[3] + 0.5f - 0.5f / h;
+        }
+        glUniform4fv(loc[2 * chroma], 1, transform);
+        glUniform4fv(loc[2 * chroma + 1], 1, bounds);
+    }
+}
+
+std::string video_output::input_shader_extensions(const video_frame &frame) const
+{
+    return (input_tex_array(frame) ? "#extension GL_EXT_texture_array : require" : "");
+}
+
+void video_output::input_bind_textures(int index, int view)
+{
+    // With array or packed textures, the shader selects the view via the layer
+    // or the texture coordinates
+    GLenum target = GL_TEXTURE_2D;
+    if (input_tex_array(_frame[index])) {
+        target = GL_TEXTURE_2D_ARRAY_EXT;
+        view = 0;
+    } else if (input_tex_packed(_frame[index])) {
+        view = 0;
+    }
+    if (_frame[index].layout == video_frame::bgra32) {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(target, _input_bgra32_tex[index][view]);
+    } else {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(target, _input_yuv_y_tex[index][view]);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(target, _input_yuv_u_tex[index][view]);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(target, _input_yuv_v_tex[index][view]);
+    }
+}
+
+void video_output::input_bind_prev_texture(int index, int view)
+{
+    // Only the luma is needed to detect motion
+    GLenum target = GL_TEXTURE_2D;
+    if (input_tex_array(_frame[index])) {
+        target = GL_TEXTURE_2D_ARRAY_EXT;
+        view = 0;
+    } else if (input_tex_packed(_frame[index])) {
+        view = 0;
+    }
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(target, _frame[index].layout == video_frame::bgra32
+            ? _input_bgra32_tex[index][view] : _input_yuv_y_tex[index][view]);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+bool video_output::input_is_compatible(const video_frame &current_frame)
+{
+    return (_input_last_frame.width == current_frame.width
+            && _input_last_frame.height == current_frame.height
+            && _input_last_frame.layout == current_frame.layout
+            && _input_last_frame.color_space == current_frame.color_space
+            && _input_last_frame.value_range == current_frame.value_range
+            && _input_last_frame.chroma_location == current_frame.chroma_location
+            && _input_last_frame.stereo_layout == current_frame.stereo_layout
+            && _input_last_frame.surface_type == current_frame.surface_type);
+}
+
+void video_output::subtitle_init(int index)
+{
+    if (_subtitle_tex[index] == 0) {
+        glGenTextures(1, &_subtitle_tex[index]);
+        glBindTexture(GL_TEXTURE_2D, _subtitle_tex[index]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        xglCheckError(HERE);
+    }
+}
+
+void video_output::subtitle_deinit(int index)
+{
+    if (_subtitle_tex[index] != 0) {
+        glDeleteTextures(1, _subtitle_tex + index);
+        _subtitle_tex[index] = 0;
+        _subtitle_tex_current[index] = false;
+        _subtitle_tex_bytes[index] = 0;
+        _subtitle[index] = subtitle_box();
+    }
+    _subtitle_updater->wait();
+    _subtitle_updater->reset();
+}
+
+/* Returns the source of the color conversion shader for the given frame format.
+ * If fused is true, the source contains only the conversion functions, for
+ * insertion into the render shader; the result is then always sRGB data with
+ * quality 0 and linear RGB data otherwise, since there is no texture that
+ * could linearize the data. */
+/* At quality 4, the exact sRGB transfer functions are used. Evaluating them
+ * costs a branch and a pow() for each color channel of each pixel, so both
+ * are precomputed once in 1D textures with 16 bit precision; linear
+ * interpolation between the entries keeps the error far below what the 8 bit
+ * output can show. Values outside [0,1] are clamped, as the framebuffer and
+ * the color textures would do anyway. */
+static const int transfer_lut_size = 4096;
+
+void video_output::transfer_lut_bind(bool to_srgb)
+{
+    glActiveTexture(GL_TEXTURE5);
+    GLuint &tex = _transfer_lut_tex[to_srgb ? 1 : 0];
+    if (tex == 0) {
+        std::vector<GLushort> table(transfer_lut_size);
+        for (int i = 0; i < transfer_lut_size; i++) {
+            // See GL_ARB_framebuffer_sRGB extension
+            double x = i / static_cast<double>(transfer_lut_size - 1);
+            double y = (to_srgb
+                    ? (x <= 0.0031308 ? x * 12.92 : 1.055 * std::pow(x, 1.0 / 2.4) - 0.055)
+                    : (x <= 0.04045 ? x / 12.92 : std::pow((x + 0.055) / 1.055, 2.4)));
+            table[i] = static_cast<GLushort>(std::min(std::max(y, 0.0), 1.0) * 65535.0 + 0.5);
+        }
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_1D, tex);
+        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage1D(GL_TEXTURE_1D, 0, GL_LUMINANCE16, transfer_lut_size, 0,
+                GL_LUMINANCE, GL_UNSIGNED_SHORT, &(table[0]));
+    } else {
+        glBindTexture(GL_TEXTURE_1D, tex);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+std::string video_output::color_shader_src(int quality, parameters::deinterlacing_t deinterlacing,
+        const video_frame &frame, bool fused, std::string *storage)
+{
+    std::string quality_str;
+    std::string layout_str;
+    std::string color_space_str;
+    std::string value_range_str;
+    std::string storage_str;
+    std::string chroma_offset_x_str;
+    std::string chroma_offset_y_str;
+    quality_str = str::from(quality);
+    if (frame.layout == video_frame::bgra32) {
+        layout_str = "layout_bgra32";
+        color_space_str = "color_space_srgb";
+        value_range_str = "value_range_8bit_full";
+        storage_str = "storage_srgb";
+    } else {
+        layout_str = (frame.layout == video_frame::yuv420sp ? "layout_yuv_sp" : "layout_yuv_p");
         if (frame.color_space == video_frame::yuv709) {
             color_space_str = "color_space_yuv709";
         } else {
@@ -803,9 +1843,21 @@ void video_output::color_init(int index, const parameters& params, const video_f
         } else if (frame.value_range == video_frame::u10_full) {
             value_range_str = "value_range_10bit_full";
             storage_str = "storage_linear_rgb";
-        } else {
+        } else if (frame.value_range == video_frame::u10_mpeg) {
             value_range_str = "value_range_10bit_mpeg";
             storage_str = "storage_linear_rgb";
+        } else if (frame.value_range == video_frame::u12_full) {
+            value_range_str = "value_range_12bit_full";
+            storage_str = "storage_linear_rgb";
+        } else if (frame.value_range == video_frame::u12_mpeg) {
+            value_range_str = "value_range_12bit_mpeg";
+            storage_str = "storage_linear_rgb";
+        } else if (frame.value_range == video_frame::u16_full) {
+            value_range_str = "value_range_16bit_full";
+            storage_str = "storage_linear_rgb";
+        } else {
+            value_range_str = "value_range_16bit_mpeg";
+            storage_str = "storage_linear_rgb";
         }
         chroma_offset_x_str = "0.0";
         chroma_offset_y_str = "0.0";
@@ -819,7 +1871,7 @@ void video_output::color_init(int index, const parameters& params, const video_f
                 chroma_offset_y_str = str::from(0.5f / static_cast<float>(frame.height
                             / _input_yuv_chroma_height_divisor));
             }
-        } else if (frame.layout == video_frame::yuv420p) {
+        } else if (frame.layout == video_frame::yuv420p || frame.layout == video_frame::yuv420sp) {
             if (frame.chroma_location == video_frame::left) {
                 chroma_offset_x_str = str::from(0.5f / static_cast<float>(frame.width
                             / _input_yuv_chroma_width_divisor));
@@ -831,8 +1883,10 @@ void video_output::color_init(int index, const parameters& params, const video_f
             }
         }
     }
-    if (params.quality() == 0) {
+    if (quality == 0) {
         storage_str = "storage_srgb";   // SRGB data in GL_RGB8 texture.
+    } else if (fused) {
+        storage_str = "storage_linear_rgb";
     } else if (storage_str == "storage_srgb"
             && (!glewIsSupported("GL_EXT_texture_sRGB")
                 || std::getenv("SRGB_TEXTURES_ARE_BROKEN") // XXX: Hack: work around broken SRGB texture implementations
@@ -848,19 +1902,64 @@ void video_output::color_init(int index, const parameters& params, const video_f
     color_fs_src = str::replace(color_fs_src, "$chroma_offset_x", chroma_offset_x_str);
     color_fs_src = str::replace(color_fs_src, "$chroma_offset_y", chroma_offset_y_str);
     color_fs_src = str::replace(color_fs_src, "$storage", storage_str);
-    _color_prg[index] = xglCreateProgram("video_output_color", "", color_fs_src);
-    xglLinkProgram("video_output_color", _color_prg[index]);
+    color_fs_src = str::replace(color_fs_src, "$transfer_lut_size", str::from(transfer_lut_size) + ".0");
+    color_fs_src = str::replace(color_fs_src, "$deinterlace",
+            deinterlacing == parameters::deinterlace_adaptive ? "deinterlace_adaptive"
+            : deinterlacing == parameters::deinterlace_bob ? "deinterlace_bob" : "deinterlace_off");
+    color_fs_src = str::replace(color_fs_src, "$view_height", str::from(frame.height) + ".0");
+    color_fs_src = str::replace(color_fs_src, "$input_tex",
+            input_tex_packed(frame) ? "input_tex_packed"
+            : input_tex_array(frame) ? "input_tex_array" : "input_tex_2d");
+    if (fused) {
+        // The render shader provides these
+        color_fs_src = str::replace(color_fs_src, "#version 110", "");
+        color_fs_src = str::replace(color_fs_src, "$extensions", "");
+        color_fs_src = str::replace(color_fs_src, "#define quality " + quality_str, "");
+    } else {
+        color_fs_src = str::replace(color_fs_src, "$extensions", input_shader_extensions(frame));
+    }
+    color_fs_src = str::replace(color_fs_src, "$pass", fused ? "pass_render" : "pass_color");
+    *storage = storage_str;
+    return color_fs_src;
+}
+
+void video_output::color_init(int index, const parameters& params, const video_frame &frame)
+{
+    xglCheckError(HERE);
+    if (_color_fbo == 0)
+        glGenFramebuffersEXT(1, &_color_fbo);
+    std::string storage_str;
+    std::string color_fs_src = color_shader_src(params.quality(), color_deinterlacing(params, frame),
+            frame, false, &storage_str);
+    _color_prg[index] = xglGetProgram("video_output_color", VIDEO_OUTPUT_COLOR_VS_GLSL_STR, color_fs_src);
+    glUseProgram(_color_prg[index]);
+    if (frame.layout == video_frame::bgra32) {
+        glUniform1i(glGetUniformLocation(_color_prg[index], "srgb_tex"), 0);
+    } else {
+        glUniform1i(glGetUniformLocation(_color_prg[index], "y_tex"), 0);
+        glUniform1i(glGetUniformLocation(_color_prg[index], "u_tex"), 1);
+        glUniform1i(glGetUniformLocation(_color_prg[index], "v_tex"), 4);
+        glUniform1i(glGetUniformLocation(_color_prg[index], "uv_tex"), 1);
+    }
+    glUniform1i(glGetUniformLocation(_color_prg[index], "to_linear_lut"), 5);
+    glUniform1i(glGetUniformLocation(_color_prg[index], "prev_tex"), 6);
+    _color_loc_deinterlace[index][0] = glGetUniformLocation(_color_prg[index], "field_parity");
+    _color_loc_deinterlace[index][1] = glGetUniformLocation(_color_prg[index], "have_prev");
+    _color_loc_input_layer[index] = glGetUniformLocation(_color_prg[index], "input_layer");
+    _color_loc_packed_view[index][0] = glGetUniformLocation(_color_prg[index], "view_transform");
+    _color_loc_packed_view[index][1] = glGetUniformLocation(_color_prg[index], "view_bounds");
+    _color_loc_packed_view[index][2] = glGetUniformLocation(_color_prg[index], "chroma_view_transform");
+    _color_loc_packed_view[index][3] = glGetUniformLocation(_color_prg[index], "chroma_view_bounds");
+    glUseProgram(0);
+    _color_tex_format[index] = (params.quality() == 0 ? GL_RGB
+            : storage_str == "storage_srgb" ? GL_SRGB8 : GL_RGB16);
     for (int i = 0; i < (frame.stereo_layout == parameters::layout_mono ? 1 : 2); i++) {
-        glGenTextures(1, &(_color_tex[index][i]));
-        glBindTexture(GL_TEXTURE_2D, _color_tex[index][i]);
+        _color_tex[index][i] = tex_pool_get(_color_tex_format[index], frame.width, frame.height);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-        glTexImage2D(GL_TEXTURE_2D, 0,
-                params.quality() == 0 ? GL_RGB
-                : storage_str == "storage_srgb" ? GL_SRGB8 : GL_RGB16,
-                frame.width, frame.height, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+        _color_tex_bytes[index] += tex_bytes(_color_tex_format[index], frame.width, frame.height);
     }
     xglCheckError(HERE);
     _color_last_params[index] = params;
@@ -870,18 +1969,15 @@ void video_output::color_init(int index, const parameters& params, const video_f
 void video_output::color_deinit(int index)
 {
     xglCheckError(HERE);
-    glDeleteFramebuffersEXT(1, &_color_fbo);
-    _color_fbo = 0;
-    if (_color_prg[index] != 0) {
-        xglDeleteProgram(_color_prg[index]);
-        _color_prg[index] = 0;
-    }
+    _color_prg[index] = 0;     // owned by the program cache
     for (int i = 0; i < 2; i++) {
         if (_color_tex[index][i] != 0) {
-            glDeleteTextures(1, &(_color_tex[index][i]));
+            tex_pool_put(_color_tex[index][i], _color_tex_format[index],
+                    _color_last_frame[index].width, _color_last_frame[index].height);
             _color_tex[index][i] = 0;
         }
     }
+    _color_tex_bytes[index] = 0;
     _color_last_params[index] = parameters();
     _color_last_frame[index] = video_frame();
     xglCheckError(HERE);
@@ -896,7 +1992,22 @@ bool video_output::color_is_compatible(int index, const parameters& params, cons
             && _color_last_frame[index].color_space == current_frame.color_space
             && _color_last_frame[index].value_range == current_frame.value_range
             && _color_last_frame[index].chroma_location == current_frame.chroma_location
-            && _color_last_frame[index].stereo_layout == current_frame.stereo_layout);
+            && _color_last_frame[index].stereo_layout == current_frame.stereo_layout
+            && _color_last_frame[index].surface_type == current_frame.surface_type
+            && color_deinterlacing(_color_last_params[index], _color_last_frame[index])
+            == color_deinterlacing(params, current_frame));
+}
+
+parameters::deinterlacing_t video_output::color_deinterlacing(const parameters& params, const video_frame &frame) const
+{
+    // In the even-odd-rows layout, the fields are the views. Hardware surfaces
+    // have their own texture coordinates, and the VDPAU video mixer could
+    // deinterlace them anyway.
+    if (frame.field_order == video_frame::progressive
+            || frame.stereo_layout == parameters::layout_even_odd_rows
+            || frame.surface_type != video_frame::no_surface)
+        return parameters::deinterlace_off;
+    return params.deinterlacing();
 }
 
 void video_output::render_init()
@@ -925,37 +2036,86 @@ void video_output::render_init()
     std::string subtitle_str = (render_needs_subtitle(_render_params) ? "subtitle_enabled" : "subtitle_disabled");
     std::string coloradjust_str = (render_needs_coloradjust(_render_params) ? "coloradjust_enabled" : "coloradjust_disabled");
     std::string ghostbust_str = (render_needs_ghostbust(_render_params) ? "ghostbust_enabled" : "ghostbust_disabled");
+    bool fused = _render_fused[_active_index];
+    std::string input_str = (fused ? "input_fused" : "input_rgb");
+    std::string color_functions_str;
+    if (fused) {
+        std::string storage_str;
+        color_functions_str = color_shader_src(_render_params.quality(), parameters::deinterlace_off,
+                _frame[_active_index], true, &storage_str);
+    }
     std::string render_fs_src(VIDEO_OUTPUT_RENDER_FS_GLSL_STR);
+    render_fs_src = str::replace(render_fs_src, "$extensions",
+            fused ? input_shader_extensions(_frame[_active_index]) : "");
     render_fs_src = str::replace(render_fs_src, "$quality", quality_str);
     render_fs_src = str::replace(render_fs_src, "$mode", mode_str);
     render_fs_src = str::replace(render_fs_src, "$subtitle", subtitle_str);
     render_fs_src = str::replace(render_fs_src, "$coloradjust", coloradjust_str);
     render_fs_src = str::replace(render_fs_src, "$ghostbust", ghostbust_str);
-    _render_prg = xglCreateProgram("video_output_render", "", render_fs_src);
-    xglLinkProgram("video_output_render", _render_prg);
-    uint32_t dummy_texture = 0;
-    glGenTextures(1, &_render_dummy_tex);
-    glBindTexture(GL_TEXTURE_2D, _render_dummy_tex);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0,
-            GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, &dummy_texture);
+    render_fs_src = str::replace(render_fs_src, "$input", input_str);
+    render_fs_src = str::replace(render_fs_src, "$color_functions", color_functions_str);
+    render_fs_src = str::replace(render_fs_src, "$transfer_lut_size", str::from(transfer_lut_size) + ".0");
+    _render_prg = xglGetProgram("video_output_render", VIDEO_OUTPUT_RENDER_VS_GLSL_STR, render_fs_src);
+    glUseProgram(_render_prg);
+    if (!fused) {
+        glUniform1i(glGetUniformLocation(_render_prg, "rgb_l"), 0);
+        glUniform1i(glGetUniformLocation(_render_prg, "rgb_r"), 1);
+    } else if (_frame[_active_index].layout == video_frame::bgra32) {
+        // The input textures are bound for each view by render_set_channel()
+        glUniform1i(glGetUniformLocation(_render_prg, "srgb_tex"), 0);
+    } else {
+        glUniform1i(glGetUniformLocation(_render_prg, "y_tex"), 0);
+        glUniform1i(glGetUniformLocation(_render_prg, "u_tex"), 1);
+        glUniform1i(glGetUniformLocation(_render_prg, "v_tex"), 4);
+        glUniform1i(glGetUniformLocation(_render_prg, "uv_tex"), 1);
+    }
+    glUniform1i(glGetUniformLocation(_render_prg, "subtitle"), 2);
+    glUniform1i(glGetUniformLocation(_render_prg, "mask_tex"), 3);
+    glUniform1i(glGetUniformLocation(_render_prg, "to_srgb_lut"), 5);
+    glUseProgram(0);
+    _render_loc_parallax = glGetUniformLocation(_render_prg, "parallax");
+    _render_loc_vertical_shift_left = glGetUniformLocation(_render_prg, "vertical_shift_left");
+    _render_loc_vertical_shift_right = glGetUniformLocation(_render_prg, "vertical_shift_right");
+    _render_loc_subtitle_parallax = glGetUniformLocation(_render_prg, "subtitle_parallax");
+    _render_loc_color_matrix = glGetUniformLocation(_render_prg, "color_matrix");
+    _render_loc_crosstalk = glGetUniformLocation(_render_prg, "crosstalk");
+    _render_loc_step_x = glGetUniformLocation(_render_prg, "step_x");
+    _render_loc_step_y = glGetUniformLocation(_render_prg, "step_y");
+    _render_loc_channel = glGetUniformLocation(_render_prg, "channel");
+    _render_loc_input_layer = glGetUniformLocation(_render_prg, "input_layer");
+    _render_loc_packed_view[0] = glGetUniformLocation(_render_prg, "view_transform");
+    _render_loc_packed_view[1] = glGetUniformLocation(_render_prg, "view_bounds");
+    _render_loc_packed_view[2] = glGetUniformLocation(_render_prg, "chroma_view_transform");
+    _render_loc_packed_view[3] = glGetUniformLocation(_render_prg, "chroma_view_bounds");
+    // The dummy and mask textures are kept until deinit().
+    if (_render_dummy_tex == 0) {
+        uint32_t dummy_texture = 0;
+        glGenTextures(1, &_render_dummy_tex);
+        glBindTexture(GL_TEXTURE_2D, _render_dummy_tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0,
+                GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, &dummy_texture);
+    }
     if (_render_params.stereo_mode() == parameters::mode_even_odd_rows
             || _render_params.stereo_mode() == parameters::mode_even_odd_columns
             || _render_params.stereo_mode() == parameters::mode_checkerboard) {
         GLubyte even_odd_rows_mask[4] = { 0xff, 0xff, 0x00, 0x00 };
         GLubyte even_odd_columns_mask[4] = { 0xff, 0x00, 0xff, 0x00 };
         GLubyte checkerboard_mask[4] = { 0xff, 0x00, 0x00, 0xff };
-        glGenTextures(1, &_render_mask_tex);
+        if (_render_mask_tex == 0) {
+            glGenTextures(1, &_render_mask_tex);
+            glBindTexture(GL_TEXTURE_2D, _render_mask_tex);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        }
         glBindTexture(GL_TEXTURE_2D, _render_mask_tex);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
         glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE8, 2, 2, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE,
@@ -963,26 +2123,19 @@ void video_output::render_init()
                 : _render_params.stereo_mode() == parameters::mode_even_odd_columns ? even_odd_columns_mask
                 : checkerboard_mask);
     }
+    _render_last_fused = fused;
     xglCheckError(HERE);
 }
 
 void video_output::render_deinit()
 {
     xglCheckError(HERE);
-    if (_render_prg != 0) {
-        xglDeleteProgram(_render_prg);
-        _render_prg = 0;
-    }
-    if (_render_dummy_tex != 0) {
-        glDeleteTextures(1, &_render_dummy_tex);
-        _render_dummy_tex = 0;
-    }
-    if (_render_mask_tex != 0) {
-        glDeleteTextures(1, &_render_mask_tex);
-        _render_mask_tex = 0;
-    }
+    _render_prg = 0;            // owned by the program cache
     _render_last_params = parameters();
     _render_last_frame = video_frame();
+    _render_last_fused = false;
+    _render_cache_valid[0] = false;
+    _render_cache_valid[1] = false;
     xglCheckError(HERE);
 }
 
@@ -1004,13 +2157,69 @@ bool video_output::render_needs_ghostbust(const parameters& params)
     return params.ghostbust() > 0.0f;
 }
 
+bool video_output::render_needs_3d_ready_sync(const parameters& params)
+{
+    return (params.fullscreen() && params.fullscreen_3d_ready_sync()
+            && (params.stereo_mode() == parameters::mode_left_right
+                || params.stereo_mode() == parameters::mode_left_right_half
+                || params.stereo_mode() == parameters::mode_top_bottom
+                || params.stereo_mode() == parameters::mode_top_bottom_half
+                || params.stereo_mode() == parameters::mode_alternating));
+}
+
 bool video_output::render_is_compatible()
 {
     return (_render_last_params.quality() == _render_params.quality()
             && _render_last_params.stereo_mode() == _render_params.stereo_mode()
             && render_needs_subtitle(_render_last_params) == render_needs_subtitle(_render_params)
             && render_needs_coloradjust(_render_last_params) == render_needs_coloradjust(_render_params)
-            && render_needs_ghostbust(_render_last_params) == render_needs_ghostbust(_render_params));
+            && render_needs_ghostbust(_render_last_params) == render_needs_ghostbust(_render_params)
+            && _render_last_fused == _render_fused[_active_index]
+            && (!_render_last_fused
+                || (_render_last_frame.width == _frame[_active_index].width
+                    && _render_last_frame.height == _frame[_active_index].height
+                    && _render_last_frame.layout == _frame[_active_index].layout
+                    && _render_last_frame.color_space == _frame[_active_index].color_space
+                    && _render_last_frame.value_range == _frame[_active_index].value_range
+                    && _render_last_frame.chroma_location == _frame[_active_index].chroma_location
+                    && _render_last_frame.stereo_layout == _frame[_active_index].stereo_layout)));
+}
+
+/* The render step can read the input textures directly and skip the color
+ * conversion step if it draws only one view at a time: this is the case
+ * for the output modes that show a single view per draw call without
+ * ghostbusting. The color conversion then happens after filtering instead
+ * of before, which is only acceptable below the highest quality setting.
+ * Hardware surfaces always go through the color conversion step. */
+bool video_output::render_can_fuse(const parameters& params, const video_frame &frame)
+{
+    return (frame.surface_type == video_frame::no_surface
+            && params.quality() < 4
+            && color_deinterlacing(params, frame) == parameters::deinterlace_off
+            && !render_needs_ghostbust(params)
+            && (params.stereo_mode() == parameters::mode_stereo
+                || params.stereo_mode() == parameters::mode_mono_left
+                || params.stereo_mode() == parameters::mode_mono_right
+                || params.stereo_mode() == parameters::mode_alternating
+                || params.stereo_mode() == parameters::mode_left_right
+                || params.stereo_mode() == parameters::mode_left_right_half
+                || params.stereo_mode() == parameters::mode_top_bottom
+                || params.stereo_mode() == parameters::mode_top_bottom_half
+                || params.stereo_mode() == parameters::mode_hdmi_frame_pack));
+}
+
+void video_output::render_set_channel(int channel, int left, int right)
+{
+    glUniform1f(_render_loc_channel, channel);
+    if (_render_fused[_active_index]) {
+        int view = (channel == 0 ? left : right);
+        if (input_tex_packed(_frame[_active_index]))
+            input_set_packed_view(_frame[_active_index], view, _render_loc_packed_view);
+        else if (input_tex_array(_frame[_active_index]))
+            glUniform1f(_render_loc_input_layer, view);
+        else
+            input_bind_textures(_active_index, view);
+    }
 }
 
 int video_output::full_display_width() const
@@ -1058,15 +2267,44 @@ void video_output::reshape(int w, int h, const parameters& params)
     _full_viewport[3] = h;
     glViewport(0, 0, w, h);
     clear();
-    _viewport[0][0] = 0;
-    _viewport[0][1] = 0;
-    _viewport[0][2] = w;
-    _viewport[0][3] = h;
-    _viewport[1][0] = 0;
-    _viewport[1][1] = 0;
-    _viewport[1][2] = w;
-    _viewport[1][3] = h;
-    std::memcpy(_tex_coords, full_tex_coords, sizeof(_tex_coords));
+    if (_display_span[2] > 0 && _display_span[3] > 0) {
+        // Lay out the views for the whole display area and move our part of it
+        // into our viewport. The span offset counts from the top, GL from the bottom.
+        compute_layout(_display_span[2], _display_span[3], params, _viewport, _tex_coords);
+        for (int i = 0; i < 2; i++) {
+            _viewport[i][0] -= _display_span[0];
+            _viewport[i][1] -= _display_span[3] - _display_span[1] - h;
+        }
+    } else {
+        compute_layout(w, h, params, _viewport, _tex_coords);
+    }
+    _reshape_last_params = params;
+    _reshape_last_frame = _frame[_active_index];
+}
+
+void video_output::set_display_span(int x, int y, int span_w, int span_h)
+{
+    _display_span[0] = x;
+    _display_span[1] = y;
+    _display_span[2] = span_w;
+    _display_span[3] = span_h;
+    // Force a reshape before the next frame is displayed
+    _full_viewport[2] = -1;
+    _full_viewport[3] = -1;
+}
+
+void video_output::compute_layout(int w, int h, const parameters& params,
+        GLint viewport[2][4], float tex_coords[2][4][2]) const
+{
+    viewport[0][0] = 0;
+    viewport[0][1] = 0;
+    viewport[0][2] = w;
+    viewport[0][3] = h;
+    viewport[1][0] = 0;
+    viewport[1][1] = 0;
+    viewport[1][2] = w;
+    viewport[1][3] = h;
+    std::memcpy(tex_coords, full_tex_coords, sizeof(full_tex_coords));
     if (!_frame[_active_index].is_valid())
         return;
 
@@ -1091,12 +2329,12 @@ void video_output::reshape(int w, int h, const parameters& params)
         }
         if (params.source_aspect_ratio_is_set() && params.source_aspect_ratio() > 0.0f)
             src_ar = params.source_aspect_ratio();
-        compute_viewport_and_tex_coords(_viewport[0], _tex_coords[0], src_ar,
+        compute_viewport_and_tex_coords(viewport[0], tex_coords[0], src_ar,
                 w / 2, h, dst_w, dst_h, dst_ar,
                 crop_ar, params.zoom(), need_even_width, need_even_height);
-        std::memcpy(_viewport[1], _viewport[0], sizeof(_viewport[1]));
-        _viewport[1][0] = _viewport[0][0] + w / 2;
-        std::memcpy(_tex_coords[1], _tex_coords[0], sizeof(_tex_coords[1]));
+        std::memcpy(viewport[1], viewport[0], sizeof(viewport[1]));
+        viewport[1][0] = viewport[0][0] + w / 2;
+        std::memcpy(tex_coords[1], tex_coords[0], sizeof(tex_coords[1]));
     } else if (params.stereo_mode() == parameters::mode_top_bottom
             || params.stereo_mode() == parameters::mode_top_bottom_half) {
         float dst_w = w;
@@ -1110,12 +2348,12 @@ void video_output::reshape(int w, int h, const parameters& params)
         }
         if (params.source_aspect_ratio_is_set() && params.source_aspect_ratio() > 0.0f)
             src_ar = params.source_aspect_ratio();
-        compute_viewport_and_tex_coords(_viewport[0], _tex_coords[0], src_ar,
+        compute_viewport_and_tex_coords(viewport[0], tex_coords[0], src_ar,
                 w, h / 2, dst_w, dst_h, dst_ar,
                 crop_ar, params.zoom(), need_even_width, need_even_height);
-        std::memcpy(_viewport[1], _viewport[0], sizeof(_viewport[1]));
-        _viewport[0][1] = _viewport[1][1] + h / 2;
-        std::memcpy(_tex_coords[1], _tex_coords[0], sizeof(_tex_coords[1]));
+        std::memcpy(viewport[1], viewport[0], sizeof(viewport[1]));
+        viewport[0][1] = viewport[1][1] + h / 2;
+        std::memcpy(tex_coords[1], tex_coords[0], sizeof(tex_coords[1]));
     } else if (params.stereo_mode() == parameters::mode_hdmi_frame_pack) {
         // HDMI frame packing mode has left view top, right view bottom, plus a
         // blank area separating the two. 720p uses 30 blank lines (total: 720
@@ -1131,12 +2369,12 @@ void video_output::reshape(int w, int h, const parameters& params)
         float src_ar = _frame[_active_index].aspect_ratio;
         if (params.source_aspect_ratio_is_set() && params.source_aspect_ratio() > 0.0f)
             src_ar = params.source_aspect_ratio();
-        compute_viewport_and_tex_coords(_viewport[0], _tex_coords[0], src_ar,
+        compute_viewport_and_tex_coords(viewport[0], tex_coords[0], src_ar,
                 w, (h - blank_lines) / 2, dst_w, dst_h, dst_ar,
                 params.crop_aspect_ratio(), params.zoom(), need_even_width, need_even_height);
-        std::memcpy(_viewport[1], _viewport[0], sizeof(_viewport[1]));
-        _viewport[0][1] = _viewport[1][1] + (h - blank_lines) / 2 + blank_lines;
-        std::memcpy(_tex_coords[1], _tex_coords[0], sizeof(_tex_coords[1]));
+        std::memcpy(viewport[1], viewport[0], sizeof(viewport[1]));
+        viewport[0][1] = viewport[1][1] + (h - blank_lines) / 2 + blank_lines;
+        std::memcpy(tex_coords[1], tex_coords[0], sizeof(tex_coords[1]));
     } else {
         float dst_w = w;
         float dst_h = h;
@@ -1144,14 +2382,115 @@ void video_output::reshape(int w, int h, const parameters& params)
         float src_ar = _frame[_active_index].aspect_ratio;
         if (params.source_aspect_ratio_is_set() && params.source_aspect_ratio() > 0.0f)
             src_ar = params.source_aspect_ratio();
-        compute_viewport_and_tex_coords(_viewport[0], _tex_coords[0], src_ar,
+        compute_viewport_and_tex_coords(viewport[0], tex_coords[0], src_ar,
                 w, h, dst_w, dst_h, dst_ar,
                 params.crop_aspect_ratio(), params.zoom(), need_even_width, need_even_height);
-        std::memcpy(_viewport[1], _viewport[0], sizeof(_viewport[1]));
-        std::memcpy(_tex_coords[1], _tex_coords[0], sizeof(_tex_coords[1]));
+        std::memcpy(viewport[1], viewport[0], sizeof(viewport[1]));
+        std::memcpy(tex_coords[1], tex_coords[0], sizeof(tex_coords[1]));
     }
 }
 
+/* In alternating mode and with DLP 3-D Ready Sync, the output is redisplayed
+ * for every output frame, even though the video frame changes much less often
+ * (or not at all in pause mode). The composited output of the render step is
+ * therefore kept in textures, and the redisplays that do not have a new frame
+ * or new parameters only copy it to the window. Alternating mode needs one
+ * texture per view. The 3-D Ready Sync lines change with every output frame
+ * and are drawn on top. Only the window display uses the cache; SDI and file
+ * output and Equalizer render each frame once anyway. */
+bool video_output::render_cache_applies(bool keep_viewport)
+{
+    return (!keep_viewport && _output_fbo == 0 && GLEW_EXT_framebuffer_blit
+            && (_render_params.stereo_mode() == parameters::mode_alternating
+                || render_needs_3d_ready_sync(_render_params)));
+}
+
+void video_output::render_cache_bind(int index, const GLint viewport[2][4], int dst_width, int dst_height)
+{
+    // Drop the cache contents if anything that affects them has changed.
+    // A new frame invalidates the cache in activate_next_frame().
+    if (dst_width != _render_cache_width || dst_height != _render_cache_height
+            || std::memcmp(viewport, _render_cache_viewport, sizeof(_render_cache_viewport)) != 0
+            || _render_params.stereo_mode() != _render_cache_stereo_mode
+            || _render_params_version != _render_cache_params_version) {
+        if (dst_width != _render_cache_width || dst_height != _render_cache_height) {
+            // The textures are only replaced when the size leaves their size
+            // class, so that resizing the window does not reallocate them for
+            // every new size.
+            int tex_width = (dst_width + 127) / 128 * 128;
+            int tex_height = (dst_height + 127) / 128 * 128;
+            if (tex_width != _render_cache_tex_width || tex_height != _render_cache_tex_height) {
+                for (int i = 0; i < 2; i++) {
+                    if (_render_cache_tex[i] != 0) {
+                        tex_pool_put(_render_cache_tex[i], GL_RGBA8,
+                                _render_cache_tex_width, _render_cache_tex_height);
+                        _render_cache_tex[i] = 0;
+                    }
+                }
+                _render_cache_tex_width = tex_width;
+                _render_cache_tex_height = tex_height;
+            }
+            _render_cache_width = dst_width;
+            _render_cache_height = dst_height;
+        }
+        std::memcpy(_render_cache_viewport, viewport, sizeof(_render_cache_viewport));
+        _render_cache_stereo_mode = _render_params.stereo_mode();
+        _render_cache_params_version = _render_params_version;
+        _render_cache_valid[0] = false;
+        _render_cache_valid[1] = false;
+    }
+    if (_render_cache_valid[index])
+        return;
+    if (_render_cache_fbo == 0)
+        glGenFramebuffersEXT(1, &_render_cache_fbo);
+    if (_render_cache_tex[index] == 0) {
+        _render_cache_tex[index] = tex_pool_get(GL_RGBA8, _render_cache_tex_width, _render_cache_tex_height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    // Render into the cache texture
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _render_cache_fbo);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,
+            GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, _render_cache_tex[index], 0);
+    xglCheckFBO(HERE);
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+void video_output::render_cache_blit(int index)
+{
+    glBindFramebufferEXT(GL_READ_FRAMEBUFFER_EXT, _render_cache_fbo);
+    glFramebufferTexture2DEXT(GL_READ_FRAMEBUFFER_EXT,
+            GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, _render_cache_tex[index], 0);
+    glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, _output_fbo);
+    glBlitFramebufferEXT(0, 0, _render_cache_width, _render_cache_height,
+            0, 0, _render_cache_width, _render_cache_height,
+            GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _output_fbo);
+    assert(xglCheckError(HERE));
+}
+
+void video_output::render_cache_deinit()
+{
+    if (_render_cache_fbo != 0) {
+        glDeleteFramebuffersEXT(1, &_render_cache_fbo);
+        _render_cache_fbo = 0;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (_render_cache_tex[i] != 0) {
+            tex_pool_put(_render_cache_tex[i], GL_RGBA8, _render_cache_tex_width, _render_cache_tex_height);
+            _render_cache_tex[i] = 0;
+        }
+        _render_cache_valid[i] = false;
+    }
+    _render_cache_tex_width = -1;
+    _render_cache_tex_height = -1;
+    _render_cache_width = -1;
+    _render_cache_height = -1;
+}
+
 void video_output::display_current_frame(
         int64_t display_frameno,
         bool keep_viewport, bool mono_right_instead_of_left,
@@ -1173,29 +2512,43 @@ void video_output::display_current_frame(
     last_timestamp = timestamp;
     */
 
-    _render_params = dispatch::parameters();
-    // The quality parameter must always be consistent with the color conversion step
-    // so that we avoid a mismatch between SRGB/RGB linearization/delinearization.
-    _render_params.set_quality(_color_last_params[_active_index].quality());
-
+    // Only copy the parameters when a new snapshot was published
+    _params.update();
+    if (_render_params_version != _params.version()) {
+        _render_params = _params.get();
+        _render_params_version = _params.version();
+    }
     _render_params.set_stereo_mode(stereo_mode);
+    _render_params.set_quality(quality_params().quality());
+    if (_render_fused[_active_index] && !render_can_fuse(_render_params, frame)) {
+        // The parameters changed since the frame was prepared (e.g. in pause
+        // mode), or this is the second display of an SDI output. Fall back to
+        // the color conversion step; the input textures still hold this frame.
+        color_convert(_active_index, NULL);
+        _render_fused[_active_index] = false;
+    }
+    if (!_render_fused[_active_index]) {
+        // The quality parameter must always be consistent with the color conversion step
+        // so that we avoid a mismatch between SRGB/RGB linearization/delinearization.
+        _render_params.set_quality(_color_last_params[_active_index].quality());
+    }
     bool context_needs_stereo = (_render_params.stereo_mode() == parameters::mode_stereo);
     if (context_needs_stereo != context_is_stereo()) {
         recreate_context(context_needs_stereo);
         return;
     }
     if (!keep_viewport
-            && (frame.width != _render_last_frame.width
-                || frame.height != _render_last_frame.height
-                || frame.aspect_ratio < _render_last_frame.aspect_ratio
-                || frame.aspect_ratio > _render_last_frame.aspect_ratio
-                || _render_last_params.stereo_mode() != _render_params.stereo_mode()
-                || _render_last_params.crop_aspect_ratio() < _render_params.crop_aspect_ratio()
-                || _render_last_params.crop_aspect_ratio() > _render_params.crop_aspect_ratio()
-                || _render_last_params.source_aspect_ratio() < _render_params.source_aspect_ratio()
-                || _render_last_params.source_aspect_ratio() > _render_params.source_aspect_ratio()
-                || _render_last_params.zoom() < _render_params.zoom()
-                || _render_last_params.zoom() > _render_params.zoom()
+            && (frame.width != _reshape_last_frame.width
+                || frame.height != _reshape_last_frame.height
+                || frame.aspect_ratio < _reshape_last_frame.aspect_ratio
+                || frame.aspect_ratio > _reshape_last_frame.aspect_ratio
+                || _reshape_last_params.stereo_mode() != _render_params.stereo_mode()
+                || _reshape_last_params.crop_aspect_ratio() < _render_params.crop_aspect_ratio()
+                || _reshape_last_params.crop_aspect_ratio() > _render_params.crop_aspect_ratio()
+                || _reshape_last_params.source_aspect_ratio() < _render_params.source_aspect_ratio()
+                || _reshape_last_params.source_aspect_ratio() > _render_params.source_aspect_ratio()
+                || _reshape_last_params.zoom() < _render_params.zoom()
+                || _reshape_last_params.zoom() > _render_params.zoom()
                 || full_display_width() != dst_width
                 || full_display_height() != dst_height)) {
         reshape(dst_width, dst_height, _render_params);
@@ -1204,8 +2557,8 @@ void video_output::display_current_frame(
     if (!_render_prg || !render_is_compatible()) {
         render_deinit();
         render_init();
+        _render_last_params = _render_params;
     }
-    _render_last_params = _render_params;
     _render_last_frame = frame;
 
     /* Use correct left and right view indices */
@@ -1226,8 +2579,22 @@ void video_output::display_current_frame(
         std::swap(left, right);
     }
 
+    /* Use the cached output if it is still current */
+
+    bool use_cache = render_cache_applies(keep_viewport);
+    int cache_index = (_render_params.stereo_mode() == parameters::mode_alternating ? display_frameno % 2 : 0);
+    if (use_cache) {
+        render_cache_bind(cache_index, viewport, dst_width, dst_height);
+        if (_render_cache_valid[cache_index]) {
+            render_cache_blit(cache_index);
+            render_3d_ready_sync(display_frameno, dst_width, dst_height);
+            return;
+        }
+    }
+
     /* Initialize GL things */
 
+    gpu_timer_begin(benchmark_stats::gpu_render);
     glEnable(GL_TEXTURE_2D);
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 
@@ -1236,7 +2603,7 @@ void video_output::display_current_frame(
     // Apply fullscreen flipping/flopping
     float my_tex_coords[2][4][2];
     std::memcpy(my_tex_coords, tex_coords, sizeof(my_tex_coords));
-    if (dispatch::parameters().fullscreen()) {
+    if (_render_params.fullscreen()) {
         if (_render_params.fullscreen_flip_left()) {
             std::swap(my_tex_coords[0][0][0], my_tex_coords[0][3][0]);
             std::swap(my_tex_coords[0][0][1], my_tex_coords[0][3][1]);
@@ -1273,25 +2640,30 @@ void video_output::display_current_frame(
     // if that means that subtitle changes don't take effect in pause mode.
 
     glUseProgram(_render_prg);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, _color_tex[_active_index][left]);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, _color_tex[_active_index][right]);
-    glUniform1i(glGetUniformLocation(_render_prg, "rgb_l"), 0);
-    glUniform1i(glGetUniformLocation(_render_prg, "rgb_r"), 1);
-    glUniform1f(glGetUniformLocation(_render_prg, "parallax"),
+    if (_render_params.quality() >= 4)
+        transfer_lut_bind(true);
+    if (!_render_fused[_active_index]) {
+        // Otherwise, the input textures are bound for each view by render_set_channel()
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, _color_tex[_active_index][left]);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, _color_tex[_active_index][right]);
+    } else if (input_tex_array(frame) || input_tex_packed(frame)) {
+        // Both views are in the same textures; render_set_channel() only selects the view
+        input_bind_textures(_active_index, left);
+    }
+    glUniform1f(_render_loc_parallax,
             _render_params.parallax() * 0.05f
             * (_render_params.stereo_mode_swap() ? -1 : +1));
-    glUniform1f(glGetUniformLocation(_render_prg, "vertical_shift_left"),
+    glUniform1f(_render_loc_vertical_shift_left,
                 _render_params.vertical_pixel_shift_left() / frame.height);
-    glUniform1f(glGetUniformLocation(_render_prg, "vertical_shift_right"),
+    glUniform1f(_render_loc_vertical_shift_right,
                 _render_params.vertical_pixel_shift_right() / frame.height);
     if (render_needs_subtitle(_render_params)) {
         glActiveTexture(GL_TEXTURE2);
         glBindTexture(GL_TEXTURE_2D, (_subtitle[_active_index].is_valid()
                     ? _subtitle_tex[_active_index] : _render_dummy_tex));
-        glUniform1i(glGetUniformLocation(_render_prg, "subtitle"), 2);
-        glUniform1f(glGetUniformLocation(_render_prg, "subtitle_parallax"),
+        glUniform1f(_render_loc_subtitle_parallax,
                 _render_params.subtitle_parallax() * 0.05f
                 * (_render_params.stereo_mode_swap() ? -1 : +1));
     }
@@ -1299,7 +2671,7 @@ void video_output::display_current_frame(
         float color_matrix[16];
         get_color_matrix(_render_params.brightness(), _render_params.contrast(),
                 _render_params.hue(), _render_params.saturation(), color_matrix);
-        glUniformMatrix4fv(glGetUniformLocation(_render_prg, "color_matrix"), 1, GL_TRUE, color_matrix);
+        glUniformMatrix4fv(_render_loc_color_matrix, 1, GL_TRUE, color_matrix);
     }
     if (_render_params.stereo_mode() != parameters::mode_red_green_monochrome
             && _render_params.stereo_mode() != parameters::mode_red_cyan_half_color
@@ -1316,7 +2688,7 @@ void video_output::display_current_frame(
             && _render_params.stereo_mode() != parameters::mode_red_blue_monochrome
             && _render_params.stereo_mode() != parameters::mode_red_cyan_monochrome
             && render_needs_ghostbust(_render_params)) {
-        glUniform3f(glGetUniformLocation(_render_prg, "crosstalk"),
+        glUniform3f(_render_loc_crosstalk,
                 _render_params.crosstalk_r() * _render_params.ghostbust(),
                 _render_params.crosstalk_g() * _render_params.ghostbust(),
                 _render_params.crosstalk_b() * _render_params.ghostbust());
@@ -1324,17 +2696,16 @@ void video_output::display_current_frame(
     if (_render_params.stereo_mode() == parameters::mode_even_odd_rows
             || _render_params.stereo_mode() == parameters::mode_even_odd_columns
             || _render_params.stereo_mode() == parameters::mode_checkerboard) {
-        glUniform1i(glGetUniformLocation(_render_prg, "mask_tex"), 3);
-        glUniform1f(glGetUniformLocation(_render_prg, "step_x"), 1.0f / static_cast<float>(viewport[0][2]));
-        glUniform1f(glGetUniformLocation(_render_prg, "step_y"), 1.0f / static_cast<float>(viewport[0][3]));
+        glUniform1f(_render_loc_step_x, 1.0f / static_cast<float>(viewport[0][2]));
+        glUniform1f(_render_loc_step_y, 1.0f / static_cast<float>(viewport[0][3]));
     }
 
     glViewport(viewport[0][0], viewport[0][1], viewport[0][2], viewport[0][3]);
     if (_render_params.stereo_mode() == parameters::mode_stereo) {
-        glUniform1f(glGetUniformLocation(_render_prg, "channel"), 0.0f);
+        render_set_channel(0, left, right);
         glDrawBuffer(GL_BACK_LEFT);
         draw_quad(x, y, w, h, my_tex_coords);
-        glUniform1f(glGetUniformLocation(_render_prg, "channel"), 1.0f);
+        render_set_channel(1, left, right);
         glDrawBuffer(GL_BACK_RIGHT);
         draw_quad(x, y, w, h, my_tex_coords);
     } else if (_render_params.stereo_mode() == parameters::mode_even_odd_rows
@@ -1366,22 +2737,22 @@ void video_output::display_current_frame(
         draw_quad(x, y, w, h, my_tex_coords);
     } else if ((_render_params.stereo_mode() == parameters::mode_mono_left && !mono_right_instead_of_left)
             || (_render_params.stereo_mode() == parameters::mode_alternating && display_frameno % 2 == 0)) {
-        glUniform1f(glGetUniformLocation(_render_prg, "channel"), 0.0f);
+        render_set_channel(0, left, right);
         draw_quad(x, y, w, h, my_tex_coords);
     } else if (_render_params.stereo_mode() == parameters::mode_mono_right
             || (_render_params.stereo_mode() == parameters::mode_mono_left && mono_right_instead_of_left)
             || (_render_params.stereo_mode() == parameters::mode_alternating && display_frameno % 2 == 1)) {
-        glUniform1f(glGetUniformLocation(_render_prg, "channel"), 1.0f);
+        render_set_channel(1, left, right);
         draw_quad(x, y, w, h, my_tex_coords);
     } else if (_render_params.stereo_mode() == parameters::mode_left_right
             || _render_params.stereo_mode() == parameters::mode_left_right_half
             || _render_params.stereo_mode() == parameters::mode_top_bottom
             || _render_params.stereo_mode() == parameters::mode_top_bottom_half
             || _render_params.stereo_mode() == parameters::mode_hdmi_frame_pack) {
-        glUniform1f(glGetUniformLocation(_render_prg, "channel"), 0.0f);
+        render_set_channel(0, left, right);
         draw_quad(x, y, w, h, my_tex_coords);
         glViewport(viewport[1][0], viewport[1][1], viewport[1][2], viewport[1][3]);
-        glUniform1f(glGetUniformLocation(_render_prg, "channel"), 1.0f);
+        render_set_channel(1, left, right);
         draw_quad(x, y, w, h, my_tex_coords);
     }
     assert(xglCheckError(HERE));
@@ -1390,46 +2761,48 @@ void video_output::display_current_frame(
     glBindTexture(GL_TEXTURE_2D, 0);
     glDisable(GL_TEXTURE_2D);
 
-    if (_render_params.fullscreen() && _render_params.fullscreen_3d_ready_sync()
-            && (_render_params.stereo_mode() == parameters::mode_left_right
-                || _render_params.stereo_mode() == parameters::mode_left_right_half
-                || _render_params.stereo_mode() == parameters::mode_top_bottom
-                || _render_params.stereo_mode() == parameters::mode_top_bottom_half
-                || _render_params.stereo_mode() == parameters::mode_alternating)) {
+    if (use_cache) {
+        _render_cache_valid[cache_index] = true;
+        render_cache_blit(cache_index);
+    }
+    render_3d_ready_sync(display_frameno, dst_width, dst_height);
+    gpu_timer_end(benchmark_stats::gpu_render);
+}
+
+void video_output::render_3d_ready_sync(int64_t display_frameno, int dst_width, int dst_height)
+{
+    if (render_needs_3d_ready_sync(_render_params)) {
         /* DLP 3-D Ready Sync: draw colored lines to allow the projector
-         * to identify the stereo mode and the left / right views automatically. */
-        const uint32_t R = 0xffu << 16u;
-        const uint32_t G = 0xffu << 8u;
-        const uint32_t B = 0xffu;
-        int width = full_display_width();
-        int height = full_display_height();
-        // Make space in the buffer for the pixel data
-        size_t req_size = width * sizeof(uint32_t);
-        if (_3d_ready_sync_buf.size() < req_size)
-            _3d_ready_sync_buf.resize(req_size);
+         * to identify the stereo mode and the left / right views automatically.
+         * The lines are drawn with scissored clears, which need neither a
+         * pixel transfer nor a shader. */
+        const float R[3] = { 1.0f, 0.0f, 0.0f };
+        const float G[3] = { 0.0f, 1.0f, 0.0f };
+        const float B[3] = { 0.0f, 0.0f, 1.0f };
+        const float GB[3] = { 0.0f, 1.0f, 1.0f };
+        const float RG[3] = { 1.0f, 1.0f, 0.0f };
+        const float RB[3] = { 1.0f, 0.0f, 1.0f };
+        const float *color;
+        int lines = 1;
         if (_render_params.stereo_mode() == parameters::mode_left_right
                 || _render_params.stereo_mode() == parameters::mode_left_right_half) {
-           uint32_t color = (display_frameno % 2 == 0 ? R : G | B);
-           for (int i = 0; i < width; i++)
-               _3d_ready_sync_buf.ptr<uint32_t>()[i] = color;
-           glWindowPos2i(0, 0);
-           glDrawPixels(width, 1, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, _3d_ready_sync_buf.ptr());
+            color = (display_frameno % 2 == 0 ? R : GB);
         } else if (_render_params.stereo_mode() == parameters::mode_top_bottom
                 || _render_params.stereo_mode() == parameters::mode_top_bottom_half) {
-           uint32_t color = (display_frameno % 2 == 0 ? B : R | G);
-           for (int i = 0; i < width; i++)
-               _3d_ready_sync_buf.ptr<uint32_t>()[i] = color;
-           glWindowPos2i(0, 0);
-           glDrawPixels(width, 1, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, _3d_ready_sync_buf.ptr());
-           glWindowPos2i(0, height / 2);
-           glDrawPixels(width, 1, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, _3d_ready_sync_buf.ptr());
-        } else if (_render_params.stereo_mode() == parameters::mode_alternating) {
-           uint32_t color = (display_frameno % 4 < 2 ? G : R | B);
-           for (int i = 0; i < width; i++)
-               _3d_ready_sync_buf.ptr<uint32_t>()[i] = color;
-           glWindowPos2i(0, 0);
-           glDrawPixels(width, 1, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, _3d_ready_sync_buf.ptr());
+            color = (display_frameno % 2 == 0 ? B : RG);
+            lines = 2;
+        } else {
+            color = (display_frameno % 4 < 2 ? G : RB);
         }
+        glEnable(GL_SCISSOR_TEST);
+        glClearColor(color[0], color[1], color[2], 1.0f);
+        for (int i = 0; i < lines; i++) {
+            glScissor(0, i * (dst_height / 2), dst_width, 1);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+        // The clear color is never changed elsewhere, so restore the default.
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glDisable(GL_SCISSOR_TEST);
     }
 }
 
@@ -1438,6 +2811,7 @@ void video_output::sdi_output(int64_t display_frameno)
 {
     if (!_nv_sdi_output->isInitialized())
         return;
+    _params.update();
 
     // NVIDIA sdi output device has an output queue to display frames, which
     // default size is 5.
@@ -1449,21 +2823,43 @@ void video_output::sdi_output(int64_t display_frameno)
     if (display_frameno == _last_nv_sdi_displayed_frameno)
         return;
 
-    if (_nv_sdi_output->getOutputFormat() != dispatch::parameters().sdi_output_format())
-        _nv_sdi_output->reinit(dispatch::parameters().sdi_output_format());
+    if (_nv_sdi_output->getOutputFormat() != _params.get().sdi_output_format())
+        _nv_sdi_output->reinit(_params.get().sdi_output_format());
 
+    // If the output queue is full, sending another frame would block this
+    // thread until the device displayed a frame, and stall the display and
+    // the preparation of the next frame. Skip this frame instead; the device
+    // repeats the last one. The next frame will be tried again.
+    if (!_nv_sdi_output->canSendTextures()) {
+        _nv_sdi_output->skipFrame();
+        return;
+    }
+
+    // Render both SDI views with their own layout, computed for the SDI
+    // output size. This leaves the layout of the video display alone, so
+    // that the following display of the frame in the window does not need
+    // to reshape it. The color textures of the frame are shared by all
+    // of these renderings. Their GPU time is measured as a whole.
+    gpu_timer_begin(benchmark_stats::gpu_sdi);
     glEnable(GL_TEXTURE_2D);
     for (int i = 0; i < 2; ++i) {
-        // Render each image to specified texture of SDI output
-        _nv_sdi_output->startRenderingTo(i);
-
         parameters::stereo_mode_t tmp_stereo_mode =
-                (i == 0 ? dispatch::parameters().sdi_output_left_stereo_mode() :
-                          dispatch::parameters().sdi_output_right_stereo_mode());
-
-        display_current_frame(display_frameno, _nv_sdi_output->width(), _nv_sdi_output->height(), tmp_stereo_mode);
+                (i == 0 ? _params.get().sdi_output_left_stereo_mode() :
+                          _params.get().sdi_output_right_stereo_mode());
+        parameters params = _params.get();
+        params.set_stereo_mode(tmp_stereo_mode);
+        GLint viewport[2][4];
+        float tex_coords[2][4][2];
+        compute_layout(_nv_sdi_output->width(), _nv_sdi_output->height(), params, viewport, tex_coords);
 
+        // Render each image to specified texture of SDI output
+        _nv_sdi_output->startRenderingTo(i);
+        _output_fbo = _nv_sdi_output->framebuffer();
+        display_current_frame(display_frameno, true, false, -1.0f, -1.0f, 2.0f, 2.0f,
+                viewport, tex_coords, _nv_sdi_output->width(), _nv_sdi_output->height(),
+                tmp_stereo_mode);
         _nv_sdi_output->stopRenderingTo();
+        _output_fbo = 0;
         assert(xglCheckError(HERE));
     }
 
@@ -1471,31 +2867,278 @@ void video_output::sdi_output(int64_t display_frameno)
 
     // Display both textures on SDI output
     _nv_sdi_output->sendTextures();
+    gpu_timer_end(benchmark_stats::gpu_sdi);
     assert(xglCheckError(HERE));
-
-    // Reshape the video again to fit the normal output.
-    // The above call to display_current_frame() will have triggered a reshape
-    // if the SDI output size is different from the video display size. Undo
-    // the effects here.
-    if (_nv_sdi_output->width() != full_display_width()
-            || _nv_sdi_output->height() != full_display_height()) {
-        reshape(full_display_width(), full_display_height());
-    }
+    int queued;
+    int64_t sent, repeated, skipped;
+    _nv_sdi_output->getStats(&queued, &sent, &repeated, &skipped);
+    if (sent % 250 == 0 && msg::dbg_enabled())
+        msg::dbg("SDI output: " + str::from(queued) + " frames queued; " + str::from(sent) + " sent, "
+                + str::from(repeated) + " repeated, " + str::from(skipped) + " skipped");
 
     _last_nv_sdi_displayed_frameno = display_frameno;
 }
 #endif // HAVE_LIBXNVCTRL
 
+void video_output::share_deinit()
+{
+    for (int i = 0; i < 2; i++) {
+        if (_share_pbo_fence[i]) {
+            glDeleteSync(_share_pbo_fence[i]);
+            _share_pbo_fence[i] = 0;
+        }
+        _share_pbo_frameno[i] = -1;
+        _share_pbo_size[i] = 0;
+    }
+    glDeleteBuffers(2, _share_pbo);
+    _share_pbo[0] = 0;
+    _share_pbo[1] = 0;
+    glDeleteFramebuffersEXT(1, &_share_fbo);
+    _share_fbo = 0;
+    glDeleteRenderbuffersEXT(1, &_share_rb);
+    _share_rb = 0;
+    _share_rb_width = 0;
+    _share_rb_height = 0;
+    _last_shared_frameno = -1;
+    _frame_share.close();
+}
+
+void video_output::share_publish(int index)
+{
+    if (_share_pbo_frameno[index] < 0)
+        return;
+    if (_share_pbo_fence[index]) {
+        glClientWaitSync(_share_pbo_fence[index], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(_share_pbo_fence[index]);
+        _share_pbo_fence[index] = 0;
+    }
+    const int *geometry = _share_pbo_geometry[index];
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _share_pbo[index]);
+    const char *data = static_cast<const char *>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+    if (data) {
+        try {
+            _frame_share.open(geometry[0], geometry[1], geometry[2]);
+            size_t view_size = static_cast<size_t>(geometry[0]) * geometry[1] * 4;
+            _frame_share.begin_write();
+            for (int v = 0; v < geometry[2]; v++)
+                std::memcpy(_frame_share.data(v), data + v * view_size, view_size);
+            _frame_share.end_write(_share_pbo_frameno[index], _share_pbo_pts[index]);
+        }
+        catch (exc& e) {
+            // Do not stop playback; the consumers are not essential.
+            msg::err("%s", e.what());
+            frame_share::set_name(std::string());
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    _share_pbo_frameno[index] = -1;
+}
+
+void video_output::share_frame(int64_t display_frameno)
+{
+    const video_frame &frame = _frame[_active_index];
+    if (!frame_share::enabled() || !frame.is_valid() || display_frameno == _last_shared_frameno)
+        return;
+    _last_shared_frameno = display_frameno;
+
+    // The composited output is read from the back buffer of the window. The
+    // views are rendered separately at their original size, like for SDI output.
+    int views = (frame_share::per_view() ? 2 : 1);
+    int w = (views == 2 ? frame.width : width());
+    int h = (views == 2 ? frame.height : height());
+    size_t view_size = static_cast<size_t>(w) * h * 4;
+    int i = _share_pbo_index;
+    if (_share_pbo[i] == 0)
+        glGenBuffers(1, &_share_pbo[i]);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _share_pbo[i]);
+    if (_share_pbo_size[i] != views * view_size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, views * view_size, NULL, GL_STREAM_READ);
+        _share_pbo_size[i] = views * view_size;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (views == 1) {
+        glReadBuffer(context_is_stereo() ? GL_BACK_LEFT : GL_BACK);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, _share_pbo[i]);
+        glReadPixels(0, 0, w, h, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    } else {
+        if (_share_rb == 0 || _share_rb_width != w || _share_rb_height != h) {
+            if (_share_fbo == 0)
+                glGenFramebuffersEXT(1, &_share_fbo);
+            if (_share_rb == 0)
+                glGenRenderbuffersEXT(1, &_share_rb);
+            glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, _share_rb);
+            glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGBA8, w, h);
+            glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, 0);
+            glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _share_fbo);
+            glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+                    GL_RENDERBUFFER_EXT, _share_rb);
+            xglCheckFBO(HERE);
+            _share_rb_width = w;
+            _share_rb_height = h;
+        }
+        GLuint output_fbo = _output_fbo;
+        _output_fbo = _share_fbo;
+        for (int v = 0; v < 2; v++) {
+            parameters::stereo_mode_t mode = (v == 0 ? parameters::mode_mono_left : parameters::mode_mono_right);
+            parameters params = _params.get();
+            params.set_stereo_mode(mode);
+            GLint viewport[2][4];
+            float tex_coords[2][4][2];
+            compute_layout(w, h, params, viewport, tex_coords);
+            glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _share_fbo);
+            glViewport(0, 0, w, h);
+            display_current_frame(display_frameno, true, false, -1.0f, -1.0f, 2.0f, 2.0f,
+                    viewport, tex_coords, w, h, mode);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, _share_pbo[i]);
+            glReadPixels(0, 0, w, h, GL_BGRA, GL_UNSIGNED_BYTE,
+                    reinterpret_cast<GLvoid *>(v * view_size));
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+        _output_fbo = output_fbo;
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _output_fbo);
+        glViewport(0, 0, width(), height());
+    }
+    if (GLEW_ARB_sync)
+        _share_pbo_fence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    _share_pbo_frameno[i] = display_frameno;
+    _share_pbo_pts[i] = frame.presentation_time;
+    _share_pbo_geometry[i][0] = w;
+    _share_pbo_geometry[i][1] = h;
+    _share_pbo_geometry[i][2] = views;
+    _share_pbo_index = 1 - i;
+    // Publish the previous frame, whose readback had a frame's time to complete.
+    share_publish(_share_pbo_index);
+    assert(xglCheckError(HERE));
+}
+
+/* Step 2: convert the views of frame [index] into its color textures. The
+ * input data is read from the input textures, or from the given mapped
+ * surface textures for hardware surface frames. */
+void video_output::color_convert(int index, const GLuint surface_tex[2])
+{
+    const video_frame &frame = _frame[index];
+    const parameters& params = quality_params();
+    if (!_color_prg[index] || !color_is_compatible(index, params, frame)) {
+        color_deinit(index);
+        color_init(index, params, frame);
+    }
+    int left = 0;
+    int right = (frame.stereo_layout == parameters::layout_mono ? 0 : 1);
+
+    // The color program has its own vertex shader that does not use the matrices,
+    // and the viewport is set before each use anyway. So the only state that needs
+    // to be restored is the framebuffer binding, which is tracked in _output_fbo,
+    // and the scissor test, which is used below and disabled everywhere else.
+    gpu_timer_begin(benchmark_stats::gpu_color);
+    glEnable(GL_TEXTURE_2D);
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    glViewport(0, 0, frame.width, frame.height);
+    // Only convert the part of the views that was uploaded. The color textures
+    // are vertically flipped relative to the input textures.
+    const int *region = _input_view_region[index];
+    bool scissor = (region[2] < frame.width || region[3] < frame.height);
+    if (scissor) {
+        glScissor(region[0], frame.height - region[1] - region[3], region[2], region[3]);
+        glEnable(GL_SCISSOR_TEST);
+    }
+    glUseProgram(_color_prg[index]);
+    if (_color_last_params[index].quality() >= 4)
+        transfer_lut_bind(false);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _color_fbo);
+    // Keep the field that is displayed first. Motion-adaptive deinterlacing
+    // compares with the previous frame, whose input textures are those of the
+    // active frame; without them, every pixel counts as moving.
+    parameters::deinterlacing_t deinterlacing = color_deinterlacing(_color_last_params[index], frame);
+    bool use_prev = (deinterlacing == parameters::deinterlace_adaptive
+            && index != _active_index && _input_prev_valid);
+    if (deinterlacing != parameters::deinterlace_off) {
+        glUniform1f(_color_loc_deinterlace[index][0],
+                frame.field_order == video_frame::top_first ? 0.0f : 1.0f);
+        glUniform1f(_color_loc_deinterlace[index][1], use_prev ? 1.0f : 0.0f);
+    }
+    if (use_prev)
+        input_bind_prev_texture(_active_index, left);
+    float surface_tex_coords[2][2][4][2];
+    int surface_index[2] = { 0, 0 };
+    if (frame.surface_type != video_frame::no_surface) {
+        surface_index[0] = compute_surface_tex_coords(frame, left, surface_tex_coords[0]);
+        surface_index[1] = compute_surface_tex_coords(frame, right, surface_tex_coords[1]);
+    }
+    // left view: render into _color_tex[index][0]
+    if (frame.surface_type != video_frame::no_surface) {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, surface_tex[surface_index[0]]);
+    } else {
+        input_bind_textures(index, left);
+        if (input_tex_packed(frame))
+            input_set_packed_view(frame, left, _color_loc_packed_view[index]);
+        else
+            glUniform1f(_color_loc_input_layer[index], left);
+    }
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,
+            GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, _color_tex[index][0], 0);
+    xglCheckFBO(HERE);
+    draw_quad(-1.0f, +1.0f, +2.0f, -2.0f,
+            frame.surface_type != video_frame::no_surface ? surface_tex_coords[0] : NULL);
+    // right view: render into _color_tex[index][1]
+    if (left != right) {
+        if (frame.surface_type != video_frame::no_surface) {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, surface_tex[surface_index[1]]);
+        } else if (input_tex_packed(frame)) {
+            // Same textures, other part
+            input_set_packed_view(frame, right, _color_loc_packed_view[index]);
+        } else if (input_tex_array(frame)) {
+            // Same textures, other layer
+            glUniform1f(_color_loc_input_layer[index], right);
+        } else {
+            input_bind_textures(index, right);
+        }
+        if (use_prev)
+            input_bind_prev_texture(_active_index, right);
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,
+                GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, _color_tex[index][1], 0);
+        xglCheckFBO(HERE);
+        draw_quad(-1.0f, +1.0f, +2.0f, -2.0f,
+                frame.surface_type != video_frame::no_surface ? surface_tex_coords[1] : NULL);
+    }
+
+    // Restore GL state
+    if (scissor)
+        glDisable(GL_SCISSOR_TEST);
+    if (use_prev) {
+        glActiveTexture(GL_TEXTURE6);
+        glBindTexture(input_tex_array(frame) ? GL_TEXTURE_2D_ARRAY_EXT : GL_TEXTURE_2D, 0);
+    }
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _output_fbo);
+    glUseProgram(0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_TEXTURE_2D);
+    gpu_timer_end(benchmark_stats::gpu_color);
+}
+
 void video_output::prepare_next_frame(const video_frame &frame, const subtitle_box &subtitle)
 {
     // Initialization
+    _params.update();
     int index = (_active_index == 0 ? 1 : 0);
     if (!frame.is_valid()) {
         _frame[index] = frame;
+        _render_fused[index] = false;
         return;
     }
     assert(xglCheckError(HERE));
+    _input_prev_valid = (_frame[_active_index].is_valid() && input_is_compatible(frame));
     if (!input_is_compatible(frame)) {
+        // The active frame may still need its input textures
+        if (_render_fused[_active_index]) {
+            color_convert(_active_index, NULL);
+            _render_fused[_active_index] = false;
+        }
         input_deinit();
         input_init(frame);
         _input_last_frame = frame;
@@ -1516,149 +3159,205 @@ void video_output::prepare_next_frame(const video_frame &frame, const subtitle_b
             sub_outwidth = frame.width;
             sub_outheight = frame.height;
         }
+        // A subtitle that is still being rendered ahead of time is likely needed now.
+        _subtitle_updater->finish();
         _subtitle_updater->set(subtitle, frame.presentation_time,
-                dispatch::parameters(), sub_outwidth, sub_outheight,
+                _params, sub_outwidth, sub_outheight,
                 screen_pixel_aspect_ratio());
         _subtitle_updater->start();
     }
 
     // Upload the frame data
     _frame[index] = frame;
-    int bytes_per_pixel = 4;
-    GLenum format = GL_BGRA;
-    GLenum type = GL_UNSIGNED_INT_8_8_8_8_REV;
-    if (frame.layout != video_frame::bgra32) {
-        bool type_u8 = (frame.value_range == video_frame::u8_full || frame.value_range == video_frame::u8_mpeg);
-        bytes_per_pixel = type_u8 ? 1 : 2;
-        format = GL_LUMINANCE;
-        type = type_u8 ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT;
-    }
-    for (int i = 0; i < (frame.stereo_layout == parameters::layout_mono ? 1 : 2); i++) {
-        for (int plane = 0; plane < (frame.layout == video_frame::bgra32 ? 1 : 3); plane++) {
-            // Determine the texture and the dimensions
-            int w = frame.width;
-            int h = frame.height;
-            GLuint tex;
+    if (!_input_region_is_set)
+        input_update_region(frame);
+    _input_view_region[index][0] = 0;
+    _input_view_region[index][1] = 0;
+    _input_view_region[index][2] = frame.width;
+    _input_view_region[index][3] = frame.height;
+    GLuint surface_tex[2] = { 0, 0 };
+    if (frame.surface_type != video_frame::no_surface) {
+        // The hardware surfaces are used as input textures directly.
+        input_map_surfaces(frame, surface_tex);
+    } else {
+        int64_t upload_start = timer::get(timer::monotonic);
+        // Packed textures are split into the views only by the color conversion
+        // step, so there is no view region to restrict it to.
+        bool packed = input_tex_packed(frame);
+        int upload_views = (frame.stereo_layout == parameters::layout_mono || packed ? 1 : 2);
+        if (!input_region_is_full() && !packed) {
             int row_size;
-            if (frame.layout == video_frame::bgra32) {
-                tex = _input_bgra32_tex[i];
+            input_plane_region(frame, 0, &_input_view_region[index][0], &_input_view_region[index][1],
+                    &_input_view_region[index][2], &_input_view_region[index][3], &row_size);
+        }
+        int pbo = _input_pbo_index;
+        _input_pbo_index = (_input_pbo_index + 1) % _input_pbo_count;
+        // Wait until the GL is done with the previous contents of this PBO.
+        // With a ring of PBOs, this should usually not block at all.
+        if (_input_pbo_fence[pbo]) {
+            while (glClientWaitSync(_input_pbo_fence[pbo], GL_SYNC_FLUSH_COMMANDS_BIT,
+                        1000000000) == GL_TIMEOUT_EXPIRED);
+            glDeleteSync(_input_pbo_fence[pbo]);
+            _input_pbo_fence[pbo] = 0;
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _input_pbo[pbo]);
+        char *pboptr = static_cast<char *>(_input_pbo_ptr[pbo]);
+        if (!pboptr) {
+            if (GLEW_ARB_map_buffer_range) {
+                // If we have a fence, we know that the buffer is not in use anymore.
+                // Otherwise, let the GL orphan the old buffer contents.
+                pboptr = static_cast<char *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, _input_pbo_size,
+                            GL_MAP_WRITE_BIT | (GLEW_ARB_sync ? GL_MAP_UNSYNCHRONIZED_BIT : GL_MAP_INVALIDATE_BUFFER_BIT)));
             } else {
-                if (plane != 0) {
-                    w /= _input_yuv_chroma_width_divisor;
-                    h /= _input_yuv_chroma_height_divisor;
-                }
-                tex = (plane == 0 ? _input_yuv_y_tex[i]
-                        : plane == 1 ? _input_yuv_u_tex[i]
-                        : _input_yuv_v_tex[i]);
+                glBufferData(GL_PIXEL_UNPACK_BUFFER, _input_pbo_size, NULL, GL_STREAM_DRAW);
+                pboptr = static_cast<char *>(glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY));
             }
-            row_size = next_multiple_of_4(w * bytes_per_pixel);
-            // Get a pixel buffer object buffer for the data
-            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _input_pbo);
-            glBufferData(GL_PIXEL_UNPACK_BUFFER, row_size * h, NULL, GL_STREAM_DRAW);
-            void *pboptr = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
             if (!pboptr)
                 throw exc(_("Cannot create a PBO buffer."));
-            assert(reinterpret_cast<uintptr_t>(pboptr) % 4 == 0);
-            // Get the plane data into the pbo
-            frame.copy_plane(i, plane, pboptr);
-            // Upload the data to the texture. We need to set GL_UNPACK_ROW_LENGTH for
-            // misbehaving OpenGL implementations that do not seem to honor
-            // GL_UNPACK_ALIGNMENT correctly in all cases (reported for Mac).
+        }
+        assert(reinterpret_cast<uintptr_t>(pboptr) % 4 == 0);
+        // Get the plane data into the pbo. If the row sizes of the data allow it,
+        // we copy each plane with a single memcpy() and let the GL pick out the
+        // views. Otherwise, the views are copied row by row. In both cases, the
+        // data of one plane is kept together so that the two layers of an array
+        // texture can often be uploaded with one call.
+        size_t direct_size = input_direct_upload_size(frame);
+        bool direct = (input_region_is_full() && direct_size > 0 && direct_size <= _input_pbo_size);
+        size_t data_offset[2][3] = { { 0, 0, 0 }, { 0, 0, 0 } };
+        size_t offset = 0;
+        if (direct) {
+            int data_views = (frame.stereo_layout == parameters::layout_separate
+                    || frame.stereo_layout == parameters::layout_alternating ? 2 : 1);
+            for (int plane = 0; plane < frame.planes(); plane++) {
+                for (int i = 0; i < data_views; i++) {
+                    size_t size = frame.line_size[i][plane] * input_raw_plane_height(frame, plane);
+                    video_frame::copy_data(pboptr + offset, frame.data[i][plane], size, true);
+                    data_offset[i][plane] = offset;
+                    offset += size;
+                }
+            }
+        } else {
+            // The views of each plane are consecutive, as needed for array textures.
+            // If only a region of the views is uploaded, only that is copied.
+            for (int plane = 0; plane < frame.planes(); plane++) {
+                for (int i = 0; i < upload_views; i++) {
+                    int x, y, w, h, row_size;
+                    input_plane_region(frame, plane, &x, &y, &w, &h, &row_size);
+                    if (packed) {
+                        const char *src = static_cast<const char *>(frame.data[0][plane])
+                            + y * frame.line_size[0][plane] + x * input_bytes_per_pixel(frame, plane);
+                        video_frame::copy_rect(pboptr + offset, row_size, src, frame.line_size[0][plane],
+                                w * input_bytes_per_pixel(frame, plane), h, true);
+                    } else if (input_region_is_full()) {
+                        frame.copy_plane(i, plane, pboptr + offset, true);
+                    } else {
+                        int data_view;
+                        size_t view_offset, view_row_size;
+                        frame.plane_location(i, plane, &data_view, &view_offset, &view_row_size);
+                        const char *src = static_cast<const char *>(frame.data[data_view][plane])
+                            + view_offset + y * view_row_size + x * input_bytes_per_pixel(frame, plane);
+                        video_frame::copy_rect(pboptr + offset, row_size, src, view_row_size,
+                                w * input_bytes_per_pixel(frame, plane), h, true);
+                    }
+                    offset += row_size * h;
+                }
+            }
+        }
+        if (!_input_pbo_ptr[pbo])
             glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-            glPixelStorei(GL_UNPACK_ROW_LENGTH, row_size / bytes_per_pixel);
-            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, tex);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, format, type, NULL);
-            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        // Upload the data to the textures. We need to set GL_UNPACK_ROW_LENGTH for
+        // misbehaving OpenGL implementations that do not seem to honor
+        // GL_UNPACK_ALIGNMENT correctly in all cases (reported for Mac).
+        int bytes_per_pixel = 4;
+        GLenum format = GL_BGRA;
+        GLenum type = GL_UNSIGNED_INT_8_8_8_8_REV;
+        if (frame.layout != video_frame::bgra32) {
+            bool type_u8 = (frame.value_range == video_frame::u8_full || frame.value_range == video_frame::u8_mpeg);
+            bytes_per_pixel = type_u8 ? 1 : 2;
+            format = GL_LUMINANCE;
+            type = type_u8 ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT;
         }
+        int sample_size = bytes_per_pixel;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glActiveTexture(GL_TEXTURE0);
+        bool array = input_tex_array(frame);
+        offset = 0;
+        for (int plane = 0; plane < frame.planes(); plane++) {
+            size_t tex_offset[2];
+            int tex_row_size[2];
+            int x, y, w, h;
+            for (int i = 0; i < upload_views; i++) {
+                // Determine the location of the data and the dimensions
+                int row_size;
+                input_plane_region(frame, plane, &x, &y, &w, &h, &row_size);
+                if (direct && packed) {
+                    tex_offset[i] = data_offset[0][plane];
+                    tex_row_size[i] = frame.line_size[0][plane];
+                } else if (direct) {
+                    int data_view;
+                    size_t view_offset, view_row_size;
+                    frame.plane_location(i, plane, &data_view, &view_offset, &view_row_size);
+                    tex_offset[i] = data_offset[data_view][plane] + view_offset;
+                    tex_row_size[i] = view_row_size;
+                } else {
+                    tex_offset[i] = offset;
+                    tex_row_size[i] = row_size;
+                    offset += row_size * h;
+                }
+            }
+            if (frame.layout == video_frame::yuv420sp) {
+                format = (plane == 0 ? GL_LUMINANCE : GL_LUMINANCE_ALPHA);
+                bytes_per_pixel = (plane == 0 ? 1 : 2) * sample_size;
+            }
+            for (int i = 0; i < upload_views; i++) {
+                GLuint tex = (frame.layout == video_frame::bgra32 ? _input_bgra32_tex[index][array ? 0 : i]
+                        : plane == 0 ? _input_yuv_y_tex[index][array ? 0 : i]
+                        : plane == 1 ? _input_yuv_u_tex[index][array ? 0 : i]
+                        : _input_yuv_v_tex[index][array ? 0 : i]);
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, tex_row_size[i] / bytes_per_pixel);
+                if (!array) {
+                    glBindTexture(GL_TEXTURE_2D, tex);
+                    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, format, type,
+                            reinterpret_cast<const GLvoid *>(tex_offset[i]));
+                } else if (i == 0) {
+                    glBindTexture(GL_TEXTURE_2D_ARRAY_EXT, tex);
+                    // If the second view directly follows the first with the same row
+                    // size, which is always the case unless the data is used directly,
+                    // both layers are uploaded with a single call.
+                    int layers = (tex_row_size[1] == tex_row_size[0]
+                            && tex_offset[1] == tex_offset[0] + static_cast<size_t>(tex_row_size[0]) * h ? 2 : 1);
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY_EXT, 0, x, y, 0, w, h, layers, format, type,
+                            reinterpret_cast<const GLvoid *>(tex_offset[0]));
+                    if (layers == 2)
+                        break;
+                } else {
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY_EXT, 0, x, y, 1, w, h, 1, format, type,
+                            reinterpret_cast<const GLvoid *>(tex_offset[1]));
+                }
+            }
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (GLEW_ARB_sync)
+            _input_pbo_fence[pbo] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        int64_t upload_time = timer::get(timer::monotonic) - upload_start;
+        _upload_frames++;
+        _upload_time += upload_time;
+        benchmark_stats::add(benchmark_stats::upload, upload_time);
     }
     assert(xglCheckError(HERE));
 
     /* Step 2: color-correction */
 
-    if (!_color_prg[index] || !color_is_compatible(index, dispatch::parameters(), frame)) {
-        color_deinit(index);
-        color_init(index, dispatch::parameters(), frame);
-    }
-    int left = 0;
-    int right = (frame.stereo_layout == parameters::layout_mono ? 0 : 1);
-
-    // Backup GL state
-    GLint framebuffer_bak;
-    glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &framebuffer_bak);
-    GLint viewport_bak[4];
-    glGetIntegerv(GL_VIEWPORT, viewport_bak);
-    GLboolean scissor_bak = glIsEnabled(GL_SCISSOR_TEST);
-    glMatrixMode(GL_MODELVIEW);
-    glPushMatrix();
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-
-    glEnable(GL_TEXTURE_2D);
-    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-    glDisable(GL_SCISSOR_TEST);
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glViewport(0, 0, frame.width, frame.height);
-    glUseProgram(_color_prg[index]);
-    if (frame.layout == video_frame::bgra32) {
-        glUniform1i(glGetUniformLocation(_color_prg[index], "srgb_tex"), 0);
-    } else {
-        glUniform1i(glGetUniformLocation(_color_prg[index], "y_tex"), 0);
-        glUniform1i(glGetUniformLocation(_color_prg[index], "u_tex"), 1);
-        glUniform1i(glGetUniformLocation(_color_prg[index], "v_tex"), 2);
+    // If possible, leave this step to the render step, which then reads the
+    // input textures of this frame directly.
+    _render_fused[index] = render_can_fuse(quality_params(), frame);
+    if (!_render_fused[index]) {
+        int64_t color_start = timer::get(timer::monotonic);
+        color_convert(index, surface_tex);
+        benchmark_stats::add(benchmark_stats::color, timer::get(timer::monotonic) - color_start);
     }
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _color_fbo);
-    // left view: render into _color_tex[index][0]
-    if (frame.layout == video_frame::bgra32) {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, _input_bgra32_tex[left]);
-    } else {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, _input_yuv_y_tex[left]);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, _input_yuv_u_tex[left]);
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, _input_yuv_v_tex[left]);
-    }
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,
-            GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, _color_tex[index][0], 0);
-    xglCheckFBO(HERE);
-    draw_quad(-1.0f, +1.0f, +2.0f, -2.0f);
-    // right view: render into _color_tex[index][1]
-    if (left != right) {
-        if (frame.layout == video_frame::bgra32) {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, _input_bgra32_tex[right]);
-        } else {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, _input_yuv_y_tex[right]);
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, _input_yuv_u_tex[right]);
-            glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_2D, _input_yuv_v_tex[right]);
-        }
-        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,
-                GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, _color_tex[index][1], 0);
-        xglCheckFBO(HERE);
-        draw_quad(-1.0f, +1.0f, +2.0f, -2.0f);
-    }
-
-    // Restore GL state
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer_bak);
-    if (scissor_bak)
-        glEnable(GL_SCISSOR_TEST);
-    glViewport(viewport_bak[0], viewport_bak[1], viewport_bak[2], viewport_bak[3]);
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
-    glMatrixMode(GL_MODELVIEW);
-    glPopMatrix();
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glDisable(GL_TEXTURE_2D);
+    if (frame.surface_type != video_frame::no_surface)
+        input_unmap_surfaces(frame);
 
     // Finish the subtitle updating
     if (subtitle.is_valid()) {
@@ -1674,6 +3373,7 @@ void video_output::prepare_next_frame(const video_frame &frame, const subtitle_b
         bb_w = std::min(std::max(bb_w, 0), sub_outwidth - bb_x);
         bb_h = std::min(std::max(bb_h, 0), sub_outheight - bb_y);
         if (buffer_updated || !_subtitle_tex_current[index]) {
+            gpu_timer_begin(benchmark_stats::gpu_subtitle);
             // Make sure the texture has the right size
             assert(xglCheckError(HERE));
             GLint tex_w, tex_h;
@@ -1681,30 +3381,49 @@ void video_output::prepare_next_frame(const video_frame &frame, const subtitle_b
             glBindTexture(GL_TEXTURE_2D, _subtitle_tex[index]);
             glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &tex_w);
             glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &tex_h);
+            int *old_bb = _subtitle_tex_bb[index];
+            bool clear_all = false;
             if (tex_w != sub_outwidth || tex_h != sub_outheight) {
                 glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, sub_outwidth, sub_outheight, 0,
                         GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+                _subtitle_tex_bytes[index] = static_cast<size_t>(sub_outwidth) * sub_outheight * 4;
+                clear_all = true;
             }
-            // Clear the texture
-            GLint framebuffer_bak;
-            glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &framebuffer_bak);
-            glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _input_fbo);
-            glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,
-                    GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, _subtitle_tex[index], 0);
-            xglCheckFBO(HERE);
-            glClear(GL_COLOR_BUFFER_BIT);
-            glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer_bak);
+            // Clear the texture. Only the area of the previous subtitle needs to
+            // be cleared, and only if the new bounding box does not cover it:
+            // the new bounding box is overwritten completely below.
+            bool old_bb_covered = (bb_w > 0 && bb_h > 0
+                    && old_bb[0] >= bb_x && old_bb[0] + old_bb[2] <= bb_x + bb_w
+                    && old_bb[1] >= bb_y && old_bb[1] + old_bb[3] <= bb_y + bb_h);
+            if (clear_all || (old_bb[2] > 0 && old_bb[3] > 0 && !old_bb_covered)) {
+                glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _input_fbo);
+                glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,
+                        GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, _subtitle_tex[index], 0);
+                xglCheckFBO(HERE);
+                if (!clear_all) {
+                    glScissor(old_bb[0], old_bb[1], old_bb[2], old_bb[3]);
+                    glEnable(GL_SCISSOR_TEST);
+                }
+                glClear(GL_COLOR_BUFFER_BIT);
+                glDisable(GL_SCISSOR_TEST);
+                glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _output_fbo);
+            }
+            old_bb[0] = bb_x;
+            old_bb[1] = bb_y;
+            old_bb[2] = bb_w;
+            old_bb[3] = bb_h;
             // Get a PBO buffer of appropriate size for the bounding box.
             if (bb_w > 0 && bb_h > 0) {
                 size_t size = bb_w * bb_h * sizeof(uint32_t);
-                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _input_pbo);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _subtitle_pbo);
                 glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+                _subtitle_pbo_size = size;
                 void* pboptr = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
                 if (!pboptr)
                     throw exc(_("Cannot create a PBO buffer."));
                 assert(reinterpret_cast<uintptr_t>(pboptr) % 4 == 0);
                 // Copy the bounding box into the buffer
-                std::memcpy(pboptr, ptr, size);
+                video_frame::copy_data(pboptr, ptr, size, true);
                 // Update the appropriate part of the texture.
                 glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
                 glPixelStorei(GL_UNPACK_ROW_LENGTH, bb_w);
@@ -1714,6 +3433,7 @@ void video_output::prepare_next_frame(const video_frame &frame, const subtitle_b
                 glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
                 assert(xglCheckError(HERE));
             }
+            gpu_timer_end(benchmark_stats::gpu_subtitle);
         }
         _subtitle_tex_current[index] = true;
         if (buffer_updated) {
@@ -1721,14 +3441,137 @@ void video_output::prepare_next_frame(const video_frame &frame, const subtitle_b
         }
     }
     _subtitle[index] = subtitle;
+
+    // Render the upcoming subtitle in the background while this frame is shown,
+    // so that preparing the frame that needs it only has to upload it.
+    if (_subtitle_upcoming.is_valid() && !(_subtitle_upcoming == subtitle)
+            && _subtitle_renderer.is_initialized() && !_subtitle_updater->running()) {
+        int sub_outwidth, sub_outheight;
+        if (_subtitle_renderer.render_to_display_size(_subtitle_upcoming)) {
+            sub_outwidth = video_display_width();
+            sub_outheight = video_display_height();
+        } else {
+            sub_outwidth = frame.width;
+            sub_outheight = frame.height;
+        }
+        _subtitle_updater->set(_subtitle_upcoming, _subtitle_upcoming.presentation_start_time,
+                _params, sub_outwidth, sub_outheight,
+                screen_pixel_aspect_ratio(), true);
+        _subtitle_updater->start(task::priority_min);
+    }
+}
+
+void video_output::set_upcoming_subtitle(const subtitle_box &subtitle)
+{
+    _subtitle_upcoming = subtitle;
+}
+
+void video_output::get_upload_stats(int64_t *frames, int64_t *time)
+{
+    *frames = _upload_frames;
+    *time = _upload_time;
+}
+
+void video_output::get_gpu_stats(benchmark_stats::stage_t stage, int64_t *frames, int64_t *time)
+{
+    *frames = _gpu_frames[stage - benchmark_stats::gpu_color];
+    *time = _gpu_time[stage - benchmark_stats::gpu_color];
+}
+
+void video_output::adapt_quality(int64_t frame_duration, int64_t delay)
+{
+    // Like the decoder skip level in the player: step down quickly when the
+    // GPU cannot keep up, and go back up only after a long run of frames with
+    // plenty of headroom, so that the quality does not oscillate. Late frames
+    // only count when the GPU is busy or its time is unknown; otherwise the
+    // decoder is the bottleneck, and that is handled by the skip level.
+    if (!_params.get().adaptive_quality()) {
+        _quality_limit = 4;
+        return;
+    }
+    if (frame_duration <= 0)
+        return;
+    _quality_window_frames++;
+    if (delay > frame_duration / 2)
+        _quality_window_late_frames++;
+    if (_quality_window_frames < 30)
+        return;
+    // The GPU time of one frame is the sum of the average time of each stage.
+    int64_t gpu_time = -1;
+    for (int i = 0; i < _gpu_stage_count; i++) {
+        int64_t frames = _gpu_frames[i] - _quality_mark_gpu_frames[i];
+        if (frames > 0)
+            gpu_time = std::max(gpu_time, static_cast<int64_t>(0))
+                + (_gpu_time[i] - _quality_mark_gpu_time[i]) / frames;
+        _quality_mark_gpu_frames[i] = _gpu_frames[i];
+        _quality_mark_gpu_time[i] = _gpu_time[i];
+    }
+    bool gpu_busy = (gpu_time < 0 || gpu_time > frame_duration / 2);
+    int quality = std::min(_params.get().quality(), _quality_limit);
+    int limit = _quality_limit;
+    if (gpu_time > frame_duration * 85 / 100 || (_quality_window_late_frames >= 3 && gpu_busy)) {
+        _quality_good_windows = 0;
+        if (quality > 0)
+            limit = quality - 1;
+    } else if (_quality_window_late_frames == 0 && gpu_time < frame_duration * 4 / 10) {
+        if (++_quality_good_windows >= 20 && limit < 4)
+            limit++;
+    } else {
+        _quality_good_windows = 0;
+    }
+    if (limit != _quality_limit) {
+        if (limit < _quality_limit)
+            msg::inf(_("Video: rendering is too slow; reducing rendering quality to %d."), limit);
+        else
+            msg::inf(_("Video: increasing rendering quality to %d."), limit);
+        _quality_limit = limit;
+        _quality_good_windows = 0;
+    }
+    _quality_window_frames = 0;
+    _quality_window_late_frames = 0;
+}
+
+const parameters& video_output::quality_params()
+{
+    const parameters& params = _params.get();
+    if (!params.adaptive_quality() || params.quality() <= _quality_limit)
+        return params;
+    if (_quality_params_version != _params.version() || _quality_params.quality() != _quality_limit) {
+        _quality_params = params;
+        _quality_params.set_quality(_quality_limit);
+        _quality_params_version = _params.version();
+    }
+    return _quality_params;
+}
+
+void video_output::get_memory_stats(size_t *bytes)
+{
+    *bytes = _input_tex_bytes + _input_pbo_count * _input_pbo_size + _subtitle_pbo_size
+        + _subtitle_tex_bytes[0] + _subtitle_tex_bytes[1]
+        + _color_tex_bytes[0] + _color_tex_bytes[1];
+    for (int i = 0; i < 2; i++)
+        if (_render_cache_tex[i] != 0)
+            *bytes += tex_bytes(GL_RGBA8, _render_cache_tex_width, _render_cache_tex_height);
+    *bytes += _share_pbo_size[0] + _share_pbo_size[1];
+    if (_share_rb != 0)
+        *bytes += tex_bytes(GL_RGBA8, _share_rb_width, _share_rb_height);
+    for (size_t i = 0; i < _tex_pool.size(); i++)
+        *bytes += tex_bytes(_tex_pool[i].internal_format, _tex_pool[i].width, _tex_pool[i].height);
 }
 
 void video_output::activate_next_frame()
 {
     _active_index = (_active_index == 0 ? 1 : 0);
+    _render_cache_valid[0] = false;
+    _render_cache_valid[1] = false;
 }
 
 int64_t video_output::time_to_next_frame_presentation() const
 {
     return 0;
 }
+
+int64_t video_output::presentation_period() const
+{
+    return 0;
+}
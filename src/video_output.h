@@ -26,14 +26,15 @@
 
 #include <vector>
 #include <string>
+#include <map>
 
 #include <GL/glew.h>
 
-#include "base/blb.h"
-
 #include "media_data.h"
 #include "subtitle_renderer.h"
 #include "dispatch.h"
+#include "benchmark_stats.h"
+#include "frame_share.h"
 
 
 class subtitle_updater;
@@ -55,37 +56,170 @@ private:
     video_frame _frame[2];              // input frames (active / preparing)
     // Step 1: input of video data
     video_frame _input_last_frame;      // last frame for this step
-    GLuint _input_pbo;                  // pixel-buffer object for texture uploading
+    // A ring of pixel-buffer objects for texture uploading, so that writing the
+    // next frame does not have to wait until the GL has consumed the previous one.
+    // Each PBO holds all planes of all views of one frame.
+    static const int _input_pbo_count = 3;
+    GLuint _input_pbo[_input_pbo_count];        // pixel-buffer objects for texture uploading
+    GLsync _input_pbo_fence[_input_pbo_count];  // signaled when the GL is done with a PBO
+    void *_input_pbo_ptr[_input_pbo_count];     // persistent mapping (with ARB_buffer_storage)
+    size_t _input_pbo_size;                     // size of each PBO
+    int _input_pbo_index;                       // the PBO to use for the next frame
+    float _input_region[4];             // the part of the views to upload (x, y, w, h), relative to the view size
+    bool _input_region_is_set;          // whether set_input_region() was used; otherwise the region is automatic
+    int _input_view_region[2][4];       // the part of the views (x, y, w, h) that was uploaded for each frame, in pixels
+    bool _input_prev_valid;             // whether the input textures of the active frame still hold it, for deinterlacing
+    GLuint _subtitle_pbo;               // pixel-buffer object for subtitle uploading
+    size_t _subtitle_pbo_size;          // current size of the subtitle PBO
+    int64_t _upload_frames;             // number of uploaded frames, for statistics
+    int64_t _upload_time;               // time spent on uploads in microseconds, for statistics
     GLuint _input_fbo;                  // frame-buffer object for texture clearing
-    GLuint _input_yuv_y_tex[2];         // for yuv formats: y component
-    GLuint _input_yuv_u_tex[2];         // for yuv formats: u component
-    GLuint _input_yuv_v_tex[2];         // for yuv formats: v component
-    GLuint _input_bgra32_tex[2];        // for bgra32 format
+    // The input textures exist for both frames, so that the render step can read
+    // the active frame directly while the next frame is uploaded (see _render_fused).
+    // If input_tex_array() is true, the textures of view 0 are array textures that
+    // hold both views as layers, and the textures of view 1 are unused.
+    // If input_tex_packed() is true, the textures of view 0 hold the whole raw
+    // frame, and the textures of view 1 are unused.
+    GLuint _input_yuv_y_tex[2][2];      // for yuv formats: y component
+    GLuint _input_yuv_u_tex[2][2];      // for yuv formats: u component (or u and v, for yuv420sp)
+    GLuint _input_yuv_v_tex[2][2];      // for yuv formats: v component
+    GLuint _input_bgra32_tex[2][2];     // for bgra32 format
+    size_t _input_tex_bytes;            // memory of all input textures
     int _input_yuv_chroma_width_divisor;        // for yuv formats: chroma subsampling
     int _input_yuv_chroma_height_divisor;       // for yuv formats: chroma subsampling
+    bool _input_supports_vdpau_surfaces;        // whether VDPAU surfaces can be used as textures
+#if HAVE_LIBVDPAU
+    const void *_input_vdpau_device;    // the VDPAU device that the interop was initialized with
+    std::vector<uintptr_t> _input_vdpau_surfaces;               // registered VDPAU output surfaces
+    std::vector<GLvdpauSurfaceNV> _input_vdpau_gl_surfaces;     // GL handles of the registered surfaces
+    std::vector<GLuint> _input_vdpau_tex;                       // textures of the registered surfaces
+    GLvdpauSurfaceNV _input_vdpau_mapped[2];                    // surfaces mapped for the current frame
+#endif
     subtitle_box _subtitle[2];          // the current subtitle box
     GLuint _subtitle_tex[2];            // subtitle texture
+    size_t _subtitle_tex_bytes[2];      // memory of the subtitle textures
     bool _subtitle_tex_current[2];      // whether the subtitle tex contains the current subtitle buffer
+    int _subtitle_tex_bb[2][4];         // the area of the subtitle tex that is not transparent (x, y, w, h)
+    subtitle_box _subtitle_upcoming;    // the subtitle that follows the one of the next frame
     // Step 2: color space conversion and color correction
     parameters _color_last_params[2];   // last params for this step; used for reinitialization check
     video_frame _color_last_frame[2];   // last frame for this step; used for reinitialization check
     GLuint _color_prg[2];               // color space transformation, color adjustment
+    GLint _color_loc_input_layer[2];    // only with array input textures
+    GLint _color_loc_packed_view[2][4]; // only with packed input textures, see input_set_packed_view()
+    GLint _color_loc_deinterlace[2][2]; // only with deinterlacing: field_parity, have_prev
     GLuint _color_fbo;                  // framebuffer object to render into the sRGB texture
     GLuint _color_tex[2][2];            // output: SRGB8 or linear RGB16 texture
+    GLint _color_tex_format[2];         // internal format of the output textures
+    size_t _color_tex_bytes[2];         // memory of the output textures of both frames
     // Step 3: rendering
+    parameters_ref _params;             // parameter snapshot, updated for each frame
     parameters _render_params;          // current parameters for display
+    unsigned int _render_params_version; // version of the snapshot that _render_params was copied from
     parameters _render_last_params;     // last params for this step; used for reinitialization check
     video_frame _render_last_frame;     // last frame for this step; used for reinitialization check
     GLuint _render_prg;                 // reads sRGB texture, renders according to _params[_active_index]
+    bool _render_fused[2];              // whether the frame skips step 2 and is color converted by _render_prg
+    bool _render_last_fused;            // whether _render_prg includes the color conversion
+    // Locations of the _render_prg uniforms that change per frame, queried once in render_init()
+    GLint _render_loc_parallax;
+    GLint _render_loc_vertical_shift_left;
+    GLint _render_loc_vertical_shift_right;
+    GLint _render_loc_subtitle_parallax;
+    GLint _render_loc_color_matrix;
+    GLint _render_loc_crosstalk;
+    GLint _render_loc_step_x;
+    GLint _render_loc_step_y;
+    GLint _render_loc_channel;
+    GLint _render_loc_input_layer;      // only with array input textures
+    GLint _render_loc_packed_view[4];   // only with packed input textures
     GLuint _render_dummy_tex;           // an empty subtitle texture
     GLuint _render_mask_tex;            // for the masking modes even-odd-{rows,columns}, checkerboard
-    blob _3d_ready_sync_buf;            // for 3-D Ready Sync pixels
+    GLuint _transfer_lut_tex[2];        // sRGB transfer function tables: [0] to linear, [1] to sRGB
+    // Cache of the composited output, for the modes that redisplay the same
+    // frame on every output frame (see render_cache_applies())
+    GLuint _render_cache_fbo;
+    GLuint _render_cache_tex[2];        // one for each output frame parity in alternating mode
+    bool _render_cache_valid[2];
+    int _render_cache_tex_width;        // size of the cache textures, rounded up to a size class
+    int _render_cache_tex_height;
+    int _render_cache_width;            // the following describe what is in the cache
+    int _render_cache_height;
+    GLint _render_cache_viewport[2][4];
+    parameters::stereo_mode_t _render_cache_stereo_mode;
+    unsigned int _render_cache_params_version;
+    // Released color and render cache textures, for reuse by later textures of
+    // the same format and size. Reinitializing a step (e.g. when a parameter
+    // changes its shader) and resizing the window then do not reallocate them.
+    struct pooled_tex {
+        GLuint tex;
+        GLint internal_format;
+        int width, height;
+    };
+    static const size_t _tex_pool_size = 4;
+    std::vector<pooled_tex> _tex_pool;  // oldest first
+    // The framebuffer that the output is rendered into; 0 for the window system
+    // framebuffer. Tracked here so that intermediate passes can restore it
+    // without querying the GL.
+    GLuint _output_fbo;
+    GLuint _quad_vbo;                   // vertex buffer for draw_quad()
+    GLuint _quad_vao;                   // vertex array object for draw_quad(), if supported
     // OpenGL viewports and tex coordinates for drawing the two views of the video frame
     GLint _full_viewport[4];
+    GLint _display_span[4];             // see set_display_span(); all zero if unused
     GLint _viewport[2][4];
     float _tex_coords[2][4][2];
+    parameters _reshape_last_params;    // params that _viewport and _tex_coords were computed for
+    video_frame _reshape_last_frame;    // frame that _viewport and _tex_coords were computed for
+
+    std::map<std::string, GLuint> _program_cache;       // linked GL programs, by shader sources
+
+    // GPU timer queries for the stages benchmark_stats::gpu_color to gpu_sdi.
+    // Each stage has a ring of queries, so that a result is only read back
+    // when the GPU is done with it, a few frames later. Only one query can be
+    // active at a time, so a stage that runs inside another one is not measured.
+    static const int _gpu_stage_count = 4;
+    static const int _gpu_timer_count = 4;
+    bool _gpu_timer_supported;          // whether the GL supports timer queries
+    GLuint _gpu_timer_query[_gpu_stage_count][_gpu_timer_count];
+    bool _gpu_timer_pending[_gpu_stage_count][_gpu_timer_count];        // whether a result is still to be read
+    int _gpu_timer_index[_gpu_stage_count];     // the query to use next
+    int _gpu_timer_active;              // the stage that is measured now, or -1
+    int64_t _gpu_frames[_gpu_stage_count];      // number of measurements, for statistics
+    int64_t _gpu_time[_gpu_stage_count];        // measured GPU time in microseconds, for statistics
+
+    // Adaptive quality (see parameters::adaptive_quality()). The GPU times and
+    // late frames are evaluated in windows of frames.
+    int _quality_limit;                 // the highest quality that the GPU keeps up with
+    int _quality_window_frames;         // frames in the current window
+    int _quality_window_late_frames;    // late frames in the current window
+    int _quality_good_windows;          // consecutive windows with plenty of headroom
+    int64_t _quality_mark_gpu_frames[_gpu_stage_count]; // GPU time counters at the start of the window
+    int64_t _quality_mark_gpu_time[_gpu_stage_count];
+    parameters _quality_params;         // the parameter snapshot with the limited quality
+    unsigned int _quality_params_version;       // version of the snapshot that _quality_params was copied from
+    // The parameter snapshot, with the quality limited if adaptive quality is enabled.
+    const parameters& quality_params();
 
     subtitle_updater *_subtitle_updater;        // the subtitle updater thread
+
+    // Publishing of output frames to other applications; see frame_share.h.
+    // Frames are read back into pixel buffer objects and copied to shared
+    // memory one frame later, when the readback has completed.
+    frame_share _frame_share;
+    GLuint _share_fbo;                  // framebuffer for rendering the views separately
+    GLuint _share_rb;                   // its color renderbuffer
+    int _share_rb_width, _share_rb_height;
+    GLuint _share_pbo[2];
+    size_t _share_pbo_size[2];
+    GLsync _share_pbo_fence[2];         // signals readback completion, if GL_ARB_sync is available
+    int64_t _share_pbo_frameno[2];      // display frame number of the data in the PBO, or -1 if empty
+    int64_t _share_pbo_pts[2];          // presentation time of that frame
+    int _share_pbo_geometry[2][3];      // width, height, and views of that frame
+    int _share_pbo_index;               // the PBO that the next readback goes to
+    int64_t _last_shared_frameno;
+    void share_publish(int index);      // wait for the readback in PBO [index] and publish it
+    void share_deinit();
 #if HAVE_LIBXNVCTRL
     CNvSDIout *_nv_sdi_output;          // access the nvidia quadro sdi output card
     int64_t _last_nv_sdi_displayed_frameno;
@@ -100,9 +234,30 @@ private:
             const std::string& vshader_src, const std::string& fshader_src) const;
     void xglLinkProgram(const std::string& name, const GLuint prg) const;
     void xglDeleteProgram(GLuint prg) const;
+    GLuint xglGetProgram(const std::string& name,
+            const std::string& vshader_src, const std::string& fshader_src);
+    GLuint xglLoadProgramBinary(const std::string& name, const std::string& filename) const;
+    void xglSaveProgramBinary(const std::string& name, GLuint prg, const std::string& filename) const;
+    void xglClearProgramCache();
+
+    // Get a texture of the given format and size from the pool, or create
+    // one. Its contents are undefined. The texture is bound to GL_TEXTURE_2D.
+    GLuint tex_pool_get(GLint internal_format, int w, int h);
+    // Return a texture to the pool. This may delete the oldest pooled texture.
+    void tex_pool_put(GLuint tex, GLint internal_format, int w, int h);
+    void tex_pool_clear();
+
+    void gpu_timer_init();
+    void gpu_timer_deinit();
+    // Read the results of the finished queries of a stage
+    void gpu_timer_collect(int stage_index);
+    // Measure the GPU time of the GL commands between these calls
+    void gpu_timer_begin(benchmark_stats::stage_t stage);
+    void gpu_timer_end(benchmark_stats::stage_t stage);
 
     bool srgb8_textures_are_color_renderable();
 
+    void quad_setup_attribs() const;
     void draw_quad(float x, float y, float w, float h,
             const float tex_coords[2][4][2] = NULL,
             const float more_tex_coords[4][2] = NULL) const;
@@ -111,23 +266,73 @@ private:
     void input_init(const video_frame &frame);
     void input_deinit();
     bool input_is_compatible(const video_frame &current_frame);
+    int input_bytes_per_pixel(const video_frame &frame, int plane) const;
+    void input_plane_size(const video_frame &frame, int plane, int *w, int *h, int *row_size) const;
+    bool input_region_is_full() const;
+    // Restrict the upload to the part of the views that the current layout shows
+    void input_update_region(const video_frame &frame);
+    // The part of the plane to upload, in pixels of the plane, see set_input_region()
+    void input_plane_region(const video_frame &frame, int plane, int *x, int *y, int *w, int *h, int *row_size) const;
+    int input_raw_plane_height(const video_frame &frame, int plane) const;
+    size_t input_direct_upload_size(const video_frame &frame) const;
+    void input_map_surfaces(const video_frame &frame, GLuint tex[2]);
+    void input_unmap_surfaces(const video_frame &frame);
+    void input_surfaces_deinit();
+    // Whether the input textures of the frame are array textures with one layer per view,
+    // so that each plane is uploaded with one call and the views share one binding.
+    bool input_tex_array(const video_frame &frame) const;
+    // Whether the input textures of the frame have the size of the raw frame and hold
+    // both views side by side, so that each plane is uploaded in one piece and the
+    // shaders select the views via coordinate transformations.
+    bool input_tex_packed(const video_frame &frame) const;
+    // Set the uniforms that select the view in packed input textures. The locations
+    // are those of view_transform, view_bounds, chroma_view_transform, chroma_view_bounds.
+    void input_set_packed_view(const video_frame &frame, int view, const GLint loc[4]) const;
+    // The GLSL extension directives needed to read the input textures of the frame
+    std::string input_shader_extensions(const video_frame &frame) const;
+    void input_bind_textures(int index, int view);
+    // Bind the luma (or BGRA) texture of a view to texture unit 6, for motion-adaptive deinterlacing
+    void input_bind_prev_texture(int index, int view);
     void subtitle_init(int index);
     void subtitle_deinit(int index);
     // Step 2: initialize/deinitialize, and check if reinitialization is necessary
     void color_init(int index, const parameters& params, const video_frame &frame);
     void color_deinit(int index);
     bool color_is_compatible(int index, const parameters& params, const video_frame &current_frame);
+    std::string color_shader_src(int quality, parameters::deinterlacing_t deinterlacing,
+            const video_frame &frame, bool fused, std::string *storage);
+    // The deinterlacing method that the color conversion step applies to the frame
+    parameters::deinterlacing_t color_deinterlacing(const parameters& params, const video_frame &frame) const;
+    // Bind the table of an sRGB transfer function to texture unit 5, for quality 4
+    void transfer_lut_bind(bool to_srgb);
+    void color_convert(int index, const GLuint surface_tex[2]);
     // Step 3: initialize/deinitialize, and check if reinitialization is necessary
     void render_init();
     void render_deinit();
     bool render_needs_subtitle(const parameters& params);
     bool render_needs_coloradjust(const parameters& params);
     bool render_needs_ghostbust(const parameters& params);
+    bool render_needs_3d_ready_sync(const parameters& params);
+    void render_3d_ready_sync(int64_t display_frameno, int dst_width, int dst_height);
+    // The cache of the composited output
+    bool render_cache_applies(bool keep_viewport);
+    void render_cache_bind(int index, const GLint viewport[2][4], int dst_width, int dst_height);
+    void render_cache_blit(int index);
+    void render_cache_deinit();
     bool render_is_compatible();
+    bool render_can_fuse(const parameters& params, const video_frame &frame);
+    void render_set_channel(int channel, int left, int right);
 
 protected:
     subtitle_renderer _subtitle_renderer;
 
+    /* Restrict texture uploads of the following frames to the given part of the
+     * views, in relative coordinates of the texture (0 to 1). The rest of the input
+     * textures keeps stale data, so the region must include everything that is
+     * displayed. Without this, the region is derived from the cropping and zooming
+     * of the current layout while playing, and is the whole view otherwise. */
+    void set_input_region(float x, float y, float w, float h);
+
 #ifdef GLEW_MX
     virtual GLEWContext* glewGetContext() const = 0;
 #endif
@@ -143,8 +348,22 @@ protected:
     virtual void recreate_context(bool stereo) = 0;     // Recreate an OpenGL context and make it current
     virtual void trigger_resize(int w, int h) = 0;      // Trigger a resize the video area
 
+    // Set the framebuffer that the output is rendered into; the caller has to bind it.
+    void set_output_fbo(GLuint fbo) { _output_fbo = fbo; }
+
+    /* Show only a part of a larger display area: the views are laid out for an
+     * area of span_w x span_h pixels, and this output shows the part whose top
+     * left corner is at (x, y). This is used when each screen of a multi-screen
+     * fullscreen mode has its own output. A span of 0 x 0 shows the whole layout.
+     * Must be called from the thread that renders. */
+    void set_display_span(int x, int y, int span_w, int span_h);
+
     void clear() const;                         // Clear the video area
     void reshape(int w, int h, const parameters& params = dispatch::parameters());       // Call this when the video area was resized
+    // Compute the viewports and tex coordinates for the views of the current frame
+    // in an output area of size w x h.
+    void compute_layout(int w, int h, const parameters& params,
+            GLint viewport[2][4], float tex_coords[2][4][2]) const;
 
     /* Get screen properties (fixed) */
     virtual int screen_width() const = 0;       // in pixels
@@ -158,31 +377,32 @@ protected:
     virtual int pos_y() const = 0;              // in pixels
 
     /* Display the current frame.
-     * The first version is used by Equalizer, which needs to set some special properties.
-     * The second version is used by NVIDIA SDI output.
-     * The third version is for everyone else.
+     * The first version is used by Equalizer and NVIDIA SDI output, which need
+     * to set some special properties.
+     * The second version is for everyone else.
      * TODO: This function needs to handle interlaced frames! */
     void display_current_frame(int64_t display_frameno, bool keep_viewport, bool mono_right_instead_of_left,
             float x, float y, float w, float h,
             const GLint viewport[2][4], const float tex_coords[2][4][2],
             int dst_width, int dst_height,
             parameters::stereo_mode_t stereo_mode);
-    void display_current_frame(int64_t display_frameno, int dst_width, int dst_height, parameters::stereo_mode_t stereo_mode)
-    {
-        display_current_frame(display_frameno, false, false, -1.0f, -1.0f, 2.0f, 2.0f,
-                _viewport, _tex_coords, dst_width, dst_height, stereo_mode);
-    }
     void display_current_frame(int64_t display_frameno = 0)
     {
+        _params.update();
         display_current_frame(display_frameno, false, false, -1.0f, -1.0f, 2.0f, 2.0f,
                 _viewport, _tex_coords, full_display_width(), full_display_height(),
-                dispatch::parameters().stereo_mode());
+                _params.get().stereo_mode());
     }
 
 #if HAVE_LIBXNVCTRL
     void sdi_output(int64_t display_frameno = 0);
 #endif // HAVE_LIBXNVCTRL
 
+    /* Publish the current frame to other applications, if enabled (see
+     * frame_share.h). Call this after display_current_frame() and before the
+     * buffer swap, since the composited output is read from the back buffer. */
+    void share_frame(int64_t display_frameno);
+
 public:
     /* Constructor, Destructor */
     video_output();
@@ -194,6 +414,14 @@ public:
      * if the video has subtitles. Returns the number of microseconds that the
      * waiting took. */
     virtual int64_t wait_for_subtitle_renderer() = 0;
+    /* Start subtitle renderer initialization in the background, so that it is
+     * likely finished when the first subtitle needs to be shown. */
+    void start_subtitle_renderer();
+    /* Return whether subtitle renderer initialization is finished, without waiting. */
+    bool subtitle_renderer_is_initialized()
+    {
+        return _subtitle_renderer.is_initialized();
+    }
     /* Deinitialize the video output */
     virtual void deinit();
 
@@ -202,6 +430,7 @@ public:
 
     /* Get capabilities */
     virtual bool supports_stereo() const = 0;           // Is OpenGL quad buffered stereo available?
+    bool supports_surface(video_frame::surface_type_t type) const; // Can hardware surfaces of this type be displayed directly?
 
     /* Center video area on screen */
     virtual void center() = 0;
@@ -213,12 +442,35 @@ public:
     /* Process window system events (if applicable) */
     virtual void process_events() = 0;
     
+    /* Announce the subtitle that follows the one of the next prepared frame, so
+     * that it can be rendered in the background before it is needed. Call this
+     * before prepare_next_frame(). */
+    virtual void set_upcoming_subtitle(const subtitle_box &subtitle);
     /* Prepare a new frame for display. */
     virtual void prepare_next_frame(const video_frame &frame, const subtitle_box &subtitle);
     /* Switch to the next frame (make it the current one) */
     virtual void activate_next_frame();
     /* Get an estimation of when the next frame will appear on screen */
     virtual int64_t time_to_next_frame_presentation() const;
+    /* Get the interval between two opportunities to present a frame, i.e. the
+     * refresh period times the swap interval, in microseconds, or 0 if unknown */
+    virtual int64_t presentation_period() const;
+    /* Get the number of frames uploaded to the GL and the CPU time spent on
+     * that in microseconds since the output was initialized. */
+    void get_upload_stats(int64_t *frames, int64_t *time);
+    /* Get the number of GPU time measurements of the given stage (one of
+     * benchmark_stats::gpu_color to gpu_sdi) and the measured time in
+     * microseconds since the output was initialized. Both are zero if the
+     * GL does not support timer queries. */
+    void get_gpu_stats(benchmark_stats::stage_t stage, int64_t *frames, int64_t *time);
+    /* Report a displayed frame with its duration and its delay w.r.t. the
+     * master clock, both in microseconds. If adaptive quality is enabled,
+     * this steps the rendering quality down when the GPU leaves too little
+     * headroom, and back up when there is plenty of it. */
+    void adapt_quality(int64_t frame_duration, int64_t delay);
+    /* Get an estimation of the GL memory used for textures and pixel-buffer
+     * objects, in bytes. Drivers may add padding and internal copies. */
+    void get_memory_stats(size_t *bytes);
 };
 
 #endif
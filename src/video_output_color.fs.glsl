@@ -19,11 +19,13 @@
  */
 
 #version 110
+$extensions
 
 // quality: 0 .. 4
 #define quality $quality
 
 // layout_yuv_p
+// layout_yuv_sp
 // layout_bgra32
 #define $layout
 
@@ -36,6 +38,10 @@
 // value_range_8bit_mpeg
 // value_range_10bit_full
 // value_range_10bit_mpeg
+// value_range_12bit_full
+// value_range_12bit_mpeg
+// value_range_16bit_full
+// value_range_16bit_mpeg
 #define $value_range
 
 // the offset between the y texture coordinates and the appropriate
@@ -47,12 +53,62 @@
 // storage_linear_rgb
 #define $storage
 
+// pass_color: this is the color conversion pass, writing a color texture
+// pass_render: only the functions are used, inside the render pass
+#define $pass
+
+// deinterlace_off: show the frame as it is
+// deinterlace_bob: interpolate the lines of the second field from the first field
+// deinterlace_adaptive: like bob, but only where the picture moved since the previous frame
+#define $deinterlace
+
+// the height of a view in texels, to find the field of a texel row
+#define view_height $view_height
+
+// input_tex_2d: each view has its own input textures
+// input_tex_array: the views are layers of array textures (GL_EXT_texture_array)
+// input_tex_packed: the views are next to each other in textures of the raw frame size
+#define $input_tex
+
+#if defined(input_tex_array)
+uniform float input_layer;
+# define input_sampler sampler2DArray
+# define input_texture(tex, coord) texture2DArray(tex, vec3(coord, input_layer))
+#else
+# define input_sampler sampler2D
+# define input_texture(tex, coord) texture2D(tex, coord)
+#endif
+
+#if defined(input_tex_packed)
+// Transformation (scale in xy, offset in zw) from view coordinates to the
+// coordinates of the current view in the textures, and the texel centers at
+// the border of the view (min in xy, max in zw), so that linear filtering does
+// not pick up texels of the other view. Subsampled chroma textures need their
+// own values.
+uniform vec4 view_transform;
+uniform vec4 view_bounds;
+uniform vec4 chroma_view_transform;
+uniform vec4 chroma_view_bounds;
+vec2 packed_coord(vec4 transform, vec4 bounds, vec2 coord)
+{
+    return clamp(coord * transform.xy + transform.zw, bounds.xy, bounds.zw);
+}
+# define view_coord(coord) packed_coord(view_transform, view_bounds, coord)
+# define chroma_view_coord(coord) packed_coord(chroma_view_transform, chroma_view_bounds, coord)
+#else
+# define view_coord(coord) (coord)
+# define chroma_view_coord(coord) (coord)
+#endif
+
 #if defined(layout_yuv_p)
-uniform sampler2D y_tex;
-uniform sampler2D u_tex;
-uniform sampler2D v_tex;
+uniform input_sampler y_tex;
+uniform input_sampler u_tex;
+uniform input_sampler v_tex;
+#elif defined(layout_yuv_sp)
+uniform input_sampler y_tex;
+uniform input_sampler uv_tex;
 #elif defined(layout_bgra32)
-uniform sampler2D srgb_tex;
+uniform input_sampler srgb_tex;
 #endif
 
 /* The YUV triplets used internally in this shader use the following
@@ -71,6 +127,10 @@ vec3 yuv_to_srgb(vec3 yuv)
     yuv = (yuv - vec3(16.0 / 255.0)) * vec3(256.0 / 220.0, 256.0 / 225.0, 256.0 / 225.0);
 # elif defined(value_range_10bit_mpeg)
     yuv = (yuv - vec3(64.0 / 1023.0)) * vec3(1024.0 / 877.0, 1024.0 / 897.0, 1024.0 / 897.0);
+# elif defined(value_range_12bit_mpeg)
+    yuv = (yuv - vec3(256.0 / 4095.0)) * vec3(4096.0 / 3505.0, 4096.0 / 3585.0, 4096.0 / 3585.0);
+# elif defined(value_range_16bit_mpeg)
+    yuv = (yuv - vec3(4096.0 / 65535.0)) * vec3(65536.0 / 56065.0, 65536.0 / 57345.0, 65536.0 / 57345.0);
 # endif
 
 # if defined(color_space_yuv709)
@@ -93,17 +153,16 @@ vec3 yuv_to_srgb(vec3 yuv)
 
 #if defined(storage_linear_rgb)
 # if quality >= 4
-// See GL_ARB_framebuffer_sRGB extension
-float nonlinear_to_linear(float x)
-{
-    return (x <= 0.04045 ? (x / 12.92) : pow((x + 0.055) / 1.055, 2.4));
-}
+// Correct variant, see GL_ARB_framebuffer_sRGB extension. The transfer
+// function is precomputed in a table; see video_output::transfer_lut_bind().
+uniform sampler1D to_linear_lut;
 vec3 srgb_to_rgb(vec3 srgb)
 {
-    float r = nonlinear_to_linear(srgb.r);
-    float g = nonlinear_to_linear(srgb.g);
-    float b = nonlinear_to_linear(srgb.b);
-    return vec3(r, g, b);
+    vec3 t = srgb * (($transfer_lut_size - 1.0) / $transfer_lut_size) + 0.5 / $transfer_lut_size;
+    return vec3(
+            texture1D(to_linear_lut, t.r).x,
+            texture1D(to_linear_lut, t.g).x,
+            texture1D(to_linear_lut, t.b).x);
 }
 # elif quality >= 2
 vec3 srgb_to_rgb(vec3 srgb)
@@ -118,30 +177,107 @@ vec3 srgb_to_rgb(vec3 srgb)
 # endif
 #endif
 
+#if !defined(layout_bgra32)
+vec3 get_yuv(vec2 tex_coord)
+{
+    vec2 chroma_tex_coord = chroma_view_coord(tex_coord + vec2(chroma_offset_x, chroma_offset_y));
+    tex_coord = view_coord(tex_coord);
+# if defined(layout_yuv_sp)
+    // U and V are interleaved in a luminance-alpha texture
+    vec4 uv = input_texture(uv_tex, chroma_tex_coord);
+    return vec3(input_texture(y_tex, tex_coord).x, uv.x, uv.a);
+# else
+    return vec3(
+            input_texture(y_tex, tex_coord).x,
+            input_texture(u_tex, chroma_tex_coord).x,
+            input_texture(v_tex, chroma_tex_coord).x);
+# endif
+}
+#endif
+
 vec3 get_srgb(vec2 tex_coord)
 {
 #if defined(layout_bgra32)
-    return texture2D(srgb_tex, tex_coord).xyz;
-#elif defined(value_range_8bit_full) || defined(value_range_8bit_mpeg)
-    return yuv_to_srgb(vec3(
-                texture2D(y_tex, tex_coord).x,
-                texture2D(u_tex, tex_coord + vec2(chroma_offset_x, chroma_offset_y)).x,
-                texture2D(v_tex, tex_coord + vec2(chroma_offset_x, chroma_offset_y)).x));
+    return input_texture(srgb_tex, view_coord(tex_coord)).xyz;
+#elif defined(value_range_10bit_full) || defined(value_range_10bit_mpeg)
+    // The samples are stored in the low bits of 16 bit values
+    return yuv_to_srgb((65535.0 / 1023.0) * get_yuv(tex_coord));
+#elif defined(value_range_12bit_full) || defined(value_range_12bit_mpeg)
+    return yuv_to_srgb((65535.0 / 4095.0) * get_yuv(tex_coord));
 #else
-    return yuv_to_srgb((65535.0 / 1023.0) * vec3(
-                texture2D(y_tex, tex_coord).x,
-                texture2D(u_tex, tex_coord + vec2(chroma_offset_x, chroma_offset_y)).x,
-                texture2D(v_tex, tex_coord + vec2(chroma_offset_x, chroma_offset_y)).x));
+    return yuv_to_srgb(get_yuv(tex_coord));
 #endif
 }
 
+#if defined(deinterlace_bob) || defined(deinterlace_adaptive)
+// The parity of the texel rows of the field that is kept: 0 = even, 1 = odd
+uniform float field_parity;
+# if defined(deinterlace_adaptive)
+// The luma (or BGRA) texture of the previous frame, and whether it is valid
+uniform input_sampler prev_tex;
+uniform float have_prev;
+
+float get_luma(vec2 tex_coord)
+{
+#  if defined(layout_bgra32)
+    return dot(input_texture(srgb_tex, view_coord(tex_coord)).xyz, vec3(0.299, 0.587, 0.114));
+#  else
+    return input_texture(y_tex, view_coord(tex_coord)).x;
+#  endif
+}
+
+float get_prev_luma(vec2 tex_coord)
+{
+#  if defined(layout_bgra32)
+    return dot(input_texture(prev_tex, view_coord(tex_coord)).xyz, vec3(0.299, 0.587, 0.114));
+#  else
+    return input_texture(prev_tex, view_coord(tex_coord)).x;
+#  endif
+}
+# endif
+
+vec3 get_deinterlaced_srgb(vec2 tex_coord)
+{
+    float row = floor(tex_coord.y * view_height);
+    if (mod(row, 2.0) == field_parity)
+        return get_srgb(tex_coord);
+    // This row belongs to the second field: interpolate it from the rows of the first field
+    vec2 dy = vec2(0.0, 1.0 / view_height);
+    vec3 interpolated = 0.5 * (get_srgb(tex_coord - dy) + get_srgb(tex_coord + dy));
+# if defined(deinterlace_adaptive)
+    // Like yadif, keep the original row where neither it nor the rows above
+    // and below changed since the previous frame.
+    float motion = 1.0;
+    if (have_prev > 0.5) {
+#  if defined(value_range_10bit_full) || defined(value_range_10bit_mpeg)
+        float scale = 65535.0 / 1023.0;
+#  elif defined(value_range_12bit_full) || defined(value_range_12bit_mpeg)
+        float scale = 65535.0 / 4095.0;
+#  else
+        float scale = 1.0;
+#  endif
+        motion = scale * max(abs(get_luma(tex_coord) - get_prev_luma(tex_coord)),
+                0.5 * (abs(get_luma(tex_coord - dy) - get_prev_luma(tex_coord - dy))
+                    + abs(get_luma(tex_coord + dy) - get_prev_luma(tex_coord + dy))));
+    }
+    return mix(get_srgb(tex_coord), interpolated, smoothstep(0.01, 0.04, motion));
+# else
+    return interpolated;
+# endif
+}
+#else
+# define get_deinterlaced_srgb(tex_coord) get_srgb(tex_coord)
+#endif
+
+#if defined(pass_color)
 void main()
 {
-    vec3 srgb = get_srgb(gl_TexCoord[0].xy);
-#if defined(storage_srgb)
+    vec3 srgb = get_deinterlaced_srgb(gl_TexCoord[0].xy);
+# if defined(storage_srgb)
     gl_FragColor = vec4(srgb, 1.0);
-#else
+# else
     vec3 rgb = srgb_to_rgb(srgb);
     gl_FragColor = vec4(rgb, 1.0);
-#endif
+# endif
 }
+#endif
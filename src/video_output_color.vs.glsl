@@ -0,0 +1,33 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010, 2011, 2012
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#version 110
+
+// The color conversion pass draws in normalized device coordinates, so it
+// does not depend on the current modelview and projection matrices.
+
+attribute vec2 position;
+attribute vec2 texcoord0;
+
+void main()
+{
+    gl_Position = vec4(position, 0.0, 1.0);
+    gl_TexCoord[0] = vec4(texcoord0, 0.0, 1.0);
+}
@@ -0,0 +1,569 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010, 2011, 2012, 2013, 2015, 2016, 2018
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+extern "C"
+{
+#define __STDC_CONSTANT_MACROS
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>     // for usleep()
+
+#include <GL/glew.h>
+
+#include <QtGlobal>
+#if QT_VERSION >= 0x050000
+# include <QOffscreenSurface>
+# include <QOpenGLContext>
+#else
+# include <QGLPixelBuffer>
+#endif
+
+#include "base/dbg.h"
+#include "base/blb.h"
+#include "base/exc.h"
+#include "base/msg.h"
+#include "base/str.h"
+#include "base/tmr.h"
+
+#include "base/gettext.h"
+#define _(string) gettext(string)
+
+#include "dispatch.h"
+#include "media_input.h"
+#include "video_output_file.h"
+#include "benchmark_stats.h"
+
+
+/* The FFmpeg side: encode BGRA frames into a video file. */
+
+struct video_output_file_encoder
+{
+    AVFormatContext *format_ctx;
+    AVStream *stream;
+    AVCodecContext *codec_ctx;
+    bool codec_opened;
+    bool header_written;
+    AVFrame *frame;
+    uint8_t *frame_buffer;
+    SwsContext *sws_ctx;
+    int width, height;
+};
+
+static std::string my_av_strerror(int err)
+{
+    blob b(1024);
+    av_strerror(err, b.ptr<char>(), b.size());
+    return std::string(b.ptr<const char>());
+}
+
+static void encoder_close(video_output_file_encoder *enc)
+{
+    if (enc->header_written)
+        av_write_trailer(enc->format_ctx);
+    if (enc->codec_opened)
+        avcodec_close(enc->codec_ctx);
+    if (enc->format_ctx) {
+        if (enc->format_ctx->pb && !(enc->format_ctx->oformat->flags & AVFMT_NOFILE))
+            avio_close(enc->format_ctx->pb);
+        avformat_free_context(enc->format_ctx);
+    }
+    if (enc->sws_ctx)
+        sws_freeContext(enc->sws_ctx);
+    av_free(enc->frame_buffer);
+    av_free(enc->frame);
+    delete enc;
+}
+
+static video_output_file_encoder *encoder_open(const std::string &file_name,
+        int width, int height, int rate_num, int rate_den)
+{
+    video_output_file_encoder *enc = new video_output_file_encoder;
+    std::memset(enc, 0, sizeof(*enc));
+    enc->width = width;
+    enc->height = height;
+    try {
+        int e = avformat_alloc_output_context2(&enc->format_ctx, NULL, NULL, file_name.c_str());
+        if (e < 0 || !enc->format_ctx) {
+            throw exc(str::asprintf(_("%s: Cannot determine output format: %s"), file_name.c_str(),
+                        e < 0 ? my_av_strerror(e).c_str() : _("unknown file name extension")));
+        }
+        enum AVCodecID codec_id = av_guess_codec(enc->format_ctx->oformat, NULL,
+                file_name.c_str(), NULL, AVMEDIA_TYPE_VIDEO);
+        AVCodec *codec = avcodec_find_encoder(codec_id);
+        if (!codec) {
+            throw exc(str::asprintf(_("%s: No video encoder available for this format."), file_name.c_str()));
+        }
+        enc->stream = avformat_new_stream(enc->format_ctx, codec);
+        if (!enc->stream) {
+            throw exc(HERE + ": " + strerror(ENOMEM));
+        }
+        enc->codec_ctx = enc->stream->codec;
+        enc->codec_ctx->codec_id = codec_id;
+        enc->codec_ctx->codec_type = AVMEDIA_TYPE_VIDEO;
+        enc->codec_ctx->width = width;
+        enc->codec_ctx->height = height;
+        enc->codec_ctx->time_base.num = rate_den;
+        enc->codec_ctx->time_base.den = rate_num;
+        enc->stream->time_base = enc->codec_ctx->time_base;
+        enc->codec_ctx->pix_fmt = (codec->pix_fmts ? codec->pix_fmts[0] : AV_PIX_FMT_YUV420P);
+        if (enc->format_ctx->oformat->flags & AVFMT_GLOBALHEADER)
+            enc->codec_ctx->flags |= CODEC_FLAG_GLOBAL_HEADER;
+        if ((e = avcodec_open2(enc->codec_ctx, codec, NULL)) < 0) {
+            throw exc(str::asprintf(_("%s: Cannot open video encoder: %s"),
+                        file_name.c_str(), my_av_strerror(e).c_str()));
+        }
+        enc->codec_opened = true;
+        if (!(enc->format_ctx->oformat->flags & AVFMT_NOFILE)
+                && (e = avio_open(&enc->format_ctx->pb, file_name.c_str(), AVIO_FLAG_WRITE)) < 0) {
+            throw exc(str::asprintf(_("%s: %s"), file_name.c_str(), my_av_strerror(e).c_str()));
+        }
+        if ((e = avformat_write_header(enc->format_ctx, NULL)) < 0) {
+            throw exc(str::asprintf(_("%s: Cannot write header: %s"),
+                        file_name.c_str(), my_av_strerror(e).c_str()));
+        }
+        enc->header_written = true;
+        // The frame that is passed to the encoder, and the converter that fills it.
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(55, 28, 1)
+        enc->frame = avcodec_alloc_frame();
+#else
+        enc->frame = av_frame_alloc();
+#endif
+        enc->frame_buffer = static_cast<uint8_t *>(av_malloc(
+                    avpicture_get_size(enc->codec_ctx->pix_fmt, width, height)));
+        if (!enc->frame || !enc->frame_buffer) {
+            throw exc(HERE + ": " + strerror(ENOMEM));
+        }
+        avpicture_fill(reinterpret_cast<AVPicture *>(enc->frame), enc->frame_buffer,
+                enc->codec_ctx->pix_fmt, width, height);
+        enc->frame->format = enc->codec_ctx->pix_fmt;
+        enc->frame->width = width;
+        enc->frame->height = height;
+        enc->sws_ctx = sws_getContext(width, height, AV_PIX_FMT_BGRA,
+                width, height, enc->codec_ctx->pix_fmt, SWS_POINT, NULL, NULL, NULL);
+        if (!enc->sws_ctx) {
+            throw exc(str::asprintf(_("%s: Cannot initialize conversion context."), file_name.c_str()));
+        }
+    }
+    catch (...) {
+        encoder_close(enc);
+        throw;
+    }
+    return enc;
+}
+
+/* Encode the given frame; its rows are stored bottom-up as read by glReadPixels.
+ * If data is NULL, delayed frames are flushed from the encoder. Returns whether
+ * a packet was written. */
+static bool encoder_write(video_output_file_encoder *enc, const void *data, int64_t pts)
+{
+    AVFrame *frame = NULL;
+    if (data) {
+        int src_stride[1] = { -4 * enc->width };
+        const uint8_t *src[1] = { static_cast<const uint8_t *>(data) + 4 * enc->width * (enc->height - 1) };
+        sws_scale(enc->sws_ctx, src, src_stride, 0, enc->height, enc->frame->data, enc->frame->linesize);
+        enc->frame->pts = pts;
+        frame = enc->frame;
+    }
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+    int got_packet = 0;
+    int e = avcodec_encode_video2(enc->codec_ctx, &packet, frame, &got_packet);
+    if (e < 0) {
+        throw exc(str::asprintf(_("Cannot encode video frame: %s"), my_av_strerror(e).c_str()));
+    }
+    if (got_packet) {
+        av_packet_rescale_ts(&packet, enc->codec_ctx->time_base, enc->stream->time_base);
+        packet.stream_index = enc->stream->index;
+        e = av_interleaved_write_frame(enc->format_ctx, &packet);
+        av_free_packet(&packet);
+        if (e < 0) {
+            throw exc(str::asprintf(_("Cannot write video frame: %s"), my_av_strerror(e).c_str()));
+        }
+    }
+    return got_packet;
+}
+
+
+/* The OpenGL side. */
+
+video_output_file::video_output_file(const std::string& file_name) :
+    video_output(),
+    _file_name(file_name),
+#if QT_VERSION >= 0x050000
+    _surface(NULL),
+    _context(NULL),
+#else
+    _pbuffer(NULL),
+#endif
+    _initialized(false),
+    _width(64), _height(64),
+    _fbo(0), _fbo_rb(0),
+    _pbo_index(0),
+    _frameno(0),
+    _encoder(NULL)
+{
+    for (int i = 0; i < 2; i++) {
+        _pbo[i] = 0;
+        _pbo_fence[i] = 0;
+        _pbo_frameno[i] = -1;
+    }
+}
+
+video_output_file::~video_output_file()
+{
+    deinit();
+}
+
+#ifdef GLEW_MX
+GLEWContext* video_output_file::glewGetContext() const
+{
+    return const_cast<GLEWContext*>(&_glew_context);
+}
+#endif
+
+void video_output_file::make_current()
+{
+#if QT_VERSION >= 0x050000
+    _context->makeCurrent(_surface);
+#else
+    _pbuffer->makeCurrent();
+#endif
+}
+
+void video_output_file::init()
+{
+    if (!_initialized) {
+        // We never render into the window system framebuffer, so a minimal
+        // surface is enough. Qt5 can provide one without a display, e.g. with
+        // QT_QPA_PLATFORM=offscreen or eglfs.
+#if QT_VERSION >= 0x050000
+        _context = new QOpenGLContext();
+        if (!_context->create())
+            throw exc(_("Cannot create an OpenGL context."));
+        _surface = new QOffscreenSurface();
+        _surface->setFormat(_context->format());
+        _surface->create();
+        if (!_surface->isValid())
+            throw exc(_("Cannot create an offscreen OpenGL surface."));
+#else
+        _pbuffer = new QGLPixelBuffer(16, 16);
+        if (!_pbuffer->isValid())
+            throw exc(_("Cannot create an offscreen OpenGL surface."));
+#endif
+        make_current();
+        glewExperimental = GL_TRUE;
+        GLenum err = glewInit();
+        if (err != GLEW_OK) {
+            throw exc(str::asprintf(_("Cannot initialize GLEW: %s"),
+                        reinterpret_cast<const char *>(glewGetErrorString(err))));
+        }
+        // See video_output_qt::init(). Rendering into our own framebuffer
+        // needs nothing beyond that.
+        if (!glewIsSupported("GL_VERSION_1_3 "
+                    "GL_ARB_shader_objects GL_ARB_fragment_shader "
+                    "GL_ARB_texture_non_power_of_two "
+                    "GL_ARB_pixel_buffer_object "
+                    "GL_EXT_framebuffer_object")) {
+            throw exc(std::string(_("This OpenGL implementation does not support required features.")));
+        }
+        video_output::init();
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        _pbo_index = 0;
+        _frameno = 0;
+        _initialized = true;
+    }
+}
+
+int64_t video_output_file::wait_for_subtitle_renderer()
+{
+    if (_subtitle_renderer.is_initialized())
+        return 0;
+    int64_t wait_start = timer::get(timer::monotonic);
+    msg::wrn(_("Waiting for subtitle renderer initialization..."));
+    while (!_subtitle_renderer.is_initialized())
+        usleep(10000);
+    return timer::get(timer::monotonic) - wait_start;
+}
+
+void video_output_file::deinit()
+{
+    if (_initialized) {
+        make_current();
+        if (_encoder) {
+            try {
+                // Encode the frame whose readback is still in flight, and
+                // the frames that the encoder delayed.
+                encode_pbo(1 - _pbo_index);
+                while (encoder_write(_encoder, NULL, 0))
+                    ;
+                msg::inf(_("Wrote %s frames to %s."), str::from(_frameno).c_str(), _file_name.c_str());
+            }
+            catch (std::exception& e) {
+                msg::err("%s", e.what());
+            }
+            encoder_close(_encoder);
+            _encoder = NULL;
+        }
+        fbo_deinit();
+        video_output::deinit();
+#if QT_VERSION >= 0x050000
+        _context->doneCurrent();
+        delete _surface;
+        _surface = NULL;
+        delete _context;
+        _context = NULL;
+#else
+        _pbuffer->doneCurrent();
+        delete _pbuffer;
+        _pbuffer = NULL;
+#endif
+        _initialized = false;
+    }
+}
+
+void video_output_file::fbo_init()
+{
+    glGenRenderbuffersEXT(1, &_fbo_rb);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, _fbo_rb);
+    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGBA8, _width, _height);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, 0);
+    glGenFramebuffersEXT(1, &_fbo);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _fbo);
+    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_RENDERBUFFER_EXT, _fbo_rb);
+    if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT)
+        throw exc(_("Cannot create the output framebuffer."));
+    glGenBuffers(2, _pbo);
+    for (int i = 0; i < 2; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, _pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 4 * _width * _height, NULL, GL_STREAM_READ);
+        _pbo_frameno[i] = -1;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    set_output_fbo(_fbo);
+    reshape(_width, _height);
+}
+
+void video_output_file::fbo_deinit()
+{
+    for (int i = 0; i < 2; i++) {
+        if (_pbo_fence[i]) {
+            glDeleteSync(_pbo_fence[i]);
+            _pbo_fence[i] = 0;
+        }
+        _pbo_frameno[i] = -1;
+    }
+    if (_pbo[0]) {
+        glDeleteBuffers(2, _pbo);
+        _pbo[0] = _pbo[1] = 0;
+    }
+    if (_fbo) {
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+        glDeleteFramebuffersEXT(1, &_fbo);
+        _fbo = 0;
+    }
+    if (_fbo_rb) {
+        glDeleteRenderbuffersEXT(1, &_fbo_rb);
+        _fbo_rb = 0;
+    }
+    set_output_fbo(0);
+}
+
+void video_output_file::encode_pbo(int index)
+{
+    if (_pbo_frameno[index] < 0)
+        return;
+    if (_pbo_fence[index]) {
+        glClientWaitSync(_pbo_fence[index], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(_pbo_fence[index]);
+        _pbo_fence[index] = 0;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _pbo[index]);
+    const void *data = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (!data) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        throw exc(_("Cannot map the pixel buffer object."));
+    }
+    try {
+        encoder_write(_encoder, data, _pbo_frameno[index]);
+    }
+    catch (...) {
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        throw;
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    _pbo_frameno[index] = -1;
+}
+
+void video_output_file::activate_next_frame()
+{
+    video_output::activate_next_frame();
+    if (!_fbo) {
+        // The output size is fixed from the first frame on.
+        fbo_init();
+    }
+    if (!_encoder && !_file_name.empty()) {
+        const media_input *input = dispatch::media_input();
+        int rate_num = (input ? input->video_frame_rate_numerator() : 0);
+        int rate_den = (input ? input->video_frame_rate_denominator() : 0);
+        if (rate_num <= 0 || rate_den <= 0) {
+            rate_num = 25;
+            rate_den = 1;
+        }
+        _encoder = encoder_open(_file_name, _width, _height, rate_num, rate_den);
+        msg::inf(_("Writing %dx%d video to %s."), _width, _height, _file_name.c_str());
+    }
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _fbo);
+    int64_t render_start = timer::get(timer::monotonic);
+    display_current_frame(_frameno);
+    benchmark_stats::add(benchmark_stats::render, timer::get(timer::monotonic) - render_start);
+    if (!_encoder) {
+        _frameno++;
+        return;
+    }
+    // Start the readback of this frame. It completes while we encode the
+    // previous frame and the player prepares the next one.
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _pbo[_pbo_index]);
+    glReadPixels(0, 0, _width, _height, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+    if (GLEW_ARB_sync)
+        _pbo_fence[_pbo_index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glFlush();
+    _pbo_frameno[_pbo_index] = _frameno++;
+    _pbo_index = 1 - _pbo_index;
+    encode_pbo(_pbo_index);
+}
+
+int64_t video_output_file::time_to_next_frame_presentation() const
+{
+    return 0;
+}
+
+bool video_output_file::context_is_stereo() const
+{
+    return false;
+}
+
+void video_output_file::recreate_context(bool stereo)
+{
+    if (stereo)
+        throw exc(_("OpenGL stereo mode is not available when writing to a file."));
+}
+
+void video_output_file::trigger_resize(int w, int h)
+{
+    // The size can only change until the framebuffer is created. Most encoders
+    // require even dimensions for their subsampled chroma planes.
+    if (!_fbo) {
+        _width = std::max(w & ~1, 2);
+        _height = std::max(h & ~1, 2);
+    }
+}
+
+int video_output_file::screen_width() const
+{
+    // There is no screen that limits the video size.
+    return 16384;
+}
+
+int video_output_file::screen_height() const
+{
+    return 16384;
+}
+
+float video_output_file::screen_pixel_aspect_ratio() const
+{
+    return 1.0f;
+}
+
+int video_output_file::width() const
+{
+    return _width;
+}
+
+int video_output_file::height() const
+{
+    return _height;
+}
+
+int video_output_file::pos_x() const
+{
+    return 0;
+}
+
+int video_output_file::pos_y() const
+{
+    return 0;
+}
+
+bool video_output_file::supports_stereo() const
+{
+    return false;
+}
+
+void video_output_file::center()
+{
+}
+
+void video_output_file::enter_fullscreen()
+{
+}
+
+void video_output_file::exit_fullscreen()
+{
+}
+
+void video_output_file::process_events()
+{
+}
+
+static bool global_quit_request;
+
+class file_quit_controller : public controller
+{
+    virtual void receive_notification(const notification& note)
+    {
+        if (note.type == notification::quit)
+            global_quit_request = true;
+    }
+};
+
+void video_output_file::mainloop()
+{
+    global_quit_request = false;
+    file_quit_controller qc;
+    while (!global_quit_request) {
+        dispatch::step();
+        dispatch::process_all_events();
+    }
+}
@@ -0,0 +1,123 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010, 2011, 2012, 2013, 2015, 2016, 2018
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VIDEO_OUTPUT_FILE_H
+#define VIDEO_OUTPUT_FILE_H
+
+#include "config.h"
+
+#include <string>
+
+#include <GL/glew.h>
+
+#include <QtGlobal>
+#if QT_VERSION >= 0x050000
+class QOffscreenSurface;
+class QOpenGLContext;
+#else
+class QGLPixelBuffer;
+#endif
+
+#include "video_output.h"
+
+struct video_output_file_encoder;
+
+/* A video output that renders into an offscreen framebuffer instead of a
+ * window and encodes the result into a video file. No window system surface
+ * is needed; the player runs as fast as possible, like in benchmark mode.
+ * The rendered frames are read back asynchronously via pixel buffer objects,
+ * so that the readback of one frame overlaps with the rendering of the next.
+ * With an empty file name, the frames are only rendered; the micro benchmarks
+ * use this to measure the OpenGL passes. */
+
+class video_output_file : public video_output
+{
+    friend class micro_benchmark;
+
+private:
+#ifdef GLEW_MX
+    GLEWContext _glew_context;
+#endif
+    std::string _file_name;
+#if QT_VERSION >= 0x050000
+    QOffscreenSurface *_surface;
+    QOpenGLContext *_context;
+#else
+    QGLPixelBuffer *_pbuffer;
+#endif
+    bool _initialized;
+    int _width, _height;                // size of the output video
+    GLuint _fbo;                        // the framebuffer we render into
+    GLuint _fbo_rb;                     // its color renderbuffer
+    GLuint _pbo[2];                     // pixel buffer objects for asynchronous readback
+    GLsync _pbo_fence[2];               // signals readback completion, if GL_ARB_sync is available
+    int64_t _pbo_frameno[2];            // output frame number of the data in the PBO, or -1 if empty
+    int _pbo_index;                     // the PBO that the next readback goes to
+    int64_t _frameno;                   // number of frames rendered
+    video_output_file_encoder *_encoder;
+
+    void make_current();
+    void fbo_init();
+    void fbo_deinit();
+    void encode_pbo(int index);         // wait for the readback in PBO [index] and encode it
+
+protected:
+#ifdef GLEW_MX
+    virtual GLEWContext* glewGetContext() const;
+#endif
+    virtual bool context_is_stereo() const;
+    virtual void recreate_context(bool stereo);
+    virtual void trigger_resize(int w, int h);
+
+    virtual int screen_width() const;
+    virtual int screen_height() const;
+    virtual float screen_pixel_aspect_ratio() const;
+    virtual int width() const;
+    virtual int height() const;
+    virtual int pos_x() const;
+    virtual int pos_y() const;
+
+public:
+    /* Constructor, Destructor */
+    /* The format and codec are guessed from the file name. */
+    video_output_file(const std::string& file_name);
+    virtual ~video_output_file();
+
+    virtual void init();
+    virtual int64_t wait_for_subtitle_renderer();
+    virtual void deinit();
+
+    virtual bool supports_stereo() const;
+
+    virtual void center();
+    virtual void enter_fullscreen();
+    virtual void exit_fullscreen();
+
+    virtual void activate_next_frame();
+    virtual int64_t time_to_next_frame_presentation() const;
+
+    virtual void process_events();
+
+    /* Run the play loop until a quit notification arrives. This replaces
+     * the Qt event loop when rendering to a file. */
+    static void mainloop();
+};
+
+#endif
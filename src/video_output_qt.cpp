@@ -59,14 +59,19 @@
 #include "base/str.h"
 #include "base/dbg.h"
 #include "base/tmr.h"
+#include "base/trc.h"
 
 #include "base/gettext.h"
 #define _(string) gettext(string)
 
 #include "video_output_qt.h"
+#include "benchmark_stats.h"
 #include "lib_versions.h"
 
 
+extern dispatch* global_dispatch;
+
+
 /* The GL thread */
 
 gl_thread::gl_thread(video_output_qt* vo_qt, video_output_qt_widget* vo_qt_widget) :
@@ -75,9 +80,14 @@ gl_thread::gl_thread(video_output_qt* vo_qt, video_output_qt_widget* vo_qt_widge
     _action_activate(false),
     _action_prepare(false),
     _action_finished(false),
+    _span_changed(false),
     _failure(false),
-    _display_frameno(0)
+    _display_frameno(0),
+    _frame_fence(0),
+    _timing()
 {
+    presentation_timing timing = { -1, 0 };
+    _timing.write(timing);
 }
 
 #ifdef GLEW_MX
@@ -87,63 +97,159 @@ GLXEWContext* gl_thread::glxewGetContext() const
     return _vo_qt->glxewGetContext();
 }
 # endif
+GLEWContext* gl_thread::glewGetContext() const
+{
+    return _vo_qt->glewGetContext();
+}
 #endif
 
+void gl_thread::wait_for_frame_fence()
+{
+    // Wait until the GL has finished the commands of the previous frame
+    // before queueing the next one. Without this, the driver may buffer
+    // several frames and then block at an unpredictable point (typically
+    // inside a later buffer swap or texture upload), which shows up as
+    // frame time jitter.
+    if (_frame_fence) {
+        glClientWaitSync(_frame_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000 /* 100 ms */);
+        glDeleteSync(_frame_fence);
+        _frame_fence = 0;
+    }
+}
+
 void gl_thread::set_render(bool r)
 {
+    _wait_mutex.lock();
     _redisplay = r;
-    _render = r;
+    atomic::store_release(&_render, r);
+    _work_cond.wake_one();
+    _wait_mutex.unlock();
 }
 
 void gl_thread::resize(int w, int h)
 {
+    _wait_mutex.lock();
     _w = w;
     _h = h;
+    _work_cond.wake_one();
+    _wait_mutex.unlock();
 }
 
-void gl_thread::activate_next_frame()
+void gl_thread::set_display_span(int x, int y, int span_w, int span_h)
+{
+    _wait_mutex.lock();
+    _span[0] = x;
+    _span[1] = y;
+    _span[2] = span_w;
+    _span[3] = span_h;
+    _span_changed = true;
+    _work_cond.wake_one();
+    _wait_mutex.unlock();
+}
+
+void gl_thread::request_activate_next_frame()
 {
-    if (_failure)
+    if (atomic::load_acquire(&_failure))
         return;
     _wait_mutex.lock();
     _action_finished = false;
     _action_activate = true;
-    while (_action_activate)
-        _wait_cond.wait(_wait_mutex);
-    _action_finished = true;
+    _work_cond.wake_one();
     _wait_mutex.unlock();
 }
 
-void gl_thread::prepare_next_frame(const video_frame &frame, const subtitle_box &subtitle)
+void gl_thread::request_prepare_next_frame(const video_frame &frame, const subtitle_box &subtitle)
 {
-    if (_failure)
+    if (atomic::load_acquire(&_failure))
         return;
     _wait_mutex.lock();
     _next_subtitle = subtitle;
     _next_frame = frame;
     _action_finished = false;
     _action_prepare = true;
-    while (_action_prepare)
+    _work_cond.wake_one();
+    _wait_mutex.unlock();
+}
+
+void gl_thread::wait_for_request()
+{
+    _wait_mutex.lock();
+    while (_action_activate || _action_prepare)
         _wait_cond.wait(_wait_mutex);
     _action_finished = true;
     _wait_mutex.unlock();
 }
 
+void gl_thread::activate_next_frame()
+{
+    request_activate_next_frame();
+    wait_for_request();
+}
+
+void gl_thread::prepare_next_frame(const video_frame &frame, const subtitle_box &subtitle)
+{
+    request_prepare_next_frame(frame, subtitle);
+    wait_for_request();
+}
+
 void gl_thread::redisplay()
 {
+    _wait_mutex.lock();
     _redisplay = true;
+    _work_cond.wake_one();
+    _wait_mutex.unlock();
+}
+
+bool gl_thread::need_reshape() const
+{
+    return (_w > 0 && _h > 0
+            && (_vo_qt->full_display_width() != _w
+                || _vo_qt->full_display_height() != _h));
+}
+
+void gl_thread::update_presentation_timing()
+{
+    int64_t vblank_time = -1;
+    int64_t vblank_period = 0;
+#if HAVE_X11
+    if (GLXEW_OML_sync_control) {
+        Display *dpy = glXGetCurrentDisplay();
+        GLXDrawable drawable = glXGetCurrentDrawable();
+        int64_t ust, msc, sbc;
+        int32_t numerator, denominator;
+        if (glXGetSyncValuesOML(dpy, drawable, &ust, &msc, &sbc)
+                && glXGetMscRateOML(dpy, drawable, &numerator, &denominator)
+                && numerator > 0 && denominator > 0) {
+            // The UST is in microseconds. On Linux, it is taken from the monotonic
+            // clock; reject it if this does not seem to be the case.
+            int64_t now = timer::get(timer::monotonic);
+            if (ust <= now && now - ust < 1000000) {
+                vblank_time = ust;
+                vblank_period = static_cast<int64_t>(denominator) * 1000000 / numerator;
+            }
+        }
+    }
+#endif
+    presentation_timing timing = { vblank_time, vblank_period };
+    _timing.write(timing);
 }
 
 void gl_thread::run()
 {
+    trace::set_thread_track("gl");
     try {
         assert(_vo_qt_widget->context()->isValid());
         _vo_qt_widget->makeCurrent();
         assert(QGLContext::currentContext() == _vo_qt_widget->context());
-        while (_render) {
+        while (atomic::load_acquire(&_render)) {
+            _params.update();
 #if HAVE_X11
             GLuint counter;
-            if (GLXEW_SGI_video_sync && glXGetVideoSyncSGI(&counter) == 0)
+            if (_vo_qt->_swap_barrier_bound
+                    && glXQueryFrameCountNV(glXGetCurrentDisplay(),
+                        DefaultScreen(glXGetCurrentDisplay()), &counter))
+                _display_frameno = counter;     // the same on all systems at the barrier
+            else if (GLXEW_SGI_video_sync && glXGetVideoSyncSGI(&counter) == 0)
                 _display_frameno = counter;
             else
                 _display_frameno++;
@@ -153,17 +259,18 @@ void gl_thread::run()
             // In alternating mode, we should always present both left and right view of
             // a stereo video frame before advancing to the next video frame. This means we
             // can only switch video frames every other output frame.
-            if (dispatch::parameters().stereo_mode() != parameters::mode_alternating
+            if (_params.get().stereo_mode() != parameters::mode_alternating
                     || _display_frameno % 2 == 0) {
                 _wait_mutex.lock();
                 if (_action_activate) {
                     try {
+                        trace_scope activate_trace("activate frame");
                         _vo_qt->video_output::activate_next_frame();
                     }
                     catch (std::exception& e) {
                         _e = e;
-                        _render = false;
-                        _failure = true;
+                        atomic::store_release(&_render, false);
+                        atomic::store_release(&_failure, true);
                     }
                     _action_activate = false;
                     _wait_cond.wake_one();
@@ -176,12 +283,13 @@ void gl_thread::run()
             _wait_mutex.lock();
             if (_action_prepare) {
                 try {
+                    trace_scope prepare_trace("prepare frame");
                     _vo_qt->video_output::prepare_next_frame(_next_frame, _next_subtitle);
                 }
                 catch (std::exception& e) {
                     _e = e;
-                    _render = false;
-                    _failure = true;
+                    atomic::store_release(&_render, false);
+                    atomic::store_release(&_failure, true);
                 }
                 _action_prepare = false;
                 _wait_cond.wake_one();
@@ -189,22 +297,27 @@ void gl_thread::run()
             _wait_mutex.unlock();
             if (_failure)
                 break;
-            if (_w > 0 && _h > 0
-                    && (_vo_qt->full_display_width() != _w
-                        || _vo_qt->full_display_height() != _h)) {
+            _wait_mutex.lock();
+            if (_span_changed) {
+                _vo_qt->set_display_span(_span[0], _span[1], _span[2], _span[3]);
+                _span_changed = false;
+            }
+            bool reshape = need_reshape();
+            _wait_mutex.unlock();
+            if (reshape) {
                 _vo_qt->reshape(_w, _h);
                 _redisplay = true;
             }
             // In alternating mode, we always need to redisplay
-            if (dispatch::parameters().stereo_mode() == parameters::mode_alternating)
+            if (_params.get().stereo_mode() == parameters::mode_alternating)
                 _redisplay = true;
             // If DLP 3-D Ready Sync is active, we always need to redisplay
-            if (dispatch::parameters().fullscreen() && dispatch::parameters().fullscreen_3d_ready_sync()
-                    && (dispatch::parameters().stereo_mode() == parameters::mode_left_right
-                        || dispatch::parameters().stereo_mode() == parameters::mode_left_right_half
-                        || dispatch::parameters().stereo_mode() == parameters::mode_top_bottom
-                        || dispatch::parameters().stereo_mode() == parameters::mode_top_bottom_half
-                        || dispatch::parameters().stereo_mode() == parameters::mode_alternating))
+            if (_params.get().fullscreen() && _params.get().fullscreen_3d_ready_sync()
+                    && (_params.get().stereo_mode() == parameters::mode_left_right
+                        || _params.get().stereo_mode() == parameters::mode_left_right_half
+                        || _params.get().stereo_mode() == parameters::mode_top_bottom
+                        || _params.get().stereo_mode() == parameters::mode_top_bottom_half
+                        || _params.get().stereo_mode() == parameters::mode_alternating))
                 _redisplay = true;
             // Redisplay if necessary
             if (_redisplay) {
@@ -212,18 +325,34 @@ void gl_thread::run()
 #if HAVE_LIBXNVCTRL
                 _vo_qt->sdi_output(_display_frameno);
 #endif // HAVE_LIBXNVCTRL
+                wait_for_frame_fence();
+                int64_t render_start = timer::get(timer::monotonic);
                 _vo_qt->display_current_frame(_display_frameno);
+                _vo_qt->share_frame(_display_frameno);
+                int64_t swap_start = timer::get(timer::monotonic);
                 _vo_qt_widget->swapBuffers();
-            } else if (!dispatch::parameters().benchmark()) {
-                // do not busy loop
-                usleep(1000);
+                int64_t swap_end = timer::get(timer::monotonic);
+                trace::add("display frame", render_start, swap_start);
+                trace::add("swap buffers", swap_start, swap_end);
+                benchmark_stats::add(benchmark_stats::render, swap_start - render_start);
+                benchmark_stats::add(benchmark_stats::swap, swap_end - swap_start);
+                if (GLEW_ARB_sync)
+                    _frame_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                update_presentation_timing();
+            } else if (!_params.get().benchmark()) {
+                // Sleep until there is something to do. The timeout is only a
+                // safety net; all requests wake this thread up.
+                _wait_mutex.lock();
+                if (_render && !_redisplay && !_action_activate && !_action_prepare && !_span_changed && !need_reshape())
+                    _work_cond.wait(_wait_mutex, 100000);
+                _wait_mutex.unlock();
             }
         }
     }
     catch (std::exception& e) {
         _e = e;
-        _render = false;
-        _failure = true;
+        atomic::store_release(&_render, false);
+        atomic::store_release(&_failure, true);
     }
     _wait_mutex.lock();
     if (_action_activate || _action_prepare) {
@@ -234,6 +363,10 @@ void gl_thread::run()
         }
     }
     _wait_mutex.unlock();
+    if (_frame_fence) {
+        glDeleteSync(_frame_fence);
+        _frame_fence = 0;
+    }
     _vo_qt_widget->doneCurrent();
 #if QT_VERSION >= 0x050000
     _vo_qt_widget->context()->moveToThread(QCoreApplication::instance()->thread());
@@ -242,10 +375,29 @@ void gl_thread::run()
 
 int64_t gl_thread::time_to_next_frame_presentation()
 {
-    // TODO: return a good estimate of the number of microseconds that will
-    // pass until the next buffer swap completes. For now, just assume that
-    // the next frame will display immediately.
-    return 0;
+    presentation_timing timing = _timing.read();
+    int64_t vblank_time = timing.vblank_time;
+    int64_t vblank_period = timing.vblank_period;
+    if (vblank_time < 0 || vblank_period <= 0 || dispatch::parameters().swap_interval() <= 0) {
+        // No timing information: assume that the next frame will display immediately.
+        return 0;
+    }
+    // A frame that is activated now is drawn in the next iteration of the GL
+    // thread and becomes visible at the first vertical blank after its buffer
+    // swap. Leave a quarter of the refresh period for drawing it.
+    int64_t now = timer::get(timer::monotonic);
+    int64_t next_vblank = vblank_time + vblank_period * dispatch::parameters().swap_interval();
+    if (next_vblank < now + vblank_period / 4)
+        next_vblank += (now + vblank_period / 4 - next_vblank) / vblank_period * vblank_period + vblank_period;
+    return next_vblank - now;
+}
+
+int64_t gl_thread::presentation_period()
+{
+    presentation_timing timing = _timing.read();
+    if (timing.vblank_time < 0 || timing.vblank_period <= 0 || dispatch::parameters().swap_interval() <= 0)
+        return 0;
+    return timing.vblank_period * dispatch::parameters().swap_interval();
 }
 
 /* The GL widget */
@@ -462,6 +614,9 @@ void video_output_qt_widget::keyPressEvent(QKeyEvent *event)
 #endif
         _vo->send_cmd(command::toggle_audio_mute);
         break;
+    case Qt::Key_I:
+        _vo->send_cmd(command::toggle_stats_overlay);
+        break;
     case Qt::Key_Left:
         _vo->send_cmd(command::seek, -10.0f);
         break;
@@ -509,7 +664,7 @@ void video_output_qt_widget::focusOutEvent(QFocusEvent *)
 /* Our own video container widget, used in case that the video_output_qt
  * constructor is called without an external container widget. */
 
-video_container_widget::video_container_widget(QWidget *parent) : QWidget(parent), _w(64), _h(64)
+video_container_widget::video_container_widget(QWidget *parent) : QWidget(parent), _w(64), _h(64), _timer(NULL)
 {
     setWindowIcon(QIcon(":logo/bino/64x64/bino.png"));
     // Set minimum size > 0 so that the container is always visible
@@ -535,6 +690,8 @@ void video_container_widget::playloop_step()
     try {
         dispatch::step();
         dispatch::process_all_events();
+        // GUI events are handled immediately anyway; only polling can wait.
+        _timer->setInterval(dispatch::idle() ? 100 : 0);
     }
     catch (std::exception& e) {
         send_cmd(command::close);
@@ -588,7 +745,9 @@ video_output_qt::video_output_qt(video_container_widget *container_widget) :
     _fullscreen(false),
     _screensaver_inhibited(false),
     _recreate_context(false),
-    _recreate_context_stereo(false)
+    _recreate_context_stereo(false),
+    _swap_group_joined(false),
+    _swap_barrier_bound(false)
 {
     if (!_container_widget)
     {
@@ -663,6 +822,7 @@ void video_output_qt::init()
             throw exc(std::string(_("This OpenGL implementation does not support required features.")));
         }
         video_output::init();
+        join_swap_group();
         video_output::clear();
         // Initialize GL things
         glMatrixMode(GL_PROJECTION);
@@ -732,6 +892,7 @@ void video_output_qt::deinit()
         try {
             _widget->stop_rendering();
             _widget->makeCurrent();
+            leave_swap_group();
             video_output::deinit();
         }
         catch (std::exception& e) {
@@ -742,6 +903,59 @@ void video_output_qt::deinit()
     }
 }
 
+/* NV swap groups synchronize the buffer swaps of all windows in the group,
+ * e.g. of several Bino instances that drive one projector each. Binding the
+ * group to a swap barrier extends this to all systems connected by frame lock
+ * hardware. With a barrier, the frame counter of the frame lock hardware is
+ * used to choose the view in alternating mode, so that the phase of the views
+ * is the same on all projectors. */
+void video_output_qt::join_swap_group()
+{
+#if HAVE_X11
+    GLuint group = dispatch::parameters().swap_group();
+    GLuint barrier = dispatch::parameters().swap_barrier();
+    if (group == 0 || _swap_group_joined)
+        return;
+    if (!GLXEW_NV_swap_group) {
+        msg::wrn(_("Cannot join swap group: GLX_NV_swap_group is not supported."));
+        return;
+    }
+    Display *dpy = glXGetCurrentDisplay();
+    GLXDrawable drawable = glXGetCurrentDrawable();
+    GLuint max_groups = 0, max_barriers = 0;
+    glXQueryMaxSwapGroupsNV(dpy, DefaultScreen(dpy), &max_groups, &max_barriers);
+    if (group > max_groups || !glXJoinSwapGroupNV(dpy, drawable, group)) {
+        msg::wrn(_("Cannot join swap group %u."), group);
+        return;
+    }
+    _swap_group_joined = true;
+    msg::inf(_("Joined swap group %u."), group);
+    if (barrier > 0) {
+        if (barrier > max_barriers || !glXBindSwapBarrierNV(dpy, group, barrier)) {
+            msg::wrn(_("Cannot bind swap group %u to swap barrier %u."), group, barrier);
+        } else {
+            _swap_barrier_bound = true;
+            msg::inf(_("Bound swap group %u to swap barrier %u."), group, barrier);
+        }
+    }
+#endif
+}
+
+void video_output_qt::leave_swap_group()
+{
+#if HAVE_X11
+    Display *dpy = glXGetCurrentDisplay();
+    if (_swap_barrier_bound) {
+        glXBindSwapBarrierNV(dpy, dispatch::parameters().swap_group(), 0);
+        _swap_barrier_bound = false;
+    }
+    if (_swap_group_joined) {
+        glXJoinSwapGroupNV(dpy, glXGetCurrentDrawable(), 0);
+        _swap_group_joined = false;
+    }
+#endif
+}
+
 void video_output_qt::create_widget()
 {
     _widget = new video_output_qt_widget(this, _format, _container_widget);
@@ -972,10 +1186,11 @@ void video_output_qt::enter_fullscreen()
         int screens = dispatch::parameters().fullscreen_screens();
         int screen_count = 0;
         QRect geom;
+        QRect first_geom;
         for (int i = 0; i < std::min(QApplication::desktop()->screenCount(), 16); i++) {
             if (screens & (1 << i)) {
                 if (geom.isNull())
-                    geom = QApplication::desktop()->screenGeometry(i);
+                    geom = first_geom = QApplication::desktop()->screenGeometry(i);
                 else
                     geom = geom.united(QApplication::desktop()->screenGeometry(i));
                 screen_count++;
@@ -985,6 +1200,8 @@ void video_output_qt::enter_fullscreen()
             // Use default screen
             geom = QApplication::desktop()->screenGeometry(-1);
         }
+        // In per-screen mode, our own window only covers the first screen.
+        bool per_screen = (screen_count > 1 && dispatch::parameters().fullscreen_per_screen());
         Qt::WindowFlags new_window_flags =
             _container_widget->windowFlags()
             | Qt::FramelessWindowHint
@@ -994,11 +1211,11 @@ void video_output_qt::enter_fullscreen()
         // the window manager would always restrict the fullscreen window to one screen.
         // Note: it may be better to set _NET_WM_FULLSCREEN_MONITORS ourselves, but that
         // would also require the window manager to support this extension...
-        if (screen_count > 1)
+        if (screen_count > 1 && !per_screen)
             new_window_flags |= Qt::X11BypassWindowManagerHint;
         _container_widget->setWindowFlags(new_window_flags);
         _container_widget->setWindowState(_container_widget->windowState() | Qt::WindowFullScreen);
-        _container_widget->setGeometry(geom);
+        _container_widget->setGeometry(per_screen ? first_geom : geom);
         _container_widget->setCursor(Qt::BlankCursor);
         _container_widget->show();
         _container_widget->raise();
@@ -1017,6 +1234,8 @@ void video_output_qt::enter_fullscreen()
             XFlush(QX11Info::display());
         }
 #endif
+        if (per_screen)
+            open_screen_outputs(screens, geom);
         _container_widget->grab_focus();
         // Suspend the screensaver after going fullscreen, so that our window ID
         // represents the fullscreen window. We need to have the same ID for resume.
@@ -1043,6 +1262,7 @@ void video_output_qt::exit_fullscreen()
             resume_screensaver();
             _screensaver_inhibited = false;
         }
+        close_screen_outputs();
         // Re-embed the container widget into the main window if necessary
         if (_container_is_external)
             _container_widget->setWindowFlags(Qt::Widget);
@@ -1064,16 +1284,92 @@ void video_output_qt::exit_fullscreen()
     }
 }
 
+void video_output_qt::open_screen_outputs(int screens, const QRect& span)
+{
+    bool first = true;
+    for (int i = 0; i < std::min(QApplication::desktop()->screenCount(), 16); i++) {
+        if (!(screens & (1 << i)))
+            continue;
+        QRect geom = QApplication::desktop()->screenGeometry(i);
+        if (first) {
+            // This is the screen that our own window covers.
+            _widget->gl_thread()->set_display_span(geom.x() - span.x(), geom.y() - span.y(),
+                    span.width(), span.height());
+            first = false;
+            continue;
+        }
+        // The additional windows bypass the window manager so that it does not
+        // move them. They do not accept input: all key and mouse handling stays
+        // with our own window, which also means that they can never destroy
+        // themselves from inside their own event handlers.
+        video_container_widget *container = new video_container_widget(NULL);
+        container->setWindowFlags(Qt::Window
+                | Qt::FramelessWindowHint
+                | Qt::WindowStaysOnTopHint
+                | Qt::X11BypassWindowManagerHint);
+        container->setAttribute(Qt::WA_TransparentForMouseEvents);
+        container->setGeometry(geom);
+        container->setCursor(Qt::BlankCursor);
+        container->show();
+        video_output_qt *vo = new video_output_qt(container);
+        vo->_format = _format;
+        _screen_outputs.push_back(vo);
+        vo->init();
+        vo->_widget->setFocusPolicy(Qt::NoFocus);
+        vo->_widget->gl_thread()->set_display_span(geom.x() - span.x(), geom.y() - span.y(),
+                span.width(), span.height());
+        vo->start_subtitle_renderer();
+    }
+    msg::inf(_("Using %d outputs for fullscreen mode."), static_cast<int>(_screen_outputs.size()) + 1);
+}
+
+void video_output_qt::close_screen_outputs()
+{
+    for (size_t i = 0; i < _screen_outputs.size(); i++) {
+        video_container_widget *container = _screen_outputs[i]->_container_widget;
+        _screen_outputs[i]->deinit();
+        delete _screen_outputs[i];
+        delete container;
+    }
+    if (!_screen_outputs.empty() && _widget)
+        _widget->gl_thread()->set_display_span(0, 0, 0, 0);
+    _screen_outputs.clear();
+}
+
+void video_output_qt::set_upcoming_subtitle(const subtitle_box &subtitle)
+{
+    // The GL threads read this while they prepare the next frame, which is
+    // requested after this call.
+    for (size_t i = 0; i < _screen_outputs.size(); i++)
+        _screen_outputs[i]->video_output::set_upcoming_subtitle(subtitle);
+    video_output::set_upcoming_subtitle(subtitle);
+}
+
 void video_output_qt::prepare_next_frame(const video_frame &frame, const subtitle_box &subtitle)
 {
-    if (_widget)
-        _widget->gl_thread()->prepare_next_frame(frame, subtitle);
+    if (_widget) {
+        // Let all GL threads prepare the frame in parallel. The additional
+        // outputs skip subtitles until their subtitle renderer is ready.
+        for (size_t i = 0; i < _screen_outputs.size(); i++)
+            _screen_outputs[i]->_widget->gl_thread()->request_prepare_next_frame(frame,
+                    _screen_outputs[i]->subtitle_renderer_is_initialized() ? subtitle : subtitle_box());
+        _widget->gl_thread()->request_prepare_next_frame(frame, subtitle);
+        _widget->gl_thread()->wait_for_request();
+        for (size_t i = 0; i < _screen_outputs.size(); i++)
+            _screen_outputs[i]->_widget->gl_thread()->wait_for_request();
+    }
 }
 
 void video_output_qt::activate_next_frame()
 {
-    if (_widget)
-        _widget->gl_thread()->activate_next_frame();
+    if (_widget) {
+        for (size_t i = 0; i < _screen_outputs.size(); i++)
+            _screen_outputs[i]->_widget->gl_thread()->request_activate_next_frame();
+        _widget->gl_thread()->request_activate_next_frame();
+        _widget->gl_thread()->wait_for_request();
+        for (size_t i = 0; i < _screen_outputs.size(); i++)
+            _screen_outputs[i]->_widget->gl_thread()->wait_for_request();
+    }
 }
 
 int64_t video_output_qt::time_to_next_frame_presentation() const
@@ -1081,16 +1377,34 @@ int64_t video_output_qt::time_to_next_frame_presentation() const
     return (_widget ? _widget->gl_thread()->time_to_next_frame_presentation() : 0);
 }
 
+int64_t video_output_qt::presentation_period() const
+{
+    return (_widget ? _widget->gl_thread()->presentation_period() : 0);
+}
+
 void video_output_qt::process_events()
 {
     if (_recreate_context) {
-        // To prevent recursion, we must unset this flag first: deinit() and init()
-        // cause more calls to process_events().
-        _widget->stop_rendering();
-        _recreate_context = false;
-        deinit();
-        _format.setStereo(_recreate_context_stereo);
-        init();
+        // The player thread must not use the widget while it is recreated.
+        global_dispatch->lock_player();
+        try {
+            // To prevent recursion, we must unset this flag first: deinit() and init()
+            // cause more calls to process_events().
+            _widget->stop_rendering();
+            _recreate_context = false;
+            deinit();
+            _format.setStereo(_recreate_context_stereo);
+            init();
+        }
+        catch (...) {
+            global_dispatch->unlock_player();
+            throw;
+        }
+        global_dispatch->unlock_player();
+    }
+    for (size_t i = 0; i < _screen_outputs.size(); i++) {
+        if (_screen_outputs[i]->_recreate_context)
+            _screen_outputs[i]->process_events();
     }
     QApplication::sendPostedEvents();
     QApplication::processEvents();
@@ -27,6 +27,8 @@
 
 #include <QWidget>
 #include <QGLWidget>
+#include <vector>
+
 #include <QGLFormat>
 #include <QTimer>
 #include <QThread>
@@ -51,20 +53,39 @@ class gl_thread : public QThread
 private:
     video_output_qt* _vo_qt;
     video_output_qt_widget* _vo_qt_widget;
-    bool _render;
+    bool _render;                       // accessed atomically
     int _w, _h;
     mutex _wait_mutex;
-    condition _wait_cond;
+    condition _wait_cond;               // signals finished actions to the requesting thread
+    condition _work_cond;               // signals new requests to the GL thread
     bool _action_activate;
     bool _action_prepare;
     bool _action_finished;
     bool _redisplay;
+    int _span[4];                       // requested display span, see video_output::set_display_span()
+    bool _span_changed;
     video_frame _next_frame;
     subtitle_box _next_subtitle;
-    bool _failure;
+    bool _failure;                      // accessed atomically
     exc _e;
+    // The parameters, updated once per iteration of the rendering loop
+    parameters_ref _params;
     // The display frame number
     int64_t _display_frameno;
+    // Fence behind the commands of the last displayed frame, if supported
+    GLsync _frame_fence;
+    // Presentation timing, from the last vertical blank reported by the
+    // GLX_OML_sync_control extension if it is available
+    struct presentation_timing
+    {
+        int64_t vblank_time;            // monotonic time of the last vertical blank, or -1
+        int64_t vblank_period;          // refresh period in microseconds, or 0 if unknown
+    };
+    seqlock<presentation_timing> _timing;
+
+    void wait_for_frame_fence();
+    bool need_reshape() const;
+    void update_presentation_timing();
 
 public:
     gl_thread(video_output_qt* vo_qt, video_output_qt_widget* vo_qt_widget);
@@ -73,21 +94,30 @@ public:
 # if HAVE_X11
     GLXEWContext* glxewGetContext() const;
 # endif
+    GLEWContext* glewGetContext() const;
 #endif
 
     void set_render(bool r);
     void resize(int w, int h);
+    void set_display_span(int x, int y, int span_w, int span_h);
+    // The request functions return immediately; wait_for_request() blocks until
+    // the GL thread has handled the request. This allows several GL threads to
+    // work on the same frame in parallel.
+    void request_activate_next_frame();
+    void request_prepare_next_frame(const video_frame &frame, const subtitle_box &subtitle);
+    void wait_for_request();
     void activate_next_frame();
     void prepare_next_frame(const video_frame &frame, const subtitle_box &subtitle);
     void redisplay();
 
     int64_t time_to_next_frame_presentation();
+    int64_t presentation_period();
 
     void run();
 
     bool failure() const
     {
-        return _failure;
+        return atomic::load_acquire(&_failure);
     }
     const exc& exception() const
     {
@@ -185,11 +215,24 @@ private:
     bool _screensaver_inhibited;
     bool _recreate_context;
     bool _recreate_context_stereo;
+    bool _swap_group_joined;
+    bool _swap_barrier_bound;
+    // In per-screen fullscreen mode, our window covers the first screen, and
+    // each additional screen gets its own output with its own GL context and thread.
+    std::vector<video_output_qt*> _screen_outputs;
 #ifdef Q_OS_MAC
     unsigned int _disableDisplaySleepAssertion;
 #endif
 
     void create_widget();
+    // Join or leave the swap group and barrier given in the parameters, if any.
+    // The GL context must be current.
+    void join_swap_group();
+    void leave_swap_group();
+    // Create or destroy the outputs for the additional screens in per-screen
+    // fullscreen mode. The span is the combined geometry of all screens.
+    void open_screen_outputs(int screens, const QRect& span);
+    void close_screen_outputs();
     void mouse_set_pos(float dest);
     void mouse_toggle_fullscreen();
     void suspend_screensaver();
@@ -232,9 +275,11 @@ public:
     virtual void enter_fullscreen();
     virtual void exit_fullscreen();
 
+    virtual void set_upcoming_subtitle(const subtitle_box &subtitle);
     virtual void prepare_next_frame(const video_frame &frame, const subtitle_box &subtitle);
     virtual void activate_next_frame();
     virtual int64_t time_to_next_frame_presentation() const;
+    virtual int64_t presentation_period() const;
 
     virtual void process_events();
     virtual void receive_notification(const notification& note);
@@ -20,6 +20,7 @@
  */
 
 #version 110
+$extensions
 
 // quality: 0 .. 4
 #define quality $quality
@@ -56,8 +57,14 @@
 // ghostbust_disabled
 #define $ghostbust
 
+// input_rgb: read the color textures of the color conversion pass
+// input_fused: read the input textures and convert them here
+#define $input
+
+#if defined(input_rgb)
 uniform sampler2D rgb_l;
 uniform sampler2D rgb_r;
+#endif
 uniform float parallax;
 uniform float vertical_shift_left;
 uniform float vertical_shift_right;
@@ -95,17 +102,16 @@ float srgb_to_lum(vec3 srgb)
 #endif
 
 #if quality >= 4
-// Correct variant, see GL_ARB_framebuffer_sRGB extension
-float linear_to_nonlinear(float x)
-{
-    return (x <= 0.0031308 ? (x * 12.92) : (1.055 * pow(x, 1.0 / 2.4) - 0.055));
-}
+// Correct variant, see GL_ARB_framebuffer_sRGB extension. The transfer
+// function is precomputed in a table; see video_output::transfer_lut_bind().
+uniform sampler1D to_srgb_lut;
 vec3 rgb_to_srgb(vec3 rgb)
 {
-    float sr = linear_to_nonlinear(rgb.r);
-    float sg = linear_to_nonlinear(rgb.g);
-    float sb = linear_to_nonlinear(rgb.b);
-    return vec3(sr, sg, sb);
+    vec3 t = rgb * (($transfer_lut_size - 1.0) / $transfer_lut_size) + 0.5 / $transfer_lut_size;
+    return vec3(
+            texture1D(to_srgb_lut, t.r).x,
+            texture1D(to_srgb_lut, t.g).x,
+            texture1D(to_srgb_lut, t.b).x);
 }
 #elif quality >= 2
 vec3 rgb_to_srgb(vec3 rgb)
@@ -145,6 +151,32 @@ vec3 adjust_color(vec3 rgb)
 #  define adjust_color(rgb) rgb
 #endif
 
+#if defined(input_fused)
+// The functions of the color conversion pass (video_output_color.fs.glsl)
+$color_functions
+
+vec3 get_rgb(vec2 texcoord)
+{
+    // The input textures are upside down compared to the color textures.
+    // The clamping matches the storage of the color textures.
+    vec3 srgb = clamp(get_srgb(vec2(texcoord.x, 1.0 - texcoord.y)), 0.0, 1.0);
+# if defined(storage_srgb)
+    return srgb;
+# else
+    return srgb_to_rgb(srgb);
+# endif
+}
+
+// Only the input textures of the view that is currently drawn are bound
+vec3 tex_l(vec2 texcoord)
+{
+    return adjust_color(get_rgb(texcoord + vec2(parallax, vertical_shift_left)));
+}
+vec3 tex_r(vec2 texcoord)
+{
+    return adjust_color(get_rgb(texcoord + vec2(-parallax, vertical_shift_right)));
+}
+#else
 vec3 tex_l(vec2 texcoord)
 {
     return adjust_color(texture2D(rgb_l, texcoord + vec2(parallax, vertical_shift_left)).rgb);
@@ -153,6 +185,7 @@ vec3 tex_r(vec2 texcoord)
 {
     return adjust_color(texture2D(rgb_r, texcoord + vec2(-parallax, vertical_shift_right)).rgb);
 }
+#endif
 
 #if defined(subtitle_enabled)
 vec4 sub_l(vec2 texcoord)
@@ -176,7 +209,15 @@ void main()
     vec3 l, r;
     vec3 srgb;
 
-#if defined(mode_onechannel)
+#if defined(mode_onechannel) && defined(input_fused)
+
+    // No ghostbusting in this case, so only the current view is needed
+    if (channel < 0.5)
+        srgb = rgb_to_srgb(blend_subtitle(tex_l(gl_TexCoord[0].xy), sub_l(gl_TexCoord[0].xy)));
+    else
+        srgb = rgb_to_srgb(blend_subtitle(tex_r(gl_TexCoord[1].xy), sub_r(gl_TexCoord[1].xy)));
+
+#elif defined(mode_onechannel)
 
     l = blend_subtitle(tex_l(gl_TexCoord[0].xy), sub_l(gl_TexCoord[0].xy));
     r = blend_subtitle(tex_r(gl_TexCoord[1].xy), sub_r(gl_TexCoord[1].xy));
@@ -0,0 +1,37 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010, 2011, 2012
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#version 110
+
+// The quad is transformed by the current matrices, which are the identity
+// except when the Equalizer output places the video in 3D space.
+
+attribute vec2 position;
+attribute vec2 texcoord0;   // left view
+attribute vec2 texcoord1;   // right view
+attribute vec2 texcoord2;   // mask, for the masking modes
+
+void main()
+{
+    gl_Position = gl_ModelViewProjectionMatrix * vec4(position, 0.0, 1.0);
+    gl_TexCoord[0] = vec4(texcoord0, 0.0, 1.0);
+    gl_TexCoord[1] = vec4(texcoord1, 0.0, 1.0);
+    gl_TexCoord[2] = vec4(texcoord2, 0.0, 1.0);
+}